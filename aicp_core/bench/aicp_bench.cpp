@@ -0,0 +1,357 @@
+// Stage-level benchmark of the AICP kernels:
+//  pre-filter (serial, parallel), octree overlap, FOV overlap, alignability,
+//  alignment risk (SVM), registration and PCL <-> DataPoints conversions.
+// Each kernel runs on consecutive pairs of input clouds (bundled data by default,
+// or a session recorded with write_input_clouds_to_file), results written as JSON.
+
+// Run: rosrun aicp_core aicp_bench [options]
+//  --config <aicp_config.yaml>     parameters of the kernels (default: config/aicp_config.yaml)
+//  --session <folder>              recorded session (aicp_input_clouds.aicplog or pcd files)
+//  --clouds <a.vtk,b.vtk,...>      input clouds (default: data/cloud_0*.vtk)
+//  --max-clouds <n>                clouds used from the session (default: 10)
+//  --kernels <prefilter,icp,...>   kernels to run (default: all)
+//  --repetitions <n>               timed runs per kernel and input (default: 5)
+//  --output <file.json>            results file (default: aicp_bench.json)
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <sstream>
+#include <thread>
+
+#include "aicp_registration/registration.hpp"
+#include "aicp_registration/yaml_configurator.hpp"
+#include "aicp_overlap/overlap.hpp"
+#include "aicp_classification/classification.hpp"
+#include "aicp_utils/cloudIO.h"
+#include "aicp_utils/cloudLog.hpp"
+#include "aicp_utils/filteringUtils.hpp"
+#include "aicp_utils/textCloudReader.hpp"
+#include "aicp_utils/poseFileReader.hpp"
+#include "aicp_utils/timing.hpp"
+
+using namespace std;
+using namespace aicp;
+
+struct BenchInput
+{
+  string name;
+  pcl::PointCloud<pcl::PointXYZ>::Ptr cloud;
+  Eigen::Isometry3d pose;
+  // Pre-filtered (input of the other kernels)
+  pcl::PointCloud<pcl::PointXYZ>::Ptr filtered;
+};
+
+struct BenchResult
+{
+  string kernel;
+  string input;
+  size_t nb_points;
+  vector<double> times; // seconds
+};
+
+static vector<string> splitList(const string& list)
+{
+  vector<string> items;
+  stringstream ss(list);
+  string item;
+  while (getline(ss, item, ','))
+    if (!item.empty())
+      items.push_back(item);
+  return items;
+}
+
+static bool loadClouds(const vector<string>& files, vector<BenchInput>& inputs)
+{
+  for (size_t i = 0; i < files.size(); i++)
+  {
+    BenchInput input;
+    input.name = files[i].substr(files[i].find_last_of('/') + 1);
+    input.cloud.reset(new pcl::PointCloud<pcl::PointXYZ>);
+    input.pose = Eigen::Isometry3d::Identity();
+    string extension = files[i].substr(files[i].find_last_of('.') + 1);
+    if (extension == "pcd")
+    {
+      if (pcl::io::loadPCDFile<pcl::PointXYZ>(files[i], *input.cloud) == -1)
+        return false;
+    }
+    else if (!readTextCloud(files[i], *input.cloud))
+    {
+      // other libpointmatcher formats (e.g. binary vtk)
+      DP cloud = DP::load(files[i]);
+      fromDataPointsToPCL(cloud, *input.cloud);
+    }
+    inputs.push_back(input);
+  }
+  return true;
+}
+
+static bool loadSession(const string& folder, size_t max_clouds, vector<BenchInput>& inputs)
+{
+  string log_file = folder + "/aicp_input_clouds.aicplog";
+  CloudLogReader log;
+  if (ifstream(log_file.c_str()).good())
+  {
+    if (!log.open(log_file))
+      return false;
+    for (size_t i = 0; i < log.size() && i < max_clouds; i++)
+    {
+      BenchInput input;
+      input.name = "record_" + to_string(i);
+      input.cloud.reset(new pcl::PointCloud<pcl::PointXYZ>);
+      input.pose = log.getPose(i);
+      if (!log.readCloud(i, *input.cloud))
+        return false;
+      inputs.push_back(input);
+    }
+    return true;
+  }
+
+  vector<IsometryWithTime> poses;
+  PoseFileReader reader;
+  reader.readPoseFile(folder + "/aicp_input_poses.csv", poses);
+  for (size_t i = 0; i < poses.size() && i < max_clouds; i++)
+  {
+    stringstream file;
+    file << folder << "/cloud_" << poses[i].counter << "_" << poses[i].sec << "_" << poses[i].nsec << ".pcd";
+    BenchInput input;
+    input.name = "record_" + to_string(i);
+    input.cloud.reset(new pcl::PointCloud<pcl::PointXYZ>);
+    input.pose = poses[i].pose;
+    if (pcl::io::loadPCDFile<pcl::PointXYZ>(file.str(), *input.cloud) == -1)
+      return false;
+    inputs.push_back(input);
+  }
+  return !inputs.empty();
+}
+
+// One untimed run (warm-up: caches, lazy allocations), then repetitions timed runs
+static void runKernel(const string& kernel, const string& input, size_t nb_points, int repetitions,
+                      const function<void()>& run, vector<BenchResult>& results)
+{
+  typedef chrono::steady_clock Clock;
+  BenchResult result;
+  result.kernel = kernel;
+  result.input = input;
+  result.nb_points = nb_points;
+  run();
+  for (int r = 0; r < repetitions; r++)
+  {
+    Clock::time_point start = Clock::now();
+    run();
+    result.times.push_back(chrono::duration<double>(Clock::now() - start).count());
+  }
+  results.push_back(result);
+  cerr << "[Bench] " << kernel << " (" << input << "): "
+       << *min_element(result.times.begin(), result.times.end()) << " s (min)" << endl;
+}
+
+static void writeJSON(ostream& out, const string& config_file, int repetitions,
+                      const vector<BenchResult>& results)
+{
+  out << "{\n  \"context\": {\n"
+      << "    \"date\": \"" << TimingUtils::currentDateTime() << "\",\n"
+      << "    \"config\": \"" << config_file << "\",\n"
+      << "    \"hardware_threads\": " << thread::hardware_concurrency() << ",\n"
+      << "    \"repetitions\": " << repetitions << "\n  },\n"
+      << "  \"benchmarks\": [";
+  for (size_t i = 0; i < results.size(); i++)
+  {
+    vector<double> times = results[i].times;
+    sort(times.begin(), times.end());
+    double mean = 0.0;
+    for (size_t t = 0; t < times.size(); t++)
+      mean += times[t] / times.size();
+    out << (i > 0 ? "," : "") << "\n    {\"name\": \"" << results[i].kernel << "/" << results[i].input << "\", "
+        << "\"kernel\": \"" << results[i].kernel << "\", \"input\": \"" << results[i].input << "\", "
+        << "\"points\": " << results[i].nb_points << ", "
+        << "\"min_s\": " << times.front() << ", \"median_s\": " << times[times.size() / 2] << ", "
+        << "\"mean_s\": " << mean << ", \"max_s\": " << times.back() << "}";
+  }
+  out << "\n  ]\n}" << endl;
+}
+
+int main(int argc, char** argv)
+{
+  string config_file = AICP_BENCH_CONFIG_FILE;
+  string session;
+  vector<string> cloud_files;
+  for (int i = 0; i < 3; i++)
+    cloud_files.push_back(string(AICP_BENCH_DATA_DIR) + "/cloud_0" + to_string(i) + ".vtk");
+  size_t max_clouds = 10;
+  vector<string> kernels = splitList("prefilter,prefilter_parallel,octree_overlap,fov_overlap,"
+                                     "alignability,svm,icp,pcl_to_dp,dp_to_pcl");
+  int repetitions = 5;
+  string output_file = "aicp_bench.json";
+
+  for (int i = 1; i + 1 < argc; i += 2)
+  {
+    string option = argv[i];
+    if (option == "--config")
+      config_file = argv[i + 1];
+    else if (option == "--session")
+      session = argv[i + 1];
+    else if (option == "--clouds")
+      cloud_files = splitList(argv[i + 1]);
+    else if (option == "--max-clouds")
+      max_clouds = max(atoi(argv[i + 1]), 2);
+    else if (option == "--kernels")
+      kernels = splitList(argv[i + 1]);
+    else if (option == "--repetitions")
+      repetitions = max(atoi(argv[i + 1]), 1);
+    else if (option == "--output")
+      output_file = argv[i + 1];
+    else
+    {
+      cerr << "[Bench] Unknown option " << option << " (see the header of aicp_bench.cpp)." << endl;
+      return -1;
+    }
+  }
+
+  YAMLConfigurator yaml_conf;
+  if (!yaml_conf.parse(config_file))
+  {
+    cerr << "ERROR: could not parse file " << config_file << endl;
+    return -1;
+  }
+  RegistrationParams reg_params = yaml_conf.getRegistrationParams();
+  OverlapParams overlap_params = yaml_conf.getOverlapParams();
+  ClassificationParams class_params = yaml_conf.getClassificationParams();
+
+  vector<BenchInput> inputs;
+  bool loaded = session.empty() ? loadClouds(cloud_files, inputs) : loadSession(session, max_clouds, inputs);
+  if (!loaded || inputs.size() < 2)
+  {
+    cerr << "ERROR: could not load at least two input clouds." << endl;
+    return -1;
+  }
+  for (size_t i = 0; i < inputs.size(); i++)
+  {
+    inputs[i].filtered.reset(new pcl::PointCloud<pcl::PointXYZ>);
+    regionGrowingUniformPlaneSegmentationFilter(inputs[i].cloud, inputs[i].filtered, reg_params.prefilter.leafSize);
+  }
+
+  unique_ptr<AbstractRegistrator> registrator = create_registrator(reg_params);
+  unique_ptr<AbstractOverlapper> overlapper = create_overlapper(overlap_params);
+  unique_ptr<AbstractClassification> classifier = create_classifier(class_params);
+
+  vector<BenchResult> results;
+  for (size_t k = 0; k < kernels.size(); k++)
+  {
+    const string& kernel = kernels[k];
+    for (size_t i = 0; i < inputs.size(); i++)
+    {
+      BenchInput& reading = inputs[i];
+      // Pair kernels: previous cloud as reference
+      BenchInput& reference = inputs[i > 0 ? i - 1 : 0];
+      string pair_name = reference.name + "-" + reading.name;
+
+      if (kernel == "prefilter")
+      {
+        pcl::PointCloud<pcl::PointXYZ>::Ptr filtered (new pcl::PointCloud<pcl::PointXYZ>);
+        runKernel(kernel, reading.name, reading.cloud->size(), repetitions, [&]()
+        {
+          regionGrowingUniformPlaneSegmentationFilter(reading.cloud, filtered, reg_params.prefilter.leafSize);
+        }, results);
+      }
+      else if (kernel == "prefilter_parallel")
+      {
+        pcl::PointCloud<pcl::PointXYZ>::Ptr filtered (new pcl::PointCloud<pcl::PointXYZ>);
+        SegmentedCloud segmented;
+        runKernel(kernel, reading.name, reading.cloud->size(), repetitions, [&]()
+        {
+          parallelRegionGrowingUniformPlaneSegmentationFilter(reading.cloud, filtered, reading.pose, segmented,
+                                                              reg_params.prefilter.numThreads,
+                                                              reg_params.prefilter.leafSize);
+        }, results);
+      }
+      else if (kernel == "pcl_to_dp")
+      {
+        DP cloud;
+        runKernel(kernel, reading.name, reading.cloud->size(), repetitions, [&]()
+        {
+          fromPCLToDataPoints(cloud, *reading.cloud);
+        }, results);
+      }
+      else if (kernel == "dp_to_pcl")
+      {
+        DP cloud;
+        fromPCLToDataPoints(cloud, *reading.cloud);
+        pcl::PointCloud<pcl::PointXYZ> cloud_out;
+        runKernel(kernel, reading.name, reading.cloud->size(), repetitions, [&]()
+        {
+          fromDataPointsToPCL(cloud, cloud_out);
+        }, results);
+      }
+      else if (i == 0)
+        continue;
+      else if (kernel == "octree_overlap")
+      {
+        runKernel(kernel, pair_name, reading.filtered->size(), repetitions, [&]()
+        {
+          // Reference tree re-built at each run (reference_id -1)
+          ColorOcTree read_tree (overlap_params.octree_based.octomapResolution);
+          overlapper->computeOverlap(*reference.filtered, *reading.filtered, reference.pose, reading.pose,
+                                     &read_tree, -1);
+        }, results);
+      }
+      else if (kernel == "fov_overlap")
+      {
+        vector<int> overlap_reference, overlap_reading;
+        runKernel(kernel, pair_name, reading.filtered->size(), repetitions, [&]()
+        {
+          overlapFilter(*reference.filtered, *reading.filtered, reference.pose, reading.pose,
+                        reg_params.sensorRange, reg_params.sensorAngularView, overlap_reference, overlap_reading);
+        }, results);
+      }
+      else if (kernel == "alignability")
+      {
+        pcl::PointCloud<pcl::PointXYZ> overlap_reference, overlap_reading;
+        overlapFilter(*reference.filtered, *reading.filtered, reference.pose, reading.pose,
+                      reg_params.sensorRange, reg_params.sensorAngularView, overlap_reference, overlap_reading);
+        pcl::PointCloud<pcl::PointXYZRGBNormal>::Ptr no_output;
+        runKernel(kernel, pair_name, overlap_reading.size(), repetitions, [&]()
+        {
+          alignabilityFilter(overlap_reference, overlap_reading, reference.pose, reading.pose,
+                             no_output, no_output, no_output);
+        }, results);
+      }
+      else if (kernel == "svm")
+      {
+        Eigen::MatrixXd testing_data(1, 2);
+        testing_data << 50.0, 50.0;
+        Eigen::MatrixXd risk_prediction;
+        runKernel(kernel, pair_name, 1, repetitions, [&]()
+        {
+          classifier->test(testing_data, &risk_prediction);
+        }, results);
+      }
+      else if (kernel == "icp")
+      {
+        Eigen::Matrix4f correction;
+        runKernel(kernel, pair_name, reading.filtered->size(), repetitions, [&]()
+        {
+          registrator->registerClouds(*reference.filtered, *reading.filtered, correction);
+        }, results);
+      }
+      else
+      {
+        cerr << "[Bench] Unknown kernel " << kernel << endl;
+        break;
+      }
+    }
+  }
+
+  // Not on stdout (kernels print their own outputs)
+  ofstream out (output_file.c_str());
+  if (!out.is_open())
+  {
+    cerr << "ERROR: could not open file " << output_file << endl;
+    return -1;
+  }
+  writeJSON(out, config_file, repetitions, results);
+  cerr << "[Bench] Results written to " << output_file << endl;
+  return 0;
+}
@@ -12,8 +12,13 @@ namespace aicp {
 	  virtual void train(const Eigen::MatrixXd &training_data, const Eigen::MatrixXd &labels) = 0;
 	  virtual void test(const Eigen::MatrixXd &testing_data, Eigen::MatrixXd *probabilities) = 0;
 	  virtual void test(const Eigen::MatrixXd &testing_data, const Eigen::MatrixXd &labels, Eigen::MatrixXd *probabilities = NULL) = 0;
+	  // Predicts all samples (rows) in one call, labels (optional, may be empty) used for statistics only
+	  virtual void predictBatch(const RowMatrixXf &testing_data, const Eigen::MatrixXd &labels, Eigen::MatrixXd *probabilities) = 0;
+	  // Range of the risk over alignability [0, 100] % at overlap (false if not available)
+	  virtual bool getRiskBounds(float overlap, double &min_risk, double &max_risk) { return false; }
 	  virtual void save(const std::string &filename) = 0;
-	  virtual void load(const std::string &filename) = 0;
+	  // Replaces the current model (can be called while testing from another thread)
+	  virtual bool load(const std::string &filename) = 0;
 	};
 
 }
@@ -7,6 +7,9 @@
 
 #include <Eigen/Dense>
 
+// Samples stored by rows, contiguous (mapped as is by the classifiers)
+typedef Eigen::Matrix<float, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor> RowMatrixXf;
+
 static void confusionMatrix(unsigned int tp, unsigned int tn, unsigned int fp, unsigned int fn) {
   std::cout << "====================================" << std::endl
             << "[Classifier Common] SVM Statistics: "   << std::endl
@@ -42,6 +45,8 @@ struct ClassificationParams {
     std::string saveFile;
     std::string saveProbs;
     std::string modelLocation;
+    bool useLookupTable = false;        // risk from model sampled on an (overlap, alignability) grid
+    float lookupTableResolution = 0.5;  // grid step (%)
   } svm;
 
 };
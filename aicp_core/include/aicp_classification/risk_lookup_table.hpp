@@ -0,0 +1,45 @@
+#ifndef AICP_CLASSIFICATION_RISK_LOOKUP_TABLE_HPP_
+#define AICP_CLASSIFICATION_RISK_LOOKUP_TABLE_HPP_
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "aicp_classification/common.hpp"
+
+namespace aicp {
+
+  // Alignment risk sampled on a dense grid of classifier inputs
+  // (overlap %, alignability %), both in [0, 100]. Risk is then looked up
+  // in constant time with bilinear interpolation (inputs clamped to the grid).
+  class RiskLookupTable {
+  public:
+    RiskLookupTable();
+    explicit RiskLookupTable(float resolution);
+    ~RiskLookupTable() {}
+
+    // Grid nodes as classifier samples (overlap, alignability), in setValues() order
+    void getGridSamples(RowMatrixXf& samples) const;
+    void setValues(const Eigen::VectorXd& values);
+
+    // Valid table only (values set or loaded)
+    float lookup(float overlap, float alignability) const;
+    // Exact range of lookup(overlap, a) for a in [0, 100] (piecewise linear in a)
+    void getRiskBounds(float overlap, float& min_risk, float& max_risk) const;
+
+    bool isValid() const { return size_ >= 2 && values_.size() == (size_t)size_ * size_; }
+    float getResolution() const { return resolution_; }
+
+    // model_hash: identifies the classifier model sampled (load fails if it differs)
+    bool save(const std::string &filename, uint64_t model_hash) const;
+    bool load(const std::string &filename, uint64_t model_hash);
+
+  private:
+    float resolution_; // grid step (%)
+    int size_;         // nodes per dimension
+    std::vector<float> values_; // row-major: overlap index major
+  };
+
+}
+
+#endif
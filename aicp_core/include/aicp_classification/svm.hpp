@@ -4,6 +4,7 @@
 // classification
 #include "aicp_classification/common.hpp"
 #include "aicp_classification/abstract_classification.hpp"
+#include "aicp_classification/risk_lookup_table.hpp"
 
 // opencv
 #include <opencv2/core/core.hpp>
@@ -12,6 +13,8 @@
 // eigen
 #include <Eigen/Dense>
 
+#include <mutex>
+
 namespace aicp {
 
   class SVM : public AbstractClassification {
@@ -23,12 +26,27 @@ namespace aicp {
     virtual void train(const Eigen::MatrixXd &training_data, const Eigen::MatrixXd &labels);
     virtual void test(const Eigen::MatrixXd &testing_data, Eigen::MatrixXd *probabilities);
     virtual void test(const Eigen::MatrixXd &testing_data, const Eigen::MatrixXd &labels, Eigen::MatrixXd *probabilities = NULL);
+    virtual void predictBatch(const RowMatrixXf &testing_data, const Eigen::MatrixXd &labels, Eigen::MatrixXd *probabilities);
+    // From the lookup table (false if disabled)
+    virtual bool getRiskBounds(float overlap, double &min_risk, double &max_risk);
     virtual void save(const std::string &filename);
-    virtual void load(const std::string &filename);
+    virtual bool load(const std::string &filename);
 
   private:
     ClassificationParams params_;
     cv::Ptr<cv::ml::SVM> svm_;
+    std::shared_ptr<RiskLookupTable> lookup_table_; // svm_ sampled on a grid (NULL if disabled)
+    std::mutex svm_mutex_; // guards svm_ and lookup_table_ (swapped when a model is loaded)
+
+    // Untrained model with the classifier settings
+    static cv::Ptr<cv::ml::SVM> createModel();
+    // Probabilities of testing samples (high alignment risk)
+    static void predict(const cv::Ptr<cv::ml::SVM>& svm, const RowMatrixXf &testing_data, Eigen::VectorXd& probabilities);
+    // Contents hash of filename (false if it cannot be read)
+    static bool hashFile(const std::string &filename, uint64_t &hash);
+    // Lookup table of svm: loaded from model_file + ".lut" if built from the same model file
+    // contents (hash in the table header), built and saved otherwise
+    std::shared_ptr<RiskLookupTable> createLookupTable(const cv::Ptr<cv::ml::SVM>& svm, const std::string &model_file);
   };
 
 }
@@ -1,6 +1,9 @@
 #ifndef AICP_OCTREES_OVERLAP_ABSTRACT_HPP_
 #define AICP_OCTREES_OVERLAP_ABSTRACT_HPP_
 
+#include <memory>
+#include <vector>
+
 #include <octomap/octomap.h>
 #include <octomap/ColorOcTree.h>
 
@@ -12,10 +15,27 @@ using namespace octomap;
 namespace aicp {
   class AbstractOverlapper {
   public:
+    // reference_id: identifies the reference cloud, data computed from the reference
+    // can be reused while it does not change (-1: unknown, always recompute)
     virtual ColorOcTree* computeOverlap(pcl::PointCloud<pcl::PointXYZ> &ref_cloud, pcl::PointCloud<pcl::PointXYZ> &read_cloud,
                                         Eigen::Isometry3d ref_pose, Eigen::Isometry3d read_pose,
-                                        ColorOcTree* reading_tree) = 0;
+                                        ColorOcTree* reading_tree, int reference_id = -1) = 0;
     virtual float getOverlap() = 0;
+    // Overlap intervals (%) in which the exact overlap is needed: outside of them,
+    // a coarse estimate can be returned (empty: always exact)
+    virtual void setRefinementIntervals(const std::vector<std::pair<float, float> >& intervals) = 0;
+    // Reference tree built elsewhere (e.g. the reading tree of a cloud promoted to reference),
+    // used instead of building one from ref_cloud while reference_id does not change
+    virtual void setReferenceTree(const std::shared_ptr<ColorOcTree>& tree, int reference_id) = 0;
+    // Drops the cached reference tree (next computeOverlap builds it from ref_cloud)
+    virtual void resetReferenceTree() = 0;
+    // Tree of the points moved by transform, from the tree of the points: tree itself or a copy
+    // with shifted keys if the move is (within half a voxel) a translation by whole voxels,
+    // NULL otherwise (tree to be built again from the moved points). remainder: part of the
+    // move not applied (from the returned tree to the points), to be accumulated by the caller
+    virtual std::shared_ptr<ColorOcTree> transformTree(const std::shared_ptr<ColorOcTree>& tree,
+                                                       const Eigen::Isometry3d& transform,
+                                                       Eigen::Isometry3d& remainder) = 0;
   };
 }
 
@@ -10,7 +10,21 @@ struct OverlapParams {
 
   struct OctreeOverlapParams {
     double octomapResolution;
+    bool endpointsOnly = false; // insert occupied endpoints only (no free space raycasting)
+    bool colorTrees = true;     // color tree nodes (visualization only)
+    int coarseDepthOffset = 0;  // coarse overlap computed at (tree depth - offset) first (0: disabled)
+    float refineMargin = 10.0;  // coarse overlap margin (%) around refinement intervals
   } octree_based;
+
+  struct LoopClosureParams {
+    int nbRings = 20;          // place descriptor radial bins
+    int nbSectors = 60;        // place descriptor angular bins
+    float maxRadius = 20.0;    // place descriptor range (meters)
+    int nbCandidates = 5;      // most similar places checked with octrees overlap
+    int minIdGap = 50;         // places closer than this (graph clouds ids) are not candidates
+    int rebuildPeriod = 50;    // places added between re-builds of the search tree
+    float minOverlap = 50.0;   // octrees overlap (%) accepting a loop closure
+  } loop_closure;
 };
 
 #endif
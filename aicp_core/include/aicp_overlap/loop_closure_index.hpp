@@ -0,0 +1,73 @@
+#ifndef AICP_LOOP_CLOSURE_INDEX_HPP_
+#define AICP_LOOP_CLOSURE_INDEX_HPP_
+
+#include <vector>
+
+#include <Eigen/Dense>
+
+#include <pcl/point_types.h>
+#include <pcl/point_cloud.h>
+
+#include "aicp_overlap/common.hpp"
+
+namespace aicp {
+
+// Global descriptor of a place (ring/height signature, Scan Context like):
+// max height of the points in each ring x sector bin around the cloud pose,
+// and the occupancy of each ring (rotation invariant key used for the search).
+struct PlaceDescriptor {
+  EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+  int id;                   // graph cloud id
+  Eigen::VectorXf ring_key; // occupied sectors ratio per ring
+  Eigen::MatrixXf sectors;  // nbRings x nbSectors max height (0: empty bin)
+};
+
+// Index of place descriptors for loop closure candidates retrieval: kd-tree on the
+// ring keys (re-built every rebuildPeriod additions, newer places searched linearly),
+// nearest places re-ranked by sectors distance (best yaw shift).
+class LoopClosureIndex {
+  public:
+    LoopClosureIndex();
+    explicit LoopClosureIndex(const OverlapParams::LoopClosureParams& params);
+    ~LoopClosureIndex(){}
+
+    // cloud: global coordinates, pose: cloud pose (descriptor frame)
+    void computeDescriptor(const pcl::PointCloud<pcl::PointXYZ>& cloud, const Eigen::Isometry3d& pose,
+                           int id, PlaceDescriptor& descriptor) const;
+    void add(const PlaceDescriptor& descriptor);
+    // Ids of the nbCandidates most similar places (best first) and their distances in [0, 2],
+    // excluding places closer than minIdGap to the query
+    void getCandidates(const PlaceDescriptor& query, std::vector<int>& ids,
+                       std::vector<float>& distances) const;
+
+    size_t size() const { return descriptors_.size(); }
+
+  private:
+    struct Node {
+      int dim;     // split dimension (-1: leaf)
+      float split;
+      int begin;   // leaf: range in tree_points_
+      int end;
+      int left;    // children nodes
+      int right;
+    };
+
+    void buildTree();
+    int buildNode(int begin, int end);
+    void searchTree(int node, const Eigen::VectorXf& key, int max_id, size_t k,
+                    std::vector<std::pair<float, int> >& heap) const;
+    void pushCandidate(float distance, int index, size_t k, std::vector<std::pair<float, int> >& heap) const;
+    float getSectorsDistance(const Eigen::MatrixXf& a, const Eigen::MatrixXf& b) const;
+
+    OverlapParams::LoopClosureParams params_;
+
+    std::vector<PlaceDescriptor, Eigen::aligned_allocator<PlaceDescriptor> > descriptors_;
+    // Descriptors [0, nb_indexed_) are in the tree
+    int nb_indexed_;
+    std::vector<int> tree_points_;
+    std::vector<Node> tree_nodes_;
+};
+
+}
+#endif
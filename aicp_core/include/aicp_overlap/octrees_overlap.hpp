@@ -25,25 +25,36 @@ class OctreesOverlap : public AbstractOverlapper {
 
     virtual ColorOcTree* computeOverlap(pcl::PointCloud<pcl::PointXYZ> &ref_cloud, pcl::PointCloud<pcl::PointXYZ> &read_cloud,
                                         Eigen::Isometry3d ref_pose, Eigen::Isometry3d read_pose,
-                                        ColorOcTree* reading_tree);
+                                        ColorOcTree* reading_tree, int reference_id = -1);
 
     virtual float getOverlap(){ return overlap_; }
+    virtual void setRefinementIntervals(const std::vector<std::pair<float, float> >& intervals){ refinement_intervals_ = intervals; }
+    virtual void setReferenceTree(const std::shared_ptr<ColorOcTree>& tree, int reference_id);
+    virtual void resetReferenceTree(){ reference_id_ = -1; }
+    virtual std::shared_ptr<ColorOcTree> transformTree(const std::shared_ptr<ColorOcTree>& tree,
+                                                       const Eigen::Isometry3d& transform,
+                                                       Eigen::Isometry3d& remainder);
 //    ColorOcTree* getTree(){ return tree_; }
 //    bool clearTree(){
 //      tree_->clear();
 //      return true;
 //    }
 
-    // TODO -----------------------------------------
+    // Overlap (%) between two trees
     float computeLoopClosureFromOverlap(ColorOcTree* treeA, ColorOcTree* treeB);
-    // TODO -----------------------------------------
+    // Overlap (%) between two clouds (trees created here, cached reference tree unchanged).
+    // Used to check loop closure candidates (see LoopClosureIndex).
+    float computeLoopClosureOverlap(pcl::PointCloud<pcl::PointXYZ> &cloudA, pcl::PointCloud<pcl::PointXYZ> &cloudB,
+                                    Eigen::Isometry3d poseA, Eigen::Isometry3d poseB);
     
   private:
     OverlapParams params_;
 
-    ColorOcTree* tree_; // Octree created from reference cloud
+    std::shared_ptr<ColorOcTree> tree_; // Octree created from reference cloud (or set, may be shared)
+    int reference_id_;  // Id of the reference cloud in tree_ (-1: not cached)
 
     float overlap_;
+    std::vector<std::pair<float, float> > refinement_intervals_; // overlap intervals (%) requiring full resolution
 
     //Colors for change detection
     ColorOcTreeNode::Color* yellow; //old occupied
@@ -51,10 +62,13 @@ class OctreesOverlap : public AbstractOverlapper {
     ColorOcTreeNode::Color* green;  //new occupied
     ColorOcTreeNode::Color* red;
 
-    void getOverlappingNodes(ColorOcTree* treeA, ColorOcTree* treeB, int& overlapping_nodes, int& count_nodes_ref, int& count_nodes_read);
+    // depth: tree depth at which nodes are compared (0: max tree depth)
+    void getOverlappingNodes(ColorOcTree* treeA, ColorOcTree* treeB, int& overlapping_nodes, int& count_nodes_ref, int& count_nodes_read,
+                             unsigned int depth = 0);
     void createTree(pcl::PointCloud<pcl::PointXYZ> &cloud, Eigen::Isometry3d pose, ColorOcTree* output_tree, ColorOcTreeNode::Color* color);
+    void insertEndpoints(pcl::PointCloud<pcl::PointXYZ> &cloud, ColorOcTree* output_tree);
+    void insertScans(pcl::PointCloud<pcl::PointXYZ> &cloud, Eigen::Isometry3d pose, ColorOcTree* output_tree);
     void setReferenceTree(pcl::PointCloud<pcl::PointXYZ> &ref_cloud, Eigen::Isometry3d ref_pose);
-    ScanGraph* convertPointCloudToScanGraph(pcl::PointCloud<pcl::PointXYZ> &cloud, Eigen::Isometry3d sensor_pose);
 };
 
 }
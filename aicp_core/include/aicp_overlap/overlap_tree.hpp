@@ -0,0 +1,31 @@
+#ifndef AICP_OVERLAP_TREE_HPP_
+#define AICP_OVERLAP_TREE_HPP_
+
+#include <octomap/ColorOcTree.h>
+
+#include "aicp_utils/memoryUsage.hpp"
+
+namespace aicp {
+
+// Overlap octree counted in the process-wide usage of the overlap trees (getUsage): one object
+// while alive, bytes as accounted when it was last filled (accountMemory). A count growing with
+// the readings points to trees kept by clouds which should have released them.
+class OverlapTree : public octomap::ColorOcTree {
+  public:
+    explicit OverlapTree(double resolution);
+    ~OverlapTree();
+
+    // Called by the thread which filled the tree (memory of the nodes, one traversal)
+    void accountMemory();
+    // accountMemory if tree is an OverlapTree
+    static void accountMemory(octomap::ColorOcTree* tree);
+
+    // Alive overlap trees (objects: trees), all streams
+    static MemoryUsage getUsage();
+
+  private:
+    size_t accounted_bytes_;
+};
+
+}
+#endif
@@ -1,21 +1,103 @@
 #ifndef AICP_REGISTRATOR_ABSTRACT_HPP_
 #define AICP_REGISTRATOR_ABSTRACT_HPP_
 
+#include <algorithm>
+#include <vector>
+
 #include <pcl/point_types.h>
 #include <pcl/common/common_headers.h>
 
+#include "aicp_registration/alignment_hypotheses.hpp"
+
 namespace aicp {
+  // Residual distances (meters) of the matches used by the last iteration of a registration
+  // (-1 if not available). max is a lower bound of the Hausdorff distance between the clouds.
+  struct RegistrationQuality
+  {
+    int nb_matches = -1;
+    float mean = -1.0f;
+    float median = -1.0f;
+    float p90 = -1.0f;
+    float max = -1.0f;
+
+    // Single pass over the residuals (reordered: partial sorts for the quantiles)
+    void setResiduals(std::vector<float>& residuals)
+    {
+      *this = RegistrationQuality();
+      if (residuals.empty())
+        return;
+      nb_matches = residuals.size();
+      double sum = 0.0;
+      for (size_t i = 0; i < residuals.size(); i++)
+        sum += residuals[i];
+      mean = sum / residuals.size();
+      std::vector<float>::iterator p90_it = residuals.begin() + (size_t)(0.9 * (residuals.size() - 1));
+      std::nth_element(residuals.begin(), p90_it, residuals.end());
+      p90 = *p90_it;
+      max = *std::max_element(p90_it, residuals.end());
+      std::vector<float>::iterator median_it = residuals.begin() + (residuals.size() - 1) / 2;
+      std::nth_element(residuals.begin(), median_it, p90_it);
+      median = *median_it;
+    }
+  };
+
+  // Degeneracy of the last registration, from the normal-equation matrix (A^T A) of the
+  // last ICP matches ("On Degeneracy of Optimization-based State Estimation Problems", J. Zhang, 2016)
+  struct DegeneracyEstimate
+  {
+    float degeneracy = -1.0f;               // smallest translation eigenvalue, % of the trace (degenerate if ~ 0)
+    float inverse_condition_number = -1.0f; // translation: smallest / largest eigenvalue (want 1)
+    // Directions [roll, pitch, yaw, x, y, z] of the smallest eigenvalues (first nb_degenerate columns),
+    // rotations about the centroid of the matches scaled by their spread (comparable to translations)
+    int nb_degenerate = 0;
+    Eigen::Matrix<float, 6, 6, Eigen::DontAlign> directions = Eigen::Matrix<float, 6, 6, Eigen::DontAlign>::Zero();
+  };
+
   class AbstractRegistrator {
   public:
     virtual void registerClouds(pcl::PointCloud<pcl::PointXYZ>& cloud_ref, pcl::PointCloud<pcl::PointXYZ>& cloud_read, Eigen::Matrix4f &final_transform) = 0;
     virtual void registerClouds(pcl::PointCloud<pcl::PointXYZRGB>& cloud_ref, pcl::PointCloud<pcl::PointXYZRGB>& cloud_read, Eigen::Matrix4f &final_transform) = 0;
     virtual void registerClouds(pcl::PointCloud<pcl::PointXYZRGBNormal>& cloud_ref, pcl::PointCloud<pcl::PointXYZRGBNormal>& cloud_read, Eigen::Matrix4f &final_transform) = 0;
 
+    // Reference is kept (converted, filtered and with its matcher) across readings:
+    // setReference only re-builds it if id changes (id = -1: always re-build)
+    virtual void setReference(pcl::PointCloud<pcl::PointXYZ>& cloud_ref, int id = -1) = 0;
+    virtual void registerReading(pcl::PointCloud<pcl::PointXYZ>& cloud_read, Eigen::Matrix4f &final_transform) = 0;
+    // Same with normals (e.g. from the planes segmentation pre-filter): not estimated again
+    virtual void setReference(pcl::PointCloud<pcl::PointXYZRGBNormal>& cloud_ref, int id = -1) = 0;
+    virtual void registerReading(pcl::PointCloud<pcl::PointXYZRGBNormal>& cloud_read, Eigen::Matrix4f &final_transform) = 0;
+    // Registers reading from each initial transform concurrently (sharing the reference set),
+    // returns the index of the best hypothesis (-1 if none) and its transform in final_transform
+    virtual int registerReading(pcl::PointCloud<pcl::PointXYZ>& cloud_read, const TransformsVector& initial_transforms,
+                                Eigen::Matrix4f &final_transform) = 0;
+
+    // Initial transform of the next registerClouds / registerReading only (e.g. motion model
+    // prediction), replaces the configured initialTransform
+    virtual void setInitialGuess(const Eigen::Matrix4f& guess) = 0;
+
     virtual void getInitializedReading(pcl::PointCloud<pcl::PointXYZ>& initialized_reading) = 0;
     virtual void getOutputReading(pcl::PointCloud<pcl::PointXYZ>& out_read_cloud) = 0;
 
     virtual void updateConfigParams(std::string config_name) = 0;
 
+    // Tune the loaded chain in memory (no config file rewrite)
+    virtual void setOutlierRatio(float ratio) = 0;
+    // max_iterations <= 0: configured count restored
+    virtual void setMaxIterationCount(int max_iterations) = 0;
+    // Reading points farther than distance from the reference are not matched
+    // (e.g. reference larger than the reading), distance <= 0: configured chain restored
+    virtual void setMaxMatchDistance(float distance) = 0;
+
+    // Statistics of the last registerReading (-1 if not available)
+    virtual int getNbIterations() { return -1; }
+    virtual int getNbCoarseIterations() { return -1; } // pyramid levels, summed
+    // Stopped by the adaptive termination (-1: not enabled, 0: by the other checkers)
+    virtual int getConverged() { return -1; }
+    virtual float getInlierRatio() { return -1.0f; }
+    // From the matches of the last registration (no new matching, cheap enough for every reading)
+    virtual RegistrationQuality getQuality() { return RegistrationQuality(); }
+    virtual DegeneracyEstimate getDegeneracy() { return DegeneracyEstimate(); }
+
   };
 }
 
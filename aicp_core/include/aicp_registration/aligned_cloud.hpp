@@ -1,10 +1,17 @@
 #pragma once
 
+#include <memory>
+
 #include <Eigen/Geometry>
 
+#include <octomap/ColorOcTree.h>
+
 #include <pcl/point_types.h>
 #include <pcl/point_cloud.h>
 
+#include "aicp_utils/segmentedCloud.hpp"
+#include "aicp_utils/compactCloud.hpp"
+
 namespace aicp {
 
 // Point cloud class
@@ -30,8 +37,11 @@ public:
     // Getters
     int64_t getUtime(){ return utime_; }
 
+    // NULL if compacted or released (see decodeCloud)
     pcl::PointCloud<pcl::PointXYZ>::Ptr getCloud(){ return cloud_; }
-    int getNbPoints(){ return cloud_->size(); }
+    int getNbPoints(){ return cloud_ ? cloud_->size() : nb_points_; }
+    // Planes segmentation of cloud_ (NULL if not available)
+    SegmentedCloudPtr getSegmentedCloud(){ return segmented_cloud_; }
 
     Eigen::Isometry3d getOdomPose(){ return world_to_cloud_odom_; }
     Eigen::Isometry3d getPriorPose(){ return world_to_cloud_prior_; }
@@ -40,9 +50,16 @@ public:
 
     int getItsReferenceId(){ return its_reference_id_; }
 
+    // Identifies the current points (>= 0, new value whenever they change, unique across
+    // clouds): cache key of the data computed from them (registration reference, overlap tree)
+    int getPointsKey(){ return points_key_; }
+
     // Setters
     void setReference(){ is_reference_ = true; }
 
+    // Note: must be kept consistent with cloud_ (same points, same frame)
+    void setSegmentedCloud(SegmentedCloudPtr segmented_cloud){ segmented_cloud_ = segmented_cloud; }
+
     void setPriorPose(Eigen::Isometry3d pose_prior)
     {
         world_to_cloud_prior_ = pose_prior;
@@ -51,16 +68,86 @@ public:
 
     bool isReference(){ return is_reference_; }
 
+    // Corrected pose from pose graph optimization. Points are not moved:
+    // getPendingUpdate() maps them to the new pose (see AlignedCloudsGraph::updatePose)
+    void setOptimizedPose(const Eigen::Isometry3d& pose)
+    {
+        pending_update_ = pose * world_to_cloud_corrected_.inverse() * pending_update_;
+        world_to_cloud_corrected_ = pose;
+        has_pending_update_ = true;
+    }
+    Eigen::Isometry3d getPendingUpdate(){ return pending_update_; }
+    bool hasPendingUpdate(){ return has_pending_update_; }
+    void clearPendingUpdate()
+    {
+        pending_update_ = Eigen::Isometry3d::Identity();
+        has_pending_update_ = false;
+    }
+
+    // Memory used by the points (cloud, compact cloud and planes segmentation, bytes)
+    size_t getMemoryUsage();
+    // Replaces the points by a CompactCloud around the corrected pose (drops planes segmentation)
+    void compactCloud(float resolution);
+    // Points (copied or decoded) to cloud_out. Returns false if released.
+    bool decodeCloud(pcl::PointCloud<pcl::PointXYZ>& cloud_out);
+    // Drops the points (poses and metadata are kept)
+    void releaseCloud();
+    // Puts back compacted or released points (poses unchanged)
+    void restoreCloud(pcl::PointCloud<pcl::PointXYZ>::Ptr& cloud)
+    {
+        cloud_ = cloud;
+        compact_cloud_.clear();
+        points_key_ = newPointsKey();
+    }
+    bool isResident(){ return cloud_ != NULL; }
+
+    // Overlap octree built from the points as a reading, reused as reference tree when the cloud
+    // is promoted (NULL if not available). Transform: from the tree to the current points
+    // (moved by the registration correction and pose graph updates since the tree was built,
+    // sub-voxel remainder of the previous moves included)
+    std::shared_ptr<octomap::ColorOcTree> getOverlapTree(){ return overlap_tree_; }
+    Eigen::Isometry3d getOverlapTreeTransform(){ return overlap_tree_to_cloud_; }
+    // Points moved since the tree was set (tree to be transformed)
+    bool isOverlapTreeMoved(){ return overlap_tree_moved_; }
+    void setOverlapTree(const std::shared_ptr<octomap::ColorOcTree>& tree,
+                        const Eigen::Isometry3d& tree_to_cloud = Eigen::Isometry3d::Identity())
+    {
+        overlap_tree_ = tree;
+        overlap_tree_to_cloud_ = tree_to_cloud;
+        overlap_tree_moved_ = false;
+    }
+    // Points moved by transform (global frame)
+    void moveOverlapTree(const Eigen::Isometry3d& transform)
+    {
+        if (!overlap_tree_)
+            return;
+        overlap_tree_to_cloud_ = transform * overlap_tree_to_cloud_;
+        overlap_tree_moved_ = true;
+    }
+    void releaseOverlapTree(){ overlap_tree_.reset(); }
+    bool isCompact(){ return !cloud_ && !compact_cloud_.empty(); }
+
 private:
+    static int newPointsKey();
+
     int64_t utime_; // Cloud timestamp (microseconds)
 
     pcl::PointCloud<pcl::PointXYZ>::Ptr cloud_; // Cloud (pre-filtered and global coordinates)
+    SegmentedCloudPtr segmented_cloud_;          // Normals and planes of cloud_ (from pre-filter)
+    CompactCloud compact_cloud_;                 // Quantized cloud_ (when compacted)
+    std::shared_ptr<octomap::ColorOcTree> overlap_tree_; // Overlap octree of cloud_ (see getOverlapTree)
+    Eigen::Isometry3d overlap_tree_to_cloud_;
+    bool overlap_tree_moved_;
+    int nb_points_;                              // Size of cloud_ when compacted or released
+    int points_key_;                             // See getPointsKey
 
     Eigen::Isometry3d world_to_cloud_odom_;          // odom to base:         world -> cloud (global coordinates). this is the unmodified input.
 
     Eigen::Isometry3d world_to_cloud_prior_;         // cloud pose prior:     world -> cloud (global coordinates)
     Eigen::Isometry3d cloud_to_reference_;           // relative transform:   cloud -> reference (global coordinates)
     Eigen::Isometry3d world_to_cloud_corrected_;     // cloud pose corrected: world -> cloud (global coordinates)
+    Eigen::Isometry3d pending_update_;               // stored points -> corrected pose (after pose graph optimization)
+    bool has_pending_update_;
 
     bool is_reference_; // Is this cloud a reference cloud?
 
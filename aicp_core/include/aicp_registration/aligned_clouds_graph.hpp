@@ -1,6 +1,12 @@
 #pragma once
 
+#include <deque>
+#include <fstream>
+#include <string>
+#include <unordered_map>
+
 #include "aligned_cloud.hpp"
+#include "aicp_utils/memoryUsage.hpp"
 
 namespace aicp {
 
@@ -16,17 +22,34 @@ public:
     void initialize(AlignedCloudPtr& reference);
     bool addCloud(AlignedCloudPtr& cloud);
 
-    void updateReference(int index)
-    {
-        aligned_clouds.at(index)->setReference();
-        current_reference_ = index;
-    }
+    void updateReference(int index);
 
     bool isEmpty(){ return !initialized_; }
 
+    // Memory budget of the clouds points (max_bytes, 0: unbounded).
+    // The current reference and the last window clouds are always resident, older clouds
+    // are compacted if compact_resolution > 0 (see AlignedCloud::compactCloud), then
+    // released (oldest first) while over budget. Poses and metadata are always kept.
+    // If spill_file is not empty, released clouds are written to it (see loadCloudAt).
+    bool setMemoryBudget(size_t max_bytes, int window, const std::string& spill_file = "",
+                         float compact_resolution = 0.0f);
+    // Points of cloud index, decoded if compacted or read back from the spill file if
+    // released (planes segmentation is not kept). Returns false if not available.
+    bool loadCloudAt(int index, pcl::PointCloud<pcl::PointXYZ>& cloud_out);
+
+    // Sets the corrected pose of cloud index (pose graph optimization). Points of the
+    // current reference and of the last window clouds are moved now, others on read (loadCloudAt)
+    void updatePose(int index, const Eigen::Isometry3d& pose);
+
     // Getters clouds
     int getNbClouds(){ return aligned_clouds.size(); }
+    int getNbResidentClouds(){ return resident_clouds_.size(); }
+    size_t getResidentBytes(){ return resident_bytes_; }
+    // Resident points (see setMemoryBudget) and metadata of all clouds, overlap trees
+    // not included (objects: clouds)
+    MemoryUsage getMemoryUsage();
 
+    // Note: points of a released cloud are NULL (see loadCloudAt)
     AlignedCloudPtr getCloudAt(int index){ return aligned_clouds.at(index); }
     std::vector<AlignedCloudPtr> getClouds(){ return aligned_clouds; }
 
@@ -36,9 +59,33 @@ public:
     int getLastCloudId(){ return aligned_clouds.size()-1; }
 
 private:
+    // Location of a released cloud in spill file
+    struct SpillEntry
+    {
+        std::streamoff offset;
+        size_t nb_points;
+    };
+
+    void enforceBudget();
+    void compactCloud(int index);
+    void applyPendingUpdate(int index);
+    void releaseCloud(int index);
+
     bool initialized_;
     int current_reference_;
 
     std::vector<AlignedCloudPtr> aligned_clouds;  // Clouds in global reference frame (aligned)
+
+    size_t max_bytes_;
+    int window_;
+    float compact_resolution_;
+    int next_compact_; // Clouds before it are compacted (or released, or current reference)
+    // Resident clouds (in order of addition) and memory used when added
+    std::deque<int> resident_clouds_;
+    std::unordered_map<int, size_t> resident_sizes_;
+    size_t resident_bytes_;
+
+    std::fstream spill_file_;
+    std::unordered_map<int, SpillEntry> spilled_clouds_;
 };
 }
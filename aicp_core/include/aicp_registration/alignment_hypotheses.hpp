@@ -0,0 +1,48 @@
+#ifndef AICP_ALIGNMENT_HYPOTHESES_HPP_
+#define AICP_ALIGNMENT_HYPOTHESES_HPP_
+
+#include <vector>
+
+#include <Eigen/Dense>
+#include <Eigen/StdVector>
+
+#include <pcl/point_types.h>
+#include <pcl/point_cloud.h>
+#include <pcl/search/search.h>
+
+#include "aicp_registration/common.hpp"
+
+// Multi-hypothesis initialization (e.g. localization against prior map from a rough guess):
+// the reading is registered from several perturbed initial transforms, the best alignment is kept.
+namespace aicp {
+
+  typedef std::vector<Eigen::Matrix4f, Eigen::aligned_allocator<Eigen::Matrix4f> > TransformsVector;
+
+  struct AlignmentHypothesis
+  {
+    EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+    Eigen::Matrix4f transform = Eigen::Matrix4f::Identity();
+    float residual = -1.0;     // mean distance of inliers to the reference (meters)
+    float inlier_ratio = 0.0;  // fraction of reading points closer than max distance to the reference
+  };
+
+  typedef std::vector<AlignmentHypothesis, Eigen::aligned_allocator<AlignmentHypothesis> > HypothesesVector;
+
+  // Grid of yaw and x-y translation perturbations around the reading pose
+  // (first hypothesis is identity)
+  void getInitializationHypotheses(const Eigen::Isometry3d& reading_pose,
+                                   const RegistrationParams::InitializationParams& params,
+                                   TransformsVector& hypotheses);
+
+  // Scores reading (transformed by hypothesis.transform) against reference
+  // (search must be thread safe for concurrent scoring)
+  void scoreAlignment(const pcl::search::Search<pcl::PointXYZ>& reference_search,
+                      const pcl::PointCloud<pcl::PointXYZ>& reading,
+                      float max_distance,
+                      AlignmentHypothesis& hypothesis);
+
+  // Index of the hypothesis with lowest residual per inlier ratio (-1 if none is valid)
+  int selectBestHypothesis(const HypothesesVector& hypotheses);
+}
+
+#endif
@@ -1,9 +1,11 @@
 #pragma once
 
+#include <atomic>
 #include <memory>
 #include <thread>
 #include <mutex>
 #include <condition_variable>
+#include <unordered_set>
 
 #include <Eigen/Dense>
 #include <Eigen/StdVector>
@@ -11,15 +13,24 @@
 #include "aicp_registration/common.hpp"
 #include "aicp_registration/pointmatcher_registration.hpp"
 #include "aicp_registration/aligned_clouds_graph.hpp"
+#include "aicp_registration/pose_graph.hpp"
 #include "aicp_registration/abstract_registrator.hpp"
 
 #include "aicp_overlap/common.hpp"
 #include "aicp_overlap/abstract_overlapper.hpp"
+#include "aicp_overlap/loop_closure_index.hpp"
 
 #include "aicp_classification/common.hpp"
 #include "aicp_classification/abstract_classification.hpp"
 
 #include "aicp_utils/visualizer.hpp"
+#include "aicp_utils/voxelMap.hpp"
+#include "aicp_utils/boundedQueue.hpp"
+#include "aicp_utils/workQueue.hpp"
+#include "aicp_utils/tiledMapFile.hpp"
+#include "aicp_utils/debugWriter.hpp"
+#include "aicp_utils/memoryUsage.hpp"
+#include "aicp_utils/logging.hpp"
 
 struct CommandLineConfig
 {
@@ -29,20 +40,47 @@ struct CommandLineConfig
     string output_channel;
     string working_mode;
     string fixed_frame;
+    string stream_namespace; // topics prefix of a server stream, e.g. "/robot1" (empty: single stream)
     bool load_map_from_file;
     bool localize_against_prior_map;
     bool localize_against_built_map;
     string map_from_file_path;
+    string map_cache_directory; // pre-filtered maps (empty: no cache)
     float crop_map_around_base;
+    float prior_map_max_match_distance; // m, static prior map: reading points matched within this distance (0: unbounded)
     bool merge_aligned_clouds_to_map;
     bool failure_prediction_mode;
+    bool parallel_alignment_risk; // octree overlap concurrently with FOV overlap and alignability (alignability never skipped)
     int reference_update_frequency;
     float max_correction_magnitude;
     int max_queue_size;
+    float accumulator_voxel_size; // accumulated scans merged into voxels of this size in meters (0: raw points)
+    int max_map_points; // memory cap of the built map (0: unbounded)
+    int graph_memory_budget; // memory cap of the graph clouds points in MB (0: unbounded)
+    int graph_resident_clouds; // last clouds always kept in memory
+    string graph_spill_file; // clouds dropped from memory are written to this file (empty: not kept)
+    float graph_compact_resolution; // clouds out of the resident window are quantized at this step in meters (0: not compacted)
+    string queue_policy; // when queue is full: drop_oldest, drop_newest or coalesce (latest only)
+    double cycle_deadline; // s, target latency of a cloud (queue + processing): cheaper settings when exceeded (0: disabled)
+    double diagnostics_rate; // Hz, diagnostics publishing (0: disabled)
+    float compressed_clouds_resolution; // m, published clouds and maps also sent compressed at this step (0: disabled)
+    string trace_file; // Chrome trace JSON of the processing spans, written on SIGUSR1 and at exit (empty: no tracing)
+    double trace_dump_period; // s, trace_file also rewritten at this period (0: on signal and at exit only)
+    bool pipelined_processing; // filter, overlap/risk and registration stages in separate threads
+    bool loop_closure_detection; // new references are matched against past ones (separate thread)
+    bool pose_graph_optimization; // graph poses optimized with loop closures (with loop_closure_detection)
     bool verbose;
+    string log_level; // debug, info, warn or error
+    bool log_async; // log records written by a background thread (dropped if it falls behind)
+    int debug_queue_size; // debug files (verbose) waiting to be written before new ones are dropped
+    bool debug_binary; // binary debug clouds (false: ASCII)
     bool write_input_clouds_to_file;
+    string input_clouds_format; // "log": single chunked log (aicp_input_clouds.aicplog), "pcd": one file per cloud
+    float input_clouds_resolution; // quantization step of the clouds in the log (0: lossless)
     bool process_input_clouds_from_file;
     string process_input_clouds_folder;
+    int replay_prefetch; // clouds read ahead by reader threads when processing from folder (0: synchronous)
+    bool replay_real_time; // clouds processed at their timestamps when processing from folder (false: max speed)
 };
 
 namespace aicp {
@@ -51,15 +89,21 @@ class App{
 public:
     typedef std::vector<Eigen::Isometry3d, Eigen::aligned_allocator<Eigen::Isometry3d>> PathPoses;
 public:
+    // classifier: shared with other streams (see AppServer), created from class_params if NULL
     App(const CommandLineConfig& cl_cfg,
         RegistrationParams reg_params,
         OverlapParams overlap_params,
-        ClassificationParams class_params);
+        ClassificationParams class_params,
+        std::shared_ptr<AbstractClassification> classifier = std::shared_ptr<AbstractClassification>());
 
     inline virtual ~App(){
+        stopLoopClosureDetection();
         delete aligned_clouds_graph_;
         delete prior_map_;
         delete vis_;
+        // Queued records written before the process exits (later records written synchronously)
+        if (cl_cfg_.log_async)
+            Logger::stopAsync();
     }
 
     RegistrationParams reg_params_;
@@ -74,9 +118,30 @@ public:
     // thread function doing actual work
     void operator()();
 
+    // Stream processed by the threads of an AppServer (instead of operator()):
+    // startStream/stopStream run the loop closure detection, processQueuedCloud
+    // processes the next input cloud if any (never waits, never called concurrently)
+    void startStream();
+    void stopStream();
+    bool processQueuedCloud();
+    bool hasQueuedCloud() const { return cloud_queue_.size() > 0; }
+    // Called by the sensor callbacks once a cloud is queued (set before start)
+    void setCloudQueuedCallback(const std::function<void()>& callback) { cloud_queue_.setPushCallback(callback); }
+    // Prior map shared with other streams (read-only: merge_aligned_clouds_to_map is
+    // not applied to it). Same rule as setPriorMap: set before localization starts.
+    void setSharedPriorMap(const std::shared_ptr<VoxelMap>& map, int64_t utime);
+    bool isLocalizing() const { return pose_initialized_; }
+
     // AICP core pipeline
     void filterCloud(pcl::PointCloud<pcl::PointXYZ>::Ptr& cloud_in,
                      pcl::PointCloud<pcl::PointXYZ>::Ptr& cloud_out);
+    // Also returns planes segmentation of cloud_out (normals oriented towards view_point)
+    // leaf_size: down-sampling leaf (0: pre-filter leafSize)
+    void filterCloud(pcl::PointCloud<pcl::PointXYZ>::Ptr& cloud_in,
+                     pcl::PointCloud<pcl::PointXYZ>::Ptr& cloud_out,
+                     const Eigen::Isometry3d& view_point,
+                     SegmentedCloudPtr& segmented_out,
+                     float leaf_size = 0.0f);
     void runAicpPipeline(pcl::PointCloud<pcl::PointXYZ>::Ptr& reference_prefiltered,
                          pcl::PointCloud<pcl::PointXYZ>::Ptr& reading_prefiltered,
                          Eigen::Isometry3d& reference_pose,
@@ -100,31 +165,223 @@ public:
         return risk_prediction_;
     }
 
+    // Degeneracy of the last registration (default estimate if not registered)
+    const DegeneracyEstimate& getDegeneracy() {
+        return degeneracy_;
+    }
+
     const string getDataDirectoryPath(){
         return data_directory_path_.str();
     }
 
+    // Loop closure detected between two references of aligned_clouds_graph_
+    struct LoopClosure
+    {
+        EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+        int reference_id; // new reference
+        int candidate_id; // past reference
+        float overlap;    // octrees overlap (%)
+        float distance;   // place descriptors distance
+        Eigen::Isometry3d relative_pose; // registered pose of reference in candidate frame
+    };
+    typedef std::vector<LoopClosure, Eigen::aligned_allocator<LoopClosure> > LoopClosures;
+    LoopClosures getLoopClosures() {
+        std::unique_lock<std::mutex> lock(loop_closures_mutex_);
+        return loop_closures_;
+    }
+
+    // Memory held per structure (bytes estimated from the container sizes)
+    struct MemoryReport
+    {
+        MemoryUsage graph;        // objects: clouds
+        MemoryUsage aligned_map;  // objects: points
+        MemoryUsage prior_map;    // objects: points (with the static map occupancy)
+        MemoryUsage octrees;      // objects: overlap trees (process-wide)
+        MemoryUsage paths;        // objects: visualized poses
+        MemoryUsage queue;        // objects: input clouds
+        size_t getTotalBytes() const {
+            return graph.bytes + aligned_map.bytes + prior_map.bytes + octrees.bytes +
+                   paths.bytes + queue.bytes;
+        }
+    };
+
+    // Health of the pipeline: last processed reading and input queue
+    struct Diagnostics
+    {
+        int64_t utime;     // last processed reading
+        long nb_readings;  // processed readings
+        // Stage times of the last reading (seconds)
+        double filter_time;
+        double assess_time;
+        double align_time;
+        // Input queue
+        size_t queue_size;
+        size_t queue_pushed;
+        size_t queue_dropped;
+        double queue_mean_latency; // seconds
+        double queue_max_latency;
+        // Pre-filter of the last reading
+        size_t points_in;
+        size_t points_out;
+        size_t reference_points;
+        // Registration of the last reading (-1 if not registered or not available)
+        int icp_iterations;
+        int icp_coarse_iterations;  // pyramid levels
+        int icp_converged;          // stopped by the adaptive termination (0: by the chain checkers)
+        int icp_warm_start;         // initialized with the motion model prediction
+        float icp_inlier_ratio;
+        // Residual distances of the last matches (meters, see RegistrationQuality)
+        float icp_residual_median;
+        float icp_residual_p90;
+        float icp_residual_max;
+        // Degeneracy of the last registration (see DegeneracyEstimate)
+        float icp_degeneracy;
+        float icp_inverse_condition_number;
+        int icp_degenerate_directions;
+        float octree_overlap;
+        float fov_overlap;
+        float alignability;
+        float risk;
+        // Compute level of the last reading (0: full settings, see cycle_deadline)
+        int compute_level;
+        // Memory at the last reading (octrees, paths and queue: current)
+        MemoryReport memory;
+    };
+    Diagnostics getDiagnostics();
+
 private:
+    // Reading and its reference through the processing stages
+    // (filter -> overlap and alignment risk -> registration)
+    struct ReadingData
+    {
+        EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+        ReadingData(const AlignedCloudPtr& cloud_in) :
+            cloud(cloud_in), first_cloud(false), changes_reference(true), seq(0),
+            compute_level(0), ref_id(-1), reg_ref_id(-1),
+            octree_overlap(-1.0), fov_overlap(-1.0), alignability(-1.0),
+            risk_prediction(Eigen::MatrixXd::Zero(1, 1)),
+            correction(Eigen::Matrix4f::Identity()),
+            warm_start(false), initial_guess(Eigen::Matrix4f::Identity()), multi_hypothesis(false),
+            filter_time(0.0), assess_time(0.0), align_time(0.0), nb_input_points(0) {}
+
+        AlignedCloudPtr cloud;
+        // First cloud (becomes first reference, not registered)
+        bool first_cloud;
+        // Reading may change the reference of the next reading (pipelined processing)
+        bool changes_reference;
+        long seq;
+        // Compute level chosen when the reading enters the filter stage
+        int compute_level;
+
+        pcl::PointCloud<pcl::PointXYZ>::Ptr read_prefiltered;
+        Eigen::Isometry3d read_pose;
+        pcl::PointCloud<pcl::PointXYZ>::Ptr ref_prefiltered;
+        // Registration reference if not ref_prefiltered (whole static prior map), NULL otherwise
+        pcl::PointCloud<pcl::PointXYZ>::Ptr reg_reference;
+        // Normals of reg_reference estimated once with the map (NULL: estimated by the ICP chain)
+        pcl::PointCloud<pcl::PointXYZRGBNormal>::Ptr reg_reference_normals;
+        Eigen::Isometry3d ref_pose;
+        // Planes segmentation of reference and reading (NULL if not available)
+        SegmentedCloudPtr ref_segmented;
+        SegmentedCloudPtr read_segmented;
+        // Id of reference in aligned_clouds_graph_ (-1: reference is not a graph cloud)
+        int ref_id;
+        // Overlap tree of the reference kept from its reading (NULL: built from ref_prefiltered)
+        std::shared_ptr<ColorOcTree> ref_tree;
+        // Cache key of the reference in registr_ and overlapper_ (graph cloud: its points key,
+        // see AlignedCloud::getPointsKey, < -1: prior map crop, -1: not reusable)
+        int reg_ref_id;
+
+        float octree_overlap;
+        float fov_overlap;
+        float alignability;
+        Eigen::MatrixXd risk_prediction;
+        Eigen::Matrix4f correction;
+        // Motion model prediction of correction (initial guess of the registration if warm_start)
+        bool warm_start;
+        Eigen::Matrix4f initial_guess;
+        // Registered from the initialization hypotheses
+        bool multi_hypothesis;
+
+        // Diagnostics
+        double filter_time;
+        double assess_time;
+        double align_time;
+        size_t nb_input_points;
+    };
+    typedef std::shared_ptr<ReadingData> ReadingDataPtr;
+
+    // Processing stages (run in sequence by processCloud, or concurrently
+    // on successive readings when pipelined)
+    void filterReading(ReadingData& data);
+    void assessReading(ReadingData& data);
+    void alignReading(ReadingData& data);
+    void processPipelined();
+    // Stage run and timed in data (name: trace span)
+    void runStage(const char* name, void (App::*stage)(ReadingData&), double ReadingData::*time,
+                  ReadingData& data);
+    void updateDiagnostics(const ReadingData& data);
+    // Registration stage (owner of the graph and built map)
+    void getMemoryReport(MemoryReport& report);
+    // Reference points of data updated if moved by the pose graph since setReference
+    void refreshReference(ReadingData& data);
+    // Motion model: initial guess of the registration from the previous correction
+    void predictCorrection(ReadingData& data);
+    // Deadline mode: compute level of the next readings from the cycle time and queue depth
+    void updateComputeLevel(const ReadingData& data);
+    // Pipelined processing: readings up to seq can no longer change the next reference
+    void setReferenceFinal(long seq);
+    void predictReferenceChange(ReadingData& data);
+    // Loop closure detection thread (fed with new references ids)
+    void startLoopClosureDetection();
+    void stopLoopClosureDetection();
+    void detectLoopClosures();
+    // Pose graph (graph_mutex_ locked): nodes and edges of the last graph cloud,
+    // optimization with the new loop closures
+    void addToPoseGraph(const ReadingData& data);
+    void optimizePoseGraph();
+    // Built map from the graph references (after pose graph optimization)
+    void rebuildAlignedMap();
+
     // App specific
-    void setReference(AlignedCloudPtr& reading_cloud,
-                      pcl::PointCloud<pcl::PointXYZ>::Ptr& reference_cloud,
-                      Eigen::Isometry3d& reference_pose);
+    void setReference(ReadingData& data);
+    // Prior map cropped around pose (crop reused while pose stays close)
+    pcl::PointCloud<pcl::PointXYZ>::Ptr& cropPriorMap(const Eigen::Isometry3d& pose);
+    // Localization against a prior map which is not extended: registration against the
+    // whole map, overlap from its occupancy (static_map_, rebuilt when the map changes)
+    bool isStaticPriorMap() const {
+        return cl_cfg_.localize_against_prior_map && !cl_cfg_.merge_aligned_clouds_to_map;
+    }
+    void updateStaticMap();
     // App specific
-    void setAndFilterReading(AlignedCloudPtr& reading_cloud_in,
-                             pcl::PointCloud<pcl::PointXYZ>::Ptr& reading_cloud_out,
-                             Eigen::Isometry3d& reading_pose);
-
-    void computeOverlap(pcl::PointCloud<pcl::PointXYZ>::Ptr& reference_cloud,
-                        pcl::PointCloud<pcl::PointXYZ>::Ptr& reading_cloud,
-                        Eigen::Isometry3d& reference_pose,
-                        Eigen::Isometry3d& reading_pose);
-    void computeAlignmentRisk(pcl::PointCloud<pcl::PointXYZ>::Ptr& reference_cloud,
-                              pcl::PointCloud<pcl::PointXYZ>::Ptr& reading_cloud,
-                              Eigen::Isometry3d& reference_pose,
-                              Eigen::Isometry3d& reading_pose);
-    void computeRegistration(pcl::PointCloud<pcl::PointXYZ>& reference_cloud,
-                             pcl::PointCloud<pcl::PointXYZ>& reading_cloud,
-                             Eigen::Matrix4f &T);
+    void setAndFilterReading(ReadingData& data);
+
+    void computeOverlap(ReadingData& data);
+    // FOV-based overlap and alignability
+    void computeAlignability(ReadingData& data);
+    // Classification (needs overlap and alignability)
+    void computeAlignmentRisk(ReadingData& data);
+    // Risk bounded from the octree overlap only (classifier lookup table), true if
+    // alignability cannot change the decision (data.risk_prediction set)
+    bool decideAlignmentRiskFromOverlap(ReadingData& data);
+    // Overlap, then alignment risk if failure_prediction_mode
+    void computeOverlapAndAlignmentRisk(ReadingData& data);
+    void computeRegistration(ReadingData& data);
+    // Set prior map from a tiled map file (.aicpmap, pre-filtered): tiles are loaded
+    // around the robot when needed (loadPriorMapTiles)
+    bool setPriorMap(const std::string& tiled_map_file,
+                     int64_t utime);
+    // Returns true if new tiles were added to the prior map
+    bool loadPriorMapTiles(const Eigen::Isometry3d& pose);
+    // Merge cloud into the built map (capped around pose) and publish it
+    void addToAlignedMap(pcl::PointCloud<pcl::PointXYZ>::Ptr& cloud,
+                         const Eigen::Isometry3d& pose,
+                         int64_t utime);
+    // Set prior map (pre-filtered cloud, map coordinates)
+    void setPriorMap(pcl::PointCloud<pcl::PointXYZ>::Ptr& map_cloud,
+                     int64_t utime);
 
 protected:
     void paramInit(){
@@ -138,9 +395,23 @@ protected:
 
         valid_correction_ = false;
         force_reference_update_ = false;
+        // First registration against prior map from multiple initial hypotheses
+        initialization_pending_ = true;
 
         // Reference cloud update counters
         updates_counter_ = 0;
+        map_crop_counter_ = 0;
+
+        // Pipelined processing
+        reading_seq_ = 0;
+        reference_final_seq_ = 0;
+        pending_alignments_ = 0;
+        reading_buffer_.reset(new pcl::PointCloud<pcl::PointXYZ>);
+        sampled_buffer_.reset(new pcl::PointCloud<pcl::PointXYZ>);
+
+        // Pose graph
+        nb_loop_closures_added_ = 0;
+        aligned_map_dirty_ = false;
 
         // Count lines output file
         online_results_line_ = 0;
@@ -151,10 +422,38 @@ protected:
         octree_overlap_ = -1.0;
         alignability_ = -1.0;
 
+        // Deadline mode (full settings)
+        compute_level_ = 0;
+        compute_level_calm_cycles_ = 0;
+        iterations_capped_ = false;
+        // Static prior map
+        static_map_id_ = -1;
+        matches_bounded_ = false;
+
+        // Diagnostics (no reading processed)
+        diagnostics_ = Diagnostics();
+        diagnostics_.icp_iterations = -1;
+        diagnostics_.icp_coarse_iterations = -1;
+        diagnostics_.icp_converged = -1;
+        diagnostics_.icp_warm_start = 0;
+        diagnostics_.icp_inlier_ratio = -1.0;
+        diagnostics_.icp_residual_median = -1.0;
+        diagnostics_.icp_residual_p90 = -1.0;
+        diagnostics_.icp_residual_max = -1.0;
+        diagnostics_.icp_degeneracy = -1.0;
+        diagnostics_.icp_inverse_condition_number = -1.0;
+        diagnostics_.icp_degenerate_directions = 0;
+
         // Initialize reading with previous correction when "debug" mode
         initialT_ = Eigen::Matrix4f::Identity(4,4);
+        // Motion model (no previous correction)
+        last_correction_ = Eigen::Isometry3d::Identity();
+        last_correction_valid_ = false;
+        last_read_pose_ = Eigen::Isometry3d::Identity();
+        last_read_motion_ = 0.0;
 
         local_ = Eigen::Isometry3d::Identity();
+        map_crop_pose_ = Eigen::Isometry3d::Identity();
         world_to_body_msg_ = Eigen::Isometry3d::Identity();
         world_to_body_marker_msg_ = Eigen::Isometry3d::Identity();
         corrected_pose_ = Eigen::Isometry3d::Identity(); // world_to_body corrected (world -> body)
@@ -165,28 +464,78 @@ protected:
 
     std::unique_ptr<AbstractRegistrator> registr_;
     std::unique_ptr<AbstractOverlapper> overlapper_;
-    std::unique_ptr<AbstractClassification> classifier_;
+    std::shared_ptr<AbstractClassification> classifier_; // thread-safe, may be shared by streams
 
     // Thread variables
     bool running_;
     std::thread worker_thread_;
-    std::condition_variable worker_condition_;
-    std::mutex worker_mutex_;
-    std::list<AlignedCloudPtr> cloud_queue_;
-    std::mutex data_mutex_;
+    // Input clouds (lock-free, filled by the sensor callbacks)
+    WorkQueue<AlignedCloudPtr> cloud_queue_;
     std::mutex robot_state_mutex_;
     std::mutex robot_behavior_mutex_;
     std::mutex cloud_accumulate_mutex_;
+    // Pipelined processing: reference state shared by the overlap and registration stages
+    std::mutex graph_mutex_;
+    std::mutex reference_mutex_;
+    std::condition_variable reference_condition_;
+    long reading_seq_;
+    long reference_final_seq_;
+    int pending_alignments_;
+    // Temporaries reused from one reading to the next (capacity retained),
+    // each used by a single stage: filter stage
+    pcl::PointCloud<pcl::PointXYZ>::Ptr reading_buffer_;
+    pcl::PointCloud<pcl::PointXYZ>::Ptr sampled_buffer_;
+    // overlap stage
+    std::vector<int> overlap_indices_ref_;
+    std::vector<int> overlap_indices_read_;
+    pcl::PointCloud<pcl::PointXYZ> overlap_points_ref_;
+    pcl::PointCloud<pcl::PointXYZ> overlap_points_read_;
+    // registration stage (geometrically stable sampling of the reading)
+    std::vector<int> sampling_indices_;
+    pcl::PointCloud<pcl::PointXYZRGBNormal> sampled_reading_normals_;
+    pcl::PointCloud<pcl::PointXYZ> sampled_reading_;
+    // Loop closure detection
+    BoundedQueue<int> loop_closure_queue_;
+    std::thread loop_closure_thread_;
+    LoopClosures loop_closures_;
+    std::mutex loop_closures_mutex_;
+    // Updated by the registration stage, read by publishers (getDiagnostics)
+    Diagnostics diagnostics_;
+    std::mutex diagnostics_mutex_;
+    // Deadline mode: level set by the registration stage, read by the filter stage
+    std::atomic<int> compute_level_;
+    int compute_level_calm_cycles_; // consecutive readings well within the deadline
+    bool iterations_capped_; // ICP iteration cap applied to registr_
 
     // Data structure
     AlignedCloudsGraph* aligned_clouds_graph_;
+    // Pose graph over aligned_clouds_graph_ (same ids)
+    PoseGraph pose_graph_;
+    size_t nb_loop_closures_added_;
+    bool aligned_map_dirty_; // references moved since the built map was filled
     // Map
     AlignedCloud* prior_map_;
-    pcl::PointCloud<pcl::PointXYZ> aligned_map_;
+    VoxelMap prior_voxel_map_; // Prior map points (incrementally extended with aligned clouds)
+    // Tiled prior map file (memory-mapped) and tiles already in prior_voxel_map_
+    TiledMapFile tiled_prior_map_;
+    std::unordered_set<VoxelKey, VoxelKeyHash> loaded_map_tiles_;
+    // Prior map of the AppServer streams (replaces prior_voxel_map_ if not NULL)
+    std::shared_ptr<VoxelMap> shared_prior_map_;
+    std::mutex prior_map_mutex_;
+    // Built map (references merged, one point per voxel, appended in place).
+    // Used (and extended) by the worker, aligned_map_mutex_ needed from other threads
+    VoxelMap aligned_map_;
+    std::mutex aligned_map_mutex_;
     // Visualizer
     Visualizer* vis_;
 
     Eigen::Matrix4f initialT_;
+    // Motion model (registration stage): last accepted correction, prior pose of the last
+    // graph reading and its odometry motion from the previous one (meters)
+    Eigen::Isometry3d last_correction_;
+    bool last_correction_valid_;
+    Eigen::Isometry3d last_read_pose_;
+    double last_read_motion_;
 
     // Transformation matrices
     Eigen::Isometry3d local_;
@@ -215,10 +564,13 @@ protected:
     float alignability_;
     // Alignment Risk
     Eigen::MatrixXd risk_prediction_;
+    // Degeneracy (registration output)
+    DegeneracyEstimate degeneracy_;
 
     // Correction variables
     bool valid_correction_;
     bool force_reference_update_;
+    std::atomic<bool> initialization_pending_; // set by the marker callback, cleared by the align stage
     Eigen::Isometry3d corrected_pose_;
     Eigen::Isometry3d total_correction_;
     PathPoses poseNodes_;
@@ -226,9 +578,23 @@ protected:
     int updates_counter_;
     // Current reference pre-filtered
     pcl::PointCloud<pcl::PointXYZ>::Ptr ref_prefiltered;
+    // Prior map cropped around base at map_crop_pose_ (NULL: to be cropped)
+    pcl::PointCloud<pcl::PointXYZ>::Ptr map_crop_;
+    Eigen::Isometry3d map_crop_pose_;
+    int map_crop_counter_;
+    // Static prior map (see isStaticPriorMap): snapshot of the map points (NULL: to be
+    // built), their normals, its id in registr_ and its occupied voxels at octomap resolution
+    pcl::PointCloud<pcl::PointXYZ>::Ptr static_map_;
+    pcl::PointCloud<pcl::PointXYZRGBNormal>::Ptr static_map_normals_;
+    int static_map_id_;
+    VoxelOccupancy static_map_occupancy_;
+    // Static map copy, normals and occupancy (set by the stage updating them)
+    MemoryCounter static_map_memory_;
+    bool matches_bounded_; // max match distance applied to registr_
 
     // DEBUG: Write to file
     pcl::PCDWriter pcd_writer_;
+    DebugWriter debug_writer_; // verbose artefacts (background, dropped when full)
     // Visualization
     pcl::PointCloud<pcl::PointXYZ>::Ptr reference_vis_;
     pcl::PointCloud<pcl::PointXYZ>::Ptr last_reading_vis_;
@@ -0,0 +1,63 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "aicp_registration/app.hpp"
+
+namespace aicp {
+
+// Several streams (one App per robot or sensor) processed by one pool of threads.
+// Each stream keeps its own state (graph, corrections, input queue, registrator),
+// the prior map and the classifier are loaded once and shared.
+// Scheduling is round-robin: a thread processes one cloud of a stream, then moves to
+// the next stream with a queued cloud. A stream is processed by one thread at a time.
+class AppServer
+{
+  public:
+    // num_threads <= 0: number of hardware threads (at most one per stream is busy)
+    explicit AppServer(int num_threads = 0);
+    ~AppServer();
+
+    // Streams added before start (their worker thread must not be started, see App::run)
+    void addStream(const std::shared_ptr<App>& app);
+    void start();
+    void stop();
+
+    // Prior map built once (voxel map of leaf_size, tiled for sub-map extraction)
+    // and shared by all streams. False (map not set) if a stream is already localizing.
+    bool setPriorMap(const pcl::PointCloud<pcl::PointXYZ>& map_cloud, float leaf_size,
+                     float tile_size, int64_t utime);
+
+    size_t getNbStreams() const { return streams_.size(); }
+    size_t getNbThreads() const { return threads_.size(); }
+
+  private:
+    struct Stream
+    {
+      Stream(const std::shared_ptr<App>& app_in) : app(app_in), busy(false) {}
+      std::shared_ptr<App> app;
+      std::atomic<bool> busy;
+    };
+
+    void work();
+    // A stream has a queued cloud and no thread processing it (call with work_mutex_)
+    bool hasWork() const;
+    // Wakes an idle thread
+    void notifyWork();
+
+    int num_threads_;
+    std::vector<std::unique_ptr<Stream> > streams_;
+    std::vector<std::thread> threads_;
+    std::atomic<size_t> next_stream_;
+    std::atomic<bool> running_;
+    std::mutex work_mutex_;
+    std::condition_variable work_condition_; // queued cloud or stop
+    std::mutex prior_map_mutex_;
+};
+
+} // namespace aicp
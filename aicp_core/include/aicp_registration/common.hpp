@@ -3,6 +3,7 @@
 
 #include <iostream>
 #include <string>
+#include <vector>
 
 struct RegistrationParams {
   typedef std::string string;
@@ -14,12 +15,63 @@ struct RegistrationParams {
                                 //Note: either this or PointmatcherRegistrationParams.initialTransform
                                 //should be set (not both)
 
+    struct PrefilterParams
+    {
+      string mode = "default"; // "default", "parallel" or "cuda" (GPU) planes segmentation
+      int numThreads = 0;      // threads used in "parallel" mode (0: all available)
+      float leafSize = 0.08;   // voxel grid leaf size (meters)
+      float mapLeafSize = 0.08; // voxel grid leaf size when streaming prior map from file (meters)
+    } prefilter;
+
+    struct SamplingParams
+    {
+      // Geometrically stable sampling of the reading (planes segmentation normals):
+      // at most maxPoints reading points registered (0: all pre-filtered points)
+      int maxPoints = 0;
+    } sampling;
+
+    struct MotionModelParams
+    {
+      // Initial guess of the ICP correction from the previous one: "none" (identity),
+      // "constant_velocity" (same correction) or "odometry" (scaled by the odometry motion)
+      string mode = "none";
+      float maxScale = 2.0;  // odometry mode: largest odometry motion ratio to the previous reading
+    } motionModel;
+
+    struct InitializationParams
+    {
+      // Multi-hypothesis initialization of the first registration against the prior map
+      int yawSteps = 0;             // yaw perturbations (disabled if neither yaw nor translation steps > 1)
+      float yawRange = 180.0;       // yaw in [-yawRange, yawRange] (degrees)
+      int translationSteps = 1;     // x and y perturbations
+      float translationRange = 1.0; // translation in [-translationRange, translationRange] (meters)
+      float maxDistance = 0.5;      // inlier distance of the scoring (meters)
+      int numThreads = 0;           // hypotheses registered concurrently (0: all available)
+    } initialization;
+
     struct PointmatcherRegistrationParams
     {
       string configFileName = "";
       string initialTransform = ""; //initial transformation for the reading cloud in the form [x,y,theta]
       bool printOutputStatistics = false; //e.g. Hausdorff distance, residual mean distance
+      std::vector<float> pyramidLeafSizes; // coarse-to-fine levels (voxel sizes, meters), solved before
+                                           // the full resolution chain (empty: single level)
+      // Adaptive termination: ICP stopped once the per-iteration transform change stays below
+      // convergenceRatio times its peak (or below the min changes) for convergenceWindow iterations
+      float convergenceRatio = 0.0;          // 0: disabled (chain checkers only)
+      int convergenceWindow = 2;
+      float convergenceMinTranslation = 0.001; // (meters)
+      float convergenceMinRotation = 0.001;    // (radians)
     } pointmatcher;
+
+    struct GICPRegistrationParams
+    {
+      int kCorrespondences = 20;              // neighbours used to estimate point covariances
+      float maxCorrespondenceDistance = 2.0;  // (meters) scaled by the overlap-driven outlier ratio
+      int maxIterations = 50;
+      double transformationEpsilon = 1e-6;
+      int numThreads = 0;                     // threads used for covariances (0: all available)
+    } gicp;
 };
 
 #endif
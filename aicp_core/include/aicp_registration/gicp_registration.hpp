@@ -0,0 +1,105 @@
+#ifndef AICP_GICP_REGISTRATION_HPP_
+#define AICP_GICP_REGISTRATION_HPP_
+
+#include <pcl/point_types.h>
+#include <pcl/point_cloud.h>
+#include <pcl/registration/gicp.h>
+#include <pcl/search/kdtree.h>
+
+//Project lib
+#include "aicp_registration/common.hpp"
+#include "aicp_registration/abstract_registrator.hpp"
+
+#include "aicp_utils/threadPool.hpp"
+
+namespace aicp{
+
+// Generalized-ICP (Segal et al., 2009) based on pcl::GeneralizedIterativeClosestPoint.
+// Point covariances are computed in parallel (OpenMP) from the k nearest neighbours,
+// or directly from the normals when available (XYZRGBNormal clouds, e.g. pre-filter output).
+// The reference (target), its covariances and its KD-tree are kept across readings.
+class GICPRegistration : public AbstractRegistrator {
+  public:
+    typedef pcl::GeneralizedIterativeClosestPoint<pcl::PointXYZ, pcl::PointXYZ> GICP;
+    typedef GICP::MatricesVector MatricesVector;
+    typedef GICP::MatricesVectorPtr MatricesVectorPtr;
+
+    GICPRegistration();
+    explicit GICPRegistration(const RegistrationParams& params);
+    ~GICPRegistration();
+
+    virtual void registerClouds(pcl::PointCloud<pcl::PointXYZ>& cloud_ref, pcl::PointCloud<pcl::PointXYZ>& cloud_read, Eigen::Matrix4f &final_transform);
+    virtual void registerClouds(pcl::PointCloud<pcl::PointXYZRGB>& cloud_ref, pcl::PointCloud<pcl::PointXYZRGB>& cloud_read, Eigen::Matrix4f &final_transform);
+    virtual void registerClouds(pcl::PointCloud<pcl::PointXYZRGBNormal>& cloud_ref, pcl::PointCloud<pcl::PointXYZRGBNormal>& cloud_read, Eigen::Matrix4f &final_transform);
+
+    virtual void setReference(pcl::PointCloud<pcl::PointXYZ>& cloud_ref, int id = -1);
+    virtual void registerReading(pcl::PointCloud<pcl::PointXYZ>& cloud_read, Eigen::Matrix4f &final_transform);
+    virtual void setReference(pcl::PointCloud<pcl::PointXYZRGBNormal>& cloud_ref, int id = -1);
+    virtual void registerReading(pcl::PointCloud<pcl::PointXYZRGBNormal>& cloud_read, Eigen::Matrix4f &final_transform);
+    virtual int registerReading(pcl::PointCloud<pcl::PointXYZ>& cloud_read, const TransformsVector& initial_transforms,
+                                Eigen::Matrix4f &final_transform);
+
+    void setInitialGuess(const Eigen::Matrix4f& guess){
+      initial_guess_ = guess;
+      initial_guess_set_ = true;
+    }
+
+    void getInitializedReading(pcl::PointCloud<pcl::PointXYZ>& initialized_reading){
+      initialized_reading = *reading_cloud_;
+    }
+
+    void getOutputReading(pcl::PointCloud<pcl::PointXYZ>& out_read_cloud){
+      out_read_cloud = out_read_cloud_;
+    }
+
+    // No chain configuration file for GICP
+    void updateConfigParams(std::string config_name){}
+
+    // Outlier ratio scales the maximum correspondence distance
+    // (GICP has no trimmed outlier filter)
+    void setOutlierRatio(float ratio);
+    void setMaxIterationCount(int max_iterations);
+    // Caps the maximum correspondence distance
+    void setMaxMatchDistance(float distance);
+
+    RegistrationQuality getQuality() { return quality_; }
+
+    // Covariances (regularized: plane-like, see Segal et al.)
+    static void computeCovariances(const pcl::PointCloud<pcl::PointXYZ>::Ptr& cloud, int k,
+                                   int num_threads, MatricesVector& covariances);
+    static void computeCovariances(const pcl::PointCloud<pcl::PointXYZRGBNormal>& cloud,
+                                   int num_threads, MatricesVector& covariances);
+
+  private:
+    RegistrationParams params_;
+
+    void setTarget(const MatricesVectorPtr& covariances, int id);
+    void registerClouds(const MatricesVectorPtr& reading_covariances, Eigen::Matrix4f &final_transform);
+    void applyConfig();
+
+    GICP gicp_;
+    // Reference KD-tree and covariances (shared by hypotheses)
+    pcl::search::KdTree<pcl::PointXYZ>::Ptr target_tree_;
+    MatricesVectorPtr target_covariances_;
+    // Hypotheses registration (created on first use)
+    std::unique_ptr<ThreadPool> pool_;
+    int num_threads_;
+    int reference_id_;
+    bool reference_set_;
+    float outlier_ratio_;
+    float max_match_distance_; // <= 0: not capped
+    // Initial guess of the next registration
+    Eigen::Matrix4f initial_guess_;
+    bool initial_guess_set_;
+
+    pcl::PointCloud<pcl::PointXYZ>::Ptr reference_cloud_;
+    pcl::PointCloud<pcl::PointXYZ>::Ptr reading_cloud_;
+    pcl::PointCloud<pcl::PointXYZ> out_read_cloud_;
+    // Last registration
+    RegistrationQuality quality_;
+    std::vector<float> residuals_; // reused
+};
+
+}
+
+#endif
@@ -1,6 +1,9 @@
 #ifndef AICP_POINTMATCHER_REGISTRATION_HPP_
 #define AICP_POINTMATCHER_REGISTRATION_HPP_
 
+#include <memory>
+#include <vector>
+
 #include <Eigen/Eigenvalues>
 
 //Project lib
@@ -11,6 +14,7 @@
 #include "aicp_utils/fileIO.h"
 #include "aicp_utils/icpMonitor.h"
 #include "aicp_utils/filteringUtils.hpp"
+#include "aicp_utils/threadPool.hpp"
 
 using namespace std;
 
@@ -29,11 +33,24 @@ class PointmatcherRegistration : public AbstractRegistrator {
     virtual void registerClouds(pcl::PointCloud<pcl::PointXYZRGB>& cloud_ref, pcl::PointCloud<pcl::PointXYZRGB>& cloud_read, Eigen::Matrix4f &final_transform);
     virtual void registerClouds(pcl::PointCloud<pcl::PointXYZRGBNormal>& cloud_ref, pcl::PointCloud<pcl::PointXYZRGBNormal>& cloud_read, Eigen::Matrix4f &final_transform);
 
+    virtual void setReference(pcl::PointCloud<pcl::PointXYZ>& cloud_ref, int id = -1);
+    virtual void registerReading(pcl::PointCloud<pcl::PointXYZ>& cloud_read, Eigen::Matrix4f &final_transform);
+    virtual void setReference(pcl::PointCloud<pcl::PointXYZRGBNormal>& cloud_ref, int id = -1);
+    virtual void registerReading(pcl::PointCloud<pcl::PointXYZRGBNormal>& cloud_read, Eigen::Matrix4f &final_transform);
+    virtual int registerReading(pcl::PointCloud<pcl::PointXYZ>& cloud_read, const TransformsVector& initial_transforms,
+                                Eigen::Matrix4f &final_transform);
+
     void applyConfig();
     PM::TransformationParameters applyInitialization();
 
 //    PM::ICP getIcp(){ return icp_; }
 
+    void setInitialGuess(const Eigen::Matrix4f& guess)
+    {
+      initial_guess_ = guess;
+      initial_guess_set_ = true;
+    }
+
     void getInitializedReading(pcl::PointCloud<pcl::PointXYZ>& initialized_reading)
     {
       if (initialized_reading_.getNbPoints() > 0)
@@ -49,18 +66,80 @@ class PointmatcherRegistration : public AbstractRegistrator {
       fromDataPointsToPCL(out_read_cloud_, out_read_cloud);
     }
 
+    // Chain is re-loaded from the new file at next registration
     void updateConfigParams(string config_name){
       params_.pointmatcher.configFileName.clear();
-      params_.pointmatcher.configFileName.append(config_name);}
+      params_.pointmatcher.configFileName.append(config_name);
+      reloadChains();}
+
+    // Replace the live TrimmedDistOutlierFilter / CounterTransformationChecker / MaxDistOutlierFilter
+    void setOutlierRatio(float ratio);
+    void setMaxIterationCount(int max_iterations);
+    void setMaxMatchDistance(float distance);
+
+    int getNbIterations() { return nb_iterations_; }
+    int getNbCoarseIterations() { return nb_coarse_iterations_; }
+    int getConverged() { return converged_; }
+    float getInlierRatio() { return inlier_ratio_; }
+    RegistrationQuality getQuality() { return quality_; }
+    DegeneracyEstimate getDegeneracy() { return degeneracy_; }
 
   private:
     RegistrationParams params_;
 
     void registerClouds(Eigen::Matrix4f &final_transform);
-
-    PM::ICP icp_;
+    // Shared by the point type overloads (normals: reference and reading carry "normals")
+    template <typename PointT>
+    void setReferenceCloud(pcl::PointCloud<PointT>& cloud_ref, int id, bool normals);
+    template <typename PointT>
+    void registerReadingCloud(pcl::PointCloud<PointT>& cloud_read, Eigen::Matrix4f &final_transform);
+    // Filters the reference of the current chains and initializes their matchers (KD-trees) on it
+    void setMap();
+    void loadChain(PM::ICPSequence& icp);
+
+    // Re-applies the pending in-memory tuning to the current chains
+    void applyTuning();
+    // Chains loaded again (both reference types) at next registration
+    void reloadChains() { chain_sets_[0].loaded = false; chain_sets_[1].loaded = false; }
+
+    // Chains of a reference type: ICP sequence, filtered reference (map) and its matcher
+    // persist between readings
+    struct ChainSet
+    {
+      ChainSet() : loaded(false), reference_id(-1) {}
+      PM::ICPSequence icp;
+      // Pyramid mode: coarse levels (decreasing leaf size), solved before icp
+      std::vector<std::unique_ptr<PM::ICPSequence> > coarse_icp;
+      PM::DataPointsFilters coarse_voxel_filters; // reference down-sampling, one per coarse level
+      bool loaded;
+      int reference_id;
+      DP reference_cloud;
+    };
+    // XYZ references and references with normals (SurfaceNormalDataPointsFilter removed from
+    // the chains): switching between them keeps both maps, no chain reload
+    ChainSet chain_sets_[2];
+    ChainSet* chains_; // current reference type: chain_sets_[input_normals_]
+    bool input_normals_;
+    // Chain configuration (read once from params_.pointmatcher.configFileName, empty: default chain)
+    string chain_yaml_;
+    // Hypotheses registration (created on first use)
+    std::unique_ptr<ThreadPool> pool_;
+    // Pending in-memory tuning (< 0 if unset), applied on top of the loaded chain
+    float outlier_ratio_;
+    int max_iteration_count_;
+    float max_match_distance_;
+    // Initial guess of the next registration
+    Eigen::Matrix4f initial_guess_;
+    bool initial_guess_set_;
+    // Last registration (fine level)
+    int nb_iterations_;
+    int nb_coarse_iterations_;
+    int converged_;
+    float inlier_ratio_;
+    RegistrationQuality quality_;
+    DegeneracyEstimate degeneracy_;
+    std::vector<float> residuals_; // reused
   
-    DP reference_cloud_;
     DP reading_cloud_;
     DP initialized_reading_;
     DP out_read_cloud_;
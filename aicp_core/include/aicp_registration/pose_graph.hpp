@@ -0,0 +1,64 @@
+#pragma once
+
+#include <vector>
+
+#include <Eigen/Geometry>
+#include <Eigen/StdVector>
+
+namespace aicp {
+
+// Pose graph (one node per graph cloud) with relative pose edges.
+// Nodes are placed by their edges when added: only loop closures call for an
+// optimization, restricted to the nodes after the older end of the loop
+// (sparse Gauss-Newton, earlier nodes fixed), so that the cost of a loop closure
+// depends on its length and not on the size of the graph.
+class PoseGraph
+{
+public:
+    typedef Eigen::Matrix<double, 6, 6> InformationMatrix;
+    typedef Eigen::Matrix<double, 6, 1> Vector6d;
+
+    enum EdgeType { ODOMETRY, REGISTRATION, LOOP_CLOSURE };
+
+    PoseGraph();
+    ~PoseGraph();
+
+    // Returns node id (nodes numbered from 0 in order of addition)
+    int addNode(const Eigen::Isometry3d& pose);
+    // measurement: pose of node to in the frame of node from
+    void addEdge(int from, int to, const Eigen::Isometry3d& measurement,
+                 const InformationMatrix& information, EdgeType type);
+
+    // Optimizes nodes after first_free (nodes up to first_free are fixed).
+    // Returns the number of iterations, updated: nodes moved by more than epsilon.
+    int optimize(int first_free, int max_iterations, std::vector<int>& updated, double epsilon = 1e-4);
+
+    Eigen::Isometry3d getPose(int id){ return poses_.at(id); }
+    int getNbNodes(){ return poses_.size(); }
+    int getNbEdges(){ return edges_.size(); }
+    int getNbLoopClosures(){ return nb_loop_closures_; }
+
+    // Error of measurement (translation, rotation vector) for poses of from and to
+    static Vector6d computeError(const Eigen::Isometry3d& measurement,
+                                 const Eigen::Isometry3d& from, const Eigen::Isometry3d& to);
+    // Pose increment (translation, rotation vector) applied on the right
+    static Eigen::Isometry3d expmap(const Vector6d& delta);
+
+private:
+    struct Edge
+    {
+        EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+        int from;
+        int to;
+        Eigen::Isometry3d measurement;
+        InformationMatrix information;
+        EdgeType type;
+    };
+
+    std::vector<Eigen::Isometry3d, Eigen::aligned_allocator<Eigen::Isometry3d> > poses_;
+    std::vector<Edge, Eigen::aligned_allocator<Edge> > edges_;
+    std::vector<std::vector<int> > node_edges_; // Edges of each node
+    int nb_loop_closures_;
+};
+}
@@ -3,6 +3,7 @@
 
 #include "aicp_registration/abstract_registrator.hpp"
 #include "aicp_registration/pointmatcher_registration.hpp"
+#include "aicp_registration/gicp_registration.hpp"
 
 namespace aicp {
 
@@ -11,7 +12,7 @@ namespace aicp {
     if (parameters.type == "Pointmatcher") {
       registrator = std::unique_ptr<AbstractRegistrator>(new PointmatcherRegistration(parameters));
     } else if (parameters.type == "GICP") {
-    //  registrator = std::unique_ptr<AbstractRegistrator>(new GICPRegistration(parameters));
+      registrator = std::unique_ptr<AbstractRegistrator>(new GICPRegistration(parameters));
     } else {
       std::cerr << "Invalid registration type " << parameters.type << "." << std::endl;
     }
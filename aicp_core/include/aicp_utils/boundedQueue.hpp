@@ -0,0 +1,69 @@
+#ifndef AICP_BOUNDED_QUEUE_HPP_
+#define AICP_BOUNDED_QUEUE_HPP_
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+
+// FIFO queue of limited capacity shared by producer and consumer threads.
+// push blocks while the queue is full, pop blocks while it is empty.
+// After close, push fails and pop returns the remaining items, then fails.
+template <typename T>
+class BoundedQueue
+{
+  public:
+    explicit BoundedQueue(size_t capacity) :
+      capacity_(capacity > 0 ? capacity : 1), closed_(false) {}
+    ~BoundedQueue(){}
+
+    bool push(const T& item)
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      not_full_.wait(lock, [this](){ return closed_ || items_.size() < capacity_; });
+      if (closed_)
+        return false;
+      items_.push_back(item);
+      lock.unlock();
+      not_empty_.notify_one();
+      return true;
+    }
+
+    bool pop(T& item)
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      not_empty_.wait(lock, [this](){ return closed_ || !items_.empty(); });
+      if (items_.empty())
+        return false;
+      item = items_.front();
+      items_.pop_front();
+      lock.unlock();
+      not_full_.notify_one();
+      return true;
+    }
+
+    void close()
+    {
+      {
+        std::unique_lock<std::mutex> lock(mutex_);
+        closed_ = true;
+      }
+      not_full_.notify_all();
+      not_empty_.notify_all();
+    }
+
+    size_t size()
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      return items_.size();
+    }
+
+  private:
+    std::deque<T> items_;
+    size_t capacity_;
+    bool closed_;
+    std::mutex mutex_;
+    std::condition_variable not_full_;
+    std::condition_variable not_empty_;
+};
+
+#endif
@@ -0,0 +1,38 @@
+#ifndef AICP_CLOUD_CODEC_HPP_
+#define AICP_CLOUD_CODEC_HPP_
+
+#include <cstdint>
+#include <vector>
+
+#include <pcl/point_types.h>
+#include <pcl/point_cloud.h>
+
+// Compressed point clouds for transport (visualization, remote clients). Coordinates are
+// quantized at resolution and grouped in cells of 2^cell_bits steps, visited in scan order:
+// each occupied cell is a varint delta to the previous cell and a varint point count, the
+// points are their offsets in the cell, bit-packed (3 x cell_bits bits per point).
+// About 1.5-2.5 bytes per map point at 1-2 cm (16 for an XYZ + RGB PointCloud2).
+// Points are reordered, max error: half a step per coordinate.
+class CloudCodec
+{
+  public:
+    // cell_size (m): ~2 map leaf sizes is the smallest encoding
+    explicit CloudCodec(float resolution = 0.01f, float cell_size = 0.16f);
+    ~CloudCodec(){}
+
+    // Non-finite points are dropped, data is overwritten (little-endian hosts)
+    void encode(const pcl::PointCloud<pcl::PointXYZ>& cloud, int64_t utime, std::vector<uint8_t>& data);
+    // Returns false if data is not a valid encoding (cloud_out cleared)
+    static bool decode(const uint8_t* data, size_t size, pcl::PointCloud<pcl::PointXYZ>& cloud_out,
+                       int64_t& utime);
+
+    float getResolution() const { return resolution_; }
+
+  private:
+    float resolution_;
+    int cell_bits_;
+    // Cell index (scan order) and offsets of the points, reused
+    std::vector<uint64_t> keys_;
+};
+
+#endif
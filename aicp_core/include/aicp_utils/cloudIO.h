@@ -18,9 +18,14 @@ int savePlanarCloudCSV (const std::string &file_name, const pcl::PCLPointCloud2
 void savePointCloudPCLwithPose(const std::string file_name, pcl::PointCloud<pcl::PointXYZRGB>::Ptr cloud, Eigen::Isometry3d sensor_pose = Eigen::Isometry3d::Identity());
 
 
+// Conversions: x, y, z as features, other fields of the point type as descriptors
+// (intensity; red, green, blue; normals)
 void fromDataPointsToPCL(DP &cloud_in, pcl::PointCloud<pcl::PointXYZ> &cloud_out);
 void fromPCLToDataPoints(DP &cloud_out, pcl::PointCloud<pcl::PointXYZ> &cloud_in);
 
+void fromDataPointsToPCL(DP &cloud_in, pcl::PointCloud<pcl::PointXYZI> &cloud_out);
+void fromPCLToDataPoints(DP &cloud_out, pcl::PointCloud<pcl::PointXYZI> &cloud_in);
+
 void fromDataPointsToPCL(DP &cloud_in, pcl::PointCloud<pcl::PointXYZRGB> &cloud_out);
 void fromPCLToDataPoints(DP &cloud_out, pcl::PointCloud<pcl::PointXYZRGB> &cloud_in);
 
@@ -0,0 +1,104 @@
+#ifndef AICP_CLOUD_LOG_HPP_
+#define AICP_CLOUD_LOG_HPP_
+
+#include <atomic>
+#include <cstdint>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <Eigen/Dense>
+
+#include <pcl/point_types.h>
+#include <pcl/point_cloud.h>
+
+#include "aicp_utils/boundedQueue.hpp"
+
+// Append-only log of input clouds (.aicplog), one record per cloud.
+// Layout (native little-endian):
+//   header:  char[8] "AICPLOG1", uint32 version, uint32 reserved
+//   records: uint32 record_size (bytes after this field), int64 utime,
+//            double pose x, y, z, qx, qy, qz, qw, uint32 nb_points,
+//            float resolution (0: float coordinates), float origin x, y, z,
+//            uint32 raw_size, uint32 stored_size (== raw_size: not compressed),
+//            char block[stored_size]
+// The block holds the x[], y[], z[] arrays (int16 offsets to origin if quantized,
+// floats otherwise), byte-shuffled (bytes of same significance together) and
+// LZF-compressed. A truncated last record (e.g. interrupted recording) is ignored on read.
+
+// Records are encoded and written by a background thread.
+class CloudLogWriter
+{
+  public:
+    CloudLogWriter();
+    ~CloudLogWriter();
+
+    // resolution: quantization step of the coordinates (0: lossless)
+    // queue_size: clouds waiting to be written before append blocks
+    bool open(const std::string& file_name, float resolution = 0.0f, size_t queue_size = 100);
+    // Writes the queued records
+    void close();
+    bool isOpen() const { return thread_.joinable(); }
+
+    // The cloud is shared with the writer thread (must not be modified afterwards)
+    bool append(int64_t utime, const Eigen::Isometry3d& pose,
+                const pcl::PointCloud<pcl::PointXYZ>::ConstPtr& cloud);
+
+    size_t getNbRecords() const { return nb_records_; }
+    uint64_t getNbBytes() const { return nb_bytes_; }
+
+  private:
+    struct Record
+    {
+      int64_t utime;
+      double pose[7];
+      pcl::PointCloud<pcl::PointXYZ>::ConstPtr cloud;
+    };
+
+    void writeRecords();
+    void writeRecord(const Record& record);
+
+    std::ofstream file_;
+    std::string file_name_;
+    float resolution_;
+    std::unique_ptr<BoundedQueue<Record> > queue_;
+    std::thread thread_;
+
+    // Buffers reused from one record to the next
+    std::vector<char> raw_;
+    std::vector<char> shuffled_;
+    std::vector<char> stored_;
+
+    std::atomic<size_t> nb_records_;
+    std::atomic<uint64_t> nb_bytes_;
+};
+
+// The file is memory-mapped on open and its records indexed. Reads are const
+// (records can be decoded concurrently).
+class CloudLogReader
+{
+  public:
+    CloudLogReader();
+    ~CloudLogReader();
+
+    bool open(const std::string& file_name);
+    void close();
+    bool isOpen() const { return data_ != NULL; }
+
+    size_t size() const { return records_.size(); }
+    int64_t getUtime(size_t index) const;
+    Eigen::Isometry3d getPose(size_t index) const;
+    // False if the record is corrupted
+    bool readCloud(size_t index, pcl::PointCloud<pcl::PointXYZ>& cloud_out) const;
+
+  private:
+    int fd_;
+    const char* data_;
+    size_t size_;
+    // Offsets of the records (after the size field)
+    std::vector<uint64_t> records_;
+};
+
+#endif
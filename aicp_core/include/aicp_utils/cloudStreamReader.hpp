@@ -0,0 +1,44 @@
+#ifndef AICP_CLOUD_STREAM_READER_HPP_
+#define AICP_CLOUD_STREAM_READER_HPP_
+
+#include <fstream>
+#include <string>
+#include <vector>
+
+// Reads the points (x, y, z) of a PLY or PCD file in chunks, so that large files
+// (e.g. prior maps) can be processed without loading them in memory.
+// Supported formats: PLY ascii and binary_little_endian, PCD ascii and binary.
+class CloudStreamReader
+{
+  public:
+    CloudStreamReader();
+    ~CloudStreamReader(){}
+
+    bool open(const std::string& file_name);
+    void close();
+
+    // Reads up to max_points points (interleaved x, y, z coordinates).
+    // Returns the number of points read (0 at the end of the file).
+    size_t readChunk(std::vector<float>& xyz, size_t max_points);
+
+    size_t getNbPoints() const { return nb_points_; }
+
+  private:
+    bool parsePLYHeader();
+    bool parsePCDHeader();
+
+    std::ifstream file_;
+    bool binary_;
+    size_t nb_points_;
+    size_t nb_read_;
+
+    // Binary: bytes per point, byte offset and size (4 or 8) of x, y, z
+    // ASCII: values per point, column of x, y, z
+    size_t point_step_;
+    size_t offsets_[3];
+    size_t sizes_[3];
+
+    std::vector<char> buffer_;
+};
+
+#endif
@@ -0,0 +1,50 @@
+#ifndef AICP_COMPACT_CLOUD_HPP_
+#define AICP_COMPACT_CLOUD_HPP_
+
+#include <cstdint>
+#include <vector>
+
+#include <Eigen/Dense>
+
+#include <pcl/point_types.h>
+#include <pcl/point_cloud.h>
+
+// Quantized point cloud: 16-bit fixed-point offsets (x, y, z arrays) to an origin,
+// i.e. 6 bytes per point instead of 16 for pcl::PointXYZ.
+// The quantization step is the requested resolution, increased if needed to fit
+// the cloud extent around the origin (max error: half a step per coordinate).
+class CompactCloud
+{
+  public:
+    CompactCloud();
+    ~CompactCloud(){}
+
+    // Non-finite points are dropped
+    void encode(const pcl::PointCloud<pcl::PointXYZ>& cloud, const Eigen::Vector3f& origin,
+                float resolution = 0.002f);
+    // cloud_out is resized (its storage is reused from one call to the next)
+    void decode(pcl::PointCloud<pcl::PointXYZ>& cloud_out) const;
+    void clear();
+    // Sets the quantized coordinates (e.g. read from file)
+    void assign(const Eigen::Vector3f& origin, float resolution, const int16_t* x, const int16_t* y,
+                const int16_t* z, size_t nb_points);
+
+    size_t size() const { return x_.size(); }
+    bool empty() const { return x_.empty(); }
+    float getResolution() const { return resolution_; }
+    const Eigen::Vector3f& getOrigin() const { return origin_; }
+    const int16_t* getX() const { return x_.data(); }
+    const int16_t* getY() const { return y_.data(); }
+    const int16_t* getZ() const { return z_.data(); }
+    // Bytes used by the coordinates
+    size_t getMemoryUsage() const { return 3 * x_.capacity() * sizeof(int16_t); }
+
+  private:
+    Eigen::Vector3f origin_;
+    float resolution_;
+    std::vector<int16_t> x_;
+    std::vector<int16_t> y_;
+    std::vector<int16_t> z_;
+};
+
+#endif
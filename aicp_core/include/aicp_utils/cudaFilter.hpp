@@ -0,0 +1,33 @@
+#ifndef AICP_CUDA_FILTER_HPP_
+#define AICP_CUDA_FILTER_HPP_
+
+#include <cmath>
+#include <cstddef>
+#include <vector>
+
+// GPU backend of the planes segmentation pre-filter (built if CUDA is found, see
+// cudaRegionGrowingUniformPlaneSegmentationFilter). Plain arrays interface: PCL headers
+// are not compiled by nvcc.
+
+struct CudaPlaneSegmentationParams
+{
+  float leaf_size = 0.08f;
+  int nb_normal_neighbours = 30; // k nearest neighbours of the normal estimation (at most 32)
+  int nb_region_neighbours = 15; // nearest neighbours connected by the region growing
+  float smoothness_threshold = 3.0 / 180.0 * M_PI;
+  float view_point[3] = {0.0f, 0.0f, 0.0f}; // normals are oriented towards it
+};
+
+// True if a CUDA device can be used (checked once)
+bool cudaFilterAvailable();
+
+// xyz: interleaved coordinates of nb_points finite points. Outputs per voxel centroid:
+// - sampled_xyz: centroid coordinates, in the order of pcl::VoxelGrid (voxel index)
+// - normals: nx, ny, nz, curvature (NaN if the centroid has less than 3 neighbours)
+// - labels: planes, smallest centroid index of the connected component
+// False on CUDA errors or if the voxel indices exceed 64 bits (callers use the CPU filter).
+bool cudaPlaneSegmentation(const float* xyz, size_t nb_points, const CudaPlaneSegmentationParams& params,
+                           std::vector<float>& sampled_xyz, std::vector<float>& normals,
+                           std::vector<int>& labels);
+
+#endif
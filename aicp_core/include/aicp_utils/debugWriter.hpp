@@ -0,0 +1,49 @@
+#ifndef AICP_DEBUG_WRITER_HPP_
+#define AICP_DEBUG_WRITER_HPP_
+
+#include <atomic>
+#include <functional>
+#include <string>
+#include <thread>
+
+#include <pcl/point_types.h>
+#include <pcl/point_cloud.h>
+
+#include "aicp_utils/workQueue.hpp"
+
+// Debug artefacts (clouds, VTK files...) written by a background thread.
+// Writes are queued without blocking the caller and dropped when the queue is full,
+// so that verbose mode does not distort the latencies of the pipeline.
+class DebugWriter
+{
+  public:
+    typedef std::function<void()> Job;
+    typedef WorkQueue<Job>::Stats Stats;
+
+    // queue_size: writes waiting before new ones are dropped
+    // binary: binary PCD clouds (ASCII otherwise)
+    explicit DebugWriter(size_t queue_size = 10, bool binary = true);
+    // Writes the queued jobs
+    ~DebugWriter();
+
+    void setBinary(bool binary) { binary_ = binary; }
+
+    // The cloud is shared with the writer thread (must not be modified afterwards).
+    // False if dropped.
+    bool writeCloud(const std::string& file_name,
+                    const pcl::PointCloud<pcl::PointXYZ>::ConstPtr& cloud);
+    // Any write, data captured by the job. False if dropped.
+    bool post(const Job& job);
+
+    Stats getStats() const { return queue_.getStats(); }
+
+  private:
+    void run();
+
+    WorkQueue<Job> queue_;
+    std::atomic<bool> binary_;
+    std::atomic<bool> running_;
+    std::thread thread_;
+};
+
+#endif
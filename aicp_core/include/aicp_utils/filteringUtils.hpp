@@ -2,6 +2,7 @@
 #define FILTERING_UTILS_HPP_
 
 #include <algorithm>    // std::min
+#include <functional>
 
 //PCL
 #include <pcl/ModelCoefficients.h>
@@ -19,6 +20,7 @@
 #include <pcl/search/search.h>
 #include <pcl/search/kdtree.h>
 #include <pcl/features/normal_3d.h>
+#include <pcl/features/normal_3d_omp.h>
 #include <pcl/features/moment_of_inertia_estimation.h>
 #include <pcl/common/common.h>
 #include <pcl/common/transforms.h>
@@ -26,25 +28,105 @@
 #include <pcl/visualization/pcl_visualizer.h>
 #include <pcl/visualization/cloud_viewer.h>
 
+#include "aicp_utils/segmentedCloud.hpp"
+#include "aicp_utils/voxelGrid.hpp"
+
+// Plane cluster data used for planes matching (see alignabilityFilter)
+struct ClusterDescriptor
+{
+  Eigen::Vector3f normal;             // normals centroid
+  Eigen::Vector3f box_position;       // oriented bounding box, enlarged along plane normal
+  Eigen::Matrix3f box_rotation;       // (box to cloud frame rotation)
+  Eigen::Vector3f box_min, box_max;   // (box frame)
+  Eigen::Vector3f aabb_min, aabb_max; // axis aligned bounds of the oriented box (cloud frame)
+  Eigen::Vector3f points_min, points_max; // axis aligned bounds of the cluster points
+  int nb_points;
+};
+
+void regionGrowingUniformPlaneSegmentationFilter(pcl::PointCloud<pcl::PointXYZ>::Ptr cloud_in,
+                                                 pcl::PointCloud<pcl::PointXYZ>::Ptr cloud_out,
+                                                 float leaf_size = 0.08f);
 void regionGrowingUniformPlaneSegmentationFilter(pcl::PointCloud<pcl::PointXYZ>::Ptr cloud_in,
-                                                 pcl::PointCloud<pcl::PointXYZ>::Ptr cloud_out);
+                                                 pcl::PointCloud<pcl::PointXYZ>::Ptr cloud_sampled_out,
+                                                 std::vector<int>& indices_out,
+                                                 float leaf_size = 0.08f);
 void regionGrowingUniformPlaneSegmentationFilter(pcl::PointCloud<pcl::PointXYZ>::Ptr cloud_in,
                                                  pcl::PointCloud<pcl::PointXYZRGBNormal>::Ptr cloud_sampled_out,
                                                  Eigen::Isometry3d view_point,
-                                                 std::vector<pcl::PointIndices>& clusters);
+                                                 std::vector<pcl::PointIndices>& clusters,
+                                                 float leaf_size = 0.08f);
+void regionGrowingUniformPlaneSegmentationFilter(pcl::PointCloud<pcl::PointXYZ>::Ptr cloud_in,
+                                                 pcl::PointCloud<pcl::PointXYZ>::Ptr cloud_out,
+                                                 Eigen::Isometry3d view_point,
+                                                 SegmentedCloud& segmented_out,
+                                                 float leaf_size = 0.08f);
+void parallelRegionGrowingUniformPlaneSegmentationFilter(pcl::PointCloud<pcl::PointXYZ>::Ptr cloud_in,
+                                                         pcl::PointCloud<pcl::PointXYZ>::Ptr cloud_out,
+                                                         Eigen::Isometry3d view_point,
+                                                         SegmentedCloud& segmented_out,
+                                                         int num_threads,
+                                                         float leaf_size = 0.08f);
+void cudaRegionGrowingUniformPlaneSegmentationFilter(pcl::PointCloud<pcl::PointXYZ>::Ptr cloud_in,
+                                                     pcl::PointCloud<pcl::PointXYZ>::Ptr cloud_out,
+                                                     Eigen::Isometry3d view_point,
+                                                     SegmentedCloud& segmented_out,
+                                                     float leaf_size = 0.08f);
+void buildSegmentedCloud(const pcl::PointCloud<pcl::PointXYZRGBNormal>& cloud_sampled,
+                         const std::vector<pcl::PointIndices>& clusters,
+                         SegmentedCloud& segmented_out);
+void colorClusters(pcl::PointCloud<pcl::PointXYZRGBNormal>& cloud,
+                   const std::vector<pcl::PointIndices>& clusters);
+void voxelGridFilter(pcl::PointCloud<pcl::PointXYZ>::Ptr cloud_in, float leaf_size,
+                     pcl::PointCloud<pcl::PointXYZ>& cloud_out);
+void hashVoxelGridFilter(const pcl::PointCloud<pcl::PointXYZ>& cloud_in, float leaf_size,
+                         pcl::PointCloud<pcl::PointXYZ>& cloud_out);
+// progress (optional): called after each chunk with the fraction of the points read
+bool loadVoxelizedCloudFromFile(const std::string& file_name, float leaf_size,
+                                pcl::PointCloud<pcl::PointXYZ>& cloud_out,
+                                size_t chunk_size = 1000000,
+                                const std::function<void(float)>& progress = std::function<void(float)>());
+void getVoxelGridCloud(const HashVoxelGrid& voxel_grid, pcl::PointCloud<pcl::PointXYZ>& cloud_out);
+void getClustersIndices(const std::vector<pcl::PointIndices>& clusters, std::vector<int>& indices_out);
+void gatherPoints(const pcl::PointCloud<pcl::PointXYZ>& cloud_in, const std::vector<int>& indices,
+                  pcl::PointCloud<pcl::PointXYZ>& cloud_out);
+// Normals from the k nearest neighbours (num_threads <= 0: all), points without a valid normal dropped
+void estimateNormalsFilter(pcl::PointCloud<pcl::PointXYZ>::Ptr cloud_in,
+                           pcl::PointCloud<pcl::PointXYZRGBNormal>& cloud_out,
+                           int k = 20, int num_threads = 0);
 
 float overlapFilter(pcl::PointCloud<pcl::PointXYZ>& cloudA, pcl::PointCloud<pcl::PointXYZ>& cloudB,
                    Eigen::Isometry3d poseA, Eigen::Isometry3d poseB,
                    float range, float angularView,
                    pcl::PointCloud<pcl::PointXYZ>& accepted_pointsA,
                    pcl::PointCloud<pcl::PointXYZ>& accepted_pointsB);
+float overlapFilter(pcl::PointCloud<pcl::PointXYZ>& cloudA, pcl::PointCloud<pcl::PointXYZ>& cloudB,
+                   Eigen::Isometry3d poseA, Eigen::Isometry3d poseB,
+                   float range, float angularView,
+                   std::vector<int>& accepted_indicesA,
+                   std::vector<int>& accepted_indicesB);
 
+// cloudA_planes, cloudB_planes (matched planes) and eigenvectors are
+// visualization outputs, computed only if not NULL
 float alignabilityFilter(pcl::PointCloud<pcl::PointXYZ>& cloudA, pcl::PointCloud<pcl::PointXYZ>& cloudB,
                          Eigen::Isometry3d poseA, Eigen::Isometry3d poseB,
                          pcl::PointCloud<pcl::PointXYZRGBNormal>::Ptr cloudA_planes, pcl::PointCloud<pcl::PointXYZRGBNormal>::Ptr cloudB_planes,
                          pcl::PointCloud<pcl::PointXYZRGBNormal>::Ptr eigenvectors);
+float alignabilityFilter(SegmentedCloud& segmentedA, SegmentedCloud& segmentedB,
+                         const std::vector<int>& indicesA, const std::vector<int>& indicesB,
+                         pcl::PointCloud<pcl::PointXYZRGBNormal>::Ptr cloudA_planes, pcl::PointCloud<pcl::PointXYZRGBNormal>::Ptr cloudB_planes,
+                         pcl::PointCloud<pcl::PointXYZRGBNormal>::Ptr eigenvectors);
+void getClustersInRegion(SegmentedCloud& segmented, const std::vector<int>& indices,
+                         std::vector<pcl::PointIndices>& clusters);
 void computeNormalsCentroid(pcl::PointCloud<pcl::PointXYZRGBNormal>& cloud, Eigen::Vector3f& centroid);
 float overlapBoxFilter(pcl::PointCloud<pcl::PointXYZRGBNormal>& planeA, pcl::PointCloud<pcl::PointXYZRGBNormal>& planeB);
+void computeClusterDescriptor(pcl::PointCloud<pcl::PointXYZRGBNormal>::Ptr cloud, const pcl::PointIndices& cluster,
+                              ClusterDescriptor& descriptor);
+int getPointsInClusterBox(const pcl::PointCloud<pcl::PointXYZRGBNormal>& cloud, const pcl::PointIndices& cluster,
+                          const ClusterDescriptor& descriptor);
+float overlapBoxFilter(const pcl::PointCloud<pcl::PointXYZRGBNormal>& cloudA, const pcl::PointIndices& clusterA,
+                       const ClusterDescriptor& descriptorA,
+                       const pcl::PointCloud<pcl::PointXYZRGBNormal>& cloudB, const pcl::PointIndices& clusterB,
+                       const ClusterDescriptor& descriptorB);
 void getOrientedBoundingBox(pcl::PointCloud<pcl::PointXYZRGBNormal>::Ptr cloud,
                             pcl::PointXYZRGBNormal& min_point_OBB, pcl::PointXYZRGBNormal& max_point_OBB,
                             pcl::PointXYZRGBNormal& position_OBB, Eigen::Matrix3f& rotational_matrix_OBB);
@@ -52,9 +134,24 @@ float getPointsInOrientedBox(pcl::PointCloud<pcl::PointXYZRGBNormal>::Ptr cloud,
                              pcl::PointXYZRGBNormal& min_point_OBB, pcl::PointXYZRGBNormal& max_point_OBB,
                              pcl::PointXYZRGBNormal& position_OBB, Eigen::Matrix3f& rotational_matrix_OBB);
 
-void registrationFailurePredictionFilter(Eigen::MatrixXf system_covariance, std::vector<float>& predictions);
+// predictions: degeneracy (%, degenerate if ~ 0) and inverse condition number (want 1) of the
+// translation block of the (symmetric) 6x6 ICP system [roll, pitch, yaw, x, y, z]
+void registrationFailurePredictionFilter(const Eigen::MatrixXf& system_covariance, std::vector<float>& predictions);
+// Geometrically stable sampling (Gelfand et al., 2003): at most nb_samples points of segmented
+// constraining the 6 DoF of a point-to-plane alignment as evenly as possible (plane normals of
+// the clusters, point normals otherwise). Indices to segmented.cloud, in increasing order.
+void geometricallyStableSampling(const SegmentedCloud& segmented, size_t nb_samples,
+                                 std::vector<int>& indices_out);
 
 void getPointsInOrientedBox(pcl::PointCloud<pcl::PointXYZ>::Ptr& cloud,
                             float min, float max,
                             Eigen::Matrix4f &origin);
+
+// Keeps the points of cloud in the box [min, max]^3 of box_pose (box to cloud frame),
+// compacted in place in one pass (order kept, NaN points removed). Returns the points kept.
+size_t cropOrientedBox(pcl::PointCloud<pcl::PointXYZ>& cloud, float min, float max,
+                       const Eigen::Isometry3f& box_pose);
+// Same, kept points also moved by output_transform (same pass)
+size_t cropOrientedBox(pcl::PointCloud<pcl::PointXYZ>& cloud, float min, float max,
+                       const Eigen::Isometry3f& box_pose, const Eigen::Isometry3f& output_transform);
 #endif
@@ -11,6 +11,7 @@
 
 //Project lib
 #include "aicp_utils/vtkUtils.h"
+#include "aicp_utils/debugWriter.hpp"
 
 
 using namespace std;
@@ -22,8 +23,7 @@ typedef PM::DataPoints DP;
 float hausdorffDistance(DP &ref, DP &out);
 float hausdorffDistance(DP &ref, DP &out, const char *filename);
 
-PM::Matrix distancesKNN(DP &A, DP &B);
-PM::Matrix distancesKNN(DP &A, DP &B, const char *filename);
+PM::Matrix distancesKNN(DP &A, DP &B, DebugWriter *writer = NULL, const char *filename = "readDistances.vtk");
 
 float pairedPointsMeanDistance(DP &ref, DP &out, PM::ICP &icp);
 float pairedPointsMeanDistance(DP &ref, DP &out, PM::ICP &icp, const char *filename);
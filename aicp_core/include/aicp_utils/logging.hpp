@@ -0,0 +1,79 @@
+#ifndef AICP_LOGGING_HPP_
+#define AICP_LOGGING_HPP_
+
+#include <atomic>
+#include <cstddef>
+#include <sstream>
+#include <string>
+
+// Leveled logging. Records below the runtime level are not formatted, records
+// below AICP_LOG_MIN_LEVEL (0: debug, 1: info, 2: warn, 3: error) are compiled out.
+// By default records are written by the calling thread; after Logger::startAsync they
+// are queued (lock-free) and written by a background thread. When the queue is full,
+// debug and info records are dropped, warnings and errors written by the calling thread.
+enum class LogLevel { DEBUG = 0, INFO = 1, WARN = 2, ERROR = 3 };
+
+#ifndef AICP_LOG_MIN_LEVEL
+#define AICP_LOG_MIN_LEVEL 0
+#endif
+
+class Logger
+{
+  public:
+    struct Record
+    {
+      LogLevel level;
+      const char* module; // string literal
+      long utime; // wall clock, microseconds
+      std::string message;
+    };
+
+    static void setLevel(LogLevel level) { level_.store((int)level, std::memory_order_relaxed); }
+    static LogLevel getLevel() { return (LogLevel)level_.load(std::memory_order_relaxed); }
+    static bool isEnabled(LogLevel level) { return (int)level >= level_.load(std::memory_order_relaxed); }
+    // "debug", "info", "warn" or "error"
+    static bool parseLevel(const std::string& name, LogLevel& level);
+
+    // queue_size: records waiting to be written before new ones are dropped (debug, info)
+    static void startAsync(size_t queue_size = 4096);
+    // Writes the queued records and joins the writer (also done at exit),
+    // records are then written by the calling thread
+    static void stopAsync();
+    static size_t getNbDropped();
+
+    static void write(LogLevel level, const char* module, const std::string& message);
+
+  private:
+    static std::atomic<int> level_;
+};
+
+#define AICP_LOG(level, module, expr) \
+  do { \
+    if (Logger::isEnabled(level)) \
+    { \
+      std::ostringstream aicp_log_stream; \
+      aicp_log_stream << expr; \
+      Logger::write(level, module, aicp_log_stream.str()); \
+    } \
+  } while (0)
+
+#define AICP_LOG_DISABLED(expr) do { if (false) { std::ostringstream aicp_log_stream; aicp_log_stream << expr; } } while (0)
+
+#if AICP_LOG_MIN_LEVEL <= 0
+#define AICP_LOG_DEBUG(module, expr) AICP_LOG(LogLevel::DEBUG, module, expr)
+#else
+#define AICP_LOG_DEBUG(module, expr) AICP_LOG_DISABLED(expr)
+#endif
+#if AICP_LOG_MIN_LEVEL <= 1
+#define AICP_LOG_INFO(module, expr) AICP_LOG(LogLevel::INFO, module, expr)
+#else
+#define AICP_LOG_INFO(module, expr) AICP_LOG_DISABLED(expr)
+#endif
+#if AICP_LOG_MIN_LEVEL <= 2
+#define AICP_LOG_WARN(module, expr) AICP_LOG(LogLevel::WARN, module, expr)
+#else
+#define AICP_LOG_WARN(module, expr) AICP_LOG_DISABLED(expr)
+#endif
+#define AICP_LOG_ERROR(module, expr) AICP_LOG(LogLevel::ERROR, module, expr)
+
+#endif
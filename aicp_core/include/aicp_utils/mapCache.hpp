@@ -0,0 +1,28 @@
+#ifndef AICP_MAP_CACHE_HPP_
+#define AICP_MAP_CACHE_HPP_
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include <pcl/point_types.h>
+#include <pcl/point_cloud.h>
+
+// Cache of pre-filtered prior maps. Entries are tiled maps (.aicpmap, see TiledMapFile:
+// memory-mapped and loaded by tiles) named after a hash of the map file content and
+// of the filter parameters: a modified map or new parameters give a new entry.
+
+// 64 bit content hash (FNV-1a variant on 8 byte words, not cryptographic). The file is memory-mapped.
+bool hashFile(const std::string& file_name, uint64_t& hash);
+
+// Cache entry of map file_name pre-filtered with parameters, in directory
+// (empty if the map file cannot be read). The entry may not exist yet.
+std::string getMapCacheFile(const std::string& directory, const std::string& file_name,
+                            const std::vector<float>& parameters);
+
+// Creates the directory if needed. The entry is written to a temporary file
+// then renamed (concurrent readers never see a partial entry).
+bool writeMapCacheFile(const std::string& cache_file, const pcl::PointCloud<pcl::PointXYZ>& cloud,
+                       float tile_size, float leaf_size);
+
+#endif
@@ -0,0 +1,59 @@
+#ifndef AICP_MEMORY_USAGE_HPP_
+#define AICP_MEMORY_USAGE_HPP_
+
+#include <atomic>
+#include <cstddef>
+
+// Memory held by a data structure: bytes (estimated from the container sizes) and
+// objects (points, clouds, trees, ... depending on the structure)
+struct MemoryUsage
+{
+  MemoryUsage() : bytes(0), objects(0) {}
+  MemoryUsage(size_t nb_bytes, size_t nb_objects) : bytes(nb_bytes), objects(nb_objects) {}
+
+  MemoryUsage& operator+=(const MemoryUsage& other)
+  {
+    bytes += other.bytes;
+    objects += other.objects;
+    return *this;
+  }
+
+  size_t bytes;
+  size_t objects;
+};
+
+// Counter maintained by the owner of a structure on insert and remove, read from
+// other threads (diagnostics) without the owner lock: relaxed atomics, bytes and
+// objects are each exact but may be read from different updates.
+class MemoryCounter
+{
+  public:
+    MemoryCounter() : bytes_(0), objects_(0) {}
+
+    void add(size_t bytes, size_t objects = 1)
+    {
+      bytes_.fetch_add(bytes, std::memory_order_relaxed);
+      objects_.fetch_add(objects, std::memory_order_relaxed);
+    }
+    void remove(size_t bytes, size_t objects = 1)
+    {
+      bytes_.fetch_sub(bytes, std::memory_order_relaxed);
+      objects_.fetch_sub(objects, std::memory_order_relaxed);
+    }
+    void set(const MemoryUsage& usage)
+    {
+      bytes_.store(usage.bytes, std::memory_order_relaxed);
+      objects_.store(usage.objects, std::memory_order_relaxed);
+    }
+
+    MemoryUsage get() const
+    {
+      return MemoryUsage(bytes_.load(std::memory_order_relaxed), objects_.load(std::memory_order_relaxed));
+    }
+
+  private:
+    std::atomic<size_t> bytes_;
+    std::atomic<size_t> objects_;
+};
+
+#endif
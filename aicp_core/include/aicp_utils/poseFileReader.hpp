@@ -1,5 +1,7 @@
 
 
+#include "aicp_utils/textCloudReader.hpp"
+
 class IsometryWithTime
 {
 public:
@@ -45,26 +47,12 @@ public:
 
     void readPoseFile(std::string file_name, std::vector< IsometryWithTime > &world_to_body_poses){
 
-        // Read the input poses file:
-        ifstream in( file_name );
-        vector<vector<double>> fields;
-        if (in) {
-            string line;
-            while (getline(in, line)) {
-                if (line.at(0) == '#'){
-                    continue;
-                }
-
-                stringstream sep(line);
-                string field;
-                fields.push_back(vector<double>());
-                while (getline(sep, field, ',')) {
-                    fields.back().push_back(stod(field));
-                }
-            }
-        }
+        // Read the input poses file (counter, sec, nsec, x, y, z, qx, qy, qz, qw per line):
+        vector<double> fields;
+        readTextTable(file_name, 10, fields);
 
-        for (auto row : fields) {
+        for (size_t i = 0; i + 10 <= fields.size(); i += 10) {
+            const double* row = &fields[i];
             Eigen::Isometry3d world_to_body = Eigen::Isometry3d::Identity();
             world_to_body.translation() << row[3],row[4],row[5];
             world_to_body.rotate( Eigen::Quaterniond(row[9],row[6],row[7],row[8]) );
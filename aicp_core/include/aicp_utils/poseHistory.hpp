@@ -0,0 +1,54 @@
+#ifndef AICP_POSE_HISTORY_HPP_
+#define AICP_POSE_HISTORY_HPP_
+
+#include <memory>
+#include <vector>
+
+#include <Eigen/Dense>
+#include <Eigen/StdVector>
+
+#include "aicp_utils/memoryUsage.hpp"
+
+// Bounded history of a path: the last poses at full rate (recent window, ring buffer) and the
+// older ones, decimated by two each time the history is full (first pose kept). The full path
+// is read as a snapshot shared by the readers until the next pose (no copy per reader).
+class PoseHistory
+{
+  public:
+    typedef std::vector<Eigen::Isometry3d, Eigen::aligned_allocator<Eigen::Isometry3d> > Poses;
+    typedef std::shared_ptr<const Poses> Snapshot;
+
+    // max_poses: bound of the history (older and recent poses)
+    explicit PoseHistory(size_t window_size = 50, size_t max_poses = 5000);
+    ~PoseHistory(){}
+
+    void push_back(const Eigen::Isometry3d& pose);
+    void clear();
+
+    bool empty() const { return nb_recent_ == 0; }
+    // Poses kept (older and recent)
+    size_t size() const { return older_.size() + nb_recent_; }
+    // Last pose (not empty)
+    const Eigen::Isometry3d& back() const;
+
+    // Recent window, oldest first
+    void getRecent(Poses& poses) const;
+    // Older then recent poses (built once per pose pushed)
+    Snapshot getSnapshot();
+
+    // Kept poses and cached snapshot (objects: poses kept)
+    MemoryUsage getMemoryUsage() const;
+
+  private:
+    size_t window_size_;
+    size_t max_older_;
+    Poses recent_; // ring buffer, recent_begin_: oldest
+    size_t recent_begin_;
+    size_t nb_recent_;
+    Poses older_;
+    size_t older_stride_;  // poses out of the window per pose kept in older_
+    size_t older_pending_; // poses out of the window since the last one kept
+    Snapshot snapshot_;    // NULL: to be built
+};
+
+#endif
@@ -0,0 +1,107 @@
+#ifndef AICP_SCAN_ACCUMULATOR_HPP_
+#define AICP_SCAN_ACCUMULATOR_HPP_
+
+#include <cstdint>
+
+#include <Eigen/Dense>
+
+#include <pcl/point_types.h>
+#include <pcl/point_cloud.h>
+
+#include "aicp_utils/voxelGrid.hpp"
+
+struct ScanAccumulatorConfig
+{
+  int batch_size = 10;          // scans per accumulated cloud
+  float min_range = 0.0f;       // planar scans: accepted ranges (m)
+  float max_range = 30.0f;
+  float crop_box_size = 30.0f;  // point clouds: half size of the box around the sensor (m)
+  float voxel_size = 0.0f;      // points merged into voxel centroids as scans arrive (0: raw points)
+};
+
+// Batch of scans in the global frame, shared by the ROS (point clouds) and LCM (planar
+// lidar) accumulators. Each scan is cropped, transformed and appended in one pass into a
+// buffer pre-sized for the batch (first scan), or merged into voxels when voxel_size > 0.
+class ScanAccumulator
+{
+  public:
+    typedef pcl::PointCloud<pcl::PointXYZ> PointCloud;
+
+    explicit ScanAccumulator(const ScanAccumulatorConfig& config = ScanAccumulatorConfig());
+    ~ScanAccumulator(){}
+
+    // Restarts the batch
+    void setConfig(const ScanAccumulatorConfig& config);
+
+    // Planar scan: ranges at angles rad0 + i * radstep in the sensor xy plane. Beam poses are
+    // interpolated from pose_start (first beam) to pose_end (last beam), linearly (first order
+    // in the rotation between them, exact for pose_start == pose_end). Ranges outside
+    // [min_range, max_range] (or NaN) are skipped.
+    void addPlanarScan(const float* ranges, int nb_ranges, float rad0, float radstep,
+                       const Eigen::Isometry3d& pose_start, const Eigen::Isometry3d& pose_end,
+                       int64_t utime);
+    // Point cloud: get_point(i) returns point i (Eigen::Vector3f, sensor frame), points
+    // outside the crop box (or NaN) are skipped.
+    template <typename GetPoint>
+    void addPoints(size_t nb_points, const GetPoint& get_point, const Eigen::Isometry3d& pose,
+                   int64_t utime);
+
+    int getCounter() const { return counter_; }
+    bool getFinished() const { return finished_; }
+    // Time of the last scan
+    int64_t getFinishedTime() const { return utime_; }
+
+    const PointCloud& getCloud() const { return *cloud_; }
+    // Hands over the accumulated cloud (no copy), accumulation restarts in a new buffer
+    PointCloud::Ptr releaseCloud();
+    // Capacity kept for the next batch
+    void clear();
+
+  private:
+    // Output buffer for up to nb_points points of the current scan
+    pcl::PointXYZ* beginScan(size_t nb_points);
+    void endScan(size_t nb_kept, int64_t utime);
+    void updateBeamTables(int nb_ranges, float rad0, float radstep);
+
+    ScanAccumulatorConfig config_;
+    PointCloud::Ptr cloud_;
+    size_t nb_accumulated_; // points of cloud_ before the current scan
+    // Voxels of the batch and current scan (voxel_size > 0)
+    HashVoxelGrid voxel_grid_;
+    PointCloud scan_points_;
+
+    // Planar beams: directions and interpolation weight (0: first beam, 1: last beam),
+    // computed once per scan geometry
+    Eigen::ArrayXf cos_table_, sin_table_, weight_table_;
+    float table_rad0_, table_radstep_;
+    // Current planar scan: sensor plane and global frame coordinates
+    Eigen::ArrayXf plane_x_, plane_y_, x_, y_, z_;
+
+    int counter_;
+    bool finished_;
+    int64_t utime_;
+};
+
+template <typename GetPoint>
+void ScanAccumulator::addPoints(size_t nb_points, const GetPoint& get_point, const Eigen::Isometry3d& pose,
+                                int64_t utime)
+{
+  if (finished_)
+    return;
+  const Eigen::Matrix3f rotation = pose.rotation().cast<float>();
+  const Eigen::Vector3f translation = pose.translation().cast<float>();
+  const float box_size = config_.crop_box_size;
+
+  // Crop and transform in one pass (NaN points fail the box test)
+  pcl::PointXYZ* out = beginScan(nb_points);
+  size_t nb_kept = 0;
+  for (size_t i = 0; i < nb_points; i++)
+  {
+    Eigen::Vector3f point = get_point(i);
+    if ((point.array().abs() <= box_size).all())
+      out[nb_kept++].getVector3fMap() = rotation * point + translation;
+  }
+  endScan(nb_kept, utime);
+}
+
+#endif
@@ -0,0 +1,55 @@
+#ifndef AICP_SEGMENTED_CLOUD_HPP_
+#define AICP_SEGMENTED_CLOUD_HPP_
+
+#include <memory>
+#include <vector>
+
+#include <Eigen/Dense>
+
+//PCL
+#include <pcl/point_types.h>
+#include <pcl/point_cloud.h>
+#include <pcl/PointIndices.h>
+#include <pcl/search/kdtree.h>
+
+// Result of the planes segmentation pre-filter (see regionGrowingUniformPlaneSegmentationFilter).
+// It is computed once per cloud and shared by the overlap and alignability stages.
+// - cloud: pre-filtered points (same points and order as the XYZ pre-filtered cloud)
+//          with normals and colors indicating the clusters
+// - clusters: indices to the points in each cluster (plane)
+// - labels: cluster index of each point
+// - points: XYZ pre-filtered cloud holding the same points (NULL: unknown)
+class SegmentedCloud
+{
+  public:
+    typedef pcl::search::KdTree<pcl::PointXYZRGBNormal> SearchTree;
+
+    SegmentedCloud();
+    ~SegmentedCloud(){}
+
+    // Applies transform to points and normals (invalidates search tree, points unknown)
+    void transform(const Eigen::Matrix4f& transform);
+    // Same points (and order) as xyz: built from it (not only the same size)
+    bool isBuiltFrom(const pcl::PointCloud<pcl::PointXYZ>::ConstPtr& xyz) const {
+      return xyz && points == xyz && cloud->size() == xyz->size();
+    }
+
+    // Search tree on cloud, built on first request
+    SearchTree::Ptr getSearchTree();
+
+    size_t size() const { return cloud->size(); }
+    bool empty() const { return cloud->empty(); }
+
+    pcl::PointCloud<pcl::PointXYZRGBNormal>::Ptr cloud;
+    std::vector<pcl::PointIndices> clusters;
+    std::vector<int> labels;
+    // Held: its address cannot be reused by another cloud while compared
+    pcl::PointCloud<pcl::PointXYZ>::ConstPtr points;
+
+  private:
+    SearchTree::Ptr tree_;
+};
+
+typedef std::shared_ptr<SegmentedCloud> SegmentedCloudPtr;
+
+#endif
@@ -0,0 +1,29 @@
+#ifndef AICP_TEXT_CLOUD_READER_HPP_
+#define AICP_TEXT_CLOUD_READER_HPP_
+
+#include <string>
+#include <vector>
+
+#include <pcl/point_types.h>
+#include <pcl/point_cloud.h>
+
+// Single pass parsers of the text formats of the bundled data and recorded sessions.
+// Files are memory-mapped, numbers parsed in place (no line copies, no allocation per value).
+
+// Parses the number at begin (no leading spaces), advances begin past it.
+// Same result as strtod (exact fast path for up to 19 digits and exponents in [-22, 22],
+// strtod otherwise). False (begin unchanged) if there is no number at begin.
+bool parseDouble(const char*& begin, const char* end, double& value);
+
+// Points of an ASCII cloud file, written into cloud_out without intermediate buffers:
+// - csv: one point per line, 2 (z = 0) or 3 first columns separated by commas or spaces,
+//        non numeric lines (header, comments) skipped
+// - vtk: legacy ASCII "POINTS n float|double" section
+// False if the file cannot be read or the format is not supported (e.g. binary vtk).
+bool readTextCloud(const std::string& file_name, pcl::PointCloud<pcl::PointXYZ>& cloud_out);
+
+// Rows of nb_columns numbers (separators: commas, spaces, tabs) appended to values (row-major).
+// Lines starting with '#', with fewer values or with a non numeric value are skipped.
+bool readTextTable(const std::string& file_name, size_t nb_columns, std::vector<double>& values);
+
+#endif
@@ -0,0 +1,54 @@
+#ifndef AICP_THREAD_POOL_HPP_
+#define AICP_THREAD_POOL_HPP_
+
+#include <algorithm>
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <vector>
+
+// Fixed number of worker threads executing queued tasks in FIFO order.
+// enqueue returns a future to wait for (and get the result of) each task.
+class ThreadPool
+{
+  public:
+    // num_threads <= 0: number of hardware threads
+    explicit ThreadPool(int num_threads = 0);
+    // Waits for the queued tasks to finish
+    ~ThreadPool();
+
+    template <typename F>
+    std::future<typename std::result_of<F()>::type> enqueue(F task);
+
+    size_t size() const { return workers_.size(); }
+
+  private:
+    void work();
+
+    std::vector<std::thread> workers_;
+    std::queue<std::function<void()> > tasks_;
+    std::mutex mutex_;
+    std::condition_variable condition_;
+    bool stop_;
+};
+
+template <typename F>
+std::future<typename std::result_of<F()>::type> ThreadPool::enqueue(F task)
+{
+  typedef typename std::result_of<F()>::type Result;
+  // std::function requires copyable callables
+  std::shared_ptr<std::packaged_task<Result()> > packaged_task (new std::packaged_task<Result()>(task));
+  std::future<Result> result = packaged_task->get_future();
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+    tasks_.push([packaged_task](){ (*packaged_task)(); });
+  }
+  condition_.notify_one();
+  return result;
+}
+
+#endif
@@ -0,0 +1,68 @@
+#ifndef AICP_TILED_MAP_FILE_HPP_
+#define AICP_TILED_MAP_FILE_HPP_
+
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <Eigen/Dense>
+
+#include <pcl/point_types.h>
+#include <pcl/point_cloud.h>
+
+#include "aicp_utils/voxelGrid.hpp"
+
+// Tiled binary map (.aicpmap): pre-filtered map points bucketed in cubic tiles.
+// Layout (native little-endian):
+//   header:  char[8] "AICPMAP1", uint32 version, float tile_size, float leaf_size,
+//            uint32 reserved, uint64 nb_tiles, uint64 nb_points
+//   index:   nb_tiles x {int64 tile x, y, z, uint64 offset, uint64 nb_points}
+//   tiles:   at offset (bytes from file start), float x[nb_points], y[nb_points], z[nb_points]
+// The file is memory-mapped on open: only the index is read, tiles are paged in
+// by the OS when read (resident memory follows the area in use).
+class TiledMapFile
+{
+  public:
+    TiledMapFile();
+    ~TiledMapFile();
+
+    // leaf_size: pre-filter resolution of the map (informative)
+    static bool write(const std::string& file_name, const pcl::PointCloud<pcl::PointXYZ>& cloud,
+                      float tile_size, float leaf_size);
+
+    bool open(const std::string& file_name);
+    void close();
+    bool isOpen() const { return data_ != NULL; }
+
+    // Tiles overlapping the axis-aligned box [box_min, box_max]
+    void getTileKeys(const Eigen::Vector3f& box_min, const Eigen::Vector3f& box_max,
+                     std::vector<VoxelKey>& keys) const;
+    // Appends the points of tile key to cloud_out. Returns the number of points appended.
+    size_t readTile(const VoxelKey& key, pcl::PointCloud<pcl::PointXYZ>& cloud_out) const;
+    // Appends the points of all tiles (e.g. to visualize the map)
+    size_t readAllTiles(pcl::PointCloud<pcl::PointXYZ>& cloud_out) const;
+
+    float getTileSize() const { return tile_size_; }
+    float getLeafSize() const { return leaf_size_; }
+    size_t getNbTiles() const { return tiles_.size(); }
+    size_t getNbPoints() const { return nb_points_; }
+
+  private:
+    struct TileEntry
+    {
+      uint64_t offset;
+      uint64_t nb_points;
+    };
+
+    int fd_;
+    const char* data_;
+    size_t size_;
+
+    float tile_size_;
+    float leaf_size_;
+    size_t nb_points_;
+    std::unordered_map<VoxelKey, TileEntry, VoxelKeyHash> tiles_;
+};
+
+#endif
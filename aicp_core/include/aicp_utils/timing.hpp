@@ -1,23 +1,90 @@
 #ifndef AICP_TIMING_UTILS_HPP_
 #define AICP_TIMING_UTILS_HPP_
 
-#include <iostream>
-#include <stack>
+#include <chrono>
+#include <cstdint>
 #include <ctime>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "aicp_utils/logging.hpp"
+#include "aicp_utils/traceRecorder.hpp"
 
 class TimingUtils{
   public:
     TimingUtils(){}
-    ~TimingUtils(){}   
+    ~TimingUtils(){}
 
-    static void tic();
-    static void toc(std::string message = "");
     static std::string currentDateTime();
 
     static void sleepSeconds(clock_t sec);
+};
+
+// Durations aggregated by name over the whole run (all threads).
+// Each thread records into its own context (no shared lock on the hot path),
+// contexts are merged when statistics are read.
+class TimingStats
+{
+  public:
+    struct Summary
+    {
+      std::string name;
+      uint64_t count;
+      double total; // seconds
+      double mean;
+      double p50; // percentiles from a log-scale histogram (~10 % resolution)
+      double p95;
+      double p99;
+      double max;
+    };
+
+    static void record(const std::string& name, double seconds);
+    // Sorted by name
+    static void getSummaries(std::vector<Summary>& summaries);
+    static void print(std::ostream& out = std::cout);
+    static void reset();
+};
+
+// Wall time (steady clock) from construction to stop() or destruction, recorded
+// in TimingStats under name (and as a span if tracing is enabled). Nested and concurrent
+// timers are independent.
+// Defining AICP_DISABLE_TIMING compiles timers out (no clock reads, nothing recorded).
+class ScopedTimer
+{
+  public:
+    typedef std::chrono::steady_clock Clock;
+
+#ifndef AICP_DISABLE_TIMING
+    // verbose: logs the duration (debug level) when stopped
+    explicit ScopedTimer(const char* name, bool verbose = true) :
+      name_(name), verbose_(verbose), stopped_(false), start_(Clock::now()) {}
+    ~ScopedTimer() { stop(); }
+
+    // Returns the elapsed time in seconds (0 if already stopped)
+    double stop()
+    {
+      if (stopped_)
+        return 0.0;
+      stopped_ = true;
+      Clock::time_point end = Clock::now();
+      double seconds = std::chrono::duration<double>(end - start_).count();
+      TimingStats::record(name_, seconds);
+      TraceRecorder::record(name_, start_, end);
+      if (verbose_)
+        AICP_LOG_DEBUG("Timing", "Time elapsed: " << seconds << " sec " << name_);
+      return seconds;
+    }
 
   private:
-    static std::stack<clock_t> tictoc_stack;    
+    const char* name_;
+    bool verbose_;
+    bool stopped_;
+    Clock::time_point start_;
+#else
+    explicit ScopedTimer(const char*, bool = true) {}
+    double stop() { return 0.0; }
+#endif
 };
 
 #endif
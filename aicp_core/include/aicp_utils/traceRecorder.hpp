@@ -0,0 +1,72 @@
+#ifndef AICP_TRACE_RECORDER_HPP_
+#define AICP_TRACE_RECORDER_HPP_
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <string>
+
+// Spans of the processing, callback and publishing threads, written as Chrome trace JSON
+// (chrome://tracing, ui.perfetto.dev). Each thread records into its own ring buffer (last
+// spans kept, no lock, no allocation once the thread has recorded its first span); the
+// buffers are read when the trace is written. Disabled (one flag test per span) until enable.
+class TraceRecorder
+{
+  public:
+    typedef std::chrono::steady_clock Clock;
+
+    // spans_per_thread: ring buffer size of the threads not recording yet (~32 bytes per span)
+    static void enable(size_t spans_per_thread = 65536);
+    static bool isEnabled() { return enabled_.load(std::memory_order_relaxed); }
+
+    // name: string literal. Spans of a thread are expected to nest (scopes)
+    static void record(const char* name, Clock::time_point start, Clock::time_point end);
+    // Interval not bound to the calling thread (e.g. time spent in a queue), own track in the trace
+    static void recordAsync(const char* name, Clock::time_point start, Clock::time_point end);
+    // Name of the calling thread in the trace (also before enable)
+    static void setThreadName(const std::string& name);
+
+    // Spans currently held by the buffers, false if the file could not be written
+    static bool write(const std::string& filename);
+
+    // Enables recording and writes filename from a background thread on SIGUSR1, every
+    // period (s, 0: on signal only) and at stop (also done at exit). First filename kept.
+    static void start(const std::string& filename, double period);
+    static void stop();
+
+  private:
+    static std::atomic<bool> enabled_;
+};
+
+// Span from construction to stop() or destruction, recorded when tracing is enabled
+// (not in TimingStats, see ScopedTimer). Defining AICP_DISABLE_TIMING compiles spans out.
+class ScopedSpan
+{
+  public:
+#ifndef AICP_DISABLE_TIMING
+    explicit ScopedSpan(const char* name) : name_(name), recording_(TraceRecorder::isEnabled())
+    {
+      if (recording_)
+        start_ = TraceRecorder::Clock::now();
+    }
+    ~ScopedSpan() { stop(); }
+
+    void stop()
+    {
+      if (!recording_)
+        return;
+      recording_ = false;
+      TraceRecorder::record(name_, start_, TraceRecorder::Clock::now());
+    }
+
+  private:
+    const char* name_;
+    bool recording_;
+    TraceRecorder::Clock::time_point start_;
+#else
+    explicit ScopedSpan(const char*) {}
+    void stop() {}
+#endif
+};
+
+#endif
@@ -7,12 +7,17 @@
 
 #include <Eigen/Dense>
 
+#include <memory>
+
+#include "aicp_utils/memoryUsage.hpp"
+
 namespace aicp {
 
 class Visualizer
 {
 public:
     typedef std::vector<Eigen::Isometry3d, Eigen::aligned_allocator<Eigen::Isometry3d>> PathPoses;
+    typedef std::shared_ptr<const PathPoses> PathSnapshot;
 public:
     Visualizer(){}
     virtual ~Visualizer(){}
@@ -31,6 +36,11 @@ public:
                             int64_t utime,
                             int channel) = 0;
 
+    // Points just added to the map (publishMap may skip some updates of a growing map)
+    virtual void publishMapUpdate(pcl::PointCloud<pcl::PointXYZ>::Ptr& cloud,
+                                  int64_t utime,
+                                  int channel) {}
+
     virtual void publishOctree(octomap::ColorOcTree*& octree,
                                std::string channel_name) = 0;
 
@@ -54,7 +64,12 @@ public:
 
 
     // Gets
-    virtual const PathPoses& getPath() = 0;
+    // Corrected poses published (older ones may be decimated), shared: not modified
+    virtual PathSnapshot getPath() = 0;
+    // Last corrected pose published, false if none
+    virtual bool getLastPose(Eigen::Isometry3d& pose) = 0;
+    // Poses kept for the published paths (objects: poses)
+    virtual MemoryUsage getMemoryUsage() { return MemoryUsage(); }
 
 protected:
     // Set global reference frame to zero origin
@@ -0,0 +1,73 @@
+#ifndef AICP_VOXEL_GRID_HPP_
+#define AICP_VOXEL_GRID_HPP_
+
+#include <cmath>
+#include <cstdint>
+#include <vector>
+#include <unordered_map>
+
+// Integer coordinates of a voxel (64 bits per axis: no limit on the cloud extent)
+struct VoxelKey
+{
+  int64_t x, y, z;
+
+  bool operator==(const VoxelKey& other) const
+  {
+    return x == other.x && y == other.y && z == other.z;
+  }
+};
+
+struct VoxelKeyHash
+{
+  size_t operator()(const VoxelKey& key) const
+  {
+    // Large primes hashing (Teschner et al., 2003)
+    return (size_t)(((uint64_t)key.x * 73856093ULL) ^
+                    ((uint64_t)key.y * 19349669ULL) ^
+                    ((uint64_t)key.z * 83492791ULL));
+  }
+};
+
+inline VoxelKey getVoxelKey(float x, float y, float z, float inverse_leaf_size)
+{
+  VoxelKey key;
+  key.x = (int64_t)std::floor(x * inverse_leaf_size);
+  key.y = (int64_t)std::floor(y * inverse_leaf_size);
+  key.z = (int64_t)std::floor(z * inverse_leaf_size);
+  return key;
+}
+
+// Hash-map based voxel grid: points can be added incrementally (e.g. in chunks
+// streamed from file), memory grows with the number of occupied voxels only.
+// Output is the centroid of each occupied voxel (as pcl::VoxelGrid).
+class HashVoxelGrid
+{
+  public:
+    HashVoxelGrid(float leaf_size);
+    ~HashVoxelGrid(){}
+
+    void addPoint(float x, float y, float z);
+    // xyz: interleaved coordinates of nb_points points
+    void addPoints(const float* xyz, size_t nb_points);
+
+    // Interleaved coordinates of the voxel centroids (in insertion order)
+    void getCentroids(std::vector<float>& xyz) const;
+
+    size_t size() const { return centroids_.size(); }
+    float getLeafSize() const { return leaf_size_; }
+    void clear();
+
+  private:
+    struct Centroid
+    {
+      double x, y, z;
+      uint64_t count;
+    };
+
+    float leaf_size_;
+    float inverse_leaf_size_;
+    std::unordered_map<VoxelKey, size_t, VoxelKeyHash> voxels_; // key -> index in centroids_
+    std::vector<Centroid> centroids_;
+};
+
+#endif
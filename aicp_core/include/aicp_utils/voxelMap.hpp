@@ -0,0 +1,88 @@
+#ifndef AICP_VOXEL_MAP_HPP_
+#define AICP_VOXEL_MAP_HPP_
+
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include <Eigen/Dense>
+
+#include <pcl/point_types.h>
+#include <pcl/point_cloud.h>
+
+#include "aicp_utils/voxelGrid.hpp"
+#include "aicp_utils/memoryUsage.hpp"
+
+// Incremental voxel-hashed map: keeps one representative point per voxel (the
+// first point inserted). Inserting a cloud costs O(new points), independently of
+// the map size, and the map points are stored in a contiguous cloud.
+// Points are also bucketed in tiles (coarse voxels of tile_size) so that
+// sub-maps around a pose are extracted from the overlapping tiles only.
+class VoxelMap
+{
+  public:
+    VoxelMap(float leaf_size, float tile_size = 10.0f);
+    ~VoxelMap(){}
+
+    // Returns the number of points added to the map (points falling in
+    // already occupied voxels are discarded)
+    size_t insert(const pcl::PointCloud<pcl::PointXYZ>& cloud);
+    void setCloud(const pcl::PointCloud<pcl::PointXYZ>& cloud);
+
+    // Note: the map points are updated in place by insert()
+    pcl::PointCloud<pcl::PointXYZ>::Ptr getCloud(){ return cloud_; }
+
+    // Memory cap: keeps the max_points points closest to center (no-op if the map is smaller).
+    // Returns the number of points removed.
+    size_t removeFarthest(const Eigen::Vector3f& center, size_t max_points);
+
+    // Copies into cloud_out the map points in the box [min, max]^3 expressed in the origin
+    // frame (same box and points order as cropOrientedBox on getCloud()).
+    // Cost grows with the points of the tiles overlapping the box, not with the map size.
+    void getPointsInOrientedBox(float min, float max, const Eigen::Matrix4f& origin,
+                                pcl::PointCloud<pcl::PointXYZ>& cloud_out) const;
+
+    size_t size() const { return cloud_->size(); }
+    float getLeafSize() const { return leaf_size_; }
+    void clear();
+    // Points, voxel and tile indices, from the container sizes (objects: points)
+    MemoryUsage getMemoryUsage() const;
+
+  private:
+    void addToTile(size_t index);
+
+    float leaf_size_;
+    float inverse_leaf_size_;
+    float inverse_tile_size_;
+    std::unordered_map<VoxelKey, size_t, VoxelKeyHash> voxels_; // key -> index in cloud_
+    std::unordered_map<VoxelKey, std::vector<uint32_t>, VoxelKeyHash> tiles_; // key -> indices in cloud_
+    pcl::PointCloud<pcl::PointXYZ>::Ptr cloud_;
+};
+
+// Occupied voxels of a map at a coarse resolution (e.g. octomap resolution):
+// overlap of a cloud with the map in O(cloud points), independently of the map size.
+class VoxelOccupancy
+{
+  public:
+    VoxelOccupancy(float resolution);
+    ~VoxelOccupancy(){}
+
+    void insert(const pcl::PointCloud<pcl::PointXYZ>& cloud);
+
+    // Percentage of the voxels occupied by cloud (map coordinates) also occupied
+    // by the map (0 if cloud is empty)
+    float getOverlap(const pcl::PointCloud<pcl::PointXYZ>& cloud) const;
+
+    size_t size() const { return voxels_.size(); }
+    float getResolution() const { return resolution_; }
+    void clear() { voxels_.clear(); }
+    // From the container size (objects: voxels)
+    MemoryUsage getMemoryUsage() const;
+
+  private:
+    float resolution_;
+    float inverse_resolution_;
+    std::unordered_set<VoxelKey, VoxelKeyHash> voxels_;
+};
+
+#endif
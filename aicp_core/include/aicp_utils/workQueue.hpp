@@ -0,0 +1,268 @@
+#ifndef AICP_WORK_QUEUE_HPP_
+#define AICP_WORK_QUEUE_HPP_
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "aicp_utils/memoryUsage.hpp"
+#include "aicp_utils/traceRecorder.hpp"
+
+// Bounded lock-free MPMC ring buffer (D. Vyukov): each cell holds a sequence number
+// telling producers and consumers whether it is free or filled for their turn.
+template <typename T>
+class RingBuffer
+{
+  public:
+    explicit RingBuffer(size_t capacity) :
+      cells_(capacity > 0 ? capacity : 1), push_pos_(0), pop_pos_(0)
+    {
+      for (size_t i = 0; i < cells_.size(); i++)
+        cells_[i].sequence.store(i, std::memory_order_relaxed);
+    }
+    ~RingBuffer(){}
+
+    // Fails if full
+    bool tryPush(const T& item)
+    {
+      size_t pos = push_pos_.load(std::memory_order_relaxed);
+      for (;;)
+      {
+        Cell& cell = cells_[pos % cells_.size()];
+        size_t sequence = cell.sequence.load(std::memory_order_acquire);
+        std::ptrdiff_t diff = (std::ptrdiff_t)sequence - (std::ptrdiff_t)pos;
+        if (diff == 0)
+        {
+          if (push_pos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+          {
+            cell.item = item;
+            cell.sequence.store(pos + 1, std::memory_order_release);
+            return true;
+          }
+        }
+        else if (diff < 0)
+          return false;
+        else
+          pos = push_pos_.load(std::memory_order_relaxed);
+      }
+    }
+
+    // Fails if empty
+    bool tryPop(T& item)
+    {
+      size_t pos = pop_pos_.load(std::memory_order_relaxed);
+      for (;;)
+      {
+        Cell& cell = cells_[pos % cells_.size()];
+        size_t sequence = cell.sequence.load(std::memory_order_acquire);
+        std::ptrdiff_t diff = (std::ptrdiff_t)sequence - (std::ptrdiff_t)(pos + 1);
+        if (diff == 0)
+        {
+          if (pop_pos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+          {
+            item = cell.item;
+            cell.item = T(); // release shared data now
+            cell.sequence.store(pos + cells_.size(), std::memory_order_release);
+            return true;
+          }
+        }
+        else if (diff < 0)
+          return false;
+        else
+          pos = pop_pos_.load(std::memory_order_relaxed);
+      }
+    }
+
+    // Approximate (exact when producers and consumers are idle)
+    size_t size() const
+    {
+      size_t push_pos = push_pos_.load(std::memory_order_relaxed);
+      size_t pop_pos = pop_pos_.load(std::memory_order_relaxed);
+      return push_pos > pop_pos ? push_pos - pop_pos : 0;
+    }
+
+    size_t capacity() const { return cells_.size(); }
+
+  private:
+    struct Cell
+    {
+      Cell() : sequence(0) {}
+      std::atomic<size_t> sequence;
+      T item;
+    };
+
+    std::vector<Cell> cells_;
+    std::atomic<size_t> push_pos_;
+    std::atomic<size_t> pop_pos_;
+};
+
+// What push does when the queue is full:
+// DROP_OLDEST: oldest queued items make room for the new one
+// DROP_NEWEST: new item is dropped
+// COALESCE:    queued items are replaced by the new one (latest only)
+enum class QueuePolicy { DROP_OLDEST, DROP_NEWEST, COALESCE };
+
+inline bool parseQueuePolicy(const std::string& name, QueuePolicy& policy)
+{
+  if (name == "drop_oldest")
+    policy = QueuePolicy::DROP_OLDEST;
+  else if (name == "drop_newest")
+    policy = QueuePolicy::DROP_NEWEST;
+  else if (name == "coalesce")
+    policy = QueuePolicy::COALESCE;
+  else
+    return false;
+  return true;
+}
+
+// Work queue between sensor callbacks (producers) and a worker thread (consumer).
+// Producers never block: items are stored in a RingBuffer and the worker is only
+// notified (mutex held for the notification, not while pushing).
+// Counts pushed, dropped and popped items, and the time spent by the items in the queue
+// (also traced as async spans once named with setTraceName), and the memory held by the
+// queued items once a memory usage function is set.
+template <typename T>
+class WorkQueue
+{
+  public:
+    typedef std::chrono::steady_clock Clock;
+
+    struct Stats
+    {
+      size_t pushed;
+      size_t dropped;
+      size_t popped;
+      double mean_latency; // seconds
+      double max_latency;
+    };
+
+    WorkQueue(size_t capacity, QueuePolicy policy) :
+      ring_(capacity), policy_(policy), trace_name_(NULL), memory_usage_(NULL),
+      pushed_(0), dropped_(0), popped_(0), total_latency_us_(0), max_latency_us_(0) {}
+    ~WorkQueue(){}
+
+    void setPolicy(QueuePolicy policy) { policy_ = policy; }
+    // name: string literal (NULL: not traced)
+    void setTraceName(const char* name) { trace_name_ = name; }
+    // Bytes held by an item, evaluated when it is pushed (set before the first push)
+    void setMemoryUsageFunction(size_t (*memory_usage)(const T&)) { memory_usage_ = memory_usage; }
+    // Called after each push, once the item can be popped (set before the first push)
+    void setPushCallback(const std::function<void()>& callback) { push_callback_ = callback; }
+
+    // Returns the number of dropped items (the new one included, if dropped)
+    size_t push(const T& item)
+    {
+      Entry entry;
+      entry.item = item;
+      entry.time = Clock::now();
+      entry.bytes = memory_usage_ != NULL ? memory_usage_(item) : 0;
+      pushed_ ++;
+
+      size_t dropped = 0;
+      Entry old;
+      if (policy_ == QueuePolicy::COALESCE)
+      {
+        while (ring_.tryPop(old))
+        {
+          memory_.remove(old.bytes);
+          dropped ++;
+        }
+      }
+      // Counted before the push: a consumer may pop it right away
+      memory_.add(entry.bytes);
+      while (!ring_.tryPush(entry))
+      {
+        if (policy_ == QueuePolicy::DROP_NEWEST)
+        {
+          memory_.remove(entry.bytes);
+          dropped ++;
+          break;
+        }
+        if (ring_.tryPop(old))
+        {
+          memory_.remove(old.bytes);
+          dropped ++;
+        }
+      }
+      dropped_ += dropped;
+
+      {
+        std::unique_lock<std::mutex> lock(mutex_);
+      }
+      condition_.notify_one();
+      if (push_callback_)
+        push_callback_();
+      return dropped;
+    }
+
+    // Waits up to timeout for an item
+    template <typename Duration>
+    bool pop(T& item, const Duration& timeout)
+    {
+      Entry entry;
+      if (!ring_.tryPop(entry))
+      {
+        std::unique_lock<std::mutex> lock(mutex_);
+        if (!condition_.wait_for(lock, timeout, [&](){ return ring_.tryPop(entry); }))
+          return false;
+      }
+      item = entry.item;
+      memory_.remove(entry.bytes);
+
+      Clock::time_point now = Clock::now();
+      if (trace_name_ != NULL)
+        TraceRecorder::recordAsync(trace_name_, entry.time, now);
+      long latency = std::chrono::duration_cast<std::chrono::microseconds>(now - entry.time).count();
+      popped_ ++;
+      total_latency_us_ += latency;
+      long max_latency = max_latency_us_.load();
+      while (latency > max_latency && !max_latency_us_.compare_exchange_weak(max_latency, latency));
+      return true;
+    }
+
+    size_t size() const { return ring_.size(); }
+    // Queued items (objects) and their bytes (0 without memory usage function)
+    MemoryUsage getMemoryUsage() const { return memory_.get(); }
+
+    Stats getStats() const
+    {
+      Stats stats;
+      stats.pushed = pushed_.load();
+      stats.dropped = dropped_.load();
+      stats.popped = popped_.load();
+      stats.mean_latency = stats.popped > 0 ? 1e-6 * total_latency_us_.load() / stats.popped : 0.0;
+      stats.max_latency = 1e-6 * max_latency_us_.load();
+      return stats;
+    }
+
+  private:
+    struct Entry
+    {
+      T item;
+      Clock::time_point time;
+      size_t bytes;
+    };
+
+    RingBuffer<Entry> ring_;
+    QueuePolicy policy_;
+    const char* trace_name_;
+    size_t (*memory_usage_)(const T&);
+    std::function<void()> push_callback_;
+    MemoryCounter memory_;
+
+    std::mutex mutex_;
+    std::condition_variable condition_;
+
+    std::atomic<size_t> pushed_;
+    std::atomic<size_t> dropped_;
+    std::atomic<size_t> popped_;
+    std::atomic<long> total_latency_us_;
+    std::atomic<long> max_latency_us_;
+};
+
+#endif
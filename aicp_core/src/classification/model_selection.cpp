@@ -0,0 +1,442 @@
+// aicp_classification_select: SVM model selection on labelled alignment samples
+// Stratified k-fold cross-validation of a grid of SVM candidates (kernel, C, gamma, degree,
+// coef0), trained in parallel with fixed folds (seed): same data and seed, same report.
+// The winner is trained on the whole training set and exported with its risk lookup table.
+
+// Run: aicp_classification_select --training <file> --output <model.xml> [options]
+//  --training <file>      labelled samples: "id overlap alignability label" per line
+//                         (as aicp_classification_main: alignability scaled by 100)
+//  --testing <file>       held-out samples evaluated with the exported model (optional)
+//  --output <file>        winner model (OpenCV xml), lookup table saved to <file>.lut
+//  --report <file>        metrics of all candidates (space separated, one line each)
+//  --kernels <list>       among linear, poly, rbf, sigmoid (default: linear,poly,rbf)
+//  --C <list>             (default: 0.1,1,10,100,1000)
+//  --gamma <list>         poly, rbf and sigmoid kernels (default: 0.0001,0.001,0.01,0.1)
+//  --degree <list>        poly kernel (default: 2,3,4)
+//  --coef0 <list>         poly and sigmoid kernels (default: 0,1)
+//  --max-iter <n>         solver iterations (default: 100, as aicp::SVM)
+//  --folds <n>            cross-validation folds (default: 5)
+//  --threads <n>          candidates and folds trained concurrently (default: all available)
+//  --seed <n>             folds shuffling (default: 0)
+//  --threshold <p>        risk threshold of the F-score (default: 0.5, as SVM threshold)
+//  --select <f1|auc>      winner criterion (default: f1), ties: higher AUC, then lower cost
+//  --lut-resolution <%>   lookup table grid step (default: 0.5, 0: no lookup table)
+
+// classification
+#include "aicp_classification/svm.hpp"
+
+// project
+#include "aicp_utils/textCloudReader.hpp"
+#include "aicp_utils/threadPool.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// opencv
+#include <opencv2/core/core.hpp>
+#include <opencv2/ml/ml.hpp>
+
+using namespace aicp;
+
+struct Samples {
+  cv::Mat1f features; // overlap, 100 * alignability
+  cv::Mat1i labels;   // 1: alignment failure (high risk)
+};
+
+struct Candidate {
+  int kernel;
+  double C;
+  double gamma;
+  int degree;
+  double coef0;
+};
+
+struct CandidateResult {
+  bool trained = true; // false if the solver failed on a fold
+  double auc = 0.0;
+  double precision = 0.0;
+  double recall = 0.0;
+  double f1 = 0.0;
+  int nb_support_vectors = 0;
+  double inference_us = 0.0; // single sample prediction
+};
+
+static std::string kernelName(int kernel) {
+  switch (kernel) {
+    case cv::ml::SVM::LINEAR: return "linear";
+    case cv::ml::SVM::POLY: return "poly";
+    case cv::ml::SVM::RBF: return "rbf";
+    case cv::ml::SVM::SIGMOID: return "sigmoid";
+  }
+  return "unknown";
+}
+
+static std::string candidateName(const Candidate& candidate) {
+  std::stringstream ss;
+  ss << kernelName(candidate.kernel) << " C=" << candidate.C;
+  if (candidate.kernel != cv::ml::SVM::LINEAR)
+    ss << " gamma=" << candidate.gamma;
+  if (candidate.kernel == cv::ml::SVM::POLY)
+    ss << " degree=" << candidate.degree;
+  if (candidate.kernel == cv::ml::SVM::POLY || candidate.kernel == cv::ml::SVM::SIGMOID)
+    ss << " coef0=" << candidate.coef0;
+  return ss.str();
+}
+
+static bool parseList(const std::string& list, std::vector<double>& values) {
+  values.clear();
+  std::stringstream ss(list);
+  std::string item;
+  while (std::getline(ss, item, ',')) {
+    char* end;
+    double value = std::strtod(item.c_str(), &end);
+    if (item.empty() || *end != '\0')
+      return false;
+    values.push_back(value);
+  }
+  return !values.empty();
+}
+
+// Same features and labels as aicp_classification_main
+static bool loadSamples(const std::string& file, Samples& samples) {
+  std::vector<double> values;
+  if (!readTextTable(file, 4, values) || values.empty()) {
+    std::cerr << "[ModelSelection] Error: no samples in " << file << "." << std::endl;
+    return false;
+  }
+  const int nb_samples = values.size() / 4;
+  samples.features.create(nb_samples, 2);
+  samples.labels.create(nb_samples, 1);
+  for (int i = 0; i < nb_samples; ++i) {
+    samples.features(i, 0) = values[4 * i + 1];
+    samples.features(i, 1) = 100.0 * values[4 * i + 2];
+    samples.labels(i, 0) = (values[4 * i + 3] == 1.0) ? 1 : 0;
+  }
+  return true;
+}
+
+static Samples subset(const Samples& samples, const std::vector<int>& indices) {
+  Samples out;
+  out.features.create(indices.size(), samples.features.cols);
+  out.labels.create(indices.size(), 1);
+  for (size_t i = 0; i < indices.size(); ++i) {
+    samples.features.row(indices[i]).copyTo(out.features.row(i));
+    out.labels(i, 0) = samples.labels(indices[i], 0);
+  }
+  return out;
+}
+
+static cv::Ptr<cv::ml::SVM> trainCandidate(const Candidate& candidate, const Samples& samples, int max_iter) {
+  cv::Ptr<cv::ml::SVM> svm = cv::ml::SVM::create();
+  svm->setType(cv::ml::SVM::C_SVC);
+  svm->setKernel(candidate.kernel);
+  svm->setC(candidate.C);
+  svm->setGamma(candidate.gamma);
+  svm->setDegree(candidate.degree);
+  svm->setCoef0(candidate.coef0);
+  svm->setTermCriteria(cv::TermCriteria(cv::TermCriteria::MAX_ITER, max_iter, 1e-6));
+  svm->train(cv::ml::TrainData::create(samples.features, cv::ml::ROW_SAMPLE, samples.labels));
+  return svm;
+}
+
+// Risk of each sample, as aicp::SVM (logistic of the decision function)
+static std::vector<double> predictRisk(const cv::Ptr<cv::ml::SVM>& svm, const cv::Mat1f& features) {
+  cv::Mat1f outputs;
+  svm->predict(features, outputs, cv::ml::StatModel::RAW_OUTPUT);
+  std::vector<double> risks (features.rows);
+  for (int i = 0; i < features.rows; ++i)
+    risks[i] = 1.0 - 1.0 / (1.0 + std::exp(-(double)outputs(i, 0)));
+  return risks;
+}
+
+// ROC area (Mann-Whitney statistic, ties count half), precision, recall and F-score at threshold
+static void evaluate(const std::vector<double>& risks, const std::vector<int>& labels, double threshold,
+                     CandidateResult& result) {
+  std::vector<std::pair<double, int> > sorted (risks.size());
+  for (size_t i = 0; i < risks.size(); ++i)
+    sorted[i] = std::make_pair(risks[i], labels[i]);
+  std::sort(sorted.begin(), sorted.end());
+  double nb_positives = 0.0, nb_negatives = 0.0, rank_sum = 0.0;
+  for (size_t i = 0; i < sorted.size(); ) {
+    size_t j = i;
+    while (j < sorted.size() && sorted[j].first == sorted[i].first)
+      ++j;
+    double rank = 0.5 * (i + j + 1); // mean rank of the ties (1-based)
+    for (size_t k = i; k < j; ++k) {
+      if (sorted[k].second == 1) {
+        nb_positives++;
+        rank_sum += rank;
+      }
+      else
+        nb_negatives++;
+    }
+    i = j;
+  }
+  result.auc = (nb_positives > 0 && nb_negatives > 0) ?
+               (rank_sum - nb_positives * (nb_positives + 1) / 2.0) / (nb_positives * nb_negatives) : 0.0;
+
+  unsigned int tp = 0u, fp = 0u, fn = 0u;
+  for (size_t i = 0; i < risks.size(); ++i) {
+    bool predicted = risks[i] >= threshold;
+    tp += (predicted && labels[i] == 1);
+    fp += (predicted && labels[i] == 0);
+    fn += (!predicted && labels[i] == 1);
+  }
+  result.precision = (tp + fp > 0) ? double(tp) / (tp + fp) : 0.0;
+  result.recall = (tp + fn > 0) ? double(tp) / (tp + fn) : 0.0;
+  result.f1 = (tp > 0) ? 2.0 * result.precision * result.recall / (result.precision + result.recall) : 0.0;
+}
+
+// Mean single sample prediction time (as in the registration loop), at least 1000 predictions
+static double measureInference(const cv::Ptr<cv::ml::SVM>& svm, const cv::Mat1f& features) {
+  const int nb_predictions = std::max(1000, features.rows);
+  cv::Mat1f output;
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  for (int i = 0; i < nb_predictions; ++i)
+    svm->predict(features.row(i % features.rows), output, cv::ml::StatModel::RAW_OUTPUT);
+  double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  return 1e6 * seconds / nb_predictions;
+}
+
+int main(int argc, char **argv) {
+  std::string training_file, testing_file, output_file, report_file;
+  std::string kernels = "linear,poly,rbf", select = "f1";
+  std::vector<double> Cs = {0.1, 1, 10, 100, 1000};
+  std::vector<double> gammas = {0.0001, 0.001, 0.01, 0.1};
+  std::vector<double> degrees = {2, 3, 4};
+  std::vector<double> coef0s = {0, 1};
+  int max_iter = 100, nb_folds = 5, num_threads = 0, seed = 0;
+  double threshold = 0.5;
+  float lut_resolution = 0.5;
+
+  for (int i = 1; i + 1 < argc; i += 2) {
+    const std::string option = argv[i];
+    const std::string value = argv[i + 1];
+    bool valid = true;
+    if (option == "--training") training_file = value;
+    else if (option == "--testing") testing_file = value;
+    else if (option == "--output") output_file = value;
+    else if (option == "--report") report_file = value;
+    else if (option == "--kernels") kernels = value;
+    else if (option == "--C") valid = parseList(value, Cs);
+    else if (option == "--gamma") valid = parseList(value, gammas);
+    else if (option == "--degree") valid = parseList(value, degrees);
+    else if (option == "--coef0") valid = parseList(value, coef0s);
+    else if (option == "--max-iter") max_iter = std::atoi(value.c_str());
+    else if (option == "--folds") nb_folds = std::atoi(value.c_str());
+    else if (option == "--threads") num_threads = std::atoi(value.c_str());
+    else if (option == "--seed") seed = std::atoi(value.c_str());
+    else if (option == "--threshold") threshold = std::atof(value.c_str());
+    else if (option == "--select") select = value;
+    else if (option == "--lut-resolution") lut_resolution = std::atof(value.c_str());
+    else valid = false;
+    if (!valid) {
+      std::cerr << "[ModelSelection] Invalid option " << option << " " << value
+                << " (see the header of model_selection.cpp)." << std::endl;
+      return 1;
+    }
+  }
+  if (training_file.empty() || output_file.empty() || nb_folds < 2 || (select != "f1" && select != "auc")) {
+    std::cerr << "[ModelSelection] Usage: " << argv[0]
+              << " --training <file> --output <model.xml> [options] (see the header of model_selection.cpp)." << std::endl;
+    return 1;
+  }
+
+  Samples training;
+  if (!loadSamples(training_file, training))
+    return 1;
+
+  // Candidates grid
+  std::vector<Candidate> candidates;
+  std::stringstream kernels_stream(kernels);
+  std::string kernel;
+  while (std::getline(kernels_stream, kernel, ',')) {
+    Candidate candidate = {cv::ml::SVM::LINEAR, 1.0, 1.0, 1, 0.0};
+    if (kernel == "linear") {
+      for (size_t c = 0; c < Cs.size(); ++c) {
+        candidate.C = Cs[c];
+        candidates.push_back(candidate);
+      }
+      continue;
+    }
+    if (kernel == "poly") candidate.kernel = cv::ml::SVM::POLY;
+    else if (kernel == "rbf") candidate.kernel = cv::ml::SVM::RBF;
+    else if (kernel == "sigmoid") candidate.kernel = cv::ml::SVM::SIGMOID;
+    else {
+      std::cerr << "[ModelSelection] Error: unknown kernel " << kernel << "." << std::endl;
+      return 1;
+    }
+    const bool has_degree = (candidate.kernel == cv::ml::SVM::POLY);
+    const bool has_coef0 = (candidate.kernel != cv::ml::SVM::RBF);
+    for (size_t c = 0; c < Cs.size(); ++c)
+      for (size_t g = 0; g < gammas.size(); ++g)
+        for (size_t d = 0; d < (has_degree ? degrees.size() : 1); ++d)
+          for (size_t k = 0; k < (has_coef0 ? coef0s.size() : 1); ++k) {
+            candidate.C = Cs[c];
+            candidate.gamma = gammas[g];
+            candidate.degree = has_degree ? (int)degrees[d] : 1;
+            candidate.coef0 = has_coef0 ? coef0s[k] : 0.0;
+            candidates.push_back(candidate);
+          }
+  }
+
+  // Stratified folds: samples of each class shuffled (seed), then dealt to the folds
+  std::mt19937 rng(seed);
+  std::vector<int> folds (training.features.rows);
+  for (int label = 0; label <= 1; ++label) {
+    std::vector<int> indices;
+    for (int i = 0; i < training.features.rows; ++i)
+      if (training.labels(i, 0) == label)
+        indices.push_back(i);
+    std::shuffle(indices.begin(), indices.end(), rng);
+    for (size_t i = 0; i < indices.size(); ++i)
+      folds[indices[i]] = i % nb_folds;
+  }
+  std::vector<Samples> fold_training (nb_folds), fold_validation (nb_folds);
+  std::vector<std::vector<int> > fold_indices (nb_folds);
+  for (int f = 0; f < nb_folds; ++f) {
+    std::vector<int> training_indices;
+    for (int i = 0; i < training.features.rows; ++i)
+      (folds[i] == f ? fold_indices[f] : training_indices).push_back(i);
+    fold_training[f] = subset(training, training_indices);
+    fold_validation[f] = subset(training, fold_indices[f]);
+  }
+
+  std::cout << "[ModelSelection] " << training.features.rows << " training samples, " << candidates.size()
+            << " candidates, " << nb_folds << " folds." << std::endl;
+
+  // Cross-validation: one task per (candidate, fold), out-of-fold risks gathered per candidate
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  std::vector<std::vector<double> > risks (candidates.size(), std::vector<double>(training.features.rows));
+  std::vector<cv::Ptr<cv::ml::SVM> > first_fold_models (candidates.size());
+  std::vector<char> failed (candidates.size(), 0);
+  {
+    ThreadPool pool (num_threads);
+    std::vector<std::future<void> > tasks;
+    for (size_t c = 0; c < candidates.size(); ++c)
+      for (int f = 0; f < nb_folds; ++f)
+        tasks.push_back(pool.enqueue([&, c, f]() {
+          cv::Ptr<cv::ml::SVM> svm = trainCandidate(candidates[c], fold_training[f], max_iter);
+          if (!svm->isTrained()) {
+            failed[c] = 1;
+            return;
+          }
+          std::vector<double> fold_risks = predictRisk(svm, fold_validation[f].features);
+          for (size_t i = 0; i < fold_risks.size(); ++i)
+            risks[c][fold_indices[f][i]] = fold_risks[i];
+          if (f == 0)
+            first_fold_models[c] = svm;
+        }));
+    for (size_t t = 0; t < tasks.size(); ++t)
+      tasks[t].get();
+  }
+  double cv_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+  // Metrics, inference cost measured sequentially (no concurrent training)
+  std::vector<int> labels (training.features.rows);
+  for (int i = 0; i < training.features.rows; ++i)
+    labels[i] = training.labels(i, 0);
+  std::vector<CandidateResult> results (candidates.size());
+  size_t winner = candidates.size();
+  for (size_t c = 0; c < candidates.size(); ++c) {
+    if (failed[c]) {
+      results[c].trained = false;
+      continue;
+    }
+    evaluate(risks[c], labels, threshold, results[c]);
+    results[c].nb_support_vectors = first_fold_models[c]->getSupportVectors().rows;
+    results[c].inference_us = measureInference(first_fold_models[c], fold_validation[0].features);
+
+    if (winner == candidates.size()) {
+      winner = c;
+      continue;
+    }
+    const CandidateResult& best = results[winner];
+    double score = (select == "f1") ? results[c].f1 : results[c].auc;
+    double best_score = (select == "f1") ? best.f1 : best.auc;
+    if (score > best_score ||
+        (score == best_score && (results[c].auc > best.auc ||
+                                 (results[c].auc == best.auc && results[c].inference_us < best.inference_us))))
+      winner = c;
+  }
+
+  // Report
+  std::ofstream report;
+  if (!report_file.empty()) {
+    report.open(report_file.c_str());
+    report << "# kernel C gamma degree coef0 auc precision recall f1 support_vectors inference_us\n";
+  }
+  std::cout << std::fixed << std::setprecision(4);
+  for (size_t c = 0; c < candidates.size(); ++c) {
+    const CandidateResult& r = results[c];
+    if (!r.trained) {
+      std::cout << "[ModelSelection] " << std::left << std::setw(44) << candidateName(candidates[c]) << std::right
+                << " training failed" << std::endl;
+      continue;
+    }
+    std::cout << "[ModelSelection] " << std::left << std::setw(44) << candidateName(candidates[c]) << std::right
+              << " AUC " << r.auc << "  F1 " << r.f1 << "  P " << r.precision << "  R " << r.recall
+              << "  SV " << std::setw(5) << r.nb_support_vectors << "  " << std::setprecision(2)
+              << r.inference_us << " us" << std::setprecision(4) << (c == winner ? "  <--" : "") << std::endl;
+    if (report.is_open())
+      report << kernelName(candidates[c].kernel) << " " << candidates[c].C << " " << candidates[c].gamma << " "
+             << candidates[c].degree << " " << candidates[c].coef0 << " " << r.auc << " " << r.precision << " "
+             << r.recall << " " << r.f1 << " " << r.nb_support_vectors << " " << r.inference_us << "\n";
+  }
+  std::cout << "[ModelSelection] Cross-validation: " << std::setprecision(1) << cv_seconds << " s." << std::endl;
+  if (winner == candidates.size()) {
+    std::cerr << "[ModelSelection] Error: no candidate could be trained." << std::endl;
+    return 1;
+  }
+  std::cout << "[ModelSelection] Winner: " << candidateName(candidates[winner]) << std::endl;
+
+  // Export: winner trained on all samples, lookup table built by aicp::SVM when loading it
+  cv::Ptr<cv::ml::SVM> svm = trainCandidate(candidates[winner], training, max_iter);
+  if (!svm->isTrained()) {
+    std::cerr << "[ModelSelection] Error: training the winner on all samples failed." << std::endl;
+    return 1;
+  }
+  svm->save(output_file.c_str());
+  std::cout << "[ModelSelection] Saved model to: " << output_file << "." << std::endl;
+
+  ClassificationParams params;
+  params.type = "SVM";
+  params.svm.threshold = threshold;
+  params.svm.saveFile = output_file;
+  params.svm.useLookupTable = lut_resolution > 0.0f;
+  params.svm.lookupTableResolution = lut_resolution;
+  SVM exported (params);
+
+  if (!testing_file.empty()) {
+    Samples testing;
+    if (!loadSamples(testing_file, testing))
+      return 1;
+    Eigen::MatrixXd testing_data (testing.features.rows, 2), testing_labels (testing.features.rows, 1);
+    std::vector<int> test_labels (testing.features.rows);
+    for (int i = 0; i < testing.features.rows; ++i) {
+      testing_data(i, 0) = testing.features(i, 0);
+      testing_data(i, 1) = testing.features(i, 1);
+      testing_labels(i, 0) = test_labels[i] = testing.labels(i, 0);
+    }
+    Eigen::MatrixXd probabilities;
+    exported.test(testing_data, testing_labels, &probabilities);
+    if (probabilities.rows() != testing.features.rows)
+      return 1;
+    std::vector<double> test_risks (probabilities.data(), probabilities.data() + probabilities.rows());
+    CandidateResult test_result;
+    evaluate(test_risks, test_labels, threshold, test_result);
+    std::cout << std::setprecision(4) << "[ModelSelection] Testing (" << testing.features.rows << " samples"
+              << (params.svm.useLookupTable ? ", lookup table" : "") << "): AUC " << test_result.auc
+              << "  F1 " << test_result.f1 << "  P " << test_result.precision
+              << "  R " << test_result.recall << std::endl;
+  }
+  return 0;
+}
@@ -0,0 +1,121 @@
+#include "aicp_classification/risk_lookup_table.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+
+namespace aicp {
+
+  // Tag, model hash, resolution, nodes per dimension, values
+  static const char lut_file_tag[8] = {'A', 'I', 'C', 'P', 'L', 'U', 'T', '2'};
+  static const float lut_max_input = 100.0;
+
+  RiskLookupTable::RiskLookupTable() :
+    resolution_(0.5), size_(0) {}
+
+  RiskLookupTable::RiskLookupTable(float resolution) :
+    resolution_(resolution), size_(0) {
+    // Invalid resolution: table never built (isValid() false)
+    if (resolution_ > 0.0)
+      size_ = (int)std::ceil(lut_max_input / resolution_) + 1;
+  }
+
+  void RiskLookupTable::getGridSamples(RowMatrixXf& samples) const {
+    samples.resize(size_ * size_, 2);
+    for (int i = 0; i < size_; i++) {
+      for (int j = 0; j < size_; j++) {
+        samples(i * size_ + j, 0) = std::min(i * resolution_, lut_max_input);
+        samples(i * size_ + j, 1) = std::min(j * resolution_, lut_max_input);
+      }
+    }
+  }
+
+  void RiskLookupTable::setValues(const Eigen::VectorXd& values) {
+    if (size_ < 2 || values.size() != size_ * size_) {
+      std::cerr << "[RiskLookupTable] Error: " << values.size() << " values for "
+                << size_ * size_ << " grid nodes." << std::endl;
+      return;
+    }
+    values_.resize(values.size());
+    for (int k = 0; k < values.size(); k++)
+      values_[k] = values(k);
+  }
+
+  float RiskLookupTable::lookup(float overlap, float alignability) const {
+    assert(isValid());
+    float x = std::max(0.0f, std::min(overlap, lut_max_input)) / resolution_;
+    float y = std::max(0.0f, std::min(alignability, lut_max_input)) / resolution_;
+    int i = std::min((int)x, size_ - 2);
+    int j = std::min((int)y, size_ - 2);
+    float dx = std::min(x - i, 1.0f);
+    float dy = std::min(y - j, 1.0f);
+
+    const float* row0 = &values_[i * size_ + j];
+    const float* row1 = row0 + size_;
+    return (1.0f - dx) * ((1.0f - dy) * row0[0] + dy * row0[1]) +
+                   dx * ((1.0f - dy) * row1[0] + dy * row1[1]);
+  }
+
+  void RiskLookupTable::getRiskBounds(float overlap, float& min_risk, float& max_risk) const {
+    assert(isValid());
+    float x = std::max(0.0f, std::min(overlap, lut_max_input)) / resolution_;
+    int i = std::min((int)x, size_ - 2);
+    float dx = std::min(x - i, 1.0f);
+
+    // Extrema of a linear interpolation between nodes are at the nodes
+    const float* row0 = &values_[i * size_];
+    const float* row1 = row0 + size_;
+    min_risk = max_risk = (1.0f - dx) * row0[0] + dx * row1[0];
+    for (int j = 1; j < size_; j++) {
+      float risk = (1.0f - dx) * row0[j] + dx * row1[j];
+      min_risk = std::min(min_risk, risk);
+      max_risk = std::max(max_risk, risk);
+    }
+  }
+
+  bool RiskLookupTable::save(const std::string &filename, uint64_t model_hash) const {
+    std::ofstream file(filename.c_str(), std::ios::out | std::ios::binary);
+    if (!file.is_open() || !isValid()) {
+      std::cerr << "[RiskLookupTable] Error: cannot save to " << filename << "." << std::endl;
+      return false;
+    }
+    file.write(lut_file_tag, sizeof(lut_file_tag));
+    file.write(reinterpret_cast<const char*>(&model_hash), sizeof(model_hash));
+    file.write(reinterpret_cast<const char*>(&resolution_), sizeof(resolution_));
+    file.write(reinterpret_cast<const char*>(&size_), sizeof(size_));
+    file.write(reinterpret_cast<const char*>(&values_[0]), values_.size() * sizeof(float));
+    return file.good();
+  }
+
+  bool RiskLookupTable::load(const std::string &filename, uint64_t model_hash) {
+    std::ifstream file(filename.c_str(), std::ios::in | std::ios::binary);
+    if (!file.is_open())
+      return false;
+
+    char tag[sizeof(lut_file_tag)];
+    uint64_t hash;
+    float resolution;
+    int size;
+    file.read(tag, sizeof(tag));
+    file.read(reinterpret_cast<char*>(&hash), sizeof(hash));
+    file.read(reinterpret_cast<char*>(&resolution), sizeof(resolution));
+    file.read(reinterpret_cast<char*>(&size), sizeof(size));
+    // Older format or table of another model: built again
+    if (!file.good() || std::memcmp(tag, lut_file_tag, sizeof(tag)) != 0 || hash != model_hash)
+      return false;
+    if (resolution != resolution_ || size != size_) {
+      std::cerr << "[RiskLookupTable] Error: " << filename << " does not match grid resolution " << resolution_ << "." << std::endl;
+      return false;
+    }
+
+    std::vector<float> values (size * size);
+    file.read(reinterpret_cast<char*>(&values[0]), values.size() * sizeof(float));
+    if (!file.good())
+      return false;
+    values_.swap(values);
+    return true;
+  }
+
+}
@@ -1,19 +1,32 @@
 #include "aicp_classification/svm.hpp"
+#include "aicp_utils/logging.hpp"
+
+#include <fstream>
 
 namespace aicp {
 
   SVM::SVM(const ClassificationParams& params)
       : params_(params) {
-    svm_ = cv::ml::SVM::create();
-    // SVM's parameters
-    svm_->setType(cv::ml::SVM::C_SVC);
-    svm_->setKernel(cv::ml::SVM::POLY);
-    svm_->setDegree(3);
-    svm_->setTermCriteria(cv::TermCriteria(cv::TermCriteria::MAX_ITER, 100, 1e-6));
+    svm_ = createModel();
+
+    // Load the classifier once (if already trained)
+    if (params_.svm.saveFile.compare("") != 0 && std::ifstream(params_.svm.saveFile.c_str()).good()) {
+      load(params_.svm.saveFile);
+    }
   }
 
   SVM::~SVM() {}
 
+  cv::Ptr<cv::ml::SVM> SVM::createModel() {
+    cv::Ptr<cv::ml::SVM> svm = cv::ml::SVM::create();
+    // SVM's parameters
+    svm->setType(cv::ml::SVM::C_SVC);
+    svm->setKernel(cv::ml::SVM::POLY);
+    svm->setDegree(3);
+    svm->setTermCriteria(cv::TermCriteria(cv::TermCriteria::MAX_ITER, 100, 1e-6));
+    return svm;
+  }
+
   void SVM::train(const Eigen::MatrixXd &training_data, const Eigen::MatrixXd &labels) {
 
     const unsigned int n_training_samples = training_data.rows();
@@ -32,89 +45,215 @@ namespace aicp {
       opencv_labels.at<float>(i, 0) = labels(i, 0);
     }
 
-    // Train the SVM
+    // Train a new SVM (test() keeps the current one meanwhile), swapped once trained
     cv::Ptr<cv::ml::TrainData> td = cv::ml::TrainData::create(opencv_training_data, cv::ml::ROW_SAMPLE, opencv_labels);
-    // svm_->train(td);
+    cv::Ptr<cv::ml::SVM> svm = createModel();
+    // svm->train(td);
     // or auto train
-    svm_->trainAuto(td);
+    svm->trainAuto(td);
+    {
+      std::lock_guard<std::mutex> lock(svm_mutex_);
+      svm_ = svm;
+      lookup_table_.reset();
+    }
 
+    // Lock released: save() takes it
     if (params_.svm.saveFile.compare("") != 0) {
       save(params_.svm.saveFile.c_str());
     }
+    if (params_.svm.useLookupTable) {
+      // From the trained model (svm_ may be replaced meanwhile by load())
+      std::shared_ptr<RiskLookupTable> lookup_table = createLookupTable(svm, params_.svm.saveFile);
+      std::lock_guard<std::mutex> lock(svm_mutex_);
+      if (svm_ == svm)
+        lookup_table_ = lookup_table;
+    }
   }
 
-  void SVM::test(const Eigen::MatrixXd &testing_data, Eigen::MatrixXd *probabilities) {
-    int testing_data_size = testing_data.rows();
-    Eigen::MatrixXd empty_labels = Eigen::MatrixXd::Zero(testing_data_size,1);
+  // Samples converted row by row into a buffer reused by the calling thread
+  // (test() may run concurrently, no allocation while the number of samples is unchanged)
+  static const RowMatrixXf& toFloatSamples(const Eigen::MatrixXd &testing_data) {
+    thread_local RowMatrixXf samples;
+    samples.resize(testing_data.rows(), testing_data.cols());
+    for (int i = 0; i < testing_data.rows(); ++i)
+      samples.row(i) = testing_data.row(i).cast<float>();
+    return samples;
+  }
 
-    test(testing_data, empty_labels, probabilities);
+  void SVM::test(const Eigen::MatrixXd &testing_data, Eigen::MatrixXd *probabilities) {
+    predictBatch(toFloatSamples(testing_data), Eigen::MatrixXd(), probabilities);
   }
 
   void SVM::test(const Eigen::MatrixXd &testing_data, const Eigen::MatrixXd &labels, Eigen::MatrixXd *probabilities) {
+    predictBatch(toFloatSamples(testing_data), labels, probabilities);
+  }
 
-    // Load the classifier
-    if (params_.svm.saveFile.compare("") != 0) {
-      load(params_.svm.saveFile.c_str());
+  void SVM::predictBatch(const RowMatrixXf &testing_data, const Eigen::MatrixXd &labels, Eigen::MatrixXd *probabilities) {
+
+    // Current model (kept by svm if a new one is loaded meanwhile)
+    cv::Ptr<cv::ml::SVM> svm;
+    std::shared_ptr<RiskLookupTable> lookup_table;
+    {
+      std::lock_guard<std::mutex> lock(svm_mutex_);
+      svm = svm_;
+      lookup_table = lookup_table_;
+    }
+    if (!svm->isTrained()) {
+      std::cerr << "[SVM] Error: classifier not trained, no model loaded." << std::endl;
+      return;
     }
 
     const unsigned int n_testing_samples = testing_data.rows();
     const unsigned int variables_dimension = testing_data.cols();
 
-    std::cout << "[SVM] Testing SVM with " << n_testing_samples << " samples of dimension " << variables_dimension << "." << std::endl;
+    if (n_testing_samples > 1u)
+      AICP_LOG_DEBUG("SVM", "Testing SVM with " << n_testing_samples << " samples of dimension " << variables_dimension << ".");
 
     if (probabilities != NULL)
       probabilities->resize(n_testing_samples, 1);
 
     if (n_testing_samples > 0u) {
-      unsigned int tp = 0u, fp = 0u, tn = 0u, fn = 0u;
-
-      for (size_t i = 0u; i < n_testing_samples; ++i) {
-
-        // retrieve one sample
-        cv::Mat sample(1, variables_dimension, CV_32FC1);
-        for (size_t j = 0u; j < variables_dimension; j++) {
-          sample.at<float>(j) = testing_data(i, j);
-        }
+      Eigen::VectorXd probability;
+      if (lookup_table && lookup_table->isValid() && variables_dimension == 2u) {
+        // (overlap, alignability) samples: constant time lookup
+        probability.resize(n_testing_samples);
+        for (size_t i = 0u; i < n_testing_samples; ++i)
+          probability(i) = lookup_table->lookup(testing_data(i, 0), testing_data(i, 1));
+      }
+      else {
+        predict(svm, testing_data, probability);
+      }
+      if (probabilities != NULL)
+        probabilities->col(0) = probability;
 
-        int enable = 1;
-        cv::Mat1f output;
-        svm_->predict(sample, output, enable); // enable: enable probabilities
-        double probability = 1.0 - 1.0 / (1.0 + exp(-output.at<float>(0, 0)));
-        // std::cout << "[SVM] Output:" << output << std::endl;
-        // std::cout << "[SVM] Probability:" << probability << std::endl;
-        if (!labels.isZero() && probability >= params_.svm.threshold) { // high alignment risk
-                                                    // --> expected failure (positive label = 1)
-          if (labels(i, 0) == 1.0) {
-            ++tp;
+      // Statistics
+      bool has_labels = labels.rows() == n_testing_samples && !labels.isZero();
+      if (has_labels && n_testing_samples > 1u) {
+        unsigned int tp = 0u, fp = 0u, tn = 0u, fn = 0u;
+        for (size_t i = 0u; i < n_testing_samples; ++i) {
+          if (probability(i) >= params_.svm.threshold) { // high alignment risk
+                                                         // --> expected failure (positive label = 1)
+            if (labels(i, 0) == 1.0) {
+              ++tp;
+            } else {
+              ++fp;
+            }
           } else {
-            ++fp;
-          }
-        } else {
-          if (labels(i, 0) == 0.0) {
-            ++tn;
-          } else {
-            ++fn;
+            if (labels(i, 0) == 0.0) {
+              ++tn;
+            } else {
+              ++fn;
+            }
           }
         }
+        confusionMatrix(tp, tn, fp, fn);
+      }
+    }
+  }
 
-        if (probabilities != NULL) {
-          (*probabilities)(i, 0) = probability;
-        }
+  bool SVM::getRiskBounds(float overlap, double &min_risk, double &max_risk) {
+    std::shared_ptr<RiskLookupTable> lookup_table;
+    {
+      std::lock_guard<std::mutex> lock(svm_mutex_);
+      lookup_table = lookup_table_;
+    }
+    if (!lookup_table || !lookup_table->isValid())
+      return false;
+
+    float min_value, max_value;
+    lookup_table->getRiskBounds(overlap, min_value, max_value);
+    min_risk = min_value;
+    max_risk = max_value;
+    return true;
+  }
+
+  void SVM::predict(const cv::Ptr<cv::ml::SVM>& svm, const RowMatrixXf &testing_data, Eigen::VectorXd& probabilities) {
+    // All samples at once (row-major Eigen buffer used in place, no copy);
+    // OpenCV splits the samples across threads
+    cv::Mat samples(testing_data.rows(), testing_data.cols(), CV_32FC1, const_cast<float*>(testing_data.data()));
+    cv::Mat1f outputs;
+    svm->predict(samples, outputs, cv::ml::StatModel::RAW_OUTPUT); // raw output: decision function value
+
+    Eigen::Map<Eigen::VectorXf> raw_outputs(outputs.ptr<float>(), testing_data.rows());
+    probabilities = 1.0 - 1.0 / (1.0 + (-raw_outputs.cast<double>()).array().exp());
+  }
+
+  bool SVM::hashFile(const std::string &filename, uint64_t &hash) {
+    std::ifstream file(filename.c_str(), std::ios::in | std::ios::binary);
+    if (!file.is_open())
+      return false;
+    // FNV-1a of the contents, then of the size
+    hash = 14695981039346656037ULL;
+    uint64_t size = 0;
+    char buffer[65536];
+    while (file) {
+      file.read(buffer, sizeof(buffer));
+      std::streamsize count = file.gcount();
+      for (std::streamsize i = 0; i < count; i++) {
+        hash ^= (unsigned char)buffer[i];
+        hash *= 1099511628211ULL;
       }
-      if (!labels.isZero() && probabilities->rows() > 1)
-        confusionMatrix(tp, tn, fp, fn);
+      size += count;
     }
+    for (int i = 0; i < 8; i++) {
+      hash ^= (size >> (8 * i)) & 0xFF;
+      hash *= 1099511628211ULL;
+    }
+    return file.eof();
+  }
+
+  std::shared_ptr<RiskLookupTable> SVM::createLookupTable(const cv::Ptr<cv::ml::SVM>& svm, const std::string &model_file) {
+    std::shared_ptr<RiskLookupTable> lookup_table (new RiskLookupTable(params_.svm.lookupTableResolution));
+    std::string lookup_table_file = model_file + ".lut";
+
+    // Lookup table file of the same model file contents
+    uint64_t model_hash = 0;
+    bool hashed = !model_file.empty() && hashFile(model_file, model_hash);
+    if (hashed && lookup_table->load(lookup_table_file, model_hash)) {
+      std::cout << "[SVM] Loaded risk lookup table from: " << lookup_table_file << "." << std::endl;
+      return lookup_table;
+    }
+
+    RowMatrixXf samples;
+    lookup_table->getGridSamples(samples);
+    Eigen::VectorXd values;
+    predict(svm, samples, values);
+    lookup_table->setValues(values);
+    std::cout << "[SVM] Built risk lookup table with " << samples.rows() << " nodes." << std::endl;
+
+    if (hashed && lookup_table->save(lookup_table_file, model_hash))
+      std::cout << "[SVM] Saved risk lookup table to: " << lookup_table_file << "." << std::endl;
+    return lookup_table;
   }
 
   void SVM::save(const std::string &filename) {
     std::cout << "[SVM] Saving the classifier model to: " << filename << "." << std::endl;
+    std::lock_guard<std::mutex> lock(svm_mutex_);
     svm_->save(filename.c_str());
   }
 
-  void SVM::load(const std::string &filename) {
+  bool SVM::load(const std::string &filename) {
     std::cout << "[SVM] Loading a classifier model from: " << filename << "." << std::endl;
+    if (!std::ifstream(filename.c_str()).good()) {
+      std::cerr << "[SVM] Error: cannot open " << filename << "." << std::endl;
+      return false;
+    }
     // in opencv3, cv::ml::SVM::load() creates a new instance, so you have to load your SVM like:
-    svm_ = cv::ml::SVM::load(filename.c_str());
+    cv::Ptr<cv::ml::SVM> svm = cv::ml::SVM::load(filename.c_str());
+    if (svm.empty() || !svm->isTrained()) {
+      std::cerr << "[SVM] Error: no trained model in " << filename << "." << std::endl;
+      return false;
+    }
+
+    std::shared_ptr<RiskLookupTable> lookup_table;
+    if (params_.svm.useLookupTable)
+      lookup_table = createLookupTable(svm, filename);
+
+    // Swap models (file parsed without blocking test())
+    std::lock_guard<std::mutex> lock(svm_mutex_);
+    svm_ = svm;
+    lookup_table_ = lookup_table;
+    return true;
   }
 
 }  // namespace aicp
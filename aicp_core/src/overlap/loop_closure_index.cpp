@@ -0,0 +1,205 @@
+#include "aicp_overlap/loop_closure_index.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+namespace aicp {
+
+  // Points per tree leaf
+  static const int loop_closure_leaf_size = 8;
+
+  LoopClosureIndex::LoopClosureIndex() :
+    nb_indexed_(0)
+  {
+  }
+
+  LoopClosureIndex::LoopClosureIndex(const OverlapParams::LoopClosureParams& params) :
+    params_(params), nb_indexed_(0)
+  {
+  }
+
+  void LoopClosureIndex::computeDescriptor(const pcl::PointCloud<pcl::PointXYZ>& cloud, const Eigen::Isometry3d& pose,
+                                           int id, PlaceDescriptor& descriptor) const
+  {
+    descriptor.id = id;
+    descriptor.sectors = Eigen::MatrixXf::Zero(params_.nbRings, params_.nbSectors);
+    descriptor.ring_key = Eigen::VectorXf::Zero(params_.nbRings);
+
+    // Heights are offset to be positive below the sensor
+    const float height_offset = 2.0f;
+    Eigen::Isometry3f global_to_local = pose.inverse().cast<float>();
+    for (size_t i = 0; i < cloud.size(); i++)
+    {
+      const pcl::PointXYZ& point = cloud.points[i];
+      if (!std::isfinite(point.x) || !std::isfinite(point.y) || !std::isfinite(point.z))
+        continue;
+      Eigen::Vector3f p = global_to_local * Eigen::Vector3f(point.x, point.y, point.z);
+      float radius = std::sqrt(p.x() * p.x() + p.y() * p.y());
+      if (radius >= params_.maxRadius)
+        continue;
+      int ring = std::min((int)(radius / params_.maxRadius * params_.nbRings), params_.nbRings - 1);
+      float angle = std::atan2(p.y(), p.x()) + M_PI;
+      int sector = std::min((int)(angle / (2.0 * M_PI) * params_.nbSectors), params_.nbSectors - 1);
+      float& height = descriptor.sectors(ring, sector);
+      height = std::max(height, std::max(p.z() + height_offset, 1e-3f));
+    }
+
+    for (int r = 0; r < params_.nbRings; r++)
+      descriptor.ring_key(r) = float((descriptor.sectors.row(r).array() > 0.0f).count()) / params_.nbSectors;
+  }
+
+  void LoopClosureIndex::add(const PlaceDescriptor& descriptor)
+  {
+    descriptors_.push_back(descriptor);
+    if ((int)descriptors_.size() - nb_indexed_ >= std::max(params_.rebuildPeriod, 1))
+      buildTree();
+  }
+
+  void LoopClosureIndex::buildTree()
+  {
+    nb_indexed_ = descriptors_.size();
+    tree_points_.resize(nb_indexed_);
+    for (int i = 0; i < nb_indexed_; i++)
+      tree_points_[i] = i;
+    tree_nodes_.clear();
+    tree_nodes_.reserve(2 * nb_indexed_ / loop_closure_leaf_size + 1);
+    buildNode(0, nb_indexed_);
+  }
+
+  int LoopClosureIndex::buildNode(int begin, int end)
+  {
+    int index = tree_nodes_.size();
+    tree_nodes_.push_back(Node());
+    Node node;
+    node.dim = -1;
+    node.split = 0.0f;
+    node.begin = begin;
+    node.end = end;
+    node.left = -1;
+    node.right = -1;
+
+    if (end - begin > loop_closure_leaf_size)
+    {
+      // Split at median of the widest dimension
+      Eigen::VectorXf min = descriptors_[tree_points_[begin]].ring_key;
+      Eigen::VectorXf max = min;
+      for (int i = begin + 1; i < end; i++)
+      {
+        min = min.cwiseMin(descriptors_[tree_points_[i]].ring_key);
+        max = max.cwiseMax(descriptors_[tree_points_[i]].ring_key);
+      }
+      int dim;
+      float spread = (max - min).maxCoeff(&dim);
+      if (spread > 0.0f)
+      {
+        int middle = begin + (end - begin) / 2;
+        std::nth_element(tree_points_.begin() + begin, tree_points_.begin() + middle, tree_points_.begin() + end,
+                         [&](int a, int b){ return descriptors_[a].ring_key(dim) < descriptors_[b].ring_key(dim); });
+        node.dim = dim;
+        node.split = descriptors_[tree_points_[middle]].ring_key(dim);
+        node.left = buildNode(begin, middle);
+        node.right = buildNode(middle, end);
+      }
+    }
+    tree_nodes_[index] = node;
+    return index;
+  }
+
+  void LoopClosureIndex::pushCandidate(float distance, int index, size_t k,
+                                       std::vector<std::pair<float, int> >& heap) const
+  {
+    if (heap.size() < k)
+    {
+      heap.push_back(std::make_pair(distance, index));
+      std::push_heap(heap.begin(), heap.end());
+    }
+    else if (distance < heap.front().first)
+    {
+      std::pop_heap(heap.begin(), heap.end());
+      heap.back() = std::make_pair(distance, index);
+      std::push_heap(heap.begin(), heap.end());
+    }
+  }
+
+  void LoopClosureIndex::searchTree(int node_index, const Eigen::VectorXf& key, int max_id, size_t k,
+                                    std::vector<std::pair<float, int> >& heap) const
+  {
+    const Node& node = tree_nodes_[node_index];
+    if (node.dim < 0)
+    {
+      for (int i = node.begin; i < node.end; i++)
+      {
+        const PlaceDescriptor& descriptor = descriptors_[tree_points_[i]];
+        if (descriptor.id <= max_id)
+          pushCandidate((descriptor.ring_key - key).squaredNorm(), tree_points_[i], k, heap);
+      }
+      return;
+    }
+
+    float offset = key(node.dim) - node.split;
+    int near = offset < 0.0f ? node.left : node.right;
+    int far = offset < 0.0f ? node.right : node.left;
+    searchTree(near, key, max_id, k, heap);
+    if (heap.size() < k || offset * offset < heap.front().first)
+      searchTree(far, key, max_id, k, heap);
+  }
+
+  void LoopClosureIndex::getCandidates(const PlaceDescriptor& query, std::vector<int>& ids,
+                                       std::vector<float>& distances) const
+  {
+    ids.clear();
+    distances.clear();
+    if (params_.nbCandidates <= 0)
+      return;
+
+    // Nearest ring keys (more than needed, re-ranked below)
+    size_t k = 3 * params_.nbCandidates;
+    int max_id = query.id - params_.minIdGap;
+    std::vector<std::pair<float, int> > heap;
+    if (!tree_nodes_.empty())
+      searchTree(0, query.ring_key, max_id, k, heap);
+    for (size_t i = nb_indexed_; i < descriptors_.size(); i++)
+    {
+      if (descriptors_[i].id <= max_id)
+        pushCandidate((descriptors_[i].ring_key - query.ring_key).squaredNorm(), i, k, heap);
+    }
+
+    std::vector<std::pair<float, int> > ranked;
+    for (size_t i = 0; i < heap.size(); i++)
+      ranked.push_back(std::make_pair(getSectorsDistance(query.sectors, descriptors_[heap[i].second].sectors),
+                                      descriptors_[heap[i].second].id));
+    std::sort(ranked.begin(), ranked.end());
+    for (size_t i = 0; i < ranked.size() && (int)i < params_.nbCandidates; i++)
+    {
+      ids.push_back(ranked[i].second);
+      distances.push_back(ranked[i].first);
+    }
+  }
+
+  // Mean cosine distance between columns (sectors) of a and b, at the best yaw shift of b
+  float LoopClosureIndex::getSectorsDistance(const Eigen::MatrixXf& a, const Eigen::MatrixXf& b) const
+  {
+    const int nb_sectors = a.cols();
+    Eigen::VectorXf norms_a = a.colwise().norm().transpose();
+    Eigen::VectorXf norms_b = b.colwise().norm().transpose();
+
+    float best = 2.0f;
+    for (int shift = 0; shift < nb_sectors; shift++)
+    {
+      float similarity = 0.0f;
+      int nb_valid = 0;
+      for (int s = 0; s < nb_sectors; s++)
+      {
+        int shifted = (s + shift) % nb_sectors;
+        if (norms_a(s) <= 0.0f || norms_b(shifted) <= 0.0f)
+          continue;
+        similarity += a.col(s).dot(b.col(shifted)) / (norms_a(s) * norms_b(shifted));
+        nb_valid++;
+      }
+      if (nb_valid > 0)
+        best = std::min(best, 1.0f - similarity / nb_valid);
+    }
+    return best;
+  }
+}
@@ -1,11 +1,16 @@
 #include "aicp_overlap/octrees_overlap.hpp"
+#include "aicp_overlap/overlap_tree.hpp"
+
+#include <algorithm>
+#include <limits>
 
 namespace aicp {
 
   OctreesOverlap::OctreesOverlap(const OverlapParams& params) :
     params_(params)
   {
-    tree_  = new ColorOcTree(params_.octree_based.octomapResolution);
+    tree_.reset(new OverlapTree(params_.octree_based.octomapResolution));
+    reference_id_ = -1;
 
     overlap_ = -1.0;
 
@@ -16,21 +21,101 @@ namespace aicp {
     red = new ColorOcTreeNode::Color(255,0,0);
   }
 
-  OctreesOverlap::~OctreesOverlap() {}
+  OctreesOverlap::~OctreesOverlap()
+  {
+    delete yellow;
+    delete green;
+    delete blue;
+    delete red;
+  }
 
   void OctreesOverlap::setReferenceTree(pcl::PointCloud<pcl::PointXYZ> &ref_cloud, Eigen::Isometry3d ref_pose)
   {
-    tree_ = new ColorOcTree(params_.octree_based.octomapResolution);
+    // Setting reference tree (createTree clears the previous one, unless shared)
+    if (tree_.use_count() > 1)
+      tree_.reset(new OverlapTree(params_.octree_based.octomapResolution));
+    createTree(ref_cloud, ref_pose, tree_.get(), blue);
+  }
+
+  void OctreesOverlap::setReferenceTree(const std::shared_ptr<ColorOcTree>& tree, int reference_id)
+  {
+    if (!tree || tree == tree_)
+      return;
+    tree_ = tree;
+    reference_id_ = reference_id;
+  }
 
-    // Setting reference tree
-    createTree(ref_cloud, ref_pose, tree_, blue);
+  std::shared_ptr<ColorOcTree> OctreesOverlap::transformTree(const std::shared_ptr<ColorOcTree>& tree,
+                                                             const Eigen::Isometry3d& transform,
+                                                             Eigen::Isometry3d& remainder)
+  {
+    remainder = transform;
+    if (tree->size() == 0)
+      return tree;
+
+    // Translation by whole voxels and residual motion of the tree bounding box
+    // (affine in the point: largest at a corner)
+    const double resolution = tree->getResolution();
+    const Eigen::Vector3d shift = (transform.translation() / resolution).array().round().matrix();
+    double bbox_min[3], bbox_max[3];
+    tree->getMetricMin(bbox_min[0], bbox_min[1], bbox_min[2]);
+    tree->getMetricMax(bbox_max[0], bbox_max[1], bbox_max[2]);
+    double residual = 0.0;
+    for (int corner = 0; corner < 8; corner++)
+    {
+      Eigen::Vector3d point((corner & 1) ? bbox_max[0] : bbox_min[0],
+                            (corner & 2) ? bbox_max[1] : bbox_min[1],
+                            (corner & 4) ? bbox_max[2] : bbox_min[2]);
+      residual = max(residual, (transform * point - point - shift * resolution).norm());
+    }
+    if (residual > 0.5 * resolution)
+      return std::shared_ptr<ColorOcTree>();
+    if (shift.isZero())
+      return tree;
+    // Sub-voxel part left: transform = remainder * (translation by shift voxels)
+    remainder = transform * Eigen::Translation3d(-shift * resolution);
+
+    // Key-space translation: leaves (pruned ones as their children at max depth) copied with
+    // shifted keys, occupancy and colors kept
+    std::shared_ptr<ColorOcTree> moved (new OverlapTree(resolution));
+    moved->setClampingThresMin(tree->getClampingThresMin());
+    moved->setClampingThresMax(tree->getClampingThresMax());
+    moved->setProbHit(tree->getProbHit());
+    moved->setProbMiss(tree->getProbMiss());
+    const int offset[3] = {(int)shift.x(), (int)shift.y(), (int)shift.z()};
+    const int max_key = std::numeric_limits<key_type>::max();
+    const unsigned int depth = tree->getTreeDepth();
+    for(ColorOcTree::leaf_iterator it=tree->begin_leafs(),
+        end=tree->end_leafs(); it!= end; ++it) {
+      OcTreeKey index_key = it.getIndexKey();
+      int width = 1 << (depth - it.getDepth());
+      for (int x = 0; x < width; x++)
+        for (int y = 0; y < width; y++)
+          for (int z = 0; z < width; z++)
+          {
+            int key[3] = {index_key[0] + x + offset[0], index_key[1] + y + offset[1], index_key[2] + z + offset[2]};
+            if (key[0] < 0 || key[1] < 0 || key[2] < 0 || key[0] > max_key || key[1] > max_key || key[2] > max_key)
+              continue;
+            ColorOcTreeNode* node = moved->setNodeValue(OcTreeKey(key[0], key[1], key[2]), it->getLogOdds(), true);
+            node->setColor(it->getColor());
+          }
+    }
+    moved->updateInnerOccupancy();
+    moved->prune();
+    OverlapTree::accountMemory(moved.get());
+    return moved;
   }
 
   ColorOcTree* OctreesOverlap::computeOverlap(pcl::PointCloud<pcl::PointXYZ> &ref_cloud, pcl::PointCloud<pcl::PointXYZ> &read_cloud,
                                               Eigen::Isometry3d ref_pose, Eigen::Isometry3d read_pose,
-                                              ColorOcTree* reading_tree){
-    // Create octree from reference cloud (wrt robot point of view)
-    setReferenceTree(ref_cloud, ref_pose);
+                                              ColorOcTree* reading_tree, int reference_id){
+    // Create octree from reference cloud (wrt robot point of view),
+    // unless the same reference was used for the previous reading
+    if (reference_id < 0 || reference_id != reference_id_)
+    {
+      setReferenceTree(ref_cloud, ref_pose);
+      reference_id_ = reference_id;
+    }
 
     // Create reading tree (if not filled yet)
     if(reading_tree->size() == 0)
@@ -40,7 +125,35 @@ namespace aicp {
     int count_nodes_read = 0;
     int count_nodes_ref = 0;
     int overlapping_nodes = 0;
-    getOverlappingNodes(tree_, reading_tree, overlapping_nodes, count_nodes_ref, count_nodes_read);
+
+    // Coarse overlap first: refined at full resolution only if it falls
+    // (with a margin) in an interval where the exact value is needed
+    bool refine = true;
+    int coarse_depth = tree_->getTreeDepth() - params_.octree_based.coarseDepthOffset;
+    if (params_.octree_based.coarseDepthOffset > 0 && coarse_depth > 0 && !refinement_intervals_.empty())
+    {
+      getOverlappingNodes(tree_.get(), reading_tree, overlapping_nodes, count_nodes_ref, count_nodes_read, coarse_depth);
+      // Empty tree: no overlap (not refined)
+      float coarse_overlap = 0.0;
+      if (count_nodes_ref > 0 && count_nodes_read > 0)
+        coarse_overlap = min(float(overlapping_nodes) / float(count_nodes_ref),
+                             float(overlapping_nodes) / float(count_nodes_read)) * 100.0;
+
+      refine = false;
+      for (size_t i = 0; i < refinement_intervals_.size(); i++)
+      {
+        if (coarse_overlap >= refinement_intervals_[i].first - params_.octree_based.refineMargin &&
+            coarse_overlap <= refinement_intervals_[i].second + params_.octree_based.refineMargin)
+          refine = true;
+      }
+    }
+    if (refine)
+      getOverlappingNodes(tree_.get(), reading_tree, overlapping_nodes, count_nodes_ref, count_nodes_read);
+    if (count_nodes_ref == 0 || count_nodes_read == 0)
+    {
+      overlap_ = 0.0;
+      return tree_.get();
+    }
 
     // Compute trees overlap
     float treeAoverlap, treeBoverlap;
@@ -68,10 +181,9 @@ namespace aicp {
     cout << "octreesCombinedOverlap: " << overlap_[1] << " %" << endl;
     cout << "---------------------------------------------------" << endl;*/
 
-    return tree_;
+    return tree_.get();
   }
 
-  // FUNCTION TO BE TESTED ------------------------------
   float OctreesOverlap::computeLoopClosureFromOverlap(ColorOcTree* treeA, ColorOcTree* treeB)
   {
     // count tree nodes and color overlapping nodes
@@ -79,164 +191,173 @@ namespace aicp {
     int count_nodes_ref = 0;
     int overlapping_nodes = 0;
     getOverlappingNodes(treeA, treeB, overlapping_nodes, count_nodes_ref, count_nodes_read);
+    if (count_nodes_ref == 0 || count_nodes_read == 0)
+      return 0.0;
 
     // Compute trees overlap
-    std::vector<float> loop_closure_overlap = {-1.0, -1.0, -1.0, -1.0, -1.0, -1.0, -1.0};
     float treeAoverlap, treeBoverlap;
     treeAoverlap = float(overlapping_nodes) / float(count_nodes_ref);
     treeBoverlap = float(overlapping_nodes) / float(count_nodes_read);
 
-    // TEMPORARY: PARAMS USED TO DEBUG
-    // Set overlap params
-    float minOverlap = min(treeAoverlap,treeBoverlap);
-    float maxOverlap = max(treeAoverlap,treeBoverlap);
-    loop_closure_overlap[0] = minOverlap * 100.0;
-    loop_closure_overlap[1] = abs(maxOverlap - minOverlap) * 100.0;
-    loop_closure_overlap[2] = treeAoverlap * 100.0;
-    loop_closure_overlap[3] = treeBoverlap * 100.0;
-    loop_closure_overlap[4] = overlapping_nodes;
-    loop_closure_overlap[5] = count_nodes_ref;
-    loop_closure_overlap[6] = count_nodes_read;
-
-    cout << "-------[Octrees Overlap] LOOP CLOSURE Statistics-------" << endl;
-    cout << "# of overlapping nodes: " << overlapping_nodes << endl;
-    cout << "# of nodes treeA count: " << count_nodes_ref << endl;
-    cout << "# of nodes treeB count: " << count_nodes_read << endl;
-    cout << "treeAoverlapPerc: " << treeAoverlap * 100.0 << " %" << endl;
-    cout << "treeBoverlapPerc: " << treeBoverlap * 100.0 << " %" << endl;
-    cout << "octreesCombinedOverlap: " << loop_closure_overlap[1] << " %" << endl;
-    cout << "-------------------------------------------------------" << endl;
-
-    return loop_closure_overlap[0];
-  } // FUNCTION TO BE TESTED ------------------------------
+    return min(treeAoverlap,treeBoverlap) * 100.0;
+  }
 
-  void OctreesOverlap::getOverlappingNodes(ColorOcTree* treeA, ColorOcTree* treeB, int& overlapping_nodes, int& count_nodes_ref, int& count_nodes_read)
+  float OctreesOverlap::computeLoopClosureOverlap(pcl::PointCloud<pcl::PointXYZ> &cloudA, pcl::PointCloud<pcl::PointXYZ> &cloudB,
+                                                  Eigen::Isometry3d poseA, Eigen::Isometry3d poseB)
   {
-    treeA->expand();
-    treeB->expand();
+    ColorOcTree treeA(params_.octree_based.octomapResolution);
+    ColorOcTree treeB(params_.octree_based.octomapResolution);
+    createTree(cloudA, poseA, &treeA, blue);
+    createTree(cloudB, poseB, &treeB, green);
+    return computeLoopClosureFromOverlap(&treeA, &treeB);
+  }
 
-    for(ColorOcTree::tree_iterator it=treeB->begin_tree(),
-        end=treeB->end_tree(); it!= end; ++it) {
-      if (it.isLeaf())
-      {
-        ColorOcTreeNode* node_read = treeB->search(it.getKey());
-        if(node_read != NULL)
-        {
-          count_nodes_read += 1;
-        }
-      }
+  // Packed keys (at depth) of all the leaves of tree up to depth (pruned
+  // leaves are enumerated as their children at depth), sorted
+  static void getSortedLeafKeys(const ColorOcTree& tree, unsigned int depth, std::vector<uint64_t>& keys)
+  {
+    keys.clear();
+    keys.reserve(tree.size()); // upper bound if tree is not pruned
+    unsigned int shift = tree.getTreeDepth() - depth;
+    for(ColorOcTree::leaf_iterator it=tree.begin_leafs(depth),
+        end=tree.end_leafs(); it!= end; ++it) {
+      OcTreeKey index_key = it.getIndexKey();
+      unsigned int key[3] = {(unsigned int)index_key[0] >> shift,
+                             (unsigned int)index_key[1] >> shift,
+                             (unsigned int)index_key[2] >> shift};
+      unsigned int width = 1 << (depth - it.getDepth());
+      for (unsigned int x = 0; x < width; x++)
+        for (unsigned int y = 0; y < width; y++)
+          for (unsigned int z = 0; z < width; z++)
+            keys.push_back(((uint64_t)(key[0] + x) << 32) |
+                           ((uint64_t)(key[1] + y) << 16) |
+                            (uint64_t)(key[2] + z));
     }
+    std::sort(keys.begin(), keys.end());
+  }
 
-    for(ColorOcTree::tree_iterator it=treeA->begin_tree(),
-        end=treeA->end_tree(); it!= end; ++it) {
-      if (it.isLeaf())
+  void OctreesOverlap::getOverlappingNodes(ColorOcTree* treeA, ColorOcTree* treeB, int& overlapping_nodes, int& count_nodes_ref, int& count_nodes_read,
+                                           unsigned int depth)
+  {
+    if (depth == 0 || depth > treeA->getTreeDepth())
+      depth = treeA->getTreeDepth();
+    unsigned int shift = treeA->getTreeDepth() - depth;
+
+    // Flat sorted keys (trees are not modified)
+    std::vector<uint64_t> keysA, keysB;
+#ifdef _OPENMP
+#pragma omp parallel sections
+#endif
+    {
+#ifdef _OPENMP
+#pragma omp section
+#endif
+      getSortedLeafKeys(*treeA, depth, keysA);
+#ifdef _OPENMP
+#pragma omp section
+#endif
+      getSortedLeafKeys(*treeB, depth, keysB);
+    }
+    count_nodes_ref = keysA.size();
+    count_nodes_read = keysB.size();
+
+    // Sorted keys intersection
+    overlapping_nodes = 0;
+    std::vector<uint64_t>::const_iterator itA = keysA.begin(), itB = keysB.begin();
+    while (itA != keysA.end() && itB != keysB.end())
+    {
+      if (*itA < *itB)
+        ++itA;
+      else if (*itB < *itA)
+        ++itB;
+      else
       {
-        ColorOcTreeNode* node_ref = treeA->search(it.getKey());
-        if(node_ref != NULL)
-        {
-          count_nodes_ref += 1;
-        }
-        ColorOcTreeNode* node_read = treeB->search(it.getKey());
-        if(node_read != NULL)
-        {
-          overlapping_nodes += 1;
+        overlapping_nodes += 1;
 
-          node_read->setColor(*red); // set color to red
+        // Visualization: set color to red
+        if (params_.octree_based.colorTrees)
+        {
+          OcTreeKey key((key_type)((*itA >> 32) << shift),
+                        (key_type)(((*itA >> 16) & 0xFFFF) << shift),
+                        (key_type)((*itA & 0xFFFF) << shift));
+          ColorOcTreeNode* node_read = treeB->search(key, depth);
+          if(node_read != NULL)
+            node_read->setColor(*red);
         }
+        ++itA;
+        ++itB;
       }
     }
-
-    treeA->prune();
-    treeB->prune();
   }
 
   void OctreesOverlap::createTree(pcl::PointCloud<pcl::PointXYZ> &cloud, Eigen::Isometry3d pose, ColorOcTree* output_tree, ColorOcTreeNode::Color* color)
   {
     output_tree->clear();
-    double maxrange = -1;
-    int max_scan_no = -1;
-    unsigned char compression = 0;
-
-    // 1. Convert to octomap graph:
-    ScanGraph* graph = convertPointCloudToScanGraph(cloud, pose);
-
-    timeval start;
-    timeval stop;
-
-    gettimeofday(&start, NULL);  // start timer
-    unsigned int numScans = graph->size();
-    unsigned int currentScan = 1;
-    bool discretize = false;
-
-    // get default sensor model values:
-    ColorOcTree emptyTree(0.1);
-    double clampingMin = emptyTree.getClampingThresMin();
-    double clampingMax = emptyTree.getClampingThresMax();
-    double probMiss = emptyTree.getProbMiss();
-    double probHit = emptyTree.getProbHit();
-
-    output_tree->setClampingThresMin(clampingMin);
-    output_tree->setClampingThresMax(clampingMax);
-    output_tree->setProbHit(probHit);
-    output_tree->setProbMiss(probMiss);
-
-    for (ScanGraph::iterator scan_it = graph->begin(); scan_it != graph->end(); scan_it++) {
-      output_tree->insertPointCloud((*scan_it)->scan, (*scan_it)->pose.trans(), maxrange, false, discretize);
-
-      if (compression == 2){
-        output_tree->toMaxLikelihood();
-        output_tree->prune();
-      }
-
-      if ((max_scan_no > 0) && (currentScan == (unsigned int) max_scan_no))
-        break;
-
-      currentScan++;
-    }
-
-    gettimeofday(&stop, NULL);  // stop timer
-    double time_to_insert = (stop.tv_sec - start.tv_sec) + 1.0e-6 *(stop.tv_usec - start.tv_usec);
-//    cout << "[Octrees Overlap] Time to create octree: " << time_to_insert << " seconds." << endl;
-
-    // get rid of graph in mem before doing anything fancy with tree (=> memory)
-    delete graph;
+    if (params_.octree_based.endpointsOnly)
+      insertEndpoints(cloud, output_tree);
+    else
+      insertScans(cloud, pose, output_tree);
 
     // Visualization: Color octree
-    output_tree->expand();
-    for(ColorOcTree::tree_iterator it=output_tree->begin_tree(),
-        end=output_tree->end_tree(); it!= end; ++it) {
-      if (it.isLeaf()) {
-        point3d coord = output_tree->keyToCoord(it.getKey());
-        // Set nodes color
-        ColorOcTreeNode* n = output_tree->setNodeValue(coord, true);
-        n = output_tree->updateNode(coord, true);
-        n->setColor(*color);
+    if (params_.octree_based.colorTrees)
+    {
+      output_tree->expand();
+      for(ColorOcTree::tree_iterator it=output_tree->begin_tree(),
+          end=output_tree->end_tree(); it!= end; ++it) {
+        if (it.isLeaf()) {
+          point3d coord = output_tree->keyToCoord(it.getKey());
+          // Set nodes color
+          ColorOcTreeNode* n = output_tree->setNodeValue(coord, true);
+          n = output_tree->updateNode(coord, true);
+          n->setColor(*color);
+        }
       }
     }
     output_tree->updateInnerOccupancy();
     output_tree->prune();
+    OverlapTree::accountMemory(output_tree);
   }
 
-  ScanGraph* OctreesOverlap::convertPointCloudToScanGraph(pcl::PointCloud<pcl::PointXYZ> &cloud, Eigen::Isometry3d sensor_pose)
+  void OctreesOverlap::insertEndpoints(pcl::PointCloud<pcl::PointXYZ> &cloud, ColorOcTree* output_tree)
   {
-    // Convert cloud to octomap graph:
-    ScanGraph* graph = new ScanGraph();
-    octomap::Pointcloud* scan = new octomap::Pointcloud();
+    // Occupied cells only: same occupied leaves as a raycasted insertion
+    // (where occupied cells have preference over free ones), but no free leaves
+    KeySet occupied_cells;
+    OcTreeKey key;
+    for (size_t i = 0; i < cloud.points.size(); i++){
+      const pcl::PointXYZ& point = cloud.points[i];
+      if (!std::isfinite(point.x) || !std::isfinite(point.y) || !std::isfinite(point.z))
+        continue;
+      if (output_tree->coordToKeyChecked(point.x, point.y, point.z, key))
+        occupied_cells.insert(key);
+    }
 
-    //float x, y, z, roll, pitch, yaw;
-    //pose6d pose(x, y, z, roll, pitch, yaw);
-    Eigen::Vector3d euler = sensor_pose.rotation().eulerAngles(2, 1, 0);
-    octomap::pose6d pose(sensor_pose.translation().x(), sensor_pose.translation().y(), sensor_pose.translation().z(),
-                         euler[2], euler[1], euler[0]);
+    // Lazy update: inner nodes are updated once at the end
+    for (KeySet::iterator it = occupied_cells.begin(); it != occupied_cells.end(); ++it)
+      output_tree->updateNode(*it, true, true);
+  }
+
+  void OctreesOverlap::insertScans(pcl::PointCloud<pcl::PointXYZ> &cloud, Eigen::Isometry3d pose, ColorOcTree* output_tree)
+  {
+    double maxrange = -1;
+    bool discretize = false;
 
+    // Points are already in the global frame: only the sensor origin is needed for raycasting
+    octomap::Pointcloud scan;
+    scan.reserve(cloud.points.size());
     for (size_t i = 0; i < cloud.points.size(); i++){
-      scan->push_back(cloud.at(i).x,
-                      cloud.at(i).y,
-                      cloud.at(i).z);
+      const pcl::PointXYZ& point = cloud.points[i];
+      scan.push_back(point.x, point.y, point.z);
     }
-    graph->addNode(scan, pose);
-    graph->connectPrevious();
 
-    return graph;
+    // get default sensor model values:
+    ColorOcTree emptyTree(0.1);
+    output_tree->setClampingThresMin(emptyTree.getClampingThresMin());
+    output_tree->setClampingThresMax(emptyTree.getClampingThresMax());
+    output_tree->setProbHit(emptyTree.getProbHit());
+    output_tree->setProbMiss(emptyTree.getProbMiss());
+
+    Eigen::Vector3d origin = pose.translation();
+    output_tree->insertPointCloud(scan, point3d(origin.x(), origin.y(), origin.z()), maxrange, false, discretize);
   }
 }
@@ -0,0 +1,40 @@
+#include "aicp_overlap/overlap_tree.hpp"
+
+namespace aicp {
+
+  static MemoryCounter overlap_trees_memory;
+
+  OverlapTree::OverlapTree(double resolution) :
+    ColorOcTree(resolution), accounted_bytes_(0)
+  {
+    overlap_trees_memory.add(0, 1);
+  }
+
+  OverlapTree::~OverlapTree()
+  {
+    overlap_trees_memory.remove(accounted_bytes_, 1);
+  }
+
+  void OverlapTree::accountMemory()
+  {
+    size_t bytes = memoryUsage();
+    if (bytes >= accounted_bytes_)
+      overlap_trees_memory.add(bytes - accounted_bytes_, 0);
+    else
+      overlap_trees_memory.remove(accounted_bytes_ - bytes, 0);
+    accounted_bytes_ = bytes;
+  }
+
+  void OverlapTree::accountMemory(octomap::ColorOcTree* tree)
+  {
+    OverlapTree* overlap_tree = dynamic_cast<OverlapTree*>(tree);
+    if (overlap_tree != NULL)
+      overlap_tree->accountMemory();
+  }
+
+  MemoryUsage OverlapTree::getUsage()
+  {
+    return overlap_trees_memory.get();
+  }
+
+}
@@ -1,20 +1,35 @@
 #include "aicp_registration/aligned_cloud.hpp"
 #include "aicp_utils/common.hpp"
 
+#include <atomic>
+
 namespace aicp {
 
+int AlignedCloud::newPointsKey()
+{
+    // Clouds created and updated by several threads (streams, pipeline stages)
+    static std::atomic<int> next_points_key(0);
+    return next_points_key++;
+}
+
 AlignedCloud::AlignedCloud(int64_t utime,
                            pcl::PointCloud<pcl::PointXYZ>::Ptr& cloud,
                            Eigen::Isometry3d prior_pose)
 { 
     utime_ = utime;
     cloud_ = cloud;
+    nb_points_ = 0;
+    points_key_ = newPointsKey();
 
     world_to_cloud_odom_ = prior_pose;                          // prior pose. This is the original odom-to-base and is not updated elsewhere
 
     world_to_cloud_prior_ = prior_pose;                         // prior pose
     cloud_to_reference_ = Eigen::Isometry3d::Identity();        // correction
     world_to_cloud_corrected_ = world_to_cloud_prior_;          // corrected pose (set equal to prior pose when correction not available yet)
+    pending_update_ = Eigen::Isometry3d::Identity();
+    has_pending_update_ = false;
+    overlap_tree_to_cloud_ = Eigen::Isometry3d::Identity();
+    overlap_tree_moved_ = false;
 
     is_reference_ = false;  // default false
     its_reference_id_ = -1; // default -1 (indicates no alignment performed)
@@ -24,6 +39,54 @@ AlignedCloud::~AlignedCloud()
 { 
 }
 
+size_t AlignedCloud::getMemoryUsage()
+{
+    size_t bytes = 0;
+    if (cloud_)
+        bytes += cloud_->points.capacity() * sizeof(pcl::PointXYZ);
+    bytes += compact_cloud_.getMemoryUsage();
+    if (segmented_cloud_)
+    {
+        bytes += segmented_cloud_->cloud->points.capacity() * sizeof(pcl::PointXYZRGBNormal);
+        bytes += segmented_cloud_->labels.capacity() * sizeof(int);
+        for (size_t i = 0; i < segmented_cloud_->clusters.size(); i++)
+            bytes += segmented_cloud_->clusters[i].indices.capacity() * sizeof(int);
+    }
+    return bytes;
+}
+
+void AlignedCloud::compactCloud(float resolution)
+{
+    if (!cloud_)
+        return;
+    compact_cloud_.encode(*cloud_, world_to_cloud_corrected_.translation().cast<float>(), resolution);
+    nb_points_ = compact_cloud_.size();
+    cloud_.reset();
+    segmented_cloud_.reset();
+    overlap_tree_.reset();
+}
+
+bool AlignedCloud::decodeCloud(pcl::PointCloud<pcl::PointXYZ>& cloud_out)
+{
+    if (cloud_)
+        cloud_out = *cloud_;
+    else if (!compact_cloud_.empty())
+        compact_cloud_.decode(cloud_out);
+    else
+        return false;
+    return true;
+}
+
+void AlignedCloud::releaseCloud()
+{
+    if (cloud_)
+        nb_points_ = cloud_->size();
+    cloud_.reset();
+    compact_cloud_.clear();
+    segmented_cloud_.reset();
+    overlap_tree_.reset();
+}
+
 
 // Take the roll and pitch from the odom and use it to replace the roll and pitch estimated by ICP
 // this is to ensure gravity consistency
@@ -64,6 +127,7 @@ void AlignedCloud::updateCloud(pcl::PointCloud<pcl::PointXYZ>::Ptr& cloud,
                                int its_reference_id)
 {
     cloud_ = cloud;
+    points_key_ = newPointsKey();
     cloud_to_reference_ = correction;
     world_to_cloud_corrected_ = cloud_to_reference_ * world_to_cloud_prior_;
 
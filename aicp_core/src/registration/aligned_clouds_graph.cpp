@@ -1,20 +1,33 @@
 #include "aicp_registration/aligned_clouds_graph.hpp"
 
+#include <algorithm>
+#include <iostream>
+
+#include <pcl/common/transforms.h>
+
 namespace aicp {
 
 AlignedCloudsGraph::AlignedCloudsGraph()
 { 
     initialized_ = false;
     current_reference_ = -1;
+
+    max_bytes_ = 0;
+    window_ = 1;
+    compact_resolution_ = 0.0f;
+    next_compact_ = 0;
+    resident_bytes_ = 0;
 }
 
 AlignedCloudsGraph::~AlignedCloudsGraph()
 { 
+    if (spill_file_.is_open())
+        spill_file_.close();
 }
 
 void AlignedCloudsGraph::initialize(AlignedCloudPtr& reference)
 {
-    aligned_clouds.push_back(reference);
+    addCloud(reference);
     current_reference_ = aligned_clouds.size()-1;
 
     initialized_ = true;
@@ -24,6 +37,220 @@ bool AlignedCloudsGraph::addCloud(AlignedCloudPtr& cloud)
 {
     aligned_clouds.push_back(cloud);
 
+    int index = aligned_clouds.size()-1;
+    size_t bytes = cloud->getMemoryUsage();
+    resident_clouds_.push_back(index);
+    resident_sizes_[index] = bytes;
+    resident_bytes_ += bytes;
+    enforceBudget();
+
     return initialized_;
 }
+
+void AlignedCloudsGraph::updateReference(int index)
+{
+    AlignedCloudPtr cloud = aligned_clouds.at(index);
+    if (!cloud->isResident())
+    {
+        bool was_compact = cloud->isCompact();
+        pcl::PointCloud<pcl::PointXYZ>::Ptr points (new pcl::PointCloud<pcl::PointXYZ>);
+        if (loadCloudAt(index, *points))
+        {
+            // Points are up to date (pending update applied, spilled copy is not)
+            cloud->restoreCloud(points);
+            cloud->clearPendingUpdate();
+            spilled_clouds_.erase(index);
+            if (was_compact)
+                resident_bytes_ -= resident_sizes_[index];
+            else
+                resident_clouds_.insert(std::lower_bound(resident_clouds_.begin(), resident_clouds_.end(), index), index);
+            resident_sizes_[index] = cloud->getMemoryUsage();
+            resident_bytes_ += resident_sizes_[index];
+        }
+        else
+            std::cerr << "[AlignedCloudsGraph] Reference " << index << " is not available." << std::endl;
+    }
+
+    // Previous reference is compacted if out of window
+    int previous_reference = current_reference_;
+    cloud->setReference();
+    current_reference_ = index;
+    if (previous_reference >= 0 && previous_reference < next_compact_)
+        compactCloud(previous_reference);
+}
+
+void AlignedCloudsGraph::updatePose(int index, const Eigen::Isometry3d& pose)
+{
+    aligned_clouds.at(index)->setOptimizedPose(pose);
+    if (index == current_reference_ || index >= (int)aligned_clouds.size() - window_)
+        applyPendingUpdate(index);
+}
+
+void AlignedCloudsGraph::applyPendingUpdate(int index)
+{
+    AlignedCloudPtr cloud = aligned_clouds.at(index);
+    if (!cloud->hasPendingUpdate() || !cloud->isResident())
+        return;
+
+    // Moved copies (points may be in use by other threads)
+    Eigen::Matrix4f update = cloud->getPendingUpdate().matrix().cast<float>();
+    pcl::PointCloud<pcl::PointXYZ>::Ptr points (new pcl::PointCloud<pcl::PointXYZ>);
+    pcl::transformPointCloud(*cloud->getCloud(), *points, update);
+    SegmentedCloudPtr segmented = cloud->getSegmentedCloud();
+    if (segmented)
+    {
+        SegmentedCloudPtr moved (new SegmentedCloud);
+        pcl::transformPointCloudWithNormals(*segmented->cloud, *moved->cloud, update);
+        moved->clusters = segmented->clusters;
+        moved->labels = segmented->labels;
+        moved->points = points;
+        segmented = moved;
+    }
+    cloud->restoreCloud(points);
+    cloud->setSegmentedCloud(segmented);
+    cloud->moveOverlapTree(cloud->getPendingUpdate());
+    cloud->clearPendingUpdate();
+}
+
+bool AlignedCloudsGraph::setMemoryBudget(size_t max_bytes, int window, const std::string& spill_file,
+                                         float compact_resolution)
+{
+    max_bytes_ = max_bytes;
+    window_ = std::max(window, 1);
+    compact_resolution_ = compact_resolution;
+
+    if (spill_file_.is_open())
+        spill_file_.close();
+    spilled_clouds_.clear();
+    if (!spill_file.empty())
+    {
+        spill_file_.open(spill_file.c_str(), std::ios::in | std::ios::out | std::ios::trunc | std::ios::binary);
+        if (!spill_file_.is_open())
+        {
+            std::cerr << "[AlignedCloudsGraph] Error: cannot open spill file " << spill_file << std::endl;
+            return false;
+        }
+    }
+    enforceBudget();
+    return true;
+}
+
+void AlignedCloudsGraph::enforceBudget()
+{
+    int first_in_window = (int)aligned_clouds.size() - window_;
+    if (compact_resolution_ > 0.0f)
+    {
+        for (; next_compact_ < first_in_window; next_compact_++)
+        {
+            if (next_compact_ != current_reference_)
+                compactCloud(next_compact_);
+        }
+    }
+
+    if (max_bytes_ == 0)
+        return;
+
+    std::deque<int>::iterator it = resident_clouds_.begin();
+    while (resident_bytes_ > max_bytes_ && it != resident_clouds_.end() && *it < first_in_window)
+    {
+        if (*it == current_reference_)
+        {
+            ++it;
+            continue;
+        }
+        releaseCloud(*it);
+        it = resident_clouds_.erase(it);
+    }
+}
+
+void AlignedCloudsGraph::compactCloud(int index)
+{
+    AlignedCloudPtr cloud = aligned_clouds.at(index);
+    if (compact_resolution_ <= 0.0f || !cloud->isResident())
+        return;
+    cloud->compactCloud(compact_resolution_);
+    resident_bytes_ -= resident_sizes_[index];
+    resident_sizes_[index] = cloud->getMemoryUsage();
+    resident_bytes_ += resident_sizes_[index];
+}
+
+void AlignedCloudsGraph::releaseCloud(int index)
+{
+    AlignedCloudPtr cloud = aligned_clouds.at(index);
+    pcl::PointCloud<pcl::PointXYZ>::Ptr points = cloud->getCloud();
+    if (!points && cloud->isCompact())
+    {
+        points.reset(new pcl::PointCloud<pcl::PointXYZ>);
+        cloud->decodeCloud(*points);
+    }
+
+    if (spill_file_.is_open() && points && !spilled_clouds_.count(index))
+    {
+        SpillEntry entry;
+        spill_file_.seekp(0, std::ios::end);
+        entry.offset = spill_file_.tellp();
+        entry.nb_points = points->size();
+        for (size_t i = 0; i < points->size(); i++)
+            spill_file_.write(reinterpret_cast<const char*>(points->points[i].data), 3 * sizeof(float));
+        if (spill_file_.good())
+            spilled_clouds_[index] = entry;
+        else
+        {
+            std::cerr << "[AlignedCloudsGraph] Error: cannot write cloud " << index << " to spill file." << std::endl;
+            spill_file_.clear();
+        }
+    }
+
+    cloud->releaseCloud();
+    resident_bytes_ -= resident_sizes_[index];
+    resident_sizes_.erase(index);
+}
+
+MemoryUsage AlignedCloudsGraph::getMemoryUsage()
+{
+    size_t bytes = resident_bytes_ + aligned_clouds.capacity() * sizeof(AlignedCloudPtr) +
+                   aligned_clouds.size() * sizeof(AlignedCloud) +
+                   resident_sizes_.size() * (sizeof(std::pair<const int, size_t>) + 2 * sizeof(void*)) +
+                   spilled_clouds_.size() * (sizeof(std::pair<const int, SpillEntry>) + 2 * sizeof(void*));
+    return MemoryUsage(bytes, aligned_clouds.size());
+}
+
+bool AlignedCloudsGraph::loadCloudAt(int index, pcl::PointCloud<pcl::PointXYZ>& cloud_out)
+{
+    AlignedCloudPtr cloud = aligned_clouds.at(index);
+    if (cloud->isResident())
+        applyPendingUpdate(index);
+    if (cloud->decodeCloud(cloud_out))
+    {
+        if (cloud->hasPendingUpdate())
+            pcl::transformPointCloud(cloud_out, cloud_out, cloud->getPendingUpdate().matrix().cast<float>());
+        return true;
+    }
+
+    std::unordered_map<int, SpillEntry>::const_iterator entry = spilled_clouds_.find(index);
+    if (entry == spilled_clouds_.end())
+        return false;
+
+    cloud_out.points.resize(entry->second.nb_points);
+    spill_file_.seekg(entry->second.offset);
+    for (size_t i = 0; i < cloud_out.points.size(); i++)
+    {
+        pcl::PointXYZ& point = cloud_out.points[i];
+        spill_file_.read(reinterpret_cast<char*>(point.data), 3 * sizeof(float));
+        point.data[3] = 1.0f;
+    }
+    cloud_out.width = cloud_out.points.size();
+    cloud_out.height = 1;
+    cloud_out.is_dense = true;
+    if (!spill_file_.good())
+    {
+        std::cerr << "[AlignedCloudsGraph] Error: cannot read cloud " << index << " from spill file." << std::endl;
+        spill_file_.clear();
+        cloud_out.clear();
+        return false;
+    }
+    if (cloud->hasPendingUpdate())
+        pcl::transformPointCloud(cloud_out, cloud_out, cloud->getPendingUpdate().matrix().cast<float>());
+    return true;
+}
 }
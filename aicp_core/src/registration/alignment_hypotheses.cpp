@@ -0,0 +1,98 @@
+#include "aicp_registration/alignment_hypotheses.hpp"
+
+#include <cmath>
+#include <limits>
+
+namespace aicp {
+
+  // Less than 2 steps: no perturbation on this dimension
+  static std::vector<float> getSteps(int nb_steps, float range, bool wrap)
+  {
+    std::vector<float> steps;
+    if (nb_steps < 2)
+    {
+      steps.push_back(0.0);
+      return steps;
+    }
+    // Wrapping range (full turn): -range and range are the same
+    float increment = 2.0 * range / (wrap ? nb_steps : nb_steps - 1);
+    for (int i = 0; i < nb_steps; i++)
+      steps.push_back(-range + i * increment);
+    return steps;
+  }
+
+  void getInitializationHypotheses(const Eigen::Isometry3d& reading_pose,
+                                   const RegistrationParams::InitializationParams& params,
+                                   TransformsVector& hypotheses)
+  {
+    hypotheses.clear();
+    hypotheses.push_back(Eigen::Matrix4f::Identity());
+
+    std::vector<float> yaws = getSteps(params.yawSteps, params.yawRange * M_PI / 180.0,
+                                       params.yawRange >= 180.0);
+    std::vector<float> translations = getSteps(params.translationSteps, params.translationRange, false);
+
+    // Perturbation in reading frame: reading -> perturbed reading pose
+    Eigen::Affine3f pose = reading_pose.cast<float>();
+    for (size_t i = 0; i < yaws.size(); i++)
+      for (size_t j = 0; j < translations.size(); j++)
+        for (size_t k = 0; k < translations.size(); k++)
+        {
+          if (yaws[i] == 0.0 && translations[j] == 0.0 && translations[k] == 0.0)
+            continue; // identity
+          Eigen::Affine3f perturbation = Eigen::Translation3f(translations[j], translations[k], 0.0) *
+                                         Eigen::AngleAxisf(yaws[i], Eigen::Vector3f::UnitZ());
+          hypotheses.push_back((pose * perturbation * pose.inverse()).matrix());
+        }
+  }
+
+  void scoreAlignment(const pcl::search::Search<pcl::PointXYZ>& reference_search,
+                      const pcl::PointCloud<pcl::PointXYZ>& reading,
+                      float max_distance,
+                      AlignmentHypothesis& hypothesis)
+  {
+    // At most max_points points are scored
+    const size_t max_points = 5000;
+    size_t step = std::max((size_t)1, reading.size() / max_points);
+    const float max_sq_distance = max_distance * max_distance;
+
+    std::vector<int> index (1);
+    std::vector<float> sq_distance (1);
+    size_t nb_scored = 0, nb_inliers = 0;
+    double sum_distances = 0.0;
+    for (size_t i = 0; i < reading.size(); i += step)
+    {
+      pcl::PointXYZ point;
+      point.getVector3fMap() = hypothesis.transform.topLeftCorner<3,3>() * reading.points[i].getVector3fMap() +
+                               hypothesis.transform.topRightCorner<3,1>();
+      nb_scored ++;
+      if (reference_search.nearestKSearch(point, 1, index, sq_distance) > 0 &&
+          sq_distance[0] < max_sq_distance)
+      {
+        sum_distances += std::sqrt(sq_distance[0]);
+        nb_inliers ++;
+      }
+    }
+
+    hypothesis.inlier_ratio = (nb_scored > 0) ? (float)nb_inliers / nb_scored : 0.0;
+    hypothesis.residual = (nb_inliers > 0) ? sum_distances / nb_inliers : -1.0;
+  }
+
+  int selectBestHypothesis(const HypothesesVector& hypotheses)
+  {
+    int best = -1;
+    float best_score = std::numeric_limits<float>::max();
+    for (size_t i = 0; i < hypotheses.size(); i++)
+    {
+      if (hypotheses[i].residual < 0.0 || hypotheses[i].inlier_ratio <= 0.0)
+        continue;
+      float score = hypotheses[i].residual / hypotheses[i].inlier_ratio;
+      if (score < best_score)
+      {
+        best_score = score;
+        best = i;
+      }
+    }
+    return best;
+  }
+}
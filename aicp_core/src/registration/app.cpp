@@ -1,21 +1,109 @@
 #include "aicp_registration/app.hpp"
 #include "aicp_registration/registration.hpp"
 #include "aicp_overlap/overlap.hpp"
+#include "aicp_overlap/overlap_tree.hpp"
 #include "aicp_classification/classification.hpp"
 
 #include "aicp_utils/timing.hpp"
+#include "aicp_utils/traceRecorder.hpp"
+#include "aicp_utils/logging.hpp"
 #include "aicp_utils/common.hpp"
 #include "aicp_utils/poseFileReader.hpp"
+#include "aicp_utils/cloudLog.hpp"
+#include "aicp_utils/threadPool.hpp"
+
+#include <pcl/common/io.h>
+#include <pcl/filters/random_sample.h>
+
+#include <chrono>
+#include <deque>
+#include <functional>
+#include <future>
+#include <iomanip>
+#include <limits>
+#include <sstream>
 
 namespace aicp {
 
+// Pipelined processing: readings waiting between two stages
+static const size_t pipeline_queue_size = 2;
+// Loop closure detection: new references waiting (worker blocks if full)
+static const size_t loop_closure_queue_size = 100;
+// Pose graph: edges information (odometry is weak, registration scaled by overlap)
+static const double pose_graph_odometry_weight = 1.0;
+static const double pose_graph_registration_weight = 100.0;
+static const double pose_graph_loop_closure_weight = 100.0;
+static const int pose_graph_max_iterations = 10;
+// Deadline mode (cycle_deadline): settings of the compute levels
+// level 1: coarser reading pre-filter, 2: + ICP iterations cap,
+// 3: + reading randomly subsampled before filtering, overlap before alignability when parallel
+static const int max_compute_level = 3;
+static const float deadline_leaf_scale = 1.5f;
+static const int deadline_max_iterations = 10;
+static const float deadline_sample_ratio = 0.5f;
+// Level lowered after this many readings below half the deadline
+static const int deadline_calm_cycles = 10;
+// Motion model ("odometry"): previous correction not scaled below this motion (meters)
+static const double motion_model_min_motion = 0.05;
+
+// Input queue memory: cloud data (compact or full points) and object
+static size_t getQueuedCloudMemoryUsage(const AlignedCloudPtr& cloud)
+{
+    return sizeof(AlignedCloud) + cloud->getMemoryUsage();
+}
+
+static std::string formatMemoryUsage(const MemoryUsage& usage, const char* objects)
+{
+    std::ostringstream text;
+    text << std::fixed << std::setprecision(1) << usage.bytes / (1024.0 * 1024.0) << " MB ("
+         << usage.objects << " " << objects << ")";
+    return text.str();
+}
+
+static std::string formatMemoryReport(const App::MemoryReport& report)
+{
+    std::ostringstream text;
+    text << "graph " << formatMemoryUsage(report.graph, "clouds")
+         << ", output map " << formatMemoryUsage(report.aligned_map, "points")
+         << ", prior map " << formatMemoryUsage(report.prior_map, "points")
+         << ", octrees " << formatMemoryUsage(report.octrees, "trees")
+         << ", paths " << formatMemoryUsage(report.paths, "poses")
+         << ", input queue " << formatMemoryUsage(report.queue, "clouds")
+         << ", total " << std::fixed << std::setprecision(1)
+         << report.getTotalBytes() / (1024.0 * 1024.0) << " MB";
+    return text.str();
+}
+
 App::App(const CommandLineConfig& cl_cfg,
          RegistrationParams reg_params,
          OverlapParams overlap_params,
-         ClassificationParams class_params) :
+         ClassificationParams class_params,
+         std::shared_ptr<AbstractClassification> classifier) :
     cl_cfg_(cl_cfg), reg_params_(reg_params),
-    overlap_params_(overlap_params), class_params_(class_params)
+    overlap_params_(overlap_params), class_params_(class_params),
+    // Maps tiled for sub-map extraction around the robot
+    prior_voxel_map_(reg_params.prefilter.leafSize, cl_cfg.crop_map_around_base),
+    aligned_map_(reg_params.prefilter.leafSize, cl_cfg.crop_map_around_base),
+    static_map_occupancy_(overlap_params.octree_based.octomapResolution),
+    cloud_queue_(std::max(cl_cfg.max_queue_size, 1), QueuePolicy::DROP_OLDEST),
+    loop_closure_queue_(loop_closure_queue_size),
+    debug_writer_(std::max(cl_cfg.debug_queue_size, 1), cl_cfg.debug_binary)
 {
+    // Process-wide logging
+    LogLevel log_level;
+    if (Logger::parseLevel(cl_cfg_.log_level, log_level))
+        Logger::setLevel(log_level);
+    else
+        cerr << "[Main] Unknown log level \"" << cl_cfg_.log_level << "\", using info." << endl;
+    if (cl_cfg_.log_async)
+        Logger::startAsync();
+    // Process-wide span tracing (first trace file kept by server streams)
+    if (!cl_cfg_.trace_file.empty())
+        TraceRecorder::start(cl_cfg_.trace_file, cl_cfg_.trace_dump_period);
+    // Time spent by the clouds in the queue (trace only)
+    cloud_queue_.setTraceName("cloudQueue");
+    cloud_queue_.setMemoryUsageFunction(&getQueuedCloudMemoryUsage);
+
     // Create debug data folder
     data_directory_path_ << "/tmp/aicp_data";
     const char* path = data_directory_path_.str().c_str();
@@ -31,72 +119,200 @@ App::App(const CommandLineConfig& cl_cfg,
     // Instantiate objects
     registr_ = create_registrator(reg_params_);
     overlapper_ = create_overlapper(overlap_params_);
-    classifier_ = create_classifier(class_params_);
-}
+    // Overlap used to auto-tune the ICP chain (clamped to 25-70 % in computeRegistration)
+    // and as a feature of the alignment risk classifier (exact value always needed)
+    std::vector<std::pair<float, float> > overlap_intervals;
+    if (!cl_cfg_.failure_prediction_mode)
+        overlap_intervals.push_back(std::make_pair(25.0f, 70.0f));
+    overlapper_->setRefinementIntervals(overlap_intervals);
+    classifier_ = classifier ? classifier : create_classifier(class_params_);
+
+    QueuePolicy queue_policy;
+    if (parseQueuePolicy(cl_cfg_.queue_policy, queue_policy))
+        cloud_queue_.setPolicy(queue_policy);
+    else
+        cerr << "[Main] Unknown queue policy \"" << cl_cfg_.queue_policy << "\", using drop_oldest." << endl;
 
-void App::setReference(AlignedCloudPtr& reading_cloud,
-                       pcl::PointCloud<pcl::PointXYZ>::Ptr& reference_cloud,
-                       Eigen::Isometry3d& reference_pose)
-{
-    // Crop map
-    pcl::PointCloud<pcl::PointXYZ>::Ptr cropped_map (new pcl::PointCloud<pcl::PointXYZ>);
-    if (cl_cfg_.load_map_from_file || cl_cfg_.localize_against_prior_map)
+    // Readings are initialized with the previous correction when not in "robot" mode
+    // (filter stage would depend on the registration stage)
+    if (cl_cfg_.pipelined_processing && cl_cfg_.working_mode != "robot")
     {
-        // crop map around current reading pose
-        *cropped_map = *(prior_map_->getCloud());
-        Eigen::Matrix4f tmp = (reading_cloud->getPriorPose()).matrix().cast<float>();
-        getPointsInOrientedBox(cropped_map,
-                               -cl_cfg_.crop_map_around_base,
-                               cl_cfg_.crop_map_around_base, tmp);
+        cerr << "[Main] Pipelined processing requires \"robot\" working mode, disabled." << endl;
+        cl_cfg_.pipelined_processing = false;
     }
+    // Prior map is the global reference (no drift to redistribute)
+    if (cl_cfg_.pose_graph_optimization &&
+        (!cl_cfg_.loop_closure_detection || cl_cfg_.localize_against_prior_map))
+    {
+        cerr << "[Main] Pose graph optimization requires loop closure detection "
+             << "(not against prior map), disabled." << endl;
+        cl_cfg_.pose_graph_optimization = false;
+    }
+    if (reg_params_.motionModel.mode != "none" && reg_params_.motionModel.mode != "constant_velocity" &&
+        reg_params_.motionModel.mode != "odometry")
+    {
+        cerr << "[Main] Unknown motion model \"" << reg_params_.motionModel.mode << "\", disabled." << endl;
+        reg_params_.motionModel.mode = "none";
+    }
+}
 
+void App::setReference(ReadingData& data)
+{
     // Set reference cloud
-    if (!first_cloud_initialized_ || cl_cfg_.localize_against_prior_map)
+    AlignedCloudPtr& reading_cloud = data.cloud;
+    data.ref_segmented.reset();
+    data.ref_tree.reset();
+    data.ref_id = -1;
+    data.reg_ref_id = -1; // cropped built map changes at every reading
+    if (isStaticPriorMap())
+    {
+        // Registration against the whole map: reference (and its KD-tree) and occupancy
+        // built again only when the map changes (new tiles)
+        if (loadPriorMapTiles(reading_cloud->getPriorPose()) || !static_map_)
+            updateStaticMap();
+        data.reg_reference = static_map_;
+        data.reg_reference_normals = static_map_normals_;
+        data.reg_ref_id = static_map_id_;
+        // Crop needed by the FOV overlap and alignability only
+        data.ref_prefiltered = cl_cfg_.failure_prediction_mode ?
+                               cropPriorMap(reading_cloud->getPriorPose()) : static_map_;
+        data.ref_pose = reading_cloud->getPriorPose();
+        first_cloud_initialized_ = true;
+    }
+    else if (!first_cloud_initialized_ || cl_cfg_.localize_against_prior_map)
     {
-        reference_cloud = cropped_map;
-        reference_pose = reading_cloud->getPriorPose();
+        // Crop prior map around current reading pose
+        if (loadPriorMapTiles(reading_cloud->getPriorPose()))
+            map_crop_.reset();
+        data.ref_prefiltered = cropPriorMap(reading_cloud->getPriorPose());
+        data.ref_pose = reading_cloud->getPriorPose();
+        data.reg_ref_id = -1 - map_crop_counter_;
         first_cloud_initialized_ = true;
     }
     else if (cl_cfg_.localize_against_built_map)
     {
-        copyPointCloud(aligned_map_, *cropped_map);
+        pcl::PointCloud<pcl::PointXYZ>::Ptr cropped_map (new pcl::PointCloud<pcl::PointXYZ>);
         Eigen::Matrix4f tmp = (reading_cloud->getPriorPose()).matrix().cast<float>();
-        getPointsInOrientedBox(cropped_map,
-                               -cl_cfg_.crop_map_around_base,
-                               cl_cfg_.crop_map_around_base, tmp);
-        reference_cloud = cropped_map;
-        reference_pose = reading_cloud->getPriorPose();
+        aligned_map_.getPointsInOrientedBox(-cl_cfg_.crop_map_around_base,
+                                            cl_cfg_.crop_map_around_base, tmp, *cropped_map);
+        data.ref_prefiltered = cropped_map;
+        data.ref_pose = reading_cloud->getPriorPose();
     }
     else
     {
-        reference_cloud = aligned_clouds_graph_->getCurrentReference()->getCloud();
-        reference_pose = aligned_clouds_graph_->getCurrentReference()->getCorrectedPose();
+        // Graph extended by the registration stage when pipelined
+        std::unique_lock<std::mutex> lock(graph_mutex_);
+        AlignedCloudPtr reference = aligned_clouds_graph_->getCurrentReference();
+        data.ref_prefiltered = reference->getCloud();
+        data.ref_pose = reference->getCorrectedPose();
+        data.ref_segmented = reference->getSegmentedCloud();
+        data.ref_id = aligned_clouds_graph_->getCurrentReferenceId();
+        // Points moved in place by pose graph updates: cached data rebuilt
+        data.reg_ref_id = reference->getPointsKey();
+        // Overlap tree of the reference from when it was a reading, moved onto its points
+        // (correction, pose graph updates) once, dropped if it must be built again. The part of
+        // the moves not applied (sub-voxel) is kept: small moves add up until the tree is rebuilt
+        data.ref_tree = reference->getOverlapTree();
+        if (data.ref_tree && reference->isOverlapTreeMoved())
+        {
+            Eigen::Isometry3d remainder;
+            data.ref_tree = overlapper_->transformTree(data.ref_tree, reference->getOverlapTreeTransform(), remainder);
+            reference->setOverlapTree(data.ref_tree, remainder);
+            // Tree handed over before the move not reused
+            if (!data.ref_tree)
+                overlapper_->resetReferenceTree();
+        }
     }
 }
 
-void App::setAndFilterReading(AlignedCloudPtr& reading_cloud_in,
-                              pcl::PointCloud<pcl::PointXYZ>::Ptr& reading_cloud_out,
-                              Eigen::Isometry3d& reading_pose)
+pcl::PointCloud<pcl::PointXYZ>::Ptr& App::cropPriorMap(const Eigen::Isometry3d& pose)
 {
-    reading_pose = reading_cloud_in->getPriorPose();
+    // Kept while the reading stays close to the crop pose: registration reuses its reference
+    Eigen::Isometry3d motion = map_crop_pose_.inverse() * pose;
+    if (!map_crop_ ||
+        motion.translation().norm() > 0.25 * cl_cfg_.crop_map_around_base ||
+        Eigen::AngleAxisd(motion.rotation()).angle() > 0.25)
+    {
+        // (prior map points are the prior_voxel_map_ points, see setPriorMap)
+        map_crop_.reset(new pcl::PointCloud<pcl::PointXYZ>);
+        Eigen::Matrix4f tmp = pose.matrix().cast<float>();
+        const VoxelMap& prior_voxel_map = shared_prior_map_ ? *shared_prior_map_ : prior_voxel_map_;
+        prior_voxel_map.getPointsInOrientedBox(-cl_cfg_.crop_map_around_base,
+                                               cl_cfg_.crop_map_around_base, tmp, *map_crop_);
+        map_crop_pose_ = pose;
+        map_crop_counter_ ++;
+    }
+    return map_crop_;
+}
+
+void App::updateStaticMap()
+{
+    if (shared_prior_map_)
+    {
+        // Immutable (see setSharedPriorMap)
+        static_map_ = shared_prior_map_->getCloud();
+    }
+    else
+    {
+        // Copy: the registration stage may still use the previous one (pipelined)
+        std::unique_lock<std::mutex> lock(prior_map_mutex_);
+        static_map_.reset(new pcl::PointCloud<pcl::PointXYZ>(*prior_voxel_map_.getCloud()));
+    }
+    static_map_occupancy_.clear();
+    static_map_occupancy_.insert(*static_map_);
+    // Normals estimated once here: the ICP reference filters would estimate them
+    // over the whole map at every new reference otherwise
+    static_map_normals_.reset(new pcl::PointCloud<pcl::PointXYZRGBNormal>);
+    estimateNormalsFilter(static_map_, *static_map_normals_);
+    static_map_memory_.set(MemoryUsage(static_map_occupancy_.getMemoryUsage().bytes +
+                                       static_map_normals_->points.capacity() * sizeof(pcl::PointXYZRGBNormal) +
+                                       (shared_prior_map_ ? 0 : static_map_->points.capacity() * sizeof(pcl::PointXYZ)), 0));
+    map_crop_.reset();
+    map_crop_counter_ ++;
+    static_map_id_ = -1 - map_crop_counter_;
+    AICP_LOG_INFO("Main", "Static prior map: " << static_map_->size() << " points ("
+                  << static_map_normals_->size() << " with normals), "
+                  << static_map_occupancy_.size() << " occupied voxels.");
+}
+
+void App::setAndFilterReading(ReadingData& data)
+{
+    AlignedCloudPtr& reading_cloud_in = data.cloud;
+    data.read_pose = reading_cloud_in->getPriorPose();
 
     // Initialize cloud before sending to filters
     // (simulates correction integration only if "debug" mode
     // and integrates interactive marker pose)
-    pcl::PointCloud<pcl::PointXYZ>::Ptr reading_tmp (new pcl::PointCloud<pcl::PointXYZ>);
+    pcl::PointCloud<pcl::PointXYZ>::Ptr reading_tmp = reading_buffer_;
     if (cl_cfg_.working_mode == "robot")
         *reading_tmp = *(reading_cloud_in->getCloud());
     else
     {
         pcl::transformPointCloud (*(reading_cloud_in->getCloud()), *reading_tmp, initialT_);
         Eigen::Isometry3d initialT_iso = fromMatrix4fToIsometry3d(initialT_);
-        reading_pose = initialT_iso * reading_pose;
+        data.read_pose = initialT_iso * data.read_pose;
         // Update AlignedCloud pose
-        reading_cloud_in->setPriorPose(reading_pose);
+        reading_cloud_in->setPriorPose(data.read_pose);
+    }
+
+    // Deadline mode: cheaper pre-filter
+    float leaf_size = reg_params_.prefilter.leafSize;
+    if (data.compute_level >= 1)
+        leaf_size *= deadline_leaf_scale;
+    if (data.compute_level >= 3 && !reading_tmp->empty())
+    {
+        pcl::RandomSample<pcl::PointXYZ> random_sample;
+        random_sample.setInputCloud(reading_tmp);
+        random_sample.setSample((unsigned int)(deadline_sample_ratio * reading_tmp->size()));
+        random_sample.setSeed((unsigned int)data.cloud->getUtime());
+        random_sample.filter(*sampled_buffer_);
+        reading_tmp = sampled_buffer_;
     }
 
     // Pre-filter reading cloud
-    filterCloud(reading_tmp, reading_cloud_out);
+    data.read_prefiltered.reset(new pcl::PointCloud<pcl::PointXYZ>);
+    filterCloud(reading_tmp, data.read_prefiltered, data.read_pose, data.read_segmented, leaf_size);
+    reading_cloud_in->setSegmentedCloud(data.read_segmented);
 }
 
 void App::filterCloud(pcl::PointCloud<pcl::PointXYZ>::Ptr& cloud_in,
@@ -106,69 +322,139 @@ void App::filterCloud(pcl::PointCloud<pcl::PointXYZ>::Ptr& cloud_in,
     // Pre-filtering: 1) down-sampling
     //                2) planes extraction
     // ------------------------------------
-    regionGrowingUniformPlaneSegmentationFilter(cloud_in, cloud_out);
+    if (reg_params_.prefilter.mode == "parallel")
+    {
+        SegmentedCloud segmented;
+        parallelRegionGrowingUniformPlaneSegmentationFilter(cloud_in, cloud_out, Eigen::Isometry3d::Identity(),
+                                                            segmented, reg_params_.prefilter.numThreads,
+                                                            reg_params_.prefilter.leafSize);
+    }
+    else if (reg_params_.prefilter.mode == "cuda")
+    {
+        SegmentedCloud segmented;
+        cudaRegionGrowingUniformPlaneSegmentationFilter(cloud_in, cloud_out, Eigen::Isometry3d::Identity(),
+                                                        segmented, reg_params_.prefilter.leafSize);
+    }
+    else
+        regionGrowingUniformPlaneSegmentationFilter(cloud_in, cloud_out, reg_params_.prefilter.leafSize);
+}
+
+void App::filterCloud(pcl::PointCloud<pcl::PointXYZ>::Ptr& cloud_in,
+                      pcl::PointCloud<pcl::PointXYZ>::Ptr& cloud_out,
+                      const Eigen::Isometry3d& view_point,
+                      SegmentedCloudPtr& segmented_out,
+                      float leaf_size)
+{
+    if (leaf_size <= 0.0f)
+        leaf_size = reg_params_.prefilter.leafSize;
+    segmented_out.reset(new SegmentedCloud);
+    if (reg_params_.prefilter.mode == "parallel")
+        parallelRegionGrowingUniformPlaneSegmentationFilter(cloud_in, cloud_out, view_point, *segmented_out,
+                                                            reg_params_.prefilter.numThreads,
+                                                            leaf_size);
+    else if (reg_params_.prefilter.mode == "cuda")
+        cudaRegionGrowingUniformPlaneSegmentationFilter(cloud_in, cloud_out, view_point, *segmented_out,
+                                                        leaf_size);
+    else
+        regionGrowingUniformPlaneSegmentationFilter(cloud_in, cloud_out, view_point, *segmented_out,
+                                                    leaf_size);
+    segmented_out->points = cloud_out;
 }
 
-void App::computeOverlap(pcl::PointCloud<pcl::PointXYZ>::Ptr& reference_cloud,
-                         pcl::PointCloud<pcl::PointXYZ>::Ptr& reading_cloud,
-                         Eigen::Isometry3d& reference_pose,
-                         Eigen::Isometry3d& reading_pose)
+void App::computeOverlap(ReadingData& data)
 {
     // ---------------------
     // Octree-based Overlap
     // ---------------------
-    ColorOcTree* ref_tree;
-    ColorOcTree* read_tree = new ColorOcTree(overlap_params_.octree_based.octomapResolution);
-
-    if(//(cl_cfg_.load_map_from_file && aligned_clouds_graph_->getNbClouds() == 0) ||
+    if (isStaticPriorMap() && static_map_)
+    {
+        // Reading voxels occupied by the map (precomputed occupancy, no octrees)
+        data.octree_overlap = static_map_occupancy_.getOverlap(*data.read_prefiltered);
+    }
+    else if(//(cl_cfg_.load_map_from_file && aligned_clouds_graph_->getNbClouds() == 0) ||
         cl_cfg_.localize_against_prior_map)
     {
-        octree_overlap_ = 50.0;
+        data.octree_overlap = 50.0;
     }
     else
     {
-        // 1) create octree from reference cloud (wrt robot's point of view)
+        // 1) create octree from reference cloud (wrt robot's point of view),
+        //    unless kept from its reading
         // 2) add the reading cloud and compute overlap
-        ref_tree = overlapper_->computeOverlap(*reference_cloud, *reading_cloud,
-                                               reference_pose, reading_pose,
-                                               read_tree);
-        octree_overlap_ = overlapper_->getOverlap();
-    }
-
-    cout << "====================================" << endl
-         << "[Main] Octree-based Overlap: " << octree_overlap_ << " %" << endl
-         << "====================================" << endl;
-}
-
-void App::computeAlignmentRisk(pcl::PointCloud<pcl::PointXYZ>::Ptr& reference_cloud,
-                               pcl::PointCloud<pcl::PointXYZ>::Ptr& reading_cloud,
-                               Eigen::Isometry3d& reference_pose,
-                               Eigen::Isometry3d& reading_pose)
-{
-    pcl::PointCloud<pcl::PointXYZ> overlap_reference;
-    pcl::PointCloud<pcl::PointXYZ> overlap_reading;
-    // ------------------
-    // FOV-based Overlap
-    // ------------------
-    fov_overlap_ = overlapFilter(*reference_cloud, *reading_cloud,
-                                 reference_pose, reading_pose,
-                                 reg_params_.sensorRange , reg_params_.sensorAngularView,
-                                 overlap_reference, overlap_reading);
-
-    pcl::PointCloud<pcl::PointXYZRGBNormal>::Ptr matched_planes_reference (new pcl::PointCloud<pcl::PointXYZRGBNormal>);
-    pcl::PointCloud<pcl::PointXYZRGBNormal>::Ptr matched_planes_reading (new pcl::PointCloud<pcl::PointXYZRGBNormal>);
-    pcl::PointCloud<pcl::PointXYZRGBNormal>::Ptr eigenvectors (new pcl::PointCloud<pcl::PointXYZRGBNormal>);
-    // -------------
-    // Alignability
-    // -------------
-    // Alignability computed on points belonging to the region of overlap (overlap_points_A, overlap_points_B)
-    alignability_ = alignabilityFilter(overlap_reference, overlap_reading,
-                                       reference_pose, reading_pose,
-                                       matched_planes_reference, matched_planes_reading, eigenvectors);
-    cout << "====================================" << endl
-         << "[Main] Alignability: " << alignability_ << " % (degenerate if ~ 0)" << endl
-         << "====================================" << endl;
+        // (reading tree kept on the reading: reference tree if the reading is promoted)
+        if (data.ref_tree)
+            overlapper_->setReferenceTree(data.ref_tree, data.reg_ref_id);
+        std::shared_ptr<ColorOcTree> read_tree (new OverlapTree(overlap_params_.octree_based.octomapResolution));
+        overlapper_->computeOverlap(*data.ref_prefiltered, *data.read_prefiltered,
+                                    data.ref_pose, data.read_pose,
+                                    read_tree.get(), data.reg_ref_id);
+        data.octree_overlap = overlapper_->getOverlap();
+        if (data.ref_id >= 0)
+            data.cloud->setOverlapTree(read_tree);
+    }
+
+    AICP_LOG_DEBUG("Main", "Octree-based Overlap: " << data.octree_overlap << " %");
+}
 
+void App::computeAlignability(ReadingData& data)
+{
+    pcl::PointCloud<pcl::PointXYZ>::Ptr& reference_cloud = data.ref_prefiltered;
+    pcl::PointCloud<pcl::PointXYZ>::Ptr& reading_cloud = data.read_prefiltered;
+
+    // Alignability visualization outputs: not used (NULL, not computed)
+    pcl::PointCloud<pcl::PointXYZRGBNormal>::Ptr matched_planes_reference;
+    pcl::PointCloud<pcl::PointXYZRGBNormal>::Ptr matched_planes_reading;
+    pcl::PointCloud<pcl::PointXYZRGBNormal>::Ptr eigenvectors;
+
+    // Reuse planes segmentation from pre-filter if available for both clouds
+    // (segmented clouds built from these pre-filtered clouds)
+    if (data.ref_segmented && data.read_segmented &&
+        data.ref_segmented->isBuiltFrom(reference_cloud) &&
+        data.read_segmented->isBuiltFrom(reading_cloud))
+    {
+        std::vector<int>& overlap_reference = overlap_indices_ref_;
+        std::vector<int>& overlap_reading = overlap_indices_read_;
+        // ------------------
+        // FOV-based Overlap
+        // ------------------
+        data.fov_overlap = overlapFilter(*reference_cloud, *reading_cloud,
+                                         data.ref_pose, data.read_pose,
+                                         reg_params_.sensorRange , reg_params_.sensorAngularView,
+                                         overlap_reference, overlap_reading);
+        // -------------
+        // Alignability
+        // -------------
+        // Alignability computed on planes belonging to the region of overlap
+        data.alignability = alignabilityFilter(*data.ref_segmented, *data.read_segmented,
+                                               overlap_reference, overlap_reading,
+                                               matched_planes_reference, matched_planes_reading, eigenvectors);
+    }
+    else
+    {
+        pcl::PointCloud<pcl::PointXYZ>& overlap_reference = overlap_points_ref_;
+        pcl::PointCloud<pcl::PointXYZ>& overlap_reading = overlap_points_read_;
+        overlap_reference.clear(); // overlapFilter appends the points
+        overlap_reading.clear();
+        // ------------------
+        // FOV-based Overlap
+        // ------------------
+        data.fov_overlap = overlapFilter(*reference_cloud, *reading_cloud,
+                                         data.ref_pose, data.read_pose,
+                                         reg_params_.sensorRange , reg_params_.sensorAngularView,
+                                         overlap_reference, overlap_reading);
+        // -------------
+        // Alignability
+        // -------------
+        // Alignability computed on points belonging to the region of overlap (overlap_points_A, overlap_points_B)
+        data.alignability = alignabilityFilter(overlap_reference, overlap_reading,
+                                               data.ref_pose, data.read_pose,
+                                               matched_planes_reference, matched_planes_reading, eigenvectors);
+    }
+    AICP_LOG_DEBUG("Main", "Alignability: " << data.alignability << " % (degenerate if ~ 0)");
+}
+
+void App::computeAlignmentRisk(ReadingData& data)
+{
     /*===================================
     =           Classification          =
     ===================================*/
@@ -176,43 +462,383 @@ void App::computeAlignmentRisk(pcl::PointCloud<pcl::PointXYZ>::Ptr& reference_cl
     // Alignment Risk
     // ---------------
     Eigen::MatrixXd testing_data(1, 2);
-    testing_data << (float)octree_overlap_, (float)alignability_;
+    testing_data << (float)data.octree_overlap, (float)data.alignability;
+
+    classifier_->test(testing_data, &data.risk_prediction);
+    AICP_LOG_DEBUG("Main", "Alignment Risk: " << data.risk_prediction << " (0-1)");
+}
+
+bool App::decideAlignmentRiskFromOverlap(ReadingData& data)
+{
+    // Risk over the whole alignability range (0-100 %): the decision is known
+    // if the range is on one side of the threshold (reported risk: closest bound)
+    double min_risk, max_risk;
+    if (!classifier_->getRiskBounds(data.octree_overlap, min_risk, max_risk))
+        return false;
+
+    const double threshold = class_params_.svm.threshold;
+    if (max_risk <= threshold)
+        data.risk_prediction(0,0) = max_risk;
+    else if (min_risk > threshold)
+        data.risk_prediction(0,0) = min_risk;
+    else
+        return false;
+    AICP_LOG_DEBUG("Main", "Alignment Risk: " << data.risk_prediction << " (0-1, from overlap only)");
+    return true;
+}
+
+void App::computeOverlapAndAlignmentRisk(ReadingData& data)
+{
+    if (!cl_cfg_.failure_prediction_mode)
+    {
+        ScopedTimer compute_overlap_timer ("computeOverlap");
+        computeOverlap(data);
+        compute_overlap_timer.stop();
+        return;
+    }
+
+    // Alignability only if it can change the decision (octree overlap known first:
+    // not when parallel, unless in deadline mode)
+    if (!cl_cfg_.parallel_alignment_risk || data.compute_level >= 3)
+    {
+        ScopedTimer compute_overlap_timer ("computeOverlap");
+        computeOverlap(data);
+        compute_overlap_timer.stop();
+        if (decideAlignmentRiskFromOverlap(data))
+            return;
+        ScopedTimer compute_alignability_timer ("computeAlignability");
+        computeAlignability(data);
+        compute_alignability_timer.stop();
+    }
+    else
+    {
+        // Octree-based overlap and FOV-based overlap / alignability are independent
+        // (both needed by the classifier): octree branch runs in a separate thread.
+        // Wall time per branch (the branches overlap, reported here rather than by ScopedTimer)
+        typedef std::chrono::steady_clock Clock;
+        std::future<double> octree_branch = std::async(std::launch::async, [&]()
+        {
+            Clock::time_point start = Clock::now();
+            computeOverlap(data);
+            return std::chrono::duration<double>(Clock::now() - start).count();
+        });
+        Clock::time_point start = Clock::now();
+        computeAlignability(data);
+        double alignability_time = std::chrono::duration<double>(Clock::now() - start).count();
+        double octree_time = octree_branch.get();
+        AICP_LOG_DEBUG("Main", "Parallel alignment risk features: octree overlap " << octree_time
+                       << " sec, FOV overlap and alignability " << alignability_time
+                       << " sec, total " << std::chrono::duration<double>(Clock::now() - start).count() << " sec");
+    }
 
-    classifier_->test(testing_data, &risk_prediction_);
-    cout << "====================================" << endl
-         << "[Main] Alignment Risk: " << risk_prediction_ << " (0-1)" << endl
-         << "====================================" << endl;
+    computeAlignmentRisk(data);
 }
 
-void App::computeRegistration(pcl::PointCloud<pcl::PointXYZ>& reference,
-                              pcl::PointCloud<pcl::PointXYZ>& reading,
-                              Eigen::Matrix4f &T)
+void App::setPriorMap(pcl::PointCloud<pcl::PointXYZ>::Ptr& map_cloud,
+                      int64_t utime)
 {
+    tiled_prior_map_.close();
+    loaded_map_tiles_.clear();
+    shared_prior_map_.reset();
+    prior_voxel_map_.setCloud(*map_cloud);
+    pcl::PointCloud<pcl::PointXYZ>::Ptr voxel_map_cloud = prior_voxel_map_.getCloud();
+    if (map_initialized_)
+        delete prior_map_;
+    map_crop_.reset();
+    static_map_.reset();
+    static_map_normals_.reset();
+    prior_map_ = new AlignedCloud(utime,
+                                  voxel_map_cloud,
+                                  Eigen::Isometry3d::Identity());
+    map_initialized_ = true;
+}
+
+bool App::setPriorMap(const std::string& tiled_map_file,
+                      int64_t utime)
+{
+    // Tiles loaded around the robot by loadPriorMapTiles
+    if (!tiled_prior_map_.open(tiled_map_file))
+        return false;
+    loaded_map_tiles_.clear();
+    shared_prior_map_.reset();
+    prior_voxel_map_.clear();
+    pcl::PointCloud<pcl::PointXYZ>::Ptr voxel_map_cloud = prior_voxel_map_.getCloud();
+    if (map_initialized_)
+        delete prior_map_;
+    map_crop_.reset();
+    static_map_.reset();
+    static_map_normals_.reset();
+    prior_map_ = new AlignedCloud(utime,
+                                  voxel_map_cloud,
+                                  Eigen::Isometry3d::Identity());
+    map_initialized_ = true;
+    return true;
+}
+
+void App::setSharedPriorMap(const std::shared_ptr<VoxelMap>& map, int64_t utime)
+{
+    tiled_prior_map_.close();
+    loaded_map_tiles_.clear();
+    prior_voxel_map_.clear();
+    shared_prior_map_ = map;
+    pcl::PointCloud<pcl::PointXYZ>::Ptr voxel_map_cloud = shared_prior_map_->getCloud();
+    if (map_initialized_)
+        delete prior_map_;
+    map_crop_.reset();
+    static_map_.reset();
+    static_map_normals_.reset();
+    prior_map_ = new AlignedCloud(utime,
+                                  voxel_map_cloud,
+                                  Eigen::Isometry3d::Identity());
+    map_initialized_ = true;
+}
+
+bool App::loadPriorMapTiles(const Eigen::Isometry3d& pose)
+{
+    if (!tiled_prior_map_.isOpen())
+        return false;
+
+    // Tiles overlapping the crop box whatever its orientation
+    Eigen::Vector3f center = pose.translation().cast<float>();
+    Eigen::Vector3f extent = Eigen::Vector3f::Constant(std::sqrt(3.0f) * cl_cfg_.crop_map_around_base);
+    std::vector<VoxelKey> keys;
+    tiled_prior_map_.getTileKeys(center - extent, center + extent, keys);
+
+    pcl::PointCloud<pcl::PointXYZ> tiles_cloud;
+    for (size_t i = 0; i < keys.size(); i++)
+    {
+        if (loaded_map_tiles_.insert(keys[i]).second)
+            tiled_prior_map_.readTile(keys[i], tiles_cloud);
+    }
+    if (tiles_cloud.empty())
+        return false;
+
+    std::unique_lock<std::mutex> lock(prior_map_mutex_);
+    prior_voxel_map_.insert(tiles_cloud);
+    AICP_LOG_INFO("Main", "Prior map: " << tiles_cloud.size() << " points loaded ("
+                  << loaded_map_tiles_.size() << " of " << tiled_prior_map_.getNbTiles() << " tiles).");
+    return true;
+}
+
+void App::addToAlignedMap(pcl::PointCloud<pcl::PointXYZ>::Ptr& cloud,
+                          const Eigen::Isometry3d& pose,
+                          int64_t utime)
+{
+    if (aligned_map_dirty_)
+        rebuildAlignedMap();
+
+    pcl::PointCloud<pcl::PointXYZ>::Ptr aligned_map_ptr;
+    pcl::PointCloud<pcl::PointXYZ>::Ptr new_points (new pcl::PointCloud<pcl::PointXYZ>);
+    {
+        std::unique_lock<std::mutex> lock(aligned_map_mutex_);
+        // Points in occupied voxels are discarded (map appended in place)
+        size_t first_new = aligned_map_.size();
+        aligned_map_.insert(*cloud);
+        new_points->points.assign(aligned_map_.getCloud()->points.begin() + first_new,
+                                  aligned_map_.getCloud()->points.end());
+        new_points->width = new_points->points.size();
+        new_points->height = 1;
+        // Memory cap: drop points far from the robot, down to 90 % of the cap
+        // (amortizes the O(map size) removal over the next insertions)
+        if (cl_cfg_.max_map_points > 0 && aligned_map_.size() > (size_t)cl_cfg_.max_map_points)
+        {
+            size_t removed = aligned_map_.removeFarthest(pose.translation().cast<float>(),
+                                                         (size_t)(0.9 * cl_cfg_.max_map_points));
+            AICP_LOG_INFO("Main", "Built map limited to " << cl_cfg_.max_map_points << " points: "
+                          << removed << " points removed.");
+        }
+        aligned_map_ptr = aligned_map_.getCloud();
+    }
+    // VISUALIZE built map (no copy: published synchronously). The full map may be
+    // rate-limited by the visualizer, the new points are always sent.
+    vis_->publishMapUpdate(new_points, utime, 1);
+    vis_->publishMap(aligned_map_ptr, utime, 1);
+}
+
+void App::rebuildAlignedMap()
+{
+    // Deferred to the next map update: all references re-inserted at their optimized
+    // pose (points of references moved by the pose graph are transformed when loaded)
+    std::unique_lock<std::mutex> graph_lock(graph_mutex_);
+    std::unique_lock<std::mutex> map_lock(aligned_map_mutex_);
+    aligned_map_.clear();
+    pcl::PointCloud<pcl::PointXYZ> reference;
+    for (int i = 0; i < aligned_clouds_graph_->getNbClouds(); i++)
+    {
+        if (aligned_clouds_graph_->getCloudAt(i)->isReference() &&
+            aligned_clouds_graph_->loadCloudAt(i, reference))
+            aligned_map_.insert(reference);
+    }
+    aligned_map_dirty_ = false;
+    AICP_LOG_INFO("Main", "Built map re-built after pose graph optimization: " << aligned_map_.size() << " points.");
+}
+
+void App::addToPoseGraph(const ReadingData& data)
+{
+    AlignedCloudPtr cloud = aligned_clouds_graph_->getLastCloud();
+    int id = pose_graph_.addNode(cloud->getCorrectedPose());
+    if (id == 0)
+        return;
+
+    AlignedCloudPtr previous = aligned_clouds_graph_->getCloudAt(id-1);
+    pose_graph_.addEdge(id-1, id, previous->getOdomPose().inverse() * cloud->getOdomPose(),
+                        PoseGraph::InformationMatrix::Identity() * pose_graph_odometry_weight,
+                        PoseGraph::ODOMETRY);
+
+    // Registered against a graph reference (-1: not aligned)
+    int reference_id = cloud->getItsReferenceId();
+    if (reference_id >= 0 && reference_id < id)
+    {
+        double overlap = data.octree_overlap > 0.0 ? data.octree_overlap / 100.0 : 0.5;
+        AlignedCloudPtr reference = aligned_clouds_graph_->getCloudAt(reference_id);
+        pose_graph_.addEdge(reference_id, id, reference->getCorrectedPose().inverse() * cloud->getCorrectedPose(),
+                            PoseGraph::InformationMatrix::Identity() * pose_graph_registration_weight * overlap,
+                            PoseGraph::REGISTRATION);
+    }
+}
+
+void App::optimizePoseGraph()
+{
+    LoopClosures loop_closures = getLoopClosures();
+    int first_free = -1;
+    for (size_t i = nb_loop_closures_added_; i < loop_closures.size(); i++)
+    {
+        const LoopClosure& loop_closure = loop_closures[i];
+        pose_graph_.addEdge(loop_closure.candidate_id, loop_closure.reference_id, loop_closure.relative_pose,
+                            PoseGraph::InformationMatrix::Identity() * pose_graph_loop_closure_weight *
+                            loop_closure.overlap / 100.0,
+                            PoseGraph::LOOP_CLOSURE);
+        if (first_free < 0 || loop_closure.candidate_id + 1 < first_free)
+            first_free = loop_closure.candidate_id + 1;
+    }
+    nb_loop_closures_added_ = loop_closures.size();
+    if (first_free < 0)
+        return;
+
+    // Only the nodes after the older end of the loops are optimized
+    ScopedTimer optimize_pose_graph_timer ("optimizePoseGraph");
+    Eigen::Isometry3d last_pose = aligned_clouds_graph_->getLastCloud()->getCorrectedPose();
+    std::vector<int> updated;
+    int iterations = pose_graph_.optimize(first_free, pose_graph_max_iterations, updated);
+    for (size_t i = 0; i < updated.size(); i++)
+        aligned_clouds_graph_->updatePose(updated[i], pose_graph_.getPose(updated[i]));
+
+    // Next readings follow the update of the last cloud
+    Eigen::Isometry3d update = aligned_clouds_graph_->getLastCloud()->getCorrectedPose() * last_pose.inverse();
+    initialT_ = update.matrix().cast<float>() * initialT_;
+    if (!updated.empty())
+        aligned_map_dirty_ = true;
+    optimize_pose_graph_timer.stop();
+
+    AICP_LOG_INFO("Main", "Pose graph: " << updated.size() << " of " << pose_graph_.getNbNodes() - first_free
+                  << " poses updated (" << iterations << " iterations, " << pose_graph_.getNbLoopClosures()
+                  << " loop closures).");
+}
+
+void App::computeRegistration(ReadingData& data)
+{
+    pcl::PointCloud<pcl::PointXYZ>::Ptr& reference_ptr = data.reg_reference ? data.reg_reference : data.ref_prefiltered;
+    pcl::PointCloud<pcl::PointXYZ>& reference = *reference_ptr;
+    pcl::PointCloud<pcl::PointXYZ>& reading = *data.read_prefiltered;
+    Eigen::Matrix4f& T = data.correction;
+
     /*===================================
     =              AICP Core            =
     ===================================*/
-    string configNameAICP;
-    configNameAICP.append(cl_cfg_.registration_config_file);
-
-    // Auto-tune ICP chain (quantile for the outlier filter)
-    float current_ratio = octree_overlap_/100.0;
+    // Auto-tune ICP chain (quantile for the outlier filter), in memory
+    float current_ratio = data.octree_overlap/100.0;
     if (current_ratio < 0.25)
         current_ratio = 0.25;
     else if (current_ratio > 0.70)
         current_ratio = 0.70;
 
-    replaceRatioConfigFile(reg_params_.pointmatcher.configFileName, configNameAICP, current_ratio);
-    registr_->updateConfigParams(configNameAICP);
+    registr_->setOutlierRatio(current_ratio);
+    // Deadline mode: cap ICP iterations (configured count restored when back to lower levels)
+    bool cap_iterations = data.compute_level >= 2;
+    if (cap_iterations != iterations_capped_)
+    {
+        registr_->setMaxIterationCount(cap_iterations ? deadline_max_iterations : -1);
+        iterations_capped_ = cap_iterations;
+    }
+    // Static prior map: the whole map is the reference, matches bounded instead
+    bool bound_matches = data.reg_reference && cl_cfg_.prior_map_max_match_distance > 0.0;
+    if (bound_matches != matches_bounded_)
+    {
+        registr_->setMaxMatchDistance(bound_matches ? cl_cfg_.prior_map_max_match_distance : -1.0f);
+        matches_bounded_ = bound_matches;
+    }
 
     /*===================================
     =          Register Clouds          =
     ===================================*/
-    registr_->registerClouds(reference, reading, T);
+    // Initialization against prior map: keep best of perturbed initial guesses
+    if ((cl_cfg_.load_map_from_file || cl_cfg_.localize_against_prior_map) &&
+        initialization_pending_.exchange(false))
+    {
+        TransformsVector hypotheses;
+        getInitializationHypotheses(data.read_pose, reg_params_.initialization, hypotheses);
+        if (hypotheses.size() > 1)
+        {
+            if (data.reg_reference_normals)
+                registr_->setReference(*data.reg_reference_normals, data.reg_ref_id);
+            else
+                registr_->setReference(reference, data.reg_ref_id);
+            data.warm_start = false; // hypotheses around the prior pose instead
+            if (registr_->registerReading(reading, hypotheses, T) >= 0)
+            {
+                data.multi_hypothesis = true;
+                return;
+            }
+        }
+    }
+    // Motion model prediction (identity otherwise)
+    if (data.warm_start)
+        registr_->setInitialGuess(data.initial_guess);
+
+    // Geometrically stable subset of the reading (planes segmentation normals),
+    // all reference points kept for the matching
+    bool sample = reg_params_.sampling.maxPoints > 0 && data.read_segmented &&
+                  data.read_segmented->isBuiltFrom(data.read_prefiltered) &&
+                  reading.size() > (size_t)reg_params_.sampling.maxPoints;
+    if (sample)
+    {
+        geometricallyStableSampling(*data.read_segmented, reg_params_.sampling.maxPoints, sampling_indices_);
+        AICP_LOG_DEBUG("AICP Core", "Stable sampling: " << sampling_indices_.size() << " of "
+                       << reading.size() << " reading points.");
+    }
+
+    // Reference (and its KD-tree) re-built only if changed since last reading
+    if (data.ref_segmented && data.read_segmented &&
+        data.ref_segmented->isBuiltFrom(reference_ptr) &&
+        data.read_segmented->isBuiltFrom(data.read_prefiltered))
+    {
+        // Reuse pre-filter normals (segmented clouds built from the registered clouds)
+        registr_->setReference(*data.ref_segmented->cloud, data.reg_ref_id);
+        if (sample)
+        {
+            pcl::copyPointCloud(*data.read_segmented->cloud, sampling_indices_, sampled_reading_normals_);
+            registr_->registerReading(sampled_reading_normals_, T);
+        }
+        else
+            registr_->registerReading(*data.read_segmented->cloud, T);
+    }
+    else
+    {
+        if (data.reg_reference_normals)
+            registr_->setReference(*data.reg_reference_normals, data.reg_ref_id);
+        else
+            registr_->setReference(reference, data.reg_ref_id);
+        if (sample)
+        {
+            sampled_reading_.clear();
+            gatherPoints(reading, sampling_indices_, sampled_reading_);
+            registr_->registerReading(sampled_reading_, T);
+        }
+        else
+            registr_->registerReading(reading, T);
+    }
 
-    cout << "========================" << endl
-         << "[AICP Core] Correction:" << endl
-         << "========================" << endl
-         << T << endl;
+    AICP_LOG_DEBUG("AICP Core", "Correction:" << endl << T);
 }
 
 void App::runAicpPipeline(pcl::PointCloud<pcl::PointXYZ>::Ptr& reference_prefiltered,
@@ -221,331 +847,881 @@ void App::runAicpPipeline(pcl::PointCloud<pcl::PointXYZ>::Ptr& reference_prefilt
                           Eigen::Isometry3d& reading_pose,
                           Eigen::Matrix4f &T)
 {
-    /*==========================
-    =          Overlap         =
-    ===========================*/
-
-    TimingUtils::tic();
-    computeOverlap(reference_prefiltered, reading_prefiltered, reference_pose, reading_pose);
-    TimingUtils::toc("computeOverlap");
-
-    /*=================================
-    =          Alignment Risk         =
-    =================================*/
+    ReadingData data ((AlignedCloudPtr()));
+    data.ref_prefiltered = reference_prefiltered;
+    data.read_prefiltered = reading_prefiltered;
+    data.ref_pose = reference_pose;
+    data.read_pose = reading_pose;
 
-    if (cl_cfg_.failure_prediction_mode)
-        computeAlignmentRisk(reference_prefiltered, reading_prefiltered, reference_pose, reading_pose);
+    /*===================================
+    =     Overlap and Alignment Risk    =
+    ===================================*/
+    computeOverlapAndAlignmentRisk(data);
 
-    TimingUtils::tic();
+    ScopedTimer compute_registration_timer ("computeRegistration");
     /*================================
     =          Registration          =
     ================================*/
+    degeneracy_ = DegeneracyEstimate();
     if(!cl_cfg_.failure_prediction_mode ||                      // if alignment risk disabled
-       risk_prediction_(0,0) <= class_params_.svm.threshold)    // or below threshold
-        computeRegistration(*reference_prefiltered, *reading_prefiltered, T);
-    TimingUtils::toc("computeRegistration");
+       data.risk_prediction(0,0) <= class_params_.svm.threshold) // or below threshold
+    {
+        computeRegistration(data);
+        degeneracy_ = registr_->getDegeneracy();
+    }
+    compute_registration_timer.stop();
+
+    T = data.correction;
+    octree_overlap_ = data.octree_overlap;
+    fov_overlap_ = data.fov_overlap;
+    alignability_ = data.alignability;
+    risk_prediction_ = data.risk_prediction;
 }
 
+void App::setReferenceFinal(long seq)
+{
+    {
+        std::unique_lock<std::mutex> lock(reference_mutex_);
+        reference_final_seq_ = std::max(reference_final_seq_, seq);
+    }
+    reference_condition_.notify_all();
+}
+
+void App::refreshReference(ReadingData& data)
+{
+    if (data.ref_id < 0)
+        return;
+    // Reading released before the pose graph optimization of the previous one (pipelined):
+    // reference points moved since setReference
+    std::unique_lock<std::mutex> lock(graph_mutex_);
+    AlignedCloudPtr reference = aligned_clouds_graph_->getCloudAt(data.ref_id);
+    if (reference->getPointsKey() == data.reg_ref_id || !reference->isResident())
+        return;
+    data.ref_prefiltered = reference->getCloud();
+    data.ref_pose = reference->getCorrectedPose();
+    data.ref_segmented = reference->getSegmentedCloud();
+    data.reg_ref_id = reference->getPointsKey();
+    AICP_LOG_DEBUG("Main", "Reference " << data.ref_id << " moved by the pose graph, points updated.");
+}
+
+void App::predictReferenceChange(ReadingData& data)
+{
+    std::unique_lock<std::mutex> lock(graph_mutex_);
+    data.changes_reference = data.first_cloud ||
+                             (cl_cfg_.failure_prediction_mode &&
+                              data.risk_prediction(0,0) > class_params_.svm.threshold) ||
+                             (cl_cfg_.localize_against_prior_map && cl_cfg_.merge_aligned_clouds_to_map);
+    if (!cl_cfg_.localize_against_prior_map)
+    {
+        // Clouds in graph once this reading is added: readings still being registered
+        // are either added or dropped, check the reference update policy for all cases
+        int nb_clouds = aligned_clouds_graph_->getNbClouds();
+        int ref_id = aligned_clouds_graph_->getCurrentReferenceId();
+        for (int n = nb_clouds + 1; n <= nb_clouds + pending_alignments_ + 1 && !data.changes_reference; n++)
+        {
+            if ((n - (ref_id+1)) % cl_cfg_.reference_update_frequency == 0 ||
+                (cl_cfg_.load_map_from_file && n == 1))
+                data.changes_reference = true;
+        }
+    }
+    pending_alignments_ ++;
+}
 
 void App::processFromFile(std::string file_path){
     std::cout << "starting processFromFile\n";
 
-    // Read all poses csv file:
-    std::stringstream ss;
-    ss << file_path << "/aicp_input_poses.csv";
     std::vector< IsometryWithTime > world_to_body_poses;
-    PoseFileReader reader;
-    reader.readPoseFile(ss.str(), world_to_body_poses);
 
-    // Process each cloud successively
-    for (auto pose_with_time : world_to_body_poses) {
+    // Clouds log (written with input_clouds_format "log") if any, otherwise one pcd file per cloud
+    std::string log_file = file_path + "/aicp_input_clouds.aicplog";
+    CloudLogReader log;
+    if (std::ifstream(log_file.c_str()).good() && log.open(log_file))
+    {
+        for (size_t i = 0; i < log.size(); i++)
+        {
+            // Same time split as the poses csv file
+            int64_t sec = log.getUtime(i) / 1000000;
+            world_to_body_poses.push_back(IsometryWithTime(log.getPose(i), sec, log.getUtime(i) - sec * 1000000, i));
+        }
+    }
+    else
+    {
+        // Read all poses csv file:
+        std::stringstream ss;
+        ss << file_path << "/aicp_input_poses.csv";
+        PoseFileReader reader;
+        reader.readPoseFile(ss.str(), world_to_body_poses);
+    }
+
+    auto cloud_file = [&](size_t index) {
         std::stringstream ss2;
-        ss2 << file_path << "/cloud_" << pose_with_time.counter << "_" << pose_with_time.sec << "_" << pose_with_time.nsec << ".pcd";
-        std::cout << ss2.str() << "\n";
+        if (log.isOpen())
+            ss2 << log_file << " [" << index << "]";
+        else
+            ss2 << file_path << "/cloud_" << world_to_body_poses[index].counter << "_" << world_to_body_poses[index].sec
+                << "_" << world_to_body_poses[index].nsec << ".pcd";
+        return ss2.str();
+    };
+    // NULL if the cloud cannot be read
+    auto load_cloud = [&](size_t index) {
+        pcl::PointCloud<pcl::PointXYZ>::Ptr cloud (new pcl::PointCloud<pcl::PointXYZ>);
+        if (log.isOpen())
+        {
+            if (!log.readCloud(index, *cloud))
+                cloud.reset();
+        }
+        else if (pcl::io::loadPCDFile<pcl::PointXYZ> (cloud_file(index), *cloud) == -1)
+            cloud.reset();
+        return cloud;
+    };
+
+    // Clouds read (and parsed) ahead by a pool of readers, up to replay_prefetch clouds
+    int prefetch = std::max(cl_cfg_.replay_prefetch, 0);
+    std::unique_ptr<ThreadPool> readers;
+    if (prefetch > 0)
+        readers.reset(new ThreadPool(std::min(prefetch, std::max((int)std::thread::hardware_concurrency() / 2, 1))));
+    std::deque<std::future<pcl::PointCloud<pcl::PointXYZ>::Ptr> > loading;
+    size_t next_load = 0;
+
+    typedef std::chrono::steady_clock Clock;
+    Clock::time_point start = Clock::now();
+    double waiting_time = 0.0;
+    size_t nb_processed = 0;
+
+    // Process each cloud successively
+    startLoopClosureDetection();
+    for (size_t i = 0; i < world_to_body_poses.size(); i++) {
+        const IsometryWithTime& pose_with_time = world_to_body_poses[i];
+        AICP_LOG_DEBUG("Main", "Replaying " << cloud_file(i));
 
         int64_t utime = pose_with_time.sec*1E6 + pose_with_time.nsec;
 
-        pcl::PointCloud<pcl::PointXYZ>::Ptr accumulated_cloud (new pcl::PointCloud<pcl::PointXYZ>);
-        if (pcl::io::loadPCDFile<pcl::PointXYZ> (ss2.str(), *accumulated_cloud) == -1){
-           std::cout << "Couldn't read file " << ss2.str() << "\n";
-           return;
+        Clock::time_point wait_start = Clock::now();
+        pcl::PointCloud<pcl::PointXYZ>::Ptr accumulated_cloud;
+        if (readers)
+        {
+            for (; next_load < world_to_body_poses.size() && next_load <= i + prefetch; next_load++)
+                loading.push_back(readers->enqueue(std::bind(load_cloud, next_load)));
+            accumulated_cloud = loading.front().get();
+            loading.pop_front();
+        }
+        else
+            accumulated_cloud = load_cloud(i);
+        if (!accumulated_cloud){
+           AICP_LOG_ERROR("Main", "Couldn't read file " << cloud_file(i));
+           break;
+        }
+
+        // Real time: cloud processed when due since the first one (no wait if late)
+        if (cl_cfg_.replay_real_time)
+        {
+            int64_t first_utime = world_to_body_poses[0].sec*1E6 + world_to_body_poses[0].nsec;
+            std::this_thread::sleep_until(start + std::chrono::microseconds(utime - first_utime));
         }
+        else
+            waiting_time += std::chrono::duration<double>(Clock::now() - wait_start).count();
 
         AlignedCloudPtr current_cloud (new AlignedCloud(utime,
                                                         accumulated_cloud,
                                                         pose_with_time.pose));
         processCloud(current_cloud);
+        nb_processed ++;
     }
+    stopLoopClosureDetection();
+
+    double total_time = std::chrono::duration<double>(Clock::now() - start).count();
+    cout << "[Main] Replayed " << nb_processed << " clouds in " << total_time << " s";
+    if (!cl_cfg_.replay_real_time)
+        cout << " (waiting for clouds: " << waiting_time << " s)";
+    cout << endl;
+    TimingStats::print();
+    MemoryReport memory;
+    getMemoryReport(memory);
+    cout << "[Main] Memory: " << formatMemoryReport(memory) << endl;
+    // Pending reads finished before the poses are released
+    loading.clear();
+    readers.reset();
 }
 
 
 void App::processCloud(AlignedCloudPtr cloud){
+    ReadingData data (cloud);
+
+    ScopedTimer full_loop_timer ("fullLoop");
+    runStage("filterReading", &App::filterReading, &ReadingData::filter_time, data);
+    runStage("assessReading", &App::assessReading, &ReadingData::assess_time, data);
+    runStage("alignReading", &App::alignReading, &ReadingData::align_time, data);
+    full_loop_timer.stop();
+    updateDiagnostics(data);
+    updateComputeLevel(data);
+}
 
+void App::runStage(const char* name, void (App::*stage)(ReadingData&), double ReadingData::*time,
+                   ReadingData& data)
+{
+    // Wall time measured here (also when timers are compiled out)
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    (this->*stage)(data);
+    std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+    data.*time = std::chrono::duration<double>(end - start).count();
+    TraceRecorder::record(name, start, end);
+}
 
-            // First point cloud (becomes first reference)
-            if(!cl_cfg_.localize_against_prior_map &&
-               !cl_cfg_.load_map_from_file &&
-               aligned_clouds_graph_->isEmpty())
-            {
-                /*===================================
-                =            First Cloud            =
-                ===================================*/
-                // Pre-filter first cloud
-                pcl::PointCloud<pcl::PointXYZ>::Ptr ref_prefiltered (new pcl::PointCloud<pcl::PointXYZ>);
-                regionGrowingUniformPlaneSegmentationFilter(cloud->getCloud(), ref_prefiltered);
-                // Update AlignedCloud
-                cloud->updateCloud(ref_prefiltered, true);
-                // Initialize graph
-                aligned_clouds_graph_->initialize(cloud);
-
-                // VISUALIZE first reference cloud
-                reference_vis_ = aligned_clouds_graph_->getCurrentReference()->getCloud();
-                vis_->publishCloud(reference_vis_, 0, "", cloud->getUtime());
-
-                // Path
-                vis_->publishPoses(aligned_clouds_graph_->getCurrentReference()->getCorrectedPose(), 0, "",
-                                   cloud->getUtime());
-
-                // Store built map
-                aligned_map_ = aligned_map_ + *reference_vis_;
-                // VISUALIZE built map
-                pcl::PointCloud<pcl::PointXYZ>::Ptr aligned_map_ptr = aligned_map_.makeShared();
-                vis_->publishMap(aligned_map_ptr, cloud->getUtime(), 1);
-
-                first_cloud_initialized_ = true;
-            }
-            else {
+void App::updateDiagnostics(const ReadingData& data)
+{
+    MemoryReport memory;
+    getMemoryReport(memory);
+    std::unique_lock<std::mutex> lock(diagnostics_mutex_);
+    diagnostics_.memory = memory;
+    diagnostics_.utime = data.cloud->getUtime();
+    diagnostics_.nb_readings ++;
+    diagnostics_.filter_time = data.filter_time;
+    diagnostics_.assess_time = data.assess_time;
+    diagnostics_.align_time = data.align_time;
+    diagnostics_.points_in = data.nb_input_points;
+    diagnostics_.points_out = data.read_prefiltered ? data.read_prefiltered->size() : 0;
+    diagnostics_.reference_points = data.ref_prefiltered ? data.ref_prefiltered->size() : 0;
+    // Registration skipped for the first cloud and if the alignment risk is too high
+    bool registered = !data.first_cloud &&
+                      (!cl_cfg_.failure_prediction_mode ||
+                       data.risk_prediction(0,0) <= class_params_.svm.threshold);
+    diagnostics_.icp_iterations = registered ? registr_->getNbIterations() : -1;
+    diagnostics_.icp_coarse_iterations = registered ? registr_->getNbCoarseIterations() : -1;
+    diagnostics_.icp_converged = registered ? registr_->getConverged() : -1;
+    diagnostics_.icp_warm_start = registered && data.warm_start;
+    diagnostics_.icp_inlier_ratio = registered ? registr_->getInlierRatio() : -1.0f;
+    RegistrationQuality quality = registered ? registr_->getQuality() : RegistrationQuality();
+    diagnostics_.icp_residual_median = quality.median;
+    diagnostics_.icp_residual_p90 = quality.p90;
+    diagnostics_.icp_residual_max = quality.max;
+    degeneracy_ = registered ? registr_->getDegeneracy() : DegeneracyEstimate();
+    diagnostics_.icp_degeneracy = degeneracy_.degeneracy;
+    diagnostics_.icp_inverse_condition_number = degeneracy_.inverse_condition_number;
+    diagnostics_.icp_degenerate_directions = degeneracy_.nb_degenerate;
+    diagnostics_.octree_overlap = data.octree_overlap;
+    diagnostics_.fov_overlap = data.fov_overlap;
+    diagnostics_.alignability = data.alignability;
+    diagnostics_.risk = data.risk_prediction(0,0);
+    diagnostics_.compute_level = data.compute_level;
+}
 
-                TimingUtils::tic();
-                TimingUtils::tic();
-                if (cl_cfg_.verbose)
-                {
-                    // Publish original reading cloud
-                    last_reading_vis_ = cloud->getCloud();
-                }
+void App::getMemoryReport(MemoryReport& report)
+{
+    report.graph = aligned_clouds_graph_->getMemoryUsage();
+    report.aligned_map = aligned_map_.getMemoryUsage();
+    {
+        // Prior map extended by the registration stage, loaded or replaced from other threads
+        std::unique_lock<std::mutex> lock(prior_map_mutex_);
+        const VoxelMap& prior_voxel_map = shared_prior_map_ ? *shared_prior_map_ : prior_voxel_map_;
+        report.prior_map = prior_voxel_map.getMemoryUsage();
+        // Prior map cloud if not the points of the voxel map
+        if (prior_map_ && prior_map_->getCloud() && prior_map_->getCloud() != prior_voxel_map.getCloud())
+            report.prior_map.bytes += prior_map_->getMemoryUsage();
+    }
+    report.prior_map += static_map_memory_.get();
+    report.octrees = OverlapTree::getUsage();
+    report.paths = vis_ ? vis_->getMemoryUsage() : MemoryUsage();
+    report.queue = cloud_queue_.getMemoryUsage();
+}
 
-                /*========================
-                =          Input         =
-                ========================*/
+void App::predictCorrection(ReadingData& data)
+{
+    data.warm_start = false;
+    if (reg_params_.motionModel.mode == "none" || !last_correction_valid_)
+        return;
 
-                Eigen::Isometry3d ref_pose;
-                pcl::PointCloud<pcl::PointXYZ>::Ptr ref_prefiltered;
-                setReference(cloud, ref_prefiltered, ref_pose);
+    // Constant velocity: drift of the prior pose between readings as for the last one
+    double scale = 1.0;
+    if (reg_params_.motionModel.mode == "odometry")
+    {
+        // Drift proportional to the distance travelled (constant if the robot was static)
+        double motion = (last_read_pose_.inverse() * data.read_pose).translation().norm();
+        if (last_read_motion_ > motion_model_min_motion)
+            scale = std::min(motion / last_read_motion_, (double)reg_params_.motionModel.maxScale);
+    }
+    Eigen::AngleAxisd rotation (last_correction_.rotation());
+    Eigen::Isometry3d guess = Eigen::Isometry3d::Identity();
+    guess.translate(scale * last_correction_.translation());
+    guess.rotate(Eigen::AngleAxisd(scale * rotation.angle(), rotation.axis()));
+    data.initial_guess = guess.matrix().cast<float>();
+    data.warm_start = true;
+    AICP_LOG_DEBUG("Main", "Motion model initial guess (scale " << scale << "):" << endl << data.initial_guess);
+}
 
-                Eigen::Isometry3d read_pose;
-                pcl::PointCloud<pcl::PointXYZ>::Ptr read_prefiltered (new pcl::PointCloud<pcl::PointXYZ>);
-                setAndFilterReading(cloud, read_prefiltered, read_pose);
+void App::updateComputeLevel(const ReadingData& data)
+{
+    if (cl_cfg_.cycle_deadline <= 0.0)
+        return;
+
+    // Time to clear the queue and this reading: stages in sequence, or
+    // throughput of the slowest stage when pipelined
+    double cycle_time = data.filter_time + data.assess_time + data.align_time;
+    if (cl_cfg_.pipelined_processing)
+        cycle_time = std::max(data.filter_time, std::max(data.assess_time, data.align_time));
+    const double latency = cycle_time * (cloud_queue_.size() + 1);
+
+    int level = compute_level_;
+    if (latency > cl_cfg_.cycle_deadline)
+    {
+        compute_level_calm_cycles_ = 0;
+        // Readings at the current level only (pipelined: previous ones still in the stages)
+        if (data.compute_level == level && level < max_compute_level)
+            level ++;
+    }
+    else if (latency < 0.5 * cl_cfg_.cycle_deadline && level > 0)
+    {
+        if (++compute_level_calm_cycles_ >= deadline_calm_cycles)
+        {
+            compute_level_calm_cycles_ = 0;
+            level --;
+        }
+    }
+    else
+        compute_level_calm_cycles_ = 0;
 
-                if (cl_cfg_.verbose)
-                {
-                    // Save filtered clouds to file
-                    stringstream filtered_ref;
-                    filtered_ref << data_directory_path_.str();
-                    filtered_ref << "/reference_prefiltered.pcd";
-                    pcd_writer_.write<pcl::PointXYZ> (filtered_ref.str (), *ref_prefiltered, false);
-                    stringstream filtered_read;
-                    filtered_read << data_directory_path_.str();
-                    filtered_read << "/reading_prefiltered.pcd";
-                    pcd_writer_.write<pcl::PointXYZ> (filtered_read.str (), *read_prefiltered, false);
-                }
-                TimingUtils::toc("setAndFilterReading");
+    if (level != compute_level_)
+    {
+        AICP_LOG_INFO("Main", "Deadline mode: compute level " << level << " (latency " << latency
+                      << " sec, deadline " << cl_cfg_.cycle_deadline << " sec).");
+        compute_level_ = level;
+    }
+}
+
+App::Diagnostics App::getDiagnostics()
+{
+    Diagnostics diagnostics;
+    {
+        std::unique_lock<std::mutex> lock(diagnostics_mutex_);
+        diagnostics = diagnostics_;
+    }
+    WorkQueue<AlignedCloudPtr>::Stats stats = cloud_queue_.getStats();
+    diagnostics.queue_size = cloud_queue_.size();
+    diagnostics.queue_pushed = stats.pushed;
+    diagnostics.queue_dropped = stats.dropped;
+    diagnostics.queue_mean_latency = stats.mean_latency;
+    diagnostics.queue_max_latency = stats.max_latency;
+    // Counters maintained by their owners (read without the registration stage)
+    diagnostics.memory.octrees = OverlapTree::getUsage();
+    diagnostics.memory.paths = vis_ ? vis_->getMemoryUsage() : MemoryUsage();
+    diagnostics.memory.queue = cloud_queue_.getMemoryUsage();
+    return diagnostics;
+}
+
+void App::filterReading(ReadingData& data)
+{
+    /*========================
+    =          Input         =
+    ========================*/
+    data.nb_input_points = data.cloud->getNbPoints();
+    data.compute_level = compute_level_;
+    ScopedTimer set_and_filter_reading_timer ("setAndFilterReading");
+    setAndFilterReading(data);
+    set_and_filter_reading_timer.stop();
+}
 
-                /*=====================================
-                =          AICP Registration          =
-                =====================================*/
-                Eigen::Matrix4f correction = Eigen::Matrix4f::Identity(4,4);
-                pcl::PointCloud<pcl::PointXYZ>::Ptr output (new pcl::PointCloud<pcl::PointXYZ>);
+void App::assessReading(ReadingData& data)
+{
+    // First point cloud (becomes first reference)
+    {
+        std::unique_lock<std::mutex> lock(graph_mutex_);
+        data.first_cloud = !cl_cfg_.localize_against_prior_map &&
+                           !cl_cfg_.load_map_from_file &&
+                           aligned_clouds_graph_->isEmpty();
+    }
 
-                runAicpPipeline(ref_prefiltered, read_prefiltered, ref_pose, read_pose, correction);
+    if (!data.first_cloud)
+    {
+        ScopedTimer set_reference_timer ("setReference");
+        setReference(data);
+
+        if (cl_cfg_.verbose)
+        {
+            // Save filtered clouds to file
+            stringstream filtered_ref;
+            filtered_ref << data_directory_path_.str();
+            filtered_ref << "/reference_prefiltered.pcd";
+            debug_writer_.writeCloud(filtered_ref.str (), data.ref_prefiltered);
+            stringstream filtered_read;
+            filtered_read << data_directory_path_.str();
+            filtered_read << "/reading_prefiltered.pcd";
+            debug_writer_.writeCloud(filtered_read.str (), data.read_prefiltered);
+        }
+        set_reference_timer.stop();
+
+        /*===================================
+        =     Overlap and Alignment Risk    =
+        ===================================*/
+        computeOverlapAndAlignmentRisk(data);
+    }
+
+    predictReferenceChange(data);
+}
 
-                TimingUtils::tic();
-                if(!cl_cfg_.failure_prediction_mode ||                      // if alignment risk disabled
-                   risk_prediction_(0,0) <= class_params_.svm.threshold)    // or below threshold
+void App::alignReading(ReadingData& data)
+{
+    AlignedCloudPtr& cloud = data.cloud;
+    if (data.first_cloud)
+    {
+        /*===================================
+        =            First Cloud            =
+        ===================================*/
+        // Update AlignedCloud (pre-filtered, planes segmentation set by setAndFilterReading)
+        cloud->updateCloud(data.read_prefiltered, true);
+        {
+            std::unique_lock<std::mutex> lock(graph_mutex_);
+            // Initialize graph
+            aligned_clouds_graph_->initialize(cloud);
+            last_correction_valid_ = false;
+            last_read_pose_ = data.read_pose;
+            if (cl_cfg_.pose_graph_optimization)
+                addToPoseGraph(data);
+            pending_alignments_ --;
+        }
+
+        // VISUALIZE first reference cloud
+        reference_vis_ = aligned_clouds_graph_->getCurrentReference()->getCloud();
+        vis_->publishCloud(reference_vis_, 0, "", cloud->getUtime());
+
+        // Path
+        vis_->publishPoses(aligned_clouds_graph_->getCurrentReference()->getCorrectedPose(), 0, "",
+                           cloud->getUtime());
+
+        // Store and VISUALIZE built map
+        addToAlignedMap(reference_vis_, aligned_clouds_graph_->getCurrentReference()->getCorrectedPose(),
+                        cloud->getUtime());
+
+        first_cloud_initialized_ = true;
+        AICP_LOG_DEBUG("Main", "First cloud: reference " << aligned_clouds_graph_->getCurrentReferenceId());
+        setReferenceFinal(data.seq);
+        return;
+    }
+
+    if (cl_cfg_.verbose)
+    {
+        // Publish original reading cloud
+        last_reading_vis_ = cloud->getCloud();
+    }
+
+    // Published with the corrected pose
+    octree_overlap_ = data.octree_overlap;
+    fov_overlap_ = data.fov_overlap;
+    alignability_ = data.alignability;
+    risk_prediction_ = data.risk_prediction;
+
+    /*=====================================
+    =          AICP Registration          =
+    =====================================*/
+    ScopedTimer compute_registration_timer ("computeRegistration");
+    if(!cl_cfg_.failure_prediction_mode ||                           // if alignment risk disabled
+       data.risk_prediction(0,0) <= class_params_.svm.threshold)    // or below threshold
+    {
+        refreshReference(data);
+        predictCorrection(data);
+        computeRegistration(data);
+    }
+    compute_registration_timer.stop();
+
+    Eigen::Matrix4f& correction = data.correction;
+    pcl::PointCloud<pcl::PointXYZ>::Ptr& read_prefiltered = data.read_prefiltered;
+    pcl::PointCloud<pcl::PointXYZ>::Ptr output (new pcl::PointCloud<pcl::PointXYZ>);
+
+    ScopedTimer update_reference_timer ("updateReference");
+    bool dropped = false;
+    {
+        // Graph read by the overlap stage when pipelined
+        ScopedSpan wait_span ("waitGraphMutex");
+        std::unique_lock<std::mutex> lock(graph_mutex_);
+        wait_span.stop();
+        pending_alignments_ --;
+        int previous_reference_id = aligned_clouds_graph_->getCurrentReferenceId();
+        if(!cl_cfg_.failure_prediction_mode ||                           // if alignment risk disabled
+           data.risk_prediction(0,0) <= class_params_.svm.threshold)    // or below threshold
+        {
+            // Probably failed alignment
+            if ((abs(correction(0,3)) > cl_cfg_.max_correction_magnitude ||
+                 abs(correction(1,3)) > cl_cfg_.max_correction_magnitude ||
+                 abs(correction(2,3)) > cl_cfg_.max_correction_magnitude) &&
+                 aligned_clouds_graph_->getNbClouds() != 0)
+            {
+                AICP_LOG_WARN("Main", "WRONG ALIGNMENT: DROPPED POINT CLOUD");
+                dropped = true;
+                last_correction_valid_ = false;
+            }
+            else
+            {
+                pcl::transformPointCloud (*read_prefiltered, *output, correction);
+                if (cloud->getSegmentedCloud())
                 {
-                    // Probably failed alignment
-                    if ((abs(correction(0,3)) > cl_cfg_.max_correction_magnitude ||
-                         abs(correction(1,3)) > cl_cfg_.max_correction_magnitude ||
-                         abs(correction(2,3)) > cl_cfg_.max_correction_magnitude) &&
-                         aligned_clouds_graph_->getNbClouds() != 0)
-                    {
-                        cout << "[Main] -----> WRONG ALIGNMENT: DROPPED POINT CLOUD" << endl;
-                        return;
-                    }
-
-                    pcl::transformPointCloud (*read_prefiltered, *output, correction);
-                    Eigen::Isometry3d correction_iso = fromMatrix4fToIsometry3d(correction);
-                    // Update AlignedCloud with corrected pose and (prefiltered) cloud after alignment
-                    cloud->updateCloud(output, correction_iso, false, aligned_clouds_graph_->getCurrentReferenceId());
-                    // Add AlignedCloud to graph
-                    aligned_clouds_graph_->addCloud(cloud);
-
-                    // Windowed reference update policy (count number of clouds after last reference)
-                    if(((aligned_clouds_graph_->getNbClouds() - (aligned_clouds_graph_->getCurrentReferenceId()+1))
-                        % cl_cfg_.reference_update_frequency == 0) &&
-                        !cl_cfg_.localize_against_prior_map)
-                    {
-                        // Set AlignedCloud to be next reference
-                        aligned_clouds_graph_->updateReference(aligned_clouds_graph_->getNbClouds()-1);
-                        updates_counter_ ++;
-                        cout << "[Main] -----> FREQUENCY REFERENCE UPDATE" << endl;
-                    }
-                    else if(cl_cfg_.load_map_from_file &&
-                            !cl_cfg_.localize_against_prior_map &&
-                            aligned_clouds_graph_->getNbClouds() == 1)
-                    {
-                        // Case: reference is the map just for first iteration (-> visualization)
-                        // set AlignedCloud to be next reference
-                        aligned_clouds_graph_->updateReference(aligned_clouds_graph_->getNbClouds()-1);
-                    }
+                    cloud->getSegmentedCloud()->transform(correction);
+                    cloud->getSegmentedCloud()->points = output;
                 }
-                else
+                Eigen::Isometry3d correction_iso = fromMatrix4fToIsometry3d(correction);
+                // Update AlignedCloud with corrected pose and (prefiltered) cloud after alignment
+                cloud->updateCloud(output, correction_iso, false, aligned_clouds_graph_->getCurrentReferenceId());
+                cloud->moveOverlapTree(correction_iso);
+                // Motion model: next readings predicted from this correction
+                last_correction_ = correction_iso;
+                last_correction_valid_ = !data.multi_hypothesis;
+                last_read_motion_ = (last_read_pose_.inverse() * data.read_pose).translation().norm();
+                last_read_pose_ = data.read_pose;
+                // Add AlignedCloud to graph
+                aligned_clouds_graph_->addCloud(cloud);
+                if (cl_cfg_.pose_graph_optimization)
+                    addToPoseGraph(data);
+
+                // Windowed reference update policy (count number of clouds after last reference)
+                if(((aligned_clouds_graph_->getNbClouds() - (aligned_clouds_graph_->getCurrentReferenceId()+1))
+                    % cl_cfg_.reference_update_frequency == 0) &&
+                    !cl_cfg_.localize_against_prior_map)
                 {
-                    // Case: risk_prediction_(0,0) > class_params_.svm.threshold
-                    // rely on prior pose for one step (alignment not performed!)
-                    cloud->updateCloud(read_prefiltered, true);
-                    // add AlignedCloud to graph
-                    aligned_clouds_graph_->addCloud(cloud);
+                    // Set AlignedCloud to be next reference
                     aligned_clouds_graph_->updateReference(aligned_clouds_graph_->getNbClouds()-1);
                     updates_counter_ ++;
-                    cout << "[Main] -----> ALIGNMENT RISK REFERENCE UPDATE" << endl;
+                    AICP_LOG_INFO("Main", "FREQUENCY REFERENCE UPDATE");
+                }
+                else if(cl_cfg_.load_map_from_file &&
+                        !cl_cfg_.localize_against_prior_map &&
+                        aligned_clouds_graph_->getNbClouds() == 1)
+                {
+                    // Case: reference is the map just for first iteration (-> visualization)
+                    // set AlignedCloud to be next reference
+                    aligned_clouds_graph_->updateReference(aligned_clouds_graph_->getNbClouds()-1);
                 }
-                TimingUtils::toc("updateReference");
+            }
+        }
+        else
+        {
+            // Case: risk_prediction(0,0) > class_params_.svm.threshold
+            // rely on prior pose for one step (alignment not performed!)
+            cloud->updateCloud(read_prefiltered, true);
+            last_correction_valid_ = false;
+            last_read_pose_ = data.read_pose;
+            // add AlignedCloud to graph
+            aligned_clouds_graph_->addCloud(cloud);
+            if (cl_cfg_.pose_graph_optimization)
+                addToPoseGraph(data);
+            aligned_clouds_graph_->updateReference(aligned_clouds_graph_->getNbClouds()-1);
+            updates_counter_ ++;
+            AICP_LOG_INFO("Main", "ALIGNMENT RISK REFERENCE UPDATE");
+        }
 
-                initialT_ = correction * initialT_;
+        // Overlap trees kept by the current reference only
+        if (aligned_clouds_graph_->getCurrentReference() != cloud)
+            cloud->releaseOverlapTree();
+        if (previous_reference_id >= 0 && previous_reference_id != aligned_clouds_graph_->getCurrentReferenceId())
+            aligned_clouds_graph_->getCloudAt(previous_reference_id)->releaseOverlapTree();
+    }
+    update_reference_timer.stop();
+    if (dropped)
+    {
+        setReferenceFinal(data.seq);
+        return;
+    }
 
-                /*======================================
-                =          Save and Visualize          =
-                ======================================*/
-                TimingUtils::tic();
+    initialT_ = correction * initialT_;
+    if (cl_cfg_.pose_graph_optimization)
+    {
+        std::unique_lock<std::mutex> lock(graph_mutex_);
+        optimizePoseGraph();
+    }
 
-                // Store chain of corrections for publishing
-                total_correction_ = fromMatrix4fToIsometry3d(initialT_);
-                updated_correction_ = true;
+    /*======================================
+    =          Save and Visualize          =
+    ======================================*/
+    ScopedTimer post_processing_timer ("postProcessing");
+
+    // Store chain of corrections for publishing
+    total_correction_ = fromMatrix4fToIsometry3d(initialT_);
+    updated_correction_ = true;
+
+    // Path (save and visualize)
+    // Ensure robot moves between stored poses
+    Eigen::Isometry3d last_path_pose;
+    double dist = std::numeric_limits<double>::infinity();
+    if (vis_->getLastPose(last_path_pose))
+        dist = (last_path_pose.inverse() *
+                aligned_clouds_graph_->getLastCloud()->getCorrectedPose()).translation().norm();
+    if (dist > 1.0)//(1==1)// use threshold to reduce number of nearby markers. this shouldnt be done here
+    {
+        vis_->publishPoses(aligned_clouds_graph_->getLastCloud()->getCorrectedPose(), 0, "",
+                           cloud->getUtime());
+        vis_->publishPriorPoses(aligned_clouds_graph_->getLastCloud()->getPriorPose(), 0, "",
+                           cloud->getUtime());
+        vis_->publishOdomPoses(aligned_clouds_graph_->getLastCloud()->getOdomPose(), 0, "",
+                           cloud->getUtime());
 
-                // Path (save and visualize)
-                // Ensure robot moves between stored poses
-                Eigen::Isometry3d relative_motion = vis_->getPath().back().inverse() *
-                                                    aligned_clouds_graph_->getLastCloud()->getCorrectedPose();
-                double dist = relative_motion.translation().norm();
-                if (dist > 1.0)//(1==1)// use threshold to reduce number of nearby markers. this shouldnt be done here
-                {
-                    vis_->publishPoses(aligned_clouds_graph_->getLastCloud()->getCorrectedPose(), 0, "",
-                                       cloud->getUtime());
-                    vis_->publishPriorPoses(aligned_clouds_graph_->getLastCloud()->getPriorPose(), 0, "",
-                                       cloud->getUtime());
-                    vis_->publishOdomPoses(aligned_clouds_graph_->getLastCloud()->getOdomPose(), 0, "",
-                                       cloud->getUtime());
 
+        Eigen::Isometry3d odom_to_base = aligned_clouds_graph_->getLastCloud()->getOdomPose();
+        Eigen::Isometry3d map_to_base = aligned_clouds_graph_->getLastCloud()->getCorrectedPose();
 
-                    std::cout << "odom_to_map publish <<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<\n";
-                    Eigen::Isometry3d odom_to_base = aligned_clouds_graph_->getLastCloud()->getOdomPose();
-                    Eigen::Isometry3d map_to_base = aligned_clouds_graph_->getLastCloud()->getCorrectedPose();
+        Eigen::Isometry3d odom_to_map = (map_to_base * odom_to_base.inverse()).inverse();
+        vis_->publishOdomToMapPose(odom_to_map, cloud->getUtime());
 
-                    Eigen::Isometry3d odom_to_map = (map_to_base * odom_to_base.inverse()).inverse();
-                    vis_->publishOdomToMapPose(odom_to_map, cloud->getUtime());
+        if (Logger::isEnabled(LogLevel::DEBUG))
+        {
+            Eigen::Quaterniond q_corr = Eigen::Quaterniond(odom_to_map.rotation());
+            double r_corr, p_corr, y_corr;
+            quat_to_euler(q_corr, r_corr, p_corr, y_corr);
+            AICP_LOG_DEBUG("Main", "odom_to_map publish: " << odom_to_map.translation().transpose() << " xyz, "
+                           << r_corr*180/M_PI << " " << p_corr*180/M_PI << " " << y_corr*180/M_PI << " rpy");
+        }
 
-                    Eigen::Quaterniond q_corr = Eigen::Quaterniond(odom_to_map.rotation());
-                    double r_corr, p_corr, y_corr;
-                    quat_to_euler(q_corr, r_corr, p_corr, y_corr);
-                    std::cout << odom_to_map.translation().transpose() << " odom_to_map publish\n";
-                    std::cout << r_corr*180/M_PI << " " 
-                              << p_corr*180/M_PI << " " 
-                              << y_corr*180/M_PI << " rpy\n";
+    }
 
-                }
+    // Store aligned map and VISUALIZE
+    if(aligned_clouds_graph_->getLastCloud()->isReference())
+    {
+        // Loop closure detection running (see startLoopClosureDetection)
+        if (loop_closure_thread_.joinable())
+            loop_closure_queue_.push(aligned_clouds_graph_->getLastCloudId());
+        // vis_->publishPoses(aligned_clouds_graph_->getCurrentReference()->getCorrectedPose(), 0, "",
+        //                    cloud->getUtime());
+        reference_vis_ = aligned_clouds_graph_->getCurrentReference()->getCloud();
+        vis_->publishCloud(reference_vis_, 0, "", cloud->getUtime());
+        // Output map
+        addToAlignedMap(reference_vis_, aligned_clouds_graph_->getCurrentReference()->getCorrectedPose(),
+                        cloud->getUtime());
+    }
+    else if(cl_cfg_.localize_against_prior_map &&
+            (aligned_clouds_graph_->getNbClouds()-1) % cl_cfg_.reference_update_frequency == 0)
+    {
+        vis_->publishPoses(aligned_clouds_graph_->getLastCloud()->getCorrectedPose(),
+                           0, "", cloud->getUtime());
+        reference_vis_ = aligned_clouds_graph_->getLastCloud()->getCloud();
+        vis_->publishCloud(reference_vis_, 0, "", cloud->getUtime());
+        // Add last aligned reference to map
+        // (only points falling in empty voxels of the map are added)
+        if(cl_cfg_.merge_aligned_clouds_to_map && !shared_prior_map_)
+        {
+            std::unique_lock<std::mutex> lock(prior_map_mutex_);
+            prior_voxel_map_.insert(*output);
+            pcl::PointCloud<pcl::PointXYZ>::Ptr map_cloud = prior_voxel_map_.getCloud();
+            prior_map_->updateCloud(map_cloud, 0);
+            map_crop_.reset();
+        }
+    }
 
-                // Store aligned map and VISUALIZE
-                if(aligned_clouds_graph_->getLastCloud()->isReference())
-                {
-                    // vis_->publishPoses(aligned_clouds_graph_->getCurrentReference()->getCorrectedPose(), 0, "",
-                    //                    cloud->getUtime());
-                    reference_vis_ = aligned_clouds_graph_->getCurrentReference()->getCloud();
-                    vis_->publishCloud(reference_vis_, 0, "", cloud->getUtime());
-                    // Output map
-                    aligned_map_ = aligned_map_ + *reference_vis_;
-                    pcl::PointCloud<pcl::PointXYZ>::Ptr aligned_map_ptr = aligned_map_.makeShared();
-                    vis_->publishMap(aligned_map_ptr, cloud->getUtime(), 1);
-                }
-                else if(cl_cfg_.localize_against_prior_map &&
-                        (aligned_clouds_graph_->getNbClouds()-1) % cl_cfg_.reference_update_frequency == 0)
-                {
-                    vis_->publishPoses(aligned_clouds_graph_->getLastCloud()->getCorrectedPose(),
-                                       0, "", cloud->getUtime());
-                    reference_vis_ = aligned_clouds_graph_->getLastCloud()->getCloud();
-                    vis_->publishCloud(reference_vis_, 0, "", cloud->getUtime());
-                    // Add last aligned reference to map
-                    if(cl_cfg_.merge_aligned_clouds_to_map)
-                    {
-                        pcl::PointCloud<pcl::PointXYZ>::Ptr merged_map (new pcl::PointCloud<pcl::PointXYZ>);
-                        *merged_map = *(prior_map_->getCloud()) + *output;
-                        prior_map_->updateCloud(merged_map, 0);
-                    }
-                }
+    if (cl_cfg_.verbose)
+    {
+        // Publish aligned reading cloud
+        last_reading_vis_ = aligned_clouds_graph_->getLastCloud()->getCloud();
+
+        // Save aligned reading cloud to file
+        stringstream aligned_read;
+        aligned_read << data_directory_path_.str();
+        aligned_read << "/reading_aligned.pcd";
+        debug_writer_.writeCloud(aligned_read.str (), aligned_clouds_graph_->getLastCloud()->getCloud());
+    }
+    post_processing_timer.stop();
 
-                // Downsample prior map at very low frequency
-                // (once every 30 clouds -> amortized time)
-                if(cl_cfg_.localize_against_prior_map && cl_cfg_.merge_aligned_clouds_to_map &&
-                   (aligned_clouds_graph_->getNbClouds()-1) % 30 == 0)
-                {
-                    pcl::PointCloud<pcl::PointXYZ>::Ptr map_prefiltered (new pcl::PointCloud<pcl::PointXYZ>);
-                    regionGrowingUniformPlaneSegmentationFilter(prior_map_->getCloud(), map_prefiltered);
-                    prior_map_->updateCloud(map_prefiltered, 0);
-                }
+    if (Logger::isEnabled(LogLevel::DEBUG))
+    {
+        std::ostringstream summary;
+        summary << "Summary: reference " << aligned_clouds_graph_->getLastCloud()->getItsReferenceId()
+                << ", reading " << aligned_clouds_graph_->getLastCloudId()
+                << ", clouds " << aligned_clouds_graph_->getNbClouds();
+        if (cl_cfg_.graph_memory_budget > 0 || cl_cfg_.graph_compact_resolution > 0.0)
+            summary << " (" << aligned_clouds_graph_->getNbResidentClouds() << " resident)";
+        summary << ", output map " << aligned_map_.size() << " points";
+        if (cl_cfg_.load_map_from_file || cl_cfg_.localize_against_prior_map)
+        {
+            std::unique_lock<std::mutex> lock(prior_map_mutex_);
+            summary << ", prior map " << prior_map_->getCloud()->size() << " points";
+        }
+        summary << ", next reference " << aligned_clouds_graph_->getCurrentReferenceId()
+                << ", updates " << updates_counter_;
+        WorkQueue<AlignedCloudPtr>::Stats queue_stats = cloud_queue_.getStats();
+        summary << ", input queue " << queue_stats.popped << " processed, " << queue_stats.dropped
+                << " dropped, latency " << queue_stats.mean_latency << " sec (max "
+                << queue_stats.max_latency << " sec)";
+        MemoryReport memory;
+        getMemoryReport(memory);
+        summary << ", memory: " << formatMemoryReport(memory);
+        AICP_LOG_DEBUG("Main", summary.str());
+    }
+    setReferenceFinal(data.seq);
+}
 
-                if (cl_cfg_.verbose)
-                {
-                    // Publish aligned reading cloud
-                    last_reading_vis_ = aligned_clouds_graph_->getLastCloud()->getCloud();
-
-                    // Save aligned reading cloud to file
-                    stringstream aligned_read;
-                    aligned_read << data_directory_path_.str();
-                    aligned_read << "/reading_aligned.pcd";
-                    pcd_writer_.write<pcl::PointXYZ> (aligned_read.str (), *aligned_clouds_graph_->getLastCloud()->getCloud(), false);
-                }
-                TimingUtils::toc("postProcessing");
-                TimingUtils::toc("fullLoop");
-
-                cout << "============================" << endl
-                     << "[Main] Summary:" << endl
-                     << "============================" << endl;
-                cout << "Reference: " << aligned_clouds_graph_->getLastCloud()->getItsReferenceId() << endl;
-                cout << "Reading: " << aligned_clouds_graph_->getLastCloudId() << endl;
-                cout << "Number Clouds: " << aligned_clouds_graph_->getNbClouds() << endl;
-                cout << "Output Map Size: " << aligned_map_.size() << endl;
-                if (cl_cfg_.load_map_from_file || cl_cfg_.localize_against_prior_map)
-                    cout << "Prior Map Size: " << prior_map_->getCloud()->size() << endl;
-                cout << "Next Reference: " << aligned_clouds_graph_->getCurrentReferenceId() << endl;
-                cout << "Updates: " << updates_counter_ << endl;
+void App::processPipelined()
+{
+    // Readings processed in order by three stages connected with bounded queues:
+    // filter (this thread) -> overlap and alignment risk -> registration.
+    // The overlap stage of a reading waits until all previous readings
+    // can no longer change its reference.
+    BoundedQueue<ReadingDataPtr> filtered_queue (pipeline_queue_size);
+    BoundedQueue<ReadingDataPtr> assessed_queue (pipeline_queue_size);
+
+    std::thread assess_thread([&]()
+    {
+        TraceRecorder::setThreadName("aicp assess");
+        ReadingDataPtr data;
+        while (filtered_queue.pop(data))
+        {
+            {
+                std::unique_lock<std::mutex> lock(reference_mutex_);
+                reference_condition_.wait(lock, [&](){ return reference_final_seq_ >= data->seq - 1; });
             }
-            cout << "--------------------------------------------------------------------------------------" << endl;
+            runStage("assessReading", &App::assessReading, &ReadingData::assess_time, *data);
+            if (!data->changes_reference)
+                setReferenceFinal(data->seq);
+            ScopedSpan wait_span ("waitAssessedQueue");
+            assessed_queue.push(data);
+        }
+        assessed_queue.close();
+    });
 
+    std::thread align_thread([&]()
+    {
+        TraceRecorder::setThreadName("aicp align");
+        ReadingDataPtr data;
+        while (assessed_queue.pop(data))
+        {
+            runStage("alignReading", &App::alignReading, &ReadingData::align_time, *data);
+            updateDiagnostics(*data);
+            updateComputeLevel(*data);
+        }
+    });
+
+    while (running_) {
+        // Wait for clouds from the sensor callback (timeout to check running_)
+        AlignedCloudPtr cloud;
+        if (!cloud_queue_.pop(cloud, std::chrono::milliseconds(1000)))
+            continue;
+
+        // Filter (blocks while the next stages are busy)
+        ReadingDataPtr data (new ReadingData(cloud));
+        data->seq = ++reading_seq_;
+        runStage("filterReading", &App::filterReading, &ReadingData::filter_time, *data);
+        ScopedSpan wait_span ("waitFilteredQueue");
+        filtered_queue.push(data);
+    }
+
+    filtered_queue.close();
+    assess_thread.join();
+    align_thread.join();
+}
 
+void App::startLoopClosureDetection()
+{
+    if (cl_cfg_.loop_closure_detection && !loop_closure_thread_.joinable())
+        loop_closure_thread_ = std::thread(&App::detectLoopClosures, this);
 }
 
+void App::stopLoopClosureDetection()
+{
+    loop_closure_queue_.close();
+    if (loop_closure_thread_.joinable())
+        loop_closure_thread_.join();
+}
 
+void App::detectLoopClosures()
+{
+    TraceRecorder::setThreadName("aicp loop closure");
+    // Own overlapper and registrator (trees and reference of overlapper_ and registr_
+    // are used by the processing stages)
+    OctreesOverlap overlapper (overlap_params_);
+    std::unique_ptr<AbstractRegistrator> registrator = create_registrator(reg_params_);
+    LoopClosureIndex index (overlap_params_.loop_closure);
+
+    int reference_id;
+    while (loop_closure_queue_.pop(reference_id))
+    {
+        pcl::PointCloud<pcl::PointXYZ> reference_cloud;
+        Eigen::Isometry3d reference_pose;
+        {
+            std::unique_lock<std::mutex> lock(graph_mutex_);
+            if (!aligned_clouds_graph_->loadCloudAt(reference_id, reference_cloud))
+                continue;
+            reference_pose = aligned_clouds_graph_->getCloudAt(reference_id)->getCorrectedPose();
+        }
+        ScopedTimer loop_closure_detection_timer ("loopClosureDetection");
 
-void App::operator()() {
-    running_ = true;
-    while (running_) {
-        std::unique_lock<std::mutex> lock(worker_mutex_);
-        // Wait for notification from planarLidarHandler
-        worker_condition_.wait_for(lock, std::chrono::milliseconds(1000));
+        // Most similar past references, checked with full octrees overlap
+        PlaceDescriptor descriptor;
+        index.computeDescriptor(reference_cloud, reference_pose, reference_id, descriptor);
+        std::vector<int> candidates;
+        std::vector<float> distances;
+        index.getCandidates(descriptor, candidates, distances);
+        index.add(descriptor);
 
-        // Copy current workload from cloud queue to work queue
-        std::list<AlignedCloudPtr> work_queue;
+        for (size_t i = 0; i < candidates.size(); i++)
         {
-            std::unique_lock<std::mutex> lock(data_mutex_);
-            while (!cloud_queue_.empty()) {
-                work_queue.push_back(cloud_queue_.front());
-                cloud_queue_.pop_front();
+            pcl::PointCloud<pcl::PointXYZ> candidate_cloud;
+            Eigen::Isometry3d candidate_pose;
+            {
+                std::unique_lock<std::mutex> lock(graph_mutex_);
+                if (!aligned_clouds_graph_->loadCloudAt(candidates[i], candidate_cloud))
+                    continue;
+                candidate_pose = aligned_clouds_graph_->getCloudAt(candidates[i])->getCorrectedPose();
             }
+            float overlap = overlapper.computeLoopClosureOverlap(reference_cloud, candidate_cloud,
+                                                                 reference_pose, candidate_pose);
+            if (overlap < overlap_params_.loop_closure.minOverlap)
+                continue;
+
+            // Reference registered onto candidate
+            Eigen::Matrix4f correction;
+            registrator->registerClouds(candidate_cloud, reference_cloud, correction);
+
+            LoopClosure loop_closure;
+            loop_closure.reference_id = reference_id;
+            loop_closure.candidate_id = candidates[i];
+            loop_closure.overlap = overlap;
+            loop_closure.distance = distances[i];
+            loop_closure.relative_pose = candidate_pose.inverse() * fromMatrix4fToIsometry3d(correction) *
+                                         reference_pose;
+            {
+                std::unique_lock<std::mutex> lock(loop_closures_mutex_);
+                loop_closures_.push_back(loop_closure);
+            }
+            AICP_LOG_INFO("Main", "LOOP CLOSURE: reference " << reference_id << " with " << candidates[i]
+                          << " (overlap: " << overlap << " %, distance: " << distances[i] << ")");
         }
+        loop_closure_detection_timer.stop();
+    }
+}
+
+void App::startStream()
+{
+    if (cl_cfg_.pipelined_processing)
+        AICP_LOG_WARN("Main", "Pipelined processing not available for server streams, disabled.");
+    cl_cfg_.pipelined_processing = false;
+    running_ = true;
+    startLoopClosureDetection();
+}
+
+void App::stopStream()
+{
+    running_ = false;
+    stopLoopClosureDetection();
+}
 
-        // Process workload
-        for (auto cloud : work_queue) {
+bool App::processQueuedCloud()
+{
+    AlignedCloudPtr cloud;
+    if (!cloud_queue_.pop(cloud, std::chrono::milliseconds(0)))
+        return false;
+    processCloud(cloud);
+    return true;
+}
+
+void App::operator()() {
+    TraceRecorder::setThreadName(cl_cfg_.pipelined_processing ? "aicp filter" : "aicp worker");
+    running_ = true;
+    startLoopClosureDetection();
+    if (cl_cfg_.pipelined_processing)
+    {
+        processPipelined();
+        stopLoopClosureDetection();
+        return;
+    }
+
+    while (running_) {
+        // Wait for clouds from the sensor callback (timeout to check running_)
+        AlignedCloudPtr cloud;
+        if (cloud_queue_.pop(cloud, std::chrono::milliseconds(1000)))
             processCloud(cloud);
-        }
     }
+    stopLoopClosureDetection();
 }
 } // namespace aicp
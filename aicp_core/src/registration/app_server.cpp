@@ -0,0 +1,128 @@
+#include "aicp_registration/app_server.hpp"
+
+#include "aicp_utils/logging.hpp"
+#include "aicp_utils/traceRecorder.hpp"
+
+#include <algorithm>
+#include <functional>
+
+namespace aicp {
+
+AppServer::AppServer(int num_threads) :
+    num_threads_(num_threads), next_stream_(0), running_(false)
+{
+}
+
+AppServer::~AppServer()
+{
+    stop();
+}
+
+void AppServer::addStream(const std::shared_ptr<App>& app)
+{
+    if (running_)
+    {
+        AICP_LOG_ERROR("Server", "Streams must be added before start, stream ignored.");
+        return;
+    }
+    streams_.push_back(std::unique_ptr<Stream>(new Stream(app)));
+    app->setCloudQueuedCallback(std::bind(&AppServer::notifyWork, this));
+}
+
+void AppServer::start()
+{
+    if (running_ || streams_.empty())
+        return;
+    int num_threads = num_threads_ > 0 ? num_threads_ : std::max((int)std::thread::hardware_concurrency(), 1);
+    num_threads = std::min(num_threads, (int)streams_.size());
+
+    for (size_t i = 0; i < streams_.size(); i++)
+        streams_[i]->app->startStream();
+    running_ = true;
+    for (int i = 0; i < num_threads; i++)
+        threads_.push_back(std::thread(&AppServer::work, this));
+    AICP_LOG_INFO("Server", "Processing " << streams_.size() << " streams with " << num_threads << " threads.");
+}
+
+void AppServer::stop()
+{
+    if (!running_)
+        return;
+    running_ = false;
+    {
+        std::unique_lock<std::mutex> lock(work_mutex_);
+    }
+    work_condition_.notify_all();
+    for (size_t i = 0; i < threads_.size(); i++)
+        threads_[i].join();
+    threads_.clear();
+    for (size_t i = 0; i < streams_.size(); i++)
+        streams_[i]->app->stopStream();
+}
+
+bool AppServer::setPriorMap(const pcl::PointCloud<pcl::PointXYZ>& map_cloud, float leaf_size,
+                            float tile_size, int64_t utime)
+{
+    std::unique_lock<std::mutex> lock(prior_map_mutex_);
+    for (size_t i = 0; i < streams_.size(); i++)
+    {
+        if (streams_[i]->app->isLocalizing())
+        {
+            AICP_LOG_WARN("Server", "Prior map cannot be updated after localization started!");
+            return false;
+        }
+    }
+    std::shared_ptr<VoxelMap> map (new VoxelMap(leaf_size, tile_size));
+    map->setCloud(map_cloud);
+    for (size_t i = 0; i < streams_.size(); i++)
+        streams_[i]->app->setSharedPriorMap(map, utime);
+    AICP_LOG_INFO("Server", "Prior map of " << map->size() << " points shared by "
+                  << streams_.size() << " streams.");
+    return true;
+}
+
+void AppServer::work()
+{
+    TraceRecorder::setThreadName("aicp server worker");
+    while (running_)
+    {
+        // One cloud per stream and turn, starting from the stream after the last one served
+        bool processed = false;
+        size_t first = next_stream_++;
+        for (size_t i = 0; i < streams_.size() && !processed; i++)
+        {
+            Stream& stream = *streams_[(first + i) % streams_.size()];
+            bool busy = false;
+            if (!stream.busy.compare_exchange_strong(busy, true))
+                continue;
+            processed = stream.app->processQueuedCloud();
+            stream.busy = false;
+            // Clouds queued meanwhile: an idle thread may take the stream
+            if (processed && stream.app->hasQueuedCloud())
+                notifyWork();
+        }
+        if (!processed)
+        {
+            std::unique_lock<std::mutex> lock(work_mutex_);
+            work_condition_.wait(lock, [this](){ return !running_ || hasWork(); });
+        }
+    }
+}
+
+bool AppServer::hasWork() const
+{
+    for (size_t i = 0; i < streams_.size(); i++)
+        if (!streams_[i]->busy && streams_[i]->app->hasQueuedCloud())
+            return true;
+    return false;
+}
+
+void AppServer::notifyWork()
+{
+    {
+        std::unique_lock<std::mutex> lock(work_mutex_);
+    }
+    work_condition_.notify_one();
+}
+
+} // namespace aicp
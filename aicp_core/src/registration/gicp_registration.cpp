@@ -0,0 +1,321 @@
+#include "aicp_registration/gicp_registration.hpp"
+#include "aicp_utils/logging.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+#include <pcl/common/io.h>
+#include <pcl/kdtree/kdtree_flann.h>
+#include <pcl/common/transforms.h>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+namespace aicp{
+
+  // Covariance of a point along its normal (1 along the plane)
+  static const double gicp_epsilon = 0.001;
+
+  GICPRegistration::GICPRegistration() :
+          reference_id_(-1), reference_set_(false), outlier_ratio_(1.0f), max_match_distance_(0.0f),
+          initial_guess_(Eigen::Matrix4f::Identity()), initial_guess_set_(false),
+          reference_cloud_(new pcl::PointCloud<pcl::PointXYZ>),
+          reading_cloud_(new pcl::PointCloud<pcl::PointXYZ>) {
+    applyConfig();
+  }
+
+  GICPRegistration::GICPRegistration(const RegistrationParams& params) :
+          params_(params), reference_id_(-1), reference_set_(false), outlier_ratio_(1.0f), max_match_distance_(0.0f),
+          initial_guess_(Eigen::Matrix4f::Identity()), initial_guess_set_(false),
+          reference_cloud_(new pcl::PointCloud<pcl::PointXYZ>),
+          reading_cloud_(new pcl::PointCloud<pcl::PointXYZ>) {
+    applyConfig();
+  }
+
+  GICPRegistration::~GICPRegistration() {}
+
+  void GICPRegistration::applyConfig()
+  {
+    num_threads_ = params_.gicp.numThreads;
+#ifdef _OPENMP
+    if (num_threads_ <= 0)
+      num_threads_ = omp_get_max_threads();
+#else
+    num_threads_ = 1;
+#endif
+    gicp_.setCorrespondenceRandomness(params_.gicp.kCorrespondences);
+    gicp_.setMaxCorrespondenceDistance(params_.gicp.maxCorrespondenceDistance);
+    gicp_.setMaximumIterations(params_.gicp.maxIterations);
+    gicp_.setTransformationEpsilon(params_.gicp.transformationEpsilon);
+  }
+
+  void GICPRegistration::setOutlierRatio(float ratio)
+  {
+    outlier_ratio_ = ratio;
+    float distance = ratio * params_.gicp.maxCorrespondenceDistance;
+    if (max_match_distance_ > 0.0f)
+      distance = std::min(distance, max_match_distance_);
+    gicp_.setMaxCorrespondenceDistance(distance);
+  }
+
+  void GICPRegistration::setMaxMatchDistance(float distance)
+  {
+    max_match_distance_ = distance;
+    setOutlierRatio(outlier_ratio_);
+  }
+
+  void GICPRegistration::setMaxIterationCount(int max_iterations)
+  {
+    gicp_.setMaximumIterations(max_iterations > 0 ? max_iterations : params_.gicp.maxIterations);
+  }
+
+  void GICPRegistration::computeCovariances(const pcl::PointCloud<pcl::PointXYZ>::Ptr& cloud, int k,
+                                            int num_threads, MatricesVector& covariances)
+  {
+    pcl::KdTreeFLANN<pcl::PointXYZ> tree;
+    tree.setInputCloud(cloud);
+    const int nb_points = cloud->size();
+    covariances.resize(nb_points);
+
+    #pragma omp parallel for num_threads(num_threads) schedule(dynamic, 256)
+    for (int i = 0; i < nb_points; i++)
+    {
+      std::vector<int> neighbours;
+      std::vector<float> distances;
+      tree.nearestKSearch(cloud->points[i], k, neighbours, distances);
+
+      Eigen::Vector3d mean = Eigen::Vector3d::Zero();
+      Eigen::Matrix3d covariance = Eigen::Matrix3d::Zero();
+      for (size_t j = 0; j < neighbours.size(); j++)
+      {
+        Eigen::Vector3d p = cloud->points[neighbours[j]].getVector3fMap().cast<double>();
+        mean += p;
+        covariance += p * p.transpose();
+      }
+      if (neighbours.size() < 3)
+      {
+        covariances[i] = Eigen::Matrix3d::Identity();
+        continue;
+      }
+      mean /= neighbours.size();
+      covariance = covariance / neighbours.size() - mean * mean.transpose();
+
+      // Plane-like regularization: smallest eigenvalue (normal direction) to epsilon, others to 1
+      Eigen::SelfAdjointEigenSolver<Eigen::Matrix3d> solver(covariance);
+      Eigen::Vector3d values (gicp_epsilon, 1.0, 1.0);
+      covariances[i] = solver.eigenvectors() * values.asDiagonal() * solver.eigenvectors().transpose();
+    }
+  }
+
+  void GICPRegistration::computeCovariances(const pcl::PointCloud<pcl::PointXYZRGBNormal>& cloud,
+                                            int num_threads, MatricesVector& covariances)
+  {
+    const int nb_points = cloud.size();
+    covariances.resize(nb_points);
+
+    #pragma omp parallel for num_threads(num_threads)
+    for (int i = 0; i < nb_points; i++)
+    {
+      Eigen::Vector3d n = cloud.points[i].getNormalVector3fMap().cast<double>();
+      double norm = n.norm();
+      if (!std::isfinite(norm) || norm < 1e-6)
+      {
+        covariances[i] = Eigen::Matrix3d::Identity();
+        continue;
+      }
+      n /= norm;
+      // Same as eigenvectors * diag(epsilon, 1, 1) * eigenvectors^T with the normal as first eigenvector
+      covariances[i] = Eigen::Matrix3d::Identity() - (1.0 - gicp_epsilon) * n * n.transpose();
+    }
+  }
+
+  void GICPRegistration::registerClouds(pcl::PointCloud<pcl::PointXYZ>& cloud_ref, pcl::PointCloud<pcl::PointXYZ>& cloud_read, Eigen::Matrix4f &final_transform)
+  {
+    setReference(cloud_ref);
+    return registerReading(cloud_read, final_transform);
+  }
+
+  void GICPRegistration::registerClouds(pcl::PointCloud<pcl::PointXYZRGB>& cloud_ref, pcl::PointCloud<pcl::PointXYZRGB>& cloud_read, Eigen::Matrix4f &final_transform)
+  {
+    pcl::PointCloud<pcl::PointXYZ> ref_xyz, read_xyz;
+    pcl::copyPointCloud(cloud_ref, ref_xyz);
+    pcl::copyPointCloud(cloud_read, read_xyz);
+    return registerClouds(ref_xyz, read_xyz, final_transform);
+  }
+
+  void GICPRegistration::registerClouds(pcl::PointCloud<pcl::PointXYZRGBNormal>& cloud_ref, pcl::PointCloud<pcl::PointXYZRGBNormal>& cloud_read, Eigen::Matrix4f &final_transform)
+  {
+    setReference(cloud_ref);
+    return registerReading(cloud_read, final_transform);
+  }
+
+  // Covariances from normals (no neighbours search)
+  void GICPRegistration::setReference(pcl::PointCloud<pcl::PointXYZRGBNormal>& cloud_ref, int id)
+  {
+    if (id != -1 && id == reference_id_ && reference_set_)
+      return;
+
+    reference_cloud_.reset(new pcl::PointCloud<pcl::PointXYZ>);
+    pcl::copyPointCloud(cloud_ref, *reference_cloud_);
+    reference_set_ = false;
+    if (reference_cloud_->empty())
+      return;
+    MatricesVectorPtr covariances (new MatricesVector);
+    computeCovariances(cloud_ref, num_threads_, *covariances);
+    setTarget(covariances, id);
+  }
+
+  void GICPRegistration::registerReading(pcl::PointCloud<pcl::PointXYZRGBNormal>& cloud_read, Eigen::Matrix4f &final_transform)
+  {
+    reading_cloud_.reset(new pcl::PointCloud<pcl::PointXYZ>);
+    pcl::copyPointCloud(cloud_read, *reading_cloud_);
+    MatricesVectorPtr covariances (new MatricesVector);
+    computeCovariances(cloud_read, num_threads_, *covariances);
+
+    return registerClouds(covariances, final_transform);
+  }
+
+  void GICPRegistration::setReference(pcl::PointCloud<pcl::PointXYZ>& cloud_ref, int id)
+  {
+    if (id != -1 && id == reference_id_ && reference_set_)
+      return;
+
+    reference_cloud_ = cloud_ref.makeShared();
+    reference_set_ = false;
+    if (reference_cloud_->empty())
+      return;
+    MatricesVectorPtr covariances (new MatricesVector);
+    computeCovariances(reference_cloud_, params_.gicp.kCorrespondences, num_threads_, *covariances);
+    setTarget(covariances, id);
+  }
+
+  void GICPRegistration::setTarget(const MatricesVectorPtr& covariances, int id)
+  {
+    // Target KD-tree built here, shared with hypotheses (not re-built at alignment)
+    target_tree_.reset(new pcl::search::KdTree<pcl::PointXYZ>);
+    target_tree_->setInputCloud(reference_cloud_);
+    target_covariances_ = covariances;
+    gicp_.setInputTarget(reference_cloud_);
+    gicp_.setSearchMethodTarget(target_tree_, true);
+    gicp_.setTargetCovariances(covariances);
+    reference_id_ = id;
+    reference_set_ = true;
+  }
+
+  void GICPRegistration::registerReading(pcl::PointCloud<pcl::PointXYZ>& cloud_read, Eigen::Matrix4f &final_transform)
+  {
+    reading_cloud_ = cloud_read.makeShared();
+    MatricesVectorPtr covariances (new MatricesVector);
+    if (!reading_cloud_->empty())
+      computeCovariances(reading_cloud_, params_.gicp.kCorrespondences, num_threads_, *covariances);
+
+    return registerClouds(covariances, final_transform);
+  }
+
+  int GICPRegistration::registerReading(pcl::PointCloud<pcl::PointXYZ>& cloud_read, const TransformsVector& initial_transforms,
+                                        Eigen::Matrix4f &final_transform)
+  {
+    final_transform = Eigen::Matrix4f::Identity();
+    initial_guess_set_ = false; // hypotheses carry their own initial transforms
+    reading_cloud_ = cloud_read.makeShared();
+    if (!reference_set_ || reading_cloud_->empty())
+    {
+      std::cerr << "[GICP] Empty input point clouds." << std::endl;
+      return -1;
+    }
+    MatricesVectorPtr covariances (new MatricesVector);
+    computeCovariances(reading_cloud_, params_.gicp.kCorrespondences, num_threads_, *covariances);
+
+    if (!pool_)
+      pool_.reset(new ThreadPool(params_.initialization.numThreads));
+
+    HypothesesVector hypotheses (initial_transforms.size());
+    std::vector<std::future<void> > results;
+    for (size_t i = 0; i < initial_transforms.size(); i++)
+    {
+      results.push_back(pool_->enqueue([&, i]()
+      {
+        // Same settings and target (tree, covariances) as gicp_
+        GICP gicp;
+        gicp.setCorrespondenceRandomness(params_.gicp.kCorrespondences);
+        gicp.setMaxCorrespondenceDistance(gicp_.getMaxCorrespondenceDistance());
+        gicp.setMaximumIterations(gicp_.getMaximumIterations());
+        gicp.setTransformationEpsilon(gicp_.getTransformationEpsilon());
+        gicp.setInputTarget(reference_cloud_);
+        gicp.setSearchMethodTarget(target_tree_, true);
+        gicp.setTargetCovariances(target_covariances_);
+        gicp.setInputSource(reading_cloud_);
+        gicp.setSourceCovariances(covariances);
+
+        pcl::PointCloud<pcl::PointXYZ> output;
+        gicp.align(output, initial_transforms[i]);
+        hypotheses[i].transform = gicp.getFinalTransformation();
+        scoreAlignment(*target_tree_, *reading_cloud_, params_.initialization.maxDistance, hypotheses[i]);
+      }));
+    }
+    for (size_t i = 0; i < results.size(); i++)
+      results[i].get();
+
+    int best = selectBestHypothesis(hypotheses);
+    if (best < 0)
+    {
+      std::cerr << "[GICP] No valid hypothesis." << std::endl;
+      return best;
+    }
+    AICP_LOG_DEBUG("GICP", "Best of " << hypotheses.size() << " hypotheses: " << best
+                   << " (residual: " << hypotheses[best].residual << " m, inliers: "
+                   << hypotheses[best].inlier_ratio * 100 << " %)");
+
+    final_transform = hypotheses[best].transform;
+    quality_ = RegistrationQuality();
+    pcl::transformPointCloud(*reading_cloud_, out_read_cloud_, final_transform);
+    return best;
+  }
+
+  //Registration: Compute transform which aligns reading cloud onto the reference cloud.
+  void GICPRegistration::registerClouds(const MatricesVectorPtr& reading_covariances, Eigen::Matrix4f &final_transform)
+  {
+    // Used by this registration only
+    Eigen::Matrix4f init_transform = initial_guess_set_ ? initial_guess_ : Eigen::Matrix4f::Identity();
+    initial_guess_set_ = false;
+    if (!reference_set_ || reference_cloud_->empty() || reading_cloud_->empty())
+    {
+      std::cerr << "[GICP] Empty input point clouds." << std::endl;
+      final_transform = Eigen::Matrix4f::Identity();
+      quality_ = RegistrationQuality();
+      return;
+    }
+
+    // Source covariances are reset by setInputSource
+    gicp_.setInputSource(reading_cloud_);
+    gicp_.setSourceCovariances(reading_covariances);
+
+    gicp_.align(out_read_cloud_, init_transform);
+    final_transform = gicp_.getFinalTransformation();
+
+    // Residuals of the aligned reading within the correspondence distance
+    // (reference KD-tree of the registration reused)
+    const float max_sq_distance = gicp_.getMaxCorrespondenceDistance() * gicp_.getMaxCorrespondenceDistance();
+    const int nb_points = out_read_cloud_.size();
+    std::vector<float> sq_distances (nb_points, -1.0f);
+    #pragma omp parallel for num_threads(num_threads_) schedule(dynamic, 256)
+    for (int i = 0; i < nb_points; i++)
+    {
+      std::vector<int> index (1);
+      std::vector<float> sq_distance (1);
+      if (target_tree_->nearestKSearch(out_read_cloud_.points[i], 1, index, sq_distance) > 0 &&
+          sq_distance[0] <= max_sq_distance)
+        sq_distances[i] = sq_distance[0];
+    }
+    residuals_.clear();
+    for (int i = 0; i < nb_points; i++)
+    {
+      if (sq_distances[i] >= 0.0f)
+        residuals_.push_back(std::sqrt(sq_distances[i]));
+    }
+    quality_.setResiduals(residuals_);
+
+    AICP_LOG_DEBUG("GICP", "Converged: " << gicp_.hasConverged());
+  }
+}
@@ -1,59 +1,414 @@
 #include "aicp_registration/pointmatcher_registration.hpp"
+#include "aicp_utils/logging.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <mutex>
+#include <sstream>
+
+#include <pcl/search/kdtree.h>
 
 namespace aicp{
 
-  PointmatcherRegistration::PointmatcherRegistration()  {}
+  // Eigenvalues below this ratio of the largest one: degenerate direction
+  static const float degenerate_eigenvalue_ratio = 0.01;
+
+  // Chain parsing and module creation are not thread safe (global logger and registrars):
+  // serialized across registrators (e.g. loop closure thread and align stage)
+  static std::mutex chain_loading_mutex;
+
+  // Normal equations of the matched pairs: point-to-plane if the reference has normals,
+  // point-to-point otherwise (only its rotation part tells about degeneracy)
+  static void estimateDegeneracy(const PM::ErrorMinimizer::ErrorElements& matched, DegeneracyEstimate& estimate)
+  {
+    const int nb_matches = matched.reading.getNbPoints();
+    Eigen::Matrix3Xf points = matched.reading.features.topRows(3);
+    points.colwise() -= points.rowwise().mean();
+    const float spread = std::sqrt(points.colwise().squaredNorm().mean());
+    if (spread > 0.0f)
+      points /= spread;
+    Eigen::RowVectorXf weights = Eigen::RowVectorXf::Ones(nb_matches);
+    if (matched.weights.cols() == nb_matches)
+      weights = matched.weights.row(0);
+
+    Eigen::Matrix<float, 6, 6> system;
+    if (matched.reference.descriptorExists("normals", 3))
+    {
+      // Rows of A: [p x n, n] (rotation about the centroid, translation)
+      const Eigen::Matrix3Xf normals = matched.reference.getDescriptorViewByName("normals");
+      Eigen::Matrix<float, 6, Eigen::Dynamic> jacobian (6, nb_matches);
+      jacobian.row(0) = points.row(1).cwiseProduct(normals.row(2)) - points.row(2).cwiseProduct(normals.row(1));
+      jacobian.row(1) = points.row(2).cwiseProduct(normals.row(0)) - points.row(0).cwiseProduct(normals.row(2));
+      jacobian.row(2) = points.row(0).cwiseProduct(normals.row(1)) - points.row(1).cwiseProduct(normals.row(0));
+      jacobian.bottomRows(3) = normals;
+      system = jacobian * weights.asDiagonal() * jacobian.transpose();
+    }
+    else
+    {
+      // A = [-[p]x, I] per point: sum of [|p|^2 I - p p^T, [p]x; -[p]x, I]
+      const Eigen::Matrix3Xf weighted = points * weights.asDiagonal();
+      const Eigen::Vector3f sum = weighted.rowwise().sum();
+      Eigen::Matrix3f cross;
+      cross << 0.0f, -sum(2), sum(1),
+               sum(2), 0.0f, -sum(0),
+               -sum(1), sum(0), 0.0f;
+      system.topLeftCorner<3,3>() = weighted.cwiseProduct(points).sum() * Eigen::Matrix3f::Identity() -
+                                    weighted * points.transpose();
+      system.topRightCorner<3,3>() = cross;
+      system.bottomLeftCorner<3,3>() = -cross;
+      system.bottomRightCorner<3,3>() = weights.sum() * Eigen::Matrix3f::Identity();
+    }
+
+    std::vector<float> predictions;
+    registrationFailurePredictionFilter(system, predictions);
+    estimate.degeneracy = predictions[0];
+    estimate.inverse_condition_number = predictions[1];
+
+    // Eigenvalues in increasing order
+    Eigen::SelfAdjointEigenSolver<Eigen::Matrix<float, 6, 6> > es(system);
+    const float threshold = degenerate_eigenvalue_ratio * es.eigenvalues()(5);
+    estimate.nb_degenerate = 0;
+    while (estimate.nb_degenerate < 6 && es.eigenvalues()(estimate.nb_degenerate) < threshold)
+      estimate.nb_degenerate ++;
+    estimate.directions = es.eigenvectors();
+    if (estimate.nb_degenerate > 0)
+      AICP_LOG_DEBUG("Pointmatcher", "Degenerate directions: " << estimate.nb_degenerate
+                     << " (degeneracy: " << estimate.degeneracy << " %)");
+  }
+
+  // Adaptive termination: stops the ICP once the per-iteration transform change has decayed,
+  // i.e. stays below ratio times its peak (or below the min changes) for window iterations.
+  // Counts the iterations of the last registration.
+  class ConvergenceProfileChecker : public PM::TransformationChecker
+  {
+  public:
+    ConvergenceProfileChecker(float ratio, int window, float min_translation, float min_rotation) :
+      ratio_(ratio), window_(std::max(window, 1)), min_translation_(min_translation), min_rotation_(min_rotation),
+      peak_translation_(0.0f), peak_rotation_(0.0f), nb_slow_(0), nb_iterations_(0), converged_(false)
+    {
+      limits.setZero(2);
+      conditionVariables.setZero(2);
+      limitNames.push_back("Translation change");
+      limitNames.push_back("Rotation change");
+      conditionVariableNames.push_back("Translation change");
+      conditionVariableNames.push_back("Rotation change");
+    }
+
+    void init(const PM::TransformationParameters& parameters, bool& iterate)
+    {
+      previous_ = parameters;
+      peak_translation_ = 0.0f;
+      peak_rotation_ = 0.0f;
+      nb_slow_ = 0;
+      nb_iterations_ = 0;
+      converged_ = false;
+    }
+
+    void check(const PM::TransformationParameters& parameters, bool& iterate)
+    {
+      // Change of this iteration (2D or 3D rigid transforms)
+      const int dim = parameters.rows() - 1;
+      const PM::TransformationParameters delta = previous_.inverse() * parameters;
+      previous_ = parameters;
+      const float translation = delta.topRightCorner(dim, 1).norm();
+      float rotation;
+      if (dim == 2)
+        rotation = std::fabs(std::atan2(delta(1,0), delta(0,0)));
+      else
+        rotation = std::acos(std::min(1.0f, std::max(-1.0f, 0.5f * (delta.topLeftCorner(3,3).trace() - 1.0f))));
+      nb_iterations_ ++;
+
+      peak_translation_ = std::max(peak_translation_, translation);
+      peak_rotation_ = std::max(peak_rotation_, rotation);
+      conditionVariables << translation, rotation;
+      limits << std::max(min_translation_, ratio_ * peak_translation_),
+                std::max(min_rotation_, ratio_ * peak_rotation_);
+      if (translation <= limits(0) && rotation <= limits(1))
+        nb_slow_ ++;
+      else
+        nb_slow_ = 0;
+      if (nb_slow_ >= window_)
+      {
+        converged_ = true;
+        iterate = false;
+      }
+    }
+
+    int getNbIterations() const { return nb_iterations_; }
+    bool getConverged() const { return converged_; }
+
+  private:
+    const float ratio_;
+    const int window_;
+    const float min_translation_;
+    const float min_rotation_;
+    PM::TransformationParameters previous_;
+    float peak_translation_;
+    float peak_rotation_;
+    int nb_slow_;       // consecutive iterations below the limits
+    int nb_iterations_;
+    bool converged_;
+  };
+
+  // Adaptive termination checker of a chain (NULL if none)
+  static const ConvergenceProfileChecker* getConvergenceChecker(const PM::ICPSequence& icp)
+  {
+    for (size_t i = 0; i < icp.transformationCheckers.size(); i++)
+    {
+      const ConvergenceProfileChecker* checker =
+        dynamic_cast<const ConvergenceProfileChecker*>(icp.transformationCheckers[i].get());
+      if (checker)
+        return checker;
+    }
+    return NULL;
+  }
+
+  // Iterations of the last registration of a chain (-1 if not counted)
+  static int getChainIterations(const PM::ICPSequence& icp)
+  {
+    const ConvergenceProfileChecker* checker = getConvergenceChecker(icp);
+    if (checker)
+      return checker->getNbIterations();
+    // Counted by the CounterTransformationChecker (if any)
+    for (size_t i = 0; i < icp.transformationCheckers.size(); i++)
+    {
+      if (icp.transformationCheckers[i]->className == "CounterTransformationChecker")
+        return (int)icp.transformationCheckers[i]->getConditionVariables()(0);
+    }
+    return -1;
+  }
+
+  PointmatcherRegistration::PointmatcherRegistration() :
+          chains_(&chain_sets_[0]), input_normals_(false), outlier_ratio_(-1.0), max_iteration_count_(-1),
+          max_match_distance_(-1.0f), initial_guess_(Eigen::Matrix4f::Identity()), initial_guess_set_(false),
+          nb_iterations_(-1), nb_coarse_iterations_(-1), converged_(-1), inlier_ratio_(-1.0f) {}
 
   PointmatcherRegistration::PointmatcherRegistration(const RegistrationParams& params) :
-          params_(params) {
+          params_(params), chains_(&chain_sets_[0]), input_normals_(false), outlier_ratio_(-1.0), max_iteration_count_(-1),
+          max_match_distance_(-1.0f), initial_guess_(Eigen::Matrix4f::Identity()), initial_guess_set_(false),
+          nb_iterations_(-1), nb_coarse_iterations_(-1), converged_(-1), inlier_ratio_(-1.0f) {
   }
 
   PointmatcherRegistration::~PointmatcherRegistration() {}
 
-  //Templates
-  void PointmatcherRegistration::registerClouds(pcl::PointCloud<pcl::PointXYZ>& cloud_ref, pcl::PointCloud<pcl::PointXYZ>& cloud_read, Eigen::Matrix4f &final_transform)
+  // Point type front-end: descriptors (colors, normals) set by the cloudIO conversions
+  template <typename PointT>
+  void PointmatcherRegistration::setReferenceCloud(pcl::PointCloud<PointT>& cloud_ref, int id, bool normals)
   {
-    DP empty;
-    reference_cloud_ = empty;
-    reading_cloud_ = empty;
-    fromPCLToDataPoints(reference_cloud_, cloud_ref);
-    fromPCLToDataPoints(reading_cloud_, cloud_read);
+    if (input_normals_ != normals)
+    {
+      // Chains of the other reference type (without (with) normals estimation): kept with
+      // their map and matcher, in-memory tuning brought up to date
+      input_normals_ = normals;
+      chains_ = &chain_sets_[normals ? 1 : 0];
+      if (chains_->loaded)
+        applyTuning();
+    }
+    if (id != -1 && id == chains_->reference_id && chains_->loaded && chains_->icp.hasMap())
+      return;
 
-    return registerClouds(final_transform);
+    fromPCLToDataPoints(chains_->reference_cloud, cloud_ref); // overwrites previous reference
+    chains_->reference_id = id;
+    setMap();
   }
 
-  void PointmatcherRegistration::registerClouds(pcl::PointCloud<pcl::PointXYZRGB>& cloud_ref, pcl::PointCloud<pcl::PointXYZRGB>& cloud_read, Eigen::Matrix4f &final_transform)
+  template <typename PointT>
+  void PointmatcherRegistration::registerReadingCloud(pcl::PointCloud<PointT>& cloud_read, Eigen::Matrix4f &final_transform)
   {
-    DP empty;
-    reference_cloud_ = empty;
-    reading_cloud_ = empty;
-    fromPCLToDataPoints(reference_cloud_, cloud_ref);
     fromPCLToDataPoints(reading_cloud_, cloud_read);
 
     return registerClouds(final_transform);
   }
 
+  void PointmatcherRegistration::registerClouds(pcl::PointCloud<pcl::PointXYZ>& cloud_ref, pcl::PointCloud<pcl::PointXYZ>& cloud_read, Eigen::Matrix4f &final_transform)
+  {
+    setReferenceCloud(cloud_ref, -1, false);
+    return registerReadingCloud(cloud_read, final_transform);
+  }
+
+  void PointmatcherRegistration::registerClouds(pcl::PointCloud<pcl::PointXYZRGB>& cloud_ref, pcl::PointCloud<pcl::PointXYZRGB>& cloud_read, Eigen::Matrix4f &final_transform)
+  {
+    setReferenceCloud(cloud_ref, -1, false);
+    return registerReadingCloud(cloud_read, final_transform);
+  }
+
   void PointmatcherRegistration::registerClouds(pcl::PointCloud<pcl::PointXYZRGBNormal>& cloud_ref, pcl::PointCloud<pcl::PointXYZRGBNormal>& cloud_read, Eigen::Matrix4f &final_transform)
   {
-//    DP empty;
-//    reference_cloud_ = empty;
-//    reading_cloud_ = empty;
-//    fromPCLToDataPoints(reference_cloud_, cloud_ref);
-//    fromPCLToDataPoints(reading_cloud_, cloud_read);
+    setReferenceCloud(cloud_ref, -1, true);
+    return registerReadingCloud(cloud_read, final_transform);
+  }
 
-//    return registerClouds(final_transform);
+  void PointmatcherRegistration::setReference(pcl::PointCloud<pcl::PointXYZ>& cloud_ref, int id)
+  {
+    setReferenceCloud(cloud_ref, id, false);
   }
 
-  //Load and apply configuration
-  void PointmatcherRegistration::applyConfig()
+  void PointmatcherRegistration::registerReading(pcl::PointCloud<pcl::PointXYZ>& cloud_read, Eigen::Matrix4f &final_transform)
+  {
+    return registerReadingCloud(cloud_read, final_transform);
+  }
+
+  void PointmatcherRegistration::setReference(pcl::PointCloud<pcl::PointXYZRGBNormal>& cloud_ref, int id)
+  {
+    setReferenceCloud(cloud_ref, id, true); // "normals" descriptor
+  }
+
+  void PointmatcherRegistration::registerReading(pcl::PointCloud<pcl::PointXYZRGBNormal>& cloud_read, Eigen::Matrix4f &final_transform)
+  {
+    return registerReadingCloud(cloud_read, final_transform);
+  }
+
+  // ICPSequence::setMap takes the map as it is: the reference filters of the chain
+  // (e.g. normals for point-to-plane) are applied on a copy of the reference first
+  static void setFilteredMap(PM::ICPSequence& icp, DP map)
+  {
+    icp.referenceDataPointsFilters.init();
+    icp.referenceDataPointsFilters.apply(map);
+    icp.setMap(map);
+  }
+
+  void PointmatcherRegistration::setMap()
+  {
+    int cloud_dimension = chains_->reference_cloud.getEuclideanDim();
+
+    if (!(cloud_dimension == 3))
+    {
+      cerr << "[Pointmatcher] Invalid input point clouds dimension." << endl;
+      exit(1);
+    }
+
+    // Apply reference filters and build the matcher (KD-tree), at each pyramid level
+    if (!chains_->loaded)
+    {
+      applyConfig(); // sets the map once chain is loaded
+      return;
+    }
+    for (size_t i = 0; i < chains_->coarse_icp.size(); i++)
+    {
+      // Coarse level: reference down-sampled by the voxel grid of the level
+      DP coarse_reference (chains_->reference_cloud);
+      chains_->coarse_voxel_filters[i]->init();
+      chains_->coarse_voxel_filters[i]->inPlaceFilter(coarse_reference);
+      setFilteredMap(*chains_->coarse_icp[i], std::move(coarse_reference));
+    }
+    setFilteredMap(chains_->icp, chains_->reference_cloud);
+  }
+
+  // Replaces TrimmedDistOutlierFilter(s) of the chain, returns false if none
+  static bool replaceOutlierRatio(PM::ICPSequence& icp, float ratio)
+  {
+    std::unique_lock<std::mutex> lock(chain_loading_mutex);
+    PM::Parameters filter_params;
+    std::stringstream ratio_str;
+    ratio_str << ratio;
+    filter_params["ratio"] = ratio_str.str();
+
+    bool found = false;
+    for (size_t i = 0; i < icp.outlierFilters.size(); i++)
+    {
+      if (icp.outlierFilters[i]->className == "TrimmedDistOutlierFilter")
+      {
+        icp.outlierFilters[i] = PM::OutlierFilters::value_type(
+          PM::get().REG(OutlierFilter).create("TrimmedDistOutlierFilter", filter_params));
+        found = true;
+      }
+    }
+    return found;
+  }
+
+  // Replaces CounterTransformationChecker(s) of the chain, returns false if none
+  static bool replaceMaxIterationCount(PM::ICPSequence& icp, int max_iterations)
   {
+    std::unique_lock<std::mutex> lock(chain_loading_mutex);
+    PM::Parameters checker_params;
+    std::stringstream count_str;
+    count_str << max_iterations;
+    checker_params["maxIterationCount"] = count_str.str();
+
+    bool found = false;
+    for (size_t i = 0; i < icp.transformationCheckers.size(); i++)
+    {
+      if (icp.transformationCheckers[i]->className == "CounterTransformationChecker")
+      {
+        icp.transformationCheckers[i] = PM::TransformationCheckers::value_type(
+          PM::get().REG(TransformationChecker).create("CounterTransformationChecker", checker_params));
+        found = true;
+      }
+    }
+    return found;
+  }
+
+  // Replaces MaxDistOutlierFilter(s) of the chain (added if none)
+  static void replaceMaxMatchDistance(PM::ICPSequence& icp, float distance)
+  {
+    std::unique_lock<std::mutex> lock(chain_loading_mutex);
+    PM::Parameters filter_params;
+    std::stringstream distance_str;
+    distance_str << distance;
+    filter_params["maxDist"] = distance_str.str();
+
+    for (PM::OutlierFilters::iterator it = icp.outlierFilters.begin(); it != icp.outlierFilters.end();)
+    {
+      if ((*it)->className == "MaxDistOutlierFilter")
+        it = icp.outlierFilters.erase(it);
+      else
+        ++it;
+    }
+    icp.outlierFilters.push_back(PM::OutlierFilters::value_type(
+      PM::get().REG(OutlierFilter).create("MaxDistOutlierFilter", filter_params)));
+  }
+
+  // Removes the filters of a chain named class_name
+  static void removeFilters(PM::DataPointsFilters& filters, const std::string& class_name)
+  {
+    for (PM::DataPointsFilters::iterator it = filters.begin(); it != filters.end();)
+    {
+      if ((*it)->className == class_name)
+        it = filters.erase(it);
+      else
+        ++it;
+    }
+  }
+
+  void PointmatcherRegistration::loadChain(PM::ICPSequence& icp)
+  {
+    std::unique_lock<std::mutex> lock(chain_loading_mutex);
     // ICP chain configuration: check if prefiltering required
-    if (params_.pointmatcher.configFileName.empty())
+    if (chain_yaml_.empty())
     {
       // Set ICP chain to default
-      icp_.setDefault();
+      icp.setDefault();
     }
     else
+    {
+      // YAML config (in memory)
+      std::istringstream iss(chain_yaml_);
+      icp.loadFromYaml(iss);
+    }
+
+    // Normals given as input descriptor
+    if (input_normals_)
+    {
+      removeFilters(icp.readingDataPointsFilters, "SurfaceNormalDataPointsFilter");
+      removeFilters(icp.referenceDataPointsFilters, "SurfaceNormalDataPointsFilter");
+    }
+
+    // Adaptive termination (chain checkers kept: iteration cap, absolute tolerances)
+    if (params_.pointmatcher.convergenceRatio > 0.0)
+      icp.transformationCheckers.push_back(PM::TransformationCheckers::value_type(
+        new ConvergenceProfileChecker(params_.pointmatcher.convergenceRatio, params_.pointmatcher.convergenceWindow,
+                                      params_.pointmatcher.convergenceMinTranslation,
+                                      params_.pointmatcher.convergenceMinRotation)));
+  }
+
+  //Load (once) and apply configuration
+  void PointmatcherRegistration::applyConfig()
+  {
+    if (chains_->loaded)
+      return;
+
+    chain_yaml_.clear();
+    if (!params_.pointmatcher.configFileName.empty())
     {
       // load YAML config
       ifstream ifs(params_.pointmatcher.configFileName.c_str());
@@ -62,9 +417,191 @@ namespace aicp{
         cerr << "[Pointmatcher] Cannot open config file " << params_.pointmatcher.configFileName << endl;
         exit(1);
       }
-      icp_.loadFromYaml(ifs);
-      cerr << "[Pointmatcher] Loaded pre-filtering chain from yaml..." << endl;
+      std::stringstream buffer;
+      buffer << ifs.rdbuf();
+      chain_yaml_ = buffer.str();
+    }
+    loadChain(chains_->icp);
+    cerr << "[Pointmatcher] Loaded pre-filtering chain from yaml..." << endl;
+
+    // Pyramid: same chain on the clouds down-sampled by a voxel grid (first reading filter,
+    // reference down-sampled once in setMap)
+    chains_->coarse_icp.clear();
+    chains_->coarse_voxel_filters.clear();
+    const std::vector<float>& leaf_sizes = params_.pointmatcher.pyramidLeafSizes;
+    for (size_t i = 0; i < leaf_sizes.size(); i++)
+    {
+      std::unique_ptr<PM::ICPSequence> coarse_icp (new PM::ICPSequence);
+      loadChain(*coarse_icp);
+
+      PM::Parameters voxel_params;
+      std::stringstream leaf_str;
+      leaf_str << leaf_sizes[i];
+      voxel_params["vSizeX"] = leaf_str.str();
+      voxel_params["vSizeY"] = leaf_str.str();
+      voxel_params["vSizeZ"] = leaf_str.str();
+      {
+        std::unique_lock<std::mutex> lock(chain_loading_mutex);
+        coarse_icp->readingDataPointsFilters.insert(coarse_icp->readingDataPointsFilters.begin(),
+          PM::DataPointsFilters::value_type(PM::get().REG(DataPointsFilter).create("VoxelGridDataPointsFilter", voxel_params)));
+        chains_->coarse_voxel_filters.push_back(
+          PM::DataPointsFilters::value_type(PM::get().REG(DataPointsFilter).create("VoxelGridDataPointsFilter", voxel_params)));
+      }
+
+      chains_->coarse_icp.push_back(std::move(coarse_icp));
+    }
+    if (!chains_->coarse_icp.empty())
+      cout << "[Pointmatcher] Pyramid mode: " << chains_->coarse_icp.size() << " coarse level(s)." << endl;
+    chains_->loaded = true;
+
+    // New chain: matcher must be initialized again on current reference
+    if (chains_->reference_cloud.getNbPoints() > 0)
+      setMap();
+
+    // Re-apply in-memory tuning to the new chain
+    applyTuning();
+  }
+
+  void PointmatcherRegistration::applyTuning()
+  {
+    if (outlier_ratio_ > 0.0)
+      setOutlierRatio(outlier_ratio_);
+    if (max_iteration_count_ > 0)
+      setMaxIterationCount(max_iteration_count_);
+    if (max_match_distance_ > 0.0f)
+      setMaxMatchDistance(max_match_distance_);
+  }
+
+  void PointmatcherRegistration::setOutlierRatio(float ratio)
+  {
+    outlier_ratio_ = ratio;
+    if (!chains_->loaded)
+      return;
+
+    bool found = replaceOutlierRatio(chains_->icp, ratio);
+    for (size_t i = 0; i < chains_->coarse_icp.size(); i++)
+      replaceOutlierRatio(*chains_->coarse_icp[i], ratio);
+    if (!found)
+      cerr << "[Pointmatcher] No TrimmedDistOutlierFilter in the ICP chain, ratio not set." << endl;
+  }
+
+  void PointmatcherRegistration::setMaxIterationCount(int max_iterations)
+  {
+    if (max_iterations <= 0)
+    {
+      // Chain reloaded from the config on next registration (other tuning re-applied)
+      max_iteration_count_ = -1;
+      reloadChains();
+      return;
     }
+    max_iteration_count_ = max_iterations;
+    if (!chains_->loaded)
+      return;
+
+    bool found = replaceMaxIterationCount(chains_->icp, max_iterations);
+    for (size_t i = 0; i < chains_->coarse_icp.size(); i++)
+      replaceMaxIterationCount(*chains_->coarse_icp[i], max_iterations);
+    if (!found)
+      cerr << "[Pointmatcher] No CounterTransformationChecker in the ICP chain, max iterations not set." << endl;
+  }
+
+  void PointmatcherRegistration::setMaxMatchDistance(float distance)
+  {
+    if (distance <= 0.0f)
+    {
+      // Chain reloaded from the config on next registration (other tuning re-applied)
+      if (max_match_distance_ > 0.0f)
+        reloadChains();
+      max_match_distance_ = -1.0f;
+      return;
+    }
+    max_match_distance_ = distance;
+    if (!chains_->loaded)
+      return;
+
+    // Outlier filters only: the matcher (KD-tree) is kept
+    replaceMaxMatchDistance(chains_->icp, distance);
+    for (size_t i = 0; i < chains_->coarse_icp.size(); i++)
+      replaceMaxMatchDistance(*chains_->coarse_icp[i], distance);
+  }
+
+  int PointmatcherRegistration::registerReading(pcl::PointCloud<pcl::PointXYZ>& cloud_read, const TransformsVector& initial_transforms,
+                                                Eigen::Matrix4f &final_transform)
+  {
+    final_transform = Eigen::Matrix4f::Identity();
+    initial_guess_set_ = false; // hypotheses carry their own initial transforms
+    if (!chains_->icp.hasMap())
+    {
+      cerr << "[Pointmatcher] Reference cloud not set." << endl;
+      return -1;
+    }
+    applyConfig();
+    fromPCLToDataPoints(reading_cloud_, cloud_read);
+
+    // One chain per hypothesis, loaded here as chain parsing is not thread safe (global logger).
+    // Matchers are stateful (KD-tree visit counter): each chain gets its own map and matcher,
+    // set in its task from the reference filtered once
+    std::vector<std::unique_ptr<PM::ICPSequence> > chains;
+    for (size_t i = 0; i < initial_transforms.size(); i++)
+    {
+      std::unique_ptr<PM::ICPSequence> chain (new PM::ICPSequence);
+      loadChain(*chain);
+      if (outlier_ratio_ > 0.0)
+        replaceOutlierRatio(*chain, outlier_ratio_);
+      if (max_iteration_count_ > 0)
+        replaceMaxIterationCount(*chain, max_iteration_count_);
+      if (max_match_distance_ > 0.0f)
+        replaceMaxMatchDistance(*chain, max_match_distance_);
+      chains.push_back(std::move(chain));
+    }
+    DP filtered_reference (chains_->reference_cloud);
+    chains_->icp.referenceDataPointsFilters.init();
+    chains_->icp.referenceDataPointsFilters.apply(filtered_reference);
+
+    // Hypotheses scored on the (unfiltered) reference
+    pcl::PointCloud<pcl::PointXYZ>::Ptr reference (new pcl::PointCloud<pcl::PointXYZ>);
+    fromDataPointsToPCL(chains_->reference_cloud, *reference);
+    pcl::search::KdTree<pcl::PointXYZ> reference_search;
+    reference_search.setInputCloud(reference);
+
+    if (!pool_)
+      pool_.reset(new ThreadPool(params_.initialization.numThreads));
+
+    HypothesesVector hypotheses (initial_transforms.size());
+    std::vector<std::future<void> > results;
+    for (size_t i = 0; i < initial_transforms.size(); i++)
+    {
+      results.push_back(pool_->enqueue([&, i]()
+      {
+        chains[i]->setMap(filtered_reference);
+        PM::TransformationParameters T = (*chains[i])(reading_cloud_, initial_transforms[i]);
+        hypotheses[i].transform = T;
+        scoreAlignment(reference_search, cloud_read, params_.initialization.maxDistance, hypotheses[i]);
+      }));
+    }
+    for (size_t i = 0; i < results.size(); i++)
+      results[i].get();
+
+    int best = selectBestHypothesis(hypotheses);
+    if (best < 0)
+    {
+      cerr << "[Pointmatcher] No valid hypothesis." << endl;
+      return best;
+    }
+    AICP_LOG_DEBUG("Pointmatcher", "Best of " << hypotheses.size() << " hypotheses: " << best
+                   << " (residual: " << hypotheses[best].residual << " m, inliers: "
+                   << hypotheses[best].inlier_ratio * 100 << " %)");
+
+    final_transform = hypotheses[best].transform;
+    nb_iterations_ = getChainIterations(*chains[best]);
+    nb_coarse_iterations_ = -1;
+    const ConvergenceProfileChecker* checker = getConvergenceChecker(*chains[best]);
+    converged_ = checker ? checker->getConverged() : -1;
+    quality_ = RegistrationQuality(); // matches of the hypotheses chains not kept
+    degeneracy_ = DegeneracyEstimate();
+    out_read_cloud_ = reading_cloud_;
+    chains_->icp.transformations.apply(out_read_cloud_, hypotheses[best].transform);
+    return best;
   }
 
   //Load initialization
@@ -72,7 +609,11 @@ namespace aicp{
   {
     PM::TransformationParameters init_transform = parseTransformationDeg(params_.pointmatcher.initialTransform, 3);
 
-    PM::Transformation* rigid_transform = PM::get().REG(Transformation).create("RigidTransformation");
+    PM::Transformation* rigid_transform;
+    {
+      std::unique_lock<std::mutex> lock(chain_loading_mutex);
+      rigid_transform = PM::get().REG(Transformation).create("RigidTransformation");
+    }
 
     if (!rigid_transform->checkParameters(init_transform)) {
       cerr << endl
@@ -80,7 +621,7 @@ namespace aicp{
       init_transform = PM::TransformationParameters::Identity(4, 4);
     }
     else
-      cout << "[Pointmatcher] Initialization: " << params_.pointmatcher.initialTransform << endl;
+      AICP_LOG_DEBUG("Pointmatcher", "Initialization: " << params_.pointmatcher.initialTransform);
 
     // Manually transform reading to init position for visualization
     initialized_reading_ = rigid_transform->compute(reading_cloud_, init_transform);
@@ -91,44 +632,63 @@ namespace aicp{
   //Registration: Compute transform which aligns reading cloud onto the reference cloud.
   void PointmatcherRegistration::registerClouds(Eigen::Matrix4f &final_transform)
   {
-    int cloud_dimension = reference_cloud_.getEuclideanDim();
-
-    if (!(cloud_dimension == 3))
+    if (!chains_->icp.hasMap())
     {
-      cerr << "[Pointmatcher] Invalid input point clouds dimension." << endl;
+      cerr << "[Pointmatcher] Reference cloud not set." << endl;
       exit(1);
     }
 
-    // Params
+    // Params (reload if configuration changed)
     applyConfig();
 
     // Compute the transformation
     PM::TransformationParameters T;
     PM::TransformationParameters init_transform = PM::TransformationParameters::Identity(4, 4);
-    if (!params_.pointmatcher.initialTransform.empty())
+    if (initial_guess_set_)
+    {
+      // Used by this registration only
+      init_transform = initial_guess_;
+      initial_guess_set_ = false;
+    }
+    else if (!params_.pointmatcher.initialTransform.empty())
       init_transform = applyInitialization();
 
-    T = icp_(reading_cloud_, reference_cloud_, init_transform);
+    // Coarse to fine: each level is initialized with the previous estimate
+    nb_coarse_iterations_ = chains_->coarse_icp.empty() ? -1 : 0;
+    for (size_t i = 0; i < chains_->coarse_icp.size(); i++)
+    {
+      init_transform = (*chains_->coarse_icp[i])(reading_cloud_, init_transform);
+      nb_coarse_iterations_ += std::max(getChainIterations(*chains_->coarse_icp[i]), 0);
+    }
+
+    T = chains_->icp(reading_cloud_, init_transform);
 
     //Ratio of how many points were used for error minimization (defined as TrimmedDistOutlierFilter ratio)
-    cout << "[Pointmatcher] Accepted matches (inliers): " << (icp_.errorMinimizer->getWeightedPointUsedRatio())*100 << " %" << endl;
-
-    // simalpha: this is disabled after catkinize (set failure_prediction_factors to empty)
-    // // simalpha: using robotperception/libpointmatcher 3393c9327677c649d480799e76159ea223d95004
-    // // Get System Covariance:
-    // Eigen::MatrixXf system_covariance = (icp_.errorMinimizer->getSystemCovariance());
-    // cout << "[Pointmatcher] System Covariance (A^T * A): " << endl << system_covariance << endl;
-    // registrationFailurePredictionFilter(system_covariance, failure_prediction_factors);
-    // cout << "[Pointmatcher] Failure Prediction Factor: " << endl << failure_prediction_factor << endl;
-    // std::cout << "[Pointmatcher] Degeneracy and ICN state: DISABLED!\n";
-    // if (!failure_prediction_factors.empty())
-    //  failure_prediction_factors.clear();
+    inlier_ratio_ = chains_->icp.errorMinimizer->getWeightedPointUsedRatio();
+    AICP_LOG_DEBUG("Pointmatcher", "Accepted matches (inliers): " << inlier_ratio_*100 << " %");
+    // Iterations (adaptive termination or CounterTransformationChecker)
+    nb_iterations_ = getChainIterations(chains_->icp);
+    const ConvergenceProfileChecker* checker = getConvergenceChecker(chains_->icp);
+    converged_ = checker ? checker->getConverged() : -1;
+    AICP_LOG_DEBUG("Pointmatcher", "Iterations: " << nb_iterations_ << " (coarse levels: " << nb_coarse_iterations_
+                   << ", converged: " << converged_ << ")");
+    // Residuals of the pairs kept by the outlier filters at the last iteration
+    const PM::ErrorMinimizer::ErrorElements matched = chains_->icp.errorMinimizer->getErrorElements();
+    const int dim = matched.reading.getEuclideanDim();
+    residuals_.resize(matched.reading.getNbPoints());
+    if (!residuals_.empty() && matched.reference.getNbPoints() == residuals_.size())
+      Eigen::Map<Eigen::RowVectorXf>(residuals_.data(), residuals_.size()) =
+          (matched.reading.features.topRows(dim) - matched.reference.features.topRows(dim)).colwise().norm();
+    else
+      residuals_.clear();
+    quality_.setResiduals(residuals_);
+    degeneracy_ = DegeneracyEstimate();
+    if (quality_.nb_matches >= 6)
+      estimateDegeneracy(matched, degeneracy_);
 
     // Transform reading with T
-    DP tmp_out_read_cloud_(reading_cloud_);
-    icp_.transformations.apply(tmp_out_read_cloud_, T);
-
-    out_read_cloud_ = tmp_out_read_cloud_;
+    out_read_cloud_ = reading_cloud_;
+    chains_->icp.transformations.apply(out_read_cloud_, T);
 
     final_transform = T; // initialization is already included
 
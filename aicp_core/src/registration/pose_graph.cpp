@@ -0,0 +1,166 @@
+#include "aicp_registration/pose_graph.hpp"
+
+#include <Eigen/Sparse>
+#include <Eigen/SparseCholesky>
+
+namespace aicp {
+
+// Step of the numerical derivatives
+static const double pose_graph_step = 1e-6;
+
+PoseGraph::PoseGraph()
+{
+    nb_loop_closures_ = 0;
+}
+
+PoseGraph::~PoseGraph()
+{
+}
+
+int PoseGraph::addNode(const Eigen::Isometry3d& pose)
+{
+    poses_.push_back(pose);
+    node_edges_.push_back(std::vector<int>());
+    return poses_.size()-1;
+}
+
+void PoseGraph::addEdge(int from, int to, const Eigen::Isometry3d& measurement,
+                        const InformationMatrix& information, EdgeType type)
+{
+    Edge edge;
+    edge.from = from;
+    edge.to = to;
+    edge.measurement = measurement;
+    edge.information = information;
+    edge.type = type;
+    edges_.push_back(edge);
+    node_edges_.at(from).push_back(edges_.size()-1);
+    node_edges_.at(to).push_back(edges_.size()-1);
+    if (type == LOOP_CLOSURE)
+        nb_loop_closures_ ++;
+}
+
+PoseGraph::Vector6d PoseGraph::computeError(const Eigen::Isometry3d& measurement,
+                                            const Eigen::Isometry3d& from, const Eigen::Isometry3d& to)
+{
+    Eigen::Isometry3d delta = measurement.inverse() * from.inverse() * to;
+    Eigen::AngleAxisd rotation (delta.rotation());
+    Vector6d error;
+    error.head<3>() = delta.translation();
+    error.tail<3>() = rotation.angle() * rotation.axis();
+    return error;
+}
+
+Eigen::Isometry3d PoseGraph::expmap(const Vector6d& delta)
+{
+    Eigen::Isometry3d pose = Eigen::Isometry3d::Identity();
+    pose.translation() = delta.head<3>();
+    double angle = delta.tail<3>().norm();
+    if (angle > 0.0)
+        pose.linear() = Eigen::AngleAxisd(angle, delta.tail<3>() / angle).toRotationMatrix();
+    return pose;
+}
+
+int PoseGraph::optimize(int first_free, int max_iterations, std::vector<int>& updated, double epsilon)
+{
+    updated.clear();
+    int nb_nodes = poses_.size();
+    first_free = std::max(first_free, 0);
+    int nb_free = nb_nodes - first_free;
+    if (nb_free <= 0)
+        return 0;
+
+    // Edges with at least one free node
+    std::vector<int> edges;
+    std::vector<bool> selected (edges_.size(), false);
+    for (int n = first_free; n < nb_nodes; n++)
+    {
+        for (size_t e = 0; e < node_edges_[n].size(); e++)
+        {
+            if (!selected[node_edges_[n][e]])
+            {
+                selected[node_edges_[n][e]] = true;
+                edges.push_back(node_edges_[n][e]);
+            }
+        }
+    }
+
+    std::vector<Eigen::Isometry3d, Eigen::aligned_allocator<Eigen::Isometry3d> > initial_poses (poses_.begin() + first_free, poses_.end());
+
+    int iteration = 0;
+    for (; iteration < max_iterations; iteration++)
+    {
+        std::vector<Eigen::Triplet<double> > triplets;
+        Eigen::VectorXd b = Eigen::VectorXd::Zero(6 * nb_free);
+        for (size_t k = 0; k < edges.size(); k++)
+        {
+            const Edge& edge = edges_[edges[k]];
+            Vector6d error = computeError(edge.measurement, poses_[edge.from], poses_[edge.to]);
+
+            // Numerical jacobians (right increments) of the free ends
+            int nodes[2] = {edge.from, edge.to};
+            Eigen::Matrix<double, 6, 6> jacobians[2];
+            for (int side = 0; side < 2; side++)
+            {
+                if (nodes[side] < first_free)
+                    continue;
+                for (int d = 0; d < 6; d++)
+                {
+                    Vector6d delta = Vector6d::Zero();
+                    delta(d) = pose_graph_step;
+                    Eigen::Isometry3d from = poses_[edge.from];
+                    Eigen::Isometry3d to = poses_[edge.to];
+                    if (side == 0)
+                        from = from * expmap(delta);
+                    else
+                        to = to * expmap(delta);
+                    jacobians[side].col(d) = (computeError(edge.measurement, from, to) - error) / pose_graph_step;
+                }
+            }
+
+            for (int i = 0; i < 2; i++)
+            {
+                if (nodes[i] < first_free)
+                    continue;
+                int row = 6 * (nodes[i] - first_free);
+                b.segment<6>(row) -= jacobians[i].transpose() * edge.information * error;
+                for (int j = 0; j < 2; j++)
+                {
+                    if (nodes[j] < first_free)
+                        continue;
+                    int col = 6 * (nodes[j] - first_free);
+                    Eigen::Matrix<double, 6, 6> block = jacobians[i].transpose() * edge.information * jacobians[j];
+                    for (int r = 0; r < 6; r++)
+                        for (int c = 0; c < 6; c++)
+                            triplets.push_back(Eigen::Triplet<double>(row + r, col + c, block(r, c)));
+                }
+            }
+        }
+        // Small damping: free nodes only constrained by a single edge direction stay well posed
+        for (int i = 0; i < 6 * nb_free; i++)
+            triplets.push_back(Eigen::Triplet<double>(i, i, 1e-6));
+
+        Eigen::SparseMatrix<double> H (6 * nb_free, 6 * nb_free);
+        H.setFromTriplets(triplets.begin(), triplets.end());
+        Eigen::SimplicialLDLT<Eigen::SparseMatrix<double> > solver (H);
+        if (solver.info() != Eigen::Success)
+            break;
+        Eigen::VectorXd dx = solver.solve(b);
+
+        for (int n = 0; n < nb_free; n++)
+            poses_[first_free + n] = poses_[first_free + n] * expmap(dx.segment<6>(6 * n));
+        if (dx.lpNorm<Eigen::Infinity>() < 1e-6)
+        {
+            iteration++;
+            break;
+        }
+    }
+
+    for (int n = 0; n < nb_free; n++)
+    {
+        if (computeError(Eigen::Isometry3d::Identity(), initial_poses[n], poses_[first_free + n]).norm() > epsilon)
+            updated.push_back(first_free + n);
+    }
+    return iteration;
+}
+}
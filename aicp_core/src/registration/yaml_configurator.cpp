@@ -2,6 +2,9 @@
 #include "aicp_utils/common.hpp"
 #include "aicp_utils/fileIO.h"
 
+#include <algorithm>
+#include <functional>
+
 using namespace std;
 
 namespace aicp {
@@ -40,6 +43,65 @@ namespace aicp {
             registration_params.initialTransform = it->second.as<string>();
           }
         }
+        YAML::Node prefilterNode = registrationNode["Prefilter"];
+        for(YAML::const_iterator it=prefilterNode.begin();it != prefilterNode.end();++it) {
+          const string key = it->first.as<string>();
+
+          if(key.compare("mode") == 0) {
+            registration_params.prefilter.mode = it->second.as<string>();
+          }
+          else if(key.compare("numThreads") == 0) {
+            registration_params.prefilter.numThreads = it->second.as<int>();
+          }
+          else if(key.compare("leafSize") == 0) {
+            registration_params.prefilter.leafSize = it->second.as<float>();
+          }
+          else if(key.compare("mapLeafSize") == 0) {
+            registration_params.prefilter.mapLeafSize = it->second.as<float>();
+          }
+        }
+        YAML::Node samplingNode = registrationNode["Sampling"];
+        for(YAML::const_iterator it=samplingNode.begin();it != samplingNode.end();++it) {
+          const string key = it->first.as<string>();
+
+          if(key.compare("maxPoints") == 0) {
+            registration_params.sampling.maxPoints = it->second.as<int>();
+          }
+        }
+        YAML::Node motionModelNode = registrationNode["MotionModel"];
+        for(YAML::const_iterator it=motionModelNode.begin();it != motionModelNode.end();++it) {
+          const string key = it->first.as<string>();
+
+          if(key.compare("mode") == 0) {
+            registration_params.motionModel.mode = it->second.as<string>();
+          }
+          else if(key.compare("maxScale") == 0) {
+            registration_params.motionModel.maxScale = it->second.as<float>();
+          }
+        }
+        YAML::Node initializationNode = registrationNode["Initialization"];
+        for(YAML::const_iterator it=initializationNode.begin();it != initializationNode.end();++it) {
+          const string key = it->first.as<string>();
+
+          if(key.compare("yawSteps") == 0) {
+            registration_params.initialization.yawSteps = it->second.as<int>();
+          }
+          else if(key.compare("yawRange") == 0) {
+            registration_params.initialization.yawRange = it->second.as<float>();
+          }
+          else if(key.compare("translationSteps") == 0) {
+            registration_params.initialization.translationSteps = it->second.as<int>();
+          }
+          else if(key.compare("translationRange") == 0) {
+            registration_params.initialization.translationRange = it->second.as<float>();
+          }
+          else if(key.compare("maxDistance") == 0) {
+            registration_params.initialization.maxDistance = it->second.as<float>();
+          }
+          else if(key.compare("numThreads") == 0) {
+            registration_params.initialization.numThreads = it->second.as<int>();
+          }
+        }
         if(registration_params.type.compare("Pointmatcher") == 0) {
 
           YAML::Node pointmatcherNode = registrationNode["Pointmatcher"];
@@ -50,6 +112,24 @@ namespace aicp {
             if(key.compare("printOutputStatistics") == 0) {
               registration_params.pointmatcher.printOutputStatistics =  it->second.as<bool>();
             }
+            else if(key.compare("pyramidLeafSizes") == 0) {
+              registration_params.pointmatcher.pyramidLeafSizes = it->second.as<std::vector<float> >();
+              // coarse first
+              std::sort(registration_params.pointmatcher.pyramidLeafSizes.begin(),
+                        registration_params.pointmatcher.pyramidLeafSizes.end(), std::greater<float>());
+            }
+            else if(key.compare("convergenceRatio") == 0) {
+              registration_params.pointmatcher.convergenceRatio = it->second.as<float>();
+            }
+            else if(key.compare("convergenceWindow") == 0) {
+              registration_params.pointmatcher.convergenceWindow = it->second.as<int>();
+            }
+            else if(key.compare("convergenceMinTranslation") == 0) {
+              registration_params.pointmatcher.convergenceMinTranslation = it->second.as<float>();
+            }
+            else if(key.compare("convergenceMinRotation") == 0) {
+              registration_params.pointmatcher.convergenceMinRotation = it->second.as<float>();
+            }
           }
         }
         else if(registration_params.type.compare("GICP") == 0) {
@@ -58,7 +138,22 @@ namespace aicp {
 
           for(YAML::const_iterator it=gicpNode.begin();it != gicpNode.end();++it) {
             const string key = it->first.as<string>();
-            const float val = it->second.as<float>();
+
+            if(key.compare("kCorrespondences") == 0) {
+              registration_params.gicp.kCorrespondences = it->second.as<int>();
+            }
+            else if(key.compare("maxCorrespondenceDistance") == 0) {
+              registration_params.gicp.maxCorrespondenceDistance = it->second.as<float>();
+            }
+            else if(key.compare("maxIterations") == 0) {
+              registration_params.gicp.maxIterations = it->second.as<int>();
+            }
+            else if(key.compare("transformationEpsilon") == 0) {
+              registration_params.gicp.transformationEpsilon = it->second.as<double>();
+            }
+            else if(key.compare("numThreads") == 0) {
+              registration_params.gicp.numThreads = it->second.as<int>();
+            }
           }
         }
         YAML::Node overlapNode = yn_["AICP"]["Overlap"];
@@ -80,6 +175,44 @@ namespace aicp {
             if(key.compare("octomapResolution") == 0) {
               overlap_params.octree_based.octomapResolution = it->second.as<float>();
             }
+            else if(key.compare("endpointsOnly") == 0) {
+              overlap_params.octree_based.endpointsOnly = it->second.as<bool>();
+            }
+            else if(key.compare("colorTrees") == 0) {
+              overlap_params.octree_based.colorTrees = it->second.as<bool>();
+            }
+            else if(key.compare("coarseDepthOffset") == 0) {
+              overlap_params.octree_based.coarseDepthOffset = it->second.as<int>();
+            }
+            else if(key.compare("refineMargin") == 0) {
+              overlap_params.octree_based.refineMargin = it->second.as<float>();
+            }
+          }
+        }
+        YAML::Node loopClosureNode = overlapNode["LoopClosure"];
+        for(YAML::const_iterator it=loopClosureNode.begin();it != loopClosureNode.end();++it) {
+          const string key = it->first.as<string>();
+
+          if(key.compare("nbRings") == 0) {
+            overlap_params.loop_closure.nbRings = it->second.as<int>();
+          }
+          else if(key.compare("nbSectors") == 0) {
+            overlap_params.loop_closure.nbSectors = it->second.as<int>();
+          }
+          else if(key.compare("maxRadius") == 0) {
+            overlap_params.loop_closure.maxRadius = it->second.as<float>();
+          }
+          else if(key.compare("nbCandidates") == 0) {
+            overlap_params.loop_closure.nbCandidates = it->second.as<int>();
+          }
+          else if(key.compare("minIdGap") == 0) {
+            overlap_params.loop_closure.minIdGap = it->second.as<int>();
+          }
+          else if(key.compare("rebuildPeriod") == 0) {
+            overlap_params.loop_closure.rebuildPeriod = it->second.as<int>();
+          }
+          else if(key.compare("minOverlap") == 0) {
+            overlap_params.loop_closure.minOverlap = it->second.as<float>();
           }
         }
         YAML::Node classificationNode = yn_["AICP"]["Classifier"];
@@ -101,6 +234,12 @@ namespace aicp {
             if(key.compare("threshold") == 0) {
               classification_params.svm.threshold = it->second.as<double>();
             }
+            else if(key.compare("useLookupTable") == 0) {
+              classification_params.svm.useLookupTable = it->second.as<bool>();
+            }
+            else if(key.compare("lookupTableResolution") == 0) {
+              classification_params.svm.lookupTableResolution = it->second.as<float>();
+            }
           }
         }
 
@@ -129,23 +268,64 @@ namespace aicp {
         cout << "[Main] Load Poses from: "                   << registration_params.loadPosesFrom                 << endl;
         cout << "[Main] Initial Transform: "                 << registration_params.initialTransform              << endl;
 
+        cout << "[Main] Pre-filter Mode: "                   << registration_params.prefilter.mode                << endl;
+        cout << "[Main] Pre-filter Threads: "                << registration_params.prefilter.numThreads          << endl;
+        cout << "[Main] Pre-filter Leaf Size: "              << registration_params.prefilter.leafSize            << endl;
+        cout << "[Main] Pre-filter Map Leaf Size: "          << registration_params.prefilter.mapLeafSize         << endl;
+        cout << "[Main] Sampling Max Points: "               << registration_params.sampling.maxPoints            << endl;
+        cout << "[Main] Motion Model Mode: "                 << registration_params.motionModel.mode              << endl;
+        cout << "[Main] Motion Model Max Scale: "            << registration_params.motionModel.maxScale          << endl;
+
+        cout << "[Main] Initialization Yaw Steps: "           << registration_params.initialization.yawSteps         << endl;
+        cout << "[Main] Initialization Yaw Range: "           << registration_params.initialization.yawRange         << endl;
+        cout << "[Main] Initialization Translation Steps: "   << registration_params.initialization.translationSteps << endl;
+        cout << "[Main] Initialization Translation Range: "   << registration_params.initialization.translationRange << endl;
+        cout << "[Main] Initialization Max Distance: "        << registration_params.initialization.maxDistance      << endl;
+        cout << "[Main] Initialization Threads: "             << registration_params.initialization.numThreads       << endl;
+
         if(registration_params.type.compare("Pointmatcher") == 0) {
 //            cout << "[Pointmatcher] Config File Name: "                << registration_params.pointmatcher.configFileName        << endl;
             cout << "[Pointmatcher] Print Registration Statistics: "   << registration_params.pointmatcher.printOutputStatistics << endl;
+            cout << "[Pointmatcher] Pyramid Leaf Sizes: ";
+            for (size_t i = 0; i < registration_params.pointmatcher.pyramidLeafSizes.size(); i++)
+              cout << registration_params.pointmatcher.pyramidLeafSizes[i] << " ";
+            cout << endl;
+            cout << "[Pointmatcher] Convergence Ratio: "             << registration_params.pointmatcher.convergenceRatio          << endl;
+            cout << "[Pointmatcher] Convergence Window: "            << registration_params.pointmatcher.convergenceWindow         << endl;
+            cout << "[Pointmatcher] Convergence Min Translation: "   << registration_params.pointmatcher.convergenceMinTranslation << endl;
+            cout << "[Pointmatcher] Convergence Min Rotation: "      << registration_params.pointmatcher.convergenceMinRotation    << endl;
         }
         else if(registration_params.type.compare("GICP") == 0) {
+            cout << "[GICP] K Correspondences: "              << registration_params.gicp.kCorrespondences          << endl;
+            cout << "[GICP] Max Correspondence Distance: "    << registration_params.gicp.maxCorrespondenceDistance << endl;
+            cout << "[GICP] Max Iterations: "                 << registration_params.gicp.maxIterations             << endl;
+            cout << "[GICP] Transformation Epsilon: "         << registration_params.gicp.transformationEpsilon     << endl;
+            cout << "[GICP] Threads: "                        << registration_params.gicp.numThreads                << endl;
         }
 
         cout << "[Main] Overlap Type: "                   << overlap_params.type                             << endl;
 
         if(overlap_params.type.compare("OctreeBased") == 0) {
             cout << "[OctreeBased] Octomap Resolution: "    << overlap_params.octree_based.octomapResolution   << endl;
+            cout << "[OctreeBased] Endpoints Only: "        << overlap_params.octree_based.endpointsOnly       << endl;
+            cout << "[OctreeBased] Color Trees: "           << overlap_params.octree_based.colorTrees          << endl;
+            cout << "[OctreeBased] Coarse Depth Offset: "   << overlap_params.octree_based.coarseDepthOffset   << endl;
+            cout << "[OctreeBased] Refine Margin: "         << overlap_params.octree_based.refineMargin        << endl;
         }
+        cout << "[LoopClosure] Rings x Sectors: "            << overlap_params.loop_closure.nbRings << " x "
+                                                             << overlap_params.loop_closure.nbSectors          << endl;
+        cout << "[LoopClosure] Max Radius: "                 << overlap_params.loop_closure.maxRadius          << endl;
+        cout << "[LoopClosure] Candidates: "                 << overlap_params.loop_closure.nbCandidates       << endl;
+        cout << "[LoopClosure] Min Id Gap: "                 << overlap_params.loop_closure.minIdGap           << endl;
+        cout << "[LoopClosure] Rebuild Period: "             << overlap_params.loop_closure.rebuildPeriod      << endl;
+        cout << "[LoopClosure] Min Overlap: "                << overlap_params.loop_closure.minOverlap         << endl;
 
         cout << "[Main] Classification Type: "       << classification_params.type                    << endl;
 
         if(classification_params.type.compare("SVM") == 0) {
               cout << "[SVM] Acceptance Threshold: "    << classification_params.svm.threshold           << endl;
+              cout << "[SVM] Use Lookup Table: "        << classification_params.svm.useLookupTable      << endl;
+              cout << "[SVM] Lookup Table Resolution: " << classification_params.svm.lookupTableResolution << endl;
               // cout << "[SVM] Training File: "           << classification_params.svm.trainingFile        << endl;
               // cout << "[SVM] Testing File: "            << classification_params.svm.testingFile         << endl;
               // cout << "[SVM] Saving Model To: "         << classification_params.svm.saveFile            << endl;
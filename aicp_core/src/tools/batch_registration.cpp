@@ -0,0 +1,350 @@
+// Batch pairwise registration (validation runs): runs the registration_main pipeline
+//  (FOV overlap, octree overlap, alignability, alignment risk, ICP) on a list of jobs.
+// Each cloud is loaded and pre-filtered once, the parameters and the classifier are shared,
+// each worker thread owns its registrator and overlapper. Results are written in job order.
+
+// Run: aicp_batch_registration --jobs <jobs.txt> [options]
+//  --jobs <jobs.txt>               one job per line: <reference> <reading> [x,y,yaw_deg]
+//                                  (default initial guess: initialTransform of the config,
+//                                  "random" draws one per job), # starts a comment
+//  --config <aicp_config.yaml>     parameters (default: aicp_core/config/aicp_config.yaml)
+//  --poses <file>                  ground truth poses (line id: x y z w x y z) if loadPosesFrom
+//                                  is "file" (default: pose_scanner_leica_affine.txt)
+//  --threads <n>                   worker threads (default: hardware threads)
+//  --results <file>                idA idB fov_overlap octree_overlap alignability risk degeneracy ICN
+//                                  (default: compare_results.txt, format of the python/ scripts)
+//  --corrected-poses <file>        idA idB x y z w x y z (default: corrected_poses.txt)
+// Cloud ids are the digits in the file names (as in registration_main).
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <sstream>
+#include <thread>
+
+#include <pcl/common/transforms.h>
+#include <pcl/io/pcd_io.h>
+
+#include "aicp_registration/registration.hpp"
+#include "aicp_registration/yaml_configurator.hpp"
+#include "aicp_overlap/overlap.hpp"
+#include "aicp_classification/classification.hpp"
+#include "aicp_utils/cloudIO.h"
+#include "aicp_utils/common.hpp"
+#include "aicp_utils/fileIO.h"
+#include "aicp_utils/filteringUtils.hpp"
+#include "aicp_utils/textCloudReader.hpp"
+
+using namespace std;
+using namespace aicp;
+
+struct BatchCloud
+{
+  EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+  string file;
+  int id;
+  pcl::PointCloud<pcl::PointXYZ>::Ptr cloud;
+  pcl::PointCloud<pcl::PointXYZ>::Ptr filtered;
+  Eigen::Matrix4f pose;
+};
+
+struct BatchJob
+{
+  EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+  size_t reference;
+  size_t reading;
+  Eigen::Matrix4f perturbation;
+
+  // Results
+  bool done;
+  float fov_overlap;
+  float octree_overlap;
+  float alignability;
+  float risk;
+  DegeneracyEstimate degeneracy;
+  Eigen::Matrix4f corrected_pose;
+};
+
+typedef vector<BatchCloud, Eigen::aligned_allocator<BatchCloud> > BatchClouds;
+typedef vector<BatchJob, Eigen::aligned_allocator<BatchJob> > BatchJobs;
+
+static int cloudId(const string& file)
+{
+  int id = -1;
+  stringstream ss (extract_ints(file.substr(file.find_last_of('/') + 1)));
+  ss >> id;
+  return id;
+}
+
+static bool loadCloud(BatchCloud& input, const RegistrationParams& reg_params, string& poses_file)
+{
+  input.id = cloudId(input.file);
+  input.cloud.reset(new pcl::PointCloud<pcl::PointXYZ>);
+  string extension = input.file.substr(input.file.find_last_of('.') + 1);
+  if (extension == "pcd")
+  {
+    if (pcl::io::loadPCDFile<pcl::PointXYZ>(input.file, *input.cloud) == -1)
+      return false;
+  }
+  else if (!readTextCloud(input.file, *input.cloud))
+  {
+    // other libpointmatcher formats (e.g. binary vtk)
+    DP cloud = DP::load(input.file);
+    fromDataPointsToPCL(cloud, *input.cloud);
+  }
+
+  input.pose = Eigen::Matrix4f::Identity();
+  if (reg_params.loadPosesFrom == "file")
+    input.pose = parseTransformationQuaternions(readLineFromFile(poses_file, input.id));
+  else if (reg_params.loadPosesFrom == "pcd")
+  {
+    input.pose.block<3,3>(0,0) = input.cloud->sensor_orientation_.toRotationMatrix();
+    input.pose.block<3,1>(0,3) = input.cloud->sensor_origin_.block<3,1>(0,0);
+  }
+
+  input.filtered.reset(new pcl::PointCloud<pcl::PointXYZ>);
+  regionGrowingUniformPlaneSegmentationFilter(input.cloud, input.filtered, reg_params.prefilter.leafSize);
+  return true;
+}
+
+// Jobs file: <reference> <reading> [x,y,yaw_deg], clouds indexed once
+static bool parseJobs(const string& jobs_file, const string& default_transform,
+                      BatchClouds& clouds, BatchJobs& jobs)
+{
+  ifstream in (jobs_file.c_str());
+  if (!in.is_open())
+    return false;
+  map<string, size_t> cloud_indices;
+  string line;
+  while (getline(in, line))
+  {
+    line = line.substr(0, line.find('#'));
+    stringstream ss(line);
+    string files[2];
+    string transform = default_transform;
+    if (!(ss >> files[0] >> files[1]))
+      continue;
+    ss >> transform;
+
+    BatchJob job;
+    size_t* indices[2] = {&job.reference, &job.reading};
+    for (int f = 0; f < 2; f++)
+    {
+      map<string, size_t>::iterator it = cloud_indices.find(files[f]);
+      if (it == cloud_indices.end())
+      {
+        it = cloud_indices.insert(make_pair(files[f], clouds.size())).first;
+        BatchCloud cloud;
+        cloud.file = files[f];
+        clouds.push_back(cloud);
+      }
+      *indices[f] = it->second;
+    }
+
+    if (transform == "random")
+    {
+      // Gaussian samples with 0 mean and 10 cm variance (as registration_main)
+      Eigen::VectorXf vars = get_random_gaussian_variable(0, 0.10, 3);
+      stringstream perturbation;
+      perturbation << vars(0) << ',' << vars(1) << ',' << vars(2) * 10.0;
+      transform = perturbation.str();
+    }
+    job.perturbation = transform.empty() ? Eigen::Matrix4f::Identity() : parseTransformationDeg(transform);
+    job.done = false;
+    jobs.push_back(job);
+  }
+  return true;
+}
+
+static void runJob(const BatchClouds& clouds, BatchJob& job,
+                   const RegistrationParams& reg_params,
+                   AbstractRegistrator& registrator, AbstractOverlapper& overlapper,
+                   AbstractClassification& classifier, ColorOcTree& read_tree)
+{
+  const BatchCloud& reference = clouds[job.reference];
+  const BatchCloud& reading = clouds[job.reading];
+
+  // Initialized reading (pre-filtered once, then moved: same as filtering the moved cloud
+  // up to the voxel grid alignment)
+  Eigen::Matrix4f estimated_reading_pose = job.perturbation * reading.pose;
+  pcl::PointCloud<pcl::PointXYZ> initialized_reading;
+  pcl::transformPointCloud(*reading.cloud, initialized_reading, job.perturbation);
+  pcl::PointCloud<pcl::PointXYZ> initialized_filtered;
+  pcl::transformPointCloud(*reading.filtered, initialized_filtered, job.perturbation);
+
+  Eigen::Isometry3d reference_pose_iso = fromMatrix4fToIsometry3d(reference.pose);
+  Eigen::Isometry3d reading_pose_iso = fromMatrix4fToIsometry3d(estimated_reading_pose);
+
+  // FOV-based overlap
+  pcl::PointCloud<pcl::PointXYZ> overlap_points_A;
+  pcl::PointCloud<pcl::PointXYZ> overlap_points_B;
+  job.fov_overlap = overlapFilter(*reference.cloud, initialized_reading, reference_pose_iso, reading_pose_iso,
+                                  reg_params.sensorRange, reg_params.sensorAngularView,
+                                  overlap_points_A, overlap_points_B);
+
+  // Octree-based overlap (reference tree kept by the overlapper while the reference does not change)
+  read_tree.clear();
+  overlapper.computeOverlap(*reference.filtered, initialized_filtered, reference_pose_iso, reading_pose_iso,
+                            &read_tree, (int)job.reference);
+  job.octree_overlap = overlapper.getOverlap();
+
+  // Alignability and alignment risk
+  pcl::PointCloud<pcl::PointXYZRGBNormal>::Ptr no_output;
+  job.alignability = alignabilityFilter(overlap_points_A, overlap_points_B, reference_pose_iso, reading_pose_iso,
+                                        no_output, no_output, no_output);
+  Eigen::MatrixXd testing_data(1, 2);
+  testing_data << job.octree_overlap, job.alignability;
+  Eigen::MatrixXd risk_prediction;
+  classifier.test(testing_data, &risk_prediction);
+  job.risk = risk_prediction.size() > 0 ? (float)risk_prediction(0, 0) : -1.0f;
+
+  // Auto-tuned outlier filter (quantile from the overlap, as registration_main)
+  float ratio = min(max(job.octree_overlap / 100.0f, 0.25f), 0.70f);
+  registrator.setOutlierRatio(ratio);
+
+  Eigen::Matrix4f T = Eigen::Matrix4f::Identity();
+  registrator.registerClouds(*reference.filtered, initialized_filtered, T);
+  job.degeneracy = registrator.getDegeneracy();
+  job.corrected_pose = T * estimated_reading_pose;
+}
+
+static void writeJob(const BatchClouds& clouds, const BatchJob& job,
+                     ofstream& results, ofstream& corrected_poses)
+{
+  const int id_A = clouds[job.reference].id;
+  const int id_B = clouds[job.reading].id;
+  results << id_A << " " << id_B << " " << job.fov_overlap << " " << job.octree_overlap << " "
+          << job.alignability << " " << job.risk << " " << job.degeneracy.degeneracy << " "
+          << job.degeneracy.inverse_condition_number << endl;
+
+  Eigen::Quaternionf quat(job.corrected_pose.block<3,3>(0,0));
+  corrected_poses << id_A << " " << id_B << " "
+                  << job.corrected_pose(0,3) << " " << job.corrected_pose(1,3) << " " << job.corrected_pose(2,3) << " "
+                  << quat.w() << " " << quat.x() << " " << quat.y() << " " << quat.z() << endl;
+}
+
+int main(int argc, char** argv)
+{
+  string config_file = AICP_BATCH_CONFIG_FILE;
+  string jobs_file;
+  string poses_file = "pose_scanner_leica_affine.txt";
+  int num_threads = thread::hardware_concurrency();
+  string results_file = "compare_results.txt";
+  string corrected_poses_file = "corrected_poses.txt";
+
+  for (int i = 1; i + 1 < argc; i += 2)
+  {
+    string option = argv[i];
+    if (option == "--jobs")
+      jobs_file = argv[i + 1];
+    else if (option == "--config")
+      config_file = argv[i + 1];
+    else if (option == "--poses")
+      poses_file = argv[i + 1];
+    else if (option == "--threads")
+      num_threads = atoi(argv[i + 1]);
+    else if (option == "--results")
+      results_file = argv[i + 1];
+    else if (option == "--corrected-poses")
+      corrected_poses_file = argv[i + 1];
+    else
+    {
+      cerr << "[Batch] Unknown option " << option << " (see the header of batch_registration.cpp)." << endl;
+      return -1;
+    }
+  }
+  num_threads = max(num_threads, 1);
+
+  YAMLConfigurator yaml_conf;
+  if (!yaml_conf.parse(config_file))
+  {
+    cerr << "ERROR: could not parse file " << config_file << endl;
+    return -1;
+  }
+  RegistrationParams reg_params = yaml_conf.getRegistrationParams();
+  OverlapParams overlap_params = yaml_conf.getOverlapParams();
+  ClassificationParams class_params = yaml_conf.getClassificationParams();
+
+  BatchClouds clouds;
+  BatchJobs jobs;
+  if (jobs_file.empty() || !parseJobs(jobs_file, reg_params.initialTransform, clouds, jobs))
+  {
+    cerr << "ERROR: could not read jobs file \"" << jobs_file << "\"." << endl;
+    return -1;
+  }
+  cout << "[Batch] " << jobs.size() << " jobs on " << clouds.size() << " clouds, "
+       << num_threads << " threads." << endl;
+
+  // Clouds loaded and pre-filtered in parallel (once each)
+  atomic<size_t> next_cloud (0);
+  atomic<bool> load_failed (false);
+  vector<thread> loaders;
+  for (int t = 0; t < num_threads; t++)
+    loaders.push_back(thread([&]()
+    {
+      for (size_t c = next_cloud++; c < clouds.size(); c = next_cloud++)
+        if (!loadCloud(clouds[c], reg_params, poses_file))
+        {
+          cerr << "[Batch] Was not able to open file \"" << clouds[c].file << "\"." << endl;
+          load_failed = true;
+        }
+    }));
+  for (size_t t = 0; t < loaders.size(); t++)
+    loaders[t].join();
+  if (load_failed)
+    return -1;
+
+  ofstream results (results_file.c_str());
+  ofstream corrected_poses (corrected_poses_file.c_str());
+  if (!results.is_open() || !corrected_poses.is_open())
+  {
+    cerr << "ERROR: could not open output files " << results_file << ", " << corrected_poses_file << endl;
+    return -1;
+  }
+
+  // Shared (thread-safe test)
+  unique_ptr<AbstractClassification> classifier = create_classifier(class_params);
+
+  atomic<size_t> next_job (0);
+  mutex done_mutex;
+  condition_variable done_condition;
+  vector<thread> workers;
+  for (int t = 0; t < num_threads; t++)
+    workers.push_back(thread([&]()
+    {
+      unique_ptr<AbstractRegistrator> registrator = create_registrator(reg_params);
+      unique_ptr<AbstractOverlapper> overlapper = create_overlapper(overlap_params);
+      ColorOcTree read_tree (overlap_params.octree_based.octomapResolution);
+      for (size_t j = next_job++; j < jobs.size(); j = next_job++)
+      {
+        runJob(clouds, jobs[j], reg_params, *registrator, *overlapper, *classifier, read_tree);
+        {
+          lock_guard<mutex> lock(done_mutex);
+          jobs[j].done = true;
+        }
+        done_condition.notify_one();
+      }
+    }));
+
+  // Results streamed in job order
+  for (size_t j = 0; j < jobs.size(); j++)
+  {
+    {
+      unique_lock<mutex> lock(done_mutex);
+      done_condition.wait(lock, [&]() { return jobs[j].done; });
+    }
+    writeJob(clouds, jobs[j], results, corrected_poses);
+    cout << "[Batch] Job " << j + 1 << "/" << jobs.size() << ": " << clouds[jobs[j].reference].id
+         << " - " << clouds[jobs[j].reading].id << ", octree overlap " << jobs[j].octree_overlap
+         << " %, risk " << jobs[j].risk << endl;
+  }
+  for (size_t t = 0; t < workers.size(); t++)
+    workers[t].join();
+
+  cout << "[Batch] Results written to " << results_file << " and " << corrected_poses_file << endl;
+  return 0;
+}
@@ -0,0 +1,43 @@
+// aicp_build_tiled_map
+// Converts a map cloud (pcd or ply) to a tiled map (.aicpmap) loaded by parts at localization.
+// The map is pre-filtered as when loaded by AICP (see AppROS::loadMapFromFile).
+
+#include <cstdlib>
+#include <iostream>
+#include <pcl/point_types.h>
+
+#include "aicp_utils/filteringUtils.hpp"
+#include "aicp_utils/tiledMapFile.hpp"
+
+int
+  main (int argc, char** argv)
+{
+  if (argc < 3)
+  {
+    std::cout << "Usage: aicp_build_tiled_map <map.pcd|map.ply> <map.aicpmap> "
+              << "[tile_size (default 10.0)] [map_leaf_size (default 0.08)] [leaf_size (default 0.08)]" << std::endl;
+    return EXIT_SUCCESS;
+  }
+  std::string filename_in = argv[1];
+  std::string filename_out = argv[2];
+  float tile_size = argc > 3 ? std::atof(argv[3]) : 10.0f;
+  float map_leaf_size = argc > 4 ? std::atof(argv[4]) : 0.08f;
+  float leaf_size = argc > 5 ? std::atof(argv[5]) : 0.08f;
+
+  pcl::PointCloud<pcl::PointXYZ>::Ptr map (new pcl::PointCloud<pcl::PointXYZ>);
+  if (!loadVoxelizedCloudFromFile(filename_in, map_leaf_size, *map))
+  {
+    std::cerr << "Was not able to open file \""<<filename_in<<"\"." << std::endl;
+    return EXIT_FAILURE;
+  }
+  std::cout << "Loaded map with " << map->size() << " points." << std::endl;
+
+  pcl::PointCloud<pcl::PointXYZ>::Ptr filtered_map (new pcl::PointCloud<pcl::PointXYZ>);
+  regionGrowingUniformPlaneSegmentationFilter(map, filtered_map, leaf_size);
+
+  if (!TiledMapFile::write(filename_out, *filtered_map, tile_size, leaf_size))
+    return EXIT_FAILURE;
+  std::cout << "Wrote " << filtered_map->size() << " points to \"" << filename_out << "\"." << std::endl;
+
+  return (0);
+}
@@ -0,0 +1,382 @@
+// aicp_create_synthetic_session: reproducible sessions for performance and accuracy tests
+// A multi-beam lidar is ray cast in a scene of boxes along a sensor trajectory. Clouds are
+// written in the layout read by App::processFromFile: in the odometry frame, with the drifting
+// odometry poses as priors. The ground truth poses are written as well.
+
+// Run: aicp_create_synthetic_session --output <folder> [options]
+//  --scene <corridor|rooms|outdoor>  scene type (default: corridor)
+//  --length <m>                      trajectory length along x (default: 50)
+//  --step <m>                        distance between clouds (default: 0.5)
+//  --rate <Hz>                       clouds per second (timestamps, default: 10)
+//  --rings <n>                       lidar beams (default: 16)
+//  --vertical-fov <deg>              vertical field of view, centered (default: 30)
+//  --azimuth-resolution <deg>        horizontal step between rays (default: 0.4)
+//  --range <m>                       maximum range (default: 30)
+//  --noise <m>                       range noise, standard deviation (default: 0.01)
+//  --drift <ratio>                   odometry drift: position (m/m) and yaw (rad/m)
+//                                    random walk standard deviation (default: 0.01)
+//  --format <log|pcd>                aicp_input_clouds.aicplog (default) or one pcd per cloud
+//                                    with aicp_input_poses.csv
+//  --resolution <m>                  log quantization (default: 0, lossless)
+//  --seed <n>                        random seed (default: 0)
+// Outputs: <folder>/aicp_ground_truth_poses.csv (same format as aicp_input_poses.csv)
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <Eigen/Dense>
+
+#include <pcl/point_types.h>
+#include <pcl/io/pcd_io.h>
+
+#include "aicp_utils/cloudLog.hpp"
+
+using namespace std;
+
+struct Box
+{
+  Eigen::Vector3f min;
+  Eigen::Vector3f max;
+};
+
+struct SessionConfig
+{
+  string output;
+  string scene = "corridor";
+  float length = 50.0f;
+  float step = 0.5f;
+  float rate = 10.0f;
+  int rings = 16;
+  float vertical_fov = 30.0f;
+  float azimuth_resolution = 0.4f;
+  float range = 30.0f;
+  float noise = 0.01f;
+  float drift = 0.01f;
+  string format = "log";
+  float resolution = 0.0f;
+  int seed = 0;
+};
+
+static Box makeBox(float x0, float y0, float z0, float x1, float y1, float z1)
+{
+  Box box;
+  box.min << min(x0, x1), min(y0, y1), min(z0, z1);
+  box.max << max(x0, x1), max(y0, y1), max(z0, z1);
+  return box;
+}
+
+// Lateral offset of the trajectory at x (scenes keep it free of obstacles)
+static float pathOffset(const string& scene, float x)
+{
+  if (scene == "outdoor")
+    return 6.0f * sin(x / 40.0f);
+  return (scene == "rooms" ? 0.3f : 0.2f) * sin(x / 5.0f);
+}
+
+static float sensorHeight(const string& scene)
+{
+  return scene == "outdoor" ? 1.8f : 1.0f;
+}
+
+// Corridor 2.4 m wide, 2.6 m high, with recesses, pillars and cabinets along the walls
+static void buildCorridor(float length, mt19937& rng, vector<Box>& boxes)
+{
+  uniform_real_distribution<float> uniform (0.0f, 1.0f);
+  const float x0 = -5.0f, x1 = length + 5.0f, half_width = 1.2f, height = 2.6f;
+  boxes.push_back(makeBox(x0, -half_width, -0.1f, x1, half_width, 0.0f));        // floor
+  boxes.push_back(makeBox(x0, -half_width, height, x1, half_width, height + 0.1f)); // ceiling
+  boxes.push_back(makeBox(x0 - 0.1f, -half_width, 0.0f, x0, half_width, height));  // ends
+  boxes.push_back(makeBox(x1, -half_width, 0.0f, x1 + 0.1f, half_width, height));
+  for (int side = -1; side <= 1; side += 2)
+  {
+    // Wall split by recesses (doors, 0.3 m deep)
+    float x = x0;
+    while (x < x1)
+    {
+      float wall = 2.0f + 6.0f * uniform(rng);
+      float wall_end = min(x + wall, x1);
+      boxes.push_back(makeBox(x, side * half_width, 0.0f, wall_end, side * (half_width + 0.1f), height));
+      float door = 0.8f + 0.4f * uniform(rng);
+      float door_end = min(wall_end + door, x1);
+      if (door_end > wall_end)
+        boxes.push_back(makeBox(wall_end, side * (half_width + 0.3f), 0.0f, door_end,
+                                side * (half_width + 0.4f), height));
+      x = door_end;
+    }
+    // Pillars and cabinets against the wall
+    for (float x = x0 + 3.0f * uniform(rng); x < x1; x += 3.0f + 5.0f * uniform(rng))
+    {
+      float depth = 0.15f + 0.25f * uniform(rng);
+      float width = 0.3f + 0.9f * uniform(rng);
+      float top = uniform(rng) < 0.5f ? height : 0.8f + 1.2f * uniform(rng);
+      boxes.push_back(makeBox(x, side * half_width, 0.0f, x + width, side * (half_width - depth), top));
+    }
+  }
+}
+
+// Rooms 6 m x 5 m in a row, connected by doors on the trajectory, with furniture
+static void buildRooms(float length, mt19937& rng, vector<Box>& boxes)
+{
+  uniform_real_distribution<float> uniform (0.0f, 1.0f);
+  const float room_length = 6.0f, half_width = 2.5f, height = 2.8f;
+  const int nb_rooms = (int)ceil((length + 6.0f) / room_length);
+  const float x0 = -3.0f, x1 = x0 + nb_rooms * room_length;
+  boxes.push_back(makeBox(x0, -half_width, -0.1f, x1, half_width, 0.0f));
+  boxes.push_back(makeBox(x0, -half_width, height, x1, half_width, height + 0.1f));
+  boxes.push_back(makeBox(x0, -half_width - 0.1f, 0.0f, x1, -half_width, height));
+  boxes.push_back(makeBox(x0, half_width, 0.0f, x1, half_width + 0.1f, height));
+  for (int r = 0; r <= nb_rooms; r++)
+  {
+    float x = x0 + r * room_length;
+    if (r == 0 || r == nb_rooms)
+    {
+      boxes.push_back(makeBox(x - 0.1f, -half_width, 0.0f, x, half_width, height));
+      continue;
+    }
+    // Wall with a 1 m door (2.1 m high)
+    boxes.push_back(makeBox(x - 0.1f, -half_width, 0.0f, x, -0.5f, height));
+    boxes.push_back(makeBox(x - 0.1f, 0.5f, 0.0f, x, half_width, height));
+    boxes.push_back(makeBox(x - 0.1f, -0.5f, 2.1f, x, 0.5f, height));
+  }
+  for (int r = 0; r < nb_rooms; r++)
+  {
+    // Furniture away from the trajectory (|y| > 1 m)
+    int nb_furniture = 2 + (int)(3 * uniform(rng));
+    for (int f = 0; f < nb_furniture; f++)
+    {
+      float width = 0.4f + 1.2f * uniform(rng);
+      float depth = 0.4f + 0.8f * uniform(rng);
+      float x = x0 + r * room_length + 0.3f + (room_length - width - 0.6f) * uniform(rng);
+      float y = 1.0f + (half_width - depth - 1.0f) * uniform(rng);
+      float side = uniform(rng) < 0.5f ? -1.0f : 1.0f;
+      boxes.push_back(makeBox(x, side * y, 0.0f, x + width, side * (y + depth), 0.4f + 1.6f * uniform(rng)));
+    }
+  }
+}
+
+// Ground, buildings on both sides of the road and poles along it
+static void buildOutdoor(float length, mt19937& rng, vector<Box>& boxes)
+{
+  uniform_real_distribution<float> uniform (0.0f, 1.0f);
+  const float x0 = -30.0f, x1 = length + 30.0f;
+  boxes.push_back(makeBox(x0, -80.0f, -0.2f, x1, 80.0f, 0.0f));
+  for (int side = -1; side <= 1; side += 2)
+  {
+    for (float x = x0; x < x1; )
+    {
+      float width = 5.0f + 15.0f * uniform(rng);
+      float depth = 5.0f + 15.0f * uniform(rng);
+      float offset = 8.0f + 10.0f * uniform(rng);
+      float road = max(pathOffset("outdoor", x), pathOffset("outdoor", x + width)) * side;
+      float y = side * (max(road, 0.0f) + offset);
+      boxes.push_back(makeBox(x, y, 0.0f, x + width, y + side * depth, 4.0f + 16.0f * uniform(rng)));
+      x += width + 2.0f + 8.0f * uniform(rng);
+    }
+    for (float x = x0 + 15.0f * uniform(rng); x < x1; x += 10.0f + 10.0f * uniform(rng))
+    {
+      float y = pathOffset("outdoor", x) + side * (4.0f + uniform(rng));
+      boxes.push_back(makeBox(x, y, 0.0f, x + 0.3f, y + 0.3f, 5.0f));
+    }
+  }
+}
+
+// Distance along the ray to the nearest box (slab test), max_range if none
+static float castRay(const Eigen::Vector3f& origin, const Eigen::Vector3f& direction,
+                     const vector<const Box*>& boxes, float max_range)
+{
+  float nearest = max_range;
+  Eigen::Vector3f inverse = direction.cwiseInverse();
+  for (size_t b = 0; b < boxes.size(); b++)
+  {
+    Eigen::Vector3f t0 = (boxes[b]->min - origin).cwiseProduct(inverse);
+    Eigen::Vector3f t1 = (boxes[b]->max - origin).cwiseProduct(inverse);
+    float t_near = t0.cwiseMin(t1).maxCoeff();
+    float t_far = t0.cwiseMax(t1).minCoeff();
+    if (t_near <= t_far && t_far > 0.0f && t_near > 0.0f && t_near < nearest)
+      nearest = t_near;
+  }
+  return nearest;
+}
+
+// One scan in the sensor frame
+static void scan(const Eigen::Isometry3f& sensor_pose, const vector<Box>& boxes, const SessionConfig& cfg,
+                 mt19937& rng, pcl::PointCloud<pcl::PointXYZ>& cloud)
+{
+  // Boxes within range
+  const Eigen::Vector3f origin = sensor_pose.translation();
+  vector<const Box*> visible;
+  for (size_t b = 0; b < boxes.size(); b++)
+  {
+    Eigen::Vector3f closest = origin.cwiseMax(boxes[b].min).cwiseMin(boxes[b].max);
+    if ((closest - origin).norm() < cfg.range)
+      visible.push_back(&boxes[b]);
+  }
+
+  normal_distribution<float> range_noise (0.0f, cfg.noise);
+  const int nb_azimuths = (int)(360.0f / cfg.azimuth_resolution);
+  const Eigen::Matrix3f rotation = sensor_pose.linear();
+  cloud.points.clear();
+  cloud.points.reserve(cfg.rings * nb_azimuths);
+  for (int r = 0; r < cfg.rings; r++)
+  {
+    float elevation = cfg.rings > 1 ? (-0.5f + (float)r / (cfg.rings - 1)) * cfg.vertical_fov : 0.0f;
+    elevation *= M_PI / 180.0f;
+    for (int a = 0; a < nb_azimuths; a++)
+    {
+      float azimuth = a * cfg.azimuth_resolution * M_PI / 180.0f;
+      Eigen::Vector3f direction (cos(elevation) * cos(azimuth), cos(elevation) * sin(azimuth), sin(elevation));
+      float range = castRay(origin, rotation * direction, visible, cfg.range);
+      if (range >= cfg.range)
+        continue;
+      range += cfg.noise > 0.0f ? range_noise(rng) : 0.0f;
+      Eigen::Vector3f point = range * direction;
+      cloud.points.push_back(pcl::PointXYZ(point.x(), point.y(), point.z()));
+    }
+  }
+  cloud.width = cloud.points.size();
+  cloud.height = 1;
+  cloud.is_dense = true;
+}
+
+static void writePoseLine(ofstream& file, int counter, int64_t utime, const Eigen::Isometry3d& pose)
+{
+  // Same layout as the input poses written by AppROS::writeCloudToFile
+  int64_t sec = utime / 1000000;
+  int64_t nsec = utime - sec * 1000000;
+  Eigen::Quaterniond quat(pose.rotation());
+  file << counter << ", " << sec << ", " << nsec << ", "
+       << pose.translation().x() << ", " << pose.translation().y() << ", " << pose.translation().z() << ", "
+       << quat.x() << ", " << quat.y() << ", " << quat.z() << ", " << quat.w() << "\n";
+}
+
+int main(int argc, char** argv)
+{
+  SessionConfig cfg;
+  for (int i = 1; i + 1 < argc; i += 2)
+  {
+    string option = argv[i];
+    string value = argv[i + 1];
+    if (option == "--output") cfg.output = value;
+    else if (option == "--scene") cfg.scene = value;
+    else if (option == "--length") cfg.length = atof(value.c_str());
+    else if (option == "--step") cfg.step = atof(value.c_str());
+    else if (option == "--rate") cfg.rate = atof(value.c_str());
+    else if (option == "--rings") cfg.rings = max(atoi(value.c_str()), 1);
+    else if (option == "--vertical-fov") cfg.vertical_fov = atof(value.c_str());
+    else if (option == "--azimuth-resolution") cfg.azimuth_resolution = atof(value.c_str());
+    else if (option == "--range") cfg.range = atof(value.c_str());
+    else if (option == "--noise") cfg.noise = atof(value.c_str());
+    else if (option == "--drift") cfg.drift = atof(value.c_str());
+    else if (option == "--format") cfg.format = value;
+    else if (option == "--resolution") cfg.resolution = atof(value.c_str());
+    else if (option == "--seed") cfg.seed = atoi(value.c_str());
+    else
+    {
+      cerr << "[SyntheticSession] Unknown option " << option
+           << " (see the header of create_synthetic_session.cpp)." << endl;
+      return -1;
+    }
+  }
+  if (cfg.output.empty() || cfg.step <= 0.0f || cfg.rate <= 0.0f || cfg.azimuth_resolution <= 0.0f ||
+      (cfg.format != "log" && cfg.format != "pcd"))
+  {
+    cerr << "[SyntheticSession] Invalid options (see the header of create_synthetic_session.cpp)." << endl;
+    return -1;
+  }
+
+  mt19937 rng (cfg.seed);
+  vector<Box> boxes;
+  if (cfg.scene == "corridor")
+    buildCorridor(cfg.length, rng, boxes);
+  else if (cfg.scene == "rooms")
+    buildRooms(cfg.length, rng, boxes);
+  else if (cfg.scene == "outdoor")
+    buildOutdoor(cfg.length, rng, boxes);
+  else
+  {
+    cerr << "[SyntheticSession] Unknown scene " << cfg.scene << endl;
+    return -1;
+  }
+
+  ofstream ground_truth_file ((cfg.output + "/aicp_ground_truth_poses.csv").c_str());
+  ofstream poses_file;
+  CloudLogWriter log;
+  if (cfg.format == "log")
+  {
+    if (!log.open(cfg.output + "/aicp_input_clouds.aicplog", cfg.resolution))
+      return -1;
+  }
+  else
+  {
+    poses_file.open((cfg.output + "/aicp_input_poses.csv").c_str());
+    poses_file << "# counter, sec, nsec, x, y, z, qx, qy, qz, qw\n";
+  }
+  if (!ground_truth_file.is_open() || (cfg.format == "pcd" && !poses_file.is_open()))
+  {
+    cerr << "[SyntheticSession] Error: cannot write to " << cfg.output << endl;
+    return -1;
+  }
+  ground_truth_file << "# counter, sec, nsec, x, y, z, qx, qy, qz, qw\n";
+
+  // Odometry: ground truth increments with a random walk on x, y and yaw
+  normal_distribution<double> drift_noise (0.0, cfg.drift * sqrt(cfg.step));
+  Eigen::Isometry3d odometry = Eigen::Isometry3d::Identity();
+  Eigen::Isometry3d previous_truth = Eigen::Isometry3d::Identity();
+  pcl::PCDWriter writer;
+  const int64_t first_utime = 1000000;
+  const int nb_clouds = (int)(cfg.length / cfg.step) + 1;
+  size_t nb_points = 0;
+  for (int i = 0; i < nb_clouds; i++)
+  {
+    float x = i * cfg.step;
+    float heading = atan2(pathOffset(cfg.scene, x + 0.01f) - pathOffset(cfg.scene, x), 0.01f);
+    Eigen::Isometry3d truth = Eigen::Isometry3d::Identity();
+    truth.translation() << x, pathOffset(cfg.scene, x), sensorHeight(cfg.scene);
+    truth.rotate(Eigen::AngleAxisd(heading, Eigen::Vector3d::UnitZ()));
+
+    if (i == 0)
+      odometry = truth;
+    else
+    {
+      Eigen::Isometry3d increment = previous_truth.inverse() * truth;
+      Eigen::Isometry3d error = Eigen::Isometry3d::Identity();
+      error.translation() << drift_noise(rng), drift_noise(rng), 0.0;
+      error.rotate(Eigen::AngleAxisd(drift_noise(rng), Eigen::Vector3d::UnitZ()));
+      odometry = odometry * increment * error;
+    }
+    previous_truth = truth;
+
+    // Sensor frame scan, expressed in the odometry frame (as the accumulated input clouds)
+    pcl::PointCloud<pcl::PointXYZ>::Ptr cloud (new pcl::PointCloud<pcl::PointXYZ>);
+    scan(truth.cast<float>(), boxes, cfg, rng, *cloud);
+    const Eigen::Isometry3f to_odometry = odometry.cast<float>();
+    for (size_t p = 0; p < cloud->points.size(); p++)
+      cloud->points[p].getVector3fMap() = to_odometry * cloud->points[p].getVector3fMap();
+    nb_points += cloud->points.size();
+
+    int64_t utime = first_utime + (int64_t)(i * 1e6 / cfg.rate);
+    writePoseLine(ground_truth_file, i, utime, truth);
+    if (log.isOpen())
+      log.append(utime, odometry, cloud);
+    else
+    {
+      writePoseLine(poses_file, i, utime, odometry);
+      int64_t sec = utime / 1000000;
+      stringstream cloud_file;
+      cloud_file << cfg.output << "/cloud_" << i << "_" << sec << "_" << utime - sec * 1000000 << ".pcd";
+      writer.write<pcl::PointXYZ>(cloud_file.str(), *cloud, true);
+    }
+  }
+  log.close();
+
+  cout << "[SyntheticSession] " << cfg.scene << ": " << nb_clouds << " clouds, "
+       << nb_points / max(nb_clouds, 1) << " points per cloud on average, " << boxes.size()
+       << " boxes, written to " << cfg.output << endl;
+  return 0;
+}
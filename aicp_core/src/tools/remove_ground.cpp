@@ -0,0 +1,215 @@
+// aicp_remove_ground: batch ground removal (progressive morphological filter) of KITTI scans
+// One reader thread (input files in order), N workers running the ground filter,
+// one writer (binary PCD output). Same filter parameters as aicp_lcm pcl_ground_removal.
+
+// Run: aicp_remove_ground --output <dir> [options] <inputs...>
+//  inputs                          .bin (KITTI velodyne: float x, y, z, intensity) or .pcd files,
+//                                  or folders (their .bin and .pcd files, sorted by name)
+//  --output <dir>                  non-ground clouds, <dir>/<input name>.pcd
+//  --ground <dir>                  also write the ground clouds (default: not written)
+//  --threads <n>                   workers running the filter (default: hardware threads)
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <dirent.h>
+
+#include <pcl/io/pcd_io.h>
+#include <pcl/point_types.h>
+#include <pcl/filters/extract_indices.h>
+#include <pcl/segmentation/progressive_morphological_filter.h>
+
+#include "aicp_utils/boundedQueue.hpp"
+
+using namespace std;
+
+struct GroundRemovalItem
+{
+  string name; // output file name
+  pcl::PointCloud<pcl::PointXYZI>::Ptr cloud;
+  pcl::PointCloud<pcl::PointXYZI>::Ptr ground;
+};
+
+static string extensionOf(const string& file)
+{
+  size_t dot = file.find_last_of('.');
+  return dot == string::npos ? "" : file.substr(dot + 1);
+}
+
+// Files are expanded from folders, in name order (KITTI: frame order)
+static void listInputs(const string& input, vector<string>& files)
+{
+  DIR* dir = opendir(input.c_str());
+  if (dir == NULL)
+  {
+    files.push_back(input);
+    return;
+  }
+  vector<string> folder_files;
+  while (struct dirent* entry = readdir(dir))
+  {
+    string name = entry->d_name;
+    if (extensionOf(name) == "bin" || extensionOf(name) == "pcd")
+      folder_files.push_back(input + "/" + name);
+  }
+  closedir(dir);
+  sort(folder_files.begin(), folder_files.end());
+  files.insert(files.end(), folder_files.begin(), folder_files.end());
+}
+
+// KITTI velodyne scan: float x, y, z, reflectance per point
+static bool loadKittiBin(const string& file, pcl::PointCloud<pcl::PointXYZI>& cloud)
+{
+  FILE* fp = fopen(file.c_str(), "rb");
+  if (!fp)
+    return false;
+  fseek(fp, 0, SEEK_END);
+  long size = ftell(fp);
+  fseek(fp, 0, SEEK_SET);
+  vector<float> values (size / sizeof(float));
+  size_t nb_read = fread(values.data(), sizeof(float), values.size(), fp);
+  fclose(fp);
+
+  const size_t nb_points = nb_read / 4;
+  cloud.points.resize(nb_points);
+  for (size_t i = 0; i < nb_points; i++)
+  {
+    pcl::PointXYZI& point = cloud.points[i];
+    point.x = values[4*i];
+    point.y = values[4*i+1];
+    point.z = values[4*i+2];
+    point.intensity = values[4*i+3];
+  }
+  cloud.width = nb_points;
+  cloud.height = 1;
+  cloud.is_dense = true;
+  return true;
+}
+
+static void removeGround(GroundRemovalItem& item, bool keep_ground)
+{
+  pcl::PointIndicesPtr ground (new pcl::PointIndices);
+  pcl::ProgressiveMorphologicalFilter<pcl::PointXYZI> pmf;
+  pmf.setInputCloud (item.cloud);
+  pmf.setMaxWindowSize (1);
+  pmf.setSlope (0.1f);
+  pmf.setInitialDistance (0.1f);
+  pmf.setMaxDistance (2.0f);
+  pmf.extract (ground->indices);
+
+  pcl::ExtractIndices<pcl::PointXYZI> extract;
+  extract.setInputCloud (item.cloud);
+  extract.setIndices (ground);
+  if (keep_ground)
+  {
+    item.ground.reset(new pcl::PointCloud<pcl::PointXYZI>);
+    extract.filter (*item.ground);
+  }
+
+  // Non-ground returns
+  pcl::PointCloud<pcl::PointXYZI>::Ptr objects (new pcl::PointCloud<pcl::PointXYZI>);
+  extract.setNegative (true);
+  extract.filter (*objects);
+  item.cloud = objects;
+}
+
+int main (int argc, char** argv)
+{
+  string output_dir;
+  string ground_dir;
+  int num_threads = thread::hardware_concurrency();
+  vector<string> files;
+  for (int i = 1; i < argc; i++)
+  {
+    string option = argv[i];
+    if (option == "--output" && i + 1 < argc)
+      output_dir = argv[++i];
+    else if (option == "--ground" && i + 1 < argc)
+      ground_dir = argv[++i];
+    else if (option == "--threads" && i + 1 < argc)
+      num_threads = atoi(argv[++i]);
+    else if (option.compare(0, 2, "--") == 0)
+    {
+      cerr << "[RemoveGround] Unknown option " << option << " (see the header of remove_ground.cpp)." << endl;
+      return -1;
+    }
+    else
+      listInputs(option, files);
+  }
+  num_threads = max(num_threads, 1);
+  if (output_dir.empty() || files.empty())
+  {
+    cerr << "Input files and output folder required (see the header of remove_ground.cpp)." << endl;
+    return -1;
+  }
+  cout << "[RemoveGround] " << files.size() << " clouds, " << num_threads << " threads." << endl;
+
+  // Bounded: a few clouds in flight per worker
+  BoundedQueue<GroundRemovalItem> read_queue (2 * num_threads);
+  BoundedQueue<GroundRemovalItem> write_queue (2 * num_threads);
+  atomic<size_t> nb_failed (0);
+
+  vector<thread> workers;
+  for (int t = 0; t < num_threads; t++)
+    workers.push_back(thread([&]()
+    {
+      GroundRemovalItem item;
+      while (read_queue.pop(item))
+      {
+        removeGround(item, !ground_dir.empty());
+        write_queue.push(item);
+      }
+    }));
+
+  thread writer([&]()
+  {
+    pcl::PCDWriter pcd_writer;
+    GroundRemovalItem item;
+    size_t nb_written = 0;
+    while (write_queue.pop(item))
+    {
+      if (pcd_writer.writeBinary<pcl::PointXYZI>(output_dir + "/" + item.name, *item.cloud) != 0 ||
+          (item.ground && pcd_writer.writeBinary<pcl::PointXYZI>(ground_dir + "/" + item.name, *item.ground) != 0))
+      {
+        cerr << "[RemoveGround] Error: cannot write " << item.name << endl;
+        nb_failed++;
+        continue;
+      }
+      if (++nb_written % 100 == 0)
+        cout << "[RemoveGround] " << nb_written << " clouds written." << endl;
+    }
+  });
+
+  // Reader (this thread)
+  for (size_t i = 0; i < files.size(); i++)
+  {
+    GroundRemovalItem item;
+    string name = files[i].substr(files[i].find_last_of('/') + 1);
+    item.name = name.substr(0, name.find_last_of('.')) + ".pcd";
+    item.cloud.reset(new pcl::PointCloud<pcl::PointXYZI>);
+    bool loaded = (extensionOf(files[i]) == "bin") ? loadKittiBin(files[i], *item.cloud)
+                                                   : pcl::io::loadPCDFile<pcl::PointXYZI>(files[i], *item.cloud) == 0;
+    if (!loaded)
+    {
+      cerr << "[RemoveGround] Was not able to open file \"" << files[i] << "\"." << endl;
+      nb_failed++;
+      continue;
+    }
+    read_queue.push(item);
+  }
+
+  read_queue.close();
+  for (size_t t = 0; t < workers.size(); t++)
+    workers[t].join();
+  write_queue.close();
+  writer.join();
+
+  cout << "[RemoveGround] Done: " << files.size() - nb_failed << " clouds written to " << output_dir
+       << ", " << nb_failed << " failed." << endl;
+  return nb_failed > 0 ? -1 : 0;
+}
@@ -0,0 +1,250 @@
+#include "aicp_utils/cloudCodec.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <limits>
+
+// Header: magic, version, cell bits, utime, resolution, origin (x, y, z), cells per axis x, y,
+// nb of points, nb of cells, size of the cells section (bytes)
+static const char cloud_codec_magic[4] = {'A', 'I', 'C', 'Z'};
+static const uint8_t cloud_codec_version = 1;
+static const size_t cloud_codec_header_size = 4 + 1 + 1 + 2 + 8 + 4 + 3 * 4 + 2 * 8 + 3 * 4;
+
+template <typename T>
+static void writeValue(uint8_t*& out, const T& value)
+{
+  std::memcpy(out, &value, sizeof(T));
+  out += sizeof(T);
+}
+
+template <typename T>
+static void readValue(const uint8_t*& in, T& value)
+{
+  std::memcpy(&value, in, sizeof(T));
+  in += sizeof(T);
+}
+
+static void writeVarint(std::vector<uint8_t>& data, uint64_t value)
+{
+  while (value >= 0x80)
+  {
+    data.push_back((uint8_t)(value | 0x80));
+    value >>= 7;
+  }
+  data.push_back((uint8_t)value);
+}
+
+// False if truncated or longer than 64 bits
+static bool readVarint(const uint8_t*& in, const uint8_t* end, uint64_t& value)
+{
+  value = 0;
+  for (int shift = 0; shift < 64; shift += 7)
+  {
+    if (in == end)
+      return false;
+    uint8_t byte = *in++;
+    value |= (uint64_t)(byte & 0x7F) << shift;
+    if (!(byte & 0x80))
+      return true;
+  }
+  return false;
+}
+
+CloudCodec::CloudCodec(float resolution, float cell_size) :
+  resolution_(resolution > 0.0f ? resolution : 0.01f)
+{
+  int bits = (int)std::lround(std::log2(std::max(cell_size, resolution_) / resolution_));
+  cell_bits_ = std::max(1, std::min(bits, 16));
+}
+
+void CloudCodec::encode(const pcl::PointCloud<pcl::PointXYZ>& cloud, int64_t utime, std::vector<uint8_t>& data)
+{
+  const int bits = cell_bits_;
+  const uint64_t offset_mask = (1ULL << bits) - 1;
+
+  Eigen::Array3f origin = Eigen::Array3f::Constant(std::numeric_limits<float>::max());
+  Eigen::Array3f bbox_max = Eigen::Array3f::Constant(-std::numeric_limits<float>::max());
+  size_t nb_points = 0;
+  for (size_t i = 0; i < cloud.size(); i++)
+  {
+    const Eigen::Array3f point = cloud.points[i].getArray3fMap();
+    if (!point.isFinite().all())
+      continue;
+    origin = origin.min(point);
+    bbox_max = bbox_max.max(point);
+    nb_points++;
+  }
+  if (nb_points == 0)
+  {
+    origin.setZero();
+    bbox_max.setZero();
+  }
+
+  // Step increased if the cell indices do not fit (cell index and offsets in 64 bits)
+  float resolution = resolution_;
+  uint64_t nx, ny, nz;
+  float inverse_resolution;
+  while (true)
+  {
+    // Same rounding as the points (largest steps)
+    inverse_resolution = 1.0f / resolution;
+    const Eigen::Array3f max_steps = ((bbox_max - origin) * inverse_resolution).round();
+    nx = ((uint64_t)max_steps(0) >> bits) + 1;
+    ny = ((uint64_t)max_steps(1) >> bits) + 1;
+    nz = ((uint64_t)max_steps(2) >> bits) + 1;
+    if (max_steps.maxCoeff() < std::ldexp(1.0f, 62) &&
+        (double)nx * ny * nz < std::ldexp(1.0, 62 - 3 * bits))
+      break;
+    resolution *= 2.0f;
+  }
+
+  // Cell index in scan order (x fastest), offsets in the low bits: sorted by cell
+  keys_.clear();
+  keys_.reserve(nb_points);
+  for (size_t i = 0; i < cloud.size(); i++)
+  {
+    const Eigen::Array3f point = cloud.points[i].getArray3fMap();
+    if (!point.isFinite().all())
+      continue;
+    const Eigen::Array3f steps = ((point - origin) * inverse_resolution).round();
+    const uint64_t qx = (uint64_t)steps(0), qy = (uint64_t)steps(1), qz = (uint64_t)steps(2);
+    const uint64_t cell = (qx >> bits) + nx * ((qy >> bits) + ny * (qz >> bits));
+    keys_.push_back((cell << (3 * bits)) | (qx & offset_mask) | ((qy & offset_mask) << bits) |
+                    ((qz & offset_mask) << (2 * bits)));
+  }
+  std::sort(keys_.begin(), keys_.end());
+
+  // Cells section after the header
+  data.assign(cloud_codec_header_size, 0);
+  data.reserve(cloud_codec_header_size + 2 * keys_.size());
+  uint64_t previous_cell = 0;
+  uint32_t nb_cells = 0;
+  for (size_t i = 0; i < keys_.size();)
+  {
+    const uint64_t cell = keys_[i] >> (3 * bits);
+    size_t end = i + 1;
+    while (end < keys_.size() && (keys_[end] >> (3 * bits)) == cell)
+      end++;
+    writeVarint(data, cell - previous_cell);
+    writeVarint(data, end - i);
+    previous_cell = cell;
+    nb_cells++;
+    i = end;
+  }
+  const uint32_t cells_size = data.size() - cloud_codec_header_size;
+
+  // Offsets section (bit stream, cell order)
+  const uint64_t point_mask = (1ULL << (3 * bits)) - 1;
+  uint64_t buffer = 0;
+  int nb_buffered = 0;
+  for (size_t i = 0; i < keys_.size(); i++)
+  {
+    buffer |= (keys_[i] & point_mask) << nb_buffered;
+    nb_buffered += 3 * bits;
+    while (nb_buffered >= 8)
+    {
+      data.push_back((uint8_t)buffer);
+      buffer >>= 8;
+      nb_buffered -= 8;
+    }
+  }
+  if (nb_buffered > 0)
+    data.push_back((uint8_t)buffer);
+
+  uint8_t* out = data.data();
+  std::memcpy(out, cloud_codec_magic, 4);
+  out += 4;
+  writeValue(out, cloud_codec_version);
+  writeValue(out, (uint8_t)bits);
+  writeValue(out, (uint16_t)0);
+  writeValue(out, utime);
+  writeValue(out, resolution);
+  writeValue(out, origin(0));
+  writeValue(out, origin(1));
+  writeValue(out, origin(2));
+  writeValue(out, nx);
+  writeValue(out, ny);
+  writeValue(out, (uint32_t)keys_.size());
+  writeValue(out, nb_cells);
+  writeValue(out, cells_size);
+}
+
+bool CloudCodec::decode(const uint8_t* data, size_t size, pcl::PointCloud<pcl::PointXYZ>& cloud_out,
+                        int64_t& utime)
+{
+  cloud_out.clear();
+  if (size < cloud_codec_header_size || std::memcmp(data, cloud_codec_magic, 4) != 0)
+    return false;
+
+  const uint8_t* in = data + 4;
+  uint8_t version, bits;
+  uint16_t reserved;
+  float resolution, ox, oy, oz;
+  uint64_t nx, ny;
+  uint32_t nb_points, nb_cells, cells_size;
+  readValue(in, version);
+  readValue(in, bits);
+  readValue(in, reserved);
+  readValue(in, utime);
+  readValue(in, resolution);
+  readValue(in, ox);
+  readValue(in, oy);
+  readValue(in, oz);
+  readValue(in, nx);
+  readValue(in, ny);
+  readValue(in, nb_points);
+  readValue(in, nb_cells);
+  readValue(in, cells_size);
+  const size_t offsets_size = ((uint64_t)nb_points * 3 * bits + 7) / 8;
+  if (version != cloud_codec_version || bits < 1 || bits > 16 || nx == 0 || ny == 0 ||
+      size - cloud_codec_header_size < (uint64_t)cells_size + offsets_size)
+    return false;
+
+  cloud_out.points.resize(nb_points);
+  const uint8_t* cells = in;
+  const uint8_t* cells_end = in + cells_size;
+  const uint8_t* offsets = cells_end;
+  const uint64_t offset_mask = (1ULL << bits) - 1;
+  uint64_t cell = 0;
+  uint64_t buffer = 0;
+  int nb_buffered = 0;
+  size_t nb_decoded = 0;
+  for (uint32_t c = 0; c < nb_cells; c++)
+  {
+    uint64_t delta, count;
+    if (!readVarint(cells, cells_end, delta) || !readVarint(cells, cells_end, count) ||
+        count > nb_points - nb_decoded)
+    {
+      cloud_out.clear();
+      return false;
+    }
+    cell += delta;
+    const uint64_t cx = cell % nx;
+    const uint64_t cy = (cell / nx) % ny;
+    const uint64_t cz = cell / nx / ny;
+    for (uint64_t k = 0; k < count; k++, nb_decoded++)
+    {
+      while (nb_buffered < 3 * bits)
+      {
+        buffer |= (uint64_t)(*offsets++) << nb_buffered;
+        nb_buffered += 8;
+      }
+      pcl::PointXYZ& point = cloud_out.points[nb_decoded];
+      point.x = ox + resolution * ((cx << bits) | (buffer & offset_mask));
+      point.y = oy + resolution * ((cy << bits) | ((buffer >> bits) & offset_mask));
+      point.z = oz + resolution * ((cz << bits) | ((buffer >> (2 * bits)) & offset_mask));
+      buffer >>= 3 * bits;
+      nb_buffered -= 3 * bits;
+    }
+  }
+  if (nb_decoded != nb_points)
+  {
+    cloud_out.clear();
+    return false;
+  }
+  cloud_out.width = nb_points;
+  cloud_out.height = 1;
+  cloud_out.is_dense = true;
+  return true;
+}
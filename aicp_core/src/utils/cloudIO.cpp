@@ -1,5 +1,8 @@
 #include "aicp_utils/cloudIO.h"
 
+#include <cstddef>
+#include <cstdint>
+
 int savePlanarCloudCSV (const std::string &file_name, const pcl::PCLPointCloud2 &cloud)
 {
   if (cloud.data.empty ())
@@ -65,148 +68,186 @@ void savePointCloudPCLwithPose(const std::string file_name, pcl::PointCloud<pcl:
   writer.write<pcl::PointXYZRGB> (file_name, *cloud, false);
 }
 
-void fromDataPointsToPCL(DP &cloud_in, pcl::PointCloud<pcl::PointXYZ> &cloud_out)
+// Descriptor fields of a PCL point type, copied to (from) the DataPoints descriptors
+// in this order. Adding a point type (e.g. intensity, ring) only needs its table.
+struct PointField
 {
-  cloud_out.points.resize(cloud_in.getNbPoints());
-  for (int i = 0; i < cloud_in.getNbPoints(); i++) {
-    cloud_out.points[i].x = (cloud_in.features.col(i))[0];
-    cloud_out.points[i].y = (cloud_in.features.col(i))[1];
-    cloud_out.points[i].z = (cloud_in.features.col(i))[2];
-    //cout << "i=" << i << " " << cloud_out.points[i].x << " " << cloud_out.points[i].y << " " << cloud_out.points[i].z << endl;
-  }
-  cloud_out.width = cloud_out.points.size();
-  cloud_out.height = 1;
-}
+  const char* name; // descriptor label (one row per element)
+  size_t offset;    // bytes from the start of the point
+  int span;         // consecutive elements
+  bool is_byte;     // uint8 elements (e.g. colors), float otherwise
+};
 
-void fromPCLToDataPoints(DP &cloud_out, pcl::PointCloud<pcl::PointXYZ> &cloud_in)
+template <typename PointT>
+struct PointFields
 {
-  int pointCount = cloud_in.width;
+  static const int size = 0;
+  static const PointField* fields() { return NULL; }
+};
 
-  PM::Matrix features(4, pointCount);
+template <>
+struct PointFields<pcl::PointXYZI>
+{
+  static const int size = 1;
+  static constexpr PointField table[size] = {
+    {"intensity", offsetof(pcl::PointXYZI, intensity), 1, false}};
+  static const PointField* fields() { return table; }
+};
+constexpr PointField PointFields<pcl::PointXYZI>::table[];
 
-  for (int p = 0; p < pointCount; ++p)
+template <>
+struct PointFields<pcl::PointXYZRGB>
+{
+  static const int size = 3;
+  static constexpr PointField table[size] = {
+    {"red", offsetof(pcl::PointXYZRGB, r), 1, true},
+    {"green", offsetof(pcl::PointXYZRGB, g), 1, true},
+    {"blue", offsetof(pcl::PointXYZRGB, b), 1, true}};
+  static const PointField* fields() { return table; }
+};
+constexpr PointField PointFields<pcl::PointXYZRGB>::table[];
+
+template <>
+struct PointFields<pcl::PointXYZRGBNormal>
+{
+  static const int size = 4;
+  static constexpr PointField table[size] = {
+    {"red", offsetof(pcl::PointXYZRGBNormal, r), 1, true},
+    {"green", offsetof(pcl::PointXYZRGBNormal, g), 1, true},
+    {"blue", offsetof(pcl::PointXYZRGBNormal, b), 1, true},
+    {"normals", offsetof(pcl::PointXYZRGBNormal, normal_x), 3, false}}; // as SurfaceNormalDataPointsFilter output
+  static const PointField* fields() { return table; }
+};
+constexpr PointField PointFields<pcl::PointXYZRGBNormal>::table[];
+
+// Row of a field element over all points (strided view of the PCL points)
+typedef Eigen::Map<const Eigen::Matrix<float, 1, Eigen::Dynamic>, 0, Eigen::InnerStride<> > ConstFloatRow;
+typedef Eigen::Map<Eigen::Matrix<float, 1, Eigen::Dynamic>, 0, Eigen::InnerStride<> > FloatRow;
+typedef Eigen::Map<const Eigen::Matrix<uint8_t, 1, Eigen::Dynamic>, 0, Eigen::InnerStride<> > ConstByteRow;
+typedef Eigen::Map<Eigen::Matrix<uint8_t, 1, Eigen::Dynamic>, 0, Eigen::InnerStride<> > ByteRow;
+
+// PCL points store x, y, z as the first floats of a padded struct: features are
+// copied in a single strided block (no per point access, no per feature re-allocation),
+// descriptors allocated once and copied one row at a time
+template <typename PointT>
+static void setFeaturesFromPCL(DP &cloud_out, pcl::PointCloud<PointT> &cloud_in)
+{
+  const int stride = sizeof(PointT) / sizeof(float);
+  const int pointCount = cloud_in.points.size();
+
+  cloud_out.featureLabels.clear();
+  cloud_out.featureLabels.push_back(DP::Label("x", 1));
+  cloud_out.featureLabels.push_back(DP::Label("y", 1));
+  cloud_out.featureLabels.push_back(DP::Label("z", 1));
+  cloud_out.featureLabels.push_back(DP::Label("pad", 1));
+  cloud_out.features.resize(4, pointCount);
+  cloud_out.features.topRows(3) = cloud_in.getMatrixXfMap(3, stride, 0);
+  cloud_out.features.row(3).setOnes();
+
+  const PointField* fields = PointFields<PointT>::fields();
+  int rows = 0;
+  cloud_out.descriptorLabels.clear();
+  for (int f = 0; f < PointFields<PointT>::size; f++)
   {
-    features(0, p) = cloud_in.points[p].x;
-    features(1, p) = cloud_in.points[p].y;
-    features(2, p) = cloud_in.points[p].z;
-    features(3, p) = 1.0;
+    cloud_out.descriptorLabels.push_back(DP::Label(fields[f].name, fields[f].span));
+    rows += fields[f].span;
   }
-  cloud_out.addFeature("x", features.row(0));
-  cloud_out.addFeature("y", features.row(1));
-  cloud_out.addFeature("z", features.row(2));
-  cloud_out.addFeature("pad", features.row(3));
-}
+  if (rows == 0 || pointCount == 0)
+  {
+    cloud_out.descriptors = PM::Matrix(rows, rows == 0 ? 0 : pointCount);
+    return;
+  }
+  cloud_out.descriptors.resize(rows, pointCount);
 
-// TODO: These methods deal with rgb field (rgb assignment MUST be debugged)
-void fromDataPointsToPCL(DP &cloud_in, pcl::PointCloud<pcl::PointXYZRGB> &cloud_out)
-{
-  cloud_out.points.resize(cloud_in.getNbPoints());
-  for (int i = 0; i < cloud_in.getNbPoints(); i++) {
-    cloud_out.points[i].x = (cloud_in.features.col(i))[0];
-    cloud_out.points[i].y = (cloud_in.features.col(i))[1];
-    cloud_out.points[i].z = (cloud_in.features.col(i))[2];
-    int color_row = cloud_in.getDescriptorStartingRow("color"); // (see pointmatcher/IO.h)
-    if (cloud_in.descriptorExists("color"))
+  const char* points = reinterpret_cast<const char*>(cloud_in.points.data());
+  int row = 0;
+  for (int f = 0; f < PointFields<PointT>::size; f++)
+  {
+    for (int e = 0; e < fields[f].span; e++, row++)
     {
-      cloud_out.points[i].r = (cloud_in.descriptors.col(i))[color_row];
-      cloud_out.points[i].g = (cloud_in.descriptors.col(i))[color_row+1];
-      cloud_out.points[i].b = (cloud_in.descriptors.col(i))[color_row+2];
+      if (fields[f].is_byte)
+        cloud_out.descriptors.row(row) = ConstByteRow(reinterpret_cast<const uint8_t*>(points + fields[f].offset) + e,
+                                                      pointCount, Eigen::InnerStride<>(sizeof(PointT))).cast<float>();
+      else
+        cloud_out.descriptors.row(row) = ConstFloatRow(reinterpret_cast<const float*>(points + fields[f].offset) + e,
+                                                       pointCount, Eigen::InnerStride<>(stride));
     }
-    else
-      std::cerr << "[Cloud IO] Cloud conversion with color failed." << std::endl;
   }
-  cloud_out.width = cloud_out.points.size();
-  cloud_out.height = 1;
 }
 
-void fromPCLToDataPoints(DP &cloud_out, pcl::PointCloud<pcl::PointXYZRGB> &cloud_in)
+template <typename PointT>
+static void setPCLFromFeatures(DP &cloud_in, pcl::PointCloud<PointT> &cloud_out)
 {
-  int pointCount = cloud_in.width;
+  const int stride = sizeof(PointT) / sizeof(float);
+  const int pointCount = cloud_in.getNbPoints();
 
-  PM::Matrix features(4, pointCount);
-  PM::Matrix colors(3, pointCount);
+  cloud_out.points.resize(pointCount);
+  cloud_out.getMatrixXfMap(3, stride, 0) = cloud_in.features.topRows(3);
+  cloud_out.width = cloud_out.points.size();
+  cloud_out.height = 1;
+  if (pointCount == 0)
+    return;
 
-  for (int p = 0; p < pointCount; ++p)
+  const PointField* fields = PointFields<PointT>::fields();
+  char* points = reinterpret_cast<char*>(cloud_out.points.data());
+  for (int f = 0; f < PointFields<PointT>::size; f++)
   {
-    features(0, p) = cloud_in.points[p].x;
-    features(1, p) = cloud_in.points[p].y;
-    features(2, p) = cloud_in.points[p].z;
-    features(3, p) = 1.0;
-    colors(0, p) = cloud_in.points[p].r;
-    colors(1, p) = cloud_in.points[p].g;
-    colors(2, p) = cloud_in.points[p].b;
-  }
-  cloud_out.addFeature("x", features.row(0));
-  cloud_out.addFeature("y", features.row(1));
-  cloud_out.addFeature("z", features.row(2));
-  cloud_out.addFeature("pad", features.row(3));
-  cloud_out.addDescriptor("red", colors.row(0));
-  cloud_out.addDescriptor("green", colors.row(1));
-  cloud_out.addDescriptor("blue", colors.row(2));
-}
-
-// TODO: These methods deal with rgb and normal fields (rgb and normals assignment MUST be debugged)
-void fromDataPointsToPCL(DP &cloud_in, pcl::PointCloud<pcl::PointXYZRGBNormal> &cloud_out)
-{
-  cloud_out.points.resize(cloud_in.getNbPoints());
-  for (int i = 0; i < cloud_in.getNbPoints(); i++) {
-    cloud_out.points[i].x = (cloud_in.features.col(i))[0];
-    cloud_out.points[i].y = (cloud_in.features.col(i))[1];
-    cloud_out.points[i].z = (cloud_in.features.col(i))[2];
-    int color_row = cloud_in.getDescriptorStartingRow("color"); // (see pointmatcher/IO.h)
-    if (cloud_in.descriptorExists("color"))
+    if (!cloud_in.descriptorExists(fields[f].name, fields[f].span))
     {
-      cloud_out.points[i].r = (cloud_in.descriptors.col(i))[color_row];
-      cloud_out.points[i].g = (cloud_in.descriptors.col(i))[color_row+1];
-      cloud_out.points[i].b = (cloud_in.descriptors.col(i))[color_row+2];
+      std::cerr << "[Cloud IO] Cloud conversion with " << fields[f].name << " failed." << std::endl;
+      continue;
     }
-    else
-      std::cerr << "[Cloud IO] Cloud conversion with color failed." << std::endl;
-    int normals_row = cloud_in.getDescriptorStartingRow("normals"); // (see pointmatcher/IO.h)
-    if (cloud_in.descriptorExists("normals"))
+    const int row = cloud_in.getDescriptorStartingRow(fields[f].name);
+    for (int e = 0; e < fields[f].span; e++)
     {
-      cloud_out.points[i].normal_x = (cloud_in.descriptors.col(i))[normals_row];
-      cloud_out.points[i].normal_y = (cloud_in.descriptors.col(i))[normals_row+1];
-      cloud_out.points[i].normal_z = (cloud_in.descriptors.col(i))[normals_row+2];
+      if (fields[f].is_byte)
+        ByteRow(reinterpret_cast<uint8_t*>(points + fields[f].offset) + e, pointCount,
+                Eigen::InnerStride<>(sizeof(PointT))) = cloud_in.descriptors.row(row + e).cast<uint8_t>();
+      else
+        FloatRow(reinterpret_cast<float*>(points + fields[f].offset) + e, pointCount,
+                 Eigen::InnerStride<>(stride)) = cloud_in.descriptors.row(row + e);
     }
-    else
-      std::cerr << "[Cloud IO] Cloud conversion with normals failed." << std::endl;
   }
-  cloud_out.width = cloud_out.points.size();
-  cloud_out.height = 1;
 }
 
-void fromPCLToDataPoints(DP &cloud_out, pcl::PointCloud<pcl::PointXYZRGBNormal> &cloud_in)
+void fromDataPointsToPCL(DP &cloud_in, pcl::PointCloud<pcl::PointXYZ> &cloud_out)
+{
+  setPCLFromFeatures(cloud_in, cloud_out);
+}
+
+void fromPCLToDataPoints(DP &cloud_out, pcl::PointCloud<pcl::PointXYZ> &cloud_in)
 {
-  int pointCount = cloud_in.width;
+  setFeaturesFromPCL(cloud_out, cloud_in);
+}
 
-  PM::Matrix features(4, pointCount);
-  PM::Matrix colors(3, pointCount);
-  PM::Matrix normals(3, pointCount);
+void fromDataPointsToPCL(DP &cloud_in, pcl::PointCloud<pcl::PointXYZI> &cloud_out)
+{
+  setPCLFromFeatures(cloud_in, cloud_out);
+}
 
-  for (int p = 0; p < pointCount; ++p)
-  {
-    features(0, p) = cloud_in.points[p].x;
-    features(1, p) = cloud_in.points[p].y;
-    features(2, p) = cloud_in.points[p].z;
-    features(3, p) = 1.0;
-    colors(0, p) = cloud_in.points[p].r;
-    colors(1, p) = cloud_in.points[p].g;
-    colors(2, p) = cloud_in.points[p].b;
-    normals(0, p) = cloud_in.points[p].normal_x;
-    normals(1, p) = cloud_in.points[p].normal_y;
-    normals(2, p) = cloud_in.points[p].normal_z;
-  }
-  cloud_out.addFeature("x", features.row(0));
-  cloud_out.addFeature("y", features.row(1));
-  cloud_out.addFeature("z", features.row(2));
-  cloud_out.addFeature("pad", features.row(3));
-  cloud_out.addDescriptor("red", colors.row(0));
-  cloud_out.addDescriptor("green", colors.row(1));
-  cloud_out.addDescriptor("blue", colors.row(2));
-  cloud_out.addDescriptor("nx", normals.row(0));
-  cloud_out.addDescriptor("ny", normals.row(1));
-  cloud_out.addDescriptor("nz", normals.row(2));
+void fromPCLToDataPoints(DP &cloud_out, pcl::PointCloud<pcl::PointXYZI> &cloud_in)
+{
+  setFeaturesFromPCL(cloud_out, cloud_in);
+}
+
+void fromDataPointsToPCL(DP &cloud_in, pcl::PointCloud<pcl::PointXYZRGB> &cloud_out)
+{
+  setPCLFromFeatures(cloud_in, cloud_out);
+}
+
+void fromPCLToDataPoints(DP &cloud_out, pcl::PointCloud<pcl::PointXYZRGB> &cloud_in)
+{
+  setFeaturesFromPCL(cloud_out, cloud_in);
+}
+
+void fromDataPointsToPCL(DP &cloud_in, pcl::PointCloud<pcl::PointXYZRGBNormal> &cloud_out)
+{
+  setPCLFromFeatures(cloud_in, cloud_out);
+}
+
+void fromPCLToDataPoints(DP &cloud_out, pcl::PointCloud<pcl::PointXYZRGBNormal> &cloud_in)
+{
+  setFeaturesFromPCL(cloud_out, cloud_in);
 }
 
 /* Get a transformation matrix (of the type defined in the libpointmatcher library)
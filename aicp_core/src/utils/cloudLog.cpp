@@ -0,0 +1,354 @@
+#include "aicp_utils/cloudLog.hpp"
+#include "aicp_utils/compactCloud.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+
+#include <pcl/io/lzf.h>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static const char cloud_log_magic[8] = {'A', 'I', 'C', 'P', 'L', 'O', 'G', '1'};
+static const uint32_t cloud_log_version = 1;
+static const size_t cloud_log_header_size = 16;
+static const size_t cloud_log_record_header_size = 92;
+
+template <typename T>
+static void writeValue(char* data, const T& value)
+{
+  std::memcpy(data, &value, sizeof(T));
+}
+
+template <typename T>
+static T readValue(const char* data)
+{
+  T value;
+  std::memcpy(&value, data, sizeof(T));
+  return value;
+}
+
+// Bytes of same significance grouped together (better compression of coordinates)
+static void shuffleBytes(const char* in, size_t nb_elements, size_t element_size, char* out)
+{
+  for (size_t i = 0; i < nb_elements; i++)
+    for (size_t b = 0; b < element_size; b++)
+      out[b * nb_elements + i] = in[i * element_size + b];
+}
+
+static void unshuffleBytes(const char* in, size_t nb_elements, size_t element_size, char* out)
+{
+  for (size_t i = 0; i < nb_elements; i++)
+    for (size_t b = 0; b < element_size; b++)
+      out[i * element_size + b] = in[b * nb_elements + i];
+}
+
+CloudLogWriter::CloudLogWriter() :
+  resolution_(0.0f), nb_records_(0), nb_bytes_(0)
+{
+}
+
+CloudLogWriter::~CloudLogWriter()
+{
+  close();
+}
+
+bool CloudLogWriter::open(const std::string& file_name, float resolution, size_t queue_size)
+{
+  close();
+
+  file_.open(file_name.c_str(), std::ios::out | std::ios::binary | std::ios::trunc);
+  if (!file_.is_open())
+  {
+    std::cerr << "[CloudLog] Error: cannot open file " << file_name << std::endl;
+    return false;
+  }
+  file_.write(cloud_log_magic, sizeof(cloud_log_magic));
+  char header[8];
+  writeValue(header, cloud_log_version);
+  writeValue(header + 4, (uint32_t)0);
+  file_.write(header, sizeof(header));
+  file_.flush();
+
+  file_name_ = file_name;
+  resolution_ = std::max(resolution, 0.0f);
+  nb_records_ = 0;
+  nb_bytes_ = cloud_log_header_size;
+  queue_.reset(new BoundedQueue<Record>(queue_size));
+  thread_ = std::thread(&CloudLogWriter::writeRecords, this);
+  return true;
+}
+
+void CloudLogWriter::close()
+{
+  if (!thread_.joinable())
+    return;
+  queue_->close();
+  thread_.join();
+  queue_.reset();
+  file_.close();
+  std::cout << "[CloudLog] Wrote " << nb_records_ << " clouds (" << nb_bytes_ / 1024 / 1024
+            << " MB) to " << file_name_ << std::endl;
+}
+
+bool CloudLogWriter::append(int64_t utime, const Eigen::Isometry3d& pose,
+                            const pcl::PointCloud<pcl::PointXYZ>::ConstPtr& cloud)
+{
+  if (!thread_.joinable() || !cloud)
+    return false;
+  Record record;
+  record.utime = utime;
+  Eigen::Quaterniond quat(pose.rotation());
+  record.pose[0] = pose.translation().x();
+  record.pose[1] = pose.translation().y();
+  record.pose[2] = pose.translation().z();
+  record.pose[3] = quat.x();
+  record.pose[4] = quat.y();
+  record.pose[5] = quat.z();
+  record.pose[6] = quat.w();
+  record.cloud = cloud;
+  return queue_->push(record);
+}
+
+void CloudLogWriter::writeRecords()
+{
+  Record record;
+  while (queue_->pop(record))
+  {
+    writeRecord(record);
+    record.cloud.reset();
+  }
+}
+
+void CloudLogWriter::writeRecord(const Record& record)
+{
+  const pcl::PointCloud<pcl::PointXYZ>& cloud = *record.cloud;
+  Eigen::Vector3f origin ((float)record.pose[0], (float)record.pose[1], (float)record.pose[2]);
+
+  // Coordinates arrays
+  size_t nb_points;
+  size_t element_size;
+  float resolution = 0.0f;
+  if (resolution_ > 0.0f)
+  {
+    CompactCloud compact;
+    compact.encode(cloud, origin, resolution_);
+    nb_points = compact.size();
+    element_size = sizeof(int16_t);
+    resolution = compact.getResolution();
+    raw_.resize(3 * nb_points * element_size);
+    std::memcpy(raw_.data(), compact.getX(), nb_points * element_size);
+    std::memcpy(raw_.data() + nb_points * element_size, compact.getY(), nb_points * element_size);
+    std::memcpy(raw_.data() + 2 * nb_points * element_size, compact.getZ(), nb_points * element_size);
+  }
+  else
+  {
+    origin.setZero();
+    nb_points = cloud.size();
+    element_size = sizeof(float);
+    raw_.resize(3 * nb_points * element_size);
+    float* x = reinterpret_cast<float*>(raw_.data());
+    for (size_t i = 0; i < nb_points; i++)
+    {
+      x[i] = cloud.points[i].x;
+      x[nb_points + i] = cloud.points[i].y;
+      x[2 * nb_points + i] = cloud.points[i].z;
+    }
+  }
+
+  // Compressed block (stored as is if not smaller)
+  const size_t raw_size = raw_.size();
+  shuffled_.resize(raw_size);
+  shuffleBytes(raw_.data(), 3 * nb_points, element_size, shuffled_.data());
+  stored_.resize(raw_size);
+  size_t stored_size = 0;
+  if (raw_size > 0)
+    stored_size = pcl::lzfCompress(shuffled_.data(), raw_size, stored_.data(), raw_size - 1);
+  const char* block = stored_.data();
+  if (stored_size == 0)
+  {
+    stored_size = raw_size;
+    block = shuffled_.data();
+  }
+
+  char header[4 + cloud_log_record_header_size];
+  writeValue(header, (uint32_t)(cloud_log_record_header_size + stored_size));
+  char* fields = header + 4;
+  writeValue(fields, record.utime);
+  for (int i = 0; i < 7; i++)
+    writeValue(fields + 8 + 8 * i, record.pose[i]);
+  writeValue(fields + 64, (uint32_t)nb_points);
+  writeValue(fields + 68, resolution);
+  writeValue(fields + 72, origin.x());
+  writeValue(fields + 76, origin.y());
+  writeValue(fields + 80, origin.z());
+  writeValue(fields + 84, (uint32_t)raw_size);
+  writeValue(fields + 88, (uint32_t)stored_size);
+  file_.write(header, sizeof(header));
+  file_.write(block, stored_size);
+  // Complete records reach the file (readable after a crash), no sync to disk
+  file_.flush();
+  if (!file_.good())
+  {
+    std::cerr << "[CloudLog] Error: cannot write file " << file_name_ << std::endl;
+    return;
+  }
+  nb_records_ ++;
+  nb_bytes_ += sizeof(header) + stored_size;
+}
+
+CloudLogReader::CloudLogReader() :
+  fd_(-1), data_(NULL), size_(0)
+{
+}
+
+CloudLogReader::~CloudLogReader()
+{
+  close();
+}
+
+bool CloudLogReader::open(const std::string& file_name)
+{
+  close();
+
+  fd_ = ::open(file_name.c_str(), O_RDONLY);
+  if (fd_ < 0)
+  {
+    std::cerr << "[CloudLog] Error: cannot open file " << file_name << std::endl;
+    return false;
+  }
+  struct stat file_stat;
+  if (fstat(fd_, &file_stat) != 0 || (size_t)file_stat.st_size < cloud_log_header_size)
+  {
+    std::cerr << "[CloudLog] Error: invalid file " << file_name << std::endl;
+    close();
+    return false;
+  }
+  size_ = file_stat.st_size;
+
+  void* data = mmap(NULL, size_, PROT_READ, MAP_PRIVATE, fd_, 0);
+  if (data == MAP_FAILED)
+  {
+    std::cerr << "[CloudLog] Error: cannot map file " << file_name << std::endl;
+    close();
+    return false;
+  }
+  data_ = static_cast<const char*>(data);
+  // Records are replayed in order
+  madvise(data, size_, MADV_SEQUENTIAL);
+
+  if (std::memcmp(data_, cloud_log_magic, sizeof(cloud_log_magic)) != 0 ||
+      readValue<uint32_t>(data_ + 8) != cloud_log_version)
+  {
+    std::cerr << "[CloudLog] Error: " << file_name << " is not a cloud log (version "
+              << cloud_log_version << ")." << std::endl;
+    close();
+    return false;
+  }
+
+  // Index
+  uint64_t offset = cloud_log_header_size;
+  while (offset + 4 <= size_)
+  {
+    uint32_t record_size = readValue<uint32_t>(data_ + offset);
+    if (record_size < cloud_log_record_header_size || offset + 4 + record_size > size_)
+      break;
+    records_.push_back(offset + 4);
+    offset += 4 + record_size;
+  }
+  if (offset != size_)
+    std::cerr << "[CloudLog] Warning: truncated record at the end of " << file_name
+              << " (ignored)." << std::endl;
+  return true;
+}
+
+void CloudLogReader::close()
+{
+  if (data_ != NULL)
+    munmap(const_cast<char*>(data_), size_);
+  if (fd_ >= 0)
+    ::close(fd_);
+  fd_ = -1;
+  data_ = NULL;
+  size_ = 0;
+  records_.clear();
+}
+
+int64_t CloudLogReader::getUtime(size_t index) const
+{
+  return readValue<int64_t>(data_ + records_[index]);
+}
+
+Eigen::Isometry3d CloudLogReader::getPose(size_t index) const
+{
+  const char* fields = data_ + records_[index] + 8;
+  double pose[7];
+  for (int i = 0; i < 7; i++)
+    pose[i] = readValue<double>(fields + 8 * i);
+  Eigen::Isometry3d isometry = Eigen::Isometry3d::Identity();
+  isometry.translation() << pose[0], pose[1], pose[2];
+  isometry.rotate(Eigen::Quaterniond(pose[6], pose[3], pose[4], pose[5]));
+  return isometry;
+}
+
+bool CloudLogReader::readCloud(size_t index, pcl::PointCloud<pcl::PointXYZ>& cloud_out) const
+{
+  const char* fields = data_ + records_[index];
+  const uint32_t record_size = readValue<uint32_t>(fields - 4);
+  const size_t nb_points = readValue<uint32_t>(fields + 64);
+  const float resolution = readValue<float>(fields + 68);
+  const Eigen::Vector3f origin (readValue<float>(fields + 72), readValue<float>(fields + 76),
+                                readValue<float>(fields + 80));
+  const size_t raw_size = readValue<uint32_t>(fields + 84);
+  const size_t stored_size = readValue<uint32_t>(fields + 88);
+  const size_t element_size = resolution > 0.0f ? sizeof(int16_t) : sizeof(float);
+  if (raw_size != 3 * nb_points * element_size || cloud_log_record_header_size + stored_size != record_size)
+  {
+    std::cerr << "[CloudLog] Error: corrupted record " << index << std::endl;
+    return false;
+  }
+
+  const char* block = fields + cloud_log_record_header_size;
+  std::vector<char> shuffled;
+  if (stored_size != raw_size)
+  {
+    shuffled.resize(raw_size);
+    if (pcl::lzfDecompress(block, stored_size, shuffled.data(), raw_size) != raw_size)
+    {
+      std::cerr << "[CloudLog] Error: corrupted record " << index << std::endl;
+      return false;
+    }
+    block = shuffled.data();
+  }
+  std::vector<char> raw (raw_size);
+  unshuffleBytes(block, 3 * nb_points, element_size, raw.data());
+
+  if (resolution > 0.0f)
+  {
+    const int16_t* x = reinterpret_cast<const int16_t*>(raw.data());
+    CompactCloud compact;
+    compact.assign(origin, resolution, x, x + nb_points, x + 2 * nb_points, nb_points);
+    compact.decode(cloud_out);
+    return true;
+  }
+
+  const float* x = reinterpret_cast<const float*>(raw.data());
+  cloud_out.points.resize(nb_points);
+  cloud_out.width = nb_points;
+  cloud_out.height = 1;
+  cloud_out.is_dense = true;
+  for (size_t i = 0; i < nb_points; i++)
+  {
+    pcl::PointXYZ& point = cloud_out.points[i];
+    point.x = x[i];
+    point.y = x[nb_points + i];
+    point.z = x[2 * nb_points + i];
+    if (!std::isfinite(point.x) || !std::isfinite(point.y) || !std::isfinite(point.z))
+      cloud_out.is_dense = false;
+  }
+  return true;
+}
@@ -0,0 +1,289 @@
+#include "aicp_utils/cloudStreamReader.hpp"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <sstream>
+
+// Size in bytes of a PLY property type (0 if unknown)
+static size_t getPLYTypeSize(const std::string& type)
+{
+  if (type == "char" || type == "uchar" || type == "int8" || type == "uint8")
+    return 1;
+  if (type == "short" || type == "ushort" || type == "int16" || type == "uint16")
+    return 2;
+  if (type == "int" || type == "uint" || type == "float" || type == "int32" || type == "uint32" || type == "float32")
+    return 4;
+  if (type == "double" || type == "float64")
+    return 8;
+  return 0;
+}
+
+static double readBinaryCoordinate(const char* data, size_t size)
+{
+  if (size == 8)
+  {
+    double value;
+    std::memcpy(&value, data, 8);
+    return value;
+  }
+  float value;
+  std::memcpy(&value, data, 4);
+  return value;
+}
+
+CloudStreamReader::CloudStreamReader() :
+  binary_(false), nb_points_(0), nb_read_(0), point_step_(0)
+{
+}
+
+bool CloudStreamReader::open(const std::string& file_name)
+{
+  close();
+  file_.open(file_name.c_str(), std::ios::in | std::ios::binary);
+  if (!file_.is_open())
+  {
+    std::cerr << "[CloudStreamReader] Error: cannot open file " << file_name << std::endl;
+    return false;
+  }
+
+  bool parsed = false;
+  std::string extension = file_name.substr(file_name.find_last_of('.') + 1);
+  if (extension == "ply" || extension == "PLY")
+    parsed = parsePLYHeader();
+  else if (extension == "pcd" || extension == "PCD")
+    parsed = parsePCDHeader();
+  else
+    std::cerr << "[CloudStreamReader] Error: unknown file extension " << extension << std::endl;
+
+  if (!parsed)
+    close();
+  return parsed;
+}
+
+void CloudStreamReader::close()
+{
+  if (file_.is_open())
+    file_.close();
+  file_.clear();
+  nb_points_ = 0;
+  nb_read_ = 0;
+}
+
+bool CloudStreamReader::parsePLYHeader()
+{
+  std::string line;
+  std::getline(file_, line);
+  if (line.compare(0, 3, "ply") != 0)
+    return false;
+
+  bool in_vertex = false;
+  int nb_elements = 0;
+  bool found[3] = {false, false, false};
+  size_t property_offset = 0, property_index = 0;
+  while (std::getline(file_, line))
+  {
+    std::istringstream iss(line);
+    std::string token;
+    iss >> token;
+    if (token == "format")
+    {
+      std::string format;
+      iss >> format;
+      if (format == "ascii")
+        binary_ = false;
+      else if (format == "binary_little_endian")
+        binary_ = true;
+      else
+      {
+        std::cerr << "[CloudStreamReader] Error: PLY format " << format << " not supported." << std::endl;
+        return false;
+      }
+    }
+    else if (token == "element")
+    {
+      std::string name;
+      iss >> name;
+      // Vertices must be the first element to be streamed (data starts right after the header)
+      if (name == "vertex" && nb_elements > 0)
+      {
+        std::cerr << "[CloudStreamReader] Error: vertex must be the first PLY element." << std::endl;
+        return false;
+      }
+      in_vertex = (name == "vertex");
+      if (in_vertex)
+        iss >> nb_points_;
+      nb_elements++;
+    }
+    else if (token == "property" && in_vertex)
+    {
+      std::string type, name;
+      iss >> type >> name;
+      size_t type_size = getPLYTypeSize(type);
+      if (type == "list" || type_size == 0)
+      {
+        std::cerr << "[CloudStreamReader] Error: vertex property " << type << " not supported." << std::endl;
+        return false;
+      }
+      int axis = (name == "x") ? 0 : (name == "y") ? 1 : (name == "z") ? 2 : -1;
+      if (axis >= 0)
+      {
+        if (type_size < 4 || type.find("int") != std::string::npos)
+        {
+          std::cerr << "[CloudStreamReader] Error: coordinates must be float or double." << std::endl;
+          return false;
+        }
+        offsets_[axis] = binary_ ? property_offset : property_index;
+        sizes_[axis] = type_size;
+        found[axis] = true;
+      }
+      property_offset += type_size;
+      property_index ++;
+    }
+    else if (token == "end_header")
+    {
+      point_step_ = binary_ ? property_offset : property_index;
+      return found[0] && found[1] && found[2];
+    }
+  }
+  return false;
+}
+
+bool CloudStreamReader::parsePCDHeader()
+{
+  std::vector<std::string> fields;
+  std::vector<size_t> sizes, counts;
+  std::vector<char> types;
+  std::string line;
+  while (std::getline(file_, line))
+  {
+    if (line.empty() || line[0] == '#')
+      continue;
+    std::istringstream iss(line);
+    std::string token;
+    iss >> token;
+    if (token == "FIELDS")
+    {
+      std::string field;
+      while (iss >> field)
+        fields.push_back(field);
+    }
+    else if (token == "SIZE")
+    {
+      size_t size;
+      while (iss >> size)
+        sizes.push_back(size);
+    }
+    else if (token == "TYPE")
+    {
+      char type;
+      while (iss >> type)
+        types.push_back(type);
+    }
+    else if (token == "COUNT")
+    {
+      size_t count;
+      while (iss >> count)
+        counts.push_back(count);
+    }
+    else if (token == "POINTS")
+      iss >> nb_points_;
+    else if (token == "DATA")
+    {
+      std::string data;
+      iss >> data;
+      if (data == "ascii")
+        binary_ = false;
+      else if (data == "binary")
+        binary_ = true;
+      else
+      {
+        std::cerr << "[CloudStreamReader] Error: PCD data " << data << " not supported." << std::endl;
+        return false;
+      }
+
+      if (counts.empty())
+        counts.resize(fields.size(), 1);
+      if (sizes.size() != fields.size() || types.size() != fields.size() || counts.size() != fields.size())
+        return false;
+
+      bool found[3] = {false, false, false};
+      size_t offset = 0, column = 0;
+      for (size_t i = 0; i < fields.size(); i++)
+      {
+        int axis = (fields[i] == "x") ? 0 : (fields[i] == "y") ? 1 : (fields[i] == "z") ? 2 : -1;
+        if (axis >= 0)
+        {
+          if (types[i] != 'F')
+          {
+            std::cerr << "[CloudStreamReader] Error: coordinates must be float or double." << std::endl;
+            return false;
+          }
+          offsets_[axis] = binary_ ? offset : column;
+          sizes_[axis] = sizes[i];
+          found[axis] = true;
+        }
+        offset += sizes[i] * counts[i];
+        column += counts[i];
+      }
+      point_step_ = binary_ ? offset : column;
+      return found[0] && found[1] && found[2];
+    }
+  }
+  return false;
+}
+
+size_t CloudStreamReader::readChunk(std::vector<float>& xyz, size_t max_points)
+{
+  size_t nb_points = std::min(max_points, nb_points_ - nb_read_);
+  xyz.resize(3 * nb_points);
+  if (nb_points == 0 || !file_.is_open())
+    return 0;
+
+  size_t nb_chunk = 0;
+  if (binary_)
+  {
+    buffer_.resize(nb_points * point_step_);
+    file_.read(&buffer_[0], buffer_.size());
+    nb_chunk = file_.gcount() / point_step_;
+    for (size_t i = 0; i < nb_chunk; i++)
+    {
+      const char* point = &buffer_[i * point_step_];
+      for (int axis = 0; axis < 3; axis++)
+        xyz[3*i+axis] = (float)readBinaryCoordinate(point + offsets_[axis], sizes_[axis]);
+    }
+  }
+  else
+  {
+    std::string line;
+    std::vector<double> values (point_step_);
+    while (nb_chunk < nb_points && std::getline(file_, line))
+    {
+      const char* begin = line.c_str();
+      char* end;
+      size_t nb_values = 0;
+      for (; nb_values < point_step_; nb_values++)
+      {
+        values[nb_values] = std::strtod(begin, &end);
+        if (end == begin)
+          break;
+        begin = end;
+      }
+      if (nb_values < point_step_)
+        continue; // empty or malformed line
+      for (int axis = 0; axis < 3; axis++)
+        xyz[3*nb_chunk+axis] = (float)values[offsets_[axis]];
+      nb_chunk ++;
+    }
+  }
+
+  if (nb_chunk < nb_points)
+  {
+    // Truncated file
+    nb_points_ = nb_read_ + nb_chunk;
+    xyz.resize(3 * nb_chunk);
+  }
+  nb_read_ += nb_chunk;
+  return nb_chunk;
+}
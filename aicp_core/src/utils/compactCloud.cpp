@@ -0,0 +1,94 @@
+#include "aicp_utils/compactCloud.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+static const float compact_cloud_max_value = std::numeric_limits<int16_t>::max();
+
+CompactCloud::CompactCloud() :
+  origin_(Eigen::Vector3f::Zero()), resolution_(0.0f)
+{
+}
+
+void CompactCloud::encode(const pcl::PointCloud<pcl::PointXYZ>& cloud, const Eigen::Vector3f& origin,
+                          float resolution)
+{
+  clear();
+  origin_ = origin;
+
+  // Largest offset to origin sets the minimum step
+  float max_offset = 0.0f;
+  size_t nb_points = 0;
+  for (size_t i = 0; i < cloud.size(); i++)
+  {
+    const pcl::PointXYZ& point = cloud.points[i];
+    if (!std::isfinite(point.x) || !std::isfinite(point.y) || !std::isfinite(point.z))
+      continue;
+    max_offset = std::max(max_offset, std::fabs(point.x - origin.x()));
+    max_offset = std::max(max_offset, std::fabs(point.y - origin.y()));
+    max_offset = std::max(max_offset, std::fabs(point.z - origin.z()));
+    nb_points++;
+  }
+  resolution_ = std::max(resolution, max_offset / compact_cloud_max_value);
+  if (resolution_ <= 0.0f)
+    resolution_ = 1.0f;
+
+  float inverse_resolution = 1.0f / resolution_;
+  x_.reserve(nb_points);
+  y_.reserve(nb_points);
+  z_.reserve(nb_points);
+  for (size_t i = 0; i < cloud.size(); i++)
+  {
+    const pcl::PointXYZ& point = cloud.points[i];
+    if (!std::isfinite(point.x) || !std::isfinite(point.y) || !std::isfinite(point.z))
+      continue;
+    // Clamped for rounding at the bounds
+    x_.push_back((int16_t)std::max(-compact_cloud_max_value, std::min(compact_cloud_max_value,
+                 std::round((point.x - origin.x()) * inverse_resolution))));
+    y_.push_back((int16_t)std::max(-compact_cloud_max_value, std::min(compact_cloud_max_value,
+                 std::round((point.y - origin.y()) * inverse_resolution))));
+    z_.push_back((int16_t)std::max(-compact_cloud_max_value, std::min(compact_cloud_max_value,
+                 std::round((point.z - origin.z()) * inverse_resolution))));
+  }
+}
+
+void CompactCloud::decode(pcl::PointCloud<pcl::PointXYZ>& cloud_out) const
+{
+  const size_t nb_points = x_.size();
+  cloud_out.points.resize(nb_points);
+  cloud_out.width = nb_points;
+  cloud_out.height = 1;
+  cloud_out.is_dense = true;
+
+  // Plain loop over arrays (vectorized by the compiler)
+  const int16_t* x = x_.data();
+  const int16_t* y = y_.data();
+  const int16_t* z = z_.data();
+  pcl::PointXYZ* points = cloud_out.points.data();
+  const float ox = origin_.x(), oy = origin_.y(), oz = origin_.z(), step = resolution_;
+  for (size_t i = 0; i < nb_points; i++)
+  {
+    points[i].x = ox + step * x[i];
+    points[i].y = oy + step * y[i];
+    points[i].z = oz + step * z[i];
+    points[i].data[3] = 1.0f;
+  }
+}
+
+void CompactCloud::assign(const Eigen::Vector3f& origin, float resolution, const int16_t* x,
+                          const int16_t* y, const int16_t* z, size_t nb_points)
+{
+  origin_ = origin;
+  resolution_ = resolution;
+  x_.assign(x, x + nb_points);
+  y_.assign(y, y + nb_points);
+  z_.assign(z, z + nb_points);
+}
+
+void CompactCloud::clear()
+{
+  std::vector<int16_t>().swap(x_);
+  std::vector<int16_t>().swap(y_);
+  std::vector<int16_t>().swap(z_);
+}
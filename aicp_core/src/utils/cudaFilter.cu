@@ -0,0 +1,498 @@
+#include "aicp_utils/cudaFilter.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <iostream>
+#include <limits>
+
+#include <cuda_runtime.h>
+#include <thrust/binary_search.h>
+#include <thrust/device_vector.h>
+#include <thrust/functional.h>
+#include <thrust/reduce.h>
+#include <thrust/sequence.h>
+#include <thrust/sort.h>
+#include <thrust/unique.h>
+
+namespace
+{
+
+const int kBlockSize = 256;
+const int kMaxNeighbours = 32;
+// Bound of the k nearest neighbours search (in cells of twice the leaf size):
+// farther neighbours are ignored (isolated points only)
+const int kMaxRings = 8;
+
+// Regular grid over the cloud bounds, cells indexed as pcl::VoxelGrid
+// (x + y * dim_x + z * dim_x * dim_y)
+struct Grid
+{
+  float inverse_size;
+  int64_t min_x, min_y, min_z; // first cell (integer cell coordinates)
+  int dim_x, dim_y, dim_z;
+  uint64_t div_x, div_xy;
+};
+
+struct Float4Plus
+{
+  __host__ __device__ float4 operator()(const float4& a, const float4& b) const
+  {
+    return make_float4(a.x + b.x, a.y + b.y, a.z + b.z, a.w + b.w);
+  }
+};
+
+inline int nbBlocks(int nb_items)
+{
+  return (nb_items + kBlockSize - 1) / kBlockSize;
+}
+
+template <typename T>
+inline T* raw(thrust::device_vector<T>& vector)
+{
+  return thrust::raw_pointer_cast(vector.data());
+}
+
+// False if the cell indices do not fit in 64 bits (21 bits per axis)
+bool makeGrid(const float min_point[3], const float max_point[3], float cell_size, Grid& grid)
+{
+  grid.inverse_size = 1.0f / cell_size;
+  int64_t min_cell[3], dims[3];
+  for (int i = 0; i < 3; i++)
+  {
+    min_cell[i] = (int64_t)std::floor(min_point[i] * grid.inverse_size);
+    dims[i] = (int64_t)std::floor(max_point[i] * grid.inverse_size) - min_cell[i] + 1;
+    if (dims[i] <= 0 || dims[i] > (1 << 21))
+      return false;
+  }
+  grid.min_x = min_cell[0];
+  grid.min_y = min_cell[1];
+  grid.min_z = min_cell[2];
+  grid.dim_x = dims[0];
+  grid.dim_y = dims[1];
+  grid.dim_z = dims[2];
+  grid.div_x = dims[0];
+  grid.div_xy = dims[0] * dims[1];
+  return true;
+}
+
+__device__ inline int cellCoordinate(float value, float inverse_size, int64_t min_cell, int dim)
+{
+  int64_t cell = (int64_t)floorf(value * inverse_size) - min_cell;
+  return cell < 0 ? 0 : (cell >= dim ? dim - 1 : (int)cell);
+}
+
+__device__ inline uint64_t cellIndex(const Grid& grid, int x, int y, int z)
+{
+  return (uint64_t)x + (uint64_t)y * grid.div_x + (uint64_t)z * grid.div_xy;
+}
+
+// Position of key in the sorted (unique) cell indices, -1 if the cell is empty
+__device__ inline int findCell(const uint64_t* cells, int nb_cells, uint64_t key)
+{
+  int begin = 0, end = nb_cells;
+  while (begin < end)
+  {
+    int middle = (begin + end) / 2;
+    if (cells[middle] < key)
+      begin = middle + 1;
+    else
+      end = middle;
+  }
+  return (begin < nb_cells && cells[begin] == key) ? begin : -1;
+}
+
+// Eigenvector of the smallest eigenvalue of the symmetric matrix a (cyclic Jacobi, a is
+// overwritten) and curvature (smallest eigenvalue over their sum, as pcl::solvePlaneParameters)
+__host__ __device__ inline void solvePlane(float a[3][3], float normal[3], float& curvature)
+{
+  float v[3][3] = {{1.0f, 0.0f, 0.0f}, {0.0f, 1.0f, 0.0f}, {0.0f, 0.0f, 1.0f}};
+  const float trace = a[0][0] + a[1][1] + a[2][2];
+  for (int sweep = 0; sweep < 16; sweep++)
+  {
+    float off_diagonal = a[0][1] * a[0][1] + a[0][2] * a[0][2] + a[1][2] * a[1][2];
+    if (off_diagonal <= 1e-14f * trace * trace)
+      break;
+    for (int p = 0; p < 2; p++)
+      for (int q = p + 1; q < 3; q++)
+      {
+        if (a[p][q] == 0.0f)
+          continue;
+        float theta = (a[q][q] - a[p][p]) / (2.0f * a[p][q]);
+        float t = (theta >= 0.0f ? 1.0f : -1.0f) / (fabsf(theta) + sqrtf(theta * theta + 1.0f));
+        float c = 1.0f / sqrtf(t * t + 1.0f);
+        float s = t * c;
+        for (int k = 0; k < 3; k++)
+        {
+          float akp = a[k][p], akq = a[k][q];
+          a[k][p] = c * akp - s * akq;
+          a[k][q] = s * akp + c * akq;
+        }
+        for (int k = 0; k < 3; k++)
+        {
+          float apk = a[p][k], aqk = a[q][k];
+          a[p][k] = c * apk - s * aqk;
+          a[q][k] = s * apk + c * aqk;
+        }
+        for (int k = 0; k < 3; k++)
+        {
+          float vkp = v[k][p], vkq = v[k][q];
+          v[k][p] = c * vkp - s * vkq;
+          v[k][q] = s * vkp + c * vkq;
+        }
+      }
+  }
+  int smallest = 0;
+  for (int i = 1; i < 3; i++)
+    if (a[i][i] < a[smallest][smallest])
+      smallest = i;
+  for (int i = 0; i < 3; i++)
+    normal[i] = v[i][smallest];
+  curvature = (trace != 0.0f) ? fabsf(a[smallest][smallest] / trace) : 0.0f;
+}
+
+// Index of the voxel (or cell) of each point
+__global__ void cellIndicesKernel(const float4* points, int nb_points, Grid grid, uint64_t* indices)
+{
+  int i = blockIdx.x * blockDim.x + threadIdx.x;
+  if (i >= nb_points)
+    return;
+  float4 point = points[i];
+  indices[i] = cellIndex(grid, cellCoordinate(point.x, grid.inverse_size, grid.min_x, grid.dim_x),
+                               cellCoordinate(point.y, grid.inverse_size, grid.min_y, grid.dim_y),
+                               cellCoordinate(point.z, grid.inverse_size, grid.min_z, grid.dim_z));
+}
+
+// Voxel sums (w: number of points) to centroids
+__global__ void centroidsKernel(float4* sums, int nb_voxels)
+{
+  int i = blockIdx.x * blockDim.x + threadIdx.x;
+  if (i >= nb_voxels)
+    return;
+  float4 sum = sums[i];
+  sums[i] = make_float4(sum.x / sum.w, sum.y / sum.w, sum.z / sum.w, 0.0f);
+}
+
+// k nearest neighbours of each centroid (exact within kMaxRings cells), normal and curvature
+// of the k neighbours (as pcl::NormalEstimation), and the first nb_region_neighbours of them.
+__global__ void normalsKernel(const float4* centroids, int nb_centroids, Grid grid,
+                              const uint64_t* cells, int nb_cells, const int* cell_begin,
+                              const int* cell_end, const int* cell_points,
+                              int nb_normal_neighbours, int nb_region_neighbours, float3 view_point,
+                              float4* normals, int* neighbours)
+{
+  int i = blockIdx.x * blockDim.x + threadIdx.x;
+  if (i >= nb_centroids)
+    return;
+  const float4 point = centroids[i];
+  const int cx = cellCoordinate(point.x, grid.inverse_size, grid.min_x, grid.dim_x);
+  const int cy = cellCoordinate(point.y, grid.inverse_size, grid.min_y, grid.dim_y);
+  const int cz = cellCoordinate(point.z, grid.inverse_size, grid.min_z, grid.dim_z);
+  const int k = nb_normal_neighbours;
+  const float cell_size = 1.0f / grid.inverse_size;
+
+  // Sorted by distance (insertion), the search stops when the points of the next ring
+  // of cells cannot be closer than the k-th neighbour
+  float best_distances[kMaxNeighbours];
+  int best_ids[kMaxNeighbours];
+  int count = 0;
+  for (int r = 0; r <= kMaxRings; r++)
+  {
+    for (int dz = -r; dz <= r; dz++)
+    {
+      int z = cz + dz;
+      if (z < 0 || z >= grid.dim_z)
+        continue;
+      for (int dy = -r; dy <= r; dy++)
+      {
+        int y = cy + dy;
+        if (y < 0 || y >= grid.dim_y)
+          continue;
+        // Inside the ring, only the two cells at |dx| = r
+        int step = (abs(dz) == r || abs(dy) == r) ? 1 : 2 * r;
+        for (int dx = -r; dx <= r; dx += step)
+        {
+          int x = cx + dx;
+          if (x < 0 || x >= grid.dim_x)
+            continue;
+          int cell = findCell(cells, nb_cells, cellIndex(grid, x, y, z));
+          if (cell < 0)
+            continue;
+          for (int c = cell_begin[cell]; c < cell_end[cell]; c++)
+          {
+            int j = cell_points[c];
+            float4 neighbour = centroids[j];
+            float ex = neighbour.x - point.x, ey = neighbour.y - point.y, ez = neighbour.z - point.z;
+            float distance = ex * ex + ey * ey + ez * ez;
+            if (count == k && distance >= best_distances[k - 1])
+              continue;
+            int position = (count < k) ? count++ : k - 1;
+            while (position > 0 && best_distances[position - 1] > distance)
+            {
+              best_distances[position] = best_distances[position - 1];
+              best_ids[position] = best_ids[position - 1];
+              position--;
+            }
+            best_distances[position] = distance;
+            best_ids[position] = j;
+          }
+        }
+      }
+    }
+    if (count == k && best_distances[k - 1] <= (r * cell_size) * (r * cell_size))
+      break;
+  }
+
+  float4 result = make_float4(nanf(""), nanf(""), nanf(""), nanf(""));
+  if (count >= 3)
+  {
+    float mean[3] = {0.0f, 0.0f, 0.0f};
+    for (int m = 0; m < count; m++)
+    {
+      float4 neighbour = centroids[best_ids[m]];
+      mean[0] += neighbour.x;
+      mean[1] += neighbour.y;
+      mean[2] += neighbour.z;
+    }
+    for (int d = 0; d < 3; d++)
+      mean[d] /= count;
+    float covariance[3][3] = {{0.0f, 0.0f, 0.0f}, {0.0f, 0.0f, 0.0f}, {0.0f, 0.0f, 0.0f}};
+    for (int m = 0; m < count; m++)
+    {
+      float4 neighbour = centroids[best_ids[m]];
+      float e[3] = {neighbour.x - mean[0], neighbour.y - mean[1], neighbour.z - mean[2]};
+      for (int r = 0; r < 3; r++)
+        for (int c = r; c < 3; c++)
+          covariance[r][c] += e[r] * e[c];
+    }
+    for (int r = 0; r < 3; r++)
+      for (int c = r; c < 3; c++)
+      {
+        covariance[r][c] /= count;
+        covariance[c][r] = covariance[r][c];
+      }
+    float normal[3], curvature;
+    solvePlane(covariance, normal, curvature);
+    // Oriented towards the view point (as pcl::flipNormalTowardsViewpoint)
+    float to_view_point = (view_point.x - point.x) * normal[0] + (view_point.y - point.y) * normal[1] +
+                          (view_point.z - point.z) * normal[2];
+    float sign = (to_view_point < 0.0f) ? -1.0f : 1.0f;
+    result = make_float4(sign * normal[0], sign * normal[1], sign * normal[2], curvature);
+  }
+  normals[i] = result;
+  for (int m = 0; m < nb_region_neighbours; m++)
+    neighbours[i * nb_region_neighbours + m] = (m < count) ? best_ids[m] : -1;
+}
+
+// Union-find root, parents[v] <= v (roots are the smallest index of their component)
+__device__ inline int findRoot(int* parents, int v)
+{
+  volatile int* p = parents;
+  int current = p[v];
+  if (current != v)
+  {
+    int previous = v, next;
+    while (current > (next = p[current]))
+    {
+      p[previous] = next; // path halving (ancestors only: safe with concurrent unions)
+      previous = current;
+      current = next;
+    }
+  }
+  return current;
+}
+
+// Connects neighbours with smooth normals (criteria of pcl::RegionGrowing, curvature
+// threshold disabled): planes are the connected components of this graph.
+__global__ void unionKernel(const float4* normals, const int* neighbours, int nb_centroids,
+                            int nb_region_neighbours, float cos_threshold, int* parents)
+{
+  int i = blockIdx.x * blockDim.x + threadIdx.x;
+  if (i >= nb_centroids)
+    return;
+  float4 normal = normals[i];
+  if (!isfinite(normal.x))
+    return;
+  for (int m = 0; m < nb_region_neighbours; m++)
+  {
+    int j = neighbours[i * nb_region_neighbours + m];
+    if (j < 0 || j == i)
+      continue;
+    float4 neighbour = normals[j];
+    if (!isfinite(neighbour.x) ||
+        fabsf(normal.x * neighbour.x + normal.y * neighbour.y + normal.z * neighbour.z) < cos_threshold)
+      continue;
+
+    // Hook the larger root to the smaller one (lock-free, retried if the root changed)
+    int root_i = findRoot(parents, i);
+    int root_j = findRoot(parents, j);
+    while (root_i != root_j)
+    {
+      if (root_i > root_j)
+      {
+        int old = atomicCAS(&parents[root_i], root_i, root_j);
+        if (old == root_i)
+          break;
+        root_i = findRoot(parents, old);
+      }
+      else
+      {
+        int old = atomicCAS(&parents[root_j], root_j, root_i);
+        if (old == root_j)
+          break;
+        root_j = findRoot(parents, old);
+      }
+    }
+  }
+}
+
+__global__ void flattenKernel(int* parents, int nb_centroids, int* labels)
+{
+  int i = blockIdx.x * blockDim.x + threadIdx.x;
+  if (i >= nb_centroids)
+    return;
+  labels[i] = findRoot(parents, i);
+}
+
+} // namespace
+
+bool cudaFilterAvailable()
+{
+  static const bool available = []()
+  {
+    int nb_devices = 0;
+    return cudaGetDeviceCount(&nb_devices) == cudaSuccess && nb_devices > 0;
+  }();
+  return available;
+}
+
+bool cudaPlaneSegmentation(const float* xyz, size_t nb_points, const CudaPlaneSegmentationParams& params,
+                           std::vector<float>& sampled_xyz, std::vector<float>& normals,
+                           std::vector<int>& labels)
+{
+  sampled_xyz.clear();
+  normals.clear();
+  labels.clear();
+  if (nb_points == 0)
+    return true;
+  if (nb_points > (size_t)std::numeric_limits<int>::max())
+    return false;
+  const int nb_normal_neighbours = std::min(std::max(params.nb_normal_neighbours, 3), kMaxNeighbours);
+  const int nb_region_neighbours = std::min(std::max(params.nb_region_neighbours, 1), nb_normal_neighbours);
+
+  std::vector<float4> host_points (nb_points);
+  float min_point[3], max_point[3];
+  for (int d = 0; d < 3; d++)
+  {
+    min_point[d] = std::numeric_limits<float>::max();
+    max_point[d] = -std::numeric_limits<float>::max();
+  }
+  for (size_t i = 0; i < nb_points; i++)
+  {
+    const float* point = xyz + 3 * i;
+    host_points[i] = make_float4(point[0], point[1], point[2], 1.0f);
+    for (int d = 0; d < 3; d++)
+    {
+      min_point[d] = std::min(min_point[d], point[d]);
+      max_point[d] = std::max(max_point[d], point[d]);
+    }
+  }
+  Grid voxel_grid, cell_grid;
+  if (!makeGrid(min_point, max_point, params.leaf_size, voxel_grid) ||
+      !makeGrid(min_point, max_point, 2.0f * params.leaf_size, cell_grid))
+  {
+    std::cerr << "[CUDA Filter] Cloud extent too large for the GPU voxel grid." << std::endl;
+    return false;
+  }
+
+  // Thrust reports CUDA errors with exceptions: caught here, callers fall back to the CPU filter
+  try
+  {
+    // Voxel grid: points sorted by voxel index (stable), sums reduced per voxel
+    const int nb_input = nb_points;
+    thrust::device_vector<float4> points (host_points.begin(), host_points.end());
+    thrust::device_vector<uint64_t> point_voxels (nb_input);
+    cellIndicesKernel<<<nbBlocks(nb_input), kBlockSize>>>(raw(points), nb_input, voxel_grid, raw(point_voxels));
+    thrust::sort_by_key(point_voxels.begin(), point_voxels.end(), points.begin());
+    thrust::device_vector<uint64_t> voxels (nb_input);
+    thrust::device_vector<float4> centroids (nb_input);
+    const int nb_voxels = thrust::reduce_by_key(point_voxels.begin(), point_voxels.end(), points.begin(),
+                                                voxels.begin(), centroids.begin(),
+                                                thrust::equal_to<uint64_t>(), Float4Plus()).first
+                          - voxels.begin();
+    centroids.resize(nb_voxels);
+    centroidsKernel<<<nbBlocks(nb_voxels), kBlockSize>>>(raw(centroids), nb_voxels);
+    points.clear();
+    points.shrink_to_fit();
+    point_voxels.clear();
+    point_voxels.shrink_to_fit();
+
+    // Centroids sorted by cell of the search grid, with the range of each occupied cell
+    thrust::device_vector<uint64_t> centroid_cells (nb_voxels);
+    cellIndicesKernel<<<nbBlocks(nb_voxels), kBlockSize>>>(raw(centroids), nb_voxels, cell_grid,
+                                                           raw(centroid_cells));
+    thrust::device_vector<int> cell_points (nb_voxels);
+    thrust::sequence(cell_points.begin(), cell_points.end());
+    thrust::sort_by_key(centroid_cells.begin(), centroid_cells.end(), cell_points.begin());
+    thrust::device_vector<uint64_t> cells (centroid_cells);
+    const int nb_cells = thrust::unique(cells.begin(), cells.end()) - cells.begin();
+    thrust::device_vector<int> cell_begin (nb_cells);
+    thrust::device_vector<int> cell_end (nb_cells);
+    thrust::lower_bound(centroid_cells.begin(), centroid_cells.end(), cells.begin(), cells.begin() + nb_cells,
+                        cell_begin.begin());
+    thrust::upper_bound(centroid_cells.begin(), centroid_cells.end(), cells.begin(), cells.begin() + nb_cells,
+                        cell_end.begin());
+
+    // Normals and region growing graph
+    thrust::device_vector<float4> device_normals (nb_voxels);
+    thrust::device_vector<int> neighbours ((size_t)nb_voxels * nb_region_neighbours);
+    float3 view_point = make_float3(params.view_point[0], params.view_point[1], params.view_point[2]);
+    normalsKernel<<<nbBlocks(nb_voxels), kBlockSize>>>(raw(centroids), nb_voxels, cell_grid, raw(cells), nb_cells,
+                                                       raw(cell_begin), raw(cell_end), raw(cell_points),
+                                                       nb_normal_neighbours, nb_region_neighbours, view_point,
+                                                       raw(device_normals), raw(neighbours));
+
+    // Planes: connected components
+    thrust::device_vector<int> parents (nb_voxels);
+    thrust::sequence(parents.begin(), parents.end());
+    unionKernel<<<nbBlocks(nb_voxels), kBlockSize>>>(raw(device_normals), raw(neighbours), nb_voxels,
+                                                     nb_region_neighbours, cosf(params.smoothness_threshold),
+                                                     raw(parents));
+    thrust::device_vector<int> device_labels (nb_voxels);
+    flattenKernel<<<nbBlocks(nb_voxels), kBlockSize>>>(raw(parents), nb_voxels, raw(device_labels));
+
+    cudaError_t error = cudaDeviceSynchronize();
+    if (error == cudaSuccess)
+      error = cudaGetLastError();
+    if (error != cudaSuccess)
+    {
+      std::cerr << "[CUDA Filter] Error: " << cudaGetErrorString(error) << std::endl;
+      return false;
+    }
+
+    std::vector<float4> host_centroids (nb_voxels);
+    thrust::copy(centroids.begin(), centroids.end(), host_centroids.begin());
+    sampled_xyz.resize(3 * (size_t)nb_voxels);
+    for (int i = 0; i < nb_voxels; i++)
+    {
+      sampled_xyz[3*i] = host_centroids[i].x;
+      sampled_xyz[3*i+1] = host_centroids[i].y;
+      sampled_xyz[3*i+2] = host_centroids[i].z;
+    }
+    normals.resize(4 * (size_t)nb_voxels);
+    labels.resize(nb_voxels);
+    if (cudaMemcpy(normals.data(), raw(device_normals), nb_voxels * sizeof(float4),
+                   cudaMemcpyDeviceToHost) != cudaSuccess ||
+        cudaMemcpy(labels.data(), raw(device_labels), nb_voxels * sizeof(int),
+                   cudaMemcpyDeviceToHost) != cudaSuccess)
+    {
+      std::cerr << "[CUDA Filter] Error: cannot copy the results from the device." << std::endl;
+      return false;
+    }
+  }
+  catch (const std::exception& e)
+  {
+    std::cerr << "[CUDA Filter] Error: " << e.what() << std::endl;
+    return false;
+  }
+  return true;
+}
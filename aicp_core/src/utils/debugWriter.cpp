@@ -0,0 +1,54 @@
+#include "aicp_utils/debugWriter.hpp"
+
+#include <iostream>
+
+#include <pcl/io/pcd_io.h>
+
+DebugWriter::DebugWriter(size_t queue_size, bool binary) :
+  queue_(queue_size, QueuePolicy::DROP_NEWEST), binary_(binary), running_(true)
+{
+  thread_ = std::thread(&DebugWriter::run, this);
+}
+
+DebugWriter::~DebugWriter()
+{
+  running_ = false;
+  thread_.join();
+  Stats stats = queue_.getStats();
+  if (stats.dropped > 0)
+    std::cout << "[DebugWriter] Dropped " << stats.dropped << " of " << stats.pushed
+              << " writes (queue full)." << std::endl;
+}
+
+bool DebugWriter::writeCloud(const std::string& file_name,
+                             const pcl::PointCloud<pcl::PointXYZ>::ConstPtr& cloud)
+{
+  if (!cloud)
+    return false;
+  const bool binary = binary_;
+  return post([file_name, cloud, binary]()
+  {
+    pcl::PCDWriter writer;
+    if (writer.write<pcl::PointXYZ>(file_name, *cloud, binary) != 0)
+      std::cerr << "[DebugWriter] Error: cannot write file " << file_name << std::endl;
+  });
+}
+
+bool DebugWriter::post(const Job& job)
+{
+  return queue_.push(job) == 0;
+}
+
+void DebugWriter::run()
+{
+  Job job;
+  // Queue emptied before exiting
+  while (running_ || queue_.size() > 0)
+  {
+    if (queue_.pop(job, std::chrono::milliseconds(100)))
+    {
+      job();
+      job = Job(); // release captured data now
+    }
+  }
+}
@@ -1,16 +1,43 @@
 #include "aicp_utils/filteringUtils.hpp"
+#include "aicp_utils/cloudStreamReader.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <mutex>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#ifdef AICP_WITH_CUDA
+#include "aicp_utils/cudaFilter.hpp"
+#endif
 
 // Returns filtered cloud: uniform sampling and planes segmentation.
 // This filter reduces the input's size.
 void regionGrowingUniformPlaneSegmentationFilter(pcl::PointCloud<pcl::PointXYZ>::Ptr cloud_in,
-                                                 pcl::PointCloud<pcl::PointXYZ>::Ptr cloud_out)
+                                                 pcl::PointCloud<pcl::PointXYZ>::Ptr cloud_out,
+                                                 float leaf_size)
 {
   pcl::PointCloud<pcl::PointXYZ>::Ptr cloud_sampled (new pcl::PointCloud<pcl::PointXYZ>);
+  std::vector<int> indices;
+  regionGrowingUniformPlaneSegmentationFilter(cloud_in, cloud_sampled, indices, leaf_size);
+
+  // Populate cloud with clusters
+  gatherPoints(*cloud_sampled, indices, *cloud_out);
+}
+
+// Indices-only version of the filter above: returns the cloud after uniform
+// sampling and the indices of its points belonging to the extracted planes
+// (grouped by cluster), without copying them to a new cloud.
+void regionGrowingUniformPlaneSegmentationFilter(pcl::PointCloud<pcl::PointXYZ>::Ptr cloud_in,
+                                                 pcl::PointCloud<pcl::PointXYZ>::Ptr cloud_sampled_out,
+                                                 std::vector<int>& indices_out,
+                                                 float leaf_size)
+{
   // Down-sampling to get uniform points distribution.
-  pcl::VoxelGrid<pcl::PointXYZ> sor;
-  sor.setInputCloud(cloud_in);
-  sor.setLeafSize (0.08f, 0.08f, 0.08f);
-  sor.filter(*cloud_sampled);
+  voxelGridFilter(cloud_in, leaf_size, *cloud_sampled_out);
 
   // Normals extraction.
   pcl::PointCloud<pcl::Normal>::Ptr normals (new pcl::PointCloud<pcl::Normal>);
@@ -18,7 +45,7 @@ void regionGrowingUniformPlaneSegmentationFilter(pcl::PointCloud<pcl::PointXYZ>:
   boost::shared_ptr<pcl::search::Search<pcl::PointXYZ>> (new pcl::search::KdTree<pcl::PointXYZ>);
   pcl::NormalEstimation<pcl::PointXYZ, pcl::Normal> normal_estimator;
   normal_estimator.setSearchMethod(tree);
-  normal_estimator.setInputCloud(cloud_sampled);
+  normal_estimator.setInputCloud(cloud_sampled_out);
   normal_estimator.setKSearch(30);
   normal_estimator.compute(*normals);
 
@@ -28,20 +55,158 @@ void regionGrowingUniformPlaneSegmentationFilter(pcl::PointCloud<pcl::PointXYZ>:
   reg.setMaxClusterSize(1000000);
   reg.setSearchMethod(tree);
   reg.setNumberOfNeighbours(15);
-  reg.setInputCloud(cloud_sampled);
+  reg.setInputCloud(cloud_sampled_out);
   reg.setInputNormals(normals);
   reg.setSmoothnessThreshold(3.0 / 180.0 * M_PI);
   reg.setCurvatureThreshold(1.0);
   std::vector <pcl::PointIndices> clusters;
   reg.extract(clusters);
 
-  // Populate cloud with clusters
-  srand (time(NULL));
+  getClustersIndices(clusters, indices_out);
+}
+
+// Voxel grid filter (centroid of each occupied voxel). Uses pcl::VoxelGrid when the
+// voxel indices fit in its integer range and the hash voxel grid otherwise
+// (pcl::VoxelGrid skips down-sampling on large extents, e.g. building-scale maps).
+void voxelGridFilter(pcl::PointCloud<pcl::PointXYZ>::Ptr cloud_in, float leaf_size,
+                     pcl::PointCloud<pcl::PointXYZ>& cloud_out)
+{
+  Eigen::Vector4f min_point, max_point;
+  pcl::getMinMax3D(*cloud_in, min_point, max_point);
+  double nb_voxels = 1.0;
+  for (int i = 0; i < 3; i++)
+    nb_voxels *= std::floor((max_point[i] - min_point[i]) / leaf_size) + 1.0;
+
+  if (nb_voxels < (double)std::numeric_limits<int32_t>::max())
+  {
+    pcl::VoxelGrid<pcl::PointXYZ> sor;
+    sor.setInputCloud(cloud_in);
+    sor.setLeafSize (leaf_size, leaf_size, leaf_size);
+    sor.filter(cloud_out);
+  }
+  else
+    hashVoxelGridFilter(*cloud_in, leaf_size, cloud_out);
+}
+
+// Voxel grid filter on hash map: no limit on the cloud extent
+void hashVoxelGridFilter(const pcl::PointCloud<pcl::PointXYZ>& cloud_in, float leaf_size,
+                         pcl::PointCloud<pcl::PointXYZ>& cloud_out)
+{
+  HashVoxelGrid voxel_grid (leaf_size);
+  for (size_t i = 0; i < cloud_in.size(); i++)
+    voxel_grid.addPoint(cloud_in.points[i].x, cloud_in.points[i].y, cloud_in.points[i].z);
+  getVoxelGridCloud(voxel_grid, cloud_out);
+}
+
+// Streams the points of a PLY or PCD file through the hash voxel grid (chunk_size
+// points at a time): the full resolution cloud is never stored in memory.
+bool loadVoxelizedCloudFromFile(const std::string& file_name, float leaf_size,
+                                pcl::PointCloud<pcl::PointXYZ>& cloud_out,
+                                size_t chunk_size,
+                                const std::function<void(float)>& progress)
+{
+  CloudStreamReader reader;
+  if (!reader.open(file_name))
+    return false;
+
+  HashVoxelGrid voxel_grid (leaf_size);
+  std::vector<float> chunk;
+  size_t nb_points;
+  size_t nb_read = 0;
+  while ((nb_points = reader.readChunk(chunk, chunk_size)) > 0)
+  {
+    voxel_grid.addPoints(&chunk[0], nb_points);
+    nb_read += nb_points;
+    if (progress && reader.getNbPoints() > 0)
+      progress(std::min(1.0f, (float)nb_read / reader.getNbPoints()));
+  }
+
+  std::cout << "[Filtering Utils] Loaded " << reader.getNbPoints() << " points, "
+            << voxel_grid.size() << " after down-sampling." << std::endl;
+  getVoxelGridCloud(voxel_grid, cloud_out);
+  return true;
+}
+
+void getVoxelGridCloud(const HashVoxelGrid& voxel_grid, pcl::PointCloud<pcl::PointXYZ>& cloud_out)
+{
+  std::vector<float> xyz;
+  voxel_grid.getCentroids(xyz);
+  cloud_out.points.resize(voxel_grid.size());
+  for (size_t i = 0; i < cloud_out.points.size(); i++)
+  {
+    cloud_out.points[i].x = xyz[3*i];
+    cloud_out.points[i].y = xyz[3*i+1];
+    cloud_out.points[i].z = xyz[3*i+2];
+  }
+  cloud_out.width = cloud_out.points.size();
+  cloud_out.height = 1;
+  cloud_out.is_dense = true;
+}
+
+// Concatenates the indices of all clusters (cluster by cluster)
+void getClustersIndices(const std::vector<pcl::PointIndices>& clusters, std::vector<int>& indices_out)
+{
+  size_t nb_points = 0;
+  for (int i = 0; i < clusters.size(); i++)
+    nb_points += clusters[i].indices.size();
+
+  indices_out.clear();
+  indices_out.reserve(nb_points);
   for (int i = 0; i < clusters.size(); i++)
+    indices_out.insert(indices_out.end(), clusters[i].indices.begin(), clusters[i].indices.end());
+}
+
+// Appends the points of cloud_in at indices to cloud_out (single copy per point)
+void gatherPoints(const pcl::PointCloud<pcl::PointXYZ>& cloud_in, const std::vector<int>& indices,
+                  pcl::PointCloud<pcl::PointXYZ>& cloud_out)
+{
+  cloud_out.points.reserve(cloud_out.points.size() + indices.size());
+  for (size_t i = 0; i < indices.size(); i++)
+    cloud_out.points.push_back(cloud_in.points[indices[i]]);
+  cloud_out.width = cloud_out.points.size();
+  cloud_out.height = 1;
+  cloud_out.is_dense = cloud_in.is_dense;
+}
+
+void estimateNormalsFilter(pcl::PointCloud<pcl::PointXYZ>::Ptr cloud_in,
+                           pcl::PointCloud<pcl::PointXYZRGBNormal>& cloud_out,
+                           int k, int num_threads)
+{
+#ifdef _OPENMP
+  if (num_threads <= 0)
+    num_threads = omp_get_max_threads();
+#else
+  num_threads = 1;
+#endif
+  pcl::PointCloud<pcl::Normal> normals;
+  pcl::search::KdTree<pcl::PointXYZ>::Ptr tree (new pcl::search::KdTree<pcl::PointXYZ>);
+  pcl::NormalEstimationOMP<pcl::PointXYZ, pcl::Normal> normal_estimator;
+  normal_estimator.setNumberOfThreads(num_threads);
+  normal_estimator.setSearchMethod(tree);
+  normal_estimator.setInputCloud(cloud_in);
+  normal_estimator.setKSearch(k);
+  normal_estimator.compute(normals);
+
+  cloud_out.clear();
+  cloud_out.points.reserve(cloud_in->size());
+  for (size_t i = 0; i < cloud_in->size(); i++)
   {
-    pcl::PointCloud<pcl::PointXYZ> cloud_cluster (*cloud_sampled, clusters[i].indices);
-    *cloud_out = *cloud_out + cloud_cluster;
+    const pcl::Normal& n = normals.points[i];
+    if (!pcl_isfinite(n.normal_x) || !pcl_isfinite(n.normal_y) || !pcl_isfinite(n.normal_z))
+      continue;
+    pcl::PointXYZRGBNormal p;
+    p.x = cloud_in->points[i].x;
+    p.y = cloud_in->points[i].y;
+    p.z = cloud_in->points[i].z;
+    p.normal_x = n.normal_x;
+    p.normal_y = n.normal_y;
+    p.normal_z = n.normal_z;
+    p.curvature = n.curvature;
+    cloud_out.points.push_back(p);
   }
+  cloud_out.width = cloud_out.points.size();
+  cloud_out.height = 1;
+  cloud_out.is_dense = true;
 }
 
 // The output cloud is the input after uniform sampling
@@ -51,14 +216,12 @@ void regionGrowingUniformPlaneSegmentationFilter(pcl::PointCloud<pcl::PointXYZ>:
 void regionGrowingUniformPlaneSegmentationFilter(pcl::PointCloud<pcl::PointXYZ>::Ptr cloud_in,
                                                  pcl::PointCloud<pcl::PointXYZRGBNormal>::Ptr cloud_sampled_out,
                                                  Eigen::Isometry3d view_point,
-                                                 std::vector<pcl::PointIndices>& clusters)
+                                                 std::vector<pcl::PointIndices>& clusters,
+                                                 float leaf_size)
 {
   pcl::PointCloud<pcl::PointXYZ>::Ptr cloud_sampled (new pcl::PointCloud<pcl::PointXYZ>);
   // Down-sampling to get uniform points distribution.
-  pcl::VoxelGrid<pcl::PointXYZ> sor;
-  sor.setInputCloud(cloud_in);
-  sor.setLeafSize (0.08f, 0.08f, 0.08f);
-  sor.filter(*cloud_sampled);
+  voxelGridFilter(cloud_in, leaf_size, *cloud_sampled);
   pcl::copyPointCloud(*cloud_sampled, *cloud_sampled_out);
 
   // Normals extraction.
@@ -86,6 +249,344 @@ void regionGrowingUniformPlaneSegmentationFilter(pcl::PointCloud<pcl::PointXYZ>:
   reg.extract(clusters);
 
   // Color output cloud
+  colorClusters(*cloud_sampled_out, clusters);
+}
+
+// Returns filtered cloud (same as the XYZ overload) and stores in segmented_out
+// the same points, in the same order, with normals (oriented towards view_point)
+// and the clusters they belong to. Keep it along with the cloud to avoid running
+// the segmentation again in later stages (e.g. alignabilityFilter).
+void regionGrowingUniformPlaneSegmentationFilter(pcl::PointCloud<pcl::PointXYZ>::Ptr cloud_in,
+                                                 pcl::PointCloud<pcl::PointXYZ>::Ptr cloud_out,
+                                                 Eigen::Isometry3d view_point,
+                                                 SegmentedCloud& segmented_out,
+                                                 float leaf_size)
+{
+  pcl::PointCloud<pcl::PointXYZRGBNormal>::Ptr cloud_sampled (new pcl::PointCloud<pcl::PointXYZRGBNormal>);
+  std::vector <pcl::PointIndices> clusters;
+  regionGrowingUniformPlaneSegmentationFilter(cloud_in, cloud_sampled, view_point, clusters, leaf_size);
+
+  buildSegmentedCloud(*cloud_sampled, clusters, segmented_out);
+  pcl::copyPointCloud(*segmented_out.cloud, *cloud_out);
+}
+
+// Union-find root of cluster c (with path halving)
+static int findClusterRoot(std::vector<int>& parents, int c)
+{
+  while (parents[c] != c)
+  {
+    parents[c] = parents[parents[c]];
+    c = parents[c];
+  }
+  return c;
+}
+
+// Parallel version of the filter above: normals are computed on num_threads threads
+// and planes are extracted on spatial partitions of the cloud (one search tree each,
+// built in parallel; the normals tree is built once on the full cloud),
+// then merged across partition boundaries. Output planes are equivalent, clusters
+// might be in a different order. num_threads <= 0 uses all available threads.
+void parallelRegionGrowingUniformPlaneSegmentationFilter(pcl::PointCloud<pcl::PointXYZ>::Ptr cloud_in,
+                                                         pcl::PointCloud<pcl::PointXYZ>::Ptr cloud_out,
+                                                         Eigen::Isometry3d view_point,
+                                                         SegmentedCloud& segmented_out,
+                                                         int num_threads,
+                                                         float leaf_size)
+{
+#ifdef _OPENMP
+  if (num_threads <= 0)
+    num_threads = omp_get_max_threads();
+#else
+  num_threads = 1;
+#endif
+  const int min_cluster_size = 50;
+  const float smoothness_threshold = 3.0 / 180.0 * M_PI;
+  // Width of the band around partition boundaries where clusters get merged
+  const float boundary_band = 2.0 * leaf_size;
+
+  pcl::PointCloud<pcl::PointXYZ>::Ptr cloud_sampled_xyz (new pcl::PointCloud<pcl::PointXYZ>);
+  // Down-sampling to get uniform points distribution.
+  voxelGridFilter(cloud_in, leaf_size, *cloud_sampled_xyz);
+  pcl::PointCloud<pcl::PointXYZRGBNormal>::Ptr cloud_sampled (new pcl::PointCloud<pcl::PointXYZRGBNormal>);
+  pcl::copyPointCloud(*cloud_sampled_xyz, *cloud_sampled);
+
+  // Normals extraction (multithreaded).
+  pcl::PointCloud<pcl::Normal>::Ptr normals (new pcl::PointCloud<pcl::Normal>);
+  pcl::search::Search<pcl::PointXYZRGBNormal>::Ptr tree =
+  boost::shared_ptr<pcl::search::Search<pcl::PointXYZRGBNormal>> (new pcl::search::KdTree<pcl::PointXYZRGBNormal>);
+  pcl::NormalEstimationOMP<pcl::PointXYZRGBNormal, pcl::Normal> normal_estimator;
+  normal_estimator.setNumberOfThreads(num_threads);
+  normal_estimator.setSearchMethod(tree);
+  normal_estimator.setInputCloud(cloud_sampled);
+  normal_estimator.setKSearch(30);
+  normal_estimator.setViewPoint(view_point.translation().x(), view_point.translation().y(), view_point.translation().z());
+  normal_estimator.compute(*normals);
+  pcl::copyPointCloud(*normals, *cloud_sampled);
+
+  // Spatial partitions: slabs with the same number of points along the longest horizontal axis
+  int nb_points = cloud_sampled->size();
+  int nb_partitions = std::max(1, std::min(num_threads, nb_points / (20 * min_cluster_size)));
+  pcl::PointXYZRGBNormal min_point, max_point;
+  pcl::getMinMax3D(*cloud_sampled, min_point, max_point);
+  int axis = ((max_point.x - min_point.x) >= (max_point.y - min_point.y)) ? 0 : 1;
+
+  std::vector<std::pair<float, int> > sorted_points (nb_points);
+  for (int i = 0; i < nb_points; i++)
+    sorted_points[i] = std::make_pair(cloud_sampled->points[i].data[axis], i);
+  std::sort(sorted_points.begin(), sorted_points.end());
+
+  int partition_size = (nb_points + nb_partitions - 1) / nb_partitions;
+  std::vector<pcl::IndicesPtr> partitions (nb_partitions);
+  std::vector<int> point_partition (nb_points);
+  std::vector<float> boundaries; // coordinate where each partition (after the first) starts
+  for (int k = 0; k < nb_partitions; k++)
+  {
+    partitions[k].reset(new std::vector<int>);
+    int begin = k * partition_size;
+    int end = std::min(nb_points, begin + partition_size);
+    if (begin >= end)
+      continue;
+    if (k > 0)
+      boundaries.push_back(sorted_points[begin].first);
+    partitions[k]->reserve(end - begin);
+    for (int i = begin; i < end; i++)
+    {
+      partitions[k]->push_back(sorted_points[i].second);
+      point_partition[sorted_points[i].second] = k;
+    }
+  }
+
+  // Region Growing Planes Extraction (segmentation) on each partition.
+  // Small clusters are kept at this stage as they might be part of a plane
+  // crossing a partition boundary.
+  std::vector<std::vector<pcl::PointIndices> > partition_clusters (nb_partitions);
+#ifdef _OPENMP
+#pragma omp parallel for num_threads(num_threads) schedule(dynamic)
+#endif
+  for (int k = 0; k < nb_partitions; k++)
+  {
+    if (partitions[k]->empty())
+      continue;
+    pcl::search::Search<pcl::PointXYZRGBNormal>::Ptr partition_tree =
+    boost::shared_ptr<pcl::search::Search<pcl::PointXYZRGBNormal>> (new pcl::search::KdTree<pcl::PointXYZRGBNormal>);
+    pcl::RegionGrowing<pcl::PointXYZRGBNormal, pcl::Normal> reg;
+    reg.setMinClusterSize(1);
+    reg.setMaxClusterSize(1000000);
+    reg.setSearchMethod(partition_tree);
+    reg.setNumberOfNeighbours(15);
+    reg.setInputCloud(cloud_sampled);
+    reg.setIndices(partitions[k]);
+    reg.setInputNormals(normals);
+    reg.setSmoothnessThreshold(smoothness_threshold);
+    reg.setCurvatureThreshold(1.0);
+    reg.extract(partition_clusters[k]);
+  }
+
+  // Merge clusters split by partition boundaries: clusters are connected if they have
+  // neighbouring points with smooth normals (same criteria as region growing).
+  std::vector<pcl::PointIndices> clusters_all;
+  for (int k = 0; k < nb_partitions; k++)
+    clusters_all.insert(clusters_all.end(), partition_clusters[k].begin(), partition_clusters[k].end());
+  std::vector<int> labels (nb_points, -1);
+  for (int c = 0; c < clusters_all.size(); c++)
+    for (size_t i_point = 0; i_point < clusters_all[c].indices.size(); i_point++)
+      labels[clusters_all[c].indices[i_point]] = c;
+
+  std::vector<int> parents (clusters_all.size());
+  for (int c = 0; c < parents.size(); c++)
+    parents[c] = c;
+
+  float cos_threshold = cos(smoothness_threshold);
+  for (int b = 0; b < boundaries.size(); b++)
+  {
+    // Points right after the boundary (partition b+1)
+    pcl::IndicesPtr band_after (new std::vector<int>);
+    std::vector<int> band_before;
+    for (int i = 0; i < nb_points; i++)
+    {
+      float coord = cloud_sampled->points[i].data[axis];
+      if (point_partition[i] == b+1 && coord <= boundaries[b] + boundary_band)
+        band_after->push_back(i);
+      else if (point_partition[i] == b && coord >= boundaries[b] - boundary_band)
+        band_before.push_back(i);
+    }
+    if (band_after->empty() || band_before.empty())
+      continue;
+
+    pcl::search::KdTree<pcl::PointXYZRGBNormal> band_tree;
+    band_tree.setInputCloud(cloud_sampled, band_after);
+    std::vector<int> neighbours;
+    std::vector<float> distances;
+    for (size_t i = 0; i < band_before.size(); i++)
+    {
+      const pcl::PointXYZRGBNormal& point = cloud_sampled->points[band_before[i]];
+      band_tree.radiusSearch(point, boundary_band, neighbours, distances);
+      for (size_t j = 0; j < neighbours.size(); j++)
+      {
+        const pcl::PointXYZRGBNormal& neighbour = cloud_sampled->points[neighbours[j]];
+        float dot = fabs(point.normal_x * neighbour.normal_x +
+                         point.normal_y * neighbour.normal_y +
+                         point.normal_z * neighbour.normal_z);
+        if (dot < cos_threshold)
+          continue;
+        // Points dropped by region growing (label -1) belong to no cluster
+        if (labels[band_before[i]] < 0 || labels[neighbours[j]] < 0)
+          continue;
+        int root_a = findClusterRoot(parents, labels[band_before[i]]);
+        int root_b = findClusterRoot(parents, labels[neighbours[j]]);
+        if (root_a != root_b)
+          parents[std::max(root_a, root_b)] = std::min(root_a, root_b);
+      }
+    }
+  }
+
+  // Assemble merged clusters (discard small ones as in the sequential filter)
+  std::vector<int> merged_ids (clusters_all.size(), -1);
+  std::vector<pcl::PointIndices> merged_clusters;
+  for (int c = 0; c < clusters_all.size(); c++)
+  {
+    int root = findClusterRoot(parents, c);
+    if (merged_ids[root] == -1)
+    {
+      merged_ids[root] = merged_clusters.size();
+      merged_clusters.push_back(pcl::PointIndices());
+    }
+    std::vector<int>& indices = merged_clusters[merged_ids[root]].indices;
+    indices.insert(indices.end(), clusters_all[c].indices.begin(), clusters_all[c].indices.end());
+  }
+  std::vector<pcl::PointIndices> clusters;
+  for (int c = 0; c < merged_clusters.size(); c++)
+  {
+    if (merged_clusters[c].indices.size() >= min_cluster_size &&
+        merged_clusters[c].indices.size() <= 1000000)
+      clusters.push_back(merged_clusters[c]);
+  }
+
+  colorClusters(*cloud_sampled, clusters);
+  buildSegmentedCloud(*cloud_sampled, clusters, segmented_out);
+  pcl::copyPointCloud(*segmented_out.cloud, *cloud_out);
+}
+
+// GPU version of the filter above (pre-filter mode "cuda"): voxel grid, normals (k nearest
+// neighbours on a uniform grid) and planes (connected components of the region growing
+// criteria) computed on the GPU. Same output as the parallel filter, which is used instead
+// if the CUDA backend is not built, no device is available or the GPU filter fails.
+void cudaRegionGrowingUniformPlaneSegmentationFilter(pcl::PointCloud<pcl::PointXYZ>::Ptr cloud_in,
+                                                     pcl::PointCloud<pcl::PointXYZ>::Ptr cloud_out,
+                                                     Eigen::Isometry3d view_point,
+                                                     SegmentedCloud& segmented_out,
+                                                     float leaf_size)
+{
+#ifdef AICP_WITH_CUDA
+  if (cudaFilterAvailable())
+  {
+    const int min_cluster_size = 50;
+    const int max_cluster_size = 1000000;
+    std::vector<float> xyz;
+    xyz.reserve(3 * cloud_in->size());
+    for (size_t i = 0; i < cloud_in->size(); i++)
+    {
+      const pcl::PointXYZ& point = cloud_in->points[i];
+      if (!std::isfinite(point.x) || !std::isfinite(point.y) || !std::isfinite(point.z))
+        continue;
+      xyz.push_back(point.x);
+      xyz.push_back(point.y);
+      xyz.push_back(point.z);
+    }
+    CudaPlaneSegmentationParams params;
+    params.leaf_size = leaf_size;
+    for (int i = 0; i < 3; i++)
+      params.view_point[i] = view_point.translation()[i];
+
+    std::vector<float> sampled_xyz, normals;
+    std::vector<int> labels;
+    if (cudaPlaneSegmentation(xyz.data(), xyz.size() / 3, params, sampled_xyz, normals, labels))
+    {
+      pcl::PointCloud<pcl::PointXYZRGBNormal>::Ptr cloud_sampled (new pcl::PointCloud<pcl::PointXYZRGBNormal>);
+      cloud_sampled->points.resize(labels.size());
+      for (size_t i = 0; i < labels.size(); i++)
+      {
+        pcl::PointXYZRGBNormal& point = cloud_sampled->points[i];
+        point.x = sampled_xyz[3*i];
+        point.y = sampled_xyz[3*i+1];
+        point.z = sampled_xyz[3*i+2];
+        point.normal_x = normals[4*i];
+        point.normal_y = normals[4*i+1];
+        point.normal_z = normals[4*i+2];
+        point.curvature = normals[4*i+3];
+      }
+      cloud_sampled->width = cloud_sampled->points.size();
+      cloud_sampled->height = 1;
+      cloud_sampled->is_dense = true;
+
+      // Clusters in the order of their smallest point index (labels), small ones discarded
+      std::vector<int> cluster_sizes (labels.size(), 0);
+      for (size_t i = 0; i < labels.size(); i++)
+        cluster_sizes[labels[i]]++;
+      std::vector<int> cluster_ids (labels.size(), -1);
+      std::vector<pcl::PointIndices> clusters;
+      for (size_t i = 0; i < labels.size(); i++)
+      {
+        int size = cluster_sizes[labels[i]];
+        if (size < min_cluster_size || size > max_cluster_size)
+          continue;
+        if (cluster_ids[labels[i]] == -1)
+        {
+          cluster_ids[labels[i]] = clusters.size();
+          clusters.push_back(pcl::PointIndices());
+          clusters.back().indices.reserve(size);
+        }
+        clusters[cluster_ids[labels[i]]].indices.push_back(i);
+      }
+
+      colorClusters(*cloud_sampled, clusters);
+      buildSegmentedCloud(*cloud_sampled, clusters, segmented_out);
+      pcl::copyPointCloud(*segmented_out.cloud, *cloud_out);
+      return;
+    }
+  }
+#endif
+  static std::once_flag warning_flag;
+  std::call_once(warning_flag, []()
+  {
+    std::cerr << "[Filtering Utils] Warning: GPU pre-filter not available, "
+              << "using the parallel CPU filter." << std::endl;
+  });
+  parallelRegionGrowingUniformPlaneSegmentationFilter(cloud_in, cloud_out, view_point, segmented_out, 0, leaf_size);
+}
+
+// Keeps clustered points only, grouped by cluster
+void buildSegmentedCloud(const pcl::PointCloud<pcl::PointXYZRGBNormal>& cloud_sampled,
+                         const std::vector<pcl::PointIndices>& clusters,
+                         SegmentedCloud& segmented_out)
+{
+  size_t nb_points = 0;
+  for (int i = 0; i < clusters.size(); i++)
+    nb_points += clusters[i].indices.size();
+
+  segmented_out = SegmentedCloud();
+  segmented_out.cloud->points.reserve(nb_points);
+  segmented_out.labels.reserve(nb_points);
+  segmented_out.clusters.resize(clusters.size());
+  for (int i = 0; i < clusters.size(); i++)
+  {
+    segmented_out.clusters[i].indices.reserve(clusters[i].indices.size());
+    for (size_t i_point = 0; i_point < clusters[i].indices.size(); i_point++)
+    {
+      segmented_out.clusters[i].indices.push_back(segmented_out.cloud->points.size());
+      segmented_out.cloud->points.push_back(cloud_sampled.points[clusters[i].indices[i_point]]);
+      segmented_out.labels.push_back(i);
+    }
+  }
+  segmented_out.cloud->width = segmented_out.cloud->points.size();
+  segmented_out.cloud->height = 1;
+  segmented_out.cloud->is_dense = cloud_sampled.is_dense;
+}
+
+// Assigns a random color to each cluster
+void colorClusters(pcl::PointCloud<pcl::PointXYZRGBNormal>& cloud,
+                   const std::vector<pcl::PointIndices>& clusters)
+{
   srand (time(NULL));
   for (int i = 0; i < clusters.size(); i++)
   {
@@ -97,11 +598,47 @@ void regionGrowingUniformPlaneSegmentationFilter(pcl::PointCloud<pcl::PointXYZ>:
     for (size_t i_point = 0; i_point < clusters[i].indices.size(); i_point++)
     {
       int idx = clusters[i].indices[i_point];
-      cloud_sampled_out->points[idx].rgb = rgb;
+      cloud.points[idx].rgb = rgb;
     }
   }
 }
 
+// Indices of the points of cloud (global reference frame) in the field of view of
+// a sensor at pose: range and horizontal angle (wrt sensor x axis) thresholds.
+static void fovFilter(pcl::PointCloud<pcl::PointXYZ>& cloud, const Eigen::Isometry3d& pose,
+                      float range, float angularView, std::vector<int>& accepted_indices)
+{
+  accepted_indices.clear();
+  if (cloud.empty())
+    return;
+
+  // Accepted: |theta| < thresh, i.e. cos(theta) = x / sqrt(x^2 + y^2) > cos(thresh)
+  float thresh = (180.0-((360.0-angularView)/2)) * M_PI / 180.0;
+  float cos_thresh = cos(thresh);
+  float range_squared = range * range;
+  bool any_angle = thresh >= M_PI;
+
+  // Batch transform to sensor frame (points stored with 4 floats stride)
+  Eigen::Isometry3d pose_inverse = pose.inverse();
+  Eigen::Matrix3f rotation = pose_inverse.linear().cast<float>();
+  Eigen::Vector3f translation = pose_inverse.translation().cast<float>();
+  Eigen::Matrix3Xf points = (rotation * cloud.getMatrixXfMap(3, 4, 0)).colwise() + translation;
+
+  Eigen::ArrayXf planar_squared = points.topRows<2>().colwise().squaredNorm().transpose().array();
+  Eigen::ArrayXf range_check = planar_squared + points.row(2).transpose().array().square();
+  Eigen::Array<bool, Eigen::Dynamic, 1> accepted = range_check < range_squared;
+  if (!any_angle)
+    accepted = accepted && (planar_squared == 0.0f ||
+                            points.row(0).transpose().array() > cos_thresh * planar_squared.sqrt());
+
+  accepted_indices.reserve(accepted.count());
+  for (int i = 0; i < accepted.size(); i++)
+  {
+    if (accepted[i])
+      accepted_indices.push_back(i);
+  }
+}
+
 // The overlapFilter does not reduce the number of points in the clouds. However it computes
 // a parameter describing the overlap between the two clouds.
 // Input: two clouds cloudA and cloudB in global reference frame,
@@ -114,84 +651,48 @@ float overlapFilter(pcl::PointCloud<pcl::PointXYZ>& cloudA, pcl::PointCloud<pcl:
                    pcl::PointCloud<pcl::PointXYZ>& accepted_pointsA,
                    pcl::PointCloud<pcl::PointXYZ>& accepted_pointsB)
 {
-  float thresh = (180.0-((360.0-angularView)/2));
-  Eigen::Isometry3d poseBinverse;
-  poseBinverse = poseB.inverse();
-  // Filter 1: first cloud wrt second pose
-  //pcl::PointCloud<pcl::PointXYZ> accepted_pointsA;
-  for (int i=0; i < cloudA.size(); i++)
-  {
-    pcl::PointXYZ pointA_B;
-    pointA_B.x = static_cast<float> (poseBinverse(0, 0) * cloudA.points[i].x + poseBinverse(0, 1) * cloudA.points[i].y + poseBinverse(0, 2) * cloudA.points[i].z + poseBinverse(0, 3));
-    pointA_B.y = static_cast<float> (poseBinverse(1, 0) * cloudA.points[i].x + poseBinverse(1, 1) * cloudA.points[i].y + poseBinverse(1, 2) * cloudA.points[i].z + poseBinverse(1, 3));
-    pointA_B.z = static_cast<float> (poseBinverse(2, 0) * cloudA.points[i].x + poseBinverse(2, 1) * cloudA.points[i].y + poseBinverse(2, 2) * cloudA.points[i].z + poseBinverse(2, 3));
-    //pointA_B = poseB.inverse() * cloudA.points[i];
-
-    float r = sqrt( pow(pointA_B.x,2.0) + pow(pointA_B.y,2.0) + pow(pointA_B.z,2.0) );
-    float theta = atan2 (pointA_B.y,pointA_B.x) * 180 / M_PI; //degrees
-    float phi = acos (pointA_B.z / r) * 180.0 / M_PI;
-
-    // Filter out points with (theta > 225deg and theta < 315deg) and the far ones
-    //cout << "r: " << r << ", theta: " << theta << ", phi: " << phi << endl;
-    if ((theta < thresh && theta > -thresh) && r < range)
-    {
-      // Store treimmed cloud, transformed back to local reference frame
-      pcl::PointXYZ pointA_local;
-      Eigen::Affine3d poseB_affine;
-      poseB_affine.translation() = poseB.translation();
-      poseB_affine.linear() = poseB.rotation();
-      pointA_local = pcl::transformPoint(pointA_B, poseB_affine.cast<float>());
-      accepted_pointsA.push_back(pointA_local);
-    }
-  }
+  std::vector<int> accepted_indicesA, accepted_indicesB;
+  float overlap = overlapFilter(cloudA, cloudB, poseA, poseB, range, angularView,
+                                accepted_indicesA, accepted_indicesB);
 
-  Eigen::Isometry3d poseAinverse;
-  poseAinverse = poseA.inverse();
+  gatherPoints(cloudA, accepted_indicesA, accepted_pointsA);
+  gatherPoints(cloudB, accepted_indicesB, accepted_pointsB);
+
+  return overlap;
+}
+
+// Same as above, returns the indices of the points belonging to overlap region
+// instead of copies of them.
+float overlapFilter(pcl::PointCloud<pcl::PointXYZ>& cloudA, pcl::PointCloud<pcl::PointXYZ>& cloudB,
+                   Eigen::Isometry3d poseA, Eigen::Isometry3d poseB,
+                   float range, float angularView,
+                   std::vector<int>& accepted_indicesA,
+                   std::vector<int>& accepted_indicesB)
+{
+  // Filter 1: first cloud wrt second pose
+  fovFilter(cloudA, poseB, range, angularView, accepted_indicesA);
   // Filter 2: second cloud wrt first pose
-  //pcl::PointCloud<pcl::PointXYZ> accepted_pointsB;
-  for (int i=0; i < cloudB.size(); i++)
-  {
-    pcl::PointXYZ pointB_A;
-    pointB_A.x = static_cast<float> (poseAinverse(0, 0) * cloudB.points[i].x + poseAinverse(0, 1) * cloudB.points[i].y + poseAinverse(0, 2) * cloudB.points[i].z + poseAinverse(0, 3));
-    pointB_A.y = static_cast<float> (poseAinverse(1, 0) * cloudB.points[i].x + poseAinverse(1, 1) * cloudB.points[i].y + poseAinverse(1, 2) * cloudB.points[i].z + poseAinverse(1, 3));
-    pointB_A.z = static_cast<float> (poseAinverse(2, 0) * cloudB.points[i].x + poseAinverse(2, 1) * cloudB.points[i].y + poseAinverse(2, 2) * cloudB.points[i].z + poseAinverse(2, 3));
-    //pointB_A = poseB.inverse() * cloudB.points[i];
-
-    float r = sqrt( pow(pointB_A.x,2.0) + pow(pointB_A.y,2.0) + pow(pointB_A.z,2.0) );
-    float theta = atan2 (pointB_A.y,pointB_A.x) * 180 / M_PI; //degrees
-    float phi = acos (pointB_A.z / r) * 180.0 / M_PI;
-
-    // Filter out points with (theta > 225deg and theta < 315deg) and the far ones
-    //cout << "r: " << r << ", theta: " << theta << ", phi: " << phi << endl;
-    if ((theta < thresh && theta > -thresh) && r < range)
-    {
-      // Store trimmed cloud, transformed back to local reference frame
-      pcl::PointXYZ pointB_local;
-      Eigen::Affine3d poseA_affine;
-      poseA_affine.translation() = poseA.translation();
-      poseA_affine.linear() = poseA.rotation();
-      pointB_local = pcl::transformPoint(pointB_A, poseA_affine.cast<float>());
-      accepted_pointsB.push_back(pointB_local);
-    }
-  }
+  fovFilter(cloudB, poseA, range, angularView, accepted_indicesB);
 
   //Compute overlap parameter dependent on percentage of accepted points per cloud
   float perc_accepted_A, perc_accepted_B;
-  perc_accepted_A = (float)(accepted_pointsA.size()) / (float)(cloudA.size());
-  perc_accepted_B = (float)(accepted_pointsB.size()) / (float)(cloudB.size());
-  //cout << "Points left in cloudA: " << perc_accepted_A*100.0 << "%" << endl;
-  //cout << "Points left in cloudB: " << perc_accepted_B*100.0 << "%" << endl;
+  perc_accepted_A = (float)(accepted_indicesA.size()) / (float)(cloudA.size());
+  perc_accepted_B = (float)(accepted_indicesB.size()) / (float)(cloudB.size());
 
   float overlap = perc_accepted_A * perc_accepted_B;
-  //cout << "Overlap: " << overlap*100.0 << "%" << endl;
-
-  pcl::PCDWriter writer;
-  //writer.write<pcl::PointXYZ> ("accepted_pointsA.pcd", accepted_pointsA, false);
-  //writer.write<pcl::PointXYZ> ("accepted_pointsB.pcd", accepted_pointsB, false);
 
   return overlap*100.0;
 }
 
+// Planes matching and constraints analysis on unit sphere (used by alignabilityFilter)
+static float planesAlignability(pcl::PointCloud<pcl::PointXYZRGBNormal>::Ptr cloudA_sampled,
+                                std::vector<pcl::PointIndices>& clustersA,
+                                pcl::PointCloud<pcl::PointXYZRGBNormal>::Ptr cloudB_sampled,
+                                std::vector<pcl::PointIndices>& clustersB,
+                                pcl::PointCloud<pcl::PointXYZRGBNormal>::Ptr cloudA_planes,
+                                pcl::PointCloud<pcl::PointXYZRGBNormal>::Ptr cloudB_planes,
+                                pcl::PointCloud<pcl::PointXYZRGBNormal>::Ptr eigenvectors);
+
 // Our implementation of registrationFailurePredictionFilter
 float alignabilityFilter(pcl::PointCloud<pcl::PointXYZ>& cloudA, pcl::PointCloud<pcl::PointXYZ>& cloudB,
                          Eigen::Isometry3d poseA, Eigen::Isometry3d poseB,
@@ -199,7 +700,6 @@ float alignabilityFilter(pcl::PointCloud<pcl::PointXYZ>& cloudA, pcl::PointCloud
                          pcl::PointCloud<pcl::PointXYZRGBNormal>::Ptr eigenvectors)
 {
   // Expected: cloudA and cloudB are points belonging to the region of overlap
-  float alignability = -1.0;
 
   // 1. Pre-process clouds: down-sampling and planes extraction.
   // Processing cloud A...
@@ -219,6 +719,58 @@ float alignabilityFilter(pcl::PointCloud<pcl::PointXYZ>& cloudA, pcl::PointCloud
 //  writer.write<pcl::PointXYZRGBNormal> ("cloudA_sampled.pcd", *cloudA_sampled, false);
 //  writer.write<pcl::PointXYZRGBNormal> ("cloudB_sampled.pcd", *cloudB_sampled, false);
 
+  return planesAlignability(cloudA_sampled, clustersA, cloudB_sampled, clustersB,
+                            cloudA_planes, cloudB_planes, eigenvectors);
+}
+
+// Same as above, but reuses the planes segmentation of the pre-filtered clouds
+// (computed once per cloud) instead of running it again on the region of overlap.
+// Expected: indicesA and indicesB are the points of segmentedA and segmentedB
+//           belonging to the region of overlap (see overlapFilter)
+float alignabilityFilter(SegmentedCloud& segmentedA, SegmentedCloud& segmentedB,
+                         const std::vector<int>& indicesA, const std::vector<int>& indicesB,
+                         pcl::PointCloud<pcl::PointXYZRGBNormal>::Ptr cloudA_planes, pcl::PointCloud<pcl::PointXYZRGBNormal>::Ptr cloudB_planes,
+                         pcl::PointCloud<pcl::PointXYZRGBNormal>::Ptr eigenvectors)
+{
+  std::vector <pcl::PointIndices> clustersA;
+  getClustersInRegion(segmentedA, indicesA, clustersA);
+  std::vector <pcl::PointIndices> clustersB;
+  getClustersInRegion(segmentedB, indicesB, clustersB);
+
+  return planesAlignability(segmentedA.cloud, clustersA, segmentedB.cloud, clustersB,
+                            cloudA_planes, cloudB_planes, eigenvectors);
+}
+
+// Restricts the clusters of a segmented cloud to the points in indices.
+// Clusters left with less points than the segmentation minimum (50) are discarded.
+void getClustersInRegion(SegmentedCloud& segmented, const std::vector<int>& indices,
+                         std::vector<pcl::PointIndices>& clusters)
+{
+  std::vector <pcl::PointIndices> clusters_in_region (segmented.clusters.size());
+  for (size_t i = 0; i < indices.size(); i++)
+  {
+    int label = segmented.labels[indices[i]];
+    clusters_in_region[label].indices.push_back(indices[i]);
+  }
+
+  clusters.clear();
+  for (int i = 0; i < clusters_in_region.size(); i++)
+  {
+    if (clusters_in_region[i].indices.size() >= 50)
+      clusters.push_back(clusters_in_region[i]);
+  }
+}
+
+static float planesAlignability(pcl::PointCloud<pcl::PointXYZRGBNormal>::Ptr cloudA_sampled,
+                                std::vector<pcl::PointIndices>& clustersA,
+                                pcl::PointCloud<pcl::PointXYZRGBNormal>::Ptr cloudB_sampled,
+                                std::vector<pcl::PointIndices>& clustersB,
+                                pcl::PointCloud<pcl::PointXYZRGBNormal>::Ptr cloudA_planes,
+                                pcl::PointCloud<pcl::PointXYZRGBNormal>::Ptr cloudB_planes,
+                                pcl::PointCloud<pcl::PointXYZRGBNormal>::Ptr eigenvectors)
+{
+  float alignability = -1.0;
+
   // 2. Planes matching: keep matching planes between clouds.
   // Vector with matching indeces and corresponding overlap value
   // It will contain: -1 if no correspondence exist
@@ -233,29 +785,49 @@ float alignabilityFilter(pcl::PointCloud<pcl::PointXYZ>& cloudA, pcl::PointCloud
     matching_distance[i] = -1;
   }
 
+  // Descriptors computed once per cluster
+  std::vector<ClusterDescriptor> descriptorsA (clustersA.size());
+  std::vector<ClusterDescriptor> descriptorsB (clustersB.size());
   for (int i = 0; i < clustersA.size(); i++)
-  {
-    pcl::PointCloud<pcl::PointXYZRGBNormal> cloudA_cluster (*cloudA_sampled, clustersA[i].indices);
+    computeClusterDescriptor(cloudA_sampled, clustersA[i], descriptorsA[i]);
+  for (int j = 0; j < clustersB.size(); j++)
+    computeClusterDescriptor(cloudB_sampled, clustersB[j], descriptorsB[j]);
+
+  // Sweep and prune: clusters B sorted by points lower bound along x
+  std::vector<std::pair<float, int> > sortedB (clustersB.size());
+  for (int j = 0; j < clustersB.size(); j++)
+    sortedB[j] = std::make_pair(descriptorsB[j].points_min[0], j);
+  std::sort(sortedB.begin(), sortedB.end());
 
-    Eigen::Vector3f clusterA_centroid;
-    computeNormalsCentroid(cloudA_cluster, clusterA_centroid);
+  for (int i = 0; i < clustersA.size(); i++)
+  {
+    const ClusterDescriptor& descriptorA = descriptorsA[i];
 
     float max_overlap = 0, current_distance = -1;
     int matching_cluster_idx = -1;
-    for (int j = 0; j < clustersB.size(); j++)
+    for (int k = 0; k < sortedB.size() && sortedB[k].first <= descriptorA.aabb_max[0]; k++)
     {
-      pcl::PointCloud<pcl::PointXYZRGBNormal> cloudB_cluster (*cloudB_sampled, clustersB[j].indices);
+      int j = sortedB[k].second;
+      const ClusterDescriptor& descriptorB = descriptorsB[j];
 
-      Eigen::Vector3f clusterB_centroid;
-      computeNormalsCentroid(cloudB_cluster, clusterB_centroid);
+      // Zero overlap if the points of a cluster cannot be in the other's box
+      if ((descriptorB.points_max.array() < descriptorA.aabb_min.array()).any() ||
+          (descriptorB.points_min.array() > descriptorA.aabb_max.array()).any() ||
+          (descriptorA.points_max.array() < descriptorB.aabb_min.array()).any() ||
+          (descriptorA.points_min.array() > descriptorB.aabb_max.array()).any())
+        continue;
 
-      float dot = clusterA_centroid.transpose() * clusterB_centroid;
-      float dist = acos( dot/(clusterA_centroid.norm()*clusterB_centroid.norm()) ) * 180.0/M_PI; // degrees
+      float dot = descriptorA.normal.transpose() * descriptorB.normal;
+      float dist = acos( dot/(descriptorA.normal.norm()*descriptorB.normal.norm()) ) * 180.0/M_PI; // degrees
+      if (!(dist < 20)) // Threshold for maximum angular distance between centroids (deg)
+        continue;
 
       // Planes Overlap Filter
-      float current_overlap = overlapBoxFilter(cloudA_cluster, cloudB_cluster);
-//      std::cout << "[Filtering Utils] Current Box Overlap: " << current_overlap << std::endl;
-      if (current_overlap > max_overlap && (dist < 20))// || dist > 160)) // Threshold for maximum angular distance between centroids (deg)
+      float current_overlap = overlapBoxFilter(*cloudA_sampled, clustersA[i], descriptorA,
+                                               *cloudB_sampled, clustersB[j], descriptorB);
+      // (ties: lowest index, as when visiting clusters B in order)
+      if (current_overlap > max_overlap ||
+          (current_overlap == max_overlap && current_overlap > 0 && j < matching_cluster_idx))
       {
         matching_cluster_idx = j;
         max_overlap = current_overlap;
@@ -286,96 +858,64 @@ float alignabilityFilter(pcl::PointCloud<pcl::PointXYZ>& cloudA, pcl::PointCloud
   }
 
   // PCA on unit sphere
-  // Data Structure
-  pcl::PointCloud<pcl::PointXYZRGB>::Ptr cloudA_normals (new pcl::PointCloud<pcl::PointXYZRGB>);
+  // Normals scatter matrix accumulated over matched clusters A (the mean of
+  // normals and mirrored normals is zero: scatter is the covariance up to scale)
+  Eigen::Matrix3d scatter = Eigen::Matrix3d::Zero();
+  Eigen::Vector3d points_sum = Eigen::Vector3d::Zero();
+  int nb_normals = 0;
 
   srand (time(NULL));
   for (int i = 0; i < matching_indeces.size(); i++)
   {
     if (matching_indeces.at(i) != -1)
     {
-      pcl::PointCloud<pcl::PointXYZRGBNormal> match_clusterA (*cloudA_sampled, clustersA[matching_indeces.at(i)].indices);
-      pcl::PointCloud<pcl::PointXYZRGBNormal> match_clusterB (*cloudB_sampled, clustersB[i].indices);
-
-      // Assign random color to cluster A
-      uint8_t r = (rand() % 256);
-      uint8_t g = (rand() % 256);
-      uint8_t b = (rand() % 256);
-      int32_t rgb = (r << 16) | (g << 8) | b;
-      for (size_t i_point = 0; i_point < match_clusterA.points.size (); i_point++)
+      const std::vector<int>& indicesA = clustersA[matching_indeces.at(i)].indices;
+      for (size_t i_point = 0; i_point < indicesA.size(); i_point++)
       {
-        match_clusterA.points[i_point].rgb = rgb;
+        const pcl::PointXYZRGBNormal& point = cloudA_sampled->points[indicesA[i_point]];
+        Eigen::Vector3d normal = point.getNormalVector3fMap().cast<double>();
+        scatter += normal * normal.transpose();
+        points_sum += point.getVector3fMap().cast<double>();
       }
-      // Assign same color to matched cluster B
-      for (size_t i_point = 0; i_point < match_clusterB.points.size (); i_point++)
+      nb_normals += indicesA.size();
+
+      // Visualization: matched clusters with same random color
+      if (cloudA_planes && cloudB_planes)
       {
-        match_clusterB.points[i_point].rgb = rgb;
-      }
-      *cloudA_planes = *cloudA_planes + match_clusterA;
-      *cloudB_planes = *cloudB_planes + match_clusterB;
-      // Store in data structures (mirrored normals as well to be able to identify constraints
-      // on unit sphere using PCA)
-      pcl::PointCloud<pcl::PointXYZRGB>::Ptr clusterA_normals (new pcl::PointCloud<pcl::PointXYZRGB>);
-      pcl::PointCloud<pcl::PointXYZRGB>::Ptr clusterA_normals_mirrored (new pcl::PointCloud<pcl::PointXYZRGB>);
-      clusterA_normals->width = match_clusterA.size();
-      clusterA_normals_mirrored->width = match_clusterA.size();
-      clusterA_normals->height = 1;
-      clusterA_normals_mirrored->height = 1;
-      clusterA_normals->is_dense = false;
-      clusterA_normals_mirrored->is_dense = false;
-      clusterA_normals->points.resize(clusterA_normals->width * clusterA_normals->height);
-      clusterA_normals_mirrored->points.resize(clusterA_normals_mirrored->width * clusterA_normals_mirrored->height);
-      for (int i_point = 0; i_point < clusterA_normals->size(); i_point++) {
-        clusterA_normals->points[i_point].x = match_clusterA.points[i_point].normal_x;
-        clusterA_normals->points[i_point].y = match_clusterA.points[i_point].normal_y;
-        clusterA_normals->points[i_point].z = match_clusterA.points[i_point].normal_z;
-        clusterA_normals->points[i_point].rgb = match_clusterA.points[i_point].rgb;
-        clusterA_normals_mirrored->points[i_point].x = - match_clusterA.points[i_point].normal_x;
-        clusterA_normals_mirrored->points[i_point].y = - match_clusterA.points[i_point].normal_y;
-        clusterA_normals_mirrored->points[i_point].z = - match_clusterA.points[i_point].normal_z;
-        clusterA_normals_mirrored->points[i_point].rgb = match_clusterA.points[i_point].rgb;
+        pcl::PointCloud<pcl::PointXYZRGBNormal> match_clusterA (*cloudA_sampled, indicesA);
+        pcl::PointCloud<pcl::PointXYZRGBNormal> match_clusterB (*cloudB_sampled, clustersB[i].indices);
+
+        uint8_t r = (rand() % 256);
+        uint8_t g = (rand() % 256);
+        uint8_t b = (rand() % 256);
+        int32_t rgb = (r << 16) | (g << 8) | b;
+        for (size_t i_point = 0; i_point < match_clusterA.points.size (); i_point++)
+          match_clusterA.points[i_point].rgb = rgb;
+        for (size_t i_point = 0; i_point < match_clusterB.points.size (); i_point++)
+          match_clusterB.points[i_point].rgb = rgb;
+        *cloudA_planes += match_clusterA;
+        *cloudB_planes += match_clusterB;
       }
-
-      *cloudA_normals = *cloudA_normals + *clusterA_normals;
-      *cloudA_normals = *cloudA_normals + *clusterA_normals_mirrored;
     }
   }
 
-  if(cloudA_normals->empty())
+  if(nb_normals == 0)
   {
     std::cout << "[Filtering Utils] Error: No matching normals left." << std::endl;
     return 0;
   }
 
-  // Debug
-  // std::cout << "matching_indeces:" << '\n';
-  // for (unsigned i=0; i<matching_indeces.size(); i++)
-  //   std::cout << '\t' << matching_indeces[i];
-  // std::cout << '\n';
-  // std::cout << "matching_overlap:" << '\n';
-  // for (unsigned i=0; i<matching_overlap.size(); i++)
-  //   std::cout << '\t' << matching_overlap[i];
-  // std::cout << '\n';
-  // std::cout << "matching_distance:" << '\n';
-  // for (unsigned i=0; i<matching_distance.size(); i++)
-  //   std::cout << '\t' << matching_distance[i];
-  // std::cout << '\n';
-  // std::cout << "size: " << matching_distance.size() << endl;
-
   // 3. Constraints Analysis on Unit Sphere:
   // compute continuous value describing "alignability".
   // Principal Component Analysis ===============================
-  pcl::PCA<pcl::PointXYZRGB> cpca = new pcl::PCA<pcl::PointXYZRGB>;
-  cpca.setInputCloud(cloudA_normals);
-  Eigen::Vector3f pca_values;
-  Eigen::Matrix3f pca_vector;
-  pca_values = cpca.getEigenValues();
+  Eigen::SelfAdjointEigenSolver<Eigen::Matrix3d> eigen_solver(scatter);
+  Eigen::Vector3f pca_values = eigen_solver.eigenvalues().reverse().cast<float>(); // decreasing order
+  Eigen::Matrix3f pca_vector = eigen_solver.eigenvectors().rowwise().reverse().cast<float>(); // Normalized eigenvectors
   // Normalize eigenvalues
   float lambda0, lambda1, lambda2; // lambda0 > lambda1 > lambda2
   lambda0 = pca_values[0]/(pca_values[0]+pca_values[1]+pca_values[2]);
   lambda1 = pca_values[1]/(pca_values[0]+pca_values[1]+pca_values[2]);
   lambda2 = pca_values[2]/(pca_values[0]+pca_values[1]+pca_values[2]);
-  pca_vector = cpca.getEigenVectors(); // Normalized eigenvectors
 // cout << "[Filtering Utils] Normalized Alignability Eigenvalues [max,...,min]: " << "\n" << pca_values << endl;
 
   // Features computed from eigenvalues
@@ -388,39 +928,32 @@ float alignabilityFilter(pcl::PointCloud<pcl::PointXYZ>& cloudA, pcl::PointCloud
 //                     -(lambda1*log(lambda1))
 //                     -(lambda2*log(lambda2));
 
-//  cout << "----------[Filtering Utils] PCA ANALYSIS OF EGI----------------" << endl;
-//  cout << "Linearity: " << "\t" << linearity << endl;
-//  cout << "Planarity: " << "\t" << planarity << endl;
-//  cout << "Scattering: " << "\t" << scattering << endl;
-//  cout << "Omnivariance: " << "\t" << omnivariance << endl;
-//  cout << "Anisotropy: " << "\t" << anisotropy << endl;
-//  cout << "Eigentropy: " << "\t" << eigentropy << endl;
-//  cout << "---------------------------------------------------------------" << endl;
-
   alignability = scattering*100.0;
 
   // Visualization: return eigenvalues frame
-  eigenvectors->width = 3;
-  eigenvectors->height = 1;
-  eigenvectors->points.resize(eigenvectors->width * eigenvectors->height);
-  Eigen::Vector4f cloud_centroid;
-  compute3DCentroid(*cloudA_planes, cloud_centroid);
-  for (int i = 0; i < eigenvectors->size(); i++) {
-    eigenvectors->points[i].x = cloud_centroid[0];
-    eigenvectors->points[i].y = cloud_centroid[1];
-    eigenvectors->points[i].z = cloud_centroid[2];
-    eigenvectors->points[i].r = 0.0;
-    eigenvectors->points[i].g = 0.0;
-    eigenvectors->points[i].b = 0.0;
-    eigenvectors->points[i].normal_x = pca_vector(0,i);
-    eigenvectors->points[i].normal_y = pca_vector(1,i);
-    eigenvectors->points[i].normal_z = pca_vector(2,i);
-    if(i==0)
-      eigenvectors->points[i].r = 255.0;
-    else if(i==1)
-      eigenvectors->points[i].g = 255.0;
-    else
-      eigenvectors->points[i].b = 255.0;
+  if (eigenvectors)
+  {
+    eigenvectors->width = 3;
+    eigenvectors->height = 1;
+    eigenvectors->points.resize(eigenvectors->width * eigenvectors->height);
+    Eigen::Vector3d cloud_centroid = points_sum / nb_normals;
+    for (int i = 0; i < eigenvectors->size(); i++) {
+      eigenvectors->points[i].x = cloud_centroid[0];
+      eigenvectors->points[i].y = cloud_centroid[1];
+      eigenvectors->points[i].z = cloud_centroid[2];
+      eigenvectors->points[i].r = 0.0;
+      eigenvectors->points[i].g = 0.0;
+      eigenvectors->points[i].b = 0.0;
+      eigenvectors->points[i].normal_x = pca_vector(0,i);
+      eigenvectors->points[i].normal_y = pca_vector(1,i);
+      eigenvectors->points[i].normal_z = pca_vector(2,i);
+      if(i==0)
+        eigenvectors->points[i].r = 255.0;
+      else if(i==1)
+        eigenvectors->points[i].g = 255.0;
+      else
+        eigenvectors->points[i].b = 255.0;
+    }
   }
 
 //  pcl::PCDWriter writer;
@@ -443,6 +976,91 @@ void computeNormalsCentroid(pcl::PointCloud<pcl::PointXYZRGBNormal>& cloud, Eige
   centroid[2] = sum_z/cloud.size();
 }
 
+// Normals centroid and enlarged oriented bounding box of cluster
+// (same box as overlapBoxFilter(planeA, planeB))
+void computeClusterDescriptor(pcl::PointCloud<pcl::PointXYZRGBNormal>::Ptr cloud, const pcl::PointIndices& cluster,
+                              ClusterDescriptor& descriptor)
+{
+  descriptor.nb_points = cluster.indices.size();
+
+  Eigen::Vector3f sum = Eigen::Vector3f::Zero();
+  descriptor.points_min.setConstant(std::numeric_limits<float>::max());
+  descriptor.points_max.setConstant(-std::numeric_limits<float>::max());
+  for (size_t k = 0; k < cluster.indices.size(); k++)
+  {
+    const pcl::PointXYZRGBNormal& point = cloud->points[cluster.indices[k]];
+    sum += point.getNormalVector3fMap();
+    descriptor.points_min = descriptor.points_min.cwiseMin(point.getVector3fMap());
+    descriptor.points_max = descriptor.points_max.cwiseMax(point.getVector3fMap());
+  }
+  descriptor.normal = sum / (float)cluster.indices.size();
+
+  pcl::MomentOfInertiaEstimation<pcl::PointXYZRGBNormal> feature_extractor;
+  feature_extractor.setInputCloud(cloud);
+  feature_extractor.setIndices(boost::make_shared<std::vector<int> >(cluster.indices));
+  feature_extractor.compute();
+  pcl::PointXYZRGBNormal min_point_OBB, max_point_OBB, position_OBB;
+  Eigen::Matrix3f rotational_matrix_OBB;
+  feature_extractor.getOBB(min_point_OBB, max_point_OBB, position_OBB, rotational_matrix_OBB);
+
+  // Enlarge boundaries along direction perpendicular to plane
+  descriptor.box_min << min_point_OBB.x, min_point_OBB.y, 3.0 * min_point_OBB.z;
+  descriptor.box_max << max_point_OBB.x, max_point_OBB.y, 3.0 * max_point_OBB.z;
+  descriptor.box_position << position_OBB.x, position_OBB.y, position_OBB.z;
+
+  // Box orientation as applied by pcl::CropBox in getPointsInOrientedBox
+  Eigen::Vector3f rotational_vector = rotational_matrix_OBB.eulerAngles(0, 1, 2);
+  Eigen::Affine3f box_transform;
+  pcl::getTransformation(0.0f, 0.0f, 0.0f, rotational_vector[0], rotational_vector[1], rotational_vector[2],
+                         box_transform);
+  descriptor.box_rotation = box_transform.linear();
+
+  Eigen::Vector3f center = descriptor.box_rotation * (0.5 * (descriptor.box_min + descriptor.box_max)) + descriptor.box_position;
+  Eigen::Vector3f extent = descriptor.box_rotation.cwiseAbs() * (0.5 * (descriptor.box_max - descriptor.box_min));
+  descriptor.aabb_min = center - extent;
+  descriptor.aabb_max = center + extent;
+}
+
+// Counts points of cluster contained in descriptor's box
+int getPointsInClusterBox(const pcl::PointCloud<pcl::PointXYZRGBNormal>& cloud, const pcl::PointIndices& cluster,
+                          const ClusterDescriptor& descriptor)
+{
+  Eigen::Matrix3f rotation_inverse = descriptor.box_rotation.transpose();
+  int nb_points_in_box = 0;
+  for (size_t k = 0; k < cluster.indices.size(); k++)
+  {
+    Eigen::Vector3f point_box = rotation_inverse *
+                                (cloud.points[cluster.indices[k]].getVector3fMap() - descriptor.box_position);
+    if ((point_box.array() >= descriptor.box_min.array()).all() &&
+        (point_box.array() <= descriptor.box_max.array()).all())
+      nb_points_in_box ++;
+  }
+  return nb_points_in_box;
+}
+
+// Same as overlapBoxFilter(planeA, planeB) on precomputed cluster descriptors
+float overlapBoxFilter(const pcl::PointCloud<pcl::PointXYZRGBNormal>& cloudA, const pcl::PointIndices& clusterA,
+                       const ClusterDescriptor& descriptorA,
+                       const pcl::PointCloud<pcl::PointXYZRGBNormal>& cloudB, const pcl::PointIndices& clusterB,
+                       const ClusterDescriptor& descriptorB)
+{
+  // Count points from B which belong to box A
+  int nb_pointsB_in_boxA = getPointsInClusterBox(cloudB, clusterB, descriptorA);
+  if (nb_pointsB_in_boxA == 0)
+    return 0.0;
+  // Count points from A which belong to box B
+  int nb_pointsA_in_boxB = getPointsInClusterBox(cloudA, clusterA, descriptorB);
+
+  //Compute overlap parameter dependent on percentage of accepted points per cloud
+  float perc_accepted_A, perc_accepted_B;
+  perc_accepted_A = (float)nb_pointsA_in_boxB / (float)(descriptorA.nb_points);
+  perc_accepted_B = (float)nb_pointsB_in_boxA / (float)(descriptorB.nb_points);
+
+  float overlap = perc_accepted_A * perc_accepted_B;
+
+  return overlap*100.0;
+}
+
 // Builds oriented bounding box around cloud
 void getOrientedBoundingBox(pcl::PointCloud<pcl::PointXYZRGBNormal>::Ptr cloud,
                             pcl::PointXYZRGBNormal& min_point_OBB, pcl::PointXYZRGBNormal& max_point_OBB,
@@ -577,61 +1195,193 @@ float overlapBoxFilter(pcl::PointCloud<pcl::PointXYZRGBNormal>& planeA, pcl::Poi
 
 // from "Geometrically Stable Sampling for the ICP Algorithm", J. Gelfand et al., 2003
 // from "On Degeneracy of Optimization-based State Estimation Problems", J. Zhang, 2016
-void registrationFailurePredictionFilter(Eigen::MatrixXf system_covariance, std::vector<float>& predictions)
-{
-  Eigen::EigenSolver<Eigen::MatrixXf> es(system_covariance);
-  float sum_lambda = es.eigenvalues()(0,0).real()+es.eigenvalues()(1,0).real()+es.eigenvalues()(2,0).real()+
-                     es.eigenvalues()(3,0).real()+es.eigenvalues()(4,0).real()+es.eigenvalues()(5,0).real();
-  Eigen::VectorXf system_lambdas(6);
-  system_lambdas << (es.eigenvalues()(0,0).real()/sum_lambda), //roll
-                    (es.eigenvalues()(1,0).real()/sum_lambda), //pitch
-                    (es.eigenvalues()(2,0).real()/sum_lambda), //yaw
-                    (es.eigenvalues()(3,0).real()/sum_lambda), //x
-                    (es.eigenvalues()(4,0).real()/sum_lambda), //y
-                    (es.eigenvalues()(5,0).real()/sum_lambda); //z
-  // cout << "[Filtering Utils] Prediction Eigenvectors:" << endl << es.eigenvectors().real().transpose() << endl;
-  // cout << "[Filtering Utils] Prediction Eigenvalues:" << endl << es.eigenvalues() << endl;
-  // cout << "[Filtering Utils] Normalized Prediction Eigenvalues [R,P,Y,X,Y,Z]:" << endl << system_lambdas << endl;
-
-  int pos_min, pos_max;
+void registrationFailurePredictionFilter(const Eigen::MatrixXf& system_covariance, std::vector<float>& predictions)
+{
+  // Translation block [x, y, z] of the symmetric 6x6 system [roll, pitch, yaw, x, y, z]
+  // (eigenvalues in increasing order), normalized by the trace of the whole system
+  Eigen::SelfAdjointEigenSolver<Eigen::Matrix3f> es(system_covariance.bottomRightCorner<3,3>(),
+                                                    Eigen::EigenvaluesOnly);
+  float sum_lambda = system_covariance.trace();
+  Eigen::Vector3f system_lambdas = es.eigenvalues() / sum_lambda;
+
   if (!predictions.empty())
     predictions.clear();
 
   // Degeneracy
   // used in "On Degeneracy of Optimization-based State Estimation Problems", J. Zhang, 2016
-  system_lambdas.tail<3>().minCoeff(&pos_min); // minimum eigenvalue between x, y, z only
-  predictions.push_back(system_lambdas.tail<3>()[pos_min]*100.0);
+  predictions.push_back(system_lambdas(0)*100.0);
 //  cout << "[Filtering Utils] Degeneracy (degenerate if ~ 0): " << prediction << " %" << endl;
 
-  // Condition Number
-  // used in "Geometrically Stable Sampling for the ICP Algorithm", J. Gelfand et al., 2003
-  system_lambdas.tail<3>().maxCoeff(&pos_max); // maximum eigenvalue between x, y, z only
-//  predictions.push_back(system_lambdas.tail<3>()[pos_max]/system_lambdas.tail<3>()[pos_min]);
-//  cout << "[Filtering Utils] Condition Number (degenerate if big, want 1): " << prediction << endl;
-
   // Inverse Condition Number
   // compared against in
   // "On Degeneracy of Optimization-based State Estimation Problems", J. Zhang, 2016
-  predictions.push_back(system_lambdas.tail<3>()[pos_min]/system_lambdas.tail<3>()[pos_max]);
+  predictions.push_back(system_lambdas(0)/system_lambdas(2));
 //  cout << "[Filtering Utils] Inverse Condition Number (degenerate if ~ 0, want 1): " << prediction << endl;
 }
 
+void geometricallyStableSampling(const SegmentedCloud& segmented, size_t nb_samples,
+                                 std::vector<int>& indices_out)
+{
+  const pcl::PointCloud<pcl::PointXYZRGBNormal>& cloud = *segmented.cloud;
+  const bool labeled = segmented.labels.size() == cloud.size();
+  indices_out.clear();
+
+  // Plane normals: mean normal of each cluster (sign of the first point), less noisy than the point normals
+  std::vector<Eigen::Vector3f> plane_normals(segmented.clusters.size(), Eigen::Vector3f::Zero());
+  for (size_t c = 0; c < segmented.clusters.size(); c++)
+  {
+    const std::vector<int>& indices = segmented.clusters[c].indices;
+    for (size_t i = 0; i < indices.size(); i++)
+    {
+      Eigen::Vector3f normal = cloud.points[indices[i]].getNormalVector3fMap();
+      if (!normal.allFinite())
+        continue;
+      plane_normals[c] += (normal.dot(plane_normals[c]) < 0.0f) ? -normal : normal;
+    }
+    if (plane_normals[c].norm() > 0.0f)
+      plane_normals[c].normalize();
+  }
+
+  // Points with a position and a normal
+  std::vector<int> valid;
+  std::vector<Eigen::Vector3f> normals;
+  valid.reserve(cloud.size());
+  normals.reserve(cloud.size());
+  Eigen::Vector3d centroid = Eigen::Vector3d::Zero();
+  for (size_t i = 0; i < cloud.size(); i++)
+  {
+    const pcl::PointXYZRGBNormal& point = cloud.points[i];
+    int label = labeled ? segmented.labels[i] : -1;
+    Eigen::Vector3f normal = (label >= 0 && label < (int)plane_normals.size() && plane_normals[label].norm() > 0.0f) ?
+                             plane_normals[label] : Eigen::Vector3f(point.getNormalVector3fMap());
+    if (!point.getVector3fMap().allFinite() || !normal.allFinite() || normal.norm() < 0.5f)
+      continue;
+    valid.push_back(i);
+    normals.push_back(normal);
+    centroid += point.getVector3fMap().cast<double>();
+  }
+  if (valid.size() <= nb_samples)
+  {
+    indices_out = valid;
+    return;
+  }
+  centroid /= valid.size();
+
+  // Constraints [(p - centroid) / scale x n, n] (rotations and translations of comparable scale:
+  // mean distance to the centroid)
+  double scale = 0.0;
+  for (size_t i = 0; i < valid.size(); i++)
+    scale += (cloud.points[valid[i]].getVector3fMap().cast<double>() - centroid).norm();
+  scale = std::max(scale / valid.size(), 1e-6);
+  Eigen::Matrix<float, Eigen::Dynamic, 6> constraints (valid.size(), 6);
+  for (size_t i = 0; i < valid.size(); i++)
+  {
+    Eigen::Vector3f position = ((cloud.points[valid[i]].getVector3fMap().cast<double>() - centroid) / scale).cast<float>();
+    constraints.block<1,3>(i, 0) = position.cross(normals[i]).transpose();
+    constraints.block<1,3>(i, 3) = normals[i].transpose();
+  }
+
+  // Eigenvectors of the covariance of the constraints, constraint of each point along them
+  Eigen::Matrix<double, 6, 6> covariance = (constraints.transpose() * constraints).cast<double>();
+  Eigen::SelfAdjointEigenSolver<Eigen::Matrix<double, 6, 6> > es(covariance);
+  Eigen::Matrix<float, Eigen::Dynamic, 6> projections = constraints * es.eigenvectors().cast<float>();
+
+  // Candidates of each direction by decreasing constraint (at most nb_samples of a list are visited)
+  std::vector<std::vector<int> > candidates (6);
+  for (int k = 0; k < 6; k++)
+  {
+    std::vector<int>& list = candidates[k];
+    list.resize(valid.size());
+    for (size_t i = 0; i < valid.size(); i++)
+      list[i] = i;
+    std::partial_sort(list.begin(), list.begin() + nb_samples, list.end(), [&](int a, int b)
+    {
+      return std::fabs(projections(a, k)) > std::fabs(projections(b, k));
+    });
+    list.resize(nb_samples);
+  }
+
+  // Greedy: next point from the least constrained direction so far
+  std::vector<double> constrained (6, 0.0);
+  std::vector<size_t> next (6, 0);
+  std::vector<bool> selected (valid.size(), false);
+  indices_out.reserve(nb_samples);
+  while (indices_out.size() < nb_samples)
+  {
+    int k = -1;
+    for (int j = 0; j < 6; j++)
+    {
+      while (next[j] < candidates[j].size() && selected[candidates[j][next[j]]])
+        next[j]++;
+      if (next[j] < candidates[j].size() && (k < 0 || constrained[j] < constrained[k]))
+        k = j;
+    }
+    if (k < 0)
+      break;
+    int i = candidates[k][next[k]++];
+    selected[i] = true;
+    indices_out.push_back(valid[i]);
+    for (int j = 0; j < 6; j++)
+      constrained[j] += projections(i, j) * projections(i, j);
+  }
+  std::sort(indices_out.begin(), indices_out.end());
+}
+
 // Returns filtered cloud: crop cloud using box (centered at origin)
 // This filter reduces size of the input cloud
 void getPointsInOrientedBox(pcl::PointCloud<pcl::PointXYZ>::Ptr& cloud,
                             float min, float max,
                             Eigen::Matrix4f& origin)
 {
-    pcl::CropBox<pcl::PointXYZ> box_filter;
+  // Same box as pcl::CropBox (rotation used as is, no euler angles round trip)
+  Eigen::Isometry3f box_pose = Eigen::Isometry3f::Identity();
+  box_pose.linear() = origin.block<3,3>(0,0);
+  box_pose.translation() = origin.block<3,1>(0,3);
+  cropOrientedBox(*cloud, min, max, box_pose);
+}
 
-    Eigen::Vector3f position, orientation;
-    position << origin(0,3), origin(1,3), origin(2,3);
-    orientation = origin.block<3,3>(0,0).eulerAngles(0, 1, 2); // (rx,ry,rz) in radians
+// Points as 4-float packets (pcl::PointXYZ is 16-byte aligned, padding = 1):
+// projections written as column combinations of 4x4 matrices, vectorized by Eigen
+template <bool transform_output>
+static size_t cropOrientedBoxPass(pcl::PointCloud<pcl::PointXYZ>& cloud, float min, float max,
+                                  const Eigen::Isometry3f& box_pose, const Eigen::Isometry3f& output_transform)
+{
+  const Eigen::Matrix4f to_box = box_pose.inverse().matrix();
+  const Eigen::Matrix4f to_output = output_transform.matrix();
+  // Homogeneous coordinate is exactly 1 (NaN and infinite points fail the test)
+  const Eigen::Array4f lower (min, min, min, 1.0f);
+  const Eigen::Array4f upper (max, max, max, 1.0f);
+
+  size_t nb_kept = 0;
+  for (size_t i = 0; i < cloud.size(); i++)
+  {
+    const pcl::PointXYZ point = cloud.points[i];
+    const Eigen::Vector4f point_box = to_box.col(0) * point.x + to_box.col(1) * point.y +
+                                      to_box.col(2) * point.z + to_box.col(3);
+    if (!(point_box.array() >= lower).all() || !(point_box.array() <= upper).all())
+      continue;
+    if (transform_output)
+      cloud.points[nb_kept].getVector4fMap() = to_output.col(0) * point.x + to_output.col(1) * point.y +
+                                               to_output.col(2) * point.z + to_output.col(3);
+    else
+      cloud.points[nb_kept] = point;
+    nb_kept ++;
+  }
+  cloud.points.resize(nb_kept);
+  cloud.width = nb_kept;
+  cloud.height = 1;
+  cloud.is_dense = true;
+  return nb_kept;
+}
 
-    box_filter.setMin(Eigen::Vector4f(min, min, min, 1.0)); // minX, minY, minZ
-    box_filter.setMax(Eigen::Vector4f(max, max, max, 1.0));
-    box_filter.setRotation(orientation);
-    box_filter.setTranslation(position);
-    box_filter.setInputCloud(cloud);
-    box_filter.filter(*cloud);
+size_t cropOrientedBox(pcl::PointCloud<pcl::PointXYZ>& cloud, float min, float max,
+                       const Eigen::Isometry3f& box_pose)
+{
+  return cropOrientedBoxPass<false>(cloud, min, max, box_pose, Eigen::Isometry3f::Identity());
+}
+
+size_t cropOrientedBox(pcl::PointCloud<pcl::PointXYZ>& cloud, float min, float max,
+                       const Eigen::Isometry3f& box_pose, const Eigen::Isometry3f& output_transform)
+{
+  return cropOrientedBoxPass<true>(cloud, min, max, box_pose, output_transform);
 }
@@ -80,21 +80,16 @@ float hausdorffDistance(DP &ref, DP &out, const char *filename)
   return std::sqrt(haussdorffDist);
 }
 
-PM::Matrix distancesKNN(DP &A, DP &B)
-{
-  const char *filename = "readDistances.vtk";
-  return distancesKNN(A, B, filename);
-}
-
-PM::Matrix distancesKNN(DP &A, DP &B, const char *filename)
+PM::Matrix distancesKNN(DP &A, DP &B, DebugWriter *writer, const char *filename)
 {
   using namespace PointMatcherSupport;
-  // Compute distance nearest neighbors between 2 whole clouds. Save to file (.vtp and .vtk extensions) entire point clouds.
+  // Compute distance nearest neighbors between 2 whole clouds. Save to file (.vtk extension, through writer) entire point clouds.
   // A custom field (distance between matches) is associated to each cloud.
   //
   // INPUTS:
   // A: point cloud used as reference
   // B: stored cloud with distance of each of its points from NN in cloud A
+  // writer: background writer of the file (NULL: not saved)
 
   PM::Matches matches;
 
@@ -119,7 +114,12 @@ PM::Matrix distancesKNN(DP &A, DP &B, const char *filename)
     }
   }
   //savePointCloudVTP("readDistances.vtp", B, values);
-  savePointCloudVTK(filename, B, values);
+  if (writer != NULL)
+  {
+    // Cloud and distances copied (written after returning)
+    std::string file_name (filename);
+    writer->post([file_name, B, values]() { savePointCloudVTK(file_name.c_str(), B, values); });
+  }
 
   int nbValidMatches = 0;
   float dist = 0;
@@ -0,0 +1,171 @@
+#include "aicp_utils/logging.hpp"
+#include "aicp_utils/workQueue.hpp"
+
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+std::atomic<int> Logger::level_((int)LogLevel::INFO);
+
+// Debug and info to stdout, warnings and errors to stderr
+static void writeRecord(const Logger::Record& record)
+{
+  std::ostream& out = record.level >= LogLevel::WARN ? std::cerr : std::cout;
+  out << "[" << record.module << "] ";
+  if (record.level == LogLevel::WARN)
+    out << "Warning: ";
+  else if (record.level == LogLevel::ERROR)
+    out << "Error: ";
+  out << record.message << '\n';
+}
+
+// Background writer: producers only touch the ring buffer, the sink thread polls it
+// (streams flushed when idle). When the buffer is full, debug and info records are
+// dropped, warnings and errors written by the producer (after the current batch).
+// Never deleted (producers may still hold it while the process exits).
+class LogSink
+{
+  public:
+    explicit LogSink(size_t queue_size) :
+      ring_(queue_size), running_(false), dropped_(0) {}
+
+    void start()
+    {
+      if (running_)
+        return;
+      running_ = true;
+      thread_ = std::thread(&LogSink::run, this);
+    }
+
+    // Writes the queued records
+    void stop()
+    {
+      if (!thread_.joinable())
+        return;
+      running_ = false;
+      thread_.join();
+      // Pushed while the thread was exiting
+      Logger::Record record;
+      while (ring_.tryPop(record))
+        writeRecord(record);
+      std::cout.flush();
+      std::cerr.flush();
+      if (dropped_ > 0)
+        std::cerr << "[Logger] Dropped " << dropped_ << " records (queue full)." << std::endl;
+    }
+
+    void push(const Logger::Record& record)
+    {
+      if (ring_.tryPush(record))
+        return;
+      if (record.level >= LogLevel::WARN)
+      {
+        std::unique_lock<std::mutex> lock(write_mutex_);
+        writeRecord(record);
+        std::cerr.flush();
+        return;
+      }
+      dropped_ ++;
+    }
+
+    size_t getNbDropped() const { return dropped_; }
+
+  private:
+    void run()
+    {
+      Logger::Record record;
+      for (;;)
+      {
+        bool written = false;
+        {
+          std::unique_lock<std::mutex> lock(write_mutex_);
+          while (ring_.tryPop(record))
+          {
+            writeRecord(record);
+            written = true;
+          }
+          if (written)
+          {
+            std::cout.flush();
+            std::cerr.flush();
+          }
+        }
+        if (!running_ && ring_.size() == 0)
+          break;
+        std::this_thread::sleep_for(std::chrono::milliseconds(5));
+      }
+    }
+
+    RingBuffer<Logger::Record> ring_;
+    std::atomic<bool> running_;
+    std::atomic<size_t> dropped_;
+    std::mutex write_mutex_; // lines of the sink and of producers not interleaved
+    std::thread thread_;
+};
+
+// Sink leaked on purpose: stopped (queue written) by stopAsync or at exit, while
+// threads not joined yet may still log
+static std::mutex log_sink_mutex;
+static LogSink* log_sink = NULL;
+static std::atomic<LogSink*> log_sink_ptr(NULL); // NULL: synchronous writes
+
+bool Logger::parseLevel(const std::string& name, LogLevel& level)
+{
+  if (name == "debug")
+    level = LogLevel::DEBUG;
+  else if (name == "info")
+    level = LogLevel::INFO;
+  else if (name == "warn")
+    level = LogLevel::WARN;
+  else if (name == "error")
+    level = LogLevel::ERROR;
+  else
+    return false;
+  return true;
+}
+
+void Logger::startAsync(size_t queue_size)
+{
+  std::unique_lock<std::mutex> lock(log_sink_mutex);
+  // Queue size of the first start kept
+  if (log_sink == NULL)
+  {
+    log_sink = new LogSink(queue_size);
+    std::atexit(&Logger::stopAsync);
+  }
+  log_sink->start();
+  log_sink_ptr = log_sink;
+}
+
+void Logger::stopAsync()
+{
+  std::unique_lock<std::mutex> lock(log_sink_mutex);
+  log_sink_ptr = NULL;
+  if (log_sink)
+    log_sink->stop();
+}
+
+size_t Logger::getNbDropped()
+{
+  std::unique_lock<std::mutex> lock(log_sink_mutex);
+  return log_sink != NULL ? log_sink->getNbDropped() : 0;
+}
+
+void Logger::write(LogLevel level, const char* module, const std::string& message)
+{
+  Record record;
+  record.level = level;
+  record.module = module;
+  record.utime = std::chrono::duration_cast<std::chrono::microseconds>(
+                   std::chrono::system_clock::now().time_since_epoch()).count();
+  record.message = message;
+
+  LogSink* sink = log_sink_ptr.load();
+  if (sink != NULL)
+    sink->push(record);
+  else
+    writeRecord(record);
+}
@@ -0,0 +1,118 @@
+#include "aicp_utils/mapCache.hpp"
+#include "aicp_utils/tiledMapFile.hpp"
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Bump when the pre-filter changes (invalidates all entries)
+static const uint32_t map_cache_version = 1;
+
+static const uint64_t fnv_offset_basis = 14695981039346656037ULL;
+static const uint64_t fnv_prime = 1099511628211ULL;
+
+static uint64_t hashBytes(const char* data, size_t size, uint64_t hash)
+{
+  size_t nb_words = size / sizeof(uint64_t);
+  for (size_t i = 0; i < nb_words; i++)
+  {
+    uint64_t word;
+    std::memcpy(&word, data + i * sizeof(uint64_t), sizeof(uint64_t));
+    hash = (hash ^ word) * fnv_prime;
+    hash ^= hash >> 32; // high bits back into the low bits (multiplication only carries upwards)
+  }
+  for (size_t i = nb_words * sizeof(uint64_t); i < size; i++)
+    hash = (hash ^ (uint8_t)data[i]) * fnv_prime;
+  return hash;
+}
+
+bool hashFile(const std::string& file_name, uint64_t& hash)
+{
+  int fd = ::open(file_name.c_str(), O_RDONLY);
+  if (fd < 0)
+  {
+    std::cerr << "[MapCache] Error: cannot open file " << file_name << std::endl;
+    return false;
+  }
+  struct stat file_stat;
+  if (fstat(fd, &file_stat) != 0)
+  {
+    ::close(fd);
+    return false;
+  }
+  size_t size = file_stat.st_size;
+  hash = hashBytes(reinterpret_cast<const char*>(&size), sizeof(size), fnv_offset_basis);
+  if (size == 0)
+  {
+    ::close(fd);
+    return true;
+  }
+
+  void* data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  ::close(fd);
+  if (data == MAP_FAILED)
+  {
+    std::cerr << "[MapCache] Error: cannot map file " << file_name << std::endl;
+    return false;
+  }
+  madvise(data, size, MADV_SEQUENTIAL);
+  hash = hashBytes(static_cast<const char*>(data), size, hash);
+  munmap(data, size);
+  return true;
+}
+
+std::string getMapCacheFile(const std::string& directory, const std::string& file_name,
+                            const std::vector<float>& parameters)
+{
+  uint64_t hash;
+  if (!hashFile(file_name, hash))
+    return "";
+  hash = hashBytes(reinterpret_cast<const char*>(&map_cache_version), sizeof(map_cache_version), hash);
+  if (!parameters.empty())
+    hash = hashBytes(reinterpret_cast<const char*>(parameters.data()), parameters.size() * sizeof(float), hash);
+
+  // Final avalanche (MurmurHash3 fmix64)
+  hash ^= hash >> 33;
+  hash *= 0xff51afd7ed558ccdULL;
+  hash ^= hash >> 33;
+
+  std::stringstream cache_file;
+  cache_file << directory << "/" << std::hex << std::setw(16) << std::setfill('0') << hash << ".aicpmap";
+  return cache_file.str();
+}
+
+bool writeMapCacheFile(const std::string& cache_file, const pcl::PointCloud<pcl::PointXYZ>& cloud,
+                       float tile_size, float leaf_size)
+{
+  // Parent directories first
+  size_t separator = cache_file.find('/', 1);
+  while (separator != std::string::npos)
+  {
+    std::string directory = cache_file.substr(0, separator);
+    if (mkdir(directory.c_str(), S_IRWXU | S_IRWXG | S_IROTH | S_IXOTH) != 0 && errno != EEXIST)
+    {
+      std::cerr << "[MapCache] Error: cannot create directory " << directory << std::endl;
+      return false;
+    }
+    separator = cache_file.find('/', separator + 1);
+  }
+
+  std::stringstream temporary_file;
+  temporary_file << cache_file << "." << getpid() << ".tmp";
+  if (!TiledMapFile::write(temporary_file.str(), cloud, tile_size, leaf_size) ||
+      std::rename(temporary_file.str().c_str(), cache_file.c_str()) != 0)
+  {
+    std::cerr << "[MapCache] Error: cannot write " << cache_file << std::endl;
+    std::remove(temporary_file.str().c_str());
+    return false;
+  }
+  return true;
+}
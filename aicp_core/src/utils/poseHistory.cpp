@@ -0,0 +1,89 @@
+#include "aicp_utils/poseHistory.hpp"
+
+#include <algorithm>
+
+PoseHistory::PoseHistory(size_t window_size, size_t max_poses) :
+  window_size_(std::max<size_t>(window_size, 1)),
+  max_older_(std::max<size_t>(max_poses > window_size_ ? max_poses - window_size_ : 0, 2)),
+  recent_begin_(0), nb_recent_(0), older_stride_(1), older_pending_(0)
+{
+  recent_.reserve(window_size_);
+}
+
+void PoseHistory::push_back(const Eigen::Isometry3d& pose)
+{
+  snapshot_.reset();
+  if (nb_recent_ < window_size_)
+  {
+    recent_.push_back(pose);
+    nb_recent_++;
+    return;
+  }
+
+  // Oldest recent pose leaves the window (replaced by pose)
+  const Eigen::Isometry3d& oldest = recent_[recent_begin_];
+  if (older_.empty() || ++older_pending_ >= older_stride_)
+  {
+    if (older_.size() >= max_older_)
+    {
+      // Every other pose kept (first one included), the pending ones follow the new stride
+      size_t nb_kept = 0;
+      for (size_t i = 0; i < older_.size(); i += 2)
+        older_[nb_kept++] = older_[i];
+      if (older_.size() % 2 == 0)
+        older_pending_ += older_stride_;
+      older_.resize(nb_kept);
+      older_stride_ *= 2;
+    }
+    if (older_.empty() || older_pending_ >= older_stride_)
+    {
+      older_.push_back(oldest);
+      older_pending_ = 0;
+    }
+  }
+  recent_[recent_begin_] = pose;
+  recent_begin_ = (recent_begin_ + 1) % window_size_;
+}
+
+void PoseHistory::clear()
+{
+  recent_.clear();
+  recent_begin_ = 0;
+  nb_recent_ = 0;
+  older_.clear();
+  older_stride_ = 1;
+  older_pending_ = 0;
+  snapshot_.reset();
+}
+
+const Eigen::Isometry3d& PoseHistory::back() const
+{
+  return recent_[(recent_begin_ + nb_recent_ - 1) % window_size_];
+}
+
+void PoseHistory::getRecent(Poses& poses) const
+{
+  poses.clear();
+  poses.reserve(nb_recent_);
+  for (size_t i = 0; i < nb_recent_; i++)
+    poses.push_back(recent_[(recent_begin_ + i) % window_size_]);
+}
+
+PoseHistory::Snapshot PoseHistory::getSnapshot()
+{
+  if (snapshot_)
+    return snapshot_;
+  std::shared_ptr<Poses> poses(new Poses);
+  poses->reserve(size());
+  poses->insert(poses->end(), older_.begin(), older_.end());
+  for (size_t i = 0; i < nb_recent_; i++)
+    poses->push_back(recent_[(recent_begin_ + i) % window_size_]);
+  snapshot_ = poses;
+  return snapshot_;
+}
+
+MemoryUsage PoseHistory::getMemoryUsage() const
+{
+  size_t capacity = recent_.capacity() + older_.capacity() + (snapshot_ ? snapshot_->capacity() : 0);
+  return MemoryUsage(capacity * sizeof(Eigen::Isometry3d), size());
+}
@@ -0,0 +1,147 @@
+#include "aicp_utils/scanAccumulator.hpp"
+#include "aicp_utils/filteringUtils.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+ScanAccumulator::ScanAccumulator(const ScanAccumulatorConfig& config) :
+  config_(config), cloud_(new PointCloud), nb_accumulated_(0),
+  voxel_grid_(config.voxel_size > 0.0f ? config.voxel_size : 1.0f),
+  table_rad0_(0.0f), table_radstep_(0.0f), counter_(0), finished_(false), utime_(0)
+{
+}
+
+void ScanAccumulator::setConfig(const ScanAccumulatorConfig& config)
+{
+  config_ = config;
+  voxel_grid_ = HashVoxelGrid(config_.voxel_size > 0.0f ? config_.voxel_size : 1.0f);
+  clear();
+}
+
+void ScanAccumulator::updateBeamTables(int nb_ranges, float rad0, float radstep)
+{
+  if (cos_table_.size() == nb_ranges && table_rad0_ == rad0 && table_radstep_ == radstep)
+    return;
+  cos_table_.resize(nb_ranges);
+  sin_table_.resize(nb_ranges);
+  weight_table_.resize(nb_ranges);
+  for (int i = 0; i < nb_ranges; i++)
+  {
+    double angle = (double)rad0 + i * (double)radstep;
+    cos_table_(i) = std::cos(angle);
+    sin_table_(i) = std::sin(angle);
+    weight_table_(i) = (nb_ranges > 1) ? (float)i / (nb_ranges - 1) : 0.0f;
+  }
+  table_rad0_ = rad0;
+  table_radstep_ = radstep;
+}
+
+void ScanAccumulator::addPlanarScan(const float* ranges, int nb_ranges, float rad0, float radstep,
+                                    const Eigen::Isometry3d& pose_start, const Eigen::Isometry3d& pose_end,
+                                    int64_t utime)
+{
+  if (finished_)
+    return;
+  nb_ranges = std::max(nb_ranges, 0);
+  updateBeamTables(nb_ranges, rad0, radstep);
+  Eigen::Map<const Eigen::ArrayXf> range (ranges, nb_ranges);
+
+  // Beam point p (sensor plane coordinates u, v) in global frame:
+  // a u + b v + c + w (da u + db v + dc), a, b, c: x, y axes and origin of the first beam pose,
+  // da, db, dc: their change to the last beam pose, w: beam interpolation weight
+  const Eigen::Matrix3f rotation_start = pose_start.rotation().cast<float>();
+  const Eigen::Matrix3f rotation_end = pose_end.rotation().cast<float>();
+  const Eigen::Vector3f a = rotation_start.col(0);
+  const Eigen::Vector3f b = rotation_start.col(1);
+  const Eigen::Vector3f c = pose_start.translation().cast<float>();
+  const Eigen::Vector3f da = rotation_end.col(0) - a;
+  const Eigen::Vector3f db = rotation_end.col(1) - b;
+  const Eigen::Vector3f dc = pose_end.translation().cast<float>() - c;
+
+  // Vectorized over the beams (Eigen arrays), buffers reused between scans
+  plane_x_ = range * cos_table_;
+  plane_y_ = range * sin_table_;
+  x_ = a.x() * plane_x_ + b.x() * plane_y_ + c.x() +
+       weight_table_ * (da.x() * plane_x_ + db.x() * plane_y_ + dc.x());
+  y_ = a.y() * plane_x_ + b.y() * plane_y_ + c.y() +
+       weight_table_ * (da.y() * plane_x_ + db.y() * plane_y_ + dc.y());
+  z_ = a.z() * plane_x_ + b.z() * plane_y_ + c.z() +
+       weight_table_ * (da.z() * plane_x_ + db.z() * plane_y_ + dc.z());
+
+  // Valid ranges appended in beam order (NaN ranges fail both tests)
+  const float min_range = config_.min_range;
+  const float max_range = config_.max_range;
+  pcl::PointXYZ* out = beginScan(nb_ranges);
+  size_t nb_kept = 0;
+  for (int i = 0; i < nb_ranges; i++)
+  {
+    if (range(i) >= min_range && range(i) <= max_range)
+    {
+      out[nb_kept].x = x_(i);
+      out[nb_kept].y = y_(i);
+      out[nb_kept].z = z_(i);
+      nb_kept++;
+    }
+  }
+  endScan(nb_kept, utime);
+}
+
+pcl::PointXYZ* ScanAccumulator::beginScan(size_t nb_points)
+{
+  if (config_.voxel_size > 0.0f)
+  {
+    scan_points_.points.resize(nb_points);
+    return scan_points_.points.data();
+  }
+  PointCloud& cloud = *cloud_;
+  if (counter_ == 0)
+    cloud.points.reserve(std::max(config_.batch_size, 1) * nb_points);
+  nb_accumulated_ = cloud.points.size();
+  cloud.points.resize(nb_accumulated_ + nb_points);
+  return cloud.points.data() + nb_accumulated_;
+}
+
+void ScanAccumulator::endScan(size_t nb_kept, int64_t utime)
+{
+  PointCloud& cloud = *cloud_;
+  if (config_.voxel_size > 0.0f)
+  {
+    for (size_t i = 0; i < nb_kept; i++)
+      voxel_grid_.addPoint(scan_points_.points[i].x, scan_points_.points[i].y, scan_points_.points[i].z);
+  }
+  else
+  {
+    cloud.points.resize(nb_accumulated_ + nb_kept);
+    cloud.width = cloud.points.size();
+    cloud.height = 1;
+    cloud.is_dense = true;
+  }
+  utime_ = utime;
+
+  if (++counter_ >= config_.batch_size)
+  {
+    finished_ = true;
+    // Voxel centroids of the batch
+    if (config_.voxel_size > 0.0f)
+    {
+      getVoxelGridCloud(voxel_grid_, cloud);
+      voxel_grid_.clear();
+    }
+  }
+}
+
+ScanAccumulator::PointCloud::Ptr ScanAccumulator::releaseCloud()
+{
+  PointCloud::Ptr cloud = cloud_;
+  cloud_.reset(new PointCloud);
+  return cloud;
+}
+
+void ScanAccumulator::clear()
+{
+  cloud_->clear();
+  voxel_grid_.clear();
+  nb_accumulated_ = 0;
+  counter_ = 0;
+  finished_ = false;
+}
@@ -0,0 +1,25 @@
+#include "aicp_utils/segmentedCloud.hpp"
+
+#include <pcl/common/transforms.h>
+
+SegmentedCloud::SegmentedCloud() :
+  cloud(new pcl::PointCloud<pcl::PointXYZRGBNormal>)
+{
+}
+
+void SegmentedCloud::transform(const Eigen::Matrix4f& transform)
+{
+  pcl::transformPointCloudWithNormals(*cloud, *cloud, transform);
+  tree_.reset();
+  points.reset();
+}
+
+SegmentedCloud::SearchTree::Ptr SegmentedCloud::getSearchTree()
+{
+  if (!tree_)
+  {
+    tree_.reset(new SearchTree);
+    tree_->setInputCloud(cloud);
+  }
+  return tree_;
+}
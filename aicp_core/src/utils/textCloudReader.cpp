@@ -0,0 +1,316 @@
+#include "aicp_utils/textCloudReader.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Read-only mapping of a whole file (empty files are valid, with no data)
+class MappedTextFile
+{
+  public:
+    MappedTextFile() : fd_(-1), data_(NULL), size_(0) {}
+    ~MappedTextFile() { close(); }
+
+    bool open(const std::string& file_name)
+    {
+      fd_ = ::open(file_name.c_str(), O_RDONLY);
+      struct stat file_stat;
+      if (fd_ < 0 || fstat(fd_, &file_stat) != 0)
+      {
+        std::cerr << "[TextCloudReader] Error: cannot open file " << file_name << std::endl;
+        close();
+        return false;
+      }
+      size_ = file_stat.st_size;
+      if (size_ == 0)
+        return true;
+      void* data = mmap(NULL, size_, PROT_READ, MAP_PRIVATE, fd_, 0);
+      if (data == MAP_FAILED)
+      {
+        std::cerr << "[TextCloudReader] Error: cannot map file " << file_name << std::endl;
+        close();
+        return false;
+      }
+      data_ = static_cast<const char*>(data);
+      madvise(data, size_, MADV_SEQUENTIAL);
+      return true;
+    }
+
+    void close()
+    {
+      if (data_ != NULL)
+        munmap(const_cast<char*>(data_), size_);
+      if (fd_ >= 0)
+        ::close(fd_);
+      fd_ = -1;
+      data_ = NULL;
+      size_ = 0;
+    }
+
+    const char* begin() const { return data_; }
+    const char* end() const { return data_ + size_; }
+
+  private:
+    int fd_;
+    const char* data_;
+    size_t size_;
+};
+
+static inline bool isDigit(char c)
+{
+  return c >= '0' && c <= '9';
+}
+
+static inline bool isSeparator(char c)
+{
+  return c == ' ' || c == '\t' || c == ',' || c == '\r';
+}
+
+static inline const char* nextLine(const char* p, const char* end)
+{
+  const char* eol = static_cast<const char*>(std::memchr(p, '\n', end - p));
+  return eol != NULL ? eol + 1 : end;
+}
+
+// strtod on a copy of [begin, end) (the mapped file is not null terminated)
+static bool parseDoubleSlow(const char*& begin, const char* end, double& value)
+{
+  char token[64];
+  size_t length = std::min((size_t)(end - begin), sizeof(token) - 1);
+  std::memcpy(token, begin, length);
+  token[length] = '\0';
+  char* token_end;
+  double parsed = std::strtod(token, &token_end);
+  if (token_end == token)
+    return false;
+  value = parsed;
+  begin += token_end - token;
+  return true;
+}
+
+bool parseDouble(const char*& begin, const char* end, double& value)
+{
+  // Exact powers of ten in double precision
+  static const double powers_of_ten[] = {1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+                                         1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
+
+  const char* p = begin;
+  bool negative = false;
+  if (p < end && (*p == '-' || *p == '+'))
+  {
+    negative = (*p == '-');
+    p++;
+  }
+
+  uint64_t mantissa = 0;
+  int nb_significant = 0; // digits in the mantissa (leading zeros excluded)
+  int nb_digits = 0;
+  int exponent = 0;
+  bool truncated = false;
+  for (; p < end && isDigit(*p); p++, nb_digits++)
+  {
+    if (nb_significant < 19)
+    {
+      mantissa = 10 * mantissa + (*p - '0');
+      nb_significant += (mantissa != 0);
+    }
+    else
+    {
+      exponent++;
+      truncated |= (*p != '0');
+    }
+  }
+  if (p < end && *p == '.')
+  {
+    for (p++; p < end && isDigit(*p); p++, nb_digits++)
+    {
+      if (nb_significant < 19)
+      {
+        mantissa = 10 * mantissa + (*p - '0');
+        nb_significant += (mantissa != 0);
+        exponent--;
+      }
+      else
+        truncated |= (*p != '0');
+    }
+  }
+  if (nb_digits == 0)
+  {
+    // nan, inf
+    if (p < end && (*p == 'n' || *p == 'N' || *p == 'i' || *p == 'I'))
+      return parseDoubleSlow(begin, end, value);
+    return false;
+  }
+  if (p < end && (*p == 'e' || *p == 'E'))
+  {
+    const char* q = p + 1;
+    bool negative_exponent = false;
+    if (q < end && (*q == '-' || *q == '+'))
+    {
+      negative_exponent = (*q == '-');
+      q++;
+    }
+    if (q < end && isDigit(*q))
+    {
+      int digits_exponent = 0;
+      for (; q < end && isDigit(*q); q++)
+        if (digits_exponent < 10000)
+          digits_exponent = 10 * digits_exponent + (*q - '0');
+      exponent += negative_exponent ? -digits_exponent : digits_exponent;
+      p = q;
+    }
+  }
+
+  // Mantissa and power of ten exact: a single rounding (same result as strtod)
+  if (truncated || mantissa > (1ull << 53) || exponent < -22 || exponent > 22)
+    return parseDoubleSlow(begin, end, value);
+  double parsed = (double)mantissa;
+  parsed = exponent < 0 ? parsed / powers_of_ten[-exponent] : parsed * powers_of_ten[exponent];
+  value = negative ? -parsed : parsed;
+  begin = p;
+  return true;
+}
+
+// Parses the numbers of the line at p (advanced to the next line): the first max_values are
+// stored in values. Returns their number, 0 if the line is a comment or holds a non numeric value.
+static size_t parseLine(const char*& p, const char* end, double* values, size_t max_values)
+{
+  size_t nb_values = 0;
+  while (p < end && *p != '\n')
+  {
+    if (isSeparator(*p))
+    {
+      p++;
+      continue;
+    }
+    if (nb_values == max_values)
+      break; // remaining values not needed
+    if (!parseDouble(p, end, values[nb_values]) || (p < end && !isSeparator(*p) && *p != '\n'))
+    {
+      p = nextLine(p, end);
+      return 0;
+    }
+    nb_values++;
+  }
+  p = nextLine(p, end);
+  return nb_values;
+}
+
+static void finishCloud(size_t nb_points, pcl::PointCloud<pcl::PointXYZ>& cloud_out)
+{
+  cloud_out.points.resize(nb_points);
+  cloud_out.width = nb_points;
+  cloud_out.height = 1;
+  cloud_out.is_dense = true;
+  for (size_t i = 0; i < nb_points; i++)
+    if (!std::isfinite(cloud_out.points[i].x) || !std::isfinite(cloud_out.points[i].y) ||
+        !std::isfinite(cloud_out.points[i].z))
+    {
+      cloud_out.is_dense = false;
+      break;
+    }
+}
+
+static bool parseCSVCloud(const char* p, const char* end, pcl::PointCloud<pcl::PointXYZ>& cloud_out)
+{
+  // Upper bound of the number of points
+  cloud_out.points.resize(std::count(p, end, '\n') + 1);
+  size_t nb_points = 0;
+  double values[3];
+  while (p < end)
+  {
+    size_t nb_values = parseLine(p, end, values, 3);
+    if (nb_values < 2)
+      continue;
+    pcl::PointXYZ& point = cloud_out.points[nb_points++];
+    point.x = values[0];
+    point.y = values[1];
+    point.z = nb_values > 2 ? values[2] : 0.0;
+  }
+  finishCloud(nb_points, cloud_out);
+  return true;
+}
+
+static bool parseVTKCloud(const char* p, const char* end, pcl::PointCloud<pcl::PointXYZ>& cloud_out)
+{
+  // Header lines up to "POINTS n type"
+  while (p < end)
+  {
+    const char* line = p;
+    p = nextLine(p, end);
+    if ((size_t)(p - line) >= 6 && std::strncmp(line, "BINARY", 6) == 0)
+      return false;
+    if ((size_t)(p - line) < 7 || std::strncmp(line, "POINTS ", 7) != 0)
+      continue;
+
+    const char* q = line + 7;
+    double nb_points;
+    if (!parseDouble(q, p, nb_points) || nb_points < 0)
+      return false;
+    cloud_out.points.resize((size_t)nb_points);
+    size_t nb_values = 0;
+    const size_t nb_coordinates = 3 * cloud_out.points.size();
+    while (p < end && nb_values < nb_coordinates)
+    {
+      if (isSeparator(*p) || *p == '\n')
+      {
+        p++;
+        continue;
+      }
+      double value;
+      if (!parseDouble(p, end, value))
+        break;
+      cloud_out.points[nb_values / 3].data[nb_values % 3] = value;
+      nb_values++;
+    }
+    if (nb_values < nb_coordinates)
+      std::cerr << "[TextCloudReader] Warning: truncated POINTS section (" << nb_values / 3
+                << " points read)." << std::endl;
+    finishCloud(nb_values / 3, cloud_out);
+    return true;
+  }
+  return false;
+}
+
+bool readTextCloud(const std::string& file_name, pcl::PointCloud<pcl::PointXYZ>& cloud_out)
+{
+  std::string extension = file_name.substr(file_name.find_last_of('.') + 1);
+  if (extension != "csv" && extension != "vtk")
+    return false;
+  MappedTextFile file;
+  if (!file.open(file_name))
+    return false;
+  if (extension == "csv")
+    return parseCSVCloud(file.begin(), file.end(), cloud_out);
+  return parseVTKCloud(file.begin(), file.end(), cloud_out);
+}
+
+bool readTextTable(const std::string& file_name, size_t nb_columns, std::vector<double>& values)
+{
+  MappedTextFile file;
+  if (!file.open(file_name))
+    return false;
+  const char* p = file.begin();
+  const char* end = file.end();
+  std::vector<double> row (nb_columns);
+  values.reserve(values.size() + nb_columns * (std::count(p, end, '\n') + 1));
+  while (p < end)
+  {
+    if (*p == '#')
+    {
+      p = nextLine(p, end);
+      continue;
+    }
+    if (parseLine(p, end, row.data(), nb_columns) == nb_columns)
+      values.insert(values.end(), row.begin(), row.end());
+  }
+  return true;
+}
@@ -0,0 +1,38 @@
+#include "aicp_utils/threadPool.hpp"
+
+ThreadPool::ThreadPool(int num_threads) :
+  stop_(false)
+{
+  if (num_threads <= 0)
+    num_threads = std::max(1u, std::thread::hardware_concurrency());
+  for (int i = 0; i < num_threads; i++)
+    workers_.push_back(std::thread(&ThreadPool::work, this));
+}
+
+ThreadPool::~ThreadPool()
+{
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+    stop_ = true;
+  }
+  condition_.notify_all();
+  for (size_t i = 0; i < workers_.size(); i++)
+    workers_[i].join();
+}
+
+void ThreadPool::work()
+{
+  while (true)
+  {
+    std::function<void()> task;
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      condition_.wait(lock, [this](){ return stop_ || !tasks_.empty(); });
+      if (stop_ && tasks_.empty())
+        return;
+      task = std::move(tasks_.front());
+      tasks_.pop();
+    }
+    task();
+  }
+}
@@ -0,0 +1,262 @@
+#include "aicp_utils/tiledMapFile.hpp"
+
+#include <cstring>
+#include <fstream>
+#include <iostream>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static const char tiled_map_magic[8] = {'A', 'I', 'C', 'P', 'M', 'A', 'P', '1'};
+static const uint32_t tiled_map_version = 1;
+static const size_t tiled_map_header_size = 40;
+static const size_t tiled_map_entry_size = 40;
+
+template <typename T>
+static void writeValue(std::ofstream& file, const T& value)
+{
+  file.write(reinterpret_cast<const char*>(&value), sizeof(T));
+}
+
+template <typename T>
+static T readValue(const char* data)
+{
+  T value;
+  std::memcpy(&value, data, sizeof(T));
+  return value;
+}
+
+TiledMapFile::TiledMapFile() :
+  fd_(-1), data_(NULL), size_(0), tile_size_(0.0f), leaf_size_(0.0f), nb_points_(0)
+{
+}
+
+TiledMapFile::~TiledMapFile()
+{
+  close();
+}
+
+bool TiledMapFile::write(const std::string& file_name, const pcl::PointCloud<pcl::PointXYZ>& cloud,
+                         float tile_size, float leaf_size)
+{
+  if (tile_size <= 0.0f)
+  {
+    std::cerr << "[TiledMapFile] Error: tile size must be positive." << std::endl;
+    return false;
+  }
+
+  // Bucket points (in tiles order of appearance)
+  float inverse_tile_size = 1.0f / tile_size;
+  std::unordered_map<VoxelKey, size_t, VoxelKeyHash> tile_indices;
+  std::vector<VoxelKey> keys;
+  std::vector<std::vector<uint32_t> > tiles;
+  for (size_t i = 0; i < cloud.size(); i++)
+  {
+    const pcl::PointXYZ& point = cloud.points[i];
+    if (!std::isfinite(point.x) || !std::isfinite(point.y) || !std::isfinite(point.z))
+      continue;
+    VoxelKey key = getVoxelKey(point.x, point.y, point.z, inverse_tile_size);
+    std::pair<std::unordered_map<VoxelKey, size_t, VoxelKeyHash>::iterator, bool> inserted =
+        tile_indices.insert(std::make_pair(key, tiles.size()));
+    if (inserted.second)
+    {
+      keys.push_back(key);
+      tiles.push_back(std::vector<uint32_t>());
+    }
+    tiles[inserted.first->second].push_back(i);
+  }
+
+  std::ofstream file (file_name.c_str(), std::ios::out | std::ios::binary);
+  if (!file.is_open())
+  {
+    std::cerr << "[TiledMapFile] Error: cannot open file " << file_name << std::endl;
+    return false;
+  }
+
+  uint64_t nb_points = 0;
+  for (size_t t = 0; t < tiles.size(); t++)
+    nb_points += tiles[t].size();
+
+  // Header
+  file.write(tiled_map_magic, sizeof(tiled_map_magic));
+  writeValue(file, tiled_map_version);
+  writeValue(file, tile_size);
+  writeValue(file, leaf_size);
+  writeValue(file, (uint32_t)0);
+  writeValue(file, (uint64_t)tiles.size());
+  writeValue(file, nb_points);
+
+  // Index
+  uint64_t offset = tiled_map_header_size + tiles.size() * tiled_map_entry_size;
+  for (size_t t = 0; t < tiles.size(); t++)
+  {
+    writeValue(file, keys[t].x);
+    writeValue(file, keys[t].y);
+    writeValue(file, keys[t].z);
+    writeValue(file, offset);
+    writeValue(file, (uint64_t)tiles[t].size());
+    offset += 3 * sizeof(float) * tiles[t].size();
+  }
+
+  // Tiles (structure of arrays)
+  std::vector<float> values;
+  for (size_t t = 0; t < tiles.size(); t++)
+  {
+    const std::vector<uint32_t>& indices = tiles[t];
+    values.resize(3 * indices.size());
+    for (size_t i = 0; i < indices.size(); i++)
+    {
+      values[i] = cloud.points[indices[i]].x;
+      values[indices.size() + i] = cloud.points[indices[i]].y;
+      values[2 * indices.size() + i] = cloud.points[indices[i]].z;
+    }
+    file.write(reinterpret_cast<const char*>(values.data()), values.size() * sizeof(float));
+  }
+
+  if (!file.good())
+  {
+    std::cerr << "[TiledMapFile] Error: cannot write file " << file_name << std::endl;
+    return false;
+  }
+  return true;
+}
+
+bool TiledMapFile::open(const std::string& file_name)
+{
+  close();
+
+  fd_ = ::open(file_name.c_str(), O_RDONLY);
+  if (fd_ < 0)
+  {
+    std::cerr << "[TiledMapFile] Error: cannot open file " << file_name << std::endl;
+    return false;
+  }
+  struct stat file_stat;
+  if (fstat(fd_, &file_stat) != 0 || (size_t)file_stat.st_size < tiled_map_header_size)
+  {
+    std::cerr << "[TiledMapFile] Error: invalid file " << file_name << std::endl;
+    close();
+    return false;
+  }
+  size_ = file_stat.st_size;
+
+  void* data = mmap(NULL, size_, PROT_READ, MAP_PRIVATE, fd_, 0);
+  if (data == MAP_FAILED)
+  {
+    std::cerr << "[TiledMapFile] Error: cannot map file " << file_name << std::endl;
+    close();
+    return false;
+  }
+  data_ = static_cast<const char*>(data);
+  // Tiles are accessed by location, not sequentially (no read-ahead of the whole file)
+  madvise(data, size_, MADV_RANDOM);
+
+  // Header
+  if (std::memcmp(data_, tiled_map_magic, sizeof(tiled_map_magic)) != 0 ||
+      readValue<uint32_t>(data_ + 8) != tiled_map_version)
+  {
+    std::cerr << "[TiledMapFile] Error: " << file_name << " is not a tiled map (version "
+              << tiled_map_version << ")." << std::endl;
+    close();
+    return false;
+  }
+  tile_size_ = readValue<float>(data_ + 12);
+  leaf_size_ = readValue<float>(data_ + 16);
+  uint64_t nb_tiles = readValue<uint64_t>(data_ + 24);
+  nb_points_ = readValue<uint64_t>(data_ + 32);
+  if (tile_size_ <= 0.0f || tiled_map_header_size + nb_tiles * tiled_map_entry_size > size_)
+  {
+    std::cerr << "[TiledMapFile] Error: corrupted header in " << file_name << std::endl;
+    close();
+    return false;
+  }
+
+  // Index
+  tiles_.reserve(nb_tiles);
+  for (uint64_t t = 0; t < nb_tiles; t++)
+  {
+    const char* entry = data_ + tiled_map_header_size + t * tiled_map_entry_size;
+    VoxelKey key;
+    key.x = readValue<int64_t>(entry);
+    key.y = readValue<int64_t>(entry + 8);
+    key.z = readValue<int64_t>(entry + 16);
+    TileEntry tile;
+    tile.offset = readValue<uint64_t>(entry + 24);
+    tile.nb_points = readValue<uint64_t>(entry + 32);
+    if (tile.offset + 3 * sizeof(float) * tile.nb_points > size_)
+    {
+      std::cerr << "[TiledMapFile] Error: corrupted tile index in " << file_name << std::endl;
+      close();
+      return false;
+    }
+    tiles_[key] = tile;
+  }
+  return true;
+}
+
+void TiledMapFile::close()
+{
+  if (data_ != NULL)
+    munmap(const_cast<char*>(data_), size_);
+  if (fd_ >= 0)
+    ::close(fd_);
+  fd_ = -1;
+  data_ = NULL;
+  size_ = 0;
+  nb_points_ = 0;
+  tiles_.clear();
+}
+
+void TiledMapFile::getTileKeys(const Eigen::Vector3f& box_min, const Eigen::Vector3f& box_max,
+                               std::vector<VoxelKey>& keys) const
+{
+  keys.clear();
+  if (!isOpen())
+    return;
+  float inverse_tile_size = 1.0f / tile_size_;
+  VoxelKey key_min = getVoxelKey(box_min.x(), box_min.y(), box_min.z(), inverse_tile_size);
+  VoxelKey key_max = getVoxelKey(box_max.x(), box_max.y(), box_max.z(), inverse_tile_size);
+  VoxelKey key;
+  for (key.x = key_min.x; key.x <= key_max.x; key.x++)
+    for (key.y = key_min.y; key.y <= key_max.y; key.y++)
+      for (key.z = key_min.z; key.z <= key_max.z; key.z++)
+        if (tiles_.count(key))
+          keys.push_back(key);
+}
+
+size_t TiledMapFile::readTile(const VoxelKey& key, pcl::PointCloud<pcl::PointXYZ>& cloud_out) const
+{
+  std::unordered_map<VoxelKey, TileEntry, VoxelKeyHash>::const_iterator tile = tiles_.find(key);
+  if (tile == tiles_.end())
+    return 0;
+
+  size_t nb_points = tile->second.nb_points;
+  const char* x = data_ + tile->second.offset;
+  const char* y = x + nb_points * sizeof(float);
+  const char* z = y + nb_points * sizeof(float);
+  size_t nb_before = cloud_out.size();
+  cloud_out.points.resize(nb_before + nb_points);
+  for (size_t i = 0; i < nb_points; i++)
+  {
+    pcl::PointXYZ& point = cloud_out.points[nb_before + i];
+    point.x = readValue<float>(x + i * sizeof(float));
+    point.y = readValue<float>(y + i * sizeof(float));
+    point.z = readValue<float>(z + i * sizeof(float));
+  }
+  cloud_out.width = cloud_out.points.size();
+  cloud_out.height = 1;
+  cloud_out.is_dense = true;
+  return nb_points;
+}
+
+size_t TiledMapFile::readAllTiles(pcl::PointCloud<pcl::PointXYZ>& cloud_out) const
+{
+  cloud_out.points.reserve(cloud_out.size() + nb_points_);
+  size_t nb_points = 0;
+  for (std::unordered_map<VoxelKey, TileEntry, VoxelKeyHash>::const_iterator tile = tiles_.begin();
+       tile != tiles_.end(); ++tile)
+    nb_points += readTile(tile->first, cloud_out);
+  return nb_points;
+}
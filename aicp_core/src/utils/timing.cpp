@@ -1,18 +1,147 @@
 #include "aicp_utils/timing.hpp"
 
-std::stack<clock_t> TimingUtils::tictoc_stack;
+#include <algorithm>
+#include <cmath>
+#include <iomanip>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
 
-// Get tim elapsed in seconds
-void TimingUtils::tic() {
-  tictoc_stack.push(clock());   
+// Log-scale histogram: 8 buckets per doubling of the duration, from 1 us to ~1 hour
+static const double histogram_min_duration = 1e-6;
+static const int histogram_buckets_per_octave = 8;
+static const int histogram_nb_buckets = 32 * histogram_buckets_per_octave;
+
+struct TimingHistogram
+{
+  TimingHistogram() : count(0), total(0.0), max(0.0), buckets(histogram_nb_buckets, 0) {}
+
+  void add(double seconds)
+  {
+    count++;
+    total += seconds;
+    max = std::max(max, seconds);
+    int bucket = 0;
+    if (seconds > histogram_min_duration)
+      bucket = std::min((int)(std::log2(seconds / histogram_min_duration) * histogram_buckets_per_octave),
+                        histogram_nb_buckets - 1);
+    buckets[bucket]++;
+  }
+
+  void merge(const TimingHistogram& other)
+  {
+    count += other.count;
+    total += other.total;
+    max = std::max(max, other.max);
+    for (int i = 0; i < histogram_nb_buckets; i++)
+      buckets[i] += other.buckets[i];
+  }
+
+  // Upper bound of the bucket holding the quantile (clamped to the max)
+  double quantile(double q) const
+  {
+    uint64_t rank = (uint64_t)std::ceil(q * count);
+    uint64_t cumulated = 0;
+    for (int i = 0; i < histogram_nb_buckets; i++)
+    {
+      cumulated += buckets[i];
+      if (cumulated >= rank && cumulated > 0)
+        return std::min(max, histogram_min_duration *
+                             std::pow(2.0, (double)(i + 1) / histogram_buckets_per_octave));
+    }
+    return max;
+  }
+
+  uint64_t count;
+  double total;
+  double max;
+  std::vector<uint64_t> buckets;
+};
+
+struct TimingContext
+{
+  std::mutex mutex; // uncontended unless statistics are being read
+  std::unordered_map<std::string, TimingHistogram> histograms;
+};
+
+// Contexts outlive their threads (durations of finished threads are kept)
+static std::mutex timing_contexts_mutex;
+static std::vector<std::shared_ptr<TimingContext> > timing_contexts;
+
+static TimingContext& getThreadContext()
+{
+  thread_local std::shared_ptr<TimingContext> context;
+  if (!context)
+  {
+    context = std::make_shared<TimingContext>();
+    std::unique_lock<std::mutex> lock(timing_contexts_mutex);
+    timing_contexts.push_back(context);
+  }
+  return *context;
 }
 
-void TimingUtils::toc(std::string message) {
-  std::cout << "Time elapsed: "
-  << ((double)(clock() - tictoc_stack.top())) / CLOCKS_PER_SEC
-  << " sec " << message
-  << std::endl;
-  tictoc_stack.pop();
+void TimingStats::record(const std::string& name, double seconds)
+{
+  TimingContext& context = getThreadContext();
+  std::unique_lock<std::mutex> lock(context.mutex);
+  context.histograms[name].add(seconds);
+}
+
+void TimingStats::getSummaries(std::vector<Summary>& summaries)
+{
+  std::map<std::string, TimingHistogram> merged;
+  {
+    std::unique_lock<std::mutex> lock(timing_contexts_mutex);
+    for (size_t c = 0; c < timing_contexts.size(); c++)
+    {
+      std::unique_lock<std::mutex> context_lock(timing_contexts[c]->mutex);
+      for (const auto& histogram : timing_contexts[c]->histograms)
+        merged[histogram.first].merge(histogram.second);
+    }
+  }
+
+  summaries.clear();
+  for (const auto& histogram : merged)
+  {
+    Summary summary;
+    summary.name = histogram.first;
+    summary.count = histogram.second.count;
+    summary.total = histogram.second.total;
+    summary.mean = summary.count > 0 ? summary.total / summary.count : 0.0;
+    summary.p50 = histogram.second.quantile(0.50);
+    summary.p95 = histogram.second.quantile(0.95);
+    summary.p99 = histogram.second.quantile(0.99);
+    summary.max = histogram.second.max;
+    summaries.push_back(summary);
+  }
+}
+
+void TimingStats::print(std::ostream& out)
+{
+  std::vector<Summary> summaries;
+  getSummaries(summaries);
+  out << "[Timing] " << std::left << std::setw(24) << "name" << std::right
+      << std::setw(8) << "count" << std::setw(11) << "mean (ms)" << std::setw(10) << "p50"
+      << std::setw(10) << "p95" << std::setw(10) << "p99" << std::setw(10) << "max" << std::endl;
+  for (size_t i = 0; i < summaries.size(); i++)
+  {
+    const Summary& s = summaries[i];
+    out << "[Timing] " << std::left << std::setw(24) << s.name << std::right << std::fixed << std::setprecision(1)
+        << std::setw(8) << s.count << std::setw(11) << 1e3 * s.mean << std::setw(10) << 1e3 * s.p50
+        << std::setw(10) << 1e3 * s.p95 << std::setw(10) << 1e3 * s.p99 << std::setw(10) << 1e3 * s.max
+        << std::defaultfloat << std::endl;
+  }
+}
+
+void TimingStats::reset()
+{
+  std::unique_lock<std::mutex> lock(timing_contexts_mutex);
+  for (size_t c = 0; c < timing_contexts.size(); c++)
+  {
+    std::unique_lock<std::mutex> context_lock(timing_contexts[c]->mutex);
+    timing_contexts[c]->histograms.clear();
+  }
 }
 
 // Get current date/time, format is YYYY-MM-DD.HH:mm:ss
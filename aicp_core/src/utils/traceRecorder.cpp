@@ -0,0 +1,323 @@
+#include "aicp_utils/traceRecorder.hpp"
+
+#include <algorithm>
+#include <condition_variable>
+#include <csignal>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+std::atomic<bool> TraceRecorder::enabled_(false);
+
+struct TraceSpan
+{
+  const char* name;
+  int64_t start; // ns since trace_epoch
+  int64_t duration;
+  bool async;
+};
+
+// Single writer (the owning thread), read while written: the slot about to be written is
+// announced (begin) before the fields change, the reader drops the slots announced meanwhile.
+struct TraceBuffer
+{
+  struct Slot
+  {
+    std::atomic<const char*> name;
+    std::atomic<int64_t> start;
+    std::atomic<int64_t> duration;
+    std::atomic<bool> async;
+  };
+
+  TraceBuffer(size_t nb_slots, int id) :
+    slots(new Slot[nb_slots > 0 ? nb_slots : 1]), capacity(nb_slots > 0 ? nb_slots : 1),
+    begin(0), end(0), tid(id) {}
+
+  void push(const TraceSpan& span)
+  {
+    const uint64_t index = begin.load(std::memory_order_relaxed);
+    begin.store(index + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    Slot& slot = slots[index % capacity];
+    slot.name.store(span.name, std::memory_order_relaxed);
+    slot.start.store(span.start, std::memory_order_relaxed);
+    slot.duration.store(span.duration, std::memory_order_relaxed);
+    slot.async.store(span.async, std::memory_order_relaxed);
+    end.store(index + 1, std::memory_order_release);
+  }
+
+  // Oldest first
+  void read(std::vector<TraceSpan>& spans) const
+  {
+    spans.clear();
+    const uint64_t last = end.load(std::memory_order_acquire);
+    uint64_t first = last > capacity ? last - capacity : 0;
+    for (uint64_t i = first; i < last; i++)
+    {
+      const Slot& slot = slots[i % capacity];
+      TraceSpan span;
+      span.name = slot.name.load(std::memory_order_relaxed);
+      span.start = slot.start.load(std::memory_order_relaxed);
+      span.duration = slot.duration.load(std::memory_order_relaxed);
+      span.async = slot.async.load(std::memory_order_relaxed);
+      spans.push_back(span);
+    }
+    std::atomic_thread_fence(std::memory_order_acquire);
+    // Slots of the spans [first, announced - capacity) may have been overwritten
+    const uint64_t announced = begin.load(std::memory_order_relaxed);
+    if (announced > first + capacity)
+      spans.erase(spans.begin(), spans.begin() + std::min<uint64_t>(announced - capacity - first, spans.size()));
+  }
+
+  std::unique_ptr<Slot[]> slots;
+  const size_t capacity;
+  std::atomic<uint64_t> begin;
+  std::atomic<uint64_t> end;
+  const int tid;
+  std::string name; // trace_buffers_mutex locked
+};
+
+// Buffers outlive their threads (spans of finished threads are kept)
+static std::mutex trace_buffers_mutex;
+static std::vector<std::shared_ptr<TraceBuffer> > trace_buffers;
+static std::atomic<size_t> trace_capacity(65536);
+static const TraceRecorder::Clock::time_point trace_epoch = TraceRecorder::Clock::now();
+
+static std::string& getThreadName()
+{
+  thread_local std::string name;
+  return name;
+}
+
+static TraceBuffer& getThreadBuffer()
+{
+  thread_local std::shared_ptr<TraceBuffer> buffer;
+  if (!buffer)
+  {
+    std::unique_lock<std::mutex> lock(trace_buffers_mutex);
+    buffer = std::make_shared<TraceBuffer>(trace_capacity.load(), (int)trace_buffers.size() + 1);
+    buffer->name = getThreadName();
+    trace_buffers.push_back(buffer);
+  }
+  return *buffer;
+}
+
+static int64_t toTraceTime(TraceRecorder::Clock::time_point time)
+{
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(time - trace_epoch).count();
+}
+
+void TraceRecorder::enable(size_t spans_per_thread)
+{
+  trace_capacity = spans_per_thread;
+  enabled_.store(true, std::memory_order_relaxed);
+}
+
+void TraceRecorder::record(const char* name, Clock::time_point start, Clock::time_point end)
+{
+  if (!isEnabled())
+    return;
+  TraceSpan span;
+  span.name = name;
+  span.start = toTraceTime(start);
+  span.duration = std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+  span.async = false;
+  getThreadBuffer().push(span);
+}
+
+void TraceRecorder::recordAsync(const char* name, Clock::time_point start, Clock::time_point end)
+{
+  if (!isEnabled())
+    return;
+  TraceSpan span;
+  span.name = name;
+  span.start = toTraceTime(start);
+  span.duration = std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+  span.async = true;
+  getThreadBuffer().push(span);
+}
+
+void TraceRecorder::setThreadName(const std::string& name)
+{
+  getThreadName() = name;
+  if (!isEnabled())
+    return;
+  TraceBuffer& buffer = getThreadBuffer();
+  std::unique_lock<std::mutex> lock(trace_buffers_mutex);
+  buffer.name = name;
+}
+
+static void writeJsonString(std::ostream& out, const char* text)
+{
+  out << '"';
+  for (const char* c = text; *c != '\0'; c++)
+  {
+    if (*c == '"' || *c == '\\')
+      out << '\\' << *c;
+    else if ((unsigned char)*c >= 0x20)
+      out << *c;
+  }
+  out << '"';
+}
+
+bool TraceRecorder::write(const std::string& filename)
+{
+  std::vector<std::shared_ptr<TraceBuffer> > buffers;
+  std::vector<std::string> names;
+  {
+    std::unique_lock<std::mutex> lock(trace_buffers_mutex);
+    buffers = trace_buffers;
+    for (size_t b = 0; b < buffers.size(); b++)
+      names.push_back(buffers[b]->name);
+  }
+
+  // Written next to the target and renamed: viewers never load a partial trace
+  const std::string tmp_filename = filename + ".tmp";
+  std::ofstream out(tmp_filename.c_str());
+  if (!out.is_open())
+    return false;
+  out << std::fixed << std::setprecision(3);
+  out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+  bool first_event = true;
+  uint64_t async_id = 0;
+  std::vector<TraceSpan> spans;
+  for (size_t b = 0; b < buffers.size(); b++)
+  {
+    const int tid = buffers[b]->tid;
+    std::string name = names[b].empty() ? "thread " + std::to_string(tid) : names[b];
+    out << (first_event ? "" : ",\n") << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << tid
+        << ",\"args\":{\"name\":";
+    writeJsonString(out, name.c_str());
+    out << "}}";
+    first_event = false;
+
+    buffers[b]->read(spans);
+    for (size_t i = 0; i < spans.size(); i++)
+    {
+      const TraceSpan& span = spans[i];
+      if (!span.async)
+      {
+        out << ",\n{\"name\":";
+        writeJsonString(out, span.name);
+        out << ",\"ph\":\"X\",\"pid\":1,\"tid\":" << tid << ",\"ts\":" << 1e-3 * span.start
+            << ",\"dur\":" << 1e-3 * span.duration << "}";
+        continue;
+      }
+      // Begin and end of an async span, matched by id
+      async_id ++;
+      const char* phases[2] = {"b", "e"};
+      for (int k = 0; k < 2; k++)
+      {
+        out << ",\n{\"name\":";
+        writeJsonString(out, span.name);
+        out << ",\"cat\":\"async\",\"ph\":\"" << phases[k] << "\",\"id\":" << async_id
+            << ",\"pid\":1,\"tid\":" << tid << ",\"ts\":" << 1e-3 * (span.start + k * span.duration) << "}";
+      }
+    }
+  }
+  out << "\n]}\n";
+  out.close();
+  if (out.fail())
+    return false;
+  return std::rename(tmp_filename.c_str(), filename.c_str()) == 0;
+}
+
+// Set by the signal handler (lock-free flag only)
+static std::atomic<bool> trace_dump_requested(false);
+
+static void requestTraceDump(int)
+{
+  trace_dump_requested = true;
+}
+
+class TraceDumper
+{
+  public:
+    TraceDumper(const std::string& filename, double period) :
+      filename_(filename), period_(period), running_(true)
+    {
+      thread_ = std::thread(&TraceDumper::run, this);
+    }
+    ~TraceDumper() { stop(); }
+
+    // Writes the last trace
+    void stop()
+    {
+      {
+        std::unique_lock<std::mutex> lock(mutex_);
+        if (!running_)
+          return;
+        running_ = false;
+      }
+      condition_.notify_one();
+      thread_.join();
+      dump();
+    }
+
+  private:
+    void run()
+    {
+      TraceRecorder::setThreadName("trace dumper");
+      TraceRecorder::Clock::time_point last_dump = TraceRecorder::Clock::now();
+      std::unique_lock<std::mutex> lock(mutex_);
+      while (running_)
+      {
+        // Signal flag polled
+        condition_.wait_for(lock, std::chrono::milliseconds(100));
+        const TraceRecorder::Clock::time_point now = TraceRecorder::Clock::now();
+        bool periodic = period_ > 0.0 && std::chrono::duration<double>(now - last_dump).count() >= period_;
+        if (!running_ || !(trace_dump_requested.exchange(false) || periodic))
+          continue;
+        last_dump = now;
+        lock.unlock();
+        dump();
+        lock.lock();
+      }
+    }
+
+    void dump()
+    {
+      if (TraceRecorder::write(filename_))
+        std::cout << "[Trace] Written to " << filename_ << std::endl;
+      else
+        std::cerr << "[Trace] Could not write " << filename_ << std::endl;
+    }
+
+    std::string filename_;
+    double period_;
+    bool running_;
+    std::mutex mutex_;
+    std::condition_variable condition_;
+    std::thread thread_;
+};
+
+// Dumper stopped (last trace written) at exit if not stopped before
+static std::mutex trace_dumper_mutex;
+static std::unique_ptr<TraceDumper> trace_dumper;
+
+void TraceRecorder::start(const std::string& filename, double period)
+{
+  std::unique_lock<std::mutex> lock(trace_dumper_mutex);
+  enable(trace_capacity.load());
+  if (trace_dumper)
+    return;
+  trace_dumper.reset(new TraceDumper(filename, period));
+  std::signal(SIGUSR1, requestTraceDump);
+  std::cout << "[Trace] Recording spans, written to " << filename << " on SIGUSR1";
+  if (period > 0.0)
+    std::cout << ", every " << period << " s";
+  std::cout << " and at exit." << std::endl;
+}
+
+void TraceRecorder::stop()
+{
+  std::unique_lock<std::mutex> lock(trace_dumper_mutex);
+  if (trace_dumper)
+    trace_dumper->stop();
+}
@@ -0,0 +1,52 @@
+#include "aicp_utils/voxelGrid.hpp"
+
+HashVoxelGrid::HashVoxelGrid(float leaf_size) :
+  leaf_size_(leaf_size), inverse_leaf_size_(1.0f / leaf_size)
+{
+}
+
+void HashVoxelGrid::addPoint(float x, float y, float z)
+{
+  if (!std::isfinite(x) || !std::isfinite(y) || !std::isfinite(z))
+    return;
+
+  VoxelKey key = getVoxelKey(x, y, z, inverse_leaf_size_);
+  std::pair<std::unordered_map<VoxelKey, size_t, VoxelKeyHash>::iterator, bool> inserted =
+    voxels_.insert(std::make_pair(key, centroids_.size()));
+  if (inserted.second)
+  {
+    Centroid centroid = {x, y, z, 1};
+    centroids_.push_back(centroid);
+  }
+  else
+  {
+    Centroid& centroid = centroids_[inserted.first->second];
+    centroid.x += x;
+    centroid.y += y;
+    centroid.z += z;
+    centroid.count ++;
+  }
+}
+
+void HashVoxelGrid::addPoints(const float* xyz, size_t nb_points)
+{
+  for (size_t i = 0; i < nb_points; i++)
+    addPoint(xyz[3*i], xyz[3*i+1], xyz[3*i+2]);
+}
+
+void HashVoxelGrid::getCentroids(std::vector<float>& xyz) const
+{
+  xyz.resize(3 * centroids_.size());
+  for (size_t i = 0; i < centroids_.size(); i++)
+  {
+    xyz[3*i] = (float)(centroids_[i].x / centroids_[i].count);
+    xyz[3*i+1] = (float)(centroids_[i].y / centroids_[i].count);
+    xyz[3*i+2] = (float)(centroids_[i].z / centroids_[i].count);
+  }
+}
+
+void HashVoxelGrid::clear()
+{
+  voxels_.clear();
+  centroids_.clear();
+}
@@ -0,0 +1,190 @@
+#include "aicp_utils/voxelMap.hpp"
+
+#include <algorithm>
+
+VoxelMap::VoxelMap(float leaf_size, float tile_size) :
+  leaf_size_(leaf_size), inverse_leaf_size_(1.0f / leaf_size),
+  inverse_tile_size_(1.0f / std::max(tile_size, leaf_size)),
+  cloud_(new pcl::PointCloud<pcl::PointXYZ>)
+{
+}
+
+void VoxelMap::addToTile(size_t index)
+{
+  const pcl::PointXYZ& point = cloud_->points[index];
+  tiles_[getVoxelKey(point.x, point.y, point.z, inverse_tile_size_)].push_back(index);
+}
+
+size_t VoxelMap::insert(const pcl::PointCloud<pcl::PointXYZ>& cloud)
+{
+  size_t nb_before = cloud_->size();
+  cloud_->points.reserve(nb_before + cloud.size());
+  for (size_t i = 0; i < cloud.size(); i++)
+  {
+    const pcl::PointXYZ& point = cloud.points[i];
+    if (!std::isfinite(point.x) || !std::isfinite(point.y) || !std::isfinite(point.z))
+      continue;
+    VoxelKey key = getVoxelKey(point.x, point.y, point.z, inverse_leaf_size_);
+    if (voxels_.insert(std::make_pair(key, cloud_->points.size())).second)
+    {
+      cloud_->points.push_back(point);
+      addToTile(cloud_->points.size() - 1);
+    }
+  }
+  cloud_->width = cloud_->points.size();
+  cloud_->height = 1;
+  cloud_->is_dense = true;
+  return cloud_->size() - nb_before;
+}
+
+size_t VoxelMap::removeFarthest(const Eigen::Vector3f& center, size_t max_points)
+{
+  size_t nb_before = cloud_->size();
+  if (nb_before <= max_points)
+    return 0;
+
+  std::vector<float> distances (nb_before);
+  for (size_t i = 0; i < nb_before; i++)
+    distances[i] = (cloud_->points[i].getVector3fMap() - center).squaredNorm();
+  std::vector<float> sorted (distances);
+  float threshold = 0.0f;
+  if (max_points > 0)
+  {
+    std::nth_element(sorted.begin(), sorted.begin() + (max_points - 1), sorted.end());
+    threshold = sorted[max_points - 1];
+  }
+
+  // Compact kept points in place, re-index their voxels
+  // (stored point is the one which created the voxel: its key is the voxel key)
+  voxels_.clear();
+  tiles_.clear();
+  size_t nb_kept = 0;
+  for (size_t i = 0; i < nb_before && nb_kept < max_points; i++)
+  {
+    if (distances[i] > threshold)
+      continue;
+    const pcl::PointXYZ point = cloud_->points[i];
+    cloud_->points[nb_kept] = point;
+    voxels_[getVoxelKey(point.x, point.y, point.z, inverse_leaf_size_)] = nb_kept;
+    addToTile(nb_kept);
+    nb_kept ++;
+  }
+  cloud_->points.resize(nb_kept);
+  cloud_->width = nb_kept;
+  cloud_->height = 1;
+  return nb_before - nb_kept;
+}
+
+void VoxelMap::setCloud(const pcl::PointCloud<pcl::PointXYZ>& cloud)
+{
+  clear();
+  voxels_.reserve(cloud.size());
+  insert(cloud);
+}
+
+void VoxelMap::getPointsInOrientedBox(float min, float max, const Eigen::Matrix4f& origin,
+                                      pcl::PointCloud<pcl::PointXYZ>& cloud_out) const
+{
+  // Box rotation is the origin rotation (as cropOrientedBox)
+  Eigen::Vector3f position = origin.block<3,1>(0,3);
+  Eigen::Matrix3f rotation = origin.block<3,3>(0,0);
+  Eigen::Matrix3f rotation_inverse = rotation.transpose();
+
+  // Tiles overlapping the axis-aligned bounding box of the oriented box
+  Eigen::Vector3f center = rotation * Eigen::Vector3f::Constant(0.5f * (min + max)) + position;
+  Eigen::Vector3f extent = rotation.cwiseAbs() * Eigen::Vector3f::Constant(0.5f * (max - min));
+  Eigen::Vector3f aabb_min = center - extent;
+  Eigen::Vector3f aabb_max = center + extent;
+  VoxelKey tile_min = getVoxelKey(aabb_min.x(), aabb_min.y(), aabb_min.z(), inverse_tile_size_);
+  VoxelKey tile_max = getVoxelKey(aabb_max.x(), aabb_max.y(), aabb_max.z(), inverse_tile_size_);
+
+  std::vector<uint32_t> indices;
+  VoxelKey key;
+  for (key.x = tile_min.x; key.x <= tile_max.x; key.x++)
+    for (key.y = tile_min.y; key.y <= tile_max.y; key.y++)
+      for (key.z = tile_min.z; key.z <= tile_max.z; key.z++)
+      {
+        std::unordered_map<VoxelKey, std::vector<uint32_t>, VoxelKeyHash>::const_iterator tile = tiles_.find(key);
+        if (tile == tiles_.end())
+          continue;
+        for (size_t i = 0; i < tile->second.size(); i++)
+        {
+          Eigen::Vector3f point_box = rotation_inverse *
+                                      (cloud_->points[tile->second[i]].getVector3fMap() - position);
+          if ((point_box.array() >= min).all() && (point_box.array() <= max).all())
+            indices.push_back(tile->second[i]);
+        }
+      }
+  // Map order (as a crop of the whole map)
+  std::sort(indices.begin(), indices.end());
+
+  cloud_out.points.resize(indices.size());
+  for (size_t i = 0; i < indices.size(); i++)
+    cloud_out.points[i] = cloud_->points[indices[i]];
+  cloud_out.width = indices.size();
+  cloud_out.height = 1;
+  cloud_out.is_dense = true;
+}
+
+void VoxelMap::clear()
+{
+  voxels_.clear();
+  tiles_.clear();
+  // New cloud: clouds previously returned by getCloud() are left untouched
+  cloud_.reset(new pcl::PointCloud<pcl::PointXYZ>);
+}
+
+// Hash containers: value and next pointer per node (cached hash counted as a pointer), one pointer per bucket
+template <typename Map>
+static size_t getHashMemoryUsage(const Map& map)
+{
+  return map.size() * (sizeof(typename Map::value_type) + 2 * sizeof(void*)) + map.bucket_count() * sizeof(void*);
+}
+
+MemoryUsage VoxelMap::getMemoryUsage() const
+{
+  // Every point is in one tile (tile vectors slack not counted)
+  size_t bytes = cloud_->points.capacity() * sizeof(pcl::PointXYZ) + getHashMemoryUsage(voxels_) +
+                 getHashMemoryUsage(tiles_) + cloud_->size() * sizeof(uint32_t);
+  return MemoryUsage(bytes, cloud_->size());
+}
+
+VoxelOccupancy::VoxelOccupancy(float resolution) :
+  resolution_(resolution), inverse_resolution_(1.0f / resolution)
+{
+}
+
+void VoxelOccupancy::insert(const pcl::PointCloud<pcl::PointXYZ>& cloud)
+{
+  for (size_t i = 0; i < cloud.size(); i++)
+  {
+    const pcl::PointXYZ& point = cloud.points[i];
+    if (std::isfinite(point.x) && std::isfinite(point.y) && std::isfinite(point.z))
+      voxels_.insert(getVoxelKey(point.x, point.y, point.z, inverse_resolution_));
+  }
+}
+
+float VoxelOccupancy::getOverlap(const pcl::PointCloud<pcl::PointXYZ>& cloud) const
+{
+  // Voxels counted once (as octree nodes), whatever the density of the cloud
+  std::unordered_set<VoxelKey, VoxelKeyHash> cloud_voxels;
+  cloud_voxels.reserve(cloud.size());
+  size_t nb_overlapping = 0;
+  for (size_t i = 0; i < cloud.size(); i++)
+  {
+    const pcl::PointXYZ& point = cloud.points[i];
+    if (!std::isfinite(point.x) || !std::isfinite(point.y) || !std::isfinite(point.z))
+      continue;
+    VoxelKey key = getVoxelKey(point.x, point.y, point.z, inverse_resolution_);
+    if (cloud_voxels.insert(key).second && voxels_.count(key) > 0)
+      nb_overlapping ++;
+  }
+  if (cloud_voxels.empty())
+    return 0.0f;
+  return 100.0f * nb_overlapping / cloud_voxels.size();
+}
+
+MemoryUsage VoxelOccupancy::getMemoryUsage() const
+{
+  return MemoryUsage(getHashMemoryUsage(voxels_), voxels_.size());
+}
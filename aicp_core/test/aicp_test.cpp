@@ -44,8 +44,32 @@ int main (int argc, char** argv)
   cl_cfg.aicp_config_file.append(homedir);
   cl_cfg.aicp_config_file.append("/code/aicp_base/git/aicp/aicp_core/config/aicp_test_config.yaml");
   cl_cfg.localize_against_prior_map = false; // otherwise overlap set to high default value
+  cl_cfg.prior_map_max_match_distance = 1.0; // unused without prior map
   cl_cfg.failure_prediction_mode = true; // compute Alignment Risk
+  cl_cfg.parallel_alignment_risk = false;
   cl_cfg.verbose = false;
+  cl_cfg.accumulator_voxel_size = 0.0;
+  cl_cfg.log_level = "info";
+  cl_cfg.log_async = false;
+  cl_cfg.debug_queue_size = 10;
+  cl_cfg.debug_binary = true;
+  cl_cfg.pipelined_processing = false;
+  cl_cfg.loop_closure_detection = false;
+  cl_cfg.pose_graph_optimization = false;
+  cl_cfg.max_queue_size = 1;
+  cl_cfg.max_map_points = 0;
+  cl_cfg.graph_memory_budget = 0;
+  cl_cfg.graph_resident_clouds = 10;
+  cl_cfg.graph_spill_file = "";
+  cl_cfg.graph_compact_resolution = 0.0;
+  cl_cfg.queue_policy = "drop_oldest";
+  cl_cfg.cycle_deadline = 0.0;
+  cl_cfg.diagnostics_rate = 0.0;
+  cl_cfg.compressed_clouds_resolution = 0.0;
+  cl_cfg.trace_file = "";
+  cl_cfg.trace_dump_period = 0.0;
+  cl_cfg.replay_prefetch = 0;
+  cl_cfg.replay_real_time = false;
 
   // Expected result file
   std::stringstream expected_file;
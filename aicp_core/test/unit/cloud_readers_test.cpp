@@ -0,0 +1,183 @@
+// Streamed (PLY, PCD) and text (csv, vtk) cloud readers
+// Run: catkin run_tests aicp_core
+
+#include <gtest/gtest.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+
+#include "aicp_utils/cloudStreamReader.hpp"
+#include "aicp_utils/textCloudReader.hpp"
+
+static std::string getTestFile(const std::string& name)
+{
+  return std::string(P_tmpdir) + "/aicp_cloud_readers_test_" + name;
+}
+
+static void writeFile(const std::string& filename, const std::string& content)
+{
+  std::ofstream file(filename.c_str(), std::ios::out | std::ios::binary);
+  file << content;
+}
+
+// Points (i, -i, 0.5 i)
+static void expectPoints(const std::vector<float>& xyz, size_t first, size_t nb_points)
+{
+  ASSERT_EQ(xyz.size(), 3 * nb_points);
+  for (size_t k = 0; k < nb_points; k++)
+  {
+    float i = first + k;
+    EXPECT_FLOAT_EQ(xyz[3*k], i);
+    EXPECT_FLOAT_EQ(xyz[3*k+1], -i);
+    EXPECT_FLOAT_EQ(xyz[3*k+2], 0.5 * i);
+  }
+}
+
+TEST(CloudStreamReader, readsBinaryPLYInChunks)
+{
+  // Double z and an extra property between the coordinates
+  const int nb_points = 10;
+  std::string content = "ply\nformat binary_little_endian 1.0\ncomment test\n"
+                        "element vertex 10\nproperty float x\nproperty uchar intensity\n"
+                        "property float y\nproperty double z\nelement face 0\n"
+                        "property list uchar int vertex_indices\nend_header\n";
+  for (int i = 0; i < nb_points; i++)
+  {
+    float x = i, y = -i;
+    unsigned char intensity = 7;
+    double z = 0.5 * i;
+    content.append(reinterpret_cast<const char*>(&x), sizeof(x));
+    content.append(reinterpret_cast<const char*>(&intensity), sizeof(intensity));
+    content.append(reinterpret_cast<const char*>(&y), sizeof(y));
+    content.append(reinterpret_cast<const char*>(&z), sizeof(z));
+  }
+  std::string filename = getTestFile("binary.ply");
+  writeFile(filename, content);
+
+  CloudStreamReader reader;
+  ASSERT_TRUE(reader.open(filename));
+  EXPECT_EQ(reader.getNbPoints(), 10u);
+  std::vector<float> xyz;
+  EXPECT_EQ(reader.readChunk(xyz, 4), 4u);
+  expectPoints(xyz, 0, 4);
+  EXPECT_EQ(reader.readChunk(xyz, 4), 4u);
+  expectPoints(xyz, 4, 4);
+  EXPECT_EQ(reader.readChunk(xyz, 4), 2u);
+  expectPoints(xyz, 8, 2);
+  EXPECT_EQ(reader.readChunk(xyz, 4), 0u);
+  std::remove(filename.c_str());
+}
+
+TEST(CloudStreamReader, readsAsciiPCD)
+{
+  std::string filename = getTestFile("ascii.pcd");
+  writeFile(filename, "# .PCD v0.7\nVERSION 0.7\nFIELDS intensity x y z\nSIZE 4 4 4 4\n"
+                      "TYPE F F F F\nCOUNT 1 1 1 1\nWIDTH 3\nHEIGHT 1\nPOINTS 3\nDATA ascii\n"
+                      "9 0 0 0\n9 1 -1 0.5\n9 2 -2 1.0\n");
+
+  CloudStreamReader reader;
+  ASSERT_TRUE(reader.open(filename));
+  std::vector<float> xyz;
+  EXPECT_EQ(reader.readChunk(xyz, 100), 3u);
+  expectPoints(xyz, 0, 3);
+  std::remove(filename.c_str());
+}
+
+TEST(CloudStreamReader, stopsAtTruncatedFile)
+{
+  std::string content = "ply\nformat binary_little_endian 1.0\nelement vertex 5\n"
+                        "property float x\nproperty float y\nproperty float z\nend_header\n";
+  for (int i = 0; i < 2; i++)
+  {
+    float point[3] = {(float)i, (float)-i, 0.5f * i};
+    content.append(reinterpret_cast<const char*>(point), sizeof(point));
+  }
+  std::string filename = getTestFile("truncated.ply");
+  writeFile(filename, content);
+
+  CloudStreamReader reader;
+  ASSERT_TRUE(reader.open(filename));
+  std::vector<float> xyz;
+  EXPECT_EQ(reader.readChunk(xyz, 100), 2u);
+  expectPoints(xyz, 0, 2);
+  EXPECT_EQ(reader.getNbPoints(), 2u);
+  EXPECT_EQ(reader.readChunk(xyz, 100), 0u);
+  std::remove(filename.c_str());
+}
+
+TEST(CloudStreamReader, rejectsUnsupportedFiles)
+{
+  CloudStreamReader reader;
+  EXPECT_FALSE(reader.open(getTestFile("missing.ply")));
+
+  std::string filename = getTestFile("integer.ply");
+  writeFile(filename, "ply\nformat ascii 1.0\nelement vertex 1\nproperty int x\n"
+                      "property int y\nproperty int z\nend_header\n1 2 3\n");
+  EXPECT_FALSE(reader.open(filename));
+  std::remove(filename.c_str());
+
+  filename = getTestFile("cloud.xyz");
+  writeFile(filename, "1 2 3\n");
+  EXPECT_FALSE(reader.open(filename));
+  std::remove(filename.c_str());
+}
+
+TEST(TextCloudReader, parsesNumbersLikeStrtod)
+{
+  const char* numbers[] = {"0", "-12.5", "3.14159265358979", "1e-7", "-2.5E+3", "123456789012345678901234", "7.0e-300"};
+  for (size_t k = 0; k < sizeof(numbers) / sizeof(numbers[0]); k++)
+  {
+    const char* begin = numbers[k];
+    const char* end = begin + std::string(numbers[k]).size();
+    double value;
+    ASSERT_TRUE(parseDouble(begin, end, value)) << numbers[k];
+    EXPECT_EQ(value, std::strtod(numbers[k], NULL)) << numbers[k];
+    EXPECT_EQ(begin, end);
+  }
+
+  const char* text = "x1";
+  const char* begin = text;
+  double value;
+  EXPECT_FALSE(parseDouble(begin, text + 2, value));
+  EXPECT_EQ(begin, text);
+}
+
+TEST(TextCloudReader, readsCsvAndVtk)
+{
+  std::string filename = getTestFile("cloud.csv");
+  writeFile(filename, "x,y,z\n0,0,0\n1,-1,0.5\n# comment\n2 -2 1.0\n");
+  pcl::PointCloud<pcl::PointXYZ> cloud;
+  ASSERT_TRUE(readTextCloud(filename, cloud));
+  ASSERT_EQ(cloud.size(), 3u);
+  for (size_t i = 0; i < cloud.size(); i++)
+  {
+    EXPECT_FLOAT_EQ(cloud.points[i].x, i);
+    EXPECT_FLOAT_EQ(cloud.points[i].y, -(float)i);
+    EXPECT_FLOAT_EQ(cloud.points[i].z, 0.5 * i);
+  }
+  std::remove(filename.c_str());
+
+  filename = getTestFile("cloud.vtk");
+  writeFile(filename, "# vtk DataFile Version 3.0\ntest\nASCII\nDATASET POLYDATA\n"
+                      "POINTS 2 float\n0 0 0 1 -1\n0.5\n");
+  ASSERT_TRUE(readTextCloud(filename, cloud));
+  ASSERT_EQ(cloud.size(), 2u);
+  EXPECT_FLOAT_EQ(cloud.points[1].x, 1.0);
+  EXPECT_FLOAT_EQ(cloud.points[1].y, -1.0);
+  EXPECT_FLOAT_EQ(cloud.points[1].z, 0.5);
+  std::remove(filename.c_str());
+}
+
+TEST(TextCloudReader, readsTableRows)
+{
+  std::string filename = getTestFile("table.txt");
+  writeFile(filename, "# t x y\n1, 2, 3\n4\t5\t6\n7 8\n9 a 10\n11 12 13\n");
+  std::vector<double> values;
+  ASSERT_TRUE(readTextTable(filename, 3, values));
+  ASSERT_EQ(values.size(), 9u);
+  EXPECT_EQ(values[0], 1.0);
+  EXPECT_EQ(values[5], 6.0);
+  EXPECT_EQ(values[8], 13.0);
+  std::remove(filename.c_str());
+}
@@ -0,0 +1,93 @@
+// Quantized clouds (aligned clouds memory)
+// Run: catkin run_tests aicp_core
+
+#include <gtest/gtest.h>
+
+#include <cmath>
+#include <limits>
+
+#include "aicp_utils/compactCloud.hpp"
+
+// Largest coordinate error between the points of a and b (same order)
+static float getMaxError(const pcl::PointCloud<pcl::PointXYZ>& a, const pcl::PointCloud<pcl::PointXYZ>& b)
+{
+  float max_error = 0.0;
+  for (size_t i = 0; i < a.size(); i++)
+  {
+    max_error = std::max(max_error, std::fabs(a.points[i].x - b.points[i].x));
+    max_error = std::max(max_error, std::fabs(a.points[i].y - b.points[i].y));
+    max_error = std::max(max_error, std::fabs(a.points[i].z - b.points[i].z));
+  }
+  return max_error;
+}
+
+TEST(CompactCloud, roundTripWithinHalfResolution)
+{
+  pcl::PointCloud<pcl::PointXYZ> cloud, decoded;
+  for (int i = 0; i < 1000; i++)
+    cloud.push_back(pcl::PointXYZ(10.0 + 0.0137 * i, -5.0 + 0.0071 * i, 0.5 * std::sin(0.1 * i)));
+  Eigen::Vector3f origin (12.0, -2.0, 0.0);
+
+  CompactCloud compact;
+  compact.encode(cloud, origin, 0.002);
+  EXPECT_FLOAT_EQ(compact.getResolution(), 0.002);
+  ASSERT_EQ(compact.size(), cloud.size());
+  EXPECT_EQ(compact.getMemoryUsage(), 6 * cloud.size());
+
+  compact.decode(decoded);
+  ASSERT_EQ(decoded.size(), cloud.size());
+  EXPECT_LE(getMaxError(cloud, decoded), 0.5 * compact.getResolution() + 1e-5);
+}
+
+TEST(CompactCloud, coarserStepBeyondQuantizationRange)
+{
+  // 32767 steps of 2 mm: +/- 65 m around origin, cloud spans +/- 500 m
+  pcl::PointCloud<pcl::PointXYZ> cloud, decoded;
+  for (int i = -50; i <= 50; i++)
+    cloud.push_back(pcl::PointXYZ(10.0 * i, -3.3 * i, 0.1 * i));
+
+  CompactCloud compact;
+  compact.encode(cloud, Eigen::Vector3f::Zero(), 0.002);
+  EXPECT_NEAR(compact.getResolution(), 500.0 / std::numeric_limits<int16_t>::max(), 1e-6);
+
+  compact.decode(decoded);
+  ASSERT_EQ(decoded.size(), cloud.size());
+  EXPECT_LE(getMaxError(cloud, decoded), 0.5 * compact.getResolution() + 1e-4);
+  // Farthest points not clamped
+  EXPECT_NEAR(decoded.points.front().x, -500.0, compact.getResolution());
+  EXPECT_NEAR(decoded.points.back().x, 500.0, compact.getResolution());
+}
+
+TEST(CompactCloud, emptyAndNonFiniteInput)
+{
+  pcl::PointCloud<pcl::PointXYZ> cloud, decoded;
+  CompactCloud compact;
+  compact.encode(cloud, Eigen::Vector3f::Zero());
+  EXPECT_TRUE(compact.empty());
+  compact.decode(decoded);
+  EXPECT_EQ(decoded.size(), 0u);
+
+  const float nan = std::numeric_limits<float>::quiet_NaN();
+  const float inf = std::numeric_limits<float>::infinity();
+  cloud.push_back(pcl::PointXYZ(nan, 0.0, 0.0));
+  cloud.push_back(pcl::PointXYZ(1.0, 2.0, 3.0));
+  cloud.push_back(pcl::PointXYZ(0.0, inf, 0.0));
+  cloud.push_back(pcl::PointXYZ(0.0, 0.0, -inf));
+  compact.encode(cloud, Eigen::Vector3f::Zero(), 0.01);
+  ASSERT_EQ(compact.size(), 1u);
+  EXPECT_FLOAT_EQ(compact.getResolution(), 0.01);
+
+  compact.decode(decoded);
+  ASSERT_EQ(decoded.size(), 1u);
+  EXPECT_NEAR(decoded.points[0].x, 1.0, 0.005);
+  EXPECT_NEAR(decoded.points[0].y, 2.0, 0.005);
+  EXPECT_NEAR(decoded.points[0].z, 3.0, 0.005);
+  EXPECT_TRUE(decoded.is_dense);
+
+  // Only non-finite points: nothing kept, usable resolution
+  pcl::PointCloud<pcl::PointXYZ> invalid;
+  invalid.push_back(pcl::PointXYZ(nan, nan, nan));
+  compact.encode(invalid, Eigen::Vector3f::Zero(), 0.0);
+  EXPECT_TRUE(compact.empty());
+  EXPECT_GT(compact.getResolution(), 0.0);
+}
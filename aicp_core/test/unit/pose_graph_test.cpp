@@ -0,0 +1,91 @@
+// Pose graph optimization after loop closures
+// Run: catkin run_tests aicp_core
+
+#include <gtest/gtest.h>
+
+#include <cmath>
+
+#include "aicp_registration/pose_graph.hpp"
+
+using namespace aicp;
+
+static Eigen::Isometry3d makePose(double x, double y, double yaw)
+{
+  Eigen::Isometry3d pose = Eigen::Isometry3d::Identity();
+  pose.translation() = Eigen::Vector3d(x, y, 0.0);
+  pose.linear() = Eigen::AngleAxisd(yaw, Eigen::Vector3d::UnitZ()).toRotationMatrix();
+  return pose;
+}
+
+TEST(PoseGraph, errorAndExpmapConsistent)
+{
+  Eigen::Isometry3d from = makePose(1.0, 2.0, 0.3);
+  Eigen::Isometry3d to = makePose(-0.5, 1.0, 1.2);
+  EXPECT_LT(PoseGraph::computeError(from.inverse() * to, from, to).norm(), 1e-9);
+
+  PoseGraph::Vector6d delta;
+  delta << 0.1, -0.2, 0.05, 0.01, -0.02, 0.3;
+  PoseGraph::Vector6d error = PoseGraph::computeError(Eigen::Isometry3d::Identity(), from,
+                                                      from * PoseGraph::expmap(delta));
+  EXPECT_LT((error - delta).norm(), 1e-9);
+}
+
+TEST(PoseGraph, loopClosureCorrectsDrift)
+{
+  // Square of side 4 m: odometry drifts in yaw, loop closure back to the first node
+  const int nb_nodes = 16;
+  const double step = 1.0;
+  const double drift = 0.02; // rad per step
+  PoseGraph graph;
+  PoseGraph::InformationMatrix information = PoseGraph::InformationMatrix::Identity();
+
+  std::vector<Eigen::Isometry3d, Eigen::aligned_allocator<Eigen::Isometry3d> > truth;
+  Eigen::Isometry3d true_pose = Eigen::Isometry3d::Identity();
+  Eigen::Isometry3d odom_pose = Eigen::Isometry3d::Identity();
+  graph.addNode(odom_pose);
+  truth.push_back(true_pose);
+  for (int i = 1; i < nb_nodes; i++)
+  {
+    Eigen::Isometry3d motion = makePose(step, 0.0, (i % 4 == 0) ? M_PI / 2.0 : 0.0);
+    Eigen::Isometry3d measured = motion * makePose(0.0, 0.0, drift);
+    true_pose = true_pose * motion;
+    odom_pose = odom_pose * measured;
+    int id = graph.addNode(odom_pose);
+    graph.addEdge(id - 1, id, measured, information, PoseGraph::ODOMETRY);
+    truth.push_back(true_pose);
+  }
+  // Last node is one step (and a turn) before the first one
+  Eigen::Isometry3d closure = truth[nb_nodes - 1].inverse() * truth[0];
+  graph.addEdge(nb_nodes - 1, 0, closure, 100.0 * information, PoseGraph::LOOP_CLOSURE);
+  EXPECT_EQ(graph.getNbLoopClosures(), 1);
+  EXPECT_EQ(graph.getNbEdges(), nb_nodes);
+
+  double error_before = PoseGraph::computeError(closure, graph.getPose(nb_nodes - 1), graph.getPose(0)).norm();
+  std::vector<int> updated;
+  int iterations = graph.optimize(1, 20, updated);
+  double error_after = PoseGraph::computeError(closure, graph.getPose(nb_nodes - 1), graph.getPose(0)).norm();
+
+  EXPECT_GT(iterations, 0);
+  EXPECT_LT(error_after, 0.1 * error_before);
+  // First node fixed, drifted ones moved
+  EXPECT_LT(PoseGraph::computeError(Eigen::Isometry3d::Identity(), graph.getPose(0), truth[0]).norm(), 1e-12);
+  EXPECT_FALSE(updated.empty());
+  EXPECT_EQ(updated.back(), nb_nodes - 1);
+  for (size_t i = 0; i < updated.size(); i++)
+    EXPECT_GE(updated[i], 1);
+}
+
+TEST(PoseGraph, nothingToOptimizeWithAllNodesFixed)
+{
+  PoseGraph graph;
+  graph.addNode(Eigen::Isometry3d::Identity());
+  graph.addNode(makePose(1.0, 0.0, 0.0));
+  graph.addEdge(0, 1, makePose(1.0, 0.0, 0.0), PoseGraph::InformationMatrix::Identity(), PoseGraph::ODOMETRY);
+
+  std::vector<int> updated;
+  EXPECT_EQ(graph.optimize(2, 10, updated), 0);
+  EXPECT_TRUE(updated.empty());
+  // Consistent edge: poses kept
+  EXPECT_EQ(graph.optimize(1, 10, updated), 1);
+  EXPECT_TRUE(updated.empty());
+}
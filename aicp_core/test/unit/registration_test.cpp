@@ -0,0 +1,91 @@
+// Registration of synthetic clouds with the shipped ICP chains
+// Run: catkin run_tests aicp_core
+
+#include <gtest/gtest.h>
+
+#include <pcl/common/transforms.h>
+
+#include "aicp_registration/registration.hpp"
+
+using namespace aicp;
+
+// Floor and two walls (corner of a room) sampled on a grid: all degrees of freedom constrained
+static void makeCorner(pcl::PointCloud<pcl::PointXYZ>& cloud, float size = 4.0, float step = 0.05)
+{
+  cloud.clear();
+  for (float u = 0.0; u < size; u += step)
+  {
+    for (float v = 0.0; v < size; v += step)
+    {
+      cloud.push_back(pcl::PointXYZ(u, v, 0.0));
+      cloud.push_back(pcl::PointXYZ(u, 0.0, v));
+      cloud.push_back(pcl::PointXYZ(0.0, u, v));
+    }
+  }
+}
+
+static RegistrationParams getDefaultParams()
+{
+  RegistrationParams params;
+  params.type = "Pointmatcher";
+  params.pointmatcher.configFileName = AICP_TEST_CONFIG_DIR "/icp/icp_autotuned.yaml";
+  return params;
+}
+
+TEST(PointmatcherRegistration, registersXYZCloudsWithDefaultChain)
+{
+  pcl::PointCloud<pcl::PointXYZ> reference, reading;
+  makeCorner(reference);
+  Eigen::Affine3f motion = Eigen::Translation3f(0.05, -0.04, 0.03) *
+                           Eigen::AngleAxisf(1.0 * M_PI / 180.0, Eigen::Vector3f::UnitZ());
+  pcl::transformPointCloud(reference, reading, motion);
+
+  // Point-to-plane chain: reference normals estimated by its reference filters
+  std::unique_ptr<AbstractRegistrator> registrator = create_registrator(getDefaultParams());
+  ASSERT_TRUE(registrator != NULL);
+  Eigen::Matrix4f T;
+  registrator->registerClouds(reference, reading, T);
+
+  Eigen::Matrix4f error = T * motion.matrix();
+  EXPECT_LT(error.topRightCorner<3,1>().norm(), 0.01);
+  EXPECT_LT(Eigen::AngleAxisf(Eigen::Matrix3f(error.topLeftCorner<3,3>())).angle(), 0.2 * M_PI / 180.0);
+}
+
+TEST(PointmatcherRegistration, reusesReferenceOfSameId)
+{
+  pcl::PointCloud<pcl::PointXYZ> reference, reading;
+  makeCorner(reference);
+  Eigen::Affine3f motion (Eigen::Translation3f(-0.03, 0.02, 0.0));
+  pcl::transformPointCloud(reference, reading, motion);
+
+  std::unique_ptr<AbstractRegistrator> registrator = create_registrator(getDefaultParams());
+  registrator->setReference(reference, 1);
+  Eigen::Matrix4f T_first, T_second;
+  registrator->registerReading(reading, T_first);
+  // Same id: filtered reference and matcher kept
+  registrator->setReference(reference, 1);
+  registrator->registerReading(reading, T_second);
+
+  EXPECT_LT((T_first * motion.matrix()).topRightCorner<3,1>().norm(), 0.01);
+  EXPECT_LT((T_second * motion.matrix()).topRightCorner<3,1>().norm(), 0.01);
+}
+
+TEST(PointmatcherRegistration, registersWithPyramid)
+{
+  pcl::PointCloud<pcl::PointXYZ> reference, reading;
+  makeCorner(reference);
+  Eigen::Affine3f motion = Eigen::Translation3f(0.15, 0.1, -0.05) *
+                           Eigen::AngleAxisf(2.0 * M_PI / 180.0, Eigen::Vector3f::UnitZ());
+  pcl::transformPointCloud(reference, reading, motion);
+
+  // Coarse level: reading and reference down-sampled to 0.3 m voxels
+  RegistrationParams params = getDefaultParams();
+  params.pointmatcher.pyramidLeafSizes.push_back(0.3);
+  PointmatcherRegistration registrator (params);
+  Eigen::Matrix4f T;
+  registrator.registerClouds(reference, reading, T);
+
+  EXPECT_GT(registrator.getNbCoarseIterations(), 0);
+  Eigen::Matrix4f error = T * motion.matrix();
+  EXPECT_LT(error.topRightCorner<3,1>().norm(), 0.01);
+}
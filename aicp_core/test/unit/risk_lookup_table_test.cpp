@@ -0,0 +1,96 @@
+// Risk lookup table sampled from a classifier
+// Run: catkin run_tests aicp_core
+
+#include <gtest/gtest.h>
+
+#include <cstdio>
+
+#include "aicp_classification/risk_lookup_table.hpp"
+
+using namespace aicp;
+
+// Bilinear in (overlap, alignability): reproduced exactly by the interpolation
+static float getTestRisk(float overlap, float alignability)
+{
+  return 1.0 - 0.008 * overlap - 0.002 * alignability + 0.00005 * overlap * alignability;
+}
+
+static void buildTestTable(RiskLookupTable& table)
+{
+  RowMatrixXf samples;
+  table.getGridSamples(samples);
+  Eigen::VectorXd values (samples.rows());
+  for (int k = 0; k < samples.rows(); k++)
+    values(k) = getTestRisk(samples(k, 0), samples(k, 1));
+  table.setValues(values);
+}
+
+TEST(RiskLookupTable, interpolatesBetweenNodes)
+{
+  RiskLookupTable table (2.5);
+  EXPECT_FALSE(table.isValid());
+  buildTestTable(table);
+  ASSERT_TRUE(table.isValid());
+
+  const float inputs[][2] = {{0.0, 0.0}, {37.3, 61.9}, {99.9, 0.4}, {100.0, 100.0}, {51.25, 12.5}};
+  for (size_t k = 0; k < sizeof(inputs) / sizeof(inputs[0]); k++)
+    EXPECT_NEAR(table.lookup(inputs[k][0], inputs[k][1]), getTestRisk(inputs[k][0], inputs[k][1]), 1e-5);
+  // Inputs clamped to [0, 100]
+  EXPECT_NEAR(table.lookup(-10.0, 120.0), getTestRisk(0.0, 100.0), 1e-5);
+}
+
+TEST(RiskLookupTable, boundsOverAlignability)
+{
+  RiskLookupTable table (2.5);
+  buildTestTable(table);
+
+  // Risk is linear in alignability: extrema at 0 and 100
+  float overlap = 42.0;
+  float min_risk, max_risk;
+  table.getRiskBounds(overlap, min_risk, max_risk);
+  float a = getTestRisk(overlap, 0.0), b = getTestRisk(overlap, 100.0);
+  EXPECT_NEAR(min_risk, std::min(a, b), 1e-5);
+  EXPECT_NEAR(max_risk, std::max(a, b), 1e-5);
+  for (float alignability = 0.0; alignability <= 100.0; alignability += 7.0)
+  {
+    float risk = table.lookup(overlap, alignability);
+    EXPECT_GE(risk, min_risk - 1e-6);
+    EXPECT_LE(risk, max_risk + 1e-6);
+  }
+}
+
+TEST(RiskLookupTable, invalidUntilBuilt)
+{
+  RiskLookupTable table;
+  EXPECT_FALSE(table.isValid());
+  RiskLookupTable no_grid (0.0);
+  EXPECT_FALSE(no_grid.isValid());
+  no_grid.setValues(Eigen::VectorXd());
+  EXPECT_FALSE(no_grid.isValid());
+
+  // Wrong number of values: rejected
+  RiskLookupTable grid (50.0);
+  grid.setValues(Eigen::VectorXd::Zero(4));
+  EXPECT_FALSE(grid.isValid());
+  grid.setValues(Eigen::VectorXd::Zero(9));
+  EXPECT_TRUE(grid.isValid());
+}
+
+TEST(RiskLookupTable, loadsTableOfSameModelOnly)
+{
+  RiskLookupTable table (5.0);
+  buildTestTable(table);
+  std::string filename = std::string(P_tmpdir) + "/aicp_risk_lookup_table_test.lut";
+  ASSERT_TRUE(table.save(filename, 1234));
+
+  RiskLookupTable loaded (5.0);
+  EXPECT_FALSE(loaded.load(filename, 4321));
+  EXPECT_FALSE(loaded.isValid());
+  ASSERT_TRUE(loaded.load(filename, 1234));
+  EXPECT_FLOAT_EQ(loaded.lookup(33.0, 66.0), table.lookup(33.0, 66.0));
+
+  // Other grid resolution
+  RiskLookupTable other (2.5);
+  EXPECT_FALSE(other.load(filename, 1234));
+  std::remove(filename.c_str());
+}
@@ -0,0 +1,209 @@
+// Queues between the sensor callbacks and the pipeline stages
+// Run: catkin run_tests aicp_core
+
+#include <gtest/gtest.h>
+
+#include <thread>
+#include <vector>
+
+#include "aicp_utils/boundedQueue.hpp"
+#include "aicp_utils/workQueue.hpp"
+
+TEST(RingBuffer, keepsOrderAndCapacity)
+{
+  RingBuffer<int> ring (3);
+  EXPECT_TRUE(ring.tryPush(1));
+  EXPECT_TRUE(ring.tryPush(2));
+  EXPECT_TRUE(ring.tryPush(3));
+  EXPECT_FALSE(ring.tryPush(4));
+  EXPECT_EQ(ring.size(), 3u);
+
+  int item;
+  for (int i = 1; i <= 3; i++)
+  {
+    ASSERT_TRUE(ring.tryPop(item));
+    EXPECT_EQ(item, i);
+  }
+  EXPECT_FALSE(ring.tryPop(item));
+}
+
+TEST(RingBuffer, deliversEachItemOnceAcrossThreads)
+{
+  const int nb_producers = 4;
+  const int nb_items = 10000; // per producer
+  RingBuffer<int> ring (64);
+  std::vector<int> received (nb_producers * nb_items, 0);
+  std::atomic<int> nb_received (0);
+
+  std::vector<std::thread> threads;
+  for (int p = 0; p < nb_producers; p++)
+  {
+    threads.push_back(std::thread([&, p]() {
+      for (int i = 0; i < nb_items; i++)
+        while (!ring.tryPush(p * nb_items + i))
+          std::this_thread::yield();
+    }));
+  }
+  for (int c = 0; c < 2; c++)
+  {
+    threads.push_back(std::thread([&]() {
+      int item;
+      while (nb_received.load() < nb_producers * nb_items)
+      {
+        if (ring.tryPop(item))
+        {
+          received[item] ++;
+          nb_received ++;
+        }
+        else
+          std::this_thread::yield();
+      }
+    }));
+  }
+  for (size_t i = 0; i < threads.size(); i++)
+    threads[i].join();
+
+  for (size_t i = 0; i < received.size(); i++)
+    ASSERT_EQ(received[i], 1) << "item " << i;
+}
+
+TEST(WorkQueue, keepsProducerOrder)
+{
+  WorkQueue<int> queue (100, QueuePolicy::DROP_NEWEST);
+  std::thread producer ([&]() {
+    for (int i = 0; i < 50; i++)
+      queue.push(i);
+  });
+
+  int item;
+  for (int i = 0; i < 50; i++)
+  {
+    ASSERT_TRUE(queue.pop(item, std::chrono::seconds(1)));
+    EXPECT_EQ(item, i);
+  }
+  producer.join();
+  EXPECT_FALSE(queue.pop(item, std::chrono::milliseconds(10)));
+
+  WorkQueue<int>::Stats stats = queue.getStats();
+  EXPECT_EQ(stats.pushed, 50u);
+  EXPECT_EQ(stats.popped, 50u);
+  EXPECT_EQ(stats.dropped, 0u);
+}
+
+TEST(WorkQueue, dropsOldestWhenFull)
+{
+  WorkQueue<int> queue (3, QueuePolicy::DROP_OLDEST);
+  for (int i = 0; i < 3; i++)
+    EXPECT_EQ(queue.push(i), 0u);
+  EXPECT_EQ(queue.push(3), 1u);
+
+  int item;
+  for (int i = 1; i <= 3; i++)
+  {
+    ASSERT_TRUE(queue.pop(item, std::chrono::milliseconds(10)));
+    EXPECT_EQ(item, i);
+  }
+  EXPECT_EQ(queue.getStats().dropped, 1u);
+}
+
+TEST(WorkQueue, dropsNewestWhenFull)
+{
+  WorkQueue<int> queue (3, QueuePolicy::DROP_NEWEST);
+  for (int i = 0; i < 3; i++)
+    EXPECT_EQ(queue.push(i), 0u);
+  EXPECT_EQ(queue.push(3), 1u);
+
+  int item;
+  for (int i = 0; i < 3; i++)
+  {
+    ASSERT_TRUE(queue.pop(item, std::chrono::milliseconds(10)));
+    EXPECT_EQ(item, i);
+  }
+  EXPECT_FALSE(queue.pop(item, std::chrono::milliseconds(10)));
+}
+
+TEST(WorkQueue, coalescesToLatest)
+{
+  WorkQueue<int> queue (3, QueuePolicy::COALESCE);
+  queue.push(0);
+  queue.push(1);
+  EXPECT_EQ(queue.push(2), 1u);
+  EXPECT_EQ(queue.size(), 1u);
+
+  int item;
+  ASSERT_TRUE(queue.pop(item, std::chrono::milliseconds(10)));
+  EXPECT_EQ(item, 2);
+}
+
+TEST(WorkQueue, popWakesOnPush)
+{
+  WorkQueue<int> queue (3, QueuePolicy::DROP_OLDEST);
+  std::thread producer ([&]() {
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    queue.push(7);
+  });
+
+  int item = 0;
+  EXPECT_TRUE(queue.pop(item, std::chrono::seconds(5)));
+  EXPECT_EQ(item, 7);
+  producer.join();
+}
+
+TEST(BoundedQueue, pushBlocksWhileFull)
+{
+  BoundedQueue<int> queue (2);
+  ASSERT_TRUE(queue.push(0));
+  ASSERT_TRUE(queue.push(1));
+
+  std::atomic<bool> pushed (false);
+  std::thread producer ([&]() {
+    queue.push(2);
+    pushed = true;
+  });
+  std::this_thread::sleep_for(std::chrono::milliseconds(50));
+  EXPECT_FALSE(pushed.load());
+
+  int item;
+  ASSERT_TRUE(queue.pop(item));
+  EXPECT_EQ(item, 0);
+  producer.join();
+  EXPECT_TRUE(pushed.load());
+  ASSERT_TRUE(queue.pop(item));
+  EXPECT_EQ(item, 1);
+  ASSERT_TRUE(queue.pop(item));
+  EXPECT_EQ(item, 2);
+}
+
+TEST(BoundedQueue, closeWakesBlockedPop)
+{
+  BoundedQueue<int> queue (2);
+  std::atomic<int> result (-1);
+  std::thread consumer ([&]() {
+    int item;
+    result = queue.pop(item) ? 1 : 0;
+  });
+  std::this_thread::sleep_for(std::chrono::milliseconds(50));
+  queue.close();
+  consumer.join();
+  EXPECT_EQ(result.load(), 0);
+}
+
+TEST(BoundedQueue, closeWakesBlockedPush)
+{
+  BoundedQueue<int> queue (1);
+  ASSERT_TRUE(queue.push(0));
+  std::atomic<int> result (-1);
+  std::thread producer ([&]() {
+    result = queue.push(1) ? 1 : 0;
+  });
+  std::this_thread::sleep_for(std::chrono::milliseconds(50));
+  queue.close();
+  producer.join();
+  EXPECT_EQ(result.load(), 0);
+
+  // Remaining items still popped after close
+  int item;
+  ASSERT_TRUE(queue.pop(item));
+  EXPECT_EQ(item, 0);
+  EXPECT_FALSE(queue.pop(item));
+}
@@ -2,7 +2,9 @@
 
 #include <sstream>      // std::stringstream
 
-#include "cloud_accumulate/cloud_accumulate.hpp"
+#include <lcm/lcm-cpp.hpp>
+
+#include "aicp_lcm/planar_lidar_accumulator.hpp"
 #include <pcl/io/pcd_io.h>
 #include <pcl/point_types.h>
 #include <pcl/io/vtk_io.h>
@@ -23,18 +25,18 @@ struct AppConfig
 class App{
   public:
     App(boost::shared_ptr<lcm::LCM> &lcm_, 
-        CloudAccumulateConfig ca_cfg_, AppConfig app_cfg);
+        aicp::PlanarLidarAccumulatorConfig ca_cfg_, AppConfig app_cfg);
     
     ~App(){
     }        
     
-    CloudAccumulateConfig ca_cfg_;
+    aicp::PlanarLidarAccumulatorConfig ca_cfg_;
     AppConfig app_cfg_;
     
     boost::shared_ptr<lcm::LCM> lcm_;
-    CloudAccumulate* accu_;
-
-    pronto_vis* pc_vis_;
+    aicp::PlanarLidarAccumulator* accu_;
+    BotParam* botparam_;
+    BotFrames* botframes_;
     
     void planarLidarHandler(const lcm::ReceiveBuffer* rbuf, 
                       const std::string& channel, const  bot_core::planar_lidar_t* msg);   
@@ -44,12 +46,15 @@ private:
 };
 
 App::App(boost::shared_ptr< lcm::LCM >& lcm_, 
-         CloudAccumulateConfig ca_cfg_, AppConfig app_cfg_) : lcm_(lcm_), 
+         aicp::PlanarLidarAccumulatorConfig ca_cfg_, AppConfig app_cfg_) : lcm_(lcm_), 
          ca_cfg_(ca_cfg_),
          app_cfg_(app_cfg_){
-  accu_ = new CloudAccumulate(lcm_, ca_cfg_);
+  do {
+    botparam_ = bot_param_new_from_server(lcm_->getUnderlyingLCM(), 0);
+  } while (botparam_ == NULL);
+  botframes_ = bot_frames_get_global(lcm_->getUnderlyingLCM(), botparam_);
+  accu_ = new aicp::PlanarLidarAccumulator(botparam_, botframes_, ca_cfg_);
   std::cout << "Accumulating map at launch\n";  
-  pc_vis_ = new pronto_vis( lcm_->getUnderlyingLCM() );
 }
 
 void App::planarLidarHandler(const lcm::ReceiveBuffer* rbuf, const std::string& channel, const  bot_core::planar_lidar_t* msg){
@@ -64,11 +69,7 @@ void App::planarLidarHandler(const lcm::ReceiveBuffer* rbuf, const std::string&
     
     if ( accu_->getFinished()  ){//finished_accumating?
 
-      pcl::PointCloud<pcl::PointXYZRGB>::Ptr cloud (new pcl::PointCloud<pcl::PointXYZRGB> ());
-      pc_vis_->convertCloudProntoToPcl(*accu_->getCloud(), *cloud);
-      // cloud = accu_->getCloud();
-      cloud->width = cloud->points.size();
-      cloud->height = 1;
+      pcl::PointCloud<pcl::PointXYZ>::Ptr cloud = accu_->releaseCloud();
 
       std::stringstream message;
       message << "Processing cloud with " << cloud->points.size()
@@ -101,13 +102,6 @@ void App::planarLidarHandler(const lcm::ReceiveBuffer* rbuf, const std::string&
         pcl::io::saveVTKFile (vtk_fname.str(), *cloud_output);
       }
 
-      // convert to pronto::PointCloud
-      pronto::PointCloud* prCloud (new pronto::PointCloud);
-      pc_vis_->convertCloudPclToPronto(*cloud, *prCloud);
-
-      // accu_->publishCloud(cloud);
-      accu_->publishCloud(prCloud);
-
       exit(-1);
     }
 }
@@ -118,7 +112,7 @@ int main(int argc, char ** argv) {
     homedir = getpwuid(getuid())->pw_dir;
   }
 
-  CloudAccumulateConfig ca_cfg;
+  aicp::PlanarLidarAccumulatorConfig ca_cfg;
   ca_cfg.lidar_channel ="MULTISENSE_SCAN";
   ca_cfg.batch_size = 240; // about 1 sweep
   ca_cfg.min_range = 0.0;//1.85; // remove all the short range points
@@ -5,7 +5,7 @@
 #include <lcmtypes/bot_core/pose_t.hpp>
 #include <lcmtypes/bot_core/rigid_transform_t.hpp>
 
-#include "cloud_accumulate/cloud_accumulate.hpp"
+#include "aicp_lcm/planar_lidar_accumulator.hpp"
 
 #include "aicp_registration/app.hpp"
 #include "aicp_registration/registration.hpp"
@@ -20,7 +20,7 @@ class AppLCM : public App {
 public:
     AppLCM(boost::shared_ptr<lcm::LCM> &lcm,
            const CommandLineConfig& cl_cfg,
-           CloudAccumulateConfig ca_cfg,
+           PlanarLidarAccumulatorConfig ca_cfg,
            RegistrationParams reg_params,
            OverlapParams overlap_params,
            ClassificationParams class_params);
@@ -37,6 +37,16 @@ public:
                           const std::string& channel,
                           const  bot_core::pose_t* msg);
 
+    // AICP_DIAGNOSTICS (double_array_t) values: readings, filter, assess and align times (s),
+    // queue size, pushed, dropped, mean and max latency (s), points in and out of the pre-filter,
+    // reference points, ICP iterations, inlier ratio, octree overlap, FOV overlap, alignability, risk,
+    // compute level (deadline mode), ICP residual median, 90 % quantile and max (m),
+    // ICP degeneracy (%), inverse condition number and number of degenerate directions,
+    // ICP coarse levels iterations, converged (adaptive termination) and warm start (motion model),
+    // memory bytes and objects of the graph (clouds), output map (points), prior map (points),
+    // octrees, visualized paths (poses, 0 here) and input queue (clouds), total memory bytes
+    void publishDiagnostics(int64_t utime);
+
     // Tool functions
     bot_core::pose_t getIsometry3dAsBotPose(Eigen::Isometry3d pose, int64_t utime);
     Eigen::Isometry3d getPoseAsIsometry3d(const bot_core::pose_t* pose);
@@ -45,12 +55,11 @@ public:
 
 private:
     boost::shared_ptr<lcm::LCM> lcm_;
-    // Used for: convertCloudProntoToPcl
-    pronto_vis* pc_vis_;
-    CloudAccumulate* accu_;
-    CloudAccumulateConfig ca_cfg_;
+    PlanarLidarAccumulator* accu_;
+    PlanarLidarAccumulatorConfig ca_cfg_;
     BotParam* botparam_;
     BotFrames* botframes_;
+    int64_t diagnostics_utime_; // last diagnostics publish
 
     int getTransWithMicroTime(BotFrames *bot_frames,
                              const char *from_frame,
@@ -0,0 +1,63 @@
+#pragma once
+
+#include <lcmtypes/bot_core/planar_lidar_t.hpp>
+
+#include <bot_param/param_client.h>
+#include <bot_frames/bot_frames.h>
+
+#include <pcl/point_cloud.h>
+#include <pcl/point_types.h>
+
+#include "aicp_utils/scanAccumulator.hpp"
+
+namespace aicp {
+
+struct PlanarLidarAccumulatorConfig
+{
+    int batch_size = 80;
+    double max_range = 30;
+    double min_range = 0.5;
+    std::string lidar_channel = "MULTISENSE_SCAN";
+    std::string inertial_frame = "local";
+    std::string lidar_frame = ""; // empty: coord_frame of the planar lidar on lidar_channel (bot_param)
+    // s, first to last beam of a scan (< 0: from the lidar frequency in bot_param, 0: no interpolation)
+    double scan_duration = -1.0;
+    double voxel_size = 0.0; // m, points merged into voxel centroids as scans arrive (0: raw points)
+};
+
+// Replaces MIT's CloudAccumulate: planar scans are projected (per-beam sin/cos tables),
+// moved to the inertial frame with the lidar pose interpolated over the scan and
+// appended to the batch (aicp_utils ScanAccumulator, shared with the ROS accumulator).
+class PlanarLidarAccumulator {
+public:
+    typedef pcl::PointCloud<pcl::PointXYZ> PointCloud;
+public:
+    PlanarLidarAccumulator(BotParam* botparam, BotFrames* botframes,
+                           const PlanarLidarAccumulatorConfig& config);
+
+    void processLidar(const bot_core::planar_lidar_t* msg);
+
+    uint16_t getCounter() const;
+    bool getFinished() const;
+    int64_t getFinishedTime() const;
+
+    const PointCloud& getCloud();
+    // Hands over the accumulated cloud (no copy), accumulation restarts in a new buffer
+    PointCloud::Ptr releaseCloud();
+    void clearCloud();
+
+private:
+    // Lidar frame and frequency of the planar lidar on lidar_channel (bot_param)
+    void readLidarParams();
+    // Inertial frame <- lidar frame at utime (false if not available)
+    bool getLidarPose(int64_t utime, Eigen::Isometry3d& pose);
+
+    PlanarLidarAccumulatorConfig config_;
+    BotParam* botparam_;
+    BotFrames* botframes_;
+    std::string lidar_frame_;
+    double lidar_frequency_; // Hz, full rotations (0: unknown)
+
+    ScanAccumulator accumulator_;
+};
+}
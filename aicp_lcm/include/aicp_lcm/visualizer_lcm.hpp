@@ -38,8 +38,15 @@ public:
                       int64_t utime);
 
     // Gets
-    const PathPoses& getPath()
-    {}
+    // Poses not kept
+    PathSnapshot getPath()
+    {
+        return PathSnapshot(new PathPoses());
+    }
+    bool getLastPose(Eigen::Isometry3d& pose)
+    {
+        return false;
+    }
 
 private:
     boost::shared_ptr<lcm::LCM> lcm_;
@@ -70,18 +70,41 @@ int main(int argc, char **argv){
     cl_cfg.working_mode = "robot"; // e.g. robot - POSE_BODY has been already corrected
                                    // or debug - apply previous transforms to POSE_BODY
     cl_cfg.failure_prediction_mode = FALSE; // compute Alignment Risk
+    cl_cfg.parallel_alignment_risk = FALSE;
     cl_cfg.reference_update_frequency = 5;
+    cl_cfg.pipelined_processing = false;
+    cl_cfg.loop_closure_detection = false;
+    cl_cfg.pose_graph_optimization = false;
+    cl_cfg.max_queue_size = 100;
+    cl_cfg.prior_map_max_match_distance = 1.0;
+    cl_cfg.max_map_points = 0;
+    cl_cfg.graph_memory_budget = 0;
+    cl_cfg.graph_resident_clouds = 10;
+    cl_cfg.graph_spill_file = "";
+    cl_cfg.graph_compact_resolution = 0.0;
+    cl_cfg.queue_policy = "drop_oldest";
+    cl_cfg.cycle_deadline = 0.0;
+    cl_cfg.diagnostics_rate = 1.0; // Hz, AICP_DIAGNOSTICS publishing (0: disabled)
+    cl_cfg.compressed_clouds_resolution = 0.0; // ROS visualizer only
+    cl_cfg.trace_file = ""; // Chrome trace JSON, written on SIGUSR1 and at exit (empty: no tracing)
+    cl_cfg.trace_dump_period = 0.0;
+    cl_cfg.replay_prefetch = 4;
+    cl_cfg.replay_real_time = false;
 
     cl_cfg.pose_body_channel = "POSE_BODY";
     cl_cfg.output_channel = "POSE_BODY_CORRECTED"; // Create new channel...
     cl_cfg.verbose = FALSE; // enable visualization for debug
+    cl_cfg.accumulator_voxel_size = 0.04; // accumulated cloud merged into voxels (0: raw points)
+    cl_cfg.log_level = "info";
+    cl_cfg.log_async = TRUE;
+    cl_cfg.debug_queue_size = 10;
+    cl_cfg.debug_binary = TRUE;
 
-    CloudAccumulateConfig ca_cfg;
+    aicp::PlanarLidarAccumulatorConfig ca_cfg;
     ca_cfg.batch_size = 80; // 240 is about 1 sweep at 5RPM // 80 is about 1 sweep at 15RPM
     ca_cfg.min_range = 0.50; // 1.85; // remove all the short range points
     ca_cfg.max_range = 15.0; // we can set up to 30 meters (guaranteed range)
     ca_cfg.lidar_channel ="MULTISENSE_SCAN";
-    //ca_cfg.check_local_to_scan_valid = FALSE;
 
     ConciseArgs parser(argc, argv, "aicp-lcm-online");
     parser.add(cl_cfg.registration_config_file, "cr", "registration_config_file", "Registration config file location");
@@ -93,11 +116,15 @@ int main(int argc, char **argv){
     parser.add(cl_cfg.pose_body_channel, "pc", "pose_body_channel", "Prior pose estimate");
     parser.add(cl_cfg.output_channel, "oc", "output_channel", "Corrected pose estimate");
     parser.add(cl_cfg.verbose, "v", "verbose", "Enable visualization to LCM for debug");
+    parser.add(cl_cfg.log_level, "ll", "log_level", "Log level: debug, info, warn or error");
+    parser.add(cl_cfg.trace_file, "tf", "trace_file", "Chrome trace of the processing spans (written on SIGUSR1 and at exit)");
+    parser.add(cl_cfg.trace_dump_period, "tp", "trace_dump_period", "Trace file also written every n seconds (0: disabled)");
 
     parser.add(ca_cfg.batch_size, "b", "batch_size", "Number of planar scans per 3D point cloud");
     parser.add(ca_cfg.min_range, "m", "min_range", "Min accepted lidar range");
     parser.add(ca_cfg.max_range, "M", "max_range", "Max accepted lidar range");
     parser.add(ca_cfg.lidar_channel, "l", "lidar_channel", "Input message e.g MULTISENSE_SCAN");
+    parser.add(cl_cfg.accumulator_voxel_size, "vx", "accumulator_voxel_size", "Voxel size of the accumulated cloud (0: raw points)");
     parser.parse();
 
     /*===================================
@@ -128,7 +155,6 @@ int main(int argc, char **argv){
     /*===================================
     =             Create LCM            =
     ===================================*/
-    // I'd rather use std::shared_ptr but cloud accumulator prevents it
     boost::shared_ptr<lcm::LCM> lcm(new lcm::LCM);
     if(!lcm->good()){
     std::cerr <<"ERROR: lcm is not good." <<std::endl;
@@ -1,15 +1,17 @@
 #include "aicp_lcm/app_lcm.hpp"
+#include "aicp_utils/logging.hpp"
+#include "aicp_utils/traceRecorder.hpp"
 
 namespace aicp {
 
 AppLCM::AppLCM(boost::shared_ptr<lcm::LCM> &lcm,
                const CommandLineConfig& cl_cfg,
-               CloudAccumulateConfig ca_cfg,
+               PlanarLidarAccumulatorConfig ca_cfg,
                RegistrationParams reg_params,
                OverlapParams overlap_params,
                ClassificationParams class_params) :
     App(cl_cfg, reg_params, overlap_params, class_params),
-    ca_cfg_(ca_cfg), lcm_(lcm)
+    ca_cfg_(ca_cfg), lcm_(lcm), diagnostics_utime_(0)
 {
     paramInit();
 
@@ -21,10 +23,12 @@ AppLCM::AppLCM(boost::shared_ptr<lcm::LCM> &lcm,
 
     // Data structure
     aligned_clouds_graph_ = new AlignedCloudsGraph();
-    // Accumulator
-    accu_ = new CloudAccumulate(lcm_, ca_cfg_, botparam_, botframes_);
-    // Used for: convertCloudProntoToPcl
-    pc_vis_ = new pronto_vis(lcm_->getUnderlyingLCM());
+    aligned_clouds_graph_->setMemoryBudget((size_t)cl_cfg_.graph_memory_budget * 1024 * 1024,
+                                           cl_cfg_.graph_resident_clouds, cl_cfg_.graph_spill_file,
+                                           cl_cfg_.graph_compact_resolution);
+    // Accumulator (cloud merged into voxels as scans arrive)
+    ca_cfg_.voxel_size = cl_cfg_.accumulator_voxel_size;
+    accu_ = new PlanarLidarAccumulator(botparam_, botframes_, ca_cfg_);
     // Visualizer
     vis_ = new LCMVisualizer(lcm_);
 
@@ -42,8 +46,11 @@ AppLCM::AppLCM(boost::shared_ptr<lcm::LCM> &lcm,
 
 void AppLCM::robotPoseHandler(const lcm::ReceiveBuffer* rbuf, const std::string& channel, const  bot_core::pose_t* msg){
 
+    ScopedSpan handler_span ("robotPoseHandler");
     Eigen::Isometry3d world_to_body;
+    ScopedSpan wait_span ("waitRobotStateMutex");
     std::unique_lock<std::mutex> lock(robot_state_mutex_);
+    wait_span.stop();
     {
         // Latest world -> body (pose prior)
         world_to_body_msg_ = getPoseAsIsometry3d(msg);
@@ -101,9 +108,63 @@ void AppLCM::robotPoseHandler(const lcm::ReceiveBuffer* rbuf, const std::string&
         }
     }
 
+    // Diagnostics at low rate (LCM thread, not the worker)
+    if (cl_cfg_.diagnostics_rate > 0.0 &&
+        msg->utime - diagnostics_utime_ >= 1E6 / cl_cfg_.diagnostics_rate)
+    {
+        diagnostics_utime_ = msg->utime;
+        publishDiagnostics(msg->utime);
+    }
+
     pose_initialized_ = TRUE;
 }
 
+void AppLCM::publishDiagnostics(int64_t utime)
+{
+    Diagnostics diagnostics = getDiagnostics();
+    bot_core::double_array_t msg_diagnostics;
+    msg_diagnostics.utime = utime;
+    msg_diagnostics.values.push_back(diagnostics.nb_readings);
+    msg_diagnostics.values.push_back(diagnostics.filter_time);
+    msg_diagnostics.values.push_back(diagnostics.assess_time);
+    msg_diagnostics.values.push_back(diagnostics.align_time);
+    msg_diagnostics.values.push_back(diagnostics.queue_size);
+    msg_diagnostics.values.push_back(diagnostics.queue_pushed);
+    msg_diagnostics.values.push_back(diagnostics.queue_dropped);
+    msg_diagnostics.values.push_back(diagnostics.queue_mean_latency);
+    msg_diagnostics.values.push_back(diagnostics.queue_max_latency);
+    msg_diagnostics.values.push_back(diagnostics.points_in);
+    msg_diagnostics.values.push_back(diagnostics.points_out);
+    msg_diagnostics.values.push_back(diagnostics.reference_points);
+    msg_diagnostics.values.push_back(diagnostics.icp_iterations);
+    msg_diagnostics.values.push_back(diagnostics.icp_inlier_ratio);
+    msg_diagnostics.values.push_back(diagnostics.octree_overlap);
+    msg_diagnostics.values.push_back(diagnostics.fov_overlap);
+    msg_diagnostics.values.push_back(diagnostics.alignability);
+    msg_diagnostics.values.push_back(diagnostics.risk);
+    msg_diagnostics.values.push_back(diagnostics.compute_level);
+    msg_diagnostics.values.push_back(diagnostics.icp_residual_median);
+    msg_diagnostics.values.push_back(diagnostics.icp_residual_p90);
+    msg_diagnostics.values.push_back(diagnostics.icp_residual_max);
+    msg_diagnostics.values.push_back(diagnostics.icp_degeneracy);
+    msg_diagnostics.values.push_back(diagnostics.icp_inverse_condition_number);
+    msg_diagnostics.values.push_back(diagnostics.icp_degenerate_directions);
+    msg_diagnostics.values.push_back(diagnostics.icp_coarse_iterations);
+    msg_diagnostics.values.push_back(diagnostics.icp_converged);
+    msg_diagnostics.values.push_back(diagnostics.icp_warm_start);
+    const App::MemoryReport& memory = diagnostics.memory;
+    const MemoryUsage* memory_usages[] = {&memory.graph, &memory.aligned_map, &memory.prior_map,
+                                          &memory.octrees, &memory.paths, &memory.queue};
+    for (size_t i = 0; i < sizeof(memory_usages) / sizeof(memory_usages[0]); i++)
+    {
+        msg_diagnostics.values.push_back(memory_usages[i]->bytes);
+        msg_diagnostics.values.push_back(memory_usages[i]->objects);
+    }
+    msg_diagnostics.values.push_back(memory.getTotalBytes());
+    msg_diagnostics.num_values = msg_diagnostics.values.size();
+    lcm_->publish("AICP_DIAGNOSTICS",&msg_diagnostics);
+}
+
 void AppLCM::planarLidarHandler(const lcm::ReceiveBuffer* rbuf,
                                 const std::string& channel,
                                 const bot_core::planar_lidar_t* msg)
@@ -112,6 +173,7 @@ void AppLCM::planarLidarHandler(const lcm::ReceiveBuffer* rbuf,
         cout << "[App LCM] Pose estimate not initialized, waiting for pose prior...\n";
         return;
     }
+    ScopedSpan handler_span ("planarLidarHandler");
 
     // Latest world -> body (pose prior)
     Eigen::Isometry3d world_to_body;
@@ -124,7 +186,7 @@ void AppLCM::planarLidarHandler(const lcm::ReceiveBuffer* rbuf,
     if (!clear_clouds_buffer_)
     {
         if ( accu_->getCounter() % ca_cfg_.batch_size == 0 ) {
-            cout << "[App LCM] " << accu_->getCounter() << " of " << ca_cfg_.batch_size << " scans collected." << endl;
+            AICP_LOG_DEBUG("App LCM", accu_->getCounter() << " of " << ca_cfg_.batch_size << " scans collected.");
         }
         accu_->processLidar(msg);
     }
@@ -133,7 +195,7 @@ void AppLCM::planarLidarHandler(const lcm::ReceiveBuffer* rbuf,
         {
             std::unique_lock<std::mutex> lock(cloud_accumulate_mutex_);
             clear_clouds_buffer_ = FALSE;
-            cout << "[App LCM] Cleaning cloud buffer of " << accu_->getCounter() << " scans." << endl;
+            AICP_LOG_INFO("App LCM", "Cleaning cloud buffer of " << accu_->getCounter() << " scans.");
         }
 
         if ( accu_->getCounter() > 0 )
@@ -141,42 +203,22 @@ void AppLCM::planarLidarHandler(const lcm::ReceiveBuffer* rbuf,
     }
 
     if ( accu_->getFinished() ){ //finished accumulating?
-        std::cout << "[App LCM] Finished collecting time: " << accu_->getFinishedTime() << std::endl;
+        AICP_LOG_DEBUG("App LCM", "Finished collecting time: " << accu_->getFinishedTime());
 
-        pcl::PointCloud<pcl::PointXYZRGB>::Ptr cloud_pronto (new pcl::PointCloud<pcl::PointXYZRGB> ());
-        pc_vis_->convertCloudProntoToPcl(*accu_->getCloud(), *cloud_pronto);
-        // cloud_pronto = accu_->getCloud();
-        cloud_pronto->width = cloud_pronto->points.size();
-        cloud_pronto->height = 1;
-        cout << "[App LCM] Processing cloud with " << cloud_pronto->points.size() << " points." << endl;
+        pcl::PointCloud<pcl::PointXYZ>::Ptr cloud = accu_->releaseCloud();
+        AICP_LOG_DEBUG("App LCM", "Processing cloud with " << cloud->points.size() << " points.");
 
-        // Push this cloud onto the work queue (mutex safe)
-        const int max_queue_size = 100;
-        {
-            std::unique_lock<std::mutex> lock(data_mutex_);
-            pcl::PointCloud<pcl::PointXYZ>::Ptr cloud(new pcl::PointCloud<pcl::PointXYZ>());
-
-            pcl::copyPointCloud(*cloud_pronto,*cloud);
+        // Populate AlignedCloud data structure
+        AlignedCloudPtr current_cloud (new AlignedCloud(msg->utime,
+                                                        cloud,
+                                                        world_to_body));
+        accu_->clearCloud();
 
-            // Populate AlignedCloud data structure
-            AlignedCloudPtr current_cloud (new AlignedCloud(msg->utime,
-                                                            cloud,
-                                                            world_to_body));
-            // Stack current cloud into queue
-            cloud_queue_.push_back(current_cloud);
-
-            if (cloud_queue_.size() > max_queue_size) {
-                cout << "[App LCM] WARNING: dropping " <<
-                        (cloud_queue_.size()-max_queue_size) << " clouds." << endl;
-            }
-            while (cloud_queue_.size() > max_queue_size) {
-                cloud_queue_.pop_front();
-            }
-            accu_->clearCloud();
+        // Push this cloud onto the work queue (lock-free, notifies operator()())
+        size_t dropped = cloud_queue_.push(current_cloud);
+        if (dropped > 0) {
+            AICP_LOG_WARN("App LCM", "dropping " << dropped << " clouds.");
         }
-
-        // Send notification to operator()() which is waiting for this condition variable
-        worker_condition_.notify_one();
     }
 }
 
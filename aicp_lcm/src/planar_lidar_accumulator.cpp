@@ -0,0 +1,137 @@
+#include "aicp_lcm/planar_lidar_accumulator.hpp"
+#include "aicp_utils/logging.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+
+using PointCloud = aicp::PlanarLidarAccumulator::PointCloud;
+
+namespace aicp {
+
+static ScanAccumulatorConfig getScanAccumulatorConfig(const PlanarLidarAccumulatorConfig& config)
+{
+    ScanAccumulatorConfig scan_config;
+    scan_config.batch_size = config.batch_size;
+    scan_config.min_range = config.min_range;
+    scan_config.max_range = config.max_range;
+    scan_config.voxel_size = config.voxel_size;
+    return scan_config;
+}
+
+PlanarLidarAccumulator::PlanarLidarAccumulator(BotParam* botparam, BotFrames* botframes,
+                                               const PlanarLidarAccumulatorConfig& config) :
+                                               config_(config), botparam_(botparam), botframes_(botframes),
+                                               lidar_frame_(config.lidar_frame), lidar_frequency_(0.0),
+                                               accumulator_(getScanAccumulatorConfig(config))
+{
+    readLidarParams();
+    if (lidar_frame_.empty())
+    {
+        AICP_LOG_WARN("Planar Lidar Accumulator", "No planar lidar on " << config_.lidar_channel
+                      << " in bot_param, using " << config_.lidar_channel << " as lidar frame.");
+        lidar_frame_ = config_.lidar_channel;
+    }
+    AICP_LOG_INFO("Planar Lidar Accumulator", "Accumulating " << config_.batch_size << " scans of "
+                  << lidar_frame_ << " in " << config_.inertial_frame << " frame.");
+}
+
+void PlanarLidarAccumulator::readLidarParams()
+{
+    // planar_lidars { <name> { lcm_channel = ...; coord_frame = ...; frequency = ...; } }
+    char** names = bot_param_get_subkeys(botparam_, "planar_lidars");
+    if (names == NULL)
+        return;
+    for (int i = 0; names[i] != NULL; i++)
+    {
+        const std::string prefix = std::string("planar_lidars.") + names[i];
+        char* channel = NULL;
+        if (bot_param_get_str(botparam_, (prefix + ".lcm_channel").c_str(), &channel) != 0)
+            continue;
+        const bool match = config_.lidar_channel == channel;
+        free(channel);
+        if (!match)
+            continue;
+
+        char* coord_frame = NULL;
+        if (lidar_frame_.empty() &&
+            bot_param_get_str(botparam_, (prefix + ".coord_frame").c_str(), &coord_frame) == 0)
+        {
+            lidar_frame_ = coord_frame;
+            free(coord_frame);
+        }
+        double frequency;
+        if (bot_param_get_double(botparam_, (prefix + ".frequency").c_str(), &frequency) == 0 &&
+            frequency > 0.0)
+            lidar_frequency_ = frequency;
+        break;
+    }
+    bot_param_str_array_free(names);
+}
+
+bool PlanarLidarAccumulator::getLidarPose(int64_t utime, Eigen::Isometry3d& pose)
+{
+    double matx[16];
+    if (!bot_frames_get_trans_mat_4x4_with_utime(botframes_, lidar_frame_.c_str(),
+                                                 config_.inertial_frame.c_str(), utime, matx))
+        return false;
+    for (int i = 0; i < 4; ++i) {
+        for (int j = 0; j < 4; ++j) {
+            pose(i,j) = matx[i*4+j];
+        }
+    }
+    return true;
+}
+
+void PlanarLidarAccumulator::processLidar(const bot_core::planar_lidar_t* msg)
+{
+    if (accumulator_.getFinished())
+        return;
+
+    // Lidar pose at the first beam and at the last beam (motion during the scan)
+    Eigen::Isometry3d pose_start, pose_end;
+    if (!getLidarPose(msg->utime, pose_start))
+    {
+        AICP_LOG_WARN("Planar Lidar Accumulator", "No transform from " << lidar_frame_ << " to "
+                      << config_.inertial_frame << " at " << msg->utime << ", skipping scan.");
+        return;
+    }
+    const int nb_ranges = std::min<int>(msg->nranges, msg->ranges.size());
+    double scan_duration = config_.scan_duration;
+    if (scan_duration < 0.0)
+        scan_duration = (lidar_frequency_ > 0.0 && nb_ranges > 1) ?
+                        (nb_ranges - 1) * std::fabs(msg->radstep) / (2.0 * M_PI) / lidar_frequency_ : 0.0;
+    const int64_t utime_end = msg->utime + (int64_t)(scan_duration * 1E6);
+    if (utime_end == msg->utime || !getLidarPose(utime_end, pose_end))
+        pose_end = pose_start;
+
+    accumulator_.addPlanarScan(msg->ranges.data(), nb_ranges, msg->rad0, msg->radstep,
+                               pose_start, pose_end, msg->utime);
+}
+
+void PlanarLidarAccumulator::clearCloud(){
+    // Capacity kept for the next batch
+    accumulator_.clear();
+}
+
+const PointCloud& PlanarLidarAccumulator::getCloud(){
+    return accumulator_.getCloud();
+}
+
+PointCloud::Ptr PlanarLidarAccumulator::releaseCloud(){
+    return accumulator_.releaseCloud();
+}
+
+uint16_t PlanarLidarAccumulator::getCounter() const{
+    return accumulator_.getCounter();
+}
+
+bool PlanarLidarAccumulator::getFinished() const {
+    return accumulator_.getFinished();
+}
+
+int64_t PlanarLidarAccumulator::getFinishedTime() const{
+    return accumulator_.getFinishedTime();
+}
+
+} // namespace aicp
@@ -1,5 +1,5 @@
 // Run: rosrun aicp aicp-kitti-evaluate -g /media/snobili/SimonaHD/logs/kitti/raw/poses/oxts_poses/
-// -r /home/snobili/data/outDeepLO/out_block_3/ -e exp_b
+// -r /home/snobili/data/outDeepLO/out_block_3/ -e exp_b [-t num_threads]
 
 #include <iostream>
 #include <stdio.h>
@@ -9,8 +9,13 @@
 #include <algorithm>
 #include <iostream>
 #include <string>
+#include <future>
+#include <sstream>
 
-#include "aicp_tools/matrix.h"
+#include <Eigen/Dense>
+#include <Eigen/StdVector>
+
+#include "aicp_utils/threadPool.hpp"
 
 // args
 #include <ConciseArgs>
@@ -21,8 +26,11 @@ struct CommandLineConfig {
   string gt_path;
   string result_path;
   string exp_ids;
+  int num_threads;
 } cl_cfg;
 
+typedef vector<Eigen::Isometry3d, Eigen::aligned_allocator<Eigen::Isometry3d> > Poses;
+
 // static parameter
 // float lengths[] = {5,10,50,100,150,200,250,300,350,400};
 float lengths[] = {100,200,300,400,500,600,700,800};
@@ -38,61 +46,49 @@ struct errors {
     first_frame(first_frame),r_err(r_err),t_err(t_err),len(len),speed(speed) {}
 };
 
-vector<Matrix> loadPoses(string file_name) {
-  vector<Matrix> poses;
+Poses loadPoses(string file_name) {
+  Poses poses;
   FILE *fp = fopen(file_name.c_str(),"r");
   if (!fp)
     return poses;
   while (!feof(fp)) {
-    Matrix P = Matrix::eye(4);
+    Eigen::Matrix4d P = Eigen::Matrix4d::Identity();
     if (fscanf(fp, "%lf %lf %lf %lf %lf %lf %lf %lf %lf %lf %lf %lf",
-                   &P.val[0][0], &P.val[0][1], &P.val[0][2], &P.val[0][3],
-                   &P.val[1][0], &P.val[1][1], &P.val[1][2], &P.val[1][3],
-                   &P.val[2][0], &P.val[2][1], &P.val[2][2], &P.val[2][3] )==12) {
-      poses.push_back(P);
+                   &P(0,0), &P(0,1), &P(0,2), &P(0,3),
+                   &P(1,0), &P(1,1), &P(1,2), &P(1,3),
+                   &P(2,0), &P(2,1), &P(2,2), &P(2,3) )==12) {
+      poses.push_back(Eigen::Isometry3d(P));
     }
   }
   fclose(fp);
   return poses;
 }
 
-vector<float> trajectoryDistances (vector<Matrix> &poses) {
+vector<float> trajectoryDistances (const Poses &poses) {
   vector<float> dist;
+  dist.reserve(poses.size());
   dist.push_back(0);
-  for (int32_t i=1; i<poses.size(); i++) {
-    Matrix P1 = poses[i-1];
-    Matrix P2 = poses[i];
-    float dx = P1.val[0][3]-P2.val[0][3];
-    float dy = P1.val[1][3]-P2.val[1][3];
-    float dz = P1.val[2][3]-P2.val[2][3];
-    dist.push_back(dist[i-1]+sqrt(dx*dx+dy*dy+dz*dz));
-  }
+  for (int32_t i=1; i<poses.size(); i++)
+    dist.push_back(dist[i-1]+(float)(poses[i-1].translation()-poses[i].translation()).norm());
   return dist;
 }
 
-int32_t lastFrameFromSegmentLength(vector<float> &dist,int32_t first_frame,float len) {
-  for (int32_t i=first_frame; i<dist.size(); i++)
-    if (dist[i]>dist[first_frame]+len)
-      return i;
-  return -1;
-}
-
-inline float rotationError(Matrix &pose_error) {
-  float a = pose_error.val[0][0];
-  float b = pose_error.val[1][1];
-  float c = pose_error.val[2][2];
+inline float rotationError(const Eigen::Isometry3d &pose_error) {
+  float a = pose_error(0,0);
+  float b = pose_error(1,1);
+  float c = pose_error(2,2);
   float d = 0.5*(a+b+c-1.0);
   return acos(max(min(d,1.0f),-1.0f));
 }
 
-inline float translationError(Matrix &pose_error) {
-  float dx = pose_error.val[0][3];
-  float dy = pose_error.val[1][3];
-  float dz = pose_error.val[2][3];
+inline float translationError(const Eigen::Isometry3d &pose_error) {
+  float dx = pose_error(0,3);
+  float dy = pose_error(1,3);
+  float dz = pose_error(2,3);
   return sqrt(dx*dx+dy*dy+dz*dz);
 }
 
-vector<errors> calcSequenceErrors (vector<Matrix> &poses_gt,vector<Matrix> &poses_result) {
+vector<errors> calcSequenceErrors (const Poses &poses_gt,const Poses &poses_result) {
 
   // error vector
   vector<errors> err;
@@ -102,9 +98,17 @@ vector<errors> calcSequenceErrors (vector<Matrix> &poses_gt,vector<Matrix> &pose
   
   // pre-compute distances (from ground truth as reference)
   vector<float> dist = trajectoryDistances(poses_gt);
+
+  // last frame of each segment length: first frame further than len from the start,
+  // moves forward only (distances are increasing) => one pass over the trajectory per length
+  vector<int32_t> last_frames(num_lengths, 0);
  
   // for all start positions do
   for (int32_t first_frame=0; first_frame<poses_gt.size(); first_frame+=step_size) {
+
+    // rigid inverses (R^T, -R^T t) computed once per start position
+    Eigen::Isometry3d first_gt_inverse     = poses_gt[first_frame].inverse(Eigen::Isometry);
+    Eigen::Isometry3d first_result_inverse = poses_result[first_frame].inverse(Eigen::Isometry);
   
     // for all segment lengths do
     for (int32_t i=0; i<num_lengths; i++) {
@@ -113,16 +117,19 @@ vector<errors> calcSequenceErrors (vector<Matrix> &poses_gt,vector<Matrix> &pose
       float len = lengths[i];
       
       // compute last frame
-      int32_t last_frame = lastFrameFromSegmentLength(dist,first_frame,len);
+      int32_t& last_frame = last_frames[i];
+      last_frame = max(last_frame, first_frame);
+      while (last_frame<dist.size() && dist[last_frame]<=dist[first_frame]+len)
+        last_frame++;
       
       // continue, if sequence not long enough
-      if (last_frame==-1)
+      if (last_frame==dist.size())
         continue;
 
       // compute rotational and translational errors
-      Matrix pose_delta_gt     = Matrix::inv(poses_gt[first_frame])*poses_gt[last_frame];
-      Matrix pose_delta_result = Matrix::inv(poses_result[first_frame])*poses_result[last_frame];
-      Matrix pose_error        = Matrix::inv(pose_delta_result)*pose_delta_gt;
+      Eigen::Isometry3d pose_delta_gt     = first_gt_inverse*poses_gt[last_frame];
+      Eigen::Isometry3d pose_delta_result = first_result_inverse*poses_result[last_frame];
+      Eigen::Isometry3d pose_error        = pose_delta_result.inverse(Eigen::Isometry)*pose_delta_gt;
       float r_err = rotationError(pose_error);
       float t_err = translationError(pose_error);
       
@@ -153,7 +160,7 @@ void saveSequenceErrors (vector<errors> &err,string file_name) {
   fclose(fp);
 }
 
-void savePathPlot (vector<Matrix> &poses_gt,vector<Matrix> &poses_result,string file_name) {
+void savePathPlot (const Poses &poses_gt,const Poses &poses_result,string file_name) {
 
   // parameters
   int32_t step_size = 3;
@@ -163,30 +170,30 @@ void savePathPlot (vector<Matrix> &poses_gt,vector<Matrix> &poses_result,string
  
   // save x/y coordinates of all frames to file
   for (int32_t i=0; i<poses_gt.size(); i+=step_size)
-    fprintf(fp,"%f %f %f %f\n",poses_gt[i].val[0][3],poses_gt[i].val[1][3],
-                               poses_result[i].val[0][3],poses_result[i].val[1][3]);
+    fprintf(fp,"%f %f %f %f\n",poses_gt[i](0,3),poses_gt[i](1,3),
+                               poses_result[i](0,3),poses_result[i](1,3));
   
   // close file
   fclose(fp);
 }
 
-vector<int32_t> computeRoi (vector<Matrix> &poses_gt,vector<Matrix> &poses_result) {
+vector<int32_t> computeRoi (const Poses &poses_gt,const Poses &poses_result) {
   
   float x_min = numeric_limits<int32_t>::max();
   float x_max = numeric_limits<int32_t>::min();
   float y_min = numeric_limits<int32_t>::max();
   float y_max = numeric_limits<int32_t>::min();
   
-  for (vector<Matrix>::iterator it=poses_gt.begin(); it!=poses_gt.end(); it++) {
-    float x = it->val[0][3];
-    float y = it->val[1][3];
+  for (Poses::const_iterator it=poses_gt.begin(); it!=poses_gt.end(); it++) {
+    float x = it->translation().x();
+    float y = it->translation().y();
     if (x<x_min) x_min = x; if (x>x_max) x_max = x;
     if (y<y_min) y_min = y; if (y>y_max) y_max = y;
   }
   
-  for (vector<Matrix>::iterator it=poses_result.begin(); it!=poses_result.end(); it++) {
-    float x = it->val[0][3];
-    float y = it->val[1][3];
+  for (Poses::const_iterator it=poses_result.begin(); it!=poses_result.end(); it++) {
+    float x = it->translation().x();
+    float y = it->translation().y();
     if (x<x_min) x_min = x; if (x>x_max) x_max = x;
     if (y<y_min) y_min = y; if (y>y_max) y_max = y;
   }
@@ -414,7 +421,7 @@ void plotErrorPlots (string dir,vector<string> &exp_ids,char* idx) {
   }
 }
 
-void saveStats (vector<vector<errors>> err,string dir) {
+void saveStats (const vector<vector<errors>> &err,string dir) {
 
   float t_err = 0;
   float r_err = 0;
@@ -423,7 +430,7 @@ void saveStats (vector<vector<errors>> err,string dir) {
   for (int j=0; j<err.size(); j++)
   {
     // for all errors do => compute sum of t_err, r_err
-    for (vector<errors>::iterator it=err.at(j).begin(); it!=err.at(j).end(); it++) {
+    for (vector<errors>::const_iterator it=err.at(j).begin(); it!=err.at(j).end(); it++) {
       t_err += it->t_err;
       r_err += it->r_err;
       num ++;
@@ -440,7 +447,57 @@ void saveStats (vector<vector<errors>> err,string dir) {
   fclose(fp);
 }
 
-bool eval (string gt_path, string result_path, string exp_ids) {
+struct SequenceResult {
+  bool exists;
+  vector<errors> seq_err;
+  vector<int32_t> roi;
+};
+
+// errors of one experiment on sequence i, written to error_dir and plot_*_dir
+SequenceResult evalSequence (int32_t i,string exp_id,string gt_dir,string result_path,
+                             string error_dir,string plot_path_dir,string plot_error_dir) {
+  SequenceResult result;
+  result.exists = false;
+
+  // input file name
+  char file_name[256];
+  sprintf(file_name,"%02d.txt",i);
+  string result_dir = result_path + exp_id + '/';   // contains predictions
+
+  // read ground truth and result poses
+  Poses poses_gt     = loadPoses(gt_dir + file_name);
+  Poses poses_result = loadPoses(result_dir + "/results/" + file_name);
+
+  // plot status (one line: experiments are processed concurrently)
+  stringstream status;
+  status << "Processing: " << result_dir << file_name << ", poses: " << poses_result.size() << "/" << poses_gt.size() << "\n";
+  cout << status.str() << flush;
+
+  // check for errors
+  if (poses_gt.size()==0 || poses_result.size()!=poses_gt.size()) {
+    cout << "ERROR: Couldn't read (all) poses of: " + result_dir + file_name + "\n" << flush;
+    return result;
+  }
+  result.exists = true;
+
+  // output file name
+  char out_file_name[256];
+  sprintf(out_file_name,"%02d_%s.txt",i,exp_id.c_str());
+
+  // compute sequence errors
+  result.seq_err = calcSequenceErrors(poses_gt,poses_result);
+  saveSequenceErrors(result.seq_err,error_dir + "/" + out_file_name);
+
+  // save bird's eye view trajectories and individual errors
+  savePathPlot(poses_gt,poses_result,plot_path_dir + "/" + out_file_name);
+  result.roi = computeRoi(poses_gt,poses_result);
+  char prefix[256];
+  sprintf(prefix,"%02d_%s",i,exp_id.c_str());
+  saveErrorPlots(result.seq_err,plot_error_dir,prefix);
+  return result;
+}
+
+bool eval (string gt_path, string result_path, string exp_ids, int num_threads) {
   vector<string> exp_ids_vector;
   stringstream ss(exp_ids);
   while( ss.good() )
@@ -475,93 +532,57 @@ bool eval (string gt_path, string result_path, string exp_ids) {
   // total errors
   vector<vector<errors>> total_err_vector(exp_ids_vector.size());
 
-  // for all sequences do
-  for (int32_t i=0; i<11; i++) { //only test sequence:  for (int32_t i=5; i<6; i++) {
-                                //all sequences:       for (int32_t i=0; i<11; i++) {
-    //if ((i == 4) || (i == 5) || (i == 6) || (i == 7) || (i == 10)) //choose test sequences
+  // selected sequences: all sequences: 0 to 10, test sequences: 4, 5, 6, 7, 10
+  vector<int32_t> sequences;
+  for (int32_t i=0; i<11; i++)
     if ((i == 5))
-    {
-      // input file name
-      char file_name[256];
-      sprintf(file_name,"%02d.txt",i);
-
-      vector<int32_t> roi_final;
-
-      for (int j=0; j<exp_ids_vector.size(); j++)
-      {
-        string result_dir = result_path + exp_ids_vector.at(j) + '/';   // contains predictions
-        // plot status
-        cout << "Predictions directory: " << result_dir << endl;
-
-        // read ground truth and result poses
-        vector<Matrix> poses_gt     = loadPoses(gt_dir + file_name);
-        vector<Matrix> poses_result = loadPoses(result_dir + "/results/" + file_name);
-
-        // plot status
-        cout << "Processing: " << file_name << ", poses: " << poses_result.size() << "/" << poses_gt.size() << endl;
-        
-        bool sequence_exists = true;
-        // check for errors
-        if (poses_gt.size()==0 || poses_result.size()!=poses_gt.size()) {
-          cout << "ERROR: Couldn't read (all) poses of: " << file_name << endl;
-          sequence_exists = false;
-        }
-
-        if (sequence_exists)
-        {
-          // output file name
-          char out_file_name[256];
-          sprintf(out_file_name,"%02d_%s.txt",i,exp_ids_vector.at(j).c_str());
-
-          // compute sequence errors
-          vector<errors> seq_err = calcSequenceErrors(poses_gt,poses_result);
-          saveSequenceErrors(seq_err,error_dir + "/" + out_file_name);
-
-          // add to total errors
-          // total_err.insert(total_err.end(),seq_err.begin(),seq_err.end());
-          total_err_vector.at(j).insert(total_err_vector.at(j).end(),seq_err.begin(),seq_err.end());
-
-          // for first half => plot trajectory and compute individual stats
-          if (i<=10) {
-
-            // save + plot bird's eye view trajectories
-            savePathPlot(poses_gt,poses_result,plot_path_dir + "/" + out_file_name);
-            vector<int32_t> roi = computeRoi(poses_gt,poses_result);
-            if (roi_final.empty())
-              roi_final = roi;
-            // else if(roi.at(0) < roi_final.at(0))
-            //   roi_final.at(0) = roi.at(0);
-            // else if(roi.at(1) > roi_final.at(1))
-            //   roi_final.at(1) = roi.at(1);
-            // else if(roi.at(2) < roi_final.at(2))
-            //   roi_final.at(2) = roi.at(2);
-            // else if(roi_final.at(3) > roi.at(3))
-            //   roi_final.at(3) = roi.at(3);
-
-            // plotPathPlot(plot_path_dir,roi,i);
-
-            // save + plot individual errors
-            char prefix[16];
-            sprintf(prefix,"%02d_%s",i,exp_ids_vector.at(j).c_str());
-            saveErrorPlots(seq_err,plot_error_dir,prefix);
-          }
-
-          plotPathPlot(plot_path_dir,result_path,roi_final,exp_ids_vector,i);
-          char prefix[16];
-          sprintf(prefix,"%02d",i);
-          plotErrorPlots(plot_error_dir,exp_ids_vector,prefix);
-        }
-
-        // save
-        if (total_err_vector.size()>0) {
-          char prefix[16];
-          sprintf(prefix,"avg_%s",exp_ids_vector.at(j).c_str());
-          saveErrorPlots(total_err_vector.at(j),plot_error_dir,prefix);
-        }
-      }
+      sequences.push_back(i);
+
+  // (sequence, experiment) pairs evaluated in parallel (independent output files)
+  ThreadPool pool(num_threads);
+  vector<vector<future<SequenceResult>>> results(sequences.size());
+  for (int32_t s=0; s<sequences.size(); s++)
+    for (int j=0; j<exp_ids_vector.size(); j++)
+      results[s].push_back(pool.enqueue([=]() {
+        return evalSequence(sequences[s],exp_ids_vector.at(j),gt_dir,result_path,error_dir,
+                            plot_path_dir,plot_error_dir);
+      }));
+
+  // plots of each sequence, once all its experiments are evaluated
+  vector<future<void>> plots;
+  for (int32_t s=0; s<sequences.size(); s++) {
+    int32_t i = sequences[s];
+    vector<int32_t> roi_final;
+    for (int j=0; j<exp_ids_vector.size(); j++) {
+      SequenceResult result = results[s][j].get();
+      if (!result.exists)
+        continue;
+      // add to total errors
+      total_err_vector.at(j).insert(total_err_vector.at(j).end(),result.seq_err.begin(),result.seq_err.end());
+      if (roi_final.empty())
+        roi_final = result.roi;
     }
+    if (roi_final.empty())
+      continue;
+    plots.push_back(pool.enqueue([=]() {
+      vector<int32_t> roi = roi_final;
+      vector<string> exp_ids = exp_ids_vector;
+      plotPathPlot(plot_path_dir,result_path,roi,exp_ids,i);
+      char prefix[16];
+      sprintf(prefix,"%02d",i);
+      plotErrorPlots(plot_error_dir,exp_ids,prefix);
+    }));
   }
-  
+  for (int32_t p=0; p<plots.size(); p++)
+    plots[p].get();
+
+  // save
+  for (int j=0; j<exp_ids_vector.size(); j++) {
+    char prefix[256];
+    sprintf(prefix,"avg_%s",exp_ids_vector.at(j).c_str());
+    saveErrorPlots(total_err_vector.at(j),plot_error_dir,prefix);
+  }
+
   // plot total errors + summary statistics
   if (total_err_vector.size()>0) {
     char prefix[16];
@@ -586,16 +607,18 @@ int main (int argc, char **argv) {
   cl_cfg.gt_path = "";      // /media/snobili/SimonaHD/logs/kitti/raw/poses/oxts_poses/
   cl_cfg.result_path = "";  // /home/snobili/data/outDeepLO/out_block_3/
   cl_cfg.exp_ids = "";       // exp_a or exp_a,exp_b,exp_c,...
+  cl_cfg.num_threads = 0;    // hardware threads
 
   ConciseArgs parser(argc, argv, "");
   parser.add(cl_cfg.gt_path, "g", "gt_path", "Absolute path to ground truth directory (ends with oxts_poses)");
   parser.add(cl_cfg.result_path, "r", "result_path", "Absolute path to predicted poses directory (ends with out_block_#)");
   parser.add(cl_cfg.exp_ids, "e", "exp_ids", "Experiment names list (e.g. exp_a or exp_a,exp_b,exp_c,...)");
+  parser.add(cl_cfg.num_threads, "t", "num_threads", "Sequences and experiments evaluated in parallel (0: hardware threads)");
 
   parser.parse();
 
   // run evaluation
-  bool success = eval(cl_cfg.gt_path, cl_cfg.result_path, cl_cfg.exp_ids);
+  bool success = eval(cl_cfg.gt_path, cl_cfg.result_path, cl_cfg.exp_ids, cl_cfg.num_threads);
 
   return 0;
 }
@@ -4,15 +4,24 @@
 #include <std_msgs/Float32.h>
 #include <sensor_msgs/PointCloud2.h>
 #include <geometry_msgs/PoseWithCovarianceStamped.h>
+#include <diagnostic_msgs/DiagnosticArray.h>
+#include <tf_conversions/tf_eigen.h>
 
 #include <aicp_srv/ProcessFile.h>
+#include <aicp_srv/LoadMap.h>
+#include <aicp_srv/MapLoadStatus.h>
 #include <std_srvs/Trigger.h>
 
 #include "aicp_registration/app.hpp"
+#include "aicp_registration/app_server.hpp"
+#include "aicp_utils/cloudLog.hpp"
 #include "velodyne_accumulator.hpp"
 #include "visualizer_ros.hpp"
 #include "talker_ros.hpp"
 
+#include <thread>
+#include <condition_variable>
+
 namespace aicp {
 class AppROS : public App {
 public:
@@ -21,12 +30,18 @@ public:
            const VelodyneAccumulatorConfig& va_cfg,
            const RegistrationParams& reg_params,
            const OverlapParams& overlap_params,
-           const ClassificationParams& class_params);
+           const ClassificationParams& class_params,
+           std::shared_ptr<AbstractClassification> classifier = std::shared_ptr<AbstractClassification>());
 
     inline ~AppROS() {
+        // A map being loaded is not interrupted
+        if (map_load_thread_.joinable()) {
+            map_load_thread_.join();
+        }
         if (input_poses_file_.is_open()) {
             input_poses_file_.close();
         }
+        input_clouds_log_.close();
 
         delete accu_;
         delete vis_ros_;
@@ -39,19 +54,30 @@ public:
     void velodyneCallBack(const sensor_msgs::PointCloud2::ConstPtr& laser_msg_in);
     void robotPoseCallBack(const geometry_msgs::PoseWithCovarianceStampedConstPtr& pose_msg_in);
     void interactionMarkerCallBack(const geometry_msgs::PoseStampedConstPtr& init_pose_msg_in);
+    // Timer callback (spinner thread, not the worker)
+    void publishDiagnostics(const ros::TimerEvent& event);
 
     // Advertise services
+    // Map loading returns immediately: the map is loaded and pre-filtered by a background job,
+    // then swapped in (if localization has not started meanwhile)
     bool loadMapFromFileCallBack(aicp_srv::ProcessFile::Request& request, aicp_srv::ProcessFile::Response& response);
-    bool loadMapFromFile(const std::string& file_path);
+    bool loadMapCallBack(aicp_srv::LoadMap::Request& request, aicp_srv::LoadMap::Response& response);
+    bool mapLoadStatusCallBack(aicp_srv::MapLoadStatus::Request& request, aicp_srv::MapLoadStatus::Response& response);
+    // Returns the job id (0: not started)
+    uint32_t loadMapFromFile(const std::string& file_path);
     bool goBackRequestCallBack(std_srvs::Trigger::Request& request, std_srvs::Trigger::Response& response);
     bool goBackRequest();
+    bool reloadClassifierCallBack(aicp_srv::ProcessFile::Request& request, aicp_srv::ProcessFile::Response& response);
 
     void run();
+    // Stream of server (processed by its threads, prior map loaded by this stream is shared)
+    void setServer(AppServer* server) { server_ = server; }
 
 private:
     ros::NodeHandle& nh_;
 
     std::ofstream input_poses_file_;
+    CloudLogWriter input_clouds_log_;
     int input_clouds_counter_;
 
     Eigen::Isometry3d world_to_body_;
@@ -62,9 +88,35 @@ private:
     ros::Publisher overlap_pub_;
     ros::Publisher alignability_pub_;
     ros::Publisher risk_pub_;
+    ros::Publisher diagnostics_pub_;
+    ros::Timer diagnostics_timer_;
+    size_t diagnostics_dropped_; // queue drops at last publish
+
+    // Map loading job (one at a time, status of the latest kept)
+    struct MapLoadJob
+    {
+      uint32_t id;
+      std::string file_path;
+      std::string state;
+      float progress;
+      std::string message;
+    };
+    MapLoadJob map_load_job_;
+    std::mutex map_load_mutex_;
+    std::condition_variable map_load_condition_; // notified on status change
+    std::thread map_load_thread_;
+    void runMapLoad(std::string file_path);
+    // Sets the job status unless the file cannot be opened (returns false)
+    bool openTiledMap(const std::string& file_path, bool publish);
+    // False if localization started (map not set)
+    bool swapPriorMap(pcl::PointCloud<pcl::PointXYZ>::Ptr& map, int64_t utime);
+    AppServer* server_;
+    void setMapLoadStatus(const std::string& state, float progress, const std::string& message = "");
 
     VelodyneAccumulatorROS* accu_;
     VelodyneAccumulatorConfig accu_config_;
+    // Latest pose prior, true if the robot moved enough since the last accumulated cloud
+    bool getMotionSinceLastCloud(Eigen::Isometry3d& world_to_body);
 
     // ROS only visualizer
     ROSVisualizer* vis_ros_;
@@ -14,10 +14,10 @@ class ROSTalker
 public:
     typedef std::vector<Eigen::Isometry3d, Eigen::aligned_allocator<Eigen::Isometry3d>> PathPoses;
 public:
-    ROSTalker(ros::NodeHandle& nh, std::string fixed_frame);
+    ROSTalker(ros::NodeHandle& nh, std::string fixed_frame, const std::string& topic_namespace = "");
 
     // Publish footstep plan
-    void publishFootstepPlan(PathPoses& path,
+    void publishFootstepPlan(const PathPoses& path,
                              int64_t utime,
                              bool reverse_path = false);
     void reversePath(PathPoses& path);
@@ -4,12 +4,16 @@
 #include <pcl_conversions/pcl_conversions.h>
 #include <pcl/point_cloud.h>
 
-#include <tf/transform_listener.h>
-#include <tf_conversions/tf_eigen.h>
+#include <deque>
+
+#include <tf2_ros/buffer.h>
+#include <tf2_ros/transform_listener.h>
 
 //#include <laser_geometry/laser_geometry.h>
 #include <sensor_msgs/PointCloud2.h>
 
+#include "aicp_utils/scanAccumulator.hpp"
+
 namespace aicp {
 
 struct VelodyneAccumulatorConfig
@@ -19,6 +23,9 @@ struct VelodyneAccumulatorConfig
     double min_range = 0.5;
     std::string lidar_topic = "/point_cloud_filter/velodyne/point_cloud_filtered";
     std::string inertial_frame = "/odom";
+    int max_pending_scans = 10; // scans waiting for their transform
+    double transform_timeout = 1.0; // s, scans without transform dropped after (on scan time)
+    double voxel_size = 0.0; // m, points merged into voxel centroids as scans arrive (0: raw points)
 };
 
 class VelodyneAccumulatorROS {
@@ -28,6 +35,7 @@ public:
     VelodyneAccumulatorROS(ros::NodeHandle& nh,
                            const VelodyneAccumulatorConfig& config);
 
+    // Never blocks: scans without transform yet are deferred (bounded buffer)
     void processLidar(const sensor_msgs::PointCloud2::ConstPtr& cloud_in);
 
     // functions to mimick the same behavior of MIT's cloud accumulator class
@@ -38,26 +46,33 @@ public:
     int64_t getFinishedTime() const;
 
     const PointCloud& getCloud();
+    // Hands over the accumulated cloud (no copy), accumulation restarts in a new buffer
+    PointCloud::Ptr releaseCloud();
     void clearCloud();
 
 private:
-    tf::TransformListener listener_;
+    // Accumulates the pending scans whose transform is available (in order)
+    void processPendingScans();
+    void accumulateScan(const sensor_msgs::PointCloud2& cloud_msg, const Eigen::Isometry3d& body_pose_eigen);
+
     VelodyneAccumulatorConfig config_;
 //    laser_geometry::LaserProjection projector_;
 
 //    sensor_msgs::PointCloud2 point_cloud_ros_msg_;
-    sensor_msgs::PointCloud2 cloud_msg_;
 //    pcl::PCLPointCloud2 point_cloud_pcl_msg_;
 
-    // clouds in global frame
-    // implicitly discarding intensities from the clouds
+    // Scan converted with fromROSMsg (only if x, y, z are not float32 fields)
     PointCloud point_cloud_;
-    PointCloud accumulated_point_cloud_;
-    int64_t utime_;
+    // Batch in global frame (crop, transform and voxel reduction)
+    // implicitly discarding intensities from the clouds
+    ScanAccumulator accumulator_;
+    std::deque<sensor_msgs::PointCloud2::ConstPtr> pending_scans_;
+
+    // Filled by the listener's own thread
+    tf2_ros::Buffer tf_buffer_;
+    tf2_ros::TransformListener tf_listener_;
 
     ros::NodeHandle& nh_;
     ros::Subscriber lidar_sub_;
-    bool finished_ = false;
-    uint16_t counter = 0;
 };
 }
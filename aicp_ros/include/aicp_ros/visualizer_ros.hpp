@@ -3,6 +3,8 @@
 #include "ros/node_handle.h"
 
 #include "aicp_utils/visualizer.hpp"
+#include "aicp_utils/cloudCodec.hpp"
+#include "aicp_utils/poseHistory.hpp"
 
 #include <geometry_msgs/PoseStamped.h>
 #include <geometry_msgs/PoseWithCovarianceStamped.h>
@@ -16,13 +18,18 @@
 
 #include <Eigen/StdVector>
 
+#include <mutex>
+
 namespace aicp {
 
 class ROSVisualizer : public Visualizer
 {
 public:
 
-    ROSVisualizer(ros::NodeHandle& nh, std::string fixed_frame);
+    // topic_namespace: prefix of the topics (server stream, e.g. "/robot1")
+    // compressed_resolution > 0: clouds and maps also on <topic>/compressed (CloudCodec, std_msgs/UInt8MultiArray)
+    ROSVisualizer(ros::NodeHandle& nh, std::string fixed_frame, const std::string& topic_namespace = "",
+                  float compressed_resolution = 0.0f);
     ~ROSVisualizer(){}
 
     // Publish cloud
@@ -40,12 +47,18 @@ public:
                     int64_t utime,
                     int channel); // 0 : /aicp/prior_map
                                   // 1 : /aicp/aligned_map
+    // Points added to the aligned map (channel 1) : /aicp/aligned_map_update
+    void publishMapUpdate(pcl::PointCloud<pcl::PointXYZ>::Ptr& cloud,
+                          int64_t utime,
+                          int channel);
 
     // Publish octree
     void publishOctree(octomap::ColorOcTree*& octree,
                        std::string channel_name);
 
-    // Publish corrected poses
+    // Publish corrected poses: pose added to the path, recent poses on <topic>_recent,
+    // full path (older poses decimated, latched) at most every 5 s
+    // (PathPoses: published as is on the full path topic)
     void publishPoses(Eigen::Isometry3d pose,
                       int param, std::string name, int64_t utime);
     void publishPoses(PathPoses poses,
@@ -71,28 +84,46 @@ public:
                                      ros::Time msg_time);
 
     // Gets
-    const PathPoses& getPath(){
-        return path_;
-    }
+    PathSnapshot getPath();
+    bool getLastPose(Eigen::Isometry3d& pose);
+    MemoryUsage getMemoryUsage(){ return paths_memory_.get(); }
 
 private:
     ros::NodeHandle& nh_;
     ros::Publisher cloud_pub_;
     ros::Publisher prior_map_pub_;
     ros::Publisher aligned_map_pub_;
-    ros::Publisher pose_pub_;
-    ros::Publisher odom_pose_pub_;
-    ros::Publisher prior_pose_pub_;
+    ros::Publisher aligned_map_update_pub_;
+    double aligned_map_period_; // s, min time between full aligned map messages
+    ros::WallTime last_aligned_map_time_;
+    // Compressed topics (advertised if compressed_resolution > 0)
+    bool compress_;
+    CloudCodec codec_;
+    ros::Publisher cloud_compressed_pub_;
+    ros::Publisher prior_map_compressed_pub_;
+    ros::Publisher aligned_map_compressed_pub_;
+    ros::Publisher aligned_map_update_compressed_pub_;
 
     ros::Publisher fixed_to_odom_pub_;
     ros::Publisher odom_to_map_pub_;
     
     // Duplicates the list in collections renderer. assumed to be 3xN colors
     std::vector<double> colors_;
-    // Path (vector of poses)
-    PathPoses path_;
-    PathPoses odom_path_;
-    PathPoses prior_path_;
+    // Path: poses history and its topics
+    struct PathTopic
+    {
+        PoseHistory poses;
+        ros::Publisher full_pub;
+        ros::Publisher recent_pub;
+        ros::WallTime last_full_time;
+    };
+    PathTopic path_;
+    PathTopic odom_path_;
+    PathTopic prior_path_;
+    double path_period_; // s, min time between full path messages
+    // Paths extended by the worker and the pose callback, read by services
+    std::mutex paths_mutex_;
+    MemoryCounter paths_memory_; // updated when a pose is added
 
     std::string fixed_frame_; // map or map_test
     std::string odom_frame_;
@@ -106,6 +137,15 @@ private:
     geometry_msgs::PoseWithCovarianceStamped fixed_to_odom_msg_;
     tf::Pose temp_tf_pose_;
 
+    // Encodes cloud on pub if compression is enabled and pub has subscribers
+    void publishCompressed(ros::Publisher& pub, const pcl::PointCloud<pcl::PointXYZ>& cloud, int64_t utime);
+
+    // Adds pose to path, publishes the recent window and the full path when due
+    void publishPath(PathTopic& path, const Eigen::Isometry3d& pose, int64_t utime);
+    void toPathMsg(const PathPoses& poses, int64_t utime, nav_msgs::Path& path_msg);
+
+    void updatePathsMemory(); // paths_mutex_ locked
+
     void computeFixedFrameToOdom(const Eigen::Isometry3d &fixed_frame_to_base_eigen,
                                  Eigen::Isometry3d& fixed_frame_to_odom_eigen);
 };
@@ -1,9 +1,96 @@
 #include "aicp_ros/app_ros.hpp"
 #include "aicp_registration/yaml_configurator.hpp"
+#include "aicp_registration/app_server.hpp"
+#include "aicp_classification/classification.hpp"
 #include "aicp_utils/common.hpp"
 
+#include <ros/ros.h>
+#include <ros/callback_queue.h>
+
 using namespace std;
 
+// Server mode: one AppROS per stream, processed by the threads of an AppServer. The prior map
+// (loaded by the services of the first stream) and the classifier are shared by the streams.
+// Stream parameters under ~<stream>/ (lidar_channel, inertial_frame, pose_body_channel,
+// output_channel, fixed_frame), stream topics under /<stream>/.
+static int runServer(ros::NodeHandle& nh,
+                     const std::vector<std::string>& streams,
+                     int server_threads,
+                     const CommandLineConfig& cl_cfg,
+                     const VelodyneAccumulatorConfig& va_cfg,
+                     const RegistrationParams& reg_params,
+                     const OverlapParams& overlap_params,
+                     const ClassificationParams& classification_params)
+{
+    std::shared_ptr<aicp::AbstractClassification> classifier (aicp::create_classifier(classification_params));
+    aicp::AppServer server(server_threads);
+
+    ros::CallbackQueue lidar_queue, pose_queue, service_queue;
+    ros::NodeHandle lidar_nh(nh), pose_nh(nh), service_nh(nh);
+    lidar_nh.setCallbackQueue(&lidar_queue);
+    pose_nh.setCallbackQueue(&pose_queue);
+    service_nh.setCallbackQueue(&service_queue);
+
+    std::vector<std::shared_ptr<aicp::AppROS> > apps;
+    std::vector<ros::Subscriber> subscribers;
+    std::vector<ros::ServiceServer> services;
+    for (size_t i = 0; i < streams.size(); i++)
+    {
+        const std::string& name = streams[i];
+        CommandLineConfig stream_cl_cfg = cl_cfg;
+        VelodyneAccumulatorConfig stream_va_cfg = va_cfg;
+        stream_cl_cfg.stream_namespace = "/" + name;
+        stream_cl_cfg.map_from_file_path = ""; // loaded once the server is complete
+        nh.getParam(name + "/lidar_channel", stream_va_cfg.lidar_topic);
+        nh.getParam(name + "/inertial_frame", stream_va_cfg.inertial_frame);
+        nh.getParam(name + "/pose_body_channel", stream_cl_cfg.pose_body_channel);
+        nh.getParam(name + "/output_channel", stream_cl_cfg.output_channel);
+        nh.getParam(name + "/fixed_frame", stream_cl_cfg.fixed_frame);
+
+        std::shared_ptr<aicp::AppROS> app(new aicp::AppROS(nh,
+                                                           stream_cl_cfg,
+                                                           stream_va_cfg,
+                                                           reg_params,
+                                                           overlap_params,
+                                                           classification_params,
+                                                           classifier));
+        app->setServer(&server);
+        server.addStream(app);
+        apps.push_back(app);
+
+        subscribers.push_back(lidar_nh.subscribe(stream_va_cfg.lidar_topic, 100, &aicp::AppROS::velodyneCallBack, app.get()));
+        subscribers.push_back(pose_nh.subscribe(stream_cl_cfg.pose_body_channel, 100, &aicp::AppROS::robotPoseCallBack, app.get()));
+        subscribers.push_back(pose_nh.subscribe(stream_cl_cfg.stream_namespace + "/interaction_marker/pose", 100, &aicp::AppROS::interactionMarkerCallBack, app.get()));
+        services.push_back(service_nh.advertiseService(stream_cl_cfg.stream_namespace + "/aicp/go_back_request", &aicp::AppROS::goBackRequestCallBack, app.get()));
+        ROS_INFO_STREAM("[Aicp] Stream " << name << ": " << stream_va_cfg.lidar_topic << ", "
+                        << stream_cl_cfg.pose_body_channel << " -> " << stream_cl_cfg.output_channel);
+    }
+
+    // Shared resources: services of the first stream
+    services.push_back(service_nh.advertiseService("/icp_tools/load_map_from_file", &aicp::AppROS::loadMapFromFileCallBack, apps[0].get()));
+    services.push_back(service_nh.advertiseService("/aicp/load_map", &aicp::AppROS::loadMapCallBack, apps[0].get()));
+    services.push_back(service_nh.advertiseService("/aicp/map_load_status", &aicp::AppROS::mapLoadStatusCallBack, apps[0].get()));
+    services.push_back(service_nh.advertiseService("/aicp/reload_classifier", &aicp::AppROS::reloadClassifierCallBack, apps[0].get()));
+    if (!cl_cfg.map_from_file_path.empty())
+        apps[0]->loadMapFromFile(cl_cfg.map_from_file_path);
+
+    ROS_INFO_STREAM("[Aicp] Waiting for input messages...");
+
+    server.start();
+    // Callbacks of a subscriber are never run concurrently (one thread per stream at most)
+    ros::AsyncSpinner lidar_spinner(std::min(streams.size(), (size_t)std::max(server.getNbThreads(), (size_t)1)), &lidar_queue);
+    ros::AsyncSpinner pose_spinner(1, &pose_queue);
+    ros::AsyncSpinner service_spinner(1, &service_queue);
+    ros::AsyncSpinner spinner(1); // global queue: diagnostics timers
+    lidar_spinner.start();
+    pose_spinner.start();
+    service_spinner.start();
+    spinner.start();
+    ros::waitForShutdown();
+    server.stop();
+    return 0;
+}
+
 int main(int argc, char** argv){
     ros::init(argc, argv, "aicp_ros_node");
     ros::NodeHandle nh("~");
@@ -14,27 +101,53 @@ int main(int argc, char** argv){
     cl_cfg.working_mode = "robot"; // e.g. robot - POSE_BODY has been already corrected
                                    // or debug - apply previous transforms to POSE_BODY
     cl_cfg.fixed_frame = "map";
+    cl_cfg.stream_namespace = ""; // single stream (see streams)
     cl_cfg.load_map_from_file = false; // if enabled, wait for file_path to be sent through a service,
                                        // align first cloud only against map (to visualize final drift)
     cl_cfg.map_from_file_path = "";
+    cl_cfg.map_cache_directory = ""; // pre-filtered maps are cached there, keyed on content and filter parameters
     cl_cfg.localize_against_prior_map = false; // reference is prior map cropped around current pose
     cl_cfg.localize_against_built_map = false; // reference is aligned map cropped around current pose
     cl_cfg.crop_map_around_base = 8.0; // rectangular box dimesions: value*2 x value*2
+    cl_cfg.prior_map_max_match_distance = 1.0; // static prior map (not merged): matches bounded instead of map cropped
     cl_cfg.merge_aligned_clouds_to_map = false; // improves performance if trajectory goes
                                                 // outside map (issue: slow)
 
     cl_cfg.failure_prediction_mode = false; // compute Alignment Risk
+    cl_cfg.parallel_alignment_risk = false; // compute overlap and alignability features in parallel
     cl_cfg.reference_update_frequency = 5;
     cl_cfg.max_correction_magnitude = 0.5; // Max allowed correction magnitude
                                            // (probably failed alignment otherwise)
     cl_cfg.max_queue_size = 3; // maximum length of the queue of accumulated point clouds. was 100 previously
+    cl_cfg.max_map_points = 0; // memory cap of the built map, points far from the robot are dropped (0: unbounded)
+    cl_cfg.graph_memory_budget = 0; // memory cap of the graph clouds (MB), old non-reference clouds are dropped (0: unbounded)
+    cl_cfg.graph_resident_clouds = 10; // last clouds always kept in memory
+    cl_cfg.graph_spill_file = ""; // dropped clouds are written to this file to be re-loadable (empty: not kept)
+    cl_cfg.graph_compact_resolution = 0.0; // clouds out of the resident window stored as 16-bit offsets with this step (m, 0: off)
+    cl_cfg.queue_policy = "drop_oldest"; // when queue is full: drop_oldest, drop_newest or coalesce
+    cl_cfg.cycle_deadline = 0.0; // s, cheaper settings when queue + processing exceeds it (0: disabled)
+    cl_cfg.diagnostics_rate = 1.0; // Hz, /aicp/diagnostics publishing (0: disabled)
+    cl_cfg.compressed_clouds_resolution = 0.0; // m, clouds and maps also on .../compressed topics (0: disabled)
+    cl_cfg.trace_file = ""; // Chrome trace JSON of the processing spans, written on SIGUSR1 and at exit (empty: no tracing)
+    cl_cfg.trace_dump_period = 0.0; // s, trace also written periodically (0: disabled)
+    cl_cfg.pipelined_processing = false; // filter next reading while registering current one
+    cl_cfg.loop_closure_detection = false; // match new references against past ones (separate thread)
+    cl_cfg.pose_graph_optimization = false; // redistribute drift when loops are closed (requires loop_closure_detection)
 
     cl_cfg.pose_body_channel = "/state_estimator/pose_in_odom";
     cl_cfg.output_channel = "/aicp/pose_corrected"; // Create new channel...
     cl_cfg.verbose = false; // enable visualization for debug
+    cl_cfg.log_level = "info";
+    cl_cfg.log_async = true;
+    cl_cfg.debug_queue_size = 10;
+    cl_cfg.debug_binary = true;
     cl_cfg.write_input_clouds_to_file = false; // write the raw incoming point clouds to a folder, for post processing
+    cl_cfg.input_clouds_format = "log"; // "log": single file written in background, "pcd": one file per cloud
+    cl_cfg.input_clouds_resolution = 0.0; // quantization of the logged clouds (0: lossless)
     cl_cfg.process_input_clouds_from_file = false;  // process raw incoming point cloud from a folder
     cl_cfg.process_input_clouds_folder = "/tmp/aicp_data";
+    cl_cfg.replay_prefetch = 4; // clouds read ahead from the folder (0: synchronous)
+    cl_cfg.replay_real_time = false; // pace clouds from the folder by their timestamps (false: max speed)
 
     aicp::VelodyneAccumulatorConfig va_cfg;
     va_cfg.batch_size = 80; // 240 is about 1 sweep at 5RPM // 80 is about 1 sweep at 15RPM
@@ -42,6 +155,9 @@ int main(int argc, char** argv){
     va_cfg.max_range = 15.0; // we can set up to 30 meters (guaranteed range)
     va_cfg.lidar_topic ="/point_cloud_filter/velodyne/point_cloud_filtered";
     va_cfg.inertial_frame = "/odom";
+    va_cfg.max_pending_scans = 10; // scans waiting for their transform (lidar callback never blocks)
+    va_cfg.transform_timeout = 1.0; // s, scans still without transform are dropped
+    cl_cfg.accumulator_voxel_size = 0.04; // scans merged into voxels as they arrive (half the pre-filter leaf size, 0: raw points)
 
     nh.getParam("registration_config_file", cl_cfg.registration_config_file);
     nh.getParam("aicp_config_file", cl_cfg.aicp_config_file);
@@ -49,22 +165,47 @@ int main(int argc, char** argv){
     nh.getParam("fixed_frame", cl_cfg.fixed_frame);
     nh.getParam("load_map_from_file", cl_cfg.load_map_from_file);
     nh.getParam("map_from_file_path", cl_cfg.map_from_file_path);
+    nh.getParam("map_cache_directory", cl_cfg.map_cache_directory);
     nh.getParam("localize_against_prior_map", cl_cfg.localize_against_prior_map);
     nh.getParam("localize_against_built_map", cl_cfg.localize_against_built_map);
     nh.getParam("crop_map_around_base", cl_cfg.crop_map_around_base);
+    nh.getParam("prior_map_max_match_distance", cl_cfg.prior_map_max_match_distance);
     nh.getParam("merge_aligned_clouds_to_map", cl_cfg.merge_aligned_clouds_to_map);
 
     nh.getParam("failure_prediction_mode", cl_cfg.failure_prediction_mode);
+    nh.getParam("parallel_alignment_risk", cl_cfg.parallel_alignment_risk);
     nh.getParam("reference_update_frequency", cl_cfg.reference_update_frequency);
     nh.getParam("max_correction_magnitude", cl_cfg.max_correction_magnitude);
     nh.getParam("max_queue_size", cl_cfg.max_queue_size);
+    nh.getParam("max_map_points", cl_cfg.max_map_points);
+    nh.getParam("graph_memory_budget", cl_cfg.graph_memory_budget);
+    nh.getParam("graph_resident_clouds", cl_cfg.graph_resident_clouds);
+    nh.getParam("graph_spill_file", cl_cfg.graph_spill_file);
+    nh.getParam("graph_compact_resolution", cl_cfg.graph_compact_resolution);
+    nh.getParam("queue_policy", cl_cfg.queue_policy);
+    nh.getParam("cycle_deadline", cl_cfg.cycle_deadline);
+    nh.getParam("diagnostics_rate", cl_cfg.diagnostics_rate);
+    nh.getParam("compressed_clouds_resolution", cl_cfg.compressed_clouds_resolution);
+    nh.getParam("trace_file", cl_cfg.trace_file);
+    nh.getParam("trace_dump_period", cl_cfg.trace_dump_period);
+    nh.getParam("pipelined_processing", cl_cfg.pipelined_processing);
+    nh.getParam("loop_closure_detection", cl_cfg.loop_closure_detection);
+    nh.getParam("pose_graph_optimization", cl_cfg.pose_graph_optimization);
 
     nh.getParam("pose_body_channel", cl_cfg.pose_body_channel);
     nh.getParam("output_channel", cl_cfg.output_channel);
     nh.getParam("verbose", cl_cfg.verbose);
+    nh.getParam("log_level", cl_cfg.log_level);
+    nh.getParam("log_async", cl_cfg.log_async);
+    nh.getParam("debug_queue_size", cl_cfg.debug_queue_size);
+    nh.getParam("debug_binary", cl_cfg.debug_binary);
     nh.getParam("write_input_clouds_to_file", cl_cfg.write_input_clouds_to_file);
+    nh.getParam("input_clouds_format", cl_cfg.input_clouds_format);
+    nh.getParam("input_clouds_resolution", cl_cfg.input_clouds_resolution);
     nh.getParam("process_input_clouds_from_file", cl_cfg.process_input_clouds_from_file);
     nh.getParam("process_input_clouds_folder", cl_cfg.process_input_clouds_folder);
+    nh.getParam("replay_prefetch", cl_cfg.replay_prefetch);
+    nh.getParam("replay_real_time", cl_cfg.replay_real_time);
 
 
     nh.getParam("batch_size", va_cfg.batch_size);
@@ -72,6 +213,10 @@ int main(int argc, char** argv){
     nh.getParam("max_range", va_cfg.max_range);
     nh.getParam("lidar_channel", va_cfg.lidar_topic);
     nh.getParam("inertial_frame", va_cfg.inertial_frame);
+    nh.getParam("max_pending_scans", va_cfg.max_pending_scans);
+    nh.getParam("transform_timeout", va_cfg.transform_timeout);
+    nh.getParam("accumulator_voxel_size", cl_cfg.accumulator_voxel_size);
+    va_cfg.voxel_size = cl_cfg.accumulator_voxel_size;
 
 
 
@@ -102,6 +247,15 @@ int main(int argc, char** argv){
     /*===================================
     =              Start App            =
     ===================================*/
+    // Server mode (see runServer): several streams in this process
+    std::vector<std::string> streams;
+    nh.getParam("streams", streams);
+    int server_threads = 0;
+    nh.getParam("server_threads", server_threads);
+    if (!streams.empty() && !cl_cfg.process_input_clouds_from_file)
+        return runServer(nh, streams, server_threads, cl_cfg, va_cfg, reg_params,
+                         overlap_params, classification_params);
+
     std::shared_ptr<aicp::AppROS> app(new aicp::AppROS(nh,
                                                        cl_cfg,
                                                        va_cfg,
@@ -111,19 +265,38 @@ int main(int argc, char** argv){
 
     if (!cl_cfg.process_input_clouds_from_file){
 
+        // Lidar, pose and services on separate callback queues, each served by its own
+        // spinner thread: a slow lidar callback or service never delays pose republishing
+        ros::CallbackQueue lidar_queue, pose_queue, service_queue;
+        ros::NodeHandle lidar_nh(nh), pose_nh(nh), service_nh(nh);
+        lidar_nh.setCallbackQueue(&lidar_queue);
+        pose_nh.setCallbackQueue(&pose_queue);
+        service_nh.setCallbackQueue(&service_queue);
+
         // Subscribers
-        ros::Subscriber lidar_sub = nh.subscribe(va_cfg.lidar_topic, 100, &aicp::AppROS::velodyneCallBack, app.get());
-        ros::Subscriber pose_sub = nh.subscribe(cl_cfg.pose_body_channel, 100, &aicp::AppROS::robotPoseCallBack, app.get());
-        ros::Subscriber marker_sub = nh.subscribe("/interaction_marker/pose", 100, &aicp::AppROS::interactionMarkerCallBack, app.get());
+        ros::Subscriber lidar_sub = lidar_nh.subscribe(va_cfg.lidar_topic, 100, &aicp::AppROS::velodyneCallBack, app.get());
+        ros::Subscriber pose_sub = pose_nh.subscribe(cl_cfg.pose_body_channel, 100, &aicp::AppROS::robotPoseCallBack, app.get());
+        ros::Subscriber marker_sub = pose_nh.subscribe("/interaction_marker/pose", 100, &aicp::AppROS::interactionMarkerCallBack, app.get());
 
         // Advertise services (using service published by anybotics icp_tools ui)
-        ros::ServiceServer load_map_server_ = nh.advertiseService("/icp_tools/load_map_from_file", &aicp::AppROS::loadMapFromFileCallBack, app.get());
-        ros::ServiceServer go_back_server_ = nh.advertiseService("/aicp/go_back_request", &aicp::AppROS::goBackRequestCallBack, app.get());
+        ros::ServiceServer load_map_server_ = service_nh.advertiseService("/icp_tools/load_map_from_file", &aicp::AppROS::loadMapFromFileCallBack, app.get());
+        ros::ServiceServer load_map_job_server_ = service_nh.advertiseService("/aicp/load_map", &aicp::AppROS::loadMapCallBack, app.get());
+        ros::ServiceServer map_load_status_server_ = service_nh.advertiseService("/aicp/map_load_status", &aicp::AppROS::mapLoadStatusCallBack, app.get());
+        ros::ServiceServer go_back_server_ = service_nh.advertiseService("/aicp/go_back_request", &aicp::AppROS::goBackRequestCallBack, app.get());
+        ros::ServiceServer reload_classifier_server_ = service_nh.advertiseService("/aicp/reload_classifier", &aicp::AppROS::reloadClassifierCallBack, app.get());
 
         ROS_INFO_STREAM("[Aicp] Waiting for input messages...");
 
         app->run();
-        ros::spin();
+        ros::AsyncSpinner lidar_spinner(1, &lidar_queue);
+        ros::AsyncSpinner pose_spinner(1, &pose_queue);
+        ros::AsyncSpinner service_spinner(1, &service_queue);
+        ros::AsyncSpinner spinner(1); // global queue: diagnostics timer
+        lidar_spinner.start();
+        pose_spinner.start();
+        service_spinner.start();
+        spinner.start();
+        ros::waitForShutdown();
 
     }else{
         app->processFromFile(cl_cfg.process_input_clouds_folder);
@@ -4,40 +4,57 @@
 #include "aicp_overlap/overlap.hpp"
 #include "aicp_classification/classification.hpp"
 #include "aicp_utils/common.hpp"
+#include "aicp_utils/logging.hpp"
+#include "aicp_utils/mapCache.hpp"
+#include "aicp_utils/traceRecorder.hpp"
 
 #include <tf_conversions/tf_eigen.h>
 
 #include <pcl/io/ply_io.h>
 
+#include <unistd.h>
+
 namespace aicp {
 
+// Tiles of the cached pre-filtered maps (as aicp_build_tiled_map)
+static const float map_cache_tile_size = 10.0f;
+
 AppROS::AppROS(ros::NodeHandle &nh,
                const CommandLineConfig &cl_cfg,
                const VelodyneAccumulatorConfig &va_cfg,
                const RegistrationParams &reg_params,
                const OverlapParams &overlap_params,
-               const ClassificationParams &class_params) :
-    App(cl_cfg, reg_params, overlap_params, class_params),
-    nh_(nh), accu_config_(va_cfg)
+               const ClassificationParams &class_params,
+               std::shared_ptr<AbstractClassification> classifier) :
+    App(cl_cfg, reg_params, overlap_params, class_params, classifier),
+    nh_(nh), accu_config_(va_cfg), server_(NULL)
 {
     paramInit();
 
     // Data structure
     aligned_clouds_graph_ = new AlignedCloudsGraph();
+    aligned_clouds_graph_->setMemoryBudget((size_t)cl_cfg_.graph_memory_budget * 1024 * 1024,
+                                           cl_cfg_.graph_resident_clouds, cl_cfg_.graph_spill_file,
+                                           cl_cfg_.graph_compact_resolution);
     // Accumulator
     accu_ = new VelodyneAccumulatorROS(nh_, accu_config_);
     // Visualizer
-    vis_ = new ROSVisualizer(nh_, cl_cfg_.fixed_frame);
-    vis_ros_ = new ROSVisualizer(nh_, cl_cfg_.fixed_frame);
+    vis_ = new ROSVisualizer(nh_, cl_cfg_.fixed_frame, cl_cfg_.stream_namespace,
+                             cl_cfg_.compressed_clouds_resolution);
+    vis_ros_ = new ROSVisualizer(nh_, cl_cfg_.fixed_frame, cl_cfg_.stream_namespace,
+                                 cl_cfg_.compressed_clouds_resolution);
     // Talker
-    talk_ros_ = new ROSTalker(nh_, cl_cfg_.fixed_frame);
+    talk_ros_ = new ROSTalker(nh_, cl_cfg_.fixed_frame, cl_cfg_.stream_namespace);
 
     // Init pose to identity
     world_to_body_ = Eigen::Isometry3d::Identity();
     world_to_body_previous_ = Eigen::Isometry3d::Identity();
 
-    // Init prior map
-    loadMapFromFile(cl_cfg_.map_from_file_path);
+    // Init prior map (loaded in background, the interactive marker waits for it)
+    map_load_job_.id = 0;
+    map_load_job_.progress = 0.0;
+    if (!cl_cfg_.map_from_file_path.empty())
+        loadMapFromFile(cl_cfg_.map_from_file_path);
 
     // Pose publisher
     corrected_pose_pub_ = nh_.advertise<geometry_msgs::PoseWithCovarianceStamped>(cl_cfg_.output_channel,10);
@@ -45,22 +62,42 @@ AppROS::AppROS(ros::NodeHandle &nh,
     // Verbose publishers
     if (cl_cfg_.verbose)
     {
-        overlap_pub_ = nh_.advertise<std_msgs::Float32>("/aicp/overlap",10);
-        alignability_pub_ = nh_.advertise<std_msgs::Float32>("/aicp/alignability",10);
-        risk_pub_ = nh_.advertise<std_msgs::Float32>("/aicp/alignment_risk",10);
+        overlap_pub_ = nh_.advertise<std_msgs::Float32>(cl_cfg_.stream_namespace + "/aicp/overlap",10);
+        alignability_pub_ = nh_.advertise<std_msgs::Float32>(cl_cfg_.stream_namespace + "/aicp/alignability",10);
+        risk_pub_ = nh_.advertise<std_msgs::Float32>(cl_cfg_.stream_namespace + "/aicp/alignment_risk",10);
     }
 
-    // Write the incoming data to file. This should be false when running live
-    if (cl_cfg_.write_input_clouds_to_file)
+    // Diagnostics publisher (low rate)
+    diagnostics_dropped_ = 0;
+    if (cl_cfg_.diagnostics_rate > 0.0)
     {
-        ROS_WARN_STREAM("[Aicp] Writing input clouds to file. Only do this in post processing");
-        std::stringstream input_poses_filename;
-        input_poses_filename << data_directory_path_.str() << "/aicp_input_poses.csv";
+        diagnostics_pub_ = nh_.advertise<diagnostic_msgs::DiagnosticArray>(cl_cfg_.stream_namespace + "/aicp/diagnostics",10);
+        diagnostics_timer_ = nh_.createTimer(ros::Duration(1.0 / cl_cfg_.diagnostics_rate),
+                                             &AppROS::publishDiagnostics, this);
+    }
 
-        input_poses_file_.open (input_poses_filename.str().c_str() );
-        input_poses_file_ << "# counter, sec, nsec, x, y, z, qx, qy, qz, qw\n";
-        input_poses_file_.flush();
+    // Write the incoming data to file. Only the log format should be used when running live
+    if (cl_cfg_.write_input_clouds_to_file)
+    {
         input_clouds_counter_ = 0;
+        if (cl_cfg_.input_clouds_format == "log")
+        {
+            // Encoded and written by a background thread
+            std::stringstream input_clouds_filename;
+            input_clouds_filename << data_directory_path_.str() << "/aicp_input_clouds.aicplog";
+            ROS_INFO_STREAM("[Aicp] Writing input clouds to " << input_clouds_filename.str());
+            input_clouds_log_.open(input_clouds_filename.str(), cl_cfg_.input_clouds_resolution);
+        }
+        else
+        {
+            ROS_WARN_STREAM("[Aicp] Writing input clouds to file. Only do this in post processing");
+            std::stringstream input_poses_filename;
+            input_poses_filename << data_directory_path_.str() << "/aicp_input_poses.csv";
+
+            input_poses_file_.open (input_poses_filename.str().c_str() );
+            input_poses_file_ << "# counter, sec, nsec, x, y, z, qx, qy, qz, qw\n";
+            input_poses_file_.flush();
+        }
     }
 
 }
@@ -72,8 +109,11 @@ void AppROS::robotPoseCallBack(const geometry_msgs::PoseWithCovarianceStampedCon
         ROS_WARN_STREAM("[Aicp] Pose initial guess in map not set, waiting for interactive marker...");
         return;
     }
+    ScopedSpan callback_span ("robotPoseCallBack");
 
+    ScopedSpan wait_span ("waitRobotStateMutex");
     std::unique_lock<std::mutex> lock(robot_state_mutex_);
+    wait_span.stop();
     {
         // Latest world -> body (pose prior)
         getPoseAsIsometry3d(pose_msg_in, world_to_body_msg_);
@@ -113,7 +153,9 @@ void AppROS::robotPoseCallBack(const geometry_msgs::PoseWithCovarianceStampedCon
     pose_msg_out.pose.covariance = pose_msg_in->pose.covariance;
     pose_msg_out.header.stamp = pose_msg_in->header.stamp;
     pose_msg_out.header.frame_id = cl_cfg_.fixed_frame;
+    ScopedSpan publish_span ("publishCorrectedPose");
     corrected_pose_pub_.publish(pose_msg_out);
+    publish_span.stop();
 
     if ( updated_correction_ )
     {
@@ -150,6 +192,13 @@ void AppROS::robotPoseCallBack(const geometry_msgs::PoseWithCovarianceStampedCon
 
 
 void AppROS::writeCloudToFile(AlignedCloudPtr cloud){
+    if (input_clouds_log_.isOpen())
+    {
+        input_clouds_log_.append(cloud->getUtime(), cloud->getPriorPose(), cloud->getCloud());
+        input_clouds_counter_++;
+        return;
+    }
+
     // Extract the data from AlignedCloud
     pcl::PointCloud<pcl::PointXYZ>::Ptr point_cloud = cloud->getCloud();
     Eigen::Isometry3d pose = cloud->getPriorPose();
@@ -175,19 +224,122 @@ void AppROS::writeCloudToFile(AlignedCloudPtr cloud){
 }
 
 
+template <typename T>
+static void addKeyValue(diagnostic_msgs::DiagnosticStatus& status, const std::string& key, const T& value)
+{
+    diagnostic_msgs::KeyValue key_value;
+    key_value.key = key;
+    std::stringstream ss;
+    ss << value;
+    key_value.value = ss.str();
+    status.values.push_back(key_value);
+}
+
+void AppROS::publishDiagnostics(const ros::TimerEvent& event)
+{
+    Diagnostics diagnostics = getDiagnostics();
+
+    diagnostic_msgs::DiagnosticStatus status;
+    status.name = "aicp";
+    status.hardware_id = cl_cfg_.fixed_frame;
+    // Falling behind: clouds dropped since last publish or input queue full
+    size_t dropped = diagnostics.queue_dropped - diagnostics_dropped_;
+    diagnostics_dropped_ = diagnostics.queue_dropped;
+    if (dropped > 0 || diagnostics.queue_size >= (size_t)std::max(cl_cfg_.max_queue_size, 1))
+    {
+        status.level = diagnostic_msgs::DiagnosticStatus::WARN;
+        std::stringstream message;
+        message << "Falling behind: " << dropped << " clouds dropped, " << diagnostics.queue_size << " queued";
+        status.message = message.str();
+    }
+    else
+    {
+        status.level = diagnostic_msgs::DiagnosticStatus::OK;
+        status.message = "OK";
+    }
+
+    addKeyValue(status, "readings", diagnostics.nb_readings);
+    addKeyValue(status, "last_reading_utime", diagnostics.utime);
+    addKeyValue(status, "filter_time", diagnostics.filter_time);
+    addKeyValue(status, "assess_time", diagnostics.assess_time);
+    addKeyValue(status, "align_time", diagnostics.align_time);
+    addKeyValue(status, "queue_size", diagnostics.queue_size);
+    addKeyValue(status, "queue_pushed", diagnostics.queue_pushed);
+    addKeyValue(status, "queue_dropped", diagnostics.queue_dropped);
+    addKeyValue(status, "queue_mean_latency", diagnostics.queue_mean_latency);
+    addKeyValue(status, "queue_max_latency", diagnostics.queue_max_latency);
+    addKeyValue(status, "points_in", diagnostics.points_in);
+    addKeyValue(status, "points_out", diagnostics.points_out);
+    addKeyValue(status, "reference_points", diagnostics.reference_points);
+    addKeyValue(status, "icp_iterations", diagnostics.icp_iterations);
+    addKeyValue(status, "icp_coarse_iterations", diagnostics.icp_coarse_iterations);
+    addKeyValue(status, "icp_converged", diagnostics.icp_converged);
+    addKeyValue(status, "icp_warm_start", diagnostics.icp_warm_start);
+    addKeyValue(status, "icp_inlier_ratio", diagnostics.icp_inlier_ratio);
+    addKeyValue(status, "icp_residual_median", diagnostics.icp_residual_median);
+    addKeyValue(status, "icp_residual_p90", diagnostics.icp_residual_p90);
+    addKeyValue(status, "icp_residual_max", diagnostics.icp_residual_max);
+    addKeyValue(status, "icp_degeneracy", diagnostics.icp_degeneracy);
+    addKeyValue(status, "icp_inverse_condition_number", diagnostics.icp_inverse_condition_number);
+    addKeyValue(status, "icp_degenerate_directions", diagnostics.icp_degenerate_directions);
+    addKeyValue(status, "octree_overlap", diagnostics.octree_overlap);
+    addKeyValue(status, "fov_overlap", diagnostics.fov_overlap);
+    addKeyValue(status, "alignability", diagnostics.alignability);
+    addKeyValue(status, "alignment_risk", diagnostics.risk);
+    addKeyValue(status, "compute_level", diagnostics.compute_level);
+    const App::MemoryReport& memory = diagnostics.memory;
+    addKeyValue(status, "memory_graph_bytes", memory.graph.bytes);
+    addKeyValue(status, "memory_graph_clouds", memory.graph.objects);
+    addKeyValue(status, "memory_aligned_map_bytes", memory.aligned_map.bytes);
+    addKeyValue(status, "memory_aligned_map_points", memory.aligned_map.objects);
+    addKeyValue(status, "memory_prior_map_bytes", memory.prior_map.bytes);
+    addKeyValue(status, "memory_prior_map_points", memory.prior_map.objects);
+    addKeyValue(status, "memory_octrees_bytes", memory.octrees.bytes);
+    addKeyValue(status, "memory_octrees", memory.octrees.objects);
+    addKeyValue(status, "memory_paths_bytes", memory.paths.bytes);
+    addKeyValue(status, "memory_paths_poses", memory.paths.objects);
+    addKeyValue(status, "memory_queue_bytes", memory.queue.bytes);
+    addKeyValue(status, "memory_queue_clouds", memory.queue.objects);
+    addKeyValue(status, "memory_total_bytes", memory.getTotalBytes());
+
+    diagnostic_msgs::DiagnosticArray msg;
+    msg.header.stamp = event.current_real;
+    msg.status.push_back(status);
+    diagnostics_pub_.publish(msg);
+}
+
+bool AppROS::getMotionSinceLastCloud(Eigen::Isometry3d& world_to_body)
+{
+    // Pose prior updated by robotPoseCallBack (separate callback queue), lock held for a copy only
+    Eigen::Isometry3d world_to_body_previous;
+    {
+        ScopedSpan wait_span ("waitRobotStateMutex");
+        std::unique_lock<std::mutex> lock(robot_state_mutex_);
+        wait_span.stop();
+        world_to_body = world_to_body_;
+        world_to_body_previous = world_to_body_previous_;
+    }
+
+    // Ensure robot moves between accumulated clouds
+    Eigen::Isometry3d relative_motion = world_to_body_previous.inverse() * world_to_body;
+    double dist = relative_motion.translation().norm();
+    double rpy[3];
+    quat_to_euler(Eigen::Quaterniond(relative_motion.rotation()), rpy[0], rpy[1], rpy[2]);
+
+    return (dist > 1.0) ||
+           fabs(rpy[0]) > (10.0 * M_PI / 180.0) || // condition on roll
+           fabs(rpy[1]) > (10.0 * M_PI / 180.0) || // condition on pitch
+           fabs(rpy[2]) > (10.0 * M_PI / 180.0);   // condition on yaw
+}
+
 void AppROS::velodyneCallBack(const sensor_msgs::PointCloud2::ConstPtr &laser_msg_in){
     if (!pose_initialized_){
         ROS_WARN_STREAM("[Aicp] Pose not initialized, waiting for pose prior...");
         return;
     }
+    ScopedSpan callback_span ("velodyneCallBack");
 
-    // Accumulate planar scans to 3D point cloud (global frame)
-    if (!clear_clouds_buffer_ )
-    {
-        accu_->processLidar(laser_msg_in);
-//        cout << "[App ROS] " << accu_->getCounter() + 1 << " of " << accu_config_.batch_size << " scans collected." << endl;
-    }
-    else
+    if (clear_clouds_buffer_)
     {
         {
             std::unique_lock<std::mutex> lock(cloud_accumulate_mutex_);
@@ -195,63 +347,59 @@ void AppROS::velodyneCallBack(const sensor_msgs::PointCloud2::ConstPtr &laser_ms
 //            cout << "[App ROS] Cleaning cloud buffer of " << accu_->getCounter() << " scans." << endl;
         }
 
-        if ( accu_->getCounter() > 0 )
-            accu_->clearCloud();
+        // Also drops the scans waiting for their transform
+        accu_->clearCloud();
+        return;
     }
 
-    // Ensure robot moves between accumulated clouds
-    Eigen::Isometry3d relative_motion = world_to_body_previous_.inverse() * world_to_body_;
-    double dist = relative_motion.translation().norm();
-    double rpy[3];
-    quat_to_euler(Eigen::Quaterniond(relative_motion.rotation()), rpy[0], rpy[1], rpy[2]);
+    // Motion gate before accumulation (TF lookup, transform, append): a batch starts only once
+    // the robot has moved since the last accumulated cloud, stationary scans are not processed
+    Eigen::Isometry3d world_to_body;
+    if (accu_->getCounter() == 0 && !getMotionSinceLastCloud(world_to_body))
+    {
+        // Scans of a batch not started yet (waiting for their transform) are dropped as well
+        accu_->clearCloud();
+        return;
+    }
+
+    // Accumulate planar scans to 3D point cloud (global frame)
+    ScopedSpan accumulate_span ("processLidar");
+    accu_->processLidar(laser_msg_in);
+    accumulate_span.stop();
+//    cout << "[App ROS] " << accu_->getCounter() + 1 << " of " << accu_config_.batch_size << " scans collected." << endl;
 
     if ( accu_->getFinished() )//finished accumulating?
     {
-        if ((dist > 1.0) ||
-            fabs(rpy[0]) > (10.0 * M_PI / 180.0) || // condition on roll
-            fabs(rpy[1]) > (10.0 * M_PI / 180.0) || // condition on pitch
-            fabs(rpy[2]) > (10.0 * M_PI / 180.0))   // condition on yaw
+        AICP_LOG_DEBUG("App ROS", "Finished collecting time: " << accu_->getFinishedTime());
+
+        // Pose prior at the end of the batch
+        getMotionSinceLastCloud(world_to_body);
+
+        // Accumulator buffer handed over to the AlignedCloud (no copy)
+        pcl::PointCloud<pcl::PointXYZ>::Ptr accumulated_cloud = accu_->releaseCloud();
+        AICP_LOG_DEBUG("App ROS", "Processing cloud with " << accumulated_cloud->points.size() << " points.");
+
+//        vis_->publishCloud(accumulated_cloud, 10, "/aicp/accumulated_cloud", accu_->getFinishedTime());
+
+        // Populate AlignedCloud data structure
+        AlignedCloudPtr current_cloud (new AlignedCloud(accu_->getFinishedTime(),
+                                                        accumulated_cloud,
+                                                        world_to_body));
         {
-            std::cout << "[App ROS] Finished collecting time: " << accu_->getFinishedTime() << std::endl;
-
-            pcl::PointCloud<pcl::PointXYZ>::Ptr accumulated_cloud (new pcl::PointCloud<pcl::PointXYZ> ());
-            *accumulated_cloud = accu_->getCloud();
-            cout << "[App ROS] Processing cloud with " << accumulated_cloud->points.size() << " points." << endl;
-
-//            vis_->publishCloud(accumulated_cloud, 10, "/aicp/accumulated_cloud", accu_->getFinishedTime());
-
-            // Push this cloud onto the work queue (mutex safe)
-            {
-                std::unique_lock<std::mutex> lock(data_mutex_);
-
-                // Populate AlignedCloud data structure
-                AlignedCloudPtr current_cloud (new AlignedCloud(accu_->getFinishedTime(),
-                                                                accumulated_cloud,
-                                                                world_to_body_));
-                world_to_body_previous_ = world_to_body_;
-
-                if (cl_cfg_.write_input_clouds_to_file)
-                    writeCloudToFile(current_cloud);
-
-                // Stack current cloud into queue
-                cloud_queue_.push_back(current_cloud);
-                //cout << "[App ROS] cloud_queue_ size: " << cloud_queue_.size() << endl;
-
-                if (cloud_queue_.size() > cl_cfg_.max_queue_size) {
-                    cout << "|||||||||||||||||||||||||||||||||||||||||||||||||||||||||||\n";
-                    cout << "|||||||||||||||||||||||||||||||||||||||||||||||||||||||||||\n";
-                    cout << "[App ROS] WARNING: dropping " <<
-                            (cloud_queue_.size()-cl_cfg_.max_queue_size) << " clouds." << endl;
-                }
-                while (cloud_queue_.size() > cl_cfg_.max_queue_size) {
-                    cloud_queue_.pop_front();
-                }
-            }
+            std::unique_lock<std::mutex> lock(robot_state_mutex_);
+            world_to_body_previous_ = world_to_body;
         }
-        accu_->clearCloud();
 
-        // Send notification to operator()() which is waiting for this condition variable
-        worker_condition_.notify_one();
+        if (cl_cfg_.write_input_clouds_to_file)
+            writeCloudToFile(current_cloud);
+
+        // Push this cloud onto the work queue (lock-free, notifies operator()())
+        size_t dropped = cloud_queue_.push(current_cloud);
+        if (dropped > 0) {
+            AICP_LOG_WARN("App ROS", "dropping " << dropped << " clouds ("
+                          << cloud_queue_.getStats().dropped << " in total).");
+        }
+        accu_->clearCloud();
     }
 }
 
@@ -272,6 +420,7 @@ void AppROS::interactionMarkerCallBack(const geometry_msgs::PoseStampedConstPtr&
         getPoseAsIsometry3d(init_pose_msg_in, world_to_body_marker_msg_);
 
         pose_marker_initialized_ = true;
+        initialization_pending_ = true;
     }
     else
         ROS_WARN_STREAM("[Aicp] Interactive marker cannot be updated after localization started!");
@@ -279,46 +428,220 @@ void AppROS::interactionMarkerCallBack(const geometry_msgs::PoseStampedConstPtr&
 
 bool AppROS::loadMapFromFileCallBack(aicp_srv::ProcessFile::Request& request, aicp_srv::ProcessFile::Response& response)
 {
-    return response.success = loadMapFromFile(request.file_path);
+    // Synchronous: waits for the job (asynchronous loading with /aicp/load_map)
+    uint32_t job_id = loadMapFromFile(request.file_path);
+    if (job_id == 0)
+        return response.success = false;
+    std::unique_lock<std::mutex> lock(map_load_mutex_);
+    map_load_condition_.wait(lock, [this, job_id]{
+        return map_load_job_.id != job_id ||
+               map_load_job_.state == "done" || map_load_job_.state == "failed"; });
+    return response.success = (map_load_job_.id == job_id && map_load_job_.state == "done");
+}
+
+bool AppROS::loadMapCallBack(aicp_srv::LoadMap::Request& request, aicp_srv::LoadMap::Response& response)
+{
+    response.job_id = loadMapFromFile(request.file_path);
+    return response.success = response.job_id > 0;
+}
+
+bool AppROS::mapLoadStatusCallBack(aicp_srv::MapLoadStatus::Request& request, aicp_srv::MapLoadStatus::Response& response)
+{
+    std::unique_lock<std::mutex> lock(map_load_mutex_);
+    if (request.job_id != 0 && request.job_id != map_load_job_.id){
+        response.job_id = request.job_id;
+        response.state = "failed";
+        response.progress = 0.0;
+        response.message = "unknown job (only the latest job is kept)";
+        return true;
+    }
+    response.job_id = map_load_job_.id;
+    response.state = map_load_job_.state;
+    response.progress = map_load_job_.progress;
+    response.message = map_load_job_.message;
+    return true;
 }
 
-bool AppROS::loadMapFromFile(const std::string& file_path)
+uint32_t AppROS::loadMapFromFile(const std::string& file_path)
 {
     if (!cl_cfg_.load_map_from_file && !cl_cfg_.localize_against_prior_map){
         ROS_WARN_STREAM("[Aicp] Map service disabled!");
-        return false;
+        return 0;
     }
     if (pose_initialized_){
-        pcl::PointCloud<pcl::PointXYZ>::Ptr map = prior_map_->getCloud();
-        vis_->publishMap(map, prior_map_->getUtime(), 0);
+        {
+            std::unique_lock<std::mutex> lock(prior_map_mutex_);
+            pcl::PointCloud<pcl::PointXYZ>::Ptr map = prior_map_->getCloud();
+            vis_->publishMap(map, prior_map_->getUtime(), 0);
+        }
         ROS_WARN_STREAM("[Aicp] Map cannot be updated after localization started!");
+        return 0;
+    }
+
+    std::unique_lock<std::mutex> lock(map_load_mutex_);
+    if (map_load_job_.state == "loading" || map_load_job_.state == "filtering"){
+        ROS_WARN_STREAM("[Aicp] Map '" << map_load_job_.file_path << "' is being loaded (job "
+                        << map_load_job_.id << "), request ignored.");
+        return 0;
+    }
+    if (map_load_thread_.joinable())
+        map_load_thread_.join(); // finished
+    map_load_job_.id ++;
+    map_load_job_.file_path = file_path;
+    map_load_job_.state = "loading";
+    map_load_job_.progress = 0.0;
+    map_load_job_.message = "";
+    map_load_thread_ = std::thread(&AppROS::runMapLoad, this, file_path);
+    ROS_INFO_STREAM("[Aicp] Loading map from '" << file_path << "' (job " << map_load_job_.id << ") ...");
+    return map_load_job_.id;
+}
+
+void AppROS::setMapLoadStatus(const std::string& state, float progress, const std::string& message)
+{
+    std::unique_lock<std::mutex> lock(map_load_mutex_);
+    map_load_job_.state = state;
+    map_load_job_.progress = progress;
+    map_load_job_.message = message;
+    map_load_condition_.notify_all();
+}
+
+bool AppROS::swapPriorMap(pcl::PointCloud<pcl::PointXYZ>::Ptr& map, int64_t utime)
+{
+    // Server stream: map shared by all streams (refused if any stream is localizing)
+    if (server_)
+        return server_->setPriorMap(*map, reg_params_.prefilter.leafSize, cl_cfg_.crop_map_around_base, utime);
+
+    std::unique_lock<std::mutex> state_lock(robot_state_mutex_);
+    if (pose_initialized_)
         return false;
+    std::unique_lock<std::mutex> lock(prior_map_mutex_);
+    setPriorMap(map, utime);
+    return true;
+}
+
+bool AppROS::openTiledMap(const std::string& file_path, bool publish)
+{
+    TiledMapFile tiled_map;
+    if (!tiled_map.open(file_path))
+        return false;
+
+    pcl::PointCloud<pcl::PointXYZ>::Ptr map (new pcl::PointCloud<pcl::PointXYZ>);
+    int64_t utime = ros::Time::now().toNSec() / 1000;
+    bool swapped;
+    if (server_)
+    {
+        // Shared maps are held in memory (tiles not loaded by parts)
+        tiled_map.readAllTiles(*map);
+        swapped = swapPriorMap(map, utime);
+    }
+    else
+    {
+        std::unique_lock<std::mutex> state_lock(robot_state_mutex_);
+        swapped = !pose_initialized_;
+        std::unique_lock<std::mutex> lock(prior_map_mutex_);
+        if (swapped && !setPriorMap(file_path, utime))
+            return false;
+    }
+    if (!swapped){
+        ROS_WARN_STREAM("[Aicp] Localization started during map loading, map discarded.");
+        setMapLoadStatus("failed", 1.0, "localization started during map loading");
+        return true;
+    }
+
+    std::stringstream message;
+    message << "tiled map with " << tiled_map.getNbPoints() << " points in "
+            << tiled_map.getNbTiles() << " tiles";
+    ROS_INFO_STREAM("[Aicp] Opened " << message.str() << ".");
+    setMapLoadStatus("done", 1.0, message.str());
+
+    if (publish)
+    {
+        if (map->empty())
+            tiled_map.readAllTiles(*map);
+        vis_->publishMap(map, utime, 0);
+    }
+    return true;
+}
+
+void AppROS::runMapLoad(std::string file_path)
+{
+    // Tiled map (pre-filtered, see aicp_build_tiled_map): only the index is read,
+    // tiles are loaded around the robot during localization
+    std::string extension = file_path.substr(file_path.find_last_of('.') + 1);
+    if (extension == "aicpmap")
+    {
+        if (!openTiledMap(file_path, false))
+        {
+            ROS_ERROR_STREAM("[Aicp] Error opening tiled map from file!");
+            setMapLoadStatus("failed", 1.0, "cannot open tiled map");
+        }
+        return;
+    }
+
+    // Pre-filtered map cache: a tiled map, keyed on the map content and the filter parameters
+    std::string cache_file;
+    if (!cl_cfg_.map_cache_directory.empty())
+    {
+        std::vector<float> parameters;
+        parameters.push_back(reg_params_.prefilter.mapLeafSize);
+        parameters.push_back(reg_params_.prefilter.leafSize);
+        parameters.push_back(map_cache_tile_size);
+        cache_file = getMapCacheFile(cl_cfg_.map_cache_directory, file_path, parameters);
+        if (!cache_file.empty() && access(cache_file.c_str(), R_OK) == 0)
+        {
+            ROS_INFO_STREAM("[Aicp] Using pre-filtered map from cache '" << cache_file << "'");
+            if (openTiledMap(cache_file, true))
+                return;
+            ROS_WARN_STREAM("[Aicp] Invalid map cache entry, map filtered again.");
+        }
     }
 
-    // Load map from file
-    ROS_INFO_STREAM("[Aicp] Loading map from '" << file_path << "' ...");
+    // Load map from file, 0 to 50 % of the job
+    // (streamed in chunks and voxelized on the fly: the full resolution map is never held in memory)
     pcl::PointCloud<pcl::PointXYZ>::Ptr map (new pcl::PointCloud<pcl::PointXYZ>);
-    if (pcl::io::loadPLYFile<pcl::PointXYZ>(file_path.c_str(), *map) == -1)
+    if (!loadVoxelizedCloudFromFile(file_path, reg_params_.prefilter.mapLeafSize, *map, 1000000,
+                                    [this](float fraction) { setMapLoadStatus("loading", 0.5 * fraction); }))
     {
-      ROS_ERROR_STREAM("[Aicp] Error loading map from file!");
-      return false;
+        ROS_ERROR_STREAM("[Aicp] Error loading map from file!");
+        setMapLoadStatus("failed", 0.5, "cannot load map file");
+        return;
     }
 
-    // Pre-filter map
+    // Pre-filter map (not interruptible, no intermediate progress)
+    setMapLoadStatus("filtering", 0.5);
     pcl::PointCloud<pcl::PointXYZ>::Ptr filtered_map (new pcl::PointCloud<pcl::PointXYZ>);
-    regionGrowingUniformPlaneSegmentationFilter(map, filtered_map);
-    // Populate map object
-    if (map_initialized_)
-        delete prior_map_;
-    prior_map_ = new AlignedCloud(ros::Time::now().toNSec() / 1000,
-                                  filtered_map,
-                                  Eigen::Isometry3d::Identity());
-    ROS_INFO_STREAM("[Aicp] Loaded map with " << prior_map_->getCloud()->points.size() << " points.");
-
-    map_initialized_ = true;
-    vis_->publishMap(map, prior_map_->getUtime(), 0);
+    regionGrowingUniformPlaneSegmentationFilter(map, filtered_map, reg_params_.prefilter.leafSize);
+
+    // Swap in the map object, unless localization started meanwhile (the map is
+    // only set before, see robotPoseCallBack)
+    int64_t utime = ros::Time::now().toNSec() / 1000;
+    if (!swapPriorMap(filtered_map, utime)){
+        ROS_WARN_STREAM("[Aicp] Localization started during map loading, map discarded.");
+        setMapLoadStatus("failed", 1.0, "localization started during map loading");
+        return;
+    }
+    std::stringstream message;
+    message << "map with " << filtered_map->size() << " points";
+    ROS_INFO_STREAM("[Aicp] Loaded " << message.str() << ".");
+    setMapLoadStatus("done", 1.0, message.str());
 
-    return true;
+    vis_->publishMap(map, utime, 0);
+
+    // Next loads of the same map skip the filtering
+    if (!cache_file.empty() && writeMapCacheFile(cache_file, *filtered_map, map_cache_tile_size,
+                                                 reg_params_.prefilter.leafSize))
+        ROS_INFO_STREAM("[Aicp] Pre-filtered map cached in '" << cache_file << "'");
+}
+
+bool AppROS::reloadClassifierCallBack(aicp_srv::ProcessFile::Request& request, aicp_srv::ProcessFile::Response& response)
+{
+    // Empty path: reload model from configured file
+    std::string file_path = request.file_path.empty() ? class_params_.svm.saveFile : request.file_path;
+    ROS_INFO_STREAM("[Aicp] Reloading classifier from '" << file_path << "' ...");
+    response.success = classifier_ && classifier_->load(file_path);
+    if (!response.success)
+        ROS_ERROR_STREAM("[Aicp] Error reloading classifier, previous model kept!");
+    return response.success;
 }
 
 bool AppROS::goBackRequestCallBack(std_srvs::Trigger::Request& request, std_srvs::Trigger::Response& response)
@@ -329,27 +652,26 @@ bool AppROS::goBackRequestCallBack(std_srvs::Trigger::Request& request, std_srvs
 bool AppROS::goBackRequest()
 {
     if (!cl_cfg_.localize_against_prior_map){
-        // Set map to localize against
-        pcl::PointCloud<pcl::PointXYZ>::Ptr aligned_map_ptr = aligned_map_.makeShared();
-        prior_map_ = new AlignedCloud(ros::Time::now().toNSec() / 1000,
-                                      aligned_map_ptr,
-                                      Eigen::Isometry3d::Identity());
+        // Set map to localize against (copied to the prior map)
+        std::unique_lock<std::mutex> lock(aligned_map_mutex_);
+        pcl::PointCloud<pcl::PointXYZ>::Ptr aligned_map_ptr = aligned_map_.getCloud();
+        setPriorMap(aligned_map_ptr, ros::Time::now().toNSec() / 1000);
     }
 
     // Change to localization only settings
     cl_cfg_.localize_against_prior_map = true;
     pose_marker_initialized_ = true;
 
-    // Set path back
-    PathPoses path_forward = vis_->getPath();
+    // Set path back (snapshot shared with the path publisher)
+    Visualizer::PathSnapshot path_forward = vis_->getPath();
 
     ROS_INFO_STREAM("------------------------------- GO BACK -------------------------------");
     ROS_INFO_STREAM("[Aicp] Follow path of "
-                    << path_forward.size()
+                    << path_forward->size()
                     << " poses back to origin.");
     ROS_INFO_STREAM("-----------------------------------------------------------------------");
 
-    talk_ros_->publishFootstepPlan(path_forward, ros::Time::now().toNSec() / 1000, true);
+    talk_ros_->publishFootstepPlan(*path_forward, ros::Time::now().toNSec() / 1000, true);
     pcl::PointCloud<pcl::PointXYZ>::Ptr prior_map_ptr = prior_map_->getCloud();
     vis_->publishMap(prior_map_ptr, prior_map_->getUtime(), 0);
 
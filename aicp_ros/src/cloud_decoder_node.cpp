@@ -0,0 +1,64 @@
+#include "aicp_utils/cloudCodec.hpp"
+
+#include <ros/ros.h>
+#include <pcl_conversions/pcl_conversions.h>
+#include <sensor_msgs/PointCloud2.h>
+#include <std_msgs/UInt8MultiArray.h>
+
+using namespace std;
+
+// Remote side of the compressed topics of ROSVisualizer: decodes ~compressed
+// (e.g. /aicp/aligned_map/compressed) and republishes it on ~cloud as a PointCloud2
+// in ~frame_id (fixed_frame of the AICP node).
+class CloudDecoder
+{
+public:
+    CloudDecoder(ros::NodeHandle& nh)
+    {
+        string frame_id = "map";
+        bool latch = false;
+        nh.getParam("frame_id", frame_id);
+        nh.getParam("latch", latch); // true for the full maps
+        frame_id_ = frame_id;
+
+        cloud_pub_ = nh.advertise<sensor_msgs::PointCloud2>("cloud", 10, latch);
+        compressed_sub_ = nh.subscribe("compressed", 10, &CloudDecoder::compressedCallBack, this);
+    }
+
+    void compressedCallBack(const std_msgs::UInt8MultiArray::ConstPtr& msg)
+    {
+        int64_t utime;
+        if (!CloudCodec::decode(msg->data.data(), msg->data.size(), cloud_, utime))
+        {
+            ROS_WARN_STREAM("[CloudDecoder] Invalid compressed cloud (" << msg->data.size() << " bytes), dropped.");
+            return;
+        }
+
+        int secs = utime * 1E-6;
+        int nsecs = (utime - (secs * 1E6)) * 1E3;
+
+        sensor_msgs::PointCloud2 output;
+        pcl::toROSMsg(cloud_, output);
+        output.header.stamp = ros::Time(secs, nsecs);
+        output.header.frame_id = frame_id_;
+        cloud_pub_.publish(output);
+    }
+
+private:
+    ros::Subscriber compressed_sub_;
+    ros::Publisher cloud_pub_;
+    string frame_id_;
+    // Decoded cloud, reused
+    pcl::PointCloud<pcl::PointXYZ> cloud_;
+};
+
+int main(int argc, char** argv)
+{
+    ros::init(argc, argv, "aicp_cloud_decoder");
+    ros::NodeHandle nh("~");
+
+    CloudDecoder decoder(nh);
+    ros::spin();
+
+    return 0;
+}
@@ -3,16 +3,19 @@
 
 namespace aicp {
 
-ROSTalker::ROSTalker(ros::NodeHandle& nh, std::string fixed_frame) : nh_(nh),
-                                                                     fixed_frame_(fixed_frame)
+ROSTalker::ROSTalker(ros::NodeHandle& nh, std::string fixed_frame,
+                     const std::string& topic_namespace) : nh_(nh),
+                                                           fixed_frame_(fixed_frame)
 {
-    footstep_plan_pub_ = nh_.advertise<geometry_msgs::PoseArray>("/aicp/footstep_plan_request_list",10);
+    footstep_plan_pub_ = nh_.advertise<geometry_msgs::PoseArray>(topic_namespace + "/aicp/footstep_plan_request_list",10);
 }
 
-void ROSTalker::publishFootstepPlan(PathPoses& path,
+void ROSTalker::publishFootstepPlan(const PathPoses& path_in,
                                     int64_t utime,
                                     bool reverse_path){
 
+    // Copy reversed (path_in may be shared)
+    PathPoses path(path_in);
     if(reverse_path)
         reversePath(path);
 
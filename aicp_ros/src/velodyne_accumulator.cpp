@@ -1,17 +1,36 @@
 #include "aicp_ros/velodyne_accumulator.hpp"
 
-#include "aicp_utils/filteringUtils.hpp"
-
 #include <pcl/point_types.h>
 
+#include <algorithm>
+#include <cstring>
+
 using namespace std;
 using PointCloud = aicp::VelodyneAccumulatorROS::PointCloud;
 
 namespace aicp {
 
+static ScanAccumulatorConfig getScanAccumulatorConfig(const VelodyneAccumulatorConfig& config)
+{
+    ScanAccumulatorConfig scan_config;
+    scan_config.batch_size = config.batch_size;
+    scan_config.min_range = config.min_range;
+    scan_config.max_range = config.max_range;
+    scan_config.voxel_size = config.voxel_size;
+    return scan_config;
+}
+
+// tf2 frame ids have no leading slash (tf ones may)
+static std::string tf2FrameId(const std::string& frame_id)
+{
+    return (!frame_id.empty() && frame_id[0] == '/') ? frame_id.substr(1) : frame_id;
+}
+
 VelodyneAccumulatorROS::VelodyneAccumulatorROS(ros::NodeHandle &nh,
                                                const VelodyneAccumulatorConfig &config) :
-                                               nh_(nh), config_(config)
+                                               nh_(nh), config_(config),
+                                               accumulator_(getScanAccumulatorConfig(config)),
+                                               tf_listener_(tf_buffer_)
 {
 //    lidar_sub_ = nh_.subscribe<sensor_msgs::PointCloud2>(config_.lidar_topic,
 //                                                         100,
@@ -21,6 +40,7 @@ VelodyneAccumulatorROS::VelodyneAccumulatorROS(ros::NodeHandle &nh,
 
 void VelodyneAccumulatorROS::setConfig(const VelodyneAccumulatorConfig &config){
     config_ = config;
+    accumulator_.setConfig(getScanAccumulatorConfig(config_));
     lidar_sub_ = nh_.subscribe<sensor_msgs::PointCloud2>(config_.lidar_topic,
                                                          100,
                                                          &VelodyneAccumulatorROS::processLidar,
@@ -28,71 +48,141 @@ void VelodyneAccumulatorROS::setConfig(const VelodyneAccumulatorConfig &config){
 }
 
 
+// Offsets of the x, y, z fields in the points of msg (false if not little-endian float32)
+static bool getXYZOffsets(const sensor_msgs::PointCloud2& msg, uint32_t offsets[3])
+{
+    const char* names[3] = {"x", "y", "z"};
+    for (int k = 0; k < 3; k++)
+    {
+        size_t i = 0;
+        while (i < msg.fields.size() && msg.fields[i].name != names[k])
+            i++;
+        if (i == msg.fields.size() || msg.fields[i].datatype != sensor_msgs::PointField::FLOAT32 ||
+            msg.fields[i].offset + sizeof(float) > msg.point_step)
+            return false;
+        offsets[k] = msg.fields[i].offset;
+    }
+    return !msg.is_bigendian;
+}
+
 void VelodyneAccumulatorROS::processLidar(const sensor_msgs::PointCloud2::ConstPtr& cloud_in)
 {
-    if(finished_){
+    if(accumulator_.getFinished()){
         return;
     }
-    cloud_msg_ = *cloud_in;
-
-    ros::Time msg_time(cloud_msg_.header.stamp.sec, cloud_msg_.header.stamp.nsec);
-    tf::StampedTransform body_pose_tf;
-    try {
-        // waitForTransform( to frame, from frame, ... )
-        listener_.waitForTransform(config_.inertial_frame, cloud_msg_.header.frame_id, msg_time, ros::Duration(1.0));
-        listener_.lookupTransform(config_.inertial_frame, cloud_msg_.header.frame_id, msg_time, body_pose_tf);
-    }
-    catch (tf::TransformException ex)
+    // Scans wait (in arrival order) for their transform instead of blocking the callback
+    pending_scans_.push_back(cloud_in);
+    if (pending_scans_.size() > (size_t)std::max(config_.max_pending_scans, 1))
     {
-        ROS_ERROR("%s : ", ex.what());
-        ROS_ERROR("Skipping point cloud.");
-        return;
+        ROS_WARN_THROTTLE(1.0, "[Aicp] Too many scans waiting for transform, dropping oldest.");
+        pending_scans_.pop_front();
     }
-    Eigen::Isometry3d body_pose_eigen;
-    tf::transformTFToEigen(body_pose_tf, body_pose_eigen);
-
-    // Transform point cloud to global frame
-    pcl::PointCloud<pcl::PointXYZ>::Ptr cloud_tmp(new pcl::PointCloud<pcl::PointXYZ>);
-    pcl::fromROSMsg(*cloud_in,*cloud_tmp);
-
-    // Filter: crop cloud using box (max points distance from sensor's origin)
-    Eigen::Matrix4f tmp = Eigen::MatrixXf::Identity(4, 4);
-    getPointsInOrientedBox(cloud_tmp, -30.0, 30.0, tmp);
-
-    pcl::transformPointCloud(*cloud_tmp, point_cloud_, body_pose_eigen.translation().cast<float>(),
-                             Eigen::Quaternionf(body_pose_eigen.rotation().cast<float>()));
+    processPendingScans();
+}
 
-    // Accumulate
-    accumulated_point_cloud_ += point_cloud_;
-    utime_ = cloud_msg_.header.stamp.toNSec() / 1000;
+void VelodyneAccumulatorROS::processPendingScans()
+{
+    while (!pending_scans_.empty() && !accumulator_.getFinished())
+    {
+        const sensor_msgs::PointCloud2::ConstPtr scan = pending_scans_.front();
+        const ros::Time& msg_time = scan->header.stamp;
+        const std::string inertial_frame = tf2FrameId(config_.inertial_frame);
+        const std::string scan_frame = tf2FrameId(scan->header.frame_id);
+        // Non-blocking: transform available now or deferred to a later scan
+        if (tf_buffer_.canTransform(inertial_frame, scan_frame, msg_time))
+        {
+            pending_scans_.pop_front();
+            geometry_msgs::TransformStamped body_pose_tf;
+            try {
+                body_pose_tf = tf_buffer_.lookupTransform(inertial_frame, scan_frame, msg_time);
+            }
+            catch (tf2::TransformException& ex)
+            {
+                ROS_ERROR("%s : ", ex.what());
+                ROS_ERROR("Skipping point cloud.");
+                continue;
+            }
+            const geometry_msgs::Transform& transform = body_pose_tf.transform;
+            Eigen::Isometry3d body_pose_eigen = Eigen::Isometry3d::Identity();
+            body_pose_eigen.translation() << transform.translation.x, transform.translation.y,
+                                             transform.translation.z;
+            body_pose_eigen.rotate(Eigen::Quaterniond(transform.rotation.w, transform.rotation.x,
+                                                      transform.rotation.y, transform.rotation.z));
+            accumulateScan(*scan, body_pose_eigen);
+            continue;
+        }
+        // Transform still missing after the timeout (relative to the latest scan)
+        if ((pending_scans_.back()->header.stamp - msg_time).toSec() > config_.transform_timeout)
+        {
+            ROS_ERROR_STREAM("[Aicp] No transform from " << scan->header.frame_id << " to "
+                             << config_.inertial_frame << " at " << msg_time << ", skipping point cloud.");
+            pending_scans_.pop_front();
+            continue;
+        }
+        break;
+    }
+}
 
-    // Check number of accumulated clouds
-    if(++counter >= config_.batch_size){
-        finished_ = true;
+void VelodyneAccumulatorROS::accumulateScan(const sensor_msgs::PointCloud2& cloud_msg,
+                                            const Eigen::Isometry3d& body_pose_eigen)
+{
+    // Filter: crop cloud using box (max points distance from sensor's origin) and transform to global frame,
+    // read in place from the message buffer
+    const int64_t utime = cloud_msg.header.stamp.toNSec() / 1000;
+    uint32_t offsets[3];
+    if (getXYZOffsets(cloud_msg, offsets))
+    {
+        const uint8_t* data = cloud_msg.data.data();
+        const uint32_t point_step = cloud_msg.point_step;
+        const uint32_t row_step = cloud_msg.row_step;
+        const uint32_t width = cloud_msg.width;
+        const bool contiguous = row_step == width * point_step; // no row padding
+        accumulator_.addPoints((size_t)cloud_msg.width * cloud_msg.height, [&](size_t i)
+        {
+            const uint8_t* point = contiguous ? data + i * point_step :
+                                                data + (i / width) * row_step + (i % width) * point_step;
+            float xyz[3];
+            for (int k = 0; k < 3; k++)
+                std::memcpy(&xyz[k], point + offsets[k], sizeof(float));
+            return Eigen::Vector3f(xyz[0], xyz[1], xyz[2]);
+        }, body_pose_eigen, utime);
+    }
+    else
+    {
+        pcl::fromROSMsg(cloud_msg, point_cloud_);
+        accumulator_.addPoints(point_cloud_.size(), [&](size_t i)
+        {
+            return Eigen::Vector3f(point_cloud_.points[i].getVector3fMap());
+        }, body_pose_eigen, utime);
     }
 }
 
 void VelodyneAccumulatorROS::clearCloud(){
     point_cloud_.clear();
-    accumulated_point_cloud_.clear();
-    finished_ = false;
-    counter = 0;
+    // Capacity kept for the next batch
+    accumulator_.clear();
+    // Scans taken before the clear are dropped as well
+    pending_scans_.clear();
 }
 
 const PointCloud& VelodyneAccumulatorROS::getCloud(){
-    return accumulated_point_cloud_;
+    return accumulator_.getCloud();
+}
+
+PointCloud::Ptr VelodyneAccumulatorROS::releaseCloud(){
+    return accumulator_.releaseCloud();
 }
 
 uint16_t VelodyneAccumulatorROS::getCounter() const{
-    return counter;
+    return accumulator_.getCounter();
 }
 
 bool VelodyneAccumulatorROS::getFinished() const {
-    return finished_;
+    return accumulator_.getFinished();
 }
 
 int64_t VelodyneAccumulatorROS::getFinishedTime() const{
-    return utime_;
+    return accumulator_.getFinishedTime();
 }
 
 } // namespace aicp
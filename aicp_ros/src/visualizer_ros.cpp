@@ -1,29 +1,53 @@
 #include "aicp_ros/visualizer_ros.hpp"
 
+#include "aicp_utils/traceRecorder.hpp"
+
 #include <pcl_conversions/pcl_conversions.h>
 #include <pcl/point_types.h>
 
 #include <tf_conversions/tf_eigen.h>
 
 #include <sensor_msgs/PointCloud2.h>
+#include <std_msgs/UInt8MultiArray.h>
+
+#include <cstring>
 
 using namespace std;
 
 namespace aicp {
 
-ROSVisualizer::ROSVisualizer(ros::NodeHandle& nh, string fixed_frame) : nh_(nh),
-                                                                        fixed_frame_(fixed_frame)
+ROSVisualizer::ROSVisualizer(ros::NodeHandle& nh, string fixed_frame,
+                             const string& topic_namespace,
+                             float compressed_resolution) : nh_(nh),
+                                                            fixed_frame_(fixed_frame),
+                                                            aligned_map_period_(5.0),
+                                                            compress_(compressed_resolution > 0.0f),
+                                                            codec_(compressed_resolution),
+                                                            path_period_(5.0)
 {
-    cloud_pub_ = nh_.advertise<sensor_msgs::PointCloud2>("/aicp/aligned_cloud", 10);
-    prior_map_pub_ = nh_.advertise<sensor_msgs::PointCloud2>("/aicp/prior_map", 10);
-    aligned_map_pub_ = nh_.advertise<sensor_msgs::PointCloud2>("/aicp/aligned_map", 10);
-    pose_pub_ = nh_.advertise<nav_msgs::Path>("/aicp/poses",100);
-    odom_pose_pub_ = nh_.advertise<nav_msgs::Path>("/aicp/odom_poses",100);
-    prior_pose_pub_ = nh_.advertise<nav_msgs::Path>("/aicp/prior_poses",100);
+    cloud_pub_ = nh_.advertise<sensor_msgs::PointCloud2>(topic_namespace + "/aicp/aligned_cloud", 10);
+    // Full maps latched (late subscribers get the last one)
+    prior_map_pub_ = nh_.advertise<sensor_msgs::PointCloud2>(topic_namespace + "/aicp/prior_map", 1, true);
+    aligned_map_pub_ = nh_.advertise<sensor_msgs::PointCloud2>(topic_namespace + "/aicp/aligned_map", 1, true);
+    aligned_map_update_pub_ = nh_.advertise<sensor_msgs::PointCloud2>(topic_namespace + "/aicp/aligned_map_update", 10);
+    if (compress_)
+    {
+        cloud_compressed_pub_ = nh_.advertise<std_msgs::UInt8MultiArray>(topic_namespace + "/aicp/aligned_cloud/compressed", 10);
+        prior_map_compressed_pub_ = nh_.advertise<std_msgs::UInt8MultiArray>(topic_namespace + "/aicp/prior_map/compressed", 1, true);
+        aligned_map_compressed_pub_ = nh_.advertise<std_msgs::UInt8MultiArray>(topic_namespace + "/aicp/aligned_map/compressed", 1, true);
+        aligned_map_update_compressed_pub_ = nh_.advertise<std_msgs::UInt8MultiArray>(topic_namespace + "/aicp/aligned_map_update/compressed", 10);
+    }
+    // Full paths latched, recent windows at every pose
+    path_.full_pub = nh_.advertise<nav_msgs::Path>(topic_namespace + "/aicp/poses", 1, true);
+    path_.recent_pub = nh_.advertise<nav_msgs::Path>(topic_namespace + "/aicp/poses_recent", 10);
+    odom_path_.full_pub = nh_.advertise<nav_msgs::Path>(topic_namespace + "/aicp/odom_poses", 1, true);
+    odom_path_.recent_pub = nh_.advertise<nav_msgs::Path>(topic_namespace + "/aicp/odom_poses_recent", 10);
+    prior_path_.full_pub = nh_.advertise<nav_msgs::Path>(topic_namespace + "/aicp/prior_poses", 1, true);
+    prior_path_.recent_pub = nh_.advertise<nav_msgs::Path>(topic_namespace + "/aicp/prior_poses_recent", 10);
 
-    fixed_to_odom_pub_ = nh_.advertise<geometry_msgs::PoseWithCovarianceStamped>(fixed_to_odom_prefix_ + fixed_frame_ + "_to_odom", 10);
+    fixed_to_odom_pub_ = nh_.advertise<geometry_msgs::PoseWithCovarianceStamped>(topic_namespace + fixed_to_odom_prefix_ + fixed_frame_ + "_to_odom", 10);
 
-    odom_to_map_pub_ = nh_.advertise<geometry_msgs::PoseWithCovarianceStamped>("/icp_tools/map_pose", 10);
+    odom_to_map_pub_ = nh_.advertise<geometry_msgs::PoseWithCovarianceStamped>(topic_namespace + "/icp_tools/map_pose", 10);
 
     colors_ = {
          51/255.0, 160/255.0, 44/255.0,  //0
@@ -59,32 +83,68 @@ ROSVisualizer::ROSVisualizer(ros::NodeHandle& nh, string fixed_frame) : nh_(nh),
     base_frame_ = "base";
 }
 
+// x, y, z and a constant packed rgb field written straight into the message
+// (no intermediate PointXYZRGB cloud)
+static void toColoredCloudMsg(const pcl::PointCloud<pcl::PointXYZ>& cloud,
+                              uint8_t r, uint8_t g, uint8_t b,
+                              sensor_msgs::PointCloud2& msg)
+{
+    const char* names[4] = {"x", "y", "z", "rgb"};
+    msg.fields.resize(4);
+    for (int k = 0; k < 4; k++)
+    {
+        msg.fields[k].name = names[k];
+        msg.fields[k].offset = 4 * k;
+        msg.fields[k].datatype = sensor_msgs::PointField::FLOAT32;
+        msg.fields[k].count = 1;
+    }
+    msg.height = 1;
+    msg.width = cloud.size();
+    msg.is_bigendian = false;
+    msg.point_step = 16;
+    msg.row_step = msg.point_step * msg.width;
+    msg.is_dense = cloud.is_dense;
+    msg.data.resize(msg.row_step);
+
+    const uint32_t rgb = ((uint32_t)r << 16) | ((uint32_t)g << 8) | (uint32_t)b;
+    uint8_t* data = msg.data.data();
+    for (size_t i = 0; i < cloud.size(); i++, data += msg.point_step)
+    {
+        std::memcpy(data, cloud.points[i].data, 3 * sizeof(float));
+        std::memcpy(data + 12, &rgb, sizeof(uint32_t));
+    }
+}
+
+void ROSVisualizer::publishCompressed(ros::Publisher& pub, const pcl::PointCloud<pcl::PointXYZ>& cloud,
+                                      int64_t utime)
+{
+    if (!compress_ || pub.getNumSubscribers() == 0)
+        return;
+    ScopedSpan span ("publishCompressed");
+
+    // Stamp (utime) and step carried in the encoding, frame: fixed_frame_
+    std_msgs::UInt8MultiArray output;
+    codec_.encode(cloud, utime, output.data);
+    pub.publish(output);
+}
+
 void ROSVisualizer::publishCloud(pcl::PointCloud<pcl::PointXYZ>::Ptr& cloud,
                                  int param, // channel name
                                  string name,
                                  int64_t utime)
 {
-
-    pcl::PointCloud<pcl::PointXYZRGB>::Ptr cloud_rgb (new pcl::PointCloud<pcl::PointXYZRGB>);
-    pcl::copyPointCloud(*cloud, *cloud_rgb);
+    publishCompressed(cloud_compressed_pub_, *cloud, utime);
+    if (cloud_pub_.getNumSubscribers() == 0)
+        return;
+    ScopedSpan span ("publishCloud");
 
     int secs = utime * 1E-6;
     int nsecs = (utime - (secs * 1E6)) * 1E3;
 
     sensor_msgs::PointCloud2 output;
-    int nColor = cloud_rgb->size() % (colors_.size()/3);
-    double r = colors_[nColor*3]*255.0;
-    double g = colors_[nColor*3+1]*255.0;
-    double b = colors_[nColor*3+2]*255.0;
-
-    for (size_t i = 0; i < cloud_rgb->points.size (); i++)
-    {
-        cloud_rgb->points[i].r = r;
-        cloud_rgb->points[i].g = g;
-        cloud_rgb->points[i].b = b;
-    }
-
-    pcl::toROSMsg(*cloud_rgb, output);
+    int nColor = cloud->size() % (colors_.size()/3);
+    toColoredCloudMsg(*cloud, colors_[nColor*3]*255.0, colors_[nColor*3+1]*255.0, colors_[nColor*3+2]*255.0,
+                      output);
 
     //utime has been checked and is correct;
     //cloud is called and it is correct
@@ -97,118 +157,176 @@ void ROSVisualizer::publishMap(pcl::PointCloud<pcl::PointXYZ>::Ptr& cloud,
                                int64_t utime,
                                int channel)
 {
+    if (channel != 0 && channel != 1)
+    {
+        ROS_WARN_STREAM("[ROSVisualizer] Unknown channel. Map not published.");
+        return;
+    }
+    // Prior map: published on change (latched). Aligned map: grows at each reference update,
+    // full map at most every aligned_map_period_ (latched), new points on /aicp/aligned_map_update
+    ros::Publisher& map_pub = channel == 0 ? prior_map_pub_ : aligned_map_pub_;
+    ros::Publisher& map_compressed_pub = channel == 0 ? prior_map_compressed_pub_ : aligned_map_compressed_pub_;
+    if (channel == 1)
+    {
+        ros::WallTime now = ros::WallTime::now();
+        bool subscribed = map_pub.getNumSubscribers() > 0 ||
+                          (compress_ && map_compressed_pub.getNumSubscribers() > 0);
+        if (!subscribed || (now - last_aligned_map_time_).toSec() < aligned_map_period_)
+            return;
+        last_aligned_map_time_ = now;
+    }
 
-    pcl::PointCloud<pcl::PointXYZRGB>::Ptr cloud_rgb (new pcl::PointCloud<pcl::PointXYZRGB>);
-    pcl::copyPointCloud(*cloud, *cloud_rgb);
+    publishCompressed(map_compressed_pub, *cloud, utime);
+    if (channel == 1 && map_pub.getNumSubscribers() == 0)
+        return;
+    ScopedSpan span ("publishMap");
 
     int secs = utime * 1E-6;
     int nsecs = (utime - (secs * 1E6)) * 1E3;
 
     sensor_msgs::PointCloud2 output;
-    for (size_t i = 0; i < cloud_rgb->points.size (); i++)
-    {
-        if (channel == 0)
-        {
-            cloud_rgb->points[i].r = 255.0;
-            cloud_rgb->points[i].g = 255.0;
-            cloud_rgb->points[i].b = 255.0;
-        }
-        else if (channel == 1)
-        {
-            cloud_rgb->points[i].r = 255.0;
-            cloud_rgb->points[i].g = 255.0;
-            cloud_rgb->points[i].b = 0.0;
-        }
-    }
-
-    pcl::toROSMsg(*cloud_rgb, output);
+    if (channel == 0)
+        toColoredCloudMsg(*cloud, 255, 255, 255, output);
+    else
+        toColoredCloudMsg(*cloud, 255, 255, 0, output);
 
     output.header.stamp = ros::Time(secs, nsecs);
     output.header.frame_id = fixed_frame_;
-
-    if (channel == 0)
-        prior_map_pub_.publish(output);
-    else if (channel == 1)
-        aligned_map_pub_.publish(output);
-    else
-        ROS_WARN_STREAM("[ROSVisualizer] Unknown channel. Map not published.");
+    map_pub.publish(output);
 }
 
-void ROSVisualizer::publishPoses(Eigen::Isometry3d pose, int param, std::string name, int64_t utime)
+void ROSVisualizer::publishMapUpdate(pcl::PointCloud<pcl::PointXYZ>::Ptr& cloud,
+                                     int64_t utime,
+                                     int channel)
 {
-    path_.push_back(pose);
-    publishPoses(path_, param, name, utime);
+    if (channel != 1)
+        return;
+    publishCompressed(aligned_map_update_compressed_pub_, *cloud, utime);
+    if (aligned_map_update_pub_.getNumSubscribers() == 0)
+        return;
+    ScopedSpan span ("publishMapUpdate");
+
+    int secs = utime * 1E-6;
+    int nsecs = (utime - (secs * 1E6)) * 1E3;
+
+    sensor_msgs::PointCloud2 output;
+    toColoredCloudMsg(*cloud, 255, 255, 0, output);
+    output.header.stamp = ros::Time(secs, nsecs);
+    output.header.frame_id = fixed_frame_;
+    aligned_map_update_pub_.publish(output);
 }
 
-void ROSVisualizer::publishPoses(PathPoses poses, int param, string name, int64_t utime){
+void ROSVisualizer::updatePathsMemory()
+{
+    MemoryUsage usage = path_.poses.getMemoryUsage();
+    usage += odom_path_.poses.getMemoryUsage();
+    usage += prior_path_.poses.getMemoryUsage();
+    paths_memory_.set(usage);
+}
 
-    nav_msgs::Path path_msg;
+void ROSVisualizer::toPathMsg(const PathPoses& poses, int64_t utime, nav_msgs::Path& path_msg)
+{
     int secs = utime*1E-6;
     int nsecs = (utime - (secs*1E6))*1E3;
     path_msg.header.stamp = ros::Time(secs, nsecs);
     path_msg.header.frame_id = fixed_frame_;
 
+    path_msg.poses.resize(poses.size());
     for (size_t i = 0; i < poses.size(); ++i){
-        geometry_msgs::PoseStamped m;
-        m.header.stamp = ros::Time(secs, nsecs);
-        m.header.frame_id = fixed_frame_;
+        geometry_msgs::PoseStamped& m = path_msg.poses[i];
+        m.header = path_msg.header;
         tf::poseEigenToMsg(poses[i], m.pose);
-        path_msg.poses.push_back(m);
     }
+}
 
-    pose_pub_.publish(path_msg);
+void ROSVisualizer::publishPath(PathTopic& path, const Eigen::Isometry3d& pose, int64_t utime)
+{
+    ScopedSpan span ("publishPath");
+    // Messages built out of the lock from the recent window and the shared snapshot
+    PathPoses recent;
+    PoseHistory::Snapshot full_path;
+    {
+        std::unique_lock<std::mutex> lock(paths_mutex_);
+        path.poses.push_back(pose);
+        if (path.recent_pub.getNumSubscribers() > 0)
+            path.poses.getRecent(recent);
+        ros::WallTime now = ros::WallTime::now();
+        if ((now - path.last_full_time).toSec() >= path_period_)
+        {
+            full_path = path.poses.getSnapshot();
+            path.last_full_time = now;
+        }
+        updatePathsMemory();
+    }
+
+    if (!recent.empty())
+    {
+        nav_msgs::Path path_msg;
+        toPathMsg(recent, utime, path_msg);
+        path.recent_pub.publish(path_msg);
+    }
+    if (full_path)
+    {
+        nav_msgs::Path path_msg;
+        toPathMsg(*full_path, utime, path_msg);
+        path.full_pub.publish(path_msg);
+    }
+}
+
+void ROSVisualizer::publishPoses(Eigen::Isometry3d pose, int param, std::string name, int64_t utime)
+{
+    publishPath(path_, pose, utime);
+}
+
+void ROSVisualizer::publishPoses(PathPoses poses, int param, string name, int64_t utime){
+
+    nav_msgs::Path path_msg;
+    toPathMsg(poses, utime, path_msg);
+    path_.full_pub.publish(path_msg);
 }
 
 
 void ROSVisualizer::publishOdomPoses(Eigen::Isometry3d pose, int param, std::string name, int64_t utime)
 {
-    odom_path_.push_back(pose);
-    publishOdomPoses(odom_path_, param, name, utime);
+    publishPath(odom_path_, pose, utime);
 }
 
 void ROSVisualizer::publishOdomPoses(PathPoses poses, int param, string name, int64_t utime){
 
     nav_msgs::Path path_msg;
-    int secs = utime*1E-6;
-    int nsecs = (utime - (secs*1E6))*1E3;
-    path_msg.header.stamp = ros::Time(secs, nsecs);
-    path_msg.header.frame_id = fixed_frame_;
-
-    for (size_t i = 0; i < poses.size(); ++i){
-        geometry_msgs::PoseStamped m;
-        m.header.stamp = ros::Time(secs, nsecs);
-        m.header.frame_id = fixed_frame_;
-        tf::poseEigenToMsg(poses[i], m.pose);
-        path_msg.poses.push_back(m);
-    }
-
-    odom_pose_pub_.publish(path_msg);
+    toPathMsg(poses, utime, path_msg);
+    odom_path_.full_pub.publish(path_msg);
 }
 
 
 void ROSVisualizer::publishPriorPoses(Eigen::Isometry3d pose, int param, std::string name, int64_t utime)
 {
-    prior_path_.push_back(pose);
-    publishPriorPoses(odom_path_, param, name, utime);
+    publishPath(prior_path_, pose, utime);
 }
 
 void ROSVisualizer::publishPriorPoses(PathPoses poses, int param, string name, int64_t utime){
 
     nav_msgs::Path path_msg;
-    int secs = utime*1E-6;
-    int nsecs = (utime - (secs*1E6))*1E3;
-    path_msg.header.stamp = ros::Time(secs, nsecs);
-    path_msg.header.frame_id = fixed_frame_;
+    toPathMsg(poses, utime, path_msg);
+    prior_path_.full_pub.publish(path_msg);
+}
 
-    for (size_t i = 0; i < poses.size(); ++i){
-        geometry_msgs::PoseStamped m;
-        m.header.stamp = ros::Time(secs, nsecs);
-        m.header.frame_id = fixed_frame_;
-        tf::poseEigenToMsg(poses[i], m.pose);
-        path_msg.poses.push_back(m);
-    }
 
-    prior_pose_pub_.publish(path_msg);
+Visualizer::PathSnapshot ROSVisualizer::getPath()
+{
+    std::unique_lock<std::mutex> lock(paths_mutex_);
+    PathSnapshot snapshot = path_.poses.getSnapshot();
+    updatePathsMemory();
+    return snapshot;
+}
+
+bool ROSVisualizer::getLastPose(Eigen::Isometry3d& pose)
+{
+    std::unique_lock<std::mutex> lock(paths_mutex_);
+    if (path_.poses.empty())
+        return false;
+    pose = path_.poses.back();
+    return true;
 }
 
 
@@ -31,6 +31,8 @@ do
       # echo "---------------------------------------------------------"
       FILECOUNT=$[$FILECOUNT+1]
     done
+    # Batch ground removal of the whole sequence (binary pcd, in place):
+    # aicp_remove_ground --output $1${seq_name}/pcd $1${seq_name}/pcd
   fi
   SEQCOUNT=$[$SEQCOUNT+1]
 done
@@ -2,6 +2,7 @@
 # Run: bash run_registration_validation.sh <path_to_clouds>
 # You must be in the folder of the bash
 # The clouds must be at <path_to_clouds>
+# (aicp_batch_registration runs the same jobs in one process, see src/tools/batch_registration.cpp)
 cwd=$(pwd)
 mkdir -p $1/validation;
 filenameA=cube_cloud_00